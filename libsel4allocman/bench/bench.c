@@ -0,0 +1,622 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Latency and throughput of the utspace, cspace and mspace allocators.
+ *
+ * Each run builds a private allocman out of the allocator under test, with the
+ * other two proxied to the vka of the test, and allocates and frees a number of
+ * objects in one of the patterns below, timing each operation with the cycle
+ * counter. Work the allocator does not do, such as deleting the cap to an object
+ * before freeing its memory, is left out of the timing. The distributions of
+ * allocation and free latencies are reported as separate series of the suite, in
+ * cycles and checked against their baselines, followed by the throughput of the run in operations per
+ * million cycles of allocator time and the number of allocations that failed.
+ * Only the setting up of each allocator is tested, running out of memory is a
+ * result like any other.
+ *
+ * LIFO     allocate every object, then free them newest first
+ * FIFO     allocate every object, then free them oldest first
+ * RANDOM   allocate every object, then free them in a random order
+ * MIXED    as RANDOM, with object sizes drawn from a range
+ * FRAGMENT allocate every object, free every other one, allocate half as many
+ *          objects of twice the size, which do not fit in the holes, then free
+ *          what is left oldest first
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <sel4/sel4.h>
+#include <sel4bench/sel4bench.h>
+#include <vka/capops.h>
+#include <vka/object.h>
+#include <vspace/vspace.h>
+#include <allocman/allocman.h>
+#include <allocman/cspace/vka.h>
+#include <allocman/cspace/single_level.h>
+#include <allocman/cspace/two_level.h>
+#include <allocman/utspace/vka.h>
+#include <allocman/utspace/split.h>
+#include <allocman/utspace/twinkle.h>
+#include <allocman/mspace/fixed_pool.h>
+#include <allocman/mspace/virtual_pool.h>
+#include <allocman/mspace/vspace_pool.h>
+#include <allocman/mspace/dual_pool.h>
+
+#include <sel4test/benchmark.h>
+#include <sel4test/test.h>
+#include <sel4test/testutil.h>
+
+/* objects allocated in the first phase of every pattern */
+#define ALLOCMAN_BENCH_N_OBJECTS    64
+#define ALLOCMAN_BENCH_MAX_OBJECTS  (ALLOCMAN_BENCH_N_OBJECTS + ALLOCMAN_BENCH_N_OBJECTS / 2)
+
+/* memory of the fixed pools, and size of the virtual ones */
+#define ALLOCMAN_BENCH_POOL_SIZE    BIT(18)
+
+/* both cspaces have 4096 slots */
+#define ALLOCMAN_BENCH_CNODE_BITS   12
+#define ALLOCMAN_BENCH_L1_BITS      4
+
+typedef enum bench_pattern {
+    BENCH_LIFO,
+    BENCH_FIFO,
+    BENCH_RANDOM,
+    BENCH_MIXED,
+    BENCH_FRAGMENT,
+    BENCH_NUM_PATTERNS
+} bench_pattern_t;
+
+static const char *bench_pattern_names[BENCH_NUM_PATTERNS] = {
+    [BENCH_LIFO] = "lifo",
+    [BENCH_FIFO] = "fifo",
+    [BENCH_RANDOM] = "random",
+    [BENCH_MIXED] = "mixed",
+    [BENCH_FRAGMENT] = "fragment",
+};
+
+typedef struct bench_object {
+    bool allocated;
+    size_t size_bits;
+    /* which of these are used depends on the allocator */
+    seL4_Word cookie;
+    cspacepath_t path;
+    void *ptr;
+} bench_object_t;
+
+typedef struct bench bench_t;
+
+typedef struct bench_ops {
+    /* allocate an object of object->size_bits, setting cycles to the time the
+     * allocator took. Returns 0 on success */
+    int (*alloc)(bench_t *bench, bench_object_t *object, ccnt_t *cycles);
+    void (*free)(bench_t *bench, bench_object_t *object, ccnt_t *cycles);
+} bench_ops_t;
+
+struct bench {
+    env_t env;
+    allocman_t alloc;
+    const bench_ops_t *ops;
+    char name[64];
+    /* size of the objects of a run, MIXED draws them from [min_bits, max_bits] */
+    size_t min_bits, max_bits;
+};
+
+static bench_t bench;
+static bench_object_t bench_objects[ALLOCMAN_BENCH_MAX_OBJECTS];
+static size_t bench_order[ALLOCMAN_BENCH_MAX_OBJECTS];
+static ccnt_t bench_alloc_samples[ALLOCMAN_BENCH_MAX_OBJECTS];
+static ccnt_t bench_free_samples[ALLOCMAN_BENCH_MAX_OBJECTS];
+/* cost of reading the cycle counter around nothing */
+static ccnt_t bench_overhead;
+
+static char bench_pool_mem[ALLOCMAN_BENCH_POOL_SIZE];
+static mspace_fixed_pool_t bench_fixed_pool;
+
+/* A fixed seed, so that every allocator sees the same sequence */
+static uint32_t bench_seed;
+
+static uint32_t bench_rand(void)
+{
+    /* xorshift32 */
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static void bench_shuffle(size_t *order, size_t n)
+{
+    for (size_t i = n; i > 1; i--) {
+        size_t j = bench_rand() % i;
+        size_t tmp = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = tmp;
+    }
+}
+
+static void bench_calibrate(void)
+{
+    bench_overhead = sel4test_benchmark_overhead(bench_alloc_samples, ARRAY_SIZE(bench_alloc_samples));
+}
+
+static void bench_report(const char *op, ccnt_t *samples, size_t n)
+{
+    char name[96];
+
+    snprintf(name, sizeof(name), "%s %s", bench.name, op);
+    sel4test_report_benchmark(name, samples, n, bench_overhead, NULL);
+}
+
+static void bench_alloc(bench_object_t *object, size_t size_bits, size_t *n_allocs, size_t *failed,
+                        ccnt_t *total)
+{
+    ccnt_t cycles;
+
+    object->size_bits = size_bits;
+    object->allocated = bench.ops->alloc(&bench, object, &cycles) == 0;
+    if (object->allocated) {
+        bench_alloc_samples[(*n_allocs)++] = cycles;
+        *total += cycles;
+    } else {
+        (*failed)++;
+    }
+}
+
+static void bench_free(bench_object_t *object, size_t *n_frees, ccnt_t *total)
+{
+    ccnt_t cycles;
+
+    if (!object->allocated) {
+        return;
+    }
+    bench.ops->free(&bench, object, &cycles);
+    object->allocated = false;
+    bench_free_samples[(*n_frees)++] = cycles;
+    *total += cycles;
+}
+
+/* Run one pattern against the allocator set up in bench, which is left with
+ * everything freed */
+static void bench_pattern(bench_pattern_t pattern)
+{
+    size_t n = ALLOCMAN_BENCH_N_OBJECTS;
+    size_t n_allocs = 0, n_frees = 0, failed = 0;
+    ccnt_t total = 0;
+    char *base_end = bench.name + strlen(bench.name);
+
+    snprintf(base_end, sizeof(bench.name) - (base_end - bench.name), " %s", bench_pattern_names[pattern]);
+    bench_seed = 0x2545f491;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t size_bits = bench.min_bits;
+        if (pattern == BENCH_MIXED) {
+            size_bits += bench_rand() % (bench.max_bits - bench.min_bits + 1);
+        }
+        bench_alloc(&bench_objects[i], size_bits, &n_allocs, &failed, &total);
+        bench_order[i] = i;
+    }
+
+    switch (pattern) {
+    case BENCH_LIFO:
+        for (size_t i = 0; i < n; i++) {
+            bench_order[i] = n - 1 - i;
+        }
+        break;
+    case BENCH_RANDOM:
+    case BENCH_MIXED:
+        bench_shuffle(bench_order, n);
+        break;
+    case BENCH_FRAGMENT:
+        for (size_t i = 1; i < n; i += 2) {
+            bench_free(&bench_objects[i], &n_frees, &total);
+        }
+        for (size_t i = n; i < ALLOCMAN_BENCH_MAX_OBJECTS; i++) {
+            bench_alloc(&bench_objects[i], bench.min_bits + 1, &n_allocs, &failed, &total);
+            bench_order[i] = i;
+        }
+        n = ALLOCMAN_BENCH_MAX_OBJECTS;
+        break;
+    default:
+        break;
+    }
+    for (size_t i = 0; i < n; i++) {
+        bench_free(&bench_objects[bench_order[i]], &n_frees, &total);
+    }
+
+    bench_report("alloc", bench_alloc_samples, n_allocs);
+    bench_report("free", bench_free_samples, n_frees);
+    printf("allocman bench: %s: %zu ops, %"PRIu64" ops/Mcycle, %zu failed\n", bench.name,
+           n_allocs + n_frees, total > 0 ? (uint64_t)(n_allocs + n_frees) * 1000000 / total : 0, failed);
+    *base_end = '\0';
+}
+
+static void bench_create(env_t env, const bench_ops_t *ops, struct mspace_interface mspace)
+{
+    bench.env = env;
+    bench.ops = ops;
+    allocman_create(&bench.alloc, mspace);
+}
+
+/* The allocman keeps its bookkeeping in a fixed pool, unless it is the mspace
+ * under test */
+static struct mspace_interface bench_bookkeeping(void)
+{
+    mspace_fixed_pool_create(&bench_fixed_pool, (struct mspace_fixed_pool_config) {
+        .pool = bench_pool_mem,
+        .size = sizeof(bench_pool_mem),
+    });
+    return mspace_fixed_pool_make_interface(&bench_fixed_pool);
+}
+
+static int ut_alloc(bench_t *b, bench_object_t *object, ccnt_t *cycles)
+{
+    ccnt_t start, end;
+    int error;
+
+    error = vka_cspace_alloc_path(&b->env->vka, &object->path);
+    if (error) {
+        return error;
+    }
+    SEL4BENCH_READ_CCNT(start);
+    object->cookie = allocman_utspace_alloc(&b->alloc, object->size_bits, seL4_UntypedObject,
+                                            &object->path, false, &error);
+    SEL4BENCH_READ_CCNT(end);
+    if (error) {
+        vka_cspace_free_path(&b->env->vka, object->path);
+        return error;
+    }
+    *cycles = end - start;
+    return 0;
+}
+
+static void ut_free(bench_t *b, bench_object_t *object, ccnt_t *cycles)
+{
+    ccnt_t start, end;
+
+    vka_cnode_delete(&object->path);
+    SEL4BENCH_READ_CCNT(start);
+    allocman_utspace_free(&b->alloc, object->cookie, object->size_bits);
+    SEL4BENCH_READ_CCNT(end);
+    vka_cspace_free_path(&b->env->vka, object->path);
+    *cycles = end - start;
+}
+
+static const bench_ops_t ut_ops = {
+    .alloc = ut_alloc,
+    .free = ut_free,
+};
+
+static int cs_alloc(bench_t *b, bench_object_t *object, ccnt_t *cycles)
+{
+    ccnt_t start, end;
+
+    SEL4BENCH_READ_CCNT(start);
+    int error = allocman_cspace_alloc(&b->alloc, &object->path);
+    SEL4BENCH_READ_CCNT(end);
+    *cycles = end - start;
+    return error;
+}
+
+static void cs_free(bench_t *b, bench_object_t *object, ccnt_t *cycles)
+{
+    ccnt_t start, end;
+
+    SEL4BENCH_READ_CCNT(start);
+    allocman_cspace_free(&b->alloc, &object->path);
+    SEL4BENCH_READ_CCNT(end);
+    *cycles = end - start;
+}
+
+static const bench_ops_t cs_ops = {
+    .alloc = cs_alloc,
+    .free = cs_free,
+};
+
+static int ms_alloc(bench_t *b, bench_object_t *object, ccnt_t *cycles)
+{
+    ccnt_t start, end;
+    int error;
+
+    SEL4BENCH_READ_CCNT(start);
+    object->ptr = allocman_mspace_alloc(&b->alloc, BIT(object->size_bits), &error);
+    SEL4BENCH_READ_CCNT(end);
+    *cycles = end - start;
+    return error;
+}
+
+static void ms_free(bench_t *b, bench_object_t *object, ccnt_t *cycles)
+{
+    ccnt_t start, end;
+
+    SEL4BENCH_READ_CCNT(start);
+    allocman_mspace_free(&b->alloc, object->ptr, BIT(object->size_bits));
+    SEL4BENCH_READ_CCNT(end);
+    *cycles = end - start;
+}
+
+static const bench_ops_t ms_ops = {
+    .alloc = ms_alloc,
+    .free = ms_free,
+};
+
+/* untypeds the objects are allocated from, and sizes of the objects */
+static const size_t bench_ut_bits[] = { 21, 23 };
+static const size_t bench_ut_object_bits[] = { seL4_PageBits, seL4_PageBits + 2 };
+
+static utspace_split_t bench_split;
+static utspace_twinkle_t bench_twinkle;
+
+static int bench_utspace(env_t env, bool twinkle)
+{
+    int error;
+
+    bench_calibrate();
+    for (size_t i = 0; i < ARRAY_SIZE(bench_ut_bits); i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(bench_ut_object_bits); j++) {
+            for (int pattern = 0; pattern < BENCH_NUM_PATTERNS; pattern++) {
+                vka_object_t untyped;
+                cspacepath_t path;
+                size_t ut_bits = bench_ut_bits[i];
+
+                bench_create(env, &ut_ops, bench_bookkeeping());
+                error = allocman_attach_cspace(&bench.alloc, cspace_vka_make_interface(&env->vka));
+                test_error_eq(error, 0);
+                if (twinkle) {
+                    utspace_twinkle_create_reclaiming(&bench_twinkle);
+                    error = allocman_attach_utspace(&bench.alloc, utspace_twinkle_make_interface(&bench_twinkle));
+                } else {
+                    utspace_split_create(&bench_split);
+                    error = allocman_attach_utspace(&bench.alloc, utspace_split_make_interface(&bench_split));
+                }
+                test_error_eq(error, 0);
+                error = vka_alloc_untyped(&env->vka, ut_bits, &untyped);
+                test_error_eq(error, 0);
+                vka_cspace_make_path(&env->vka, untyped.cptr, &path);
+                error = allocman_utspace_add_uts(&bench.alloc, 1, &path, &ut_bits, NULL, ALLOCMAN_UT_KERNEL);
+                test_error_eq(error, 0);
+
+                snprintf(bench.name, sizeof(bench.name), "%s %zu/%zu", twinkle ? "twinkle" : "split",
+                         bench_ut_object_bits[j], ut_bits);
+                bench.min_bits = bench_ut_object_bits[j];
+                bench.max_bits = bench.min_bits + 2;
+                bench_pattern(pattern);
+
+                /* Everything is free again, so split has merged its nodes back
+                 * together and given their slots back. */
+                vka_cnode_revoke(&path);
+                vka_free_object(&env->vka, &untyped);
+            }
+        }
+    }
+    return sel4test_get_result();
+}
+
+static int bench_utspace_split(env_t env)
+{
+    return bench_utspace(env, false);
+}
+DEFINE_BENCHMARK_SUITE(ALLOCMAN_BENCH_001, "Latency and throughput of the split utspace",
+                       bench_utspace_split)
+
+static int bench_utspace_twinkle(env_t env)
+{
+    return bench_utspace(env, true);
+}
+DEFINE_BENCHMARK_SUITE(ALLOCMAN_BENCH_002, "Latency and throughput of the reclaiming twinkle utspace",
+                       bench_utspace_twinkle)
+
+/* percentage of the cspace allocated before each run */
+static const size_t bench_cspace_fill[] = { 0, 50, 90 };
+
+static cspace_single_level_t bench_single_level;
+static cspace_two_level_t bench_two_level;
+
+static int bench_cspace(env_t env, bool two_level)
+{
+    int error;
+
+    bench_calibrate();
+    for (size_t i = 0; i < ARRAY_SIZE(bench_cspace_fill); i++) {
+        /* slots are all the same size, so only the order of frees matters */
+        for (int pattern = BENCH_LIFO; pattern <= BENCH_RANDOM; pattern++) {
+            vka_object_t cnode;
+            size_t size_bits = two_level ? ALLOCMAN_BENCH_L1_BITS : ALLOCMAN_BENCH_CNODE_BITS;
+
+            bench_create(env, &cs_ops, bench_bookkeeping());
+            error = allocman_attach_utspace(&bench.alloc, utspace_vka_make_interface(&env->vka));
+            test_error_eq(error, 0);
+            error = vka_alloc_cnode_object(&env->vka, size_bits, &cnode);
+            test_error_eq(error, 0);
+            if (two_level) {
+                error = cspace_two_level_create(&bench.alloc, &bench_two_level, (struct cspace_two_level_config) {
+                    .cnode = cnode.cptr,
+                    .cnode_size_bits = size_bits,
+                    .cnode_guard_bits = 0,
+                    .first_slot = 0,
+                    .end_slot = BIT(size_bits),
+                    .level_two_bits = ALLOCMAN_BENCH_CNODE_BITS - ALLOCMAN_BENCH_L1_BITS,
+                });
+                test_error_eq(error, 0);
+                error = allocman_attach_cspace(&bench.alloc, cspace_two_level_make_interface(&bench_two_level));
+            } else {
+                error = cspace_single_level_create(&bench.alloc, &bench_single_level,
+                (struct cspace_single_level_config) {
+                    .cnode = cnode.cptr,
+                    .cnode_size_bits = size_bits,
+                    .cnode_guard_bits = 0,
+                    .first_slot = 0,
+                    .end_slot = BIT(size_bits),
+                });
+                test_error_eq(error, 0);
+                error = allocman_attach_cspace(&bench.alloc, cspace_single_level_make_interface(&bench_single_level));
+            }
+            test_error_eq(error, 0);
+
+            /* the fill is never freed, destroying the cspace takes care of it */
+            size_t fill = BIT(ALLOCMAN_BENCH_CNODE_BITS) * bench_cspace_fill[i] / 100;
+            for (size_t j = 0; j < fill; j++) {
+                cspacepath_t path;
+                error = allocman_cspace_alloc(&bench.alloc, &path);
+                test_error_eq(error, 0);
+            }
+
+            snprintf(bench.name, sizeof(bench.name), "%s %zu%%", two_level ? "two_level" : "single_level",
+                     bench_cspace_fill[i]);
+            bench.min_bits = bench.max_bits = 0;
+            bench_pattern(pattern);
+
+            if (two_level) {
+                cspace_two_level_destroy(&bench.alloc, &bench_two_level);
+            } else {
+                cspace_single_level_destroy(&bench.alloc, &bench_single_level);
+            }
+            vka_free_object(&env->vka, &cnode);
+        }
+    }
+    return sel4test_get_result();
+}
+
+static int bench_cspace_single_level(env_t env)
+{
+    return bench_cspace(env, false);
+}
+DEFINE_BENCHMARK_SUITE(ALLOCMAN_BENCH_003, "Latency and throughput of the single level cspace",
+                       bench_cspace_single_level)
+
+static int bench_cspace_two_level(env_t env)
+{
+    return bench_cspace(env, true);
+}
+DEFINE_BENCHMARK_SUITE(ALLOCMAN_BENCH_004, "Latency and throughput of the two level cspace",
+                       bench_cspace_two_level)
+
+typedef enum bench_mspace_kind {
+    BENCH_FIXED_POOL,
+    BENCH_VIRTUAL_POOL,
+    BENCH_VSPACE_POOL,
+    BENCH_DUAL_POOL,
+} bench_mspace_kind_t;
+
+static const char *bench_mspace_names[] = {
+    [BENCH_FIXED_POOL] = "fixed_pool",
+    [BENCH_VIRTUAL_POOL] = "virtual_pool",
+    [BENCH_VSPACE_POOL] = "vspace_pool",
+    [BENCH_DUAL_POOL] = "dual_pool",
+};
+
+/* sizes of the objects, in bytes as powers of two */
+static const size_t bench_ms_object_bits[] = { 5, 8 };
+#define ALLOCMAN_BENCH_MS_MAX_BITS 10
+
+static mspace_virtual_pool_t bench_virtual_pool;
+static mspace_vspace_pool_t bench_vspace_pool;
+static mspace_dual_pool_t bench_dual_pool;
+
+/* The pools that map memory on demand never unmap it, so one of each is created
+ * for the whole test rather than for each run. Only the first run includes the
+ * cost of mapping memory, the others reuse what it freed. */
+static int bench_mspace(env_t env, bench_mspace_kind_t kind)
+{
+    struct mspace_interface mspace;
+    reservation_t reservation = {0};
+    void *vstart = NULL;
+    int error;
+
+    if (kind != BENCH_FIXED_POOL) {
+        reservation = vspace_reserve_range(&env->vspace, ALLOCMAN_BENCH_POOL_SIZE, seL4_AllRights, 1, &vstart);
+        test_assert_fatal(reservation.res != NULL);
+    }
+    switch (kind) {
+    case BENCH_VIRTUAL_POOL:
+        mspace_virtual_pool_create(&bench_virtual_pool, (struct mspace_virtual_pool_config) {
+            .vstart = vstart,
+            .size = ALLOCMAN_BENCH_POOL_SIZE,
+            .pd = env->page_directory,
+        });
+        mspace = mspace_virtual_pool_make_interface(&bench_virtual_pool);
+        break;
+    case BENCH_VSPACE_POOL:
+        mspace_vspace_pool_create(&bench_vspace_pool, (struct mspace_vspace_pool_config) {
+            .vstart = (uintptr_t) vstart,
+            .reservation = reservation,
+            .vspace = env->vspace,
+        });
+        mspace = mspace_vspace_pool_make_interface(&bench_vspace_pool);
+        break;
+    case BENCH_DUAL_POOL:
+        /* leave the fixed part small, so that the virtual part is used too */
+        mspace_dual_pool_create(&bench_dual_pool, (struct mspace_fixed_pool_config) {
+            .pool = bench_pool_mem,
+            .size = BIT(ALLOCMAN_BENCH_MS_MAX_BITS + 2),
+        });
+        mspace_dual_pool_attach_virtual(&bench_dual_pool, (struct mspace_virtual_pool_config) {
+            .vstart = vstart,
+            .size = ALLOCMAN_BENCH_POOL_SIZE,
+            .pd = env->page_directory,
+        });
+        mspace = mspace_dual_pool_make_interface(&bench_dual_pool);
+        break;
+    default:
+        break;
+    }
+
+    bench_calibrate();
+    for (size_t i = 0; i < ARRAY_SIZE(bench_ms_object_bits); i++) {
+        for (int pattern = 0; pattern < BENCH_NUM_PATTERNS; pattern++) {
+            bench_create(env, &ms_ops, kind == BENCH_FIXED_POOL ? bench_bookkeeping() : mspace);
+            error = allocman_attach_cspace(&bench.alloc, cspace_vka_make_interface(&env->vka));
+            test_error_eq(error, 0);
+            error = allocman_attach_utspace(&bench.alloc, utspace_vka_make_interface(&env->vka));
+            test_error_eq(error, 0);
+
+            snprintf(bench.name, sizeof(bench.name), "%s %zu", bench_mspace_names[kind],
+                     (size_t) BIT(bench_ms_object_bits[i]));
+            bench.min_bits = bench_ms_object_bits[i];
+            bench.max_bits = ALLOCMAN_BENCH_MS_MAX_BITS;
+            bench_pattern(pattern);
+        }
+    }
+
+    if (kind == BENCH_VSPACE_POOL) {
+        size_t num_pages = (bench_vspace_pool.pool_top - (uintptr_t) vstart) / PAGE_SIZE_4K;
+        vspace_unmap_pages(&env->vspace, vstart, num_pages, PAGE_BITS_4K, VSPACE_FREE);
+    }
+    if (kind != BENCH_FIXED_POOL) {
+        vspace_free_reservation(&env->vspace, reservation);
+    }
+    return sel4test_get_result();
+}
+
+static int bench_mspace_fixed_pool(env_t env)
+{
+    return bench_mspace(env, BENCH_FIXED_POOL);
+}
+DEFINE_BENCHMARK_SUITE(ALLOCMAN_BENCH_005, "Latency and throughput of the fixed pool mspace",
+                       bench_mspace_fixed_pool)
+
+static int bench_mspace_virtual_pool(env_t env)
+{
+    return bench_mspace(env, BENCH_VIRTUAL_POOL);
+}
+DEFINE_BENCHMARK_SUITE(ALLOCMAN_BENCH_006, "Latency and throughput of the virtual pool mspace",
+                       bench_mspace_virtual_pool)
+
+static int bench_mspace_vspace_pool(env_t env)
+{
+    return bench_mspace(env, BENCH_VSPACE_POOL);
+}
+DEFINE_BENCHMARK_SUITE(ALLOCMAN_BENCH_007, "Latency and throughput of the vspace pool mspace",
+                       bench_mspace_vspace_pool)
+
+static int bench_mspace_dual_pool(env_t env)
+{
+    return bench_mspace(env, BENCH_DUAL_POOL);
+}
+DEFINE_BENCHMARK_SUITE(ALLOCMAN_BENCH_008, "Latency and throughput of the dual pool mspace",
+                       bench_mspace_dual_pool)
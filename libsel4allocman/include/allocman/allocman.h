@@ -93,6 +93,99 @@ struct allocman_freed_utspace_chunk {
     seL4_Word cookie;
 };
 
+/**
+ * Counters describing how the deferred free queues and watermark reserves are being
+ * used. Returned by {@link #allocman_get_stats}
+ */
+struct allocman_stats {
+    /* largest number of items that have been waiting in each deferred free queue */
+    size_t freed_slots_high_water;
+    size_t freed_mspace_chunks_high_water;
+    size_t freed_utspace_chunks_high_water;
+    /* frees that were leaked because a deferred free queue was full */
+    size_t freed_queue_overflows;
+    /* number of times non empty deferred free queues were drained */
+    size_t drains;
+    /* allocations that were satisfied from the watermark reserves */
+    size_t watermark_allocations;
+    /* number of times the watermark reserves could not be completely refilled */
+    size_t refill_failures;
+    /* number of times a reclaimer gave memory back, and how many bytes it gave */
+    size_t reclaims;
+    size_t reclaimed_bytes;
+};
+
+/**
+ * Snapshot of the resources held by an allocman and the allocators underneath it.
+ * Returned by {@link #allocman_get_resource_stats}
+ */
+typedef struct allocman_resource_stats {
+    struct allocman_stats counters;
+    /* resources held in the watermark reserves */
+    size_t reserve_slots;
+    size_t reserve_mspace_bytes;
+    uint64_t reserve_utspace_bytes;
+    /* resources waiting in the deferred free queues */
+    size_t freed_slots;
+    size_t freed_mspace_bytes;
+    uint64_t freed_utspace_bytes;
+    /* set if the allocator provides a snapshot, otherwise its stats are all zero */
+    int have_utspace_stats;
+    int have_cspace_stats;
+    int have_mspace_stats;
+    struct utspace_stats utspace;
+    struct cspace_stats cspace;
+    struct mspace_stats mspace;
+} allocman_stats_t;
+
+typedef void (*allocman_stats_callback64)(uint64_t value, const char *varname, const char *description, void *cookie);
+
+/**
+ * Describes a range of physical memory that is local to a particular node (i.e. memory
+ * controller or cluster). Used by {@link #allocman_configure_locality}
+ */
+struct allocman_locality_region {
+    uintptr_t paddr;
+    size_t size;
+    int node;
+};
+
+/**
+ * A number of free untypeds of one size to keep split ahead of demand. Used by
+ * {@link #allocman_configure_presplit}
+ */
+struct allocman_presplit_target {
+    size_t size_bits;
+    size_t count;
+};
+
+/**
+ * A cache that can give memory back to the allocman when it runs short, such as a pool of
+ * objects or buffers that are not in use. Registered with {@link #allocman_register_reclaimer}
+ */
+struct allocman_reclaimer {
+    /* Free at least bytes back to the allocman if possible, or everything that can be
+     * freed if bytes is 0, and return the number of bytes freed. Called with the allocman
+     * lock held by the calling thread, so it may free to the allocman but must not wait on
+     * another thread that uses it */
+    size_t (*reclaim)(void *cookie, size_t bytes);
+    void *cookie;
+    /* reclaimers are asked lowest value first */
+    int priority;
+    /* set by allocman_register_reclaimer */
+    struct allocman_reclaimer *next;
+};
+
+/**
+ * Lock used to serialize access to an allocman that is shared between threads.
+ * Used by {@link #allocman_configure_lock}
+ */
+struct allocman_lock {
+    void (*acquire)(void *cookie);
+    void (*release)(void *cookie);
+    void *cookie;
+};
+
 /**
  * The allocman itself. This is generally the only type you will need to pass around
  * to deal with allocation. It is declared in full here so that the compiler is able
@@ -153,8 +246,75 @@ typedef struct allocman {
     struct allocman_utspace_chunk *utspace_chunk;
     size_t *utspace_chunk_count;
     struct allocman_utspace_allocation **utspace_chunks;
+
+    struct allocman_stats stats;
+
+    /* physical memory locality, see allocman_configure_locality */
+    size_t num_locality_regions;
+    const struct allocman_locality_region *locality_regions;
+    size_t num_locality_cores;
+    const int *locality_core_nodes;
+
+    /* number of cache colour bits above seL4_PageBits, 0 if not configured, see
+     * allocman_configure_colours */
+    size_t colour_bits;
+
+    /* untypeds to split ahead of demand, see allocman_configure_presplit */
+    size_t num_presplit_targets;
+    const struct allocman_presplit_target *presplit_targets;
+
+    /* optional lock taken around every root operation */
+    struct allocman_lock lock;
+
+    /* caches to ask for memory before failing, in priority order, see
+     * allocman_register_reclaimer */
+    struct allocman_reclaimer *reclaimers;
+    int reclaiming;
 } allocman_t;
 
+#define ALLOCMAN_THREAD_CACHE_SLOTS 32
+#define ALLOCMAN_THREAD_CACHE_MSPACE_CLASSES 4
+#define ALLOCMAN_THREAD_CACHE_MSPACE_CHUNKS 8
+#define ALLOCMAN_THREAD_CACHE_UTSPACE_CLASSES 4
+#define ALLOCMAN_THREAD_CACHE_UTSPACE_OBJECTS 8
+#define ALLOCMAN_THREAD_CACHE_FREED_UTSPACE 16
+/* number of resources moved between a thread cache and the allocman at a time */
+#define ALLOCMAN_THREAD_CACHE_BATCH 8
+
+/**
+ * Per thread cache of allocman resources. Whilst a thread has a cache attached
+ * (see {@link #allocman_thread_cache_attach}), allocations and frees that can be
+ * satisfied by the cache do not touch the allocman, and so do not take its lock.
+ * The cache is refilled from, and drained back to, the allocman in batches.
+ */
+typedef struct allocman_thread_cache {
+    allocman_t *alloc;
+
+    size_t num_slots;
+    cspacepath_t slots[ALLOCMAN_THREAD_CACHE_SLOTS];
+
+    /* recently freed memory, keyed by exact size */
+    struct {
+        size_t size;
+        size_t count;
+        void *chunks[ALLOCMAN_THREAD_CACHE_MSPACE_CHUNKS];
+    } mspace[ALLOCMAN_THREAD_CACHE_MSPACE_CLASSES];
+
+    /* pre-created objects of the sizes and types set by
+     * allocman_thread_cache_configure_utspace */
+    size_t num_utspace_classes;
+    struct {
+        size_t size_bits;
+        seL4_Word type;
+        size_t count;
+        struct allocman_utspace_allocation objects[ALLOCMAN_THREAD_CACHE_UTSPACE_OBJECTS];
+    } utspace[ALLOCMAN_THREAD_CACHE_UTSPACE_CLASSES];
+
+    /* untyped frees that have not yet been passed to the allocman */
+    size_t num_freed_utspace;
+    struct allocman_freed_utspace_chunk freed_utspace[ALLOCMAN_THREAD_CACHE_FREED_UTSPACE];
+} allocman_thread_cache_t;
+
 /**
  * Allocates 'real' memory from the allocator
  *
@@ -198,6 +358,29 @@ int allocman_cspace_alloc(allocman_t *alloc, cspacepath_t *slot);
  */
 void allocman_cspace_free(allocman_t *alloc, const cspacepath_t *slot);
 
+/**
+ * Allocates num consecutive cslots from the allocator. This is only supported by
+ * cspace allocators that provide an alloc_range function and never uses the
+ * watermark. Each slot in the range is freed individually with {@link #allocman_cspace_free}
+ *
+ * @param alloc Allocman to allocate from
+ * @param num Number of slots to allocate
+ * @param first Stores details of the first slot in the range
+ *
+ * @return returns 0 on success
+ */
+int allocman_cspace_alloc_range(allocman_t *alloc, size_t num, cspacepath_t *first);
+
+/**
+ * Frees num consecutive allocated cslots, starting at first. Uses the free_range function
+ * of the cspace allocator if it has one, and frees them one at a time otherwise.
+ *
+ * @param alloc Allocman the slots were allocated from
+ * @param first The first slot to free
+ * @param num Number of slots to free
+ */
+void allocman_cspace_free_range(allocman_t *alloc, const cspacepath_t *first, size_t num);
+
 /**
  * Converts a seL4_CPtr into a cspacepath_t using the cspace attached to the allocman.
  * If the slot is not valid in that cspace then the return path is completely undefined.
@@ -250,6 +433,46 @@ seL4_Word allocman_utspace_alloc(allocman_t *alloc, size_t size_bits, seL4_Word
     return allocman_utspace_alloc_at(alloc, size_bits, type, path, ALLOCMAN_NO_PADDR, canBeDev, _error);
 }
 
+/**
+ * Allocates an object from memory that is local to the given core, as described by
+ * {@link #allocman_configure_locality}. If no locality is configured, the utspace
+ * allocator cannot allocate by range, or there is no local memory left, this falls
+ * back to {@link allocman_utspace_alloc}. The resulting cookie is freed as normal
+ * with {@link allocman_utspace_free}
+ *
+ * @param alloc Allocman to allocate from
+ * @param core Core the object should be local to
+ * @param size_bits The size in bits of the memory that will be required to store this object.
+ * @param type The seL4 type of the object being allocated
+ * @param path A path to a location to put the allocated object (this must be a valid empty slot)
+ * @param canBeDev Whether this allocation can be satisified from a device region
+ * @param _error (Optional) set to 0 on success
+ *
+ * @return Returns a cookie that can be used in future to free this allocation
+ */
+seL4_Word allocman_utspace_alloc_near(allocman_t *alloc, int core, size_t size_bits, seL4_Word type, const cspacepath_t *path, bool canBeDev, int *_error);
+
+/**
+ * Allocates an object from memory of only the given cache colours, as described by
+ * {@link #allocman_configure_colours}, so that it can not evict lines of other colours
+ * from a physically indexed cache. Unlike {@link allocman_utspace_alloc_near} this does not
+ * fall back to memory of other colours, as that would break the partitioning. Untypeds with
+ * no known physical address are never used. Colours covering every colour, or no colours
+ * being configured, allocate as normal. The resulting cookie is freed as normal with
+ * {@link allocman_utspace_free}
+ *
+ * @param alloc Allocman to allocate from
+ * @param colours Bitmap of the colours the object may use
+ * @param size_bits The size in bits of the memory that will be required to store this object.
+ * @param type The seL4 type of the object being allocated
+ * @param path A path to a location to put the allocated object (this must be a valid empty slot)
+ * @param canBeDev Whether this allocation can be satisified from a device region
+ * @param _error (Optional) set to 0 on success
+ *
+ * @return Returns a cookie that can be used in future to free this allocation
+ */
+seL4_Word allocman_utspace_alloc_coloured(allocman_t *alloc, seL4_Word colours, size_t size_bits, seL4_Word type, const cspacepath_t *path, bool canBeDev, int *_error);
+
 /**
  * Returns a portion of untyped memory back to the allocator. It is assumed that this
  * memory is now unused, and every capability to this memory has been deleted (including
@@ -262,6 +485,44 @@ seL4_Word allocman_utspace_alloc(allocman_t *alloc, size_t size_bits, seL4_Word
  */
 void allocman_utspace_free(allocman_t *alloc, seL4_Word cookie, size_t size_bits);
 
+/* Book keeping for a batch of objects created by {@link allocman_utspace_alloc_n} */
+struct allocman_utspace_batch {
+    /* untyped the objects were retyped from, and its cookie */
+    cspacepath_t ut;
+    seL4_Word cookie;
+    size_t size_bits;
+};
+
+/**
+ * Allocates num objects of the same type as a single allocation. A single untyped
+ * large enough for all the objects (num rounded up to a power of two) is allocated and
+ * the objects are retyped out of it. If the destination slots are consecutive this is
+ * done with a single seL4_Untyped_Retype (split into chunks of at most
+ * CONFIG_RETYPE_FAN_OUT_LIMIT objects). The objects are physically contiguous.
+ *
+ * @param alloc Allocman to allocate from
+ * @param size_bits The size in bits of the memory required to store one object
+ * @param type The seL4 type of the objects being allocated
+ * @param paths Array of num paths to put the allocated objects (these must be valid empty slots)
+ * @param num Number of objects to allocate
+ * @param canBeDev Whether this allocation can be satisified from a device region
+ * @param _error (Optional) set to 0 on success
+ *
+ * @return Returns a cookie that can be used to free all of the objects with {@link allocman_utspace_free_n}
+ */
+seL4_Word allocman_utspace_alloc_n(allocman_t *alloc, size_t size_bits, seL4_Word type, const cspacepath_t *paths, size_t num, bool canBeDev, int *_error);
+
+/**
+ * Frees objects allocated by {@link allocman_utspace_alloc_n}. Every capability to the
+ * objects must already have been deleted.
+ *
+ * @param alloc Allocman that was allocated from
+ * @param cookie Cookie as returned by {@link allocman_utspace_alloc_n}
+ * @param size_bits The size in bits of the memory required to store one object
+ * @param num Number of objects that were allocated
+ */
+void allocman_utspace_free_n(allocman_t *alloc, seL4_Word cookie, size_t size_bits, size_t num);
+
 /**
  * Initialize a new allocman. all it requires is a memory allocator, everything will be boot strapped from it
  *
@@ -332,6 +593,205 @@ int allocman_configure_utspace_reserve(allocman_t *alloc, struct allocman_utspac
  */
 int allocman_configure_cspace_reserve(allocman_t *alloc, size_t num);
 
+/**
+ * Describe which physical memory is local to which cores. The arrays are not copied and
+ * must remain valid for the lifetime of the allocman.
+ *
+ * @param alloc The allocman to configure
+ * @param num_regions Number of entries in regions
+ * @param regions Physical memory ranges and the node they belong to
+ * @param num_cores Number of entries in core_nodes
+ * @param core_nodes The node of each core, indexed by core id
+ *
+ * @return returns 0 on success
+ */
+int allocman_configure_locality(allocman_t *alloc, size_t num_regions, const struct allocman_locality_region *regions,
+                                size_t num_cores, const int *core_nodes);
+
+/**
+ * Set the number of cache colours, for {@link #allocman_utspace_alloc_coloured}. The colour of a
+ * page is the colour_bits of its physical address above seL4_PageBits, which for a physically
+ * indexed cache is log2 of the size of one way of the cache in pages.
+ *
+ * @param alloc The allocman to configure
+ * @param colour_bits Number of colour bits, such that BIT(colour_bits) is at most seL4_WordBits
+ *
+ * @return returns 0 on success
+ */
+int allocman_configure_colours(allocman_t *alloc, size_t colour_bits);
+
+/**
+ * Set how many free untypeds of each size allocman_presplit should keep ready, so that
+ * allocations of those sizes do not have to split larger untypeds. Smaller sizes are
+ * split from larger ones, so list the targets from the largest size down. The array is
+ * not copied and must remain valid for the lifetime of the allocman.
+ *
+ * @param alloc The allocman to configure
+ * @param num_targets Number of entries in targets
+ * @param targets Sizes and the number of free untypeds of each to keep
+ *
+ * @return returns 0 on success
+ */
+int allocman_configure_presplit(allocman_t *alloc, size_t num_targets, const struct allocman_presplit_target *targets);
+
+/**
+ * Split untypeds towards the targets of {@link #allocman_configure_presplit}. Meant to be
+ * called when there is nothing else to do, such as from an idle loop or a low priority
+ * thread. The lock is only held for one split at a time, so other threads can allocate
+ * in between.
+ *
+ * @param alloc The allocman to split untypeds in
+ * @param max_splits Most untypeds to split before returning
+ *
+ * @return The number of untypeds split. Less than max_splits once every target is met,
+ *         or nothing more can be split
+ */
+size_t allocman_presplit(allocman_t *alloc, size_t max_splits);
+
+/**
+ * Record the state of the utspace, and of the cspace if it supports it, so that
+ * {@link #allocman_restore} can return to it. Meant to be taken once a persistent root
+ * task has finished its own init, so that the resources of components it starts after
+ * can be reclaimed in bulk. A new checkpoint replaces the old one.
+ *
+ * The watermark reserves are given back before the checkpoint and refilled after it.
+ * The mspace is not part of the checkpoint, so an mspace that grows by allocating from
+ * the utspace must not need to grow while the checkpoint is held. Thread caches must be
+ * detached or empty.
+ *
+ * @param alloc The allocman to checkpoint
+ *
+ * @return returns 0 on success, or an error if the utspace cannot be checkpointed
+ */
+int allocman_checkpoint(allocman_t *alloc);
+
+/**
+ * Return the utspace, and the cspace if it was checkpointed, to the state of the last
+ * {@link #allocman_checkpoint}. Each untyped that was free at the checkpoint is revoked,
+ * destroying every object made from it since, and the slots allocated since are freed.
+ * Cookies and slots handed out since the checkpoint must not be used or freed after.
+ * Caps in those slots that were not made from the allocman's untypeds, such as copies of
+ * caps it was not given, are not deleted and must be deleted by the caller first. Slots
+ * allocated before the checkpoint and freed since are allocated again.
+ *
+ * @param alloc The allocman to restore
+ *
+ * @return returns 0 on success
+ */
+int allocman_restore(allocman_t *alloc);
+
+/**
+ * Retrieve usage statistics of the deferred free queues and watermark reserves. These
+ * can be used to pick values for allocman_configure_max_freed_* and the reserves
+ *
+ * @param alloc The allocman to query
+ * @param stats Structure to fill out
+ */
+void allocman_get_stats(allocman_t *alloc, struct allocman_stats *stats);
+
+/**
+ * Take a snapshot of the resources held by the allocman and its underlying allocators.
+ * The underlying allocators walk their free lists and bitmaps to do this, so it is not
+ * something to do on a fast path
+ *
+ * @param alloc The allocman to query
+ * @param stats Structure to fill out
+ */
+void allocman_get_resource_stats(allocman_t *alloc, allocman_stats_t *stats);
+
+/**
+ * Report a snapshot from allocman_get_resource_stats one value at a time. Matches the
+ * scrape function of a profile_source_t from sel4utils/profile.h, so an allocman can
+ * be registered with profile_register_source to be reported by profile_scrape
+ *
+ * @param alloc The allocman to report on, as an allocman_t *
+ * @param callback64 Called with each value, its name and a description
+ * @param cookie Passed to callback64
+ */
+void allocman_stats_scrape(void *alloc, allocman_stats_callback64 callback64, void *cookie);
+
+/**
+ * Make this allocman safe to share between threads. The given lock is taken around
+ * every root allocman operation (recursive calls made by the underlying allocators
+ * do not take it again). This must be configured before the allocman is used by
+ * more than one thread, and all other configuration and the attaching of allocators
+ * must also be finished by then.
+ *
+ * @param alloc The allocman to configure
+ * @param lock Lock to serialize operations with
+ *
+ * @return returns 0 on success
+ */
+int allocman_configure_lock(allocman_t *alloc, struct allocman_lock lock);
+
+/**
+ * Register a cache to ask for memory back when the allocman runs short. Whenever a root
+ * untyped or mspace allocation fails, the reclaimers are asked in priority order and the
+ * allocation is retried after each one that frees something, before the watermark
+ * reserves are used or the allocation fails. They are also asked when the watermark
+ * reserves cannot be refilled. So caches can be sized generously and shrink under
+ * pressure.
+ *
+ * Allocations made by the underlying allocators in the middle of another operation do
+ * not ask the reclaimers, as what the reclaimers free could not be used until the
+ * operation finishes.
+ *
+ * @param alloc The allocman to register with
+ * @param reclaimer The reclaimer, which is not copied and must remain valid until it is
+ *                  unregistered
+ *
+ * @return returns 0 on success
+ */
+int allocman_register_reclaimer(allocman_t *alloc, struct allocman_reclaimer *reclaimer);
+
+/**
+ * Stop asking a reclaimer for memory. Must not be called from a reclaimer.
+ *
+ * @param alloc The allocman the reclaimer was registered with
+ * @param reclaimer The reclaimer to remove
+ */
+void allocman_unregister_reclaimer(allocman_t *alloc, struct allocman_reclaimer *reclaimer);
+
+/**
+ * Ask the reclaimers for memory now, such as before starting something that will need a
+ * lot of it, in priority order until bytes have been freed.
+ *
+ * @param alloc The allocman to reclaim memory for
+ * @param bytes Bytes to free, or 0 to ask every reclaimer for everything it can free, as
+ *              with the bytes argument of a reclaimer
+ *
+ * @return The number of bytes freed
+ */
+size_t allocman_reclaim(allocman_t *alloc, size_t bytes);
+
+/**
+ * Attach a thread cache to the calling thread. Subsequent allocations by this thread
+ * from alloc, and frees to it, will go through the cache where possible. Only one
+ * cache can be attached to a thread at a time.
+ *
+ * @param alloc The allocman the cache is for
+ * @param cache Storage for the cache. Must remain valid until the cache is detached
+ */
+void allocman_thread_cache_attach(allocman_t *alloc, allocman_thread_cache_t *cache);
+
+/**
+ * Ask a thread cache to keep objects of a given type and size ready for allocation.
+ * These are created in batches of ALLOCMAN_THREAD_CACHE_BATCH
+ *
+ * @param cache The cache to configure
+ * @param size_bits The size in bits of the memory required for the object
+ * @param type The seL4 type of the object
+ *
+ * @return returns 0 on success
+ */
+int allocman_thread_cache_configure_utspace(allocman_thread_cache_t *cache, size_t size_bits, seL4_Word type);
+
+/**
+ * Return everything held in the calling threads cache to the allocman and detach
+ * the cache from the thread. Must be called before the thread exits.
+ */
+void allocman_thread_cache_detach(void);
+
 /**
  * Configure the maximul number of freed cptrs we can store. This is required for
  * scenarios where an allocator cannot handle a recursive call, but we would like to not
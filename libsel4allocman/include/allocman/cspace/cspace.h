@@ -12,10 +12,35 @@
 
 struct allocman;
 
+/* Snapshot of the slots in a cspace, see the stats function of cspace_interface_t */
+struct cspace_stats {
+    /* slots that can currently be allocated from, whether free or not */
+    size_t total_slots;
+    size_t free_slots;
+    /* longest run of consecutive free slots, the most alloc_range could return */
+    size_t largest_free_run;
+    /* second level cnodes that have been created, 0 for single level cspaces */
+    size_t levels;
+    /* bytes of mspace memory used to track the slots */
+    size_t bookkeeping_bytes;
+};
+
 typedef struct cspace_interface {
     int (*alloc)(struct allocman *alloc, void *cookie, cspacepath_t *path);
     void (*free)(struct allocman *alloc, void *cookie, const cspacepath_t *path);
     cspacepath_t (*make_path)(void *cookie, seL4_CPtr slot);
+    /* Optional. Allocates num consecutive slots, returning the first. Slots from a
+     * range are individually freed with 'free' */
+    int (*alloc_range)(struct allocman *alloc, void *cookie, size_t num, cspacepath_t *first);
+    /* Optional. Frees num consecutive allocated slots starting at first, which need not
+     * have come from a single alloc_range */
+    void (*free_range)(struct allocman *alloc, void *cookie, const cspacepath_t *first, size_t num);
+    /* Optional. Fill out a snapshot of the slots */
+    void (*stats)(void *cookie, struct cspace_stats *stats);
+    /* Optional. Record which slots are free, so that restore can free every slot
+     * allocated since */
+    int (*checkpoint)(struct allocman *alloc, void *cookie);
+    int (*restore)(struct allocman *alloc, void *cookie);
     struct allocman_properties properties;
     void *cspace;
 } cspace_interface_t;
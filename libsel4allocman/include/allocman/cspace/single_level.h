@@ -26,9 +26,15 @@ struct cspace_single_level_config {
 
 typedef struct cspace_single_level {
     struct cspace_single_level_config config;
+    /* one bit per slot, set if the slot is free */
     size_t *bitmap;
     size_t bitmap_length;
+    /* one bit per word of bitmap, set if that word has any free slots */
+    size_t *summary;
+    size_t summary_length;
     size_t last_entry;
+    /* copy of the bitmap and then the summary from _cspace_single_level_checkpoint */
+    size_t *checkpoint;
 } cspace_single_level_t;
 
 int cspace_single_level_create(struct allocman *alloc, cspace_single_level_t *cspace, struct cspace_single_level_config config);
@@ -40,6 +46,37 @@ int _cspace_single_level_alloc(struct allocman *alloc, void *_cspace, cspacepath
 int _cspace_single_level_alloc_at(struct allocman *alloc, void *_cspace, seL4_CPtr slot);
 void _cspace_single_level_free(struct allocman *alloc, void *_cspace, const cspacepath_t *slot);
 
+/**
+ * Allocate a number of contiguous slots
+ *
+ * @param alloc Allocman to use for any book keeping
+ * @param _cspace cspace to allocate from
+ * @param num Number of slots to allocate
+ * @param first Path to the first slot of the range. The remaining slots follow it at increasing offsets
+ *
+ * @return returns 0 on success
+ */
+int _cspace_single_level_alloc_range(struct allocman *alloc, void *_cspace, size_t num, cspacepath_t *first);
+
+/**
+ * Free a range of allocated slots, such as one allocated by {@link #_cspace_single_level_alloc_range}.
+ * Sets whole words of the bitmap at a time
+ */
+void _cspace_single_level_free_range(struct allocman *alloc, void *_cspace, const cspacepath_t *first, size_t num);
+
+/**
+ * Fill out a snapshot of the slots. Counts every word of the bitmap, so takes time
+ * proportional to the size of the cspace
+ */
+void _cspace_single_level_stats(void *_cspace, struct cspace_stats *stats);
+
+/**
+ * Record which slots are free, so that {@link #_cspace_single_level_restore} can free every
+ * slot allocated since. Takes a copy of the bitmap
+ */
+int _cspace_single_level_checkpoint(struct allocman *alloc, void *_cspace);
+int _cspace_single_level_restore(struct allocman *alloc, void *_cspace);
+
 static inline cspacepath_t _cspace_single_level_make_path(void *_cspace, seL4_CPtr slot)
 {
     cspace_single_level_t *cspace = (cspace_single_level_t*) _cspace;
@@ -59,6 +96,11 @@ static inline cspace_interface_t cspace_single_level_make_interface(cspace_singl
         .alloc = _cspace_single_level_alloc,
         .free = _cspace_single_level_free,
         .make_path = _cspace_single_level_make_path,
+        .alloc_range = _cspace_single_level_alloc_range,
+        .free_range = _cspace_single_level_free_range,
+        .stats = _cspace_single_level_stats,
+        .checkpoint = _cspace_single_level_checkpoint,
+        .restore = _cspace_single_level_restore,
         /* We do not want to handle recursion, as it shouldn't happen */
         .properties = ALLOCMAN_DEFAULT_PROPERTIES,
         .cspace = cspace
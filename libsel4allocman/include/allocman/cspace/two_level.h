@@ -34,6 +34,13 @@ struct cspace_two_level_config {
     size_t end_existing_index;
     seL4_CPtr start_existing_slot;
     seL4_CPtr end_existing_slot;
+    /* If non zero then, once the second level currently being allocated from is this
+     * percent full, the next second level is created ahead of time during the next free
+     * or call to cspace_two_level_prefetch, instead of by the allocation that needs it */
+    size_t prefetch_percent;
+    /* If set, second levels that we created are kept when they become empty instead of
+     * being deleted and released back to the utspace allocator */
+    int keep_empty_levels;
 };
 
 struct cspace_two_level_node {
@@ -59,6 +66,8 @@ typedef struct cspace_two_level {
     struct cspace_two_level_node **second_levels;
     /* Remember which second level we last tried to allocate a slot from */
     size_t last_second_level;
+    /* Set when a second level should be created ahead of time */
+    int prefetch_wanted;
 } cspace_two_level_t;
 
 int cspace_two_level_create(struct allocman *alloc, cspace_two_level_t *cspace, struct cspace_two_level_config config);
@@ -69,13 +78,26 @@ int _cspace_two_level_alloc(struct allocman *alloc, void *_cspace, cspacepath_t
 void _cspace_two_level_free(struct allocman *alloc, void *_cspace, const cspacepath_t *slot);
 int _cspace_two_level_alloc_at(struct allocman *alloc, void *_cspace, seL4_CPtr slot);
 
+/**
+ * Create a second level ahead of time if one has been requested by reaching
+ * the configured prefetch_percent. Intended to be called from idle points, this is
+ * also done automatically on free.
+ *
+ * @return 0 on success or if there was nothing to do
+ */
+int cspace_two_level_prefetch(struct allocman *alloc, cspace_two_level_t *cspace);
+
 cspacepath_t _cspace_two_level_make_path(void *_cspace, seL4_CPtr slot);
 
+/* Fill out a snapshot of the slots in the second levels that have been created */
+void _cspace_two_level_stats(void *_cspace, struct cspace_stats *stats);
+
 static inline cspace_interface_t cspace_two_level_make_interface(cspace_two_level_t *cspace) {
     return (cspace_interface_t) {
         .alloc = _cspace_two_level_alloc,
         .free = _cspace_two_level_free,
         .make_path = _cspace_two_level_make_path,
+        .stats = _cspace_two_level_stats,
         /* We do not want to handle recursion, as it shouldn't happen */
         .properties = ALLOCMAN_DEFAULT_PROPERTIES,
         .cspace = cspace
@@ -30,11 +30,13 @@ void mspace_dual_pool_attach_virtual(mspace_dual_pool_t *dual_pool, struct mspac
 
 void *_mspace_dual_pool_alloc(struct allocman *alloc, void *_dual_pool, size_t bytes, int *error);
 void _mspace_dual_pool_free(struct allocman *alloc, void *_dual_pool, void *ptr, size_t bytes);
+void _mspace_dual_pool_stats(void *_dual_pool, struct mspace_stats *stats);
 
 static inline struct mspace_interface mspace_dual_pool_make_interface(mspace_dual_pool_t *dual_pool) {
     return (struct mspace_interface){
         .alloc = _mspace_dual_pool_alloc,
         .free = _mspace_dual_pool_free,
+        .stats = _mspace_dual_pool_stats,
         .properties = ALLOCMAN_DEFAULT_PROPERTIES,
         .mspace = dual_pool
     };
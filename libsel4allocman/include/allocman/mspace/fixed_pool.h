@@ -12,6 +12,7 @@
 #include <sel4/types.h>
 #include <allocman/mspace/mspace.h>
 #include <allocman/mspace/k_r_malloc.h>
+#include <allocman/mspace/slab.h>
 
 /* Performs allocation from a fixed pool of memory */
 
@@ -24,17 +25,21 @@ typedef struct mspace_fixed_pool {
     uintptr_t pool_ptr;
     size_t remaining;
     mspace_k_r_malloc_t k_r_malloc;
+    /* size class front end for allocator metadata */
+    mspace_slab_t slab;
 } mspace_fixed_pool_t;
 
 void mspace_fixed_pool_create(mspace_fixed_pool_t *fixed_pool, struct mspace_fixed_pool_config config);
 
 void *_mspace_fixed_pool_alloc(struct allocman *alloc, void *_fixed_pool, size_t bytes, int *error);
 void _mspace_fixed_pool_free(struct allocman *alloc, void *_fixed_pool, void *ptr, size_t bytes);
+void _mspace_fixed_pool_stats(void *_fixed_pool, struct mspace_stats *stats);
 
 static inline struct mspace_interface mspace_fixed_pool_make_interface(mspace_fixed_pool_t *fixed_pool) {
     return (struct mspace_interface){
         .alloc = _mspace_fixed_pool_alloc,
         .free = _mspace_fixed_pool_free,
+        .stats = _mspace_fixed_pool_stats,
         .properties = ALLOCMAN_DEFAULT_PROPERTIES,
         .mspace = fixed_pool
     };
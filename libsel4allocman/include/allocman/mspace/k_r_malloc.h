@@ -7,6 +7,7 @@
 #pragma once
 
 #include <stdlib.h>
+#include <allocman/mspace/mspace.h>
 
 /* A K&R malloc style allocation that can be 'put in a box' as it were. */
 
@@ -29,4 +30,6 @@ typedef struct mspace_k_r_malloc {
 void mspace_k_r_malloc_init(mspace_k_r_malloc_t *k_r_malloc, size_t cookie, k_r_malloc_header_t * (*morecore)(size_t cookie, mspace_k_r_malloc_t *k_r_malloc, size_t new_units));
 void *mspace_k_r_malloc_alloc(mspace_k_r_malloc_t *k_r_malloc, size_t nbytes);
 void mspace_k_r_malloc_free(mspace_k_r_malloc_t *k_r_malloc, void *ap);
+/* Add the free list to stats, leaving unused_bytes to the pool providing morecore */
+void mspace_k_r_malloc_stats(mspace_k_r_malloc_t *k_r_malloc, struct mspace_stats *stats);
 
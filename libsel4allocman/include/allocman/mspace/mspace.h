@@ -11,9 +11,25 @@
 
 struct allocman;
 
+/* Snapshot of the memory in an mspace, see the stats function of struct mspace_interface */
+struct mspace_stats {
+    /* bytes that have been freed and can be allocated again, including any cached
+     * by a size class front end */
+    size_t free_bytes;
+    /* number of separate free blocks, and the size of the largest, which bounds the
+     * largest allocation that can be made without more core */
+    size_t free_blocks;
+    size_t largest_free;
+    /* bytes the pool has not yet handed out, or has mapped but not yet handed out for
+     * pools that can grow without limit */
+    size_t unused_bytes;
+};
+
 struct mspace_interface {
     void *(*alloc)(struct allocman *alloc, void *cookie, size_t bytes, int *error);
     void (*free)(struct allocman *alloc, void *cookie, void *ptr, size_t bytes);
+    /* Optional. Fill out a snapshot of the memory */
+    void (*stats)(void *cookie, struct mspace_stats *stats);
     struct allocman_properties properties;
     void *mspace;
 };
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <allocman/mspace/k_r_malloc.h>
+
+/* A size class front end for a K&R allocator. Requests whose size exactly matches
+ * one of the allocators own book keeping structures (split and buddy nodes etc.)
+ * are served from a per class free list, with the free lists refilled by carving
+ * a chunk of MSPACE_SLAB_CHUNK_OBJECTS objects out of the K&R allocator. Everything
+ * else falls through to K&R. Objects in a size class are never returned to the K&R
+ * allocator, which keeps both alloc and free of allocator metadata O(1) */
+
+#define MSPACE_SLAB_NUM_CLASSES 4
+#define MSPACE_SLAB_CHUNK_OBJECTS 16
+
+struct mspace_slab_object {
+    struct mspace_slab_object *next;
+};
+
+typedef struct mspace_slab {
+    struct mspace_slab_object *heads[MSPACE_SLAB_NUM_CLASSES];
+} mspace_slab_t;
+
+void mspace_slab_init(mspace_slab_t *slab);
+void *mspace_slab_alloc(mspace_slab_t *slab, mspace_k_r_malloc_t *k_r_malloc, size_t bytes);
+void mspace_slab_free(mspace_slab_t *slab, mspace_k_r_malloc_t *k_r_malloc, void *ptr, size_t bytes);
+/* Add the cached objects and the free list of k_r_malloc to stats */
+void mspace_slab_stats(mspace_slab_t *slab, mspace_k_r_malloc_t *k_r_malloc, struct mspace_stats *stats);
@@ -11,6 +11,7 @@
 #include <sel4/types.h>
 #include <allocman/mspace/mspace.h>
 #include <allocman/mspace/k_r_malloc.h>
+#include <allocman/mspace/slab.h>
 
 /* Performs allocation from a pool of virtual memory */
 
@@ -26,6 +27,8 @@ typedef struct mspace_virtual_pool {
     void *pool_limit;
     seL4_CPtr pd;
     mspace_k_r_malloc_t k_r_malloc;
+    /* size class front end for allocator metadata */
+    mspace_slab_t slab;
     struct allocman *morecore_alloc;
 } mspace_virtual_pool_t;
 
@@ -33,11 +36,13 @@ void mspace_virtual_pool_create(mspace_virtual_pool_t *virtual_pool, struct mspa
 
 void *_mspace_virtual_pool_alloc(struct allocman *alloc, void *_virtual_pool, size_t bytes, int *error);
 void _mspace_virtual_pool_free(struct allocman *alloc, void *_virtual_pool, void *ptr, size_t bytes);
+void _mspace_virtual_pool_stats(void *_virtual_pool, struct mspace_stats *stats);
 
 static inline struct mspace_interface mspace_virtual_pool_make_interface(mspace_virtual_pool_t *virtual_pool) {
     return (struct mspace_interface){
         .alloc = _mspace_virtual_pool_alloc,
         .free = _mspace_virtual_pool_free,
+        .stats = _mspace_virtual_pool_stats,
         .properties = ALLOCMAN_DEFAULT_PROPERTIES,
         .mspace = virtual_pool
     };
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <autoconf.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <sel4/types.h>
 #include <allocman/mspace/mspace.h>
@@ -25,6 +26,12 @@ struct mspace_vspace_pool_config {
     uintptr_t vstart;
     reservation_t reservation;
     vspace_t vspace;
+    /* The pool grows a page at first and then twice as much each time, up to this many
+     * bytes, or a large page if 0 */
+    size_t max_grow_bytes;
+    /* Only map small pages. Otherwise large pages are used wherever the pool is aligned for
+     * them, so the reservation should be large page aligned */
+    bool small_pages_only;
 };
 
 typedef struct mspace_vspace_pool {
@@ -35,17 +42,23 @@ typedef struct mspace_vspace_pool {
     vspace_t vspace;
     mspace_k_r_malloc_t k_r_malloc;
     struct allocman *morecore_alloc;
+    /* how much the next growth maps, at least */
+    size_t grow_bytes;
+    size_t max_grow_bytes;
+    bool large_pages;
 } mspace_vspace_pool_t;
 
 void mspace_vspace_pool_create(mspace_vspace_pool_t *vspace_pool, struct mspace_vspace_pool_config config);
 
 void *_mspace_vspace_pool_alloc(struct allocman *alloc, void *_vspace_pool, size_t bytes, int *error);
 void _mspace_vspace_pool_free(struct allocman *alloc, void *_vspace_pool, void *ptr, size_t bytes);
+void _mspace_vspace_pool_stats(void *_vspace_pool, struct mspace_stats *stats);
 
 static inline struct mspace_interface mspace_vspace_pool_make_interface(mspace_vspace_pool_t *vspace_pool) {
     return (struct mspace_interface){
         .alloc = _mspace_vspace_pool_alloc,
         .free = _mspace_vspace_pool_free,
+        .stats = _mspace_vspace_pool_stats,
         .properties = ALLOCMAN_DEFAULT_PROPERTIES,
         .mspace = vspace_pool
     };
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <autoconf.h>
+#include <sel4/types.h>
+#include <allocman/utspace/utspace.h>
+#include <vka/cspacepath_t.h>
+#include <assert.h>
+
+/* This is an untyped manager that implements a binary buddy allocator on top of
+ * untyped objects. Like the split allocator it creates smaller untypeds by
+ * halving larger ones, but it keeps a bitmap of which size classes ('orders')
+ * currently have free blocks, so finding the smallest block that can satisfy a
+ * request is a single find-first-set rather than a walk up every list.
+ *
+ * Splitting is done iteratively from the found order down to the requested one,
+ * with the unused half of each split left on the free list of its order. Those
+ * cached halves mean that in the steady state most allocations are a single
+ * retype of an already existing block. Where the cspace hands out adjacent slots
+ * both halves of a split are created with a single retype. Freeing a block whose
+ * buddy is also free coalesces them back into the parent, but only once its order
+ * already has UTSPACE_BUDDY_CACHED_BLOCKS free blocks, so that a size that is
+ * repeatedly allocated and freed isn't merged and split again each time. When no
+ * block is large enough for an allocation every free pair is coalesced and the
+ * search retried. */
+
+/* free blocks kept per order before freeing a block coalesces it with its buddy */
+#define UTSPACE_BUDDY_CACHED_BLOCKS 4
+
+struct utspace_buddy_pool;
+
+struct utspace_buddy_node {
+    cspacepath_t ut;
+    /* the block we were split from, or NULL if we are one of the original untypeds.
+     * Our parent must by definition be considered allocated */
+    struct utspace_buddy_node *parent;
+    /* if we have a parent then this is the other half of it */
+    struct utspace_buddy_node *buddy;
+    /* pool this block came from and should be returned to */
+    struct utspace_buddy_pool *pool;
+    /* physical address of the block */
+    uintptr_t paddr;
+    size_t size_bits;
+    /* non zero if this node is currently in a free list */
+    int is_free;
+    /* if this node is free then these are the next/previous pointers in the free list */
+    struct utspace_buddy_node *next, *prev;
+};
+
+/* Children are always created in pairs, and their book keeping is allocated in a single chunk */
+struct utspace_buddy_pair {
+    struct utspace_buddy_node node[2];
+};
+
+typedef struct utspace_buddy_pool {
+    struct utspace_buddy_node *heads[CONFIG_WORD_SIZE];
+    /* bit n is set iff heads[n] is not empty */
+    seL4_Word nonempty;
+    /* number of blocks in each free list */
+    size_t num_free[CONFIG_WORD_SIZE];
+} utspace_buddy_pool_t;
+
+typedef struct utspace_buddy {
+    /* untypeds from the kernel window. Used for anything */
+    utspace_buddy_pool_t kernel;
+    /* untypeds that are unknown device regions */
+    utspace_buddy_pool_t dev;
+    /* untypeds that are known to be RAM from the device region */
+    utspace_buddy_pool_t dev_mem;
+} utspace_buddy_t;
+
+void utspace_buddy_create(utspace_buddy_t *buddy);
+int _utspace_buddy_add_uts(struct allocman *alloc, void *_buddy, size_t num, const cspacepath_t *uts, size_t *size_bits, uintptr_t *paddr, int utType);
+
+seL4_Word _utspace_buddy_alloc(struct allocman *alloc, void *_buddy, size_t size_bits, seL4_Word type, const cspacepath_t *slot, uintptr_t paddr, bool canBeDev, int *error);
+void _utspace_buddy_free(struct allocman *alloc, void *_buddy, seL4_Word cookie, size_t size_bits);
+
+uintptr_t _utspace_buddy_paddr(void *_buddy, seL4_Word cookie, size_t size_bits);
+
+static inline struct utspace_interface utspace_buddy_make_interface(utspace_buddy_t *buddy) {
+    return (struct utspace_interface) {
+        .alloc = _utspace_buddy_alloc,
+        .free = _utspace_buddy_free,
+        .add_uts = _utspace_buddy_add_uts,
+        .paddr = _utspace_buddy_paddr,
+        .properties = ALLOCMAN_DEFAULT_PROPERTIES,
+        .utspace = buddy
+    };
+}
@@ -10,13 +10,17 @@
 #include <sel4/types.h>
 #include <allocman/utspace/utspace.h>
 #include <vka/cspacepath_t.h>
+#include <vka/cspaceslot.h>
 #include <assert.h>
 
 /* This is an untyped manager that works by splitting each untyped in half to
  * create smaller untypeds. */
 
+struct utspace_split_paddr_index;
+
 struct utspace_split_node {
-    cspacepath_t ut;
+    /* in the slots table of the split */
+    cspace_slot_t ut;
     /* if this is a child node, represents our parent. Our parent must by
      * definition be considered allocated */
     struct utspace_split_node *parent;
@@ -28,8 +32,38 @@ struct utspace_split_node {
     struct utspace_split_node **origin_head;
     /* physical address of the node */
     uintptr_t paddr;
+    /* size of the untyped this node represents */
+    size_t size_bits;
+    /* index tracking this node if it has a physical address, NULL otherwise */
+    struct utspace_split_paddr_index *index;
     /* if this node is not allocated then these are the next/previous pointers in the free list */
     struct utspace_split_node *next, *prev;
+    /* set if this node was created while the current checkpoint was held, in which case
+     * it is in the created list through created_next/created_prev */
+    bool since_checkpoint;
+    struct utspace_split_node *created_next, *created_prev;
+};
+
+/* Free nodes with a known physical address, sorted by paddr. As free nodes never
+ * overlap this allows finding the node covering a particular address with a binary
+ * search. Space is reserved for every node with a physical address, whether free
+ * or allocated, so that returning a node to the index on free never needs to
+ * allocate memory */
+struct utspace_split_paddr_index {
+    size_t count;
+    size_t capacity;
+    /* number of nodes, free or allocated, that may enter this index */
+    size_t num_nodes;
+    struct utspace_split_node **nodes;
+};
+
+/* The untypeds that were free when a checkpoint was taken, and the nodes created
+ * since, which restoring the checkpoint revokes and deletes */
+struct utspace_split_checkpoint {
+    bool active;
+    size_t num_nodes;
+    struct utspace_split_node **nodes;
+    struct utspace_split_node *created;
 };
 
 typedef struct utspace_split {
@@ -39,22 +73,48 @@ typedef struct utspace_split {
     struct utspace_split_node *dev_heads[CONFIG_WORD_SIZE];
     /* untypeds that are known to be RAM from the device region */
     struct utspace_split_node *dev_mem_heads[CONFIG_WORD_SIZE];
+    /* physical address indices of each of the above */
+    struct utspace_split_paddr_index index;
+    struct utspace_split_paddr_index dev_index;
+    struct utspace_split_paddr_index dev_mem_index;
+    struct utspace_split_checkpoint checkpoint;
+    /* the cspaces the slots of the nodes are in, which nodes keep a compact reference
+     * to instead of a whole path */
+    cspace_slot_table_t slots;
 } utspace_split_t;
 
 void utspace_split_create(utspace_split_t *split);
 int _utspace_split_add_uts(struct allocman *alloc, void *_split, size_t num, const cspacepath_t *uts, size_t *size_bits, uintptr_t *paddr, int utType);
 
 seL4_Word _utspace_split_alloc(struct allocman *alloc, void *_split, size_t size_bits, seL4_Word type, const cspacepath_t *slot, uintptr_t paddr, bool canBeDev, int *error);
+seL4_Word _utspace_split_alloc_in_range(struct allocman *alloc, void *_split, size_t size_bits, seL4_Word type, const cspacepath_t *slot, uintptr_t start, uintptr_t end, bool canBeDev, int *error);
+seL4_Word _utspace_split_alloc_coloured(struct allocman *alloc, void *_split, size_t size_bits, seL4_Word type, const cspacepath_t *slot, size_t colour_bits, seL4_Word colours, bool canBeDev, int *error);
+int _utspace_split_presplit(struct allocman *alloc, void *_split, size_t size_bits, size_t target);
+/* Record the free untypeds, so that _utspace_split_restore can return to this state */
+int _utspace_split_checkpoint(struct allocman *alloc, void *_split);
+/* Revoke every free untyped from the last checkpoint and delete the book keeping of
+ * everything split or added since then. Untypeds added since the checkpoint are kept,
+ * free, and become part of it */
+int _utspace_split_restore(struct allocman *alloc, void *_split);
 void _utspace_split_free(struct allocman *alloc, void *_split, seL4_Word cookie, size_t size_bits);
 
 uintptr_t _utspace_split_paddr(void *_split, seL4_Word cookie, size_t size_bits);
 
+/* Fill out a snapshot of the free lists. Walks every free node */
+void _utspace_split_stats(void *_split, struct utspace_stats *stats);
+
 static inline struct utspace_interface utspace_split_make_interface(utspace_split_t *split) {
     return (struct utspace_interface) {
         .alloc = _utspace_split_alloc,
         .free = _utspace_split_free,
         .add_uts = _utspace_split_add_uts,
         .paddr = _utspace_split_paddr,
+        .alloc_in_range = _utspace_split_alloc_in_range,
+        .alloc_coloured = _utspace_split_alloc_coloured,
+        .stats = _utspace_split_stats,
+        .presplit = _utspace_split_presplit,
+        .checkpoint = _utspace_split_checkpoint,
+        .restore = _utspace_split_restore,
         .properties = ALLOCMAN_DEFAULT_PROPERTIES,
         .utspace = split
     };
@@ -14,20 +14,51 @@
 
 /* This is an untyped manager that is vaguely related to the twinkle allocator.
    This means it does a simple progressive allocation of untypeds and doesn't
-   support free. */
+   support free.
+
+   Optionally it can be created in a reclaiming mode. In this mode untypeds are
+   kept in buckets according to the largest object that still fits in them, so
+   finding an untyped for an allocation is a find-first-set over the non empty
+   buckets. Each untyped also counts the objects that have been created from it,
+   and once all of them have been freed its offset is reset to zero, matching
+   the kernel resetting an untyped that has no children on the next retype. */
+
+#define UTSPACE_TWINKLE_NO_UT ((size_t)-1)
 
 struct utspace_twinkle_ut {
     cspacepath_t path;
     size_t offset;
     size_t size_bits;
+    /* The following are only used in reclaiming mode */
+    /* number of objects created from this untyped that have not been freed */
+    size_t refcount;
+    /* bucket this untyped is in, or UTSPACE_TWINKLE_NO_UT if it is full */
+    size_t bucket;
+    /* index of the next/previous untyped in the bucket */
+    size_t next, prev;
 };
 
 typedef struct utspace_twinkle {
     size_t num_uts;
     struct utspace_twinkle_ut *uts;
+    /* non zero if created with utspace_twinkle_create_reclaiming */
+    int reclaim;
+    /* heads[n] is the first untyped in which at most an object of size n fits */
+    size_t heads[CONFIG_WORD_SIZE];
+    /* bit n is set iff heads[n] is not empty */
+    seL4_Word nonempty;
 } utspace_twinkle_t;
 
 void utspace_twinkle_create(utspace_twinkle_t *twinkle);
+
+/**
+ * Create a twinkle allocator that supports free. Allocations return a cookie that
+ * identifies the untyped they were made from, and an untyped is reused from the
+ * start once every object carved from it has been freed.
+ *
+ * @param twinkle Allocator to initialise
+ */
+void utspace_twinkle_create_reclaiming(utspace_twinkle_t *twinkle);
 int _utspace_twinkle_add_uts(struct allocman *alloc, void *_twinkle, size_t num, const cspacepath_t *uts, size_t *size_bits, uintptr_t *paddr, int utType);
 
 seL4_Word _utspace_twinkle_alloc(struct allocman *alloc, void *_twinkle, size_t size_bits, seL4_Word type, const cspacepath_t *slot, uintptr_t paddr, bool canBeDev, int *error);
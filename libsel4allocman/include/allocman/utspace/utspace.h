@@ -6,7 +6,9 @@
 
 #pragma once
 
+#include <autoconf.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sel4/types.h>
 #include <allocman/properties.h>
 #include <allocman/cspace/cspace.h>
@@ -31,6 +33,7 @@
  * the kernel.
  */
 #define ALLOCMAN_UT_DEV_MEM 2
+#define ALLOCMAN_UT_TYPES 3
 
 /* Use the value of 1 internally to indicate the absence of a physical address.
  * This is chosen because the zero frame might actually be valid physical memory,
@@ -50,6 +53,18 @@ static inline size_t get_sel4_object_size(seL4_Word type, size_t size_bits) {
 
 struct allocman;
 
+/* Snapshot of the free memory in a utspace, indexed by the ALLOCMAN_UT_* type of
+ * the memory. See the stats function of utspace_interface_t */
+struct utspace_stats {
+    /* number of free untypeds of each size_bits */
+    size_t free[ALLOCMAN_UT_TYPES][CONFIG_WORD_SIZE];
+    uint64_t free_bytes[ALLOCMAN_UT_TYPES];
+    /* size_bits of the largest free untyped, or 0 if there are none. As untypeds are
+     * never merged, BIT(largest_free_bits) well below free_bytes means the memory is
+     * fragmented */
+    size_t largest_free_bits[ALLOCMAN_UT_TYPES];
+};
+
 typedef struct utspace_interface {
     /* size_bits is always the size in memory of allocated object. This differs to the untypedretype
        semantics of size_bits when cnodes are involved */
@@ -57,6 +72,20 @@ typedef struct utspace_interface {
     void (*free)(struct allocman *alloc, void *utspace, seL4_Word cookie, size_t size_bits);
     int (*add_uts)(struct allocman *alloc, void *utspace, size_t num, const cspacepath_t *uts, size_t *size_bits, uintptr_t *paddr, int utType);
     uintptr_t (*paddr)(void *utspace, seL4_Word cookie, size_t size_bits);
+    /* Optional. Allocate an object that lies entirely within the physical range [start, end) */
+    seL4_Word (*alloc_in_range)(struct allocman *alloc, void *utspace, size_t size_bits, seL4_Word object_type, const cspacepath_t *slot, uintptr_t start, uintptr_t end, bool canBeDevice, int *error);
+    /* Optional. Allocate an object whose every page has a colour, bits seL4_PageBits and up of
+       its paddr, that is set in colours */
+    seL4_Word (*alloc_coloured)(struct allocman *alloc, void *utspace, size_t size_bits, seL4_Word object_type, const cspacepath_t *slot, size_t colour_bits, seL4_Word colours, bool canBeDevice, int *error);
+    /* Optional. Fill out a snapshot of the free memory */
+    void (*stats)(void *utspace, struct utspace_stats *stats);
+    /* Optional. Split at most one larger untyped towards having target free untypeds of
+       size_bits. Returns 1 if it split one, 0 if the target is met or nothing can be split */
+    int (*presplit)(struct allocman *alloc, void *utspace, size_t size_bits, size_t target);
+    /* Optional. Record the current state, so that restore can return to it by revoking
+       everything allocated since. Objects allocated since the checkpoint are destroyed */
+    int (*checkpoint)(struct allocman *alloc, void *utspace);
+    int (*restore)(struct allocman *alloc, void *utspace);
     struct allocman_properties properties;
     void *utspace;
 }utspace_interface_t;
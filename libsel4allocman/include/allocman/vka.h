@@ -18,6 +18,44 @@
 
 void allocman_make_vka(vka_t *vka, allocman_t *alloc);
 
+/* Backing data for a vka made by allocman_make_local_vka */
+struct allocman_local_vka {
+    allocman_t *alloc;
+    int core;
+};
+
+/**
+ * Make a VKA object using this allocman that prefers to allocate objects from memory
+ * local to a particular core (see allocman_configure_locality). Passing this vka to
+ * thread or process creation places their stacks, IPC buffers and paging structures
+ * close to the core they will run on.
+ *
+ * @param vka structure for the vka interface object
+ * @param local storage for the vka. Must remain valid for the lifetime of the vka
+ * @param alloc allocator to be used with this vka
+ * @param core core that allocations should be local to
+ */
+void allocman_make_local_vka(vka_t *vka, struct allocman_local_vka *local, allocman_t *alloc, int core);
+
+/* Backing data for a vka made by allocman_make_coloured_vka */
+struct allocman_coloured_vka {
+    allocman_t *alloc;
+    seL4_Word colours;
+};
+
+/**
+ * Make a VKA object using this allocman that only allocates objects from memory of the given
+ * cache colours (see allocman_configure_colours). Passing this vka to process creation confines
+ * the memory of the process to a partition of the cache.
+ *
+ * @param vka structure for the vka interface object
+ * @param coloured storage for the vka. Must remain valid for the lifetime of the vka
+ * @param alloc allocator to be used with this vka
+ * @param colours bitmap of the colours allocations may use
+ */
+void allocman_make_coloured_vka(vka_t *vka, struct allocman_coloured_vka *coloured, allocman_t *alloc,
+                                seL4_Word colours);
+
 /**
  * Make an allocman from a VKA
  * This constructs an allocman that has a cspace and utspace
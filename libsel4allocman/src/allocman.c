@@ -8,13 +8,44 @@
 #include <allocman/util.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 #include <sel4/sel4.h>
 #include <vka/capops.h>
+#include <vka/object.h>
 #include <sel4utils/util.h>
 
 static int _refill_watermark(allocman_t *alloc);
 
+/* Thread cache attached to the current thread, if any */
+static __thread allocman_thread_cache_t *_thread_cache;
+/* How many allocman entry points the current thread is nested in. Only the outermost
+ * call takes the lock and only the outermost call may use the thread cache, as
+ * recursive calls from the allocators must go through the watermark logic */
+static __thread size_t _thread_depth;
+
+static inline void _acquire(allocman_t *alloc)
+{
+    if (_thread_depth++ == 0 && alloc->lock.acquire) {
+        alloc->lock.acquire(alloc->lock.cookie);
+    }
+}
+
+static inline void _release(allocman_t *alloc)
+{
+    if (--_thread_depth == 0 && alloc->lock.release) {
+        alloc->lock.release(alloc->lock.cookie);
+    }
+}
+
+static inline allocman_thread_cache_t *_thread_cache_get(allocman_t *alloc)
+{
+    if (_thread_depth == 0 && _thread_cache && _thread_cache->alloc == alloc) {
+        return _thread_cache;
+    }
+    return NULL;
+}
+
 static inline int _can_alloc(struct allocman_properties properties, size_t alloc_depth, size_t free_depth)
 {
     int in_alloc = alloc_depth > 0;
@@ -48,33 +79,62 @@ static inline void _end_operation(allocman_t *alloc, int root)
     }
 }
 
+/* Ask the reclaimers from *next on, in priority order, until one of them frees something.
+ * *next is left after that reclaimer, so that the caller can retry what failed and ask
+ * the rest if it fails again. Returns whether anything was freed */
+static int _reclaim_next(allocman_t *alloc, struct allocman_reclaimer **next, size_t bytes)
+{
+    size_t freed = 0;
+    if (alloc->reclaiming) {
+        return 0;
+    }
+    alloc->reclaiming = 1;
+    while (*next && !freed) {
+        struct allocman_reclaimer *reclaimer = *next;
+        *next = reclaimer->next;
+        freed = reclaimer->reclaim(reclaimer->cookie, bytes);
+    }
+    alloc->reclaiming = 0;
+    if (freed) {
+        alloc->stats.reclaims++;
+        alloc->stats.reclaimed_bytes += freed;
+    }
+    return freed > 0;
+}
+
 static void allocman_mspace_queue_for_free(allocman_t *alloc, void *ptr, size_t bytes) {
     if (alloc->num_freed_mspace_chunks == alloc->desired_freed_mspace_chunks) {
+        alloc->stats.freed_queue_overflows++;
         assert(!"Out of space to store free'd objects. Leaking memory");
         return;
     }
     alloc->freed_mspace_chunks[alloc->num_freed_mspace_chunks] =
         (struct allocman_freed_mspace_chunk) {ptr, bytes};
     alloc->num_freed_mspace_chunks++;
+    alloc->stats.freed_mspace_chunks_high_water = MAX(alloc->stats.freed_mspace_chunks_high_water, alloc->num_freed_mspace_chunks);
 }
 
 static void allocman_cspace_queue_for_free(allocman_t *alloc, const cspacepath_t *path) {
     if (alloc->num_freed_slots == alloc->desired_freed_slots) {
+        alloc->stats.freed_queue_overflows++;
         assert(!"Out of space to store free'd objects. Leaking memory");
         return;
     }
     alloc->freed_slots[alloc->num_freed_slots] = *path;
     alloc->num_freed_slots++;
+    alloc->stats.freed_slots_high_water = MAX(alloc->stats.freed_slots_high_water, alloc->num_freed_slots);
 }
 
 static void allocman_utspace_queue_for_free(allocman_t *alloc, seL4_Word cookie, size_t size_bits) {
     if (alloc->num_freed_utspace_chunks == alloc->desired_freed_utspace_chunks) {
+        alloc->stats.freed_queue_overflows++;
         assert(!"Out of space to store free'd objects. Leaking memory");
         return;
     }
     alloc->freed_utspace_chunks[alloc->num_freed_utspace_chunks] =
         (struct allocman_freed_utspace_chunk) {size_bits, cookie};
     alloc->num_freed_utspace_chunks++;
+    alloc->stats.freed_utspace_chunks_high_water = MAX(alloc->stats.freed_utspace_chunks_high_water, alloc->num_freed_utspace_chunks);
 }
 
 /* this nasty macro prevents code duplication for the free functions. Unfortunately I can think of no other
@@ -93,21 +153,95 @@ static void allocman_utspace_queue_for_free(allocman_t *alloc, seL4_Word cookie,
     _end_operation(alloc, root); \
 } while(0)
 
-void allocman_cspace_free(allocman_t *alloc, const cspacepath_t *slot)
+static void _allocman_cspace_free(allocman_t *alloc, const cspacepath_t *slot)
 {
     ALLOCMAN_FREE(alloc, cspace, slot);
 }
 
-void allocman_mspace_free(allocman_t *alloc, void *ptr, size_t bytes)
+static void _allocman_mspace_free(allocman_t *alloc, void *ptr, size_t bytes)
 {
     ALLOCMAN_FREE(alloc, mspace, ptr, bytes);
 }
 
-void allocman_utspace_free(allocman_t *alloc, seL4_Word cookie, size_t size_bits)
+static void _allocman_utspace_free(allocman_t *alloc, seL4_Word cookie, size_t size_bits)
 {
     ALLOCMAN_FREE(alloc, utspace, cookie, size_bits);
 }
 
+void allocman_cspace_free(allocman_t *alloc, const cspacepath_t *slot)
+{
+    allocman_thread_cache_t *cache = _thread_cache_get(alloc);
+    if (cache) {
+        if (cache->num_slots == ALLOCMAN_THREAD_CACHE_SLOTS) {
+            _acquire(alloc);
+            for (size_t i = 0; i < ALLOCMAN_THREAD_CACHE_BATCH; i++) {
+                _allocman_cspace_free(alloc, &cache->slots[--cache->num_slots]);
+            }
+            _release(alloc);
+        }
+        cache->slots[cache->num_slots++] = *slot;
+        return;
+    }
+    _acquire(alloc);
+    _allocman_cspace_free(alloc, slot);
+    _release(alloc);
+}
+
+void allocman_mspace_free(allocman_t *alloc, void *ptr, size_t bytes)
+{
+    allocman_thread_cache_t *cache = _thread_cache_get(alloc);
+    if (cache) {
+        int empty = -1;
+        for (int i = 0; i < ALLOCMAN_THREAD_CACHE_MSPACE_CLASSES; i++) {
+            if (cache->mspace[i].count > 0 && cache->mspace[i].size == bytes) {
+                if (cache->mspace[i].count < ALLOCMAN_THREAD_CACHE_MSPACE_CHUNKS) {
+                    cache->mspace[i].chunks[cache->mspace[i].count++] = ptr;
+                    return;
+                }
+                empty = -1;
+                break;
+            }
+            if (cache->mspace[i].count == 0 && empty == -1) {
+                empty = i;
+            }
+        }
+        if (empty != -1) {
+            cache->mspace[empty].size = bytes;
+            cache->mspace[empty].chunks[0] = ptr;
+            cache->mspace[empty].count = 1;
+            return;
+        }
+    }
+    _acquire(alloc);
+    _allocman_mspace_free(alloc, ptr, bytes);
+    _release(alloc);
+}
+
+static void _thread_cache_flush_utspace(allocman_thread_cache_t *cache)
+{
+    _acquire(cache->alloc);
+    while (cache->num_freed_utspace > 0) {
+        struct allocman_freed_utspace_chunk chunk = cache->freed_utspace[--cache->num_freed_utspace];
+        _allocman_utspace_free(cache->alloc, chunk.cookie, chunk.size_bits);
+    }
+    _release(cache->alloc);
+}
+
+void allocman_utspace_free(allocman_t *alloc, seL4_Word cookie, size_t size_bits)
+{
+    allocman_thread_cache_t *cache = _thread_cache_get(alloc);
+    if (cache) {
+        if (cache->num_freed_utspace == ALLOCMAN_THREAD_CACHE_FREED_UTSPACE) {
+            _thread_cache_flush_utspace(cache);
+        }
+        cache->freed_utspace[cache->num_freed_utspace++] = (struct allocman_freed_utspace_chunk) {size_bits, cookie};
+        return;
+    }
+    _acquire(alloc);
+    _allocman_utspace_free(alloc, cookie, size_bits);
+    _release(alloc);
+}
+
 static void *_try_watermark_mspace(allocman_t *alloc, size_t size, int *_error)
 {
     size_t i;
@@ -117,6 +251,7 @@ static void *_try_watermark_mspace(allocman_t *alloc, size_t size, int *_error)
                 void *ret = alloc->mspace_chunks[i][--alloc->mspace_chunk_count[i]];
                 SET_ERROR(_error, 0);
                 alloc->used_watermark = 1;
+                alloc->stats.watermark_allocations++;
                 return ret;
             }
         }
@@ -131,6 +266,7 @@ static int _try_watermark_cspace(allocman_t *alloc, cspacepath_t *slot)
         return 1;
     }
     alloc->used_watermark = 1;
+    alloc->stats.watermark_allocations++;
     *slot = alloc->cspace_slots[--alloc->num_cspace_slots];
     return 0;
 }
@@ -151,6 +287,7 @@ static seL4_Word _try_watermark_utspace(allocman_t *alloc, size_t size_bits, seL
                     return 0;
                 }
                 alloc->used_watermark = 1;
+                alloc->stats.watermark_allocations++;
                 alloc->utspace_chunk_count[i]--;
                 allocman_cspace_free(alloc, &result.slot);
                 SET_ERROR(_error, 0);
@@ -190,6 +327,14 @@ static void *_allocman_mspace_alloc(allocman_t *alloc, size_t size, int *_error,
     alloc->mspace_alloc_depth++;
     ret = alloc->mspace.alloc(alloc, alloc->mspace.mspace, size, &error);
     alloc->mspace_alloc_depth--;
+    if (error && root_op) {
+        struct allocman_reclaimer *next = alloc->reclaimers;
+        while (error && _reclaim_next(alloc, &next, size)) {
+            alloc->mspace_alloc_depth++;
+            ret = alloc->mspace.alloc(alloc, alloc->mspace.mspace, size, &error);
+            alloc->mspace_alloc_depth--;
+        }
+    }
     if (!error) {
         _end_operation(alloc, root_op);
         SET_ERROR(_error, 0);
@@ -283,6 +428,14 @@ static seL4_Word _allocman_utspace_alloc(allocman_t *alloc, size_t size_bits, se
     alloc->utspace_alloc_depth++;
     ret = alloc->utspace.alloc(alloc, alloc->utspace.utspace, size_bits, type, path, paddr, canBeDev, &error);
     alloc->utspace_alloc_depth--;
+    if (error && root_op) {
+        struct allocman_reclaimer *next = alloc->reclaimers;
+        while (error && _reclaim_next(alloc, &next, BIT(size_bits))) {
+            alloc->utspace_alloc_depth++;
+            ret = alloc->utspace.alloc(alloc, alloc->utspace.utspace, size_bits, type, path, paddr, canBeDev, &error);
+            alloc->utspace_alloc_depth--;
+        }
+    }
     if (!error) {
         _end_operation(alloc, root_op);
         SET_ERROR(_error, error);
@@ -306,17 +459,307 @@ static seL4_Word _allocman_utspace_alloc(allocman_t *alloc, size_t size_bits, se
 
 void *allocman_mspace_alloc(allocman_t *alloc, size_t size, int *_error)
 {
-    return _allocman_mspace_alloc(alloc, size, _error, 1);
+    void *ret;
+    allocman_thread_cache_t *cache = _thread_cache_get(alloc);
+    if (cache) {
+        for (int i = 0; i < ALLOCMAN_THREAD_CACHE_MSPACE_CLASSES; i++) {
+            if (cache->mspace[i].count > 0 && cache->mspace[i].size == size) {
+                SET_ERROR(_error, 0);
+                return cache->mspace[i].chunks[--cache->mspace[i].count];
+            }
+        }
+    }
+    _acquire(alloc);
+    ret = _allocman_mspace_alloc(alloc, size, _error, 1);
+    _release(alloc);
+    return ret;
 }
 
 int allocman_cspace_alloc(allocman_t *alloc, cspacepath_t *slot)
 {
-    return _allocman_cspace_alloc(alloc, slot, 1);
+    int error;
+    allocman_thread_cache_t *cache = _thread_cache_get(alloc);
+    if (cache) {
+        if (cache->num_slots == 0) {
+            /* Refill without dipping into the watermark, we fall back to
+             * the regular path below if this fails */
+            _acquire(alloc);
+            while (cache->num_slots < ALLOCMAN_THREAD_CACHE_BATCH &&
+                   !_allocman_cspace_alloc(alloc, &cache->slots[cache->num_slots], 0)) {
+                cache->num_slots++;
+            }
+            _release(alloc);
+        }
+        if (cache->num_slots > 0) {
+            *slot = cache->slots[--cache->num_slots];
+            return 0;
+        }
+    }
+    _acquire(alloc);
+    error = _allocman_cspace_alloc(alloc, slot, 1);
+    _release(alloc);
+    return error;
+}
+
+static void _thread_cache_refill_utspace(allocman_thread_cache_t *cache, size_t i)
+{
+    allocman_t *alloc = cache->alloc;
+    _acquire(alloc);
+    while (cache->utspace[i].count < ALLOCMAN_THREAD_CACHE_BATCH) {
+        struct allocman_utspace_allocation *obj = &cache->utspace[i].objects[cache->utspace[i].count];
+        int error = _allocman_cspace_alloc(alloc, &obj->slot, 0);
+        if (error) {
+            break;
+        }
+        obj->cookie = _allocman_utspace_alloc(alloc, cache->utspace[i].size_bits, cache->utspace[i].type, &obj->slot,
+                                              ALLOCMAN_NO_PADDR, false, &error, 0);
+        if (error) {
+            _allocman_cspace_free(alloc, &obj->slot);
+            break;
+        }
+        cache->utspace[i].count++;
+    }
+    _release(alloc);
 }
 
 seL4_Word allocman_utspace_alloc_at(allocman_t *alloc, size_t size_bits, seL4_Word type, const cspacepath_t *path, uintptr_t paddr, bool canBeDev, int *_error)
 {
-    return _allocman_utspace_alloc(alloc, size_bits, type, path, paddr, canBeDev, _error, 1);
+    seL4_Word ret;
+    allocman_thread_cache_t *cache = _thread_cache_get(alloc);
+    if (cache && paddr == ALLOCMAN_NO_PADDR) {
+        for (size_t i = 0; i < cache->num_utspace_classes; i++) {
+            if (cache->utspace[i].size_bits != size_bits || cache->utspace[i].type != type) {
+                continue;
+            }
+            if (cache->utspace[i].count == 0) {
+                _thread_cache_refill_utspace(cache, i);
+            }
+            if (cache->utspace[i].count > 0) {
+                struct allocman_utspace_allocation obj = cache->utspace[i].objects[cache->utspace[i].count - 1];
+                if (vka_cnode_move(path, &obj.slot) == seL4_NoError) {
+                    cache->utspace[i].count--;
+                    allocman_cspace_free(alloc, &obj.slot);
+                    SET_ERROR(_error, 0);
+                    return obj.cookie;
+                }
+            }
+            break;
+        }
+    }
+    _acquire(alloc);
+    ret = _allocman_utspace_alloc(alloc, size_bits, type, path, paddr, canBeDev, _error, 1);
+    _release(alloc);
+    return ret;
+}
+
+seL4_Word allocman_utspace_alloc_near(allocman_t *alloc, int core, size_t size_bits, seL4_Word type, const cspacepath_t *path, bool canBeDev, int *_error)
+{
+    int error = 1;
+    seL4_Word ret = 0;
+    if (alloc->have_utspace && alloc->utspace.alloc_in_range && core >= 0 && (size_t)core < alloc->num_locality_cores) {
+        int node = alloc->locality_core_nodes[core];
+        _acquire(alloc);
+        if (_can_alloc(alloc->utspace.properties, alloc->utspace_alloc_depth, alloc->utspace_free_depth)) {
+            int root_op = _start_operation(alloc);
+            alloc->utspace_alloc_depth++;
+            for (size_t i = 0; i < alloc->num_locality_regions && error; i++) {
+                const struct allocman_locality_region *region = &alloc->locality_regions[i];
+                if (region->node == node) {
+                    ret = alloc->utspace.alloc_in_range(alloc, alloc->utspace.utspace, size_bits, type, path,
+                                                        region->paddr, region->paddr + region->size, canBeDev, &error);
+                }
+            }
+            alloc->utspace_alloc_depth--;
+            _end_operation(alloc, root_op);
+        }
+        _release(alloc);
+    }
+    if (!error) {
+        SET_ERROR(_error, 0);
+        return ret;
+    }
+    ZF_LOGV("No local memory for core %d, falling back to any memory", core);
+    return allocman_utspace_alloc(alloc, size_bits, type, path, canBeDev, _error);
+}
+
+seL4_Word allocman_utspace_alloc_coloured(allocman_t *alloc, seL4_Word colours, size_t size_bits, seL4_Word type, const cspacepath_t *path, bool canBeDev, int *_error)
+{
+    int error = 1;
+    seL4_Word ret = 0;
+    seL4_Word all = BIT(alloc->colour_bits) == seL4_WordBits ? ~(seL4_Word)0 : MASK(BIT(alloc->colour_bits));
+    if (alloc->colour_bits == 0 || (colours & all) == all) {
+        return allocman_utspace_alloc(alloc, size_bits, type, path, canBeDev, _error);
+    }
+    if (!alloc->have_utspace || !alloc->utspace.alloc_coloured) {
+        ZF_LOGE("Utspace allocator can not allocate by colour");
+        SET_ERROR(_error, 1);
+        return 0;
+    }
+    _acquire(alloc);
+    if (_can_alloc(alloc->utspace.properties, alloc->utspace_alloc_depth, alloc->utspace_free_depth)) {
+        int root_op = _start_operation(alloc);
+        alloc->utspace_alloc_depth++;
+        ret = alloc->utspace.alloc_coloured(alloc, alloc->utspace.utspace, size_bits, type, path, alloc->colour_bits,
+                                            colours, canBeDev, &error);
+        alloc->utspace_alloc_depth--;
+        _end_operation(alloc, root_op);
+    }
+    _release(alloc);
+    SET_ERROR(_error, error);
+    return error ? 0 : ret;
+}
+
+int allocman_cspace_alloc_range(allocman_t *alloc, size_t num, cspacepath_t *first)
+{
+    int root_op;
+    int error;
+    if (!alloc->have_cspace || !alloc->cspace.alloc_range || num == 0) {
+        return 1;
+    }
+    _acquire(alloc);
+    if (!_can_alloc(alloc->cspace.properties, alloc->cspace_alloc_depth, alloc->cspace_free_depth)) {
+        _release(alloc);
+        return 1;
+    }
+    root_op = _start_operation(alloc);
+    alloc->cspace_alloc_depth++;
+    error = alloc->cspace.alloc_range(alloc, alloc->cspace.cspace, num, first);
+    alloc->cspace_alloc_depth--;
+    _end_operation(alloc, root_op);
+    _release(alloc);
+    return error;
+}
+
+void allocman_cspace_free_range(allocman_t *alloc, const cspacepath_t *first, size_t num)
+{
+    if (!alloc->cspace.free_range) {
+        for (size_t i = 0; i < num; i++) {
+            cspacepath_t slot = allocman_cspace_make_path(alloc, first->capPtr + i);
+            allocman_cspace_free(alloc, &slot);
+        }
+        return;
+    }
+    _acquire(alloc);
+    if (!_can_free(alloc->cspace.properties, alloc->cspace_alloc_depth, alloc->cspace_free_depth)) {
+        for (size_t i = 0; i < num; i++) {
+            cspacepath_t slot = allocman_cspace_make_path(alloc, first->capPtr + i);
+            allocman_cspace_queue_for_free(alloc, &slot);
+        }
+    } else {
+        int root = _start_operation(alloc);
+        alloc->cspace_free_depth++;
+        alloc->cspace.free_range(alloc, alloc->cspace.cspace, first, num);
+        alloc->cspace_free_depth--;
+        _end_operation(alloc, root);
+    }
+    _release(alloc);
+}
+
+static int _paths_consecutive(const cspacepath_t *paths, size_t num)
+{
+    for (size_t i = 1; i < num; i++) {
+        if (paths[i].root != paths[0].root || paths[i].dest != paths[0].dest ||
+            paths[i].destDepth != paths[0].destDepth || paths[i].offset != paths[0].offset + i) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+seL4_Word allocman_utspace_alloc_n(allocman_t *alloc, size_t size_bits, seL4_Word type, const cspacepath_t *paths, size_t num, bool canBeDev, int *_error)
+{
+    int error;
+    struct allocman_utspace_batch *batch;
+    size_t created = 0;
+    size_t sel4_size_bits;
+    if (num == 0) {
+        SET_ERROR(_error, 1);
+        return 0;
+    }
+    sel4_size_bits = get_sel4_object_size(type, size_bits);
+    batch = allocman_mspace_alloc(alloc, sizeof(*batch), &error);
+    if (error) {
+        SET_ERROR(_error, error);
+        return 0;
+    }
+    batch->size_bits = size_bits + (num > 1 ? CONFIG_WORD_SIZE - CLZL(num - 1) : 0);
+    error = allocman_cspace_alloc(alloc, &batch->ut);
+    if (error) {
+        goto fail_slot;
+    }
+    batch->cookie = allocman_utspace_alloc(alloc, batch->size_bits, seL4_UntypedObject, &batch->ut, canBeDev, &error);
+    if (error) {
+        goto fail_ut;
+    }
+    if (_paths_consecutive(paths, num)) {
+        while (created < num) {
+            size_t count = MIN(num - created, CONFIG_RETYPE_FAN_OUT_LIMIT);
+            error = seL4_Untyped_Retype(batch->ut.capPtr, type, sel4_size_bits, paths[0].root, paths[0].dest,
+                                        paths[0].destDepth, paths[0].offset + created, count);
+            if (error != seL4_NoError) {
+                goto fail_retype;
+            }
+            created += count;
+        }
+    } else {
+        while (created < num) {
+            error = seL4_Untyped_Retype(batch->ut.capPtr, type, sel4_size_bits, paths[created].root,
+                                        paths[created].dest, paths[created].destDepth, paths[created].offset, 1);
+            if (error != seL4_NoError) {
+                goto fail_retype;
+            }
+            created++;
+        }
+    }
+    SET_ERROR(_error, 0);
+    return (seL4_Word)batch;
+fail_retype:
+    ZF_LOGE("Failed to retype %zu objects from batch untyped", num);
+    while (created > 0) {
+        created--;
+        vka_cnode_delete(&paths[created]);
+    }
+    vka_cnode_delete(&batch->ut);
+    allocman_utspace_free(alloc, batch->cookie, batch->size_bits);
+fail_ut:
+    allocman_cspace_free(alloc, &batch->ut);
+fail_slot:
+    allocman_mspace_free(alloc, batch, sizeof(*batch));
+    SET_ERROR(_error, 1);
+    return 0;
+}
+
+void allocman_utspace_free_n(allocman_t *alloc, seL4_Word cookie, size_t size_bits, size_t num)
+{
+    struct allocman_utspace_batch *batch = (struct allocman_utspace_batch *)cookie;
+    assert(batch->size_bits == size_bits + (num > 1 ? CONFIG_WORD_SIZE - CLZL(num - 1) : 0));
+    vka_cnode_delete(&batch->ut);
+    allocman_cspace_free(alloc, &batch->ut);
+    allocman_utspace_free(alloc, batch->cookie, batch->size_bits);
+    allocman_mspace_free(alloc, batch, sizeof(*batch));
+}
+
+/* Order the queued untyped frees by descending physical address. As the queue is
+ * drained from the end this frees in ascending address order, so both halves of a split
+ * are returned next to each other and can be merged straight away, with the merged
+ * parent then able to merge with its own sibling in the same pass. Queues are small,
+ * so insertion sort is fine */
+static void _sort_freed_utspace(allocman_t *alloc)
+{
+    struct allocman_freed_utspace_chunk *chunks = alloc->freed_utspace_chunks;
+    if (alloc->num_freed_utspace_chunks < 2 || !alloc->utspace.paddr) {
+        return;
+    }
+    for (size_t i = 1; i < alloc->num_freed_utspace_chunks; i++) {
+        struct allocman_freed_utspace_chunk chunk = chunks[i];
+        uintptr_t paddr = allocman_utspace_paddr(alloc, chunk.cookie, chunk.size_bits);
+        size_t j = i;
+        while (j > 0 && allocman_utspace_paddr(alloc, chunks[j - 1].cookie, chunks[j - 1].size_bits) < paddr) {
+            chunks[j] = chunks[j - 1];
+            j--;
+        }
+        chunks[j] = chunk;
+    }
 }
 
 static int _refill_watermark(allocman_t *alloc)
@@ -340,9 +783,13 @@ static int _refill_watermark(allocman_t *alloc)
        the same, and if we aren't we are boot strapping and I'm not convinced
        that all allocations orders are equivalent in this case */
     int limit = 0;
+    struct allocman_reclaimer *next = alloc->reclaimers;
     do {
         found_empty_pool = 0;
         did_allocation = 0;
+        if (alloc->num_freed_slots > 0 || alloc->num_freed_mspace_chunks > 0 || alloc->num_freed_utspace_chunks > 0) {
+            alloc->stats.drains++;
+        }
         while (alloc->num_freed_slots > 0) {
             cspacepath_t slot = alloc->freed_slots[--alloc->num_freed_slots];
             allocman_cspace_free(alloc, &slot);
@@ -354,6 +801,7 @@ static int _refill_watermark(allocman_t *alloc)
             allocman_mspace_free(alloc, chunk.ptr, chunk.size);
             did_allocation = 1;
         }
+        _sort_freed_utspace(alloc);
         while (alloc->num_freed_utspace_chunks > 0) {
             struct allocman_freed_utspace_chunk chunk = alloc->freed_utspace_chunks[--alloc->num_freed_utspace_chunks];
             allocman_utspace_free(alloc, chunk.cookie, chunk.size_bits);
@@ -405,10 +853,19 @@ static int _refill_watermark(allocman_t *alloc)
             }
         }
         limit++;
+        /* if the reserves still cannot be refilled, ask the reclaimers for memory one at
+           a time and try again after each that frees some. Any amount may help, and 0
+           would have them free everything */
+        if (found_empty_pool && (!did_allocation || limit >= 4) && _reclaim_next(alloc, &next, 1)) {
+            did_allocation = 1;
+            limit = 0;
+        }
     } while (found_empty_pool && did_allocation && limit < 4);
 
     alloc->refilling_watermark = 0;
-    if (!found_empty_pool) {
+    if (found_empty_pool) {
+        alloc->stats.refill_failures++;
+    } else {
         alloc->used_watermark = 0;
     }
     return found_empty_pool;
@@ -426,15 +883,333 @@ int allocman_create(allocman_t *alloc, struct mspace_interface mspace) {
 
 int allocman_fill_reserves(allocman_t *alloc) {
     int full;
-    int root = _start_operation(alloc);
+    int root;
+    _acquire(alloc);
+    root = _start_operation(alloc);
     /* force the reserves to be checked */
     alloc->used_watermark = 1;
     /* attempt to fill */
     full = _refill_watermark(alloc);
     _end_operation(alloc, root);
+    _release(alloc);
     return full;
 }
 
+void allocman_get_stats(allocman_t *alloc, struct allocman_stats *stats) {
+    _acquire(alloc);
+    *stats = alloc->stats;
+    _release(alloc);
+}
+
+void allocman_get_resource_stats(allocman_t *alloc, allocman_stats_t *stats) {
+    size_t i;
+    memset(stats, 0, sizeof(*stats));
+    _acquire(alloc);
+    stats->counters = alloc->stats;
+    stats->reserve_slots = alloc->num_cspace_slots;
+    for (i = 0; i < alloc->num_mspace_chunks; i++) {
+        stats->reserve_mspace_bytes += alloc->mspace_chunk_count[i] * alloc->mspace_chunk[i].size;
+    }
+    for (i = 0; i < alloc->num_utspace_chunks; i++) {
+        stats->reserve_utspace_bytes += (uint64_t)alloc->utspace_chunk_count[i] << alloc->utspace_chunk[i].size_bits;
+    }
+    stats->freed_slots = alloc->num_freed_slots;
+    for (i = 0; i < alloc->num_freed_mspace_chunks; i++) {
+        stats->freed_mspace_bytes += alloc->freed_mspace_chunks[i].size;
+    }
+    for (i = 0; i < alloc->num_freed_utspace_chunks; i++) {
+        stats->freed_utspace_bytes += BIT_ULL(alloc->freed_utspace_chunks[i].size_bits);
+    }
+    if (alloc->have_utspace && alloc->utspace.stats) {
+        alloc->utspace.stats(alloc->utspace.utspace, &stats->utspace);
+        stats->have_utspace_stats = 1;
+    }
+    if (alloc->have_cspace && alloc->cspace.stats) {
+        alloc->cspace.stats(alloc->cspace.cspace, &stats->cspace);
+        stats->have_cspace_stats = 1;
+    }
+    if (alloc->have_mspace && alloc->mspace.stats) {
+        alloc->mspace.stats(alloc->mspace.mspace, &stats->mspace);
+        stats->have_mspace_stats = 1;
+    }
+    _release(alloc);
+}
+
+static const char *ut_type_names[ALLOCMAN_UT_TYPES] = {
+    [ALLOCMAN_UT_KERNEL] = "ut",
+    [ALLOCMAN_UT_DEV] = "ut_dev",
+    [ALLOCMAN_UT_DEV_MEM] = "ut_dev_mem",
+};
+
+void allocman_stats_scrape(void *alloc, allocman_stats_callback64 callback64, void *cookie) {
+    allocman_stats_t stats;
+    char name[48];
+    allocman_get_resource_stats((allocman_t *)alloc, &stats);
+
+    callback64(stats.counters.freed_queue_overflows, "allocman_freed_queue_overflows", "frees leaked as a deferred free queue was full", cookie);
+    callback64(stats.counters.watermark_allocations, "allocman_watermark_allocations", "allocations satisfied from the watermark reserves", cookie);
+    callback64(stats.counters.refill_failures, "allocman_refill_failures", "times the watermark reserves could not be refilled", cookie);
+    callback64(stats.counters.reclaims, "allocman_reclaims", "times a reclaimer gave memory back", cookie);
+    callback64(stats.counters.reclaimed_bytes, "allocman_reclaimed_bytes", "bytes given back by reclaimers", cookie);
+    callback64(stats.reserve_slots, "allocman_reserve_slots", "slots held in the watermark reserves", cookie);
+    callback64(stats.reserve_mspace_bytes, "allocman_reserve_mspace_bytes", "bytes of mspace held in the watermark reserves", cookie);
+    callback64(stats.reserve_utspace_bytes, "allocman_reserve_utspace_bytes", "bytes of untyped held in the watermark reserves", cookie);
+    callback64(stats.freed_slots, "allocman_freed_slots", "slots waiting in the deferred free queue", cookie);
+    callback64(stats.freed_mspace_bytes, "allocman_freed_mspace_bytes", "bytes of mspace waiting in the deferred free queue", cookie);
+    callback64(stats.freed_utspace_bytes, "allocman_freed_utspace_bytes", "bytes of untyped waiting in the deferred free queue", cookie);
+    if (stats.have_utspace_stats) {
+        for (int type = 0; type < ALLOCMAN_UT_TYPES; type++) {
+            snprintf(name, sizeof(name), "allocman_%s_free_bytes", ut_type_names[type]);
+            callback64(stats.utspace.free_bytes[type], name, "bytes of free untyped", cookie);
+            snprintf(name, sizeof(name), "allocman_%s_largest_free_bits", ut_type_names[type]);
+            callback64(stats.utspace.largest_free_bits[type], name, "size_bits of the largest free untyped", cookie);
+            /* only the sizes there are free untypeds of, there are a lot of sizes */
+            for (int size_bits = 0; size_bits < CONFIG_WORD_SIZE; size_bits++) {
+                if (stats.utspace.free[type][size_bits]) {
+                    snprintf(name, sizeof(name), "allocman_%s_free_%d", ut_type_names[type], size_bits);
+                    callback64(stats.utspace.free[type][size_bits], name, "free untypeds of this size_bits", cookie);
+                }
+            }
+        }
+    }
+    if (stats.have_cspace_stats) {
+        callback64(stats.cspace.total_slots, "allocman_cspace_total_slots", "slots that can be allocated from", cookie);
+        callback64(stats.cspace.free_slots, "allocman_cspace_free_slots", "free slots", cookie);
+        callback64(stats.cspace.largest_free_run, "allocman_cspace_largest_free_run", "longest run of consecutive free slots", cookie);
+        callback64(stats.cspace.levels, "allocman_cspace_levels", "second level cnodes created", cookie);
+        callback64(stats.cspace.bookkeeping_bytes, "allocman_cspace_bookkeeping_bytes", "bytes of mspace used to track slots", cookie);
+    }
+    if (stats.have_mspace_stats) {
+        callback64(stats.mspace.free_bytes, "allocman_mspace_free_bytes", "bytes freed that can be allocated again", cookie);
+        callback64(stats.mspace.free_blocks, "allocman_mspace_free_blocks", "separate free blocks", cookie);
+        callback64(stats.mspace.largest_free, "allocman_mspace_largest_free", "bytes in the largest free block", cookie);
+        callback64(stats.mspace.unused_bytes, "allocman_mspace_unused_bytes", "bytes the pool has not yet handed out", cookie);
+    }
+}
+
+int allocman_configure_locality(allocman_t *alloc, size_t num_regions, const struct allocman_locality_region *regions,
+                                size_t num_cores, const int *core_nodes) {
+    if ((num_regions && !regions) || (num_cores && !core_nodes)) {
+        ZF_LOGE("Locality arrays must be provided");
+        return 1;
+    }
+    alloc->num_locality_regions = num_regions;
+    alloc->locality_regions = regions;
+    alloc->num_locality_cores = num_cores;
+    alloc->locality_core_nodes = core_nodes;
+    return 0;
+}
+
+int allocman_configure_colours(allocman_t *alloc, size_t colour_bits) {
+    if (BIT(colour_bits) > seL4_WordBits) {
+        ZF_LOGE("Too many colours for a colour bitmap");
+        return 1;
+    }
+    alloc->colour_bits = colour_bits;
+    return 0;
+}
+
+int allocman_configure_presplit(allocman_t *alloc, size_t num_targets, const struct allocman_presplit_target *targets) {
+    if (num_targets && !targets) {
+        ZF_LOGE("Presplit targets must be provided");
+        return 1;
+    }
+    alloc->num_presplit_targets = num_targets;
+    alloc->presplit_targets = targets;
+    return 0;
+}
+
+size_t allocman_presplit(allocman_t *alloc, size_t max_splits) {
+    size_t splits = 0;
+    if (!alloc->have_utspace || !alloc->utspace.presplit) {
+        return 0;
+    }
+    for (size_t i = 0; i < alloc->num_presplit_targets && splits < max_splits; i++) {
+        const struct allocman_presplit_target *target = &alloc->presplit_targets[i];
+        int split = 1;
+        while (split && splits < max_splits) {
+            split = 0;
+            _acquire(alloc);
+            if (_can_alloc(alloc->utspace.properties, alloc->utspace_alloc_depth, alloc->utspace_free_depth)) {
+                int root_op = _start_operation(alloc);
+                alloc->utspace_alloc_depth++;
+                split = alloc->utspace.presplit(alloc, alloc->utspace.utspace, target->size_bits, target->count);
+                alloc->utspace_alloc_depth--;
+                _end_operation(alloc, root_op);
+            }
+            _release(alloc);
+            splits += split;
+        }
+    }
+    return splits;
+}
+
+/* Give back the untyped and slot watermark reserves, so that they are not part of a
+ * checkpoint. Refills are held off until _refill_reserves */
+static void _drop_reserves(allocman_t *alloc) {
+    alloc->refilling_watermark = 1;
+    for (size_t i = 0; i < alloc->num_utspace_chunks; i++) {
+        while (alloc->utspace_chunk_count[i] > 0) {
+            struct allocman_utspace_allocation chunk = alloc->utspace_chunks[i][--alloc->utspace_chunk_count[i]];
+            vka_cnode_delete(&chunk.slot);
+            _allocman_utspace_free(alloc, chunk.cookie, alloc->utspace_chunk[i].size_bits);
+            allocman_cspace_free(alloc, &chunk.slot);
+        }
+    }
+    while (alloc->num_cspace_slots > 0) {
+        cspacepath_t slot = alloc->cspace_slots[--alloc->num_cspace_slots];
+        allocman_cspace_free(alloc, &slot);
+    }
+}
+
+static void _refill_reserves(allocman_t *alloc) {
+    alloc->refilling_watermark = 0;
+    alloc->used_watermark = 1;
+    _refill_watermark(alloc);
+}
+
+int allocman_checkpoint(allocman_t *alloc) {
+    int error;
+    if (!alloc->have_utspace || !alloc->utspace.checkpoint || !alloc->utspace.restore) {
+        ZF_LOGE("utspace does not support checkpoints");
+        return 1;
+    }
+    _acquire(alloc);
+    _drop_reserves(alloc);
+    error = alloc->utspace.checkpoint(alloc, alloc->utspace.utspace);
+    if (!error && alloc->have_cspace && alloc->cspace.checkpoint && alloc->cspace.restore) {
+        error = alloc->cspace.checkpoint(alloc, alloc->cspace.cspace);
+    }
+    _refill_reserves(alloc);
+    _release(alloc);
+    return error;
+}
+
+int allocman_restore(allocman_t *alloc) {
+    int error;
+    if (!alloc->have_utspace || !alloc->utspace.restore) {
+        ZF_LOGE("utspace does not support checkpoints");
+        return 1;
+    }
+    _acquire(alloc);
+    _drop_reserves(alloc);
+    error = alloc->utspace.restore(alloc, alloc->utspace.utspace);
+    if (!error && alloc->have_cspace && alloc->cspace.checkpoint && alloc->cspace.restore) {
+        error = alloc->cspace.restore(alloc, alloc->cspace.cspace);
+    }
+    _refill_reserves(alloc);
+    _release(alloc);
+    return error;
+}
+
+int allocman_configure_lock(allocman_t *alloc, struct allocman_lock lock) {
+    if (!lock.acquire || !lock.release) {
+        ZF_LOGE("Lock must provide both acquire and release");
+        return 1;
+    }
+    alloc->lock = lock;
+    return 0;
+}
+
+int allocman_register_reclaimer(allocman_t *alloc, struct allocman_reclaimer *reclaimer) {
+    if (!reclaimer || !reclaimer->reclaim) {
+        ZF_LOGE("Reclaimer must provide a reclaim function");
+        return 1;
+    }
+    _acquire(alloc);
+    /* after any of the same priority, so they are asked in the order they were added */
+    struct allocman_reclaimer **pos = &alloc->reclaimers;
+    while (*pos && (*pos)->priority <= reclaimer->priority) {
+        pos = &(*pos)->next;
+    }
+    reclaimer->next = *pos;
+    *pos = reclaimer;
+    _release(alloc);
+    return 0;
+}
+
+void allocman_unregister_reclaimer(allocman_t *alloc, struct allocman_reclaimer *reclaimer) {
+    assert(!alloc->reclaiming);
+    _acquire(alloc);
+    for (struct allocman_reclaimer **pos = &alloc->reclaimers; *pos; pos = &(*pos)->next) {
+        if (*pos == reclaimer) {
+            *pos = reclaimer->next;
+            break;
+        }
+    }
+    _release(alloc);
+}
+
+size_t allocman_reclaim(allocman_t *alloc, size_t bytes) {
+    size_t freed = 0;
+    _acquire(alloc);
+    if (!alloc->reclaiming) {
+        alloc->reclaiming = 1;
+        for (struct allocman_reclaimer *r = alloc->reclaimers; r && (bytes == 0 || freed < bytes); r = r->next) {
+            size_t got = r->reclaim(r->cookie, bytes ? bytes - freed : 0);
+            if (got) {
+                alloc->stats.reclaims++;
+                alloc->stats.reclaimed_bytes += got;
+                freed += got;
+            }
+        }
+        alloc->reclaiming = 0;
+    }
+    _release(alloc);
+    return freed;
+}
+
+void allocman_thread_cache_attach(allocman_t *alloc, allocman_thread_cache_t *cache) {
+    assert(!_thread_cache);
+    memset(cache, 0, sizeof(*cache));
+    cache->alloc = alloc;
+    _thread_cache = cache;
+}
+
+int allocman_thread_cache_configure_utspace(allocman_thread_cache_t *cache, size_t size_bits, seL4_Word type) {
+    if (cache->num_utspace_classes == ALLOCMAN_THREAD_CACHE_UTSPACE_CLASSES) {
+        ZF_LOGE("No space for another utspace class in the thread cache");
+        return 1;
+    }
+    cache->utspace[cache->num_utspace_classes].size_bits = size_bits;
+    cache->utspace[cache->num_utspace_classes].type = type;
+    cache->utspace[cache->num_utspace_classes].count = 0;
+    cache->num_utspace_classes++;
+    return 0;
+}
+
+void allocman_thread_cache_detach(void) {
+    allocman_thread_cache_t *cache = _thread_cache;
+    allocman_t *alloc;
+    if (!cache) {
+        return;
+    }
+    alloc = cache->alloc;
+    _acquire(alloc);
+    for (size_t i = 0; i < cache->num_utspace_classes; i++) {
+        while (cache->utspace[i].count > 0) {
+            struct allocman_utspace_allocation obj = cache->utspace[i].objects[--cache->utspace[i].count];
+            vka_cnode_delete(&obj.slot);
+            _allocman_utspace_free(alloc, obj.cookie, cache->utspace[i].size_bits);
+            _allocman_cspace_free(alloc, &obj.slot);
+        }
+    }
+    while (cache->num_freed_utspace > 0) {
+        struct allocman_freed_utspace_chunk chunk = cache->freed_utspace[--cache->num_freed_utspace];
+        _allocman_utspace_free(alloc, chunk.cookie, chunk.size_bits);
+    }
+    for (size_t i = 0; i < ALLOCMAN_THREAD_CACHE_MSPACE_CLASSES; i++) {
+        while (cache->mspace[i].count > 0) {
+            _allocman_mspace_free(alloc, cache->mspace[i].chunks[--cache->mspace[i].count], cache->mspace[i].size);
+        }
+    }
+    while (cache->num_slots > 0) {
+        _allocman_cspace_free(alloc, &cache->slots[--cache->num_slots]);
+    }
+    _release(alloc);
+    _thread_cache = NULL;
+}
+
 #define ALLOCMAN_ATTACH(alloc, space, interface) do { \
     int root = _start_operation(alloc); \
     assert(root); \
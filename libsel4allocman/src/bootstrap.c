@@ -36,6 +36,13 @@
 #define UTMAN_MAKE_INTERFACE CON(utspace_, UTMAN,_make_interface)
 #define UTMAN_ADD_UTS CON(_utspace_, UTMAN,_add_uts)
 
+struct bootstrap_ut {
+    cspacepath_t path;
+    size_t size_bits;
+    uintptr_t paddr;
+    bool isDevice;
+};
+
 struct bootstrap_info {
     allocman_t *alloc;
     int have_boot_cspace;
@@ -53,10 +60,9 @@ struct bootstrap_info {
     cspacepath_t tcb;
     int uts_in_current_cspace;
     size_t num_uts;
-    cspacepath_t *uts;
-    size_t *ut_size_bits;
-    uintptr_t *ut_paddr;
-    bool *ut_isDevice;
+    /* number of entries uts has room for */
+    size_t max_uts;
+    struct bootstrap_ut *uts;
     simple_t *simple;
 };
 
@@ -70,8 +76,7 @@ typedef struct add_untypeds_state {
 
 static void bootstrap_free_info(bootstrap_info_t *bs) {
     if (bs->uts) {
-        allocman_mspace_free(bs->alloc, bs->uts, sizeof(cspacepath_t) * bs->num_uts);
-        allocman_mspace_free(bs->alloc, bs->ut_size_bits, sizeof(size_t) * bs->num_uts);
+        allocman_mspace_free(bs->alloc, bs->uts, sizeof(struct bootstrap_ut) * bs->max_uts);
     }
     allocman_mspace_free(bs->alloc, bs, sizeof(bootstrap_info_t));
 }
@@ -142,50 +147,42 @@ static bootstrap_info_t *_create_info(allocman_t *alloc) {
     return bs;
 }
 
-static int _add_ut(bootstrap_info_t *bs, cspacepath_t slot, size_t size_bits, uintptr_t paddr, bool isDevice) {
-    cspacepath_t *new_uts;
-    size_t *new_size_bits;
-    uintptr_t *new_paddr;
-    bool *new_isDevice;
+/* Make room for at least num more untypeds. The array at least doubles when it
+ * grows, so adding untypeds one at a time is still linear overall. */
+static int _reserve_uts(bootstrap_info_t *bs, size_t num) {
+    struct bootstrap_ut *new_uts;
+    size_t new_max;
     int error;
-    new_uts = allocman_mspace_alloc(bs->alloc, sizeof(cspacepath_t) * (bs->num_uts + 1), &error);
-    if (error) {
-        LOG_ERROR("Failed to allocate space for untypeds (new_uts)");
-        return error;
+    if (bs->num_uts + num <= bs->max_uts) {
+        return 0;
     }
-    new_size_bits = allocman_mspace_alloc(bs->alloc, sizeof(size_t) * (bs->num_uts + 1), &error);
+    new_max = MAX(bs->num_uts + num, bs->max_uts * 2);
+    new_uts = allocman_mspace_alloc(bs->alloc, sizeof(struct bootstrap_ut) * new_max, &error);
     if (error) {
-        LOG_ERROR("Failed to allocate space for untypeds (new_size_bits)");
+        LOG_ERROR("Failed to allocate space for untypeds");
         return error;
     }
-    new_paddr = allocman_mspace_alloc(bs->alloc, sizeof(uintptr_t) * (bs->num_uts + 1), &error);
-    if (error) {
-        LOG_ERROR("Failed to allocate space for untypeds (new_paddr)");
-        return error;
+    if (bs->uts) {
+        memcpy(new_uts, bs->uts, sizeof(struct bootstrap_ut) * bs->num_uts);
+        allocman_mspace_free(bs->alloc, bs->uts, sizeof(struct bootstrap_ut) * bs->max_uts);
     }
-    new_isDevice = allocman_mspace_alloc(bs->alloc, sizeof(bool) * (bs->num_uts + 1), &error);
+    bs->uts = new_uts;
+    bs->max_uts = new_max;
+    return 0;
+}
+
+static int _add_ut(bootstrap_info_t *bs, cspacepath_t slot, size_t size_bits, uintptr_t paddr, bool isDevice) {
+    int error;
+    error = _reserve_uts(bs, 1);
     if (error) {
-        ZF_LOGE("Failed to allocate space for untypeds (new_isDevice)");
         return error;
     }
-    if (bs->uts) {
-        memcpy(new_uts, bs->uts, sizeof(cspacepath_t) * bs->num_uts);
-        memcpy(new_size_bits, bs->ut_size_bits, sizeof(size_t) * bs->num_uts);
-        memcpy(new_paddr, bs->ut_paddr, sizeof(uintptr_t) * bs->num_uts);
-        memcpy(new_isDevice, bs->ut_isDevice, sizeof(bool) * bs->num_uts);
-        allocman_mspace_free(bs->alloc, bs->uts, sizeof(cspacepath_t) * bs->num_uts);
-        allocman_mspace_free(bs->alloc, bs->ut_size_bits, sizeof(size_t) * bs->num_uts);
-        allocman_mspace_free(bs->alloc, bs->ut_paddr, sizeof(uintptr_t) * bs->num_uts);
-        allocman_mspace_free(bs->alloc, bs->ut_isDevice, sizeof(bool) * bs->num_uts);
-    }
-    new_uts[bs->num_uts] = slot;
-    new_size_bits[bs->num_uts] = size_bits;
-    new_paddr[bs->num_uts] = paddr;
-    new_isDevice[bs->num_uts] = isDevice;
-    bs->uts = new_uts;
-    bs->ut_size_bits = new_size_bits;
-    bs->ut_paddr = new_paddr;
-    bs->ut_isDevice = new_isDevice;
+    bs->uts[bs->num_uts] = (struct bootstrap_ut) {
+        .path = slot,
+        .size_bits = size_bits,
+        .paddr = paddr,
+        .isDevice = isDevice
+    };
     bs->num_uts++;
     return 0;
 }
@@ -193,6 +190,10 @@ static int _add_ut(bootstrap_info_t *bs, cspacepath_t slot, size_t size_bits, ui
 int bootstrap_add_untypeds(bootstrap_info_t *bs, size_t num, const cspacepath_t *uts, size_t *size_bits, uintptr_t *paddr, bool isDevice) {
     size_t i;
     int error;
+    error = _reserve_uts(bs, num);
+    if (error) {
+        return error;
+    }
     for (i = 0; i < num; i++) {
         error = _add_ut(bs, uts[i], size_bits[i], paddr ? paddr[i] : ALLOCMAN_NO_PADDR, isDevice);
         if (error) {
@@ -207,9 +208,13 @@ int bootstrap_add_untypeds_from_bootinfo(bootstrap_info_t *bs, seL4_BootInfo *bi
     seL4_CPtr i;
     /* if we do not have a boot cspace, or we have added some uts that aren't in the
      * current space then just bail */
-    if (!bs->have_boot_cspace || (bs->uts && !bs->uts_in_current_cspace)) {
+    if (!bs->have_boot_cspace || (bs->num_uts && !bs->uts_in_current_cspace)) {
         return 1;
     }
+    error = _reserve_uts(bs, bi->untyped.end - bi->untyped.start);
+    if (error) {
+        return error;
+    }
     for (i = bi->untyped.start; i < bi->untyped.end; i++) {
         size_t index = i - bi->untyped.start;
         cspacepath_t slot = bs->boot_cspace.make_path(bs->boot_cspace.cspace, i);
@@ -230,9 +235,13 @@ static int bootstrap_add_untypeds_from_simple(bootstrap_info_t *bs, simple_t *si
     int i;
     /* if we do not have a boot cspace, or we have added some uts that aren't in the
      * current space then just bail */
-    if (!bs->have_boot_cspace || (bs->uts && !bs->uts_in_current_cspace)) {
+    if (!bs->have_boot_cspace || (bs->num_uts && !bs->uts_in_current_cspace)) {
         return 1;
     }
+    error = _reserve_uts(bs, simple_get_untyped_count(simple));
+    if (error) {
+        return error;
+    }
     for (i = 0; i < simple_get_untyped_count(simple); i++) {
         size_t size_bits;
         uintptr_t paddr;
@@ -250,51 +259,12 @@ static int bootstrap_add_untypeds_from_simple(bootstrap_info_t *bs, simple_t *si
 }
 
 static int _remove_ut(bootstrap_info_t *bs, size_t i) {
-    cspacepath_t *new_uts = NULL;
-    size_t *new_size_bits = NULL;
-    uintptr_t *new_paddr = NULL;
-    bool *new_isDevice = NULL;
-    int error;
     if (bs->num_uts == 0) {
         /* what? */
         return 1;
     }
-    /* if there is only 1 then we will just skip straight to freeing the memory and setting
-     * the arrays to NULL */
-    if (bs->num_uts > 1) {
-        new_uts = allocman_mspace_alloc(bs->alloc, sizeof(cspacepath_t) * (bs->num_uts - 1), &error);
-        if (error) {
-            return error;
-        }
-        new_size_bits = allocman_mspace_alloc(bs->alloc, sizeof(size_t) * (bs->num_uts - 1), & error);
-        if (error) {
-            return error;
-        }
-        new_paddr = allocman_mspace_alloc(bs->alloc, sizeof(uintptr_t) * (bs->num_uts - 1), & error);
-        if (error) {
-            return error;
-        }
-        new_isDevice = allocman_mspace_alloc(bs->alloc, sizeof(bool) * (bs->num_uts - 1), &error);
-        if (error) {
-            return error;
-        }
-        memcpy(&new_uts[0], &bs->uts[0], i * sizeof(cspacepath_t));
-        memcpy(&new_uts[i], &bs->uts[i + 1], (bs->num_uts - i - 1) * sizeof(cspacepath_t));
-        memcpy(&new_size_bits[0], &bs->ut_size_bits[0], i * sizeof(size_t));
-        memcpy(&new_size_bits[i], &bs->ut_size_bits[i + 1], (bs->num_uts - i - 1) * sizeof(size_t));
-        memcpy(&new_paddr[0], &bs->ut_paddr[0], i * sizeof(uintptr_t));
-        memcpy(&new_paddr[i], &bs->ut_paddr[i + 1], (bs->num_uts - i - 1) * sizeof(uintptr_t));
-        memcpy(&new_isDevice[0], &bs->ut_isDevice[0], i * sizeof(bool));
-        memcpy(&new_isDevice[i], &bs->ut_isDevice[i + 1], (bs->num_uts - i - 1) * sizeof(bool));
-    }
-    allocman_mspace_free(bs->alloc, bs->uts, sizeof(cspacepath_t) * (bs->num_uts));
-    allocman_mspace_free(bs->alloc, bs->ut_size_bits, sizeof(size_t) * (bs->num_uts));
-    allocman_mspace_free(bs->alloc, bs->ut_paddr, sizeof(uintptr_t) * (bs->num_uts));
-    allocman_mspace_free(bs->alloc, bs->ut_isDevice, sizeof(bool) * (bs->num_uts));
-    bs->uts = new_uts;
-    bs->ut_size_bits = new_size_bits;
-    bs->ut_paddr = new_paddr;
-    bs->ut_isDevice = new_isDevice;
+    /* the space stays around for the halves bootstrap_allocate_cnode puts back */
+    memmove(&bs->uts[i], &bs->uts[i + 1], (bs->num_uts - i - 1) * sizeof(struct bootstrap_ut));
     bs->num_uts--;
     return 0;
 }
@@ -337,17 +307,17 @@ static int bootstrap_allocate_cnode(bootstrap_info_t *bs, size_t size, cspacepat
     ut_size = size + seL4_SlotBits;
     /* find the smallest untyped to allocate from */
     for (i = 0; i < bs->num_uts; i++) {
-        if (bs->ut_size_bits[i] >= ut_size && ( best == -1 || (bs->ut_size_bits[best] > bs->ut_size_bits[i]) ) && !bs->ut_isDevice[i]) {
+        if (bs->uts[i].size_bits >= ut_size && ( best == -1 || (bs->uts[best].size_bits > bs->uts[i].size_bits) ) && !bs->uts[i].isDevice) {
             best = i;
         }
     }
     if (best == -1) {
         return 1;
     }
-    best_size = bs->ut_size_bits[best];
-    best_path = bs->uts[best];
-    best_paddr = bs->ut_paddr[best];
-    best_isDevice = bs->ut_isDevice[best];
+    best_size = bs->uts[best].size_bits;
+    best_path = bs->uts[best].path;
+    best_paddr = bs->uts[best].paddr;
+    best_isDevice = bs->uts[best].isDevice;
     /* we searched for a non device one, but make sure here */
     assert(!best_isDevice);
     error = _remove_ut(bs, best);
@@ -631,7 +601,7 @@ static int bootstrap_new_2level_cspace(bootstrap_info_t *bs, size_t l1size, size
 static void bootstrap_update_untypeds(bootstrap_info_t *bs) {
     int i;
     for (i = 0; i < bs->num_uts; i++) {
-        bs->uts[i].root = bs->old_cnode.capPtr;
+        bs->uts[i].path.root = bs->old_cnode.capPtr;
     }
 }
 
@@ -654,11 +624,11 @@ static int bootstrap_move_untypeds(bootstrap_info_t *bs) {
         if (error) {
             return error;
         }
-        error = vka_cnode_move(&slot, &bs->uts[i]);
+        error = vka_cnode_move(&slot, &bs->uts[i].path);
         if (error != seL4_NoError) {
             return 1;
         }
-        bs->uts[i] = slot;
+        bs->uts[i].path = slot;
     }
     bs->uts_in_current_cspace = 1;
     return 0;
@@ -681,7 +651,7 @@ static int bootstrap_create_utspace(bootstrap_info_t *bs) {
     }
 
     for (i = 0; i < bs->num_uts; i++) {
-        error = UTMAN_ADD_UTS(bs->alloc, utspace, 1, &bs->uts[i], &bs->ut_size_bits[i], &bs->ut_paddr[i], bs->ut_isDevice[i] ? ALLOCMAN_UT_DEV : ALLOCMAN_UT_KERNEL);
+        error = UTMAN_ADD_UTS(bs->alloc, utspace, 1, &bs->uts[i].path, &bs->uts[i].size_bits, &bs->uts[i].paddr, bs->uts[i].isDevice ? ALLOCMAN_UT_DEV : ALLOCMAN_UT_KERNEL);
         if (error) {
             LOG_ERROR("Failed to add untypeds to untyped allocator");
             return error;
@@ -12,39 +12,77 @@
 
 #define BITS_PER_WORD (sizeof(size_t) * 8)
 
+static inline void _mark_allocated(cspace_single_level_t *cspace, size_t index)
+{
+    size_t word = index / BITS_PER_WORD;
+    cspace->bitmap[word] &= ~BIT(index % BITS_PER_WORD);
+    if (cspace->bitmap[word] == 0) {
+        cspace->summary[word / BITS_PER_WORD] &= ~BIT(word % BITS_PER_WORD);
+    }
+}
+
+static inline void _mark_free(cspace_single_level_t *cspace, size_t index)
+{
+    size_t word = index / BITS_PER_WORD;
+    cspace->bitmap[word] |= BIT(index % BITS_PER_WORD);
+    cspace->summary[word / BITS_PER_WORD] |= BIT(word % BITS_PER_WORD);
+}
+
 int cspace_single_level_create(struct allocman *alloc, cspace_single_level_t *cspace, struct cspace_single_level_config config)
 {
     size_t num_slots;
     size_t num_entries;
+    size_t num_summary;
+    size_t i;
     int error;
     cspace->config = config;
     /* Allocate bitmap */
     num_slots = cspace->config.end_slot - cspace->config.first_slot;
     num_entries = num_slots / BITS_PER_WORD;
-    cspace->bitmap_length = num_entries;
     if (num_slots % BITS_PER_WORD != 0) {
         num_entries++;
     }
+    cspace->bitmap_length = num_entries;
     cspace->bitmap = (size_t*)allocman_mspace_alloc(alloc, num_entries * sizeof(size_t), &error);
     if (error) {
         return error;
     }
+    num_summary = num_entries / BITS_PER_WORD;
+    if (num_entries % BITS_PER_WORD != 0) {
+        num_summary++;
+    }
+    cspace->summary_length = num_summary;
+    cspace->summary = (size_t*)allocman_mspace_alloc(alloc, num_summary * sizeof(size_t), &error);
+    if (error) {
+        allocman_mspace_free(alloc, cspace->bitmap, num_entries * sizeof(size_t));
+        return error;
+    }
     /* Make everything 1's */
     memset(cspace->bitmap, -1, num_entries * sizeof(size_t));
     if (num_slots % BITS_PER_WORD != 0) {
         /* Mark the padding slots as allocated */
         size_t excess = num_slots % BITS_PER_WORD;
-        size_t i;
         for (i = excess; i < BITS_PER_WORD; i++) {
             cspace->bitmap[num_entries - 1] ^= BIT(i);
         }
     }
+    memset(cspace->summary, 0, num_summary * sizeof(size_t));
+    for (i = 0; i < num_entries; i++) {
+        if (cspace->bitmap[i] != 0) {
+            cspace->summary[i / BITS_PER_WORD] |= BIT(i % BITS_PER_WORD);
+        }
+    }
     cspace->last_entry = 0;
+    cspace->checkpoint = NULL;
     return 0;
 }
 
 void cspace_single_level_destroy(struct allocman *alloc, cspace_single_level_t *cspace)
 {
+    if (cspace->checkpoint) {
+        allocman_mspace_free(alloc, cspace->checkpoint, (cspace->bitmap_length + cspace->summary_length) * sizeof(size_t));
+    }
+    allocman_mspace_free(alloc, cspace->summary, cspace->summary_length * sizeof(size_t));
     allocman_mspace_free(alloc, cspace->bitmap, cspace->bitmap_length * sizeof(size_t));
 }
 
@@ -55,18 +93,25 @@ int _cspace_single_level_alloc(allocman_t *alloc, void *_cspace, cspacepath_t *s
     cspace_single_level_t *cspace = (cspace_single_level_t*)_cspace;
     i = cspace->last_entry;
     if (cspace->bitmap[i] == 0) {
+        /* Find the next word with a free slot from the summary, wrapping around */
+        size_t s = i / BITS_PER_WORD;
+        size_t checked;
         assert(cspace->bitmap_length != 0);
         assert(cspace->last_entry < cspace->bitmap_length);
-        do {
-            i = (i + 1) % cspace->bitmap_length;
-        } while (cspace->bitmap[i] == 0 && i != cspace->last_entry);
-        if (i == cspace->last_entry) {
+        for (checked = 0; checked < cspace->summary_length; checked++) {
+            if (cspace->summary[s] != 0) {
+                break;
+            }
+            s = (s + 1) % cspace->summary_length;
+        }
+        if (checked == cspace->summary_length) {
             return 1;
         }
+        i = s * BITS_PER_WORD + CTZL(cspace->summary[s]);
         cspace->last_entry = i;
     }
     index = BITS_PER_WORD - 1 - CLZL(cspace->bitmap[i]);
-    cspace->bitmap[i] &= ~BIT(index);
+    _mark_allocated(cspace, i * BITS_PER_WORD + index);
     *slot = _cspace_single_level_make_path(cspace, cspace->config.first_slot + (i * BITS_PER_WORD + index));
     return 0;
 }
@@ -83,7 +128,7 @@ int _cspace_single_level_alloc_at(allocman_t *alloc, void *_cspace, seL4_CPtr sl
         return 1;
     }
     /* mark it as allocated */
-    cspace->bitmap[index / BITS_PER_WORD] &= ~BIT(index % BITS_PER_WORD);
+    _mark_allocated(cspace, index);
     return 0;
 }
 
@@ -92,5 +137,130 @@ void _cspace_single_level_free(allocman_t *alloc, void *_cspace, const cspacepat
     cspace_single_level_t *cspace = (cspace_single_level_t*)_cspace;
     size_t index = slot->capPtr - cspace->config.first_slot;
     assert((cspace->bitmap[index / BITS_PER_WORD] & BIT(index % BITS_PER_WORD)) == 0);
-    cspace->bitmap[index / BITS_PER_WORD] |= BIT(index % BITS_PER_WORD);
+    _mark_free(cspace, index);
+}
+
+int _cspace_single_level_alloc_range(allocman_t *alloc, void *_cspace, size_t num, cspacepath_t *first)
+{
+    cspace_single_level_t *cspace = (cspace_single_level_t*)_cspace;
+    size_t total = cspace->bitmap_length * BITS_PER_WORD;
+    size_t start = 0;
+    size_t run = 0;
+    size_t i = 0;
+    if (num == 0) {
+        return 1;
+    }
+    /* Look for a run of num set bits. Whole words that are empty or full are
+     * stepped over in one go, as are whole summary words with no free slots */
+    while (i < total && run < num) {
+        size_t word = i / BITS_PER_WORD;
+        if (i % (BITS_PER_WORD * BITS_PER_WORD) == 0 && cspace->summary[word / BITS_PER_WORD] == 0) {
+            run = 0;
+            i += BITS_PER_WORD * BITS_PER_WORD;
+        } else if (i % BITS_PER_WORD == 0 && cspace->bitmap[word] == 0) {
+            run = 0;
+            i += BITS_PER_WORD;
+        } else if (i % BITS_PER_WORD == 0 && cspace->bitmap[word] == (size_t) -1) {
+            if (run == 0) {
+                start = i;
+            }
+            run += BITS_PER_WORD;
+            i += BITS_PER_WORD;
+        } else if (cspace->bitmap[word] & BIT(i % BITS_PER_WORD)) {
+            if (run == 0) {
+                start = i;
+            }
+            run++;
+            i++;
+        } else {
+            run = 0;
+            i++;
+        }
+    }
+    if (run < num) {
+        return 1;
+    }
+    for (i = start; i < start + num; i++) {
+        _mark_allocated(cspace, i);
+    }
+    *first = _cspace_single_level_make_path(cspace, cspace->config.first_slot + start);
+    return 0;
+}
+
+void _cspace_single_level_free_range(allocman_t *alloc, void *_cspace, const cspacepath_t *first, size_t num)
+{
+    cspace_single_level_t *cspace = (cspace_single_level_t*)_cspace;
+    size_t index = first->capPtr - cspace->config.first_slot;
+    size_t end = index + num;
+    assert(first->capPtr >= cspace->config.first_slot && first->capPtr + num <= cspace->config.end_slot);
+    while (index < end) {
+        size_t word = index / BITS_PER_WORD;
+        size_t bit = index % BITS_PER_WORD;
+        size_t n = MIN(BITS_PER_WORD - bit, end - index);
+        size_t mask = n == BITS_PER_WORD ? (size_t) -1 : MASK(n) << bit;
+        assert((cspace->bitmap[word] & mask) == 0);
+        cspace->bitmap[word] |= mask;
+        cspace->summary[word / BITS_PER_WORD] |= BIT(word % BITS_PER_WORD);
+        index += n;
+    }
+}
+
+void _cspace_single_level_stats(void *_cspace, struct cspace_stats *stats)
+{
+    cspace_single_level_t *cspace = (cspace_single_level_t*)_cspace;
+    size_t run = 0;
+    *stats = (struct cspace_stats) {
+        .total_slots = cspace->config.end_slot - cspace->config.first_slot,
+        .bookkeeping_bytes = (cspace->bitmap_length + cspace->summary_length) * sizeof(size_t)
+    };
+    for (size_t word = 0; word < cspace->bitmap_length; word++) {
+        size_t bits = cspace->bitmap[word];
+        stats->free_slots += POPCOUNTL(bits);
+        if (bits == (size_t) -1) {
+            run += BITS_PER_WORD;
+        } else if (bits == 0) {
+            run = 0;
+        } else {
+            for (size_t i = 0; i < BITS_PER_WORD; i++) {
+                if (bits & BIT(i)) {
+                    run++;
+                    stats->largest_free_run = MAX(stats->largest_free_run, run);
+                } else {
+                    run = 0;
+                }
+            }
+            continue;
+        }
+        stats->largest_free_run = MAX(stats->largest_free_run, run);
+    }
+}
+
+int _cspace_single_level_checkpoint(allocman_t *alloc, void *_cspace)
+{
+    cspace_single_level_t *cspace = (cspace_single_level_t*)_cspace;
+    size_t bytes = (cspace->bitmap_length + cspace->summary_length) * sizeof(size_t);
+    int error;
+    if (!cspace->checkpoint) {
+        cspace->checkpoint = (size_t*)allocman_mspace_alloc(alloc, bytes, &error);
+        if (error) {
+            cspace->checkpoint = NULL;
+            return error;
+        }
+    }
+    memcpy(cspace->checkpoint, cspace->bitmap, cspace->bitmap_length * sizeof(size_t));
+    memcpy(cspace->checkpoint + cspace->bitmap_length, cspace->summary, cspace->summary_length * sizeof(size_t));
+    return 0;
+}
+
+int _cspace_single_level_restore(allocman_t *alloc, void *_cspace)
+{
+    cspace_single_level_t *cspace = (cspace_single_level_t*)_cspace;
+    if (!cspace->checkpoint) {
+        ZF_LOGE("No checkpoint to restore");
+        return 1;
+    }
+    memcpy(cspace->bitmap, cspace->checkpoint, cspace->bitmap_length * sizeof(size_t));
+    memcpy(cspace->summary, cspace->checkpoint + cspace->bitmap_length, cspace->summary_length * sizeof(size_t));
+    cspace->last_entry = 0;
+    return 0;
 }
@@ -114,6 +114,7 @@ int cspace_two_level_create(allocman_t *alloc, cspace_two_level_t *cspace, struc
         cspace->second_levels[i] = NULL;
     }
     cspace->last_second_level = 0;
+    cspace->prefetch_wanted = 0;
     for (i = config.start_existing_index; i < config.end_existing_index; i++) {
         error = _cspace_single_level_alloc_at(alloc, &cspace->first_level, (seL4_CPtr) i);
         if (error) {
@@ -196,8 +197,10 @@ int _cspace_two_level_alloc(allocman_t *alloc, void *_cspace, cspacepath_t *slot
         /* use this index */
         error = _create_second_level(alloc, cspace, l1slot.offset, 1);
         if (error) {
+            _cspace_single_level_free(alloc, &cspace->first_level, &l1slot);
             return error;
         }
+        i = l1slot.offset;
     }
     cspace->last_second_level = i;
     error = _cspace_single_level_alloc(alloc, &cspace->second_levels[i]->second_level, &level2_slot);
@@ -207,6 +210,10 @@ int _cspace_two_level_alloc(allocman_t *alloc, void *_cspace, cspacepath_t *slot
         return error;
     }
     cspace->second_levels[i]->count++;
+    if (cspace->config.prefetch_percent &&
+        cspace->second_levels[i]->count * 100 >= cspace->config.prefetch_percent * BIT(cspace->config.level_two_bits)) {
+        cspace->prefetch_wanted = 1;
+    }
     *slot = _cspace_two_level_make_path(cspace, (i << cspace->config.level_two_bits) | level2_slot.capPtr);
     return 0;
 }
@@ -226,6 +233,36 @@ static void _destroy_second_level(allocman_t *alloc, cspace_two_level_t *cspace,
     _cspace_single_level_free(alloc, &cspace->first_level, &path);
 }
 
+int cspace_two_level_prefetch(struct allocman *alloc, cspace_two_level_t *cspace)
+{
+    size_t i;
+    int error;
+    cspacepath_t l1slot;
+    if (!cspace->prefetch_wanted) {
+        return 0;
+    }
+    cspace->prefetch_wanted = 0;
+    /* Nothing to do if there is already another second level with space in it */
+    for (i = 0; i < BIT(cspace->config.cnode_size_bits); i++) {
+        if (i != cspace->last_second_level && cspace->second_levels[i] &&
+            cspace->second_levels[i]->count < MASK(cspace->config.level_two_bits)) {
+            return 0;
+        }
+    }
+    error = _cspace_single_level_alloc(alloc, &cspace->first_level, &l1slot);
+    if (error) {
+        return error;
+    }
+    error = _create_second_level(alloc, cspace, l1slot.offset, 1);
+    if (error) {
+        _cspace_single_level_free(alloc, &cspace->first_level, &l1slot);
+        /* try again next time */
+        cspace->prefetch_wanted = 1;
+        return error;
+    }
+    return 0;
+}
+
 void _cspace_two_level_free(struct allocman *alloc, void *_cspace, const cspacepath_t *slot)
 {
     size_t l1slot;
@@ -238,10 +275,14 @@ void _cspace_two_level_free(struct allocman *alloc, void *_cspace, const cspacep
     path = _cspace_single_level_make_path(&cspace->second_levels[l1slot]->second_level, l2slot);
     _cspace_single_level_free(alloc, &cspace->second_levels[l1slot]->second_level, &path);
     cspace->second_levels[l1slot]->count--;
-    if (cspace->second_levels[l1slot]->count == 0) {
+    /* Only release levels we created, any given to us at creation time were not
+     * allocated by us and their first level slot cannot be reused */
+    if (cspace->second_levels[l1slot]->count == 0 && cspace->second_levels[l1slot]->cookie_valid &&
+        !cspace->config.keep_empty_levels) {
         _destroy_second_level(alloc, cspace, l1slot);
         cspace->second_levels[l1slot] = NULL;
     }
+    cspace_two_level_prefetch(alloc, cspace);
 }
 
 void cspace_two_level_destroy(struct allocman *alloc, cspace_two_level_t *cspace)
@@ -256,3 +297,26 @@ void cspace_two_level_destroy(struct allocman *alloc, cspace_two_level_t *cspace
                          sizeof(struct cspace_two_level_node *) * BIT(cspace->config.cnode_size_bits));
     cspace_single_level_destroy(alloc, &cspace->first_level);
 }
+
+void _cspace_two_level_stats(void *_cspace, struct cspace_stats *stats)
+{
+    cspace_two_level_t *cspace = (cspace_two_level_t*)_cspace;
+    struct cspace_stats level;
+    _cspace_single_level_stats(&cspace->first_level, &level);
+    *stats = (struct cspace_stats) {
+        .bookkeeping_bytes = level.bookkeeping_bytes +
+                             sizeof(struct cspace_two_level_node *) * BIT(cspace->config.cnode_size_bits)
+    };
+    /* Only slots in second levels that exist are counted, creating more is up to
+     * the utspace */
+    for (size_t i = 0; i < BIT(cspace->config.cnode_size_bits); i++) {
+        if (cspace->second_levels[i]) {
+            _cspace_single_level_stats(&cspace->second_levels[i]->second_level, &level);
+            stats->total_slots += level.total_slots;
+            stats->free_slots += level.free_slots;
+            stats->largest_free_run = MAX(stats->largest_free_run, level.largest_free_run);
+            stats->bookkeeping_bytes += level.bookkeeping_bytes + sizeof(struct cspace_two_level_node);
+            stats->levels++;
+        }
+    }
+}
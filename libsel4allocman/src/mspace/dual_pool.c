@@ -49,3 +49,17 @@ void _mspace_dual_pool_free(struct allocman *alloc, void *_dual_pool, void *ptr,
         _mspace_virtual_pool_free(alloc, &dual_pool->virtual_pool, ptr, bytes);
     }
 }
+
+void _mspace_dual_pool_stats(void *_dual_pool, struct mspace_stats *stats)
+{
+    mspace_dual_pool_t *dual_pool = (mspace_dual_pool_t*)_dual_pool;
+    _mspace_fixed_pool_stats(&dual_pool->fixed_pool, stats);
+    if (dual_pool->have_virtual_pool) {
+        struct mspace_stats virtual;
+        _mspace_virtual_pool_stats(&dual_pool->virtual_pool, &virtual);
+        stats->free_bytes += virtual.free_bytes;
+        stats->free_blocks += virtual.free_blocks;
+        stats->largest_free = MAX(stats->largest_free, virtual.largest_free);
+        stats->unused_bytes += virtual.unused_bytes;
+    }
+}
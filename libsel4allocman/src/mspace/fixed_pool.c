@@ -33,13 +33,14 @@ void mspace_fixed_pool_create(mspace_fixed_pool_t *fixed_pool, struct mspace_fix
     fixed_pool->pool_ptr += padding;
     fixed_pool->remaining -= padding;
     mspace_k_r_malloc_init(&fixed_pool->k_r_malloc, (size_t)fixed_pool, _morecore);
+    mspace_slab_init(&fixed_pool->slab);
 }
 
 void *_mspace_fixed_pool_alloc(struct allocman *alloc, void *_fixed_pool, size_t bytes, int *error)
 {
     void *ret;
     mspace_fixed_pool_t *fixed_pool = (mspace_fixed_pool_t*)_fixed_pool;
-    ret = mspace_k_r_malloc_alloc(&fixed_pool->k_r_malloc, bytes);
+    ret = mspace_slab_alloc(&fixed_pool->slab, &fixed_pool->k_r_malloc, bytes);
     if (ret == NULL) {
         SET_ERROR(error, 1);
     } else {
@@ -51,5 +52,14 @@ void *_mspace_fixed_pool_alloc(struct allocman *alloc, void *_fixed_pool, size_t
 void _mspace_fixed_pool_free(struct allocman *alloc, void *_fixed_pool, void *ptr, size_t bytes)
 {
     mspace_fixed_pool_t *fixed_pool = (mspace_fixed_pool_t*)_fixed_pool;
-    mspace_k_r_malloc_free(&fixed_pool->k_r_malloc, ptr);
+    mspace_slab_free(&fixed_pool->slab, &fixed_pool->k_r_malloc, ptr, bytes);
+}
+
+void _mspace_fixed_pool_stats(void *_fixed_pool, struct mspace_stats *stats)
+{
+    mspace_fixed_pool_t *fixed_pool = (mspace_fixed_pool_t*)_fixed_pool;
+    *stats = (struct mspace_stats) {
+        .unused_bytes = fixed_pool->remaining
+    };
+    mspace_slab_stats(&fixed_pool->slab, &fixed_pool->k_r_malloc, stats);
 }
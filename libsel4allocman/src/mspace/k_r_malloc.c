@@ -83,3 +83,21 @@ void mspace_k_r_malloc_free(mspace_k_r_malloc_t *k_r_malloc, void *ap)
     k_r_malloc->freep = p;
 
 }
+
+void mspace_k_r_malloc_stats(mspace_k_r_malloc_t *k_r_malloc, struct mspace_stats *stats)
+{
+    k_r_malloc_header_t *p;
+
+    if (k_r_malloc->freep == NULL) {
+        return;
+    }
+    /* base is the empty block the free list starts at, so is skipped over */
+    for (p = k_r_malloc->base.s.ptr; p != &k_r_malloc->base; p = p->s.ptr) {
+        size_t bytes = p->s.size * sizeof(k_r_malloc_header_t);
+        stats->free_bytes += bytes;
+        stats->free_blocks++;
+        if (bytes > stats->largest_free) {
+            stats->largest_free = bytes;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <allocman/mspace/slab.h>
+#include <allocman/allocman.h>
+#include <allocman/utspace/split.h>
+#include <allocman/utspace/buddy.h>
+#include <allocman/cspace/two_level.h>
+#include <utils/util.h>
+#include <string.h>
+
+/* Objects are rounded up to a multiple of the K&R header so they keep the same
+ * alignment guarantees as a regular allocation */
+#define SLAB_UNITS(x) (((x) + sizeof(k_r_malloc_header_t) - 1) / sizeof(k_r_malloc_header_t))
+
+static const size_t class_bytes[MSPACE_SLAB_NUM_CLASSES] = {
+    sizeof(struct utspace_split_node),
+    sizeof(struct utspace_buddy_pair),
+    sizeof(struct allocman_utspace_batch),
+    sizeof(struct cspace_two_level_node),
+};
+
+static int _size_class(size_t bytes)
+{
+    for (int i = 0; i < MSPACE_SLAB_NUM_CLASSES; i++) {
+        if (class_bytes[i] == bytes) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int _refill(mspace_slab_t *slab, mspace_k_r_malloc_t *k_r_malloc, int class)
+{
+    size_t size = SLAB_UNITS(class_bytes[class]) * sizeof(k_r_malloc_header_t);
+    size_t count = MSPACE_SLAB_CHUNK_OBJECTS;
+    char *chunk = mspace_k_r_malloc_alloc(k_r_malloc, size * count);
+    if (!chunk) {
+        /* Memory may be tight (i.e. during bootstrapping), try for a single object */
+        count = 1;
+        chunk = mspace_k_r_malloc_alloc(k_r_malloc, size);
+        if (!chunk) {
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        struct mspace_slab_object *obj = (struct mspace_slab_object *)(chunk + i * size);
+        obj->next = slab->heads[class];
+        slab->heads[class] = obj;
+    }
+    return 0;
+}
+
+void mspace_slab_init(mspace_slab_t *slab)
+{
+    memset(slab, 0, sizeof(*slab));
+}
+
+void *mspace_slab_alloc(mspace_slab_t *slab, mspace_k_r_malloc_t *k_r_malloc, size_t bytes)
+{
+    struct mspace_slab_object *obj;
+    int class = _size_class(bytes);
+    if (class == -1) {
+        return mspace_k_r_malloc_alloc(k_r_malloc, bytes);
+    }
+    if (!slab->heads[class] && _refill(slab, k_r_malloc, class)) {
+        return NULL;
+    }
+    obj = slab->heads[class];
+    slab->heads[class] = obj->next;
+    return obj;
+}
+
+void mspace_slab_free(mspace_slab_t *slab, mspace_k_r_malloc_t *k_r_malloc, void *ptr, size_t bytes)
+{
+    struct mspace_slab_object *obj;
+    int class;
+    if (!ptr) {
+        return;
+    }
+    class = _size_class(bytes);
+    if (class == -1) {
+        mspace_k_r_malloc_free(k_r_malloc, ptr);
+        return;
+    }
+    obj = (struct mspace_slab_object *)ptr;
+    obj->next = slab->heads[class];
+    slab->heads[class] = obj;
+}
+
+void mspace_slab_stats(mspace_slab_t *slab, mspace_k_r_malloc_t *k_r_malloc, struct mspace_stats *stats)
+{
+    mspace_k_r_malloc_stats(k_r_malloc, stats);
+    /* cached objects only satisfy requests of their own size, so don't count
+     * towards the largest free block */
+    for (int i = 0; i < MSPACE_SLAB_NUM_CLASSES; i++) {
+        for (struct mspace_slab_object *obj = slab->heads[i]; obj; obj = obj->next) {
+            stats->free_bytes += SLAB_UNITS(class_bytes[i]) * sizeof(k_r_malloc_header_t);
+        }
+    }
+}
@@ -102,6 +102,7 @@ void mspace_virtual_pool_create(mspace_virtual_pool_t *virtual_pool, struct mspa
     virtual_pool->morecore_alloc = NULL;
     virtual_pool->pd = config.pd;
     mspace_k_r_malloc_init(&virtual_pool->k_r_malloc, (size_t)virtual_pool, _morecore);
+    mspace_slab_init(&virtual_pool->slab);
 }
 
 void *_mspace_virtual_pool_alloc(struct allocman *alloc, void *_virtual_pool, size_t bytes, int *error)
@@ -109,7 +110,7 @@ void *_mspace_virtual_pool_alloc(struct allocman *alloc, void *_virtual_pool, si
     void *ret;
     mspace_virtual_pool_t *virtual_pool = (mspace_virtual_pool_t*)_virtual_pool;
     virtual_pool->morecore_alloc = alloc;
-    ret = mspace_k_r_malloc_alloc(&virtual_pool->k_r_malloc, bytes);
+    ret = mspace_slab_alloc(&virtual_pool->slab, &virtual_pool->k_r_malloc, bytes);
     virtual_pool->morecore_alloc = NULL;
     SET_ERROR(error, (ret == NULL) ? 1 : 0);
     return ret;
@@ -119,6 +120,15 @@ void _mspace_virtual_pool_free(struct allocman *alloc, void *_virtual_pool, void
 {
     mspace_virtual_pool_t *virtual_pool = (mspace_virtual_pool_t*)_virtual_pool;
     virtual_pool->morecore_alloc = alloc;
-    mspace_k_r_malloc_free(&virtual_pool->k_r_malloc, ptr);
+    mspace_slab_free(&virtual_pool->slab, &virtual_pool->k_r_malloc, ptr, bytes);
     virtual_pool->morecore_alloc = NULL;
 }
+
+void _mspace_virtual_pool_stats(void *_virtual_pool, struct mspace_stats *stats)
+{
+    mspace_virtual_pool_t *virtual_pool = (mspace_virtual_pool_t*)_virtual_pool;
+    *stats = (struct mspace_stats) {
+        .unused_bytes = (uintptr_t)virtual_pool->pool_limit - (uintptr_t)virtual_pool->pool_ptr
+    };
+    mspace_slab_stats(&virtual_pool->slab, &virtual_pool->k_r_malloc, stats);
+}
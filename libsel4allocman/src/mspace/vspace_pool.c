@@ -15,19 +15,58 @@
  */
 #define PAGE_SIZE_BITS 12
 
+/* Grow by at least this much at a time, doubling each time up to the configured maximum */
+#define MIN_GROW_BYTES BIT(PAGE_SIZE_BITS)
+
+/* Map pages up to top, using large pages where the pool is aligned for them */
+static int _map_to(mspace_vspace_pool_t *vspace_pool, uintptr_t top)
+{
+    while (vspace_pool->pool_top < top) {
+        uintptr_t base = vspace_pool->pool_top;
+        if (vspace_pool->large_pages && IS_ALIGNED(base, seL4_LargePageBits)
+            && top - base >= BIT(seL4_LargePageBits)) {
+            size_t pages = (top - base) >> seL4_LargePageBits;
+            int error = vspace_new_pages_at_vaddr(&vspace_pool->vspace, (void*)base, pages, seL4_LargePageBits,
+                                                  vspace_pool->reservation);
+            if (error == seL4_NoError) {
+                vspace_pool->pool_top += pages << seL4_LargePageBits;
+                continue;
+            }
+            /* keep to small pages from now on, rather than trying large ones every time */
+            vspace_pool->large_pages = false;
+        }
+
+        /* small pages up to the end, or to the next large page boundary to try from there */
+        uintptr_t end = top;
+        if (vspace_pool->large_pages) {
+            end = MIN(top, ROUND_UP(base + 1, BIT(seL4_LargePageBits)));
+        }
+        int error = vspace_new_pages_at_vaddr(&vspace_pool->vspace, (void*)base, (end - base) >> PAGE_SIZE_BITS,
+                                              PAGE_SIZE_BITS, vspace_pool->reservation);
+        if (error != seL4_NoError) {
+            return error;
+        }
+        vspace_pool->pool_top = end;
+    }
+    return 0;
+}
+
 static k_r_malloc_header_t *_morecore(size_t cookie, mspace_k_r_malloc_t *k_r_malloc, size_t new_units)
 {
     size_t new_size;
     k_r_malloc_header_t *new_header;
     mspace_vspace_pool_t *vspace_pool = (mspace_vspace_pool_t*)cookie;
     new_size = new_units * sizeof(k_r_malloc_header_t);
-    while (vspace_pool->pool_ptr + new_size > vspace_pool->pool_top) {
-        int error;
-        error = vspace_new_pages_at_vaddr(&vspace_pool->vspace, (void*)vspace_pool->pool_top, 1, PAGE_SIZE_BITS, vspace_pool->reservation);
-        if (error != seL4_NoError) {
+    if (vspace_pool->pool_ptr + new_size > vspace_pool->pool_top) {
+        uintptr_t needed = ROUND_UP(vspace_pool->pool_ptr + new_size, BIT(PAGE_SIZE_BITS));
+        /* Grow by a whole chunk in as few calls as possible, so that each time the pool runs
+         * out costs the allocator fewer recursive allocations. Should the chunk not fit,
+         * fall back to only what is needed */
+        uintptr_t chunk = MAX(needed, vspace_pool->pool_top + vspace_pool->grow_bytes);
+        if (_map_to(vspace_pool, chunk) != seL4_NoError && _map_to(vspace_pool, needed) != seL4_NoError) {
             return NULL;
         }
-        vspace_pool->pool_top += BIT(PAGE_SIZE_BITS);
+        vspace_pool->grow_bytes = MIN(vspace_pool->grow_bytes * 2, vspace_pool->max_grow_bytes);
     }
     new_header = (k_r_malloc_header_t*)vspace_pool->pool_ptr;
     vspace_pool->pool_ptr += new_size;
@@ -41,6 +80,10 @@ void mspace_vspace_pool_create(mspace_vspace_pool_t *vspace_pool, struct mspace_
     vspace_pool->reservation = config.reservation;
     vspace_pool->vspace = config.vspace;
     vspace_pool->morecore_alloc = NULL;
+    vspace_pool->max_grow_bytes = config.max_grow_bytes == 0 ? BIT(seL4_LargePageBits) :
+                                  MAX(ROUND_UP(config.max_grow_bytes, BIT(PAGE_SIZE_BITS)), MIN_GROW_BYTES);
+    vspace_pool->grow_bytes = MIN_GROW_BYTES;
+    vspace_pool->large_pages = !config.small_pages_only;
 
     mspace_k_r_malloc_init(&vspace_pool->k_r_malloc, (size_t)vspace_pool, _morecore);
 }
@@ -63,3 +106,13 @@ void _mspace_vspace_pool_free(struct allocman *alloc, void *_vspace_pool, void *
     mspace_k_r_malloc_free(&vspace_pool->k_r_malloc, ptr);
     vspace_pool->morecore_alloc = NULL;
 }
+
+void _mspace_vspace_pool_stats(void *_vspace_pool, struct mspace_stats *stats)
+{
+    mspace_vspace_pool_t *vspace_pool = (mspace_vspace_pool_t*)_vspace_pool;
+    /* the reservation is only bounded by the vspace, so just count what is mapped */
+    *stats = (struct mspace_stats) {
+        .unused_bytes = vspace_pool->pool_top - vspace_pool->pool_ptr
+    };
+    mspace_k_r_malloc_stats(&vspace_pool->k_r_malloc, stats);
+}
@@ -0,0 +1,427 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <allocman/utspace/buddy.h>
+#include <allocman/allocman.h>
+#include <allocman/util.h>
+#include <sel4/sel4.h>
+#include <vka/object.h>
+#include <vka/capops.h>
+#include <string.h>
+
+static void _remove_node(struct utspace_buddy_node *node)
+{
+    utspace_buddy_pool_t *pool = node->pool;
+    assert(node->is_free);
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        assert(pool->heads[node->size_bits] == node);
+        pool->heads[node->size_bits] = node->next;
+        if (!node->next) {
+            pool->nonempty &= ~BIT(node->size_bits);
+        }
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    }
+    pool->num_free[node->size_bits]--;
+    node->is_free = 0;
+}
+
+static void _insert_node(struct utspace_buddy_node *node)
+{
+    utspace_buddy_pool_t *pool = node->pool;
+    assert(!node->is_free);
+    node->next = pool->heads[node->size_bits];
+    node->prev = NULL;
+    if (node->next) {
+        node->next->prev = node;
+    }
+    pool->heads[node->size_bits] = node;
+    pool->nonempty |= BIT(node->size_bits);
+    pool->num_free[node->size_bits]++;
+    node->is_free = 1;
+}
+
+static struct utspace_buddy_pair *_new_pair(allocman_t *alloc)
+{
+    int error;
+    struct utspace_buddy_pair *pair;
+    pair = (struct utspace_buddy_pair *) allocman_mspace_alloc(alloc, sizeof(*pair), &error);
+    if (error) {
+        ZF_LOGV("Failed to allocate node pair of size %zu", sizeof(*pair));
+        return NULL;
+    }
+    error = allocman_cspace_alloc(alloc, &pair->node[0].ut);
+    if (error) {
+        allocman_mspace_free(alloc, pair, sizeof(*pair));
+        ZF_LOGV("Failed to allocate slot");
+        return NULL;
+    }
+    error = allocman_cspace_alloc(alloc, &pair->node[1].ut);
+    if (error) {
+        allocman_cspace_free(alloc, &pair->node[0].ut);
+        allocman_mspace_free(alloc, pair, sizeof(*pair));
+        ZF_LOGV("Failed to allocate slot");
+        return NULL;
+    }
+    return pair;
+}
+
+static void _delete_pair(allocman_t *alloc, struct utspace_buddy_pair *pair)
+{
+    vka_cnode_delete(&pair->node[0].ut);
+    vka_cnode_delete(&pair->node[1].ut);
+    allocman_cspace_free(alloc, &pair->node[0].ut);
+    allocman_cspace_free(alloc, &pair->node[1].ut);
+    allocman_mspace_free(alloc, pair, sizeof(*pair));
+}
+
+static inline int _slots_adjacent(const cspacepath_t *low, const cspacepath_t *high)
+{
+    return low->root == high->root && low->dest == high->dest && low->destDepth == high->destDepth &&
+           low->offset + 1 == high->offset;
+}
+
+static int _retype_pair(struct utspace_buddy_node *parent, struct utspace_buddy_pair *pair)
+{
+    size_t size_bits = parent->size_bits - 1;
+    cspacepath_t *left = &pair->node[0].ut;
+    cspacepath_t *right = &pair->node[1].ut;
+    int sel4_error;
+    /* The kernel places objects into consecutive slots in the order it carves them
+     * out of the untyped, so order the slots such that node[0] is always the half
+     * with the lower physical address */
+    if (_slots_adjacent(right, left)) {
+        cspacepath_t tmp = *left;
+        *left = *right;
+        *right = tmp;
+    }
+    if (_slots_adjacent(left, right)) {
+        sel4_error = seL4_Untyped_Retype(parent->ut.capPtr, seL4_UntypedObject, size_bits, left->root, left->dest,
+                                         left->destDepth, left->offset, 2);
+        if (sel4_error != seL4_NoError) {
+            ZF_LOGE("Failed to retype untyped, error %d\n", sel4_error);
+            return 1;
+        }
+        return 0;
+    }
+    sel4_error = seL4_Untyped_Retype(parent->ut.capPtr, seL4_UntypedObject, size_bits, left->root, left->dest,
+                                     left->destDepth, left->offset, 1);
+    if (sel4_error != seL4_NoError) {
+        ZF_LOGE("Failed to retype untyped, error %d\n", sel4_error);
+        return 1;
+    }
+    sel4_error = seL4_Untyped_Retype(parent->ut.capPtr, seL4_UntypedObject, size_bits, right->root, right->dest,
+                                     right->destDepth, right->offset, 1);
+    if (sel4_error != seL4_NoError) {
+        vka_cnode_delete(left);
+        ZF_LOGE("Failed to retype untyped, error %d\n", sel4_error);
+        return 1;
+    }
+    return 0;
+}
+
+/* Split a block that is not in any free list into its two halves */
+static struct utspace_buddy_pair *_split(allocman_t *alloc, struct utspace_buddy_node *node)
+{
+    struct utspace_buddy_pair *pair;
+    size_t i;
+    assert(!node->is_free);
+    assert(node->size_bits > 0);
+    pair = _new_pair(alloc);
+    if (!pair) {
+        return NULL;
+    }
+    if (_retype_pair(node, pair)) {
+        allocman_cspace_free(alloc, &pair->node[0].ut);
+        allocman_cspace_free(alloc, &pair->node[1].ut);
+        allocman_mspace_free(alloc, pair, sizeof(*pair));
+        return NULL;
+    }
+    for (i = 0; i < ARRAY_SIZE(pair->node); i++) {
+        struct utspace_buddy_node *child = &pair->node[i];
+        child->parent = node;
+        child->buddy = &pair->node[1 - i];
+        child->pool = node->pool;
+        child->size_bits = node->size_bits - 1;
+        child->is_free = 0;
+        if (node->paddr != ALLOCMAN_NO_PADDR) {
+            child->paddr = node->paddr + i * BIT(child->size_bits);
+        } else {
+            child->paddr = ALLOCMAN_NO_PADDR;
+        }
+    }
+    return pair;
+}
+
+/* Takes a block that has been removed from its free list and splits it until it
+ * is of the requested size, putting the left over halves in the free lists. If
+ * paddr is given the half containing it is kept at each level, otherwise we keep
+ * the lower half so that successive allocations are physically contiguous. On
+ * failure the block we were holding is put back in the free list */
+static struct utspace_buddy_node *_split_down(allocman_t *alloc, struct utspace_buddy_node *node, size_t size_bits,
+                                              uintptr_t paddr)
+{
+    while (node->size_bits > size_bits) {
+        struct utspace_buddy_pair *pair = _split(alloc, node);
+        struct utspace_buddy_node *keep;
+        if (!pair) {
+            ZF_LOGV("Failed to split untyped of size %zu", node->size_bits);
+            _insert_node(node);
+            return NULL;
+        }
+        if (paddr != ALLOCMAN_NO_PADDR && paddr >= pair->node[1].paddr) {
+            keep = &pair->node[1];
+        } else {
+            keep = &pair->node[0];
+        }
+        _insert_node(keep->buddy);
+        node = keep;
+    }
+    return node;
+}
+
+/* Takes a node that is not in any free list and whose buddy is free, and merges
+ * the two back into their parent, which is returned not in any free list */
+static struct utspace_buddy_node *_merge(allocman_t *alloc, struct utspace_buddy_node *node)
+{
+    struct utspace_buddy_node *parent = node->parent;
+    struct utspace_buddy_pair *pair;
+    _remove_node(node->buddy);
+    /* node[0] is the first member of the pair, so the lower of the two pointers is the pair */
+    pair = (struct utspace_buddy_pair *)(node < node->buddy ? node : node->buddy);
+    _delete_pair(alloc, pair);
+    return parent;
+}
+
+/* Merge every pair of free buddies in the pool, from the smallest order up so that
+ * merged parents can in turn merge with theirs. Returns non zero if anything merged */
+static int _coalesce(allocman_t *alloc, utspace_buddy_pool_t *pool)
+{
+    int merged = 0;
+    size_t order;
+    for (order = 0; order < CONFIG_WORD_SIZE; order++) {
+        struct utspace_buddy_node *node = pool->heads[order];
+        while (node) {
+            struct utspace_buddy_node *next = node->next;
+            if (node->parent && node->buddy->is_free) {
+                /* merging only takes node and its buddy out of this list */
+                if (next == node->buddy) {
+                    next = next->next;
+                }
+                _remove_node(node);
+                _insert_node(_merge(alloc, node));
+                merged = 1;
+            }
+            node = next;
+        }
+    }
+    return merged;
+}
+
+static struct utspace_buddy_node *_find_block(utspace_buddy_pool_t *pool, size_t size_bits)
+{
+    seL4_Word candidates = pool->nonempty & ~MASK(size_bits);
+    if (!candidates) {
+        return NULL;
+    }
+    return pool->heads[CTZL(candidates)];
+}
+
+static struct utspace_buddy_node *_find_block_for_paddr(utspace_buddy_pool_t *pool, size_t size_bits, uintptr_t paddr)
+{
+    seL4_Word candidates = pool->nonempty & ~MASK(size_bits);
+    while (candidates) {
+        size_t order = CTZL(candidates);
+        struct utspace_buddy_node *node;
+        for (node = pool->heads[order]; node; node = node->next) {
+            if (node->paddr == ALLOCMAN_NO_PADDR) {
+                /* skip nodes with no physical address */
+                continue;
+            }
+            if (node->paddr <= paddr && paddr + BIT(size_bits) <= node->paddr + BIT(order)) {
+                return node;
+            }
+        }
+        candidates &= ~BIT(order);
+    }
+    return NULL;
+}
+
+/* As _find_block, coalescing the free blocks of the pool first if none is large enough */
+static struct utspace_buddy_node *_find_block_coalesce(allocman_t *alloc, utspace_buddy_pool_t *pool,
+                                                       size_t size_bits)
+{
+    struct utspace_buddy_node *node = _find_block(pool, size_bits);
+    if (!node && _coalesce(alloc, pool)) {
+        node = _find_block(pool, size_bits);
+    }
+    return node;
+}
+
+static struct utspace_buddy_node *_find_block_for_paddr_coalesce(allocman_t *alloc, utspace_buddy_pool_t *pool,
+                                                                 size_t size_bits, uintptr_t paddr)
+{
+    struct utspace_buddy_node *node = _find_block_for_paddr(pool, size_bits, paddr);
+    if (!node && _coalesce(alloc, pool)) {
+        node = _find_block_for_paddr(pool, size_bits, paddr);
+    }
+    return node;
+}
+
+void utspace_buddy_create(utspace_buddy_t *buddy)
+{
+    memset(buddy, 0, sizeof(*buddy));
+}
+
+int _utspace_buddy_add_uts(allocman_t *alloc, void *_buddy, size_t num, const cspacepath_t *uts, size_t *size_bits,
+                           uintptr_t *paddr, int utType)
+{
+    utspace_buddy_t *buddy = (utspace_buddy_t *) _buddy;
+    utspace_buddy_pool_t *pool;
+    int error;
+    size_t i;
+    switch (utType) {
+    case ALLOCMAN_UT_KERNEL:
+        pool = &buddy->kernel;
+        break;
+    case ALLOCMAN_UT_DEV:
+        pool = &buddy->dev;
+        break;
+    case ALLOCMAN_UT_DEV_MEM:
+        pool = &buddy->dev_mem;
+        break;
+    default:
+        return -1;
+    }
+    for (i = 0; i < num; i++) {
+        struct utspace_buddy_node *node;
+        if (size_bits[i] >= CONFIG_WORD_SIZE) {
+            ZF_LOGE("Untyped of size_bits %zu is too large", size_bits[i]);
+            return -1;
+        }
+        node = (struct utspace_buddy_node *) allocman_mspace_alloc(alloc, sizeof(*node), &error);
+        if (error) {
+            ZF_LOGV("Failed to allocate node of size %zu", sizeof(*node));
+            return error;
+        }
+        *node = (struct utspace_buddy_node) {
+            .ut = uts[i],
+            .parent = NULL,
+            .buddy = NULL,
+            .pool = pool,
+            .paddr = paddr ? paddr[i] : ALLOCMAN_NO_PADDR,
+            .size_bits = size_bits[i],
+            .is_free = 0,
+        };
+        _insert_node(node);
+    }
+    return 0;
+}
+
+seL4_Word _utspace_buddy_alloc(allocman_t *alloc, void *_buddy, size_t size_bits, seL4_Word type,
+                               const cspacepath_t *slot, uintptr_t paddr, bool canBeDev, int *error)
+{
+    utspace_buddy_t *buddy = (utspace_buddy_t *)_buddy;
+    size_t sel4_size_bits;
+    int sel4_error;
+    struct utspace_buddy_node *node = NULL;
+    /* get size of untyped call */
+    sel4_size_bits = get_sel4_object_size(type, size_bits);
+    if (size_bits != vka_get_object_size(type, sel4_size_bits) || size_bits == 0 || size_bits >= CONFIG_WORD_SIZE) {
+        SET_ERROR(error, 1);
+        return 0;
+    }
+    if (paddr != ALLOCMAN_NO_PADDR) {
+        if (canBeDev) {
+            node = _find_block_for_paddr_coalesce(alloc, &buddy->dev, size_bits, paddr);
+            if (!node) {
+                node = _find_block_for_paddr_coalesce(alloc, &buddy->dev_mem, size_bits, paddr);
+            }
+        }
+        if (!node) {
+            node = _find_block_for_paddr_coalesce(alloc, &buddy->kernel, size_bits, paddr);
+        }
+        if (!node) {
+            SET_ERROR(error, 1);
+            ZF_LOGV("Failed to find any untyped capable of creating an object at address %p", (void *)paddr);
+            return 0;
+        }
+        _remove_node(node);
+        node = _split_down(alloc, node, size_bits, paddr);
+        if (!node) {
+            SET_ERROR(error, 1);
+            ZF_LOGV("Failed to split untyped to allocate object of size %zu", size_bits);
+            return 0;
+        }
+        /* objects are size aligned, so the block we end up with must start exactly at paddr */
+        assert(node->paddr == paddr);
+    } else {
+        /* if we can use device memory then preference allocating from there */
+        if (canBeDev) {
+            node = _find_block_coalesce(alloc, &buddy->dev_mem, size_bits);
+            if (node) {
+                _remove_node(node);
+                node = _split_down(alloc, node, size_bits, ALLOCMAN_NO_PADDR);
+            }
+            if (!node) {
+                ZF_LOGV("Failed to find device memory to allocate object of size %zu", size_bits);
+                ZF_LOGV("Trying regular untyped pool");
+            }
+        }
+        if (!node) {
+            node = _find_block_coalesce(alloc, &buddy->kernel, size_bits);
+            if (!node) {
+                SET_ERROR(error, 1);
+                ZF_LOGV("No untyped large enough to allocate object of size %zu", size_bits);
+                return 0;
+            }
+            _remove_node(node);
+            node = _split_down(alloc, node, size_bits, ALLOCMAN_NO_PADDR);
+            if (!node) {
+                SET_ERROR(error, 1);
+                ZF_LOGV("Failed to split untyped to allocate object of size %zu", size_bits);
+                return 0;
+            }
+        }
+    }
+    /* Perform the untyped retype */
+    sel4_error = seL4_Untyped_Retype(node->ut.capPtr, type, sel4_size_bits, slot->root, slot->dest, slot->destDepth,
+                                     slot->offset, 1);
+    if (sel4_error != seL4_NoError) {
+        /* Well this shouldn't happen */
+        ZF_LOGE("Failed to retype untyped, error %d\n", sel4_error);
+        _insert_node(node);
+        SET_ERROR(error, 1);
+        return 0;
+    }
+    SET_ERROR(error, 0);
+    /* return the node as a cookie */
+    return (seL4_Word)node;
+}
+
+void _utspace_buddy_free(allocman_t *alloc, void *_buddy, seL4_Word cookie, size_t size_bits)
+{
+    struct utspace_buddy_node *node = (struct utspace_buddy_node *)cookie;
+    assert(node->size_bits == size_bits);
+    /* keep a few free blocks of each order around for the next allocation of that
+     * size, and only coalesce with our buddy once there are enough of them. Anything
+     * left uncoalesced is merged when an allocation finds no block large enough */
+    while (node->parent && node->buddy->is_free &&
+           node->pool->num_free[node->size_bits] >= UTSPACE_BUDDY_CACHED_BLOCKS) {
+        node = _merge(alloc, node);
+    }
+    _insert_node(node);
+}
+
+uintptr_t _utspace_buddy_paddr(void *_buddy, seL4_Word cookie, size_t size_bits)
+{
+    struct utspace_buddy_node *node = (struct utspace_buddy_node *)cookie;
+    return node->paddr;
+}
@@ -13,6 +13,100 @@
 #include <vka/capops.h>
 #include <string.h>
 
+/* Returns the number of entries in the index whose paddr is <= paddr */
+static size_t _index_position(struct utspace_split_paddr_index *index, uintptr_t paddr)
+{
+    size_t low = 0;
+    size_t high = index->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->nodes[mid]->paddr <= paddr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void _index_insert(struct utspace_split_node *node)
+{
+    struct utspace_split_paddr_index *index = node->index;
+    size_t pos;
+    if (!index) {
+        return;
+    }
+    assert(index->count < index->capacity);
+    pos = _index_position(index, node->paddr);
+    memmove(&index->nodes[pos + 1], &index->nodes[pos], sizeof(index->nodes[0]) * (index->count - pos));
+    index->nodes[pos] = node;
+    index->count++;
+}
+
+static void _index_remove(struct utspace_split_node *node)
+{
+    struct utspace_split_paddr_index *index = node->index;
+    size_t pos;
+    if (!index) {
+        return;
+    }
+    pos = _index_position(index, node->paddr);
+    assert(pos > 0 && index->nodes[pos - 1] == node);
+    pos--;
+    memmove(&index->nodes[pos], &index->nodes[pos + 1], sizeof(index->nodes[0]) * (index->count - pos - 1));
+    index->count--;
+}
+
+/* Find the free node that covers the range [paddr, paddr + BIT(size_bits)) */
+static struct utspace_split_node *_index_find(struct utspace_split_paddr_index *index, uintptr_t paddr,
+                                               size_t size_bits)
+{
+    struct utspace_split_node *node;
+    size_t pos = _index_position(index, paddr);
+    if (pos == 0) {
+        return NULL;
+    }
+    node = index->nodes[pos - 1];
+    if (paddr + BIT(size_bits) <= node->paddr + BIT(node->size_bits)) {
+        return node;
+    }
+    return NULL;
+}
+
+/* Ensure the index has room for an additional num nodes */
+static int _index_reserve(allocman_t *alloc, struct utspace_split_paddr_index *index, size_t num)
+{
+    int error;
+    size_t capacity;
+    struct utspace_split_node **nodes;
+    if (index->num_nodes + num <= index->capacity) {
+        index->num_nodes += num;
+        return 0;
+    }
+    capacity = MAX(index->capacity * 2, index->num_nodes + num);
+    nodes = (struct utspace_split_node **) allocman_mspace_alloc(alloc, sizeof(*nodes) * capacity, &error);
+    if (error) {
+        ZF_LOGV("Failed to grow paddr index to %zu entries", capacity);
+        return error;
+    }
+    if (index->nodes) {
+        memcpy(nodes, index->nodes, sizeof(*nodes) * index->count);
+        allocman_mspace_free(alloc, index->nodes, sizeof(*nodes) * index->capacity);
+    }
+    index->nodes = nodes;
+    index->capacity = capacity;
+    index->num_nodes += num;
+    return 0;
+}
+
+static inline void _index_release(struct utspace_split_paddr_index *index, size_t num)
+{
+    if (index) {
+        assert(index->num_nodes >= num);
+        index->num_nodes -= num;
+    }
+}
+
 static void _remove_node(struct utspace_split_node **head, struct utspace_split_node *node)
 {
     if (node->prev) {
@@ -25,6 +119,7 @@ static void _remove_node(struct utspace_split_node **head, struct utspace_split_
         node->next->prev = node->prev;
     }
     node->head = head;
+    _index_remove(node);
 }
 
 static void _insert_node(struct utspace_split_node **head, struct utspace_split_node *node)
@@ -37,46 +132,121 @@ static void _insert_node(struct utspace_split_node **head, struct utspace_split_
     *head = node;
     /* mark node as not allocated */
     node->head = NULL;
+    _index_insert(node);
+}
+
+/* Nodes created while a checkpoint is held are tracked so that restoring it can delete them */
+static void _track_node(utspace_split_t *split, struct utspace_split_node *node)
+{
+    node->since_checkpoint = split->checkpoint.active;
+    if (node->since_checkpoint) {
+        node->created_prev = NULL;
+        node->created_next = split->checkpoint.created;
+        if (split->checkpoint.created) {
+            split->checkpoint.created->created_prev = node;
+        }
+        split->checkpoint.created = node;
+    }
+}
+
+static void _untrack_node(utspace_split_t *split, struct utspace_split_node *node)
+{
+    if (!node->since_checkpoint) {
+        return;
+    }
+    if (node->created_prev) {
+        node->created_prev->created_next = node->created_next;
+    } else {
+        split->checkpoint.created = node->created_next;
+    }
+    if (node->created_next) {
+        node->created_next->created_prev = node->created_prev;
+    }
+    node->since_checkpoint = false;
+}
+
+static inline cspacepath_t _node_path(utspace_split_t *split, struct utspace_split_node *node)
+{
+    return cspace_slot_path(&split->slots, node->ut);
 }
 
-static struct utspace_split_node *_new_node(allocman_t *alloc)
+static struct utspace_split_node *_new_node(allocman_t *alloc, utspace_split_t *split)
 {
     int error;
     struct utspace_split_node *node;
+    cspacepath_t path;
     node = (struct utspace_split_node *) allocman_mspace_alloc(alloc, sizeof(*node), &error);
     if (error) {
         ZF_LOGV("Failed to allocate node of size %zu", sizeof(*node));
         return NULL;
     }
-    error = allocman_cspace_alloc(alloc, &node->ut);
+    node->index = NULL;
+    error = allocman_cspace_alloc(alloc, &path);
     if (error) {
         allocman_mspace_free(alloc, node, sizeof(*node));
         ZF_LOGV("Failed to allocate slot");
         return NULL;
     }
+    error = cspace_slot_make(&split->slots, &path, &node->ut);
+    if (error) {
+        allocman_cspace_free(alloc, &path);
+        allocman_mspace_free(alloc, node, sizeof(*node));
+        ZF_LOGE("Slot is in a cspace the node slot table can't describe");
+        return NULL;
+    }
+    _track_node(split, node);
     return node;
 }
 
-static void _delete_node(allocman_t *alloc, struct utspace_split_node *node)
+/* Free the book keeping of a node whose slot is already empty */
+static void _release_node(allocman_t *alloc, utspace_split_t *split, struct utspace_split_node *node)
 {
-    vka_cnode_delete(&node->ut);
-    allocman_cspace_free(alloc, &node->ut);
+    cspacepath_t path = _node_path(split, node);
+    _untrack_node(split, node);
+    _index_release(node->index, 1);
+    allocman_cspace_free(alloc, &path);
     allocman_mspace_free(alloc, node, sizeof(*node));
 }
 
-static int _insert_new_node(allocman_t *alloc, struct utspace_split_node **head, cspacepath_t ut, uintptr_t paddr)
+static void _delete_node(allocman_t *alloc, utspace_split_t *split, struct utspace_split_node *node)
+{
+    cspacepath_t path = _node_path(split, node);
+    vka_cnode_delete(&path);
+    _release_node(alloc, split, node);
+}
+
+static int _insert_new_node(allocman_t *alloc, utspace_split_t *split, struct utspace_split_node **head,
+                            struct utspace_split_paddr_index *index, cspacepath_t ut, size_t size_bits, uintptr_t paddr)
 {
     int error;
     struct utspace_split_node *node;
+    if (paddr != ALLOCMAN_NO_PADDR) {
+        error = _index_reserve(alloc, index, 1);
+        if (error) {
+            return 1;
+        }
+    } else {
+        index = NULL;
+    }
     node = (struct utspace_split_node *) allocman_mspace_alloc(alloc, sizeof(*node), &error);
     if (error) {
         ZF_LOGV("Failed to allocate node of size %zu", sizeof(*node));
+        _index_release(index, 1);
+        return 1;
+    }
+    error = cspace_slot_make(&split->slots, &ut, &node->ut);
+    if (error) {
+        ZF_LOGE("Untyped is in a cspace the node slot table can't describe");
+        allocman_mspace_free(alloc, node, sizeof(*node));
+        _index_release(index, 1);
         return 1;
     }
     node->parent = NULL;
-    node->ut = ut;
     node->paddr = paddr;
+    node->size_bits = size_bits;
+    node->index = index;
     node->origin_head = head;
+    _track_node(split, node);
     _insert_node(head, node);
     return 0;
 }
@@ -89,6 +259,11 @@ void utspace_split_create(utspace_split_t *split)
         split->dev_heads[i] = NULL;
         split->dev_mem_heads[i] = NULL;
     }
+    split->index = (struct utspace_split_paddr_index) {0};
+    split->dev_index = (struct utspace_split_paddr_index) {0};
+    split->dev_mem_index = (struct utspace_split_paddr_index) {0};
+    split->checkpoint = (struct utspace_split_checkpoint) {0};
+    cspace_slot_table_init(&split->slots);
 }
 
 int _utspace_split_add_uts(allocman_t *alloc, void *_split, size_t num, const cspacepath_t *uts, size_t *size_bits,
@@ -98,21 +273,26 @@ int _utspace_split_add_uts(allocman_t *alloc, void *_split, size_t num, const cs
     int error;
     size_t i;
     struct utspace_split_node **list;
+    struct utspace_split_paddr_index *index;
     switch (utType) {
     case ALLOCMAN_UT_KERNEL:
         list = split->heads;
+        index = &split->index;
         break;
     case ALLOCMAN_UT_DEV:
         list = split->dev_heads;
+        index = &split->dev_index;
         break;
     case ALLOCMAN_UT_DEV_MEM:
         list = split->dev_mem_heads;
+        index = &split->dev_mem_index;
         break;
     default:
         return -1;
     }
     for (i = 0; i < num; i++) {
-        error = _insert_new_node(alloc, &list[size_bits[i]], uts[i], paddr ? paddr[i] : ALLOCMAN_NO_PADDR);
+        error = _insert_new_node(alloc, split, &list[size_bits[i]], index, uts[i], size_bits[i],
+                                 paddr ? paddr[i] : ALLOCMAN_NO_PADDR);
         if (error) {
             return error;
         }
@@ -120,78 +300,53 @@ int _utspace_split_add_uts(allocman_t *alloc, void *_split, size_t num, const cs
     return 0;
 }
 
-static int _refill_pool(allocman_t *alloc, utspace_split_t *split, struct utspace_split_node **heads, size_t size_bits,
-                        uintptr_t paddr)
+/* Split a free node into two halves of size_bits, which go on the free list in
+ * its place */
+static int _split_node(allocman_t *alloc, utspace_split_t *split, struct utspace_split_node **heads,
+                       struct utspace_split_node *node, size_t size_bits)
 {
-    struct utspace_split_node *node;
     struct utspace_split_node *left, *right;
     int sel4_error;
-    if (paddr == ALLOCMAN_NO_PADDR) {
-        /* see if pool is actually empty */
-        if (heads[size_bits]) {
-            return 0;
-        }
-    } else {
-        /* see if the pool has the paddr we want */
-        for (node = heads[size_bits]; node; node = node->next) {
-            if (node->paddr == ALLOCMAN_NO_PADDR) {
-                continue;
-            }
-            if (node->paddr <= paddr && paddr < node->paddr + BIT(size_bits)) {
-                return 0;
-            }
-        }
-    }
-    /* ensure we are not the highest pool */
-    if (size_bits >= sizeof(seL4_Word) * 8 - 2) {
-        /* bugger, no untypeds bigger than us */
-        ZF_LOGV("Failed to refill pool of size %zu, no larger pools", size_bits);
-        return 1;
-    }
-    /* get something from the highest pool */
-    if (_refill_pool(alloc, split, heads, size_bits + 1, paddr)) {
-        /* could not fill higher pool */
-        ZF_LOGV("Failed to refill pool of size %zu", size_bits);
+    /* make sure the index can track both children before we create them */
+    if (node->index && _index_reserve(alloc, node->index, 2)) {
+        ZF_LOGV("Failed to reserve paddr index space");
         return 1;
     }
-    if (paddr == ALLOCMAN_NO_PADDR) {
-        /* use the first node for lack of a better one */
-        node = heads[size_bits + 1];
-    } else {
-        for (node = heads[size_bits + 1]; node && (node->paddr == ALLOCMAN_NO_PADDR || !(node->paddr <= paddr
-                                                                                         && paddr < node->paddr + BIT(size_bits + 1))); node = node->next);
-        /* _refill_pool should not have returned if this wasn't possible */
-        assert(node);
-    }
     /* allocate two new nodes */
-    left = _new_node(alloc);
+    left = _new_node(alloc, split);
     if (!left) {
         ZF_LOGV("Failed to allocate left node");
+        _index_release(node->index, 2);
         return 1;
     }
-    right = _new_node(alloc);
+    left->index = node->index;
+    right = _new_node(alloc, split);
     if (!right) {
         ZF_LOGV("Failed to allocate right node");
-        _delete_node(alloc, left);
+        _delete_node(alloc, split, left);
+        _index_release(node->index, 1);
         return 1;
     }
+    right->index = node->index;
     /* perform the first retype */
-    sel4_error = seL4_Untyped_Retype(node->ut.capPtr, seL4_UntypedObject, size_bits, left->ut.root, left->ut.dest,
-                                     left->ut.destDepth, left->ut.offset, 1);
+    cspacepath_t left_path = _node_path(split, left);
+    cspacepath_t right_path = _node_path(split, right);
+    sel4_error = seL4_Untyped_Retype(node->ut.capPtr, seL4_UntypedObject, size_bits, left_path.root, left_path.dest,
+                                     left_path.destDepth, left_path.offset, 1);
     if (sel4_error != seL4_NoError) {
-        _delete_node(alloc, left);
-        _delete_node(alloc, right);
+        _delete_node(alloc, split, left);
+        _delete_node(alloc, split, right);
         /* Well this shouldn't happen */
         ZF_LOGE("Failed to retype untyped, error %d\n", sel4_error);
         return 1;
     }
     /* perform the second retype */
-    sel4_error = seL4_Untyped_Retype(node->ut.capPtr, seL4_UntypedObject, size_bits, right->ut.root, right->ut.dest,
-                                     right->ut.destDepth, right->ut.offset, 1);
+    sel4_error = seL4_Untyped_Retype(node->ut.capPtr, seL4_UntypedObject, size_bits, right_path.root, right_path.dest,
+                                     right_path.destDepth, right_path.offset, 1);
     if (sel4_error != seL4_NoError) {
-        vka_cnode_delete(&left->ut);
-        _delete_node(alloc, left);
-        _delete_node(alloc, right);
+        vka_cnode_delete(&left_path);
+        _delete_node(alloc, split, left);
+        _delete_node(alloc, split, right);
         /* Well this shouldn't happen */
         ZF_LOGE("Failed to retype untyped, error %d\n", sel4_error);
         return 1;
@@ -203,6 +358,7 @@ static int _refill_pool(allocman_t *alloc, utspace_split_t *split, struct utspac
     left->origin_head = &heads[size_bits];
     right->origin_head = &heads[size_bits];
     right->sibling = left;
+    left->size_bits = right->size_bits = size_bits;
     if (node->paddr != ALLOCMAN_NO_PADDR) {
         left->paddr = node->paddr;
         right->paddr = node->paddr + BIT(size_bits);
@@ -216,23 +372,49 @@ static int _refill_pool(allocman_t *alloc, utspace_split_t *split, struct utspac
     return 0;
 }
 
-static struct utspace_split_node **find_head_for_paddr(struct utspace_split_node **head, uintptr_t paddr,
-                                                       size_t size_bits)
+static int _refill_pool(allocman_t *alloc, utspace_split_t *split, struct utspace_split_node **heads,
+                        struct utspace_split_paddr_index *index, size_t size_bits, uintptr_t paddr)
 {
-    int i;
-    for (i = 0; i < CONFIG_WORD_SIZE; i++) {
-        struct utspace_split_node *node;
-        for (node = head[i]; node; node = node->next) {
-            if (node->paddr == ALLOCMAN_NO_PADDR) {
-                /* skip nodes with no physical address */
-                continue;
-            }
-            if (node->paddr <= paddr && paddr + BIT(size_bits) <= node->paddr + BIT(i)) {
-                return head;
-            }
+    struct utspace_split_node *node;
+    if (paddr == ALLOCMAN_NO_PADDR) {
+        /* see if pool is actually empty */
+        if (heads[size_bits]) {
+            return 0;
+        }
+    } else {
+        /* see if the pool has the paddr we want. paddr is only aligned to the size
+         * of the final allocation, so look for any free node containing it */
+        node = _index_find(index, paddr, 0);
+        if (!node) {
+            /* no free untyped covers this address at any size */
+            ZF_LOGV("No free untyped covering address %p", (void *)paddr);
+            return 1;
+        }
+        if (node->size_bits == size_bits) {
+            return 0;
         }
     }
-    return NULL;
+    /* ensure we are not the highest pool */
+    if (size_bits >= sizeof(seL4_Word) * 8 - 2) {
+        /* bugger, no untypeds bigger than us */
+        ZF_LOGV("Failed to refill pool of size %zu, no larger pools", size_bits);
+        return 1;
+    }
+    /* get something from the highest pool */
+    if (_refill_pool(alloc, split, heads, index, size_bits + 1, paddr)) {
+        /* could not fill higher pool */
+        ZF_LOGV("Failed to refill pool of size %zu", size_bits);
+        return 1;
+    }
+    if (paddr == ALLOCMAN_NO_PADDR) {
+        /* use the first node for lack of a better one */
+        node = heads[size_bits + 1];
+    } else {
+        node = _index_find(index, paddr, 0);
+        /* _refill_pool should not have returned if this wasn't possible */
+        assert(node && node->size_bits == size_bits + 1);
+    }
+    return _split_node(alloc, split, heads, node, size_bits);
 }
 
 seL4_Word _utspace_split_alloc(allocman_t *alloc, void *_split, size_t size_bits, seL4_Word type,
@@ -249,39 +431,44 @@ seL4_Word _utspace_split_alloc(allocman_t *alloc, void *_split, size_t size_bits
         return 0;
     }
     struct utspace_split_node **head = NULL;
-    /* if we're allocating at a particular paddr then we will just trawl through every pool
-     * and see if we can find out which one has what we want */
+    struct utspace_split_paddr_index *index = NULL;
+    /* if we're allocating at a particular paddr then look up which pool has a free
+     * untyped covering it */
     if (paddr != ALLOCMAN_NO_PADDR) {
         if (canBeDev) {
-            head = find_head_for_paddr(split->dev_heads, paddr, size_bits);
-            if (!head) {
-                head = find_head_for_paddr(split->dev_mem_heads, paddr, size_bits);
+            if (_index_find(&split->dev_index, paddr, size_bits)) {
+                head = split->dev_heads;
+                index = &split->dev_index;
+            } else if (_index_find(&split->dev_mem_index, paddr, size_bits)) {
+                head = split->dev_mem_heads;
+                index = &split->dev_mem_index;
             }
         }
-        if (!head) {
-            head = find_head_for_paddr(split->heads, paddr, size_bits);
+        if (!head && _index_find(&split->index, paddr, size_bits)) {
+            head = split->heads;
+            index = &split->index;
         }
         if (!head) {
             SET_ERROR(error, 1);
             ZF_LOGV("Failed to find any untyped capable of creating an object at address %p", (void *)paddr);
             return 0;
         }
-        if (_refill_pool(alloc, split, head, size_bits, paddr)) {
+        if (_refill_pool(alloc, split, head, index, size_bits, paddr)) {
             /* out of memory? */
             SET_ERROR(error, 1);
             ZF_LOGV("Failed to refill pool to allocate object of size %zu", size_bits);
             return 0;
         }
-        /* search for the node we want to use. We have the advantage of knowing that
+        /* find the node we want to use. We have the advantage of knowing that
          * due to objects being size aligned that the base paddr of the untyped will
          * be exactly the paddr we want */
-        for (node = head[size_bits]; node && (node->paddr == ALLOCMAN_NO_PADDR || node->paddr != paddr); node = node->next);
+        node = _index_find(index, paddr, size_bits);
         /* _refill_pool should not have returned if this wasn't possible */
-        assert(node);
+        assert(node && node->paddr == paddr && node->size_bits == size_bits);
     } else {
         /* if we can use device memory then preference allocating from there */
         if (canBeDev) {
-            if (_refill_pool(alloc, split, split->dev_mem_heads, size_bits, ALLOCMAN_NO_PADDR)) {
+            if (_refill_pool(alloc, split, split->dev_mem_heads, &split->dev_mem_index, size_bits, ALLOCMAN_NO_PADDR)) {
                 /* out of memory? Try fall through */
                 ZF_LOGV("Failed to refill device memory pool to allocate object of size %zu", size_bits);
                 ZF_LOGV("Trying regular untyped pool");
@@ -292,7 +479,7 @@ seL4_Word _utspace_split_alloc(allocman_t *alloc, void *_split, size_t size_bits
         }
         if (!head) {
             head = split->heads;
-            if (_refill_pool(alloc, split, head, size_bits, ALLOCMAN_NO_PADDR)) {
+            if (_refill_pool(alloc, split, head, &split->index, size_bits, ALLOCMAN_NO_PADDR)) {
                 /* out of memory? */
                 SET_ERROR(error, 1);
                 ZF_LOGV("Failed to refill pool to allocate object of size %zu", size_bits);
@@ -318,18 +505,145 @@ seL4_Word _utspace_split_alloc(allocman_t *alloc, void *_split, size_t size_bits
     return (seL4_Word)node;
 }
 
+/* Find the best (smallest) free node in the index that can hold a size_bits object entirely
+ * within [start, end), returning the address to allocate at or ALLOCMAN_NO_PADDR */
+static uintptr_t _index_find_in_range(struct utspace_split_paddr_index *index, size_t size_bits, uintptr_t start,
+                                      uintptr_t end)
+{
+    uintptr_t best = ALLOCMAN_NO_PADDR;
+    size_t best_bits = 0;
+    size_t pos = _index_position(index, start);
+    /* the node before start may still cover part of the range */
+    if (pos > 0) {
+        pos--;
+    }
+    for (; pos < index->count && index->nodes[pos]->paddr < end; pos++) {
+        struct utspace_split_node *node = index->nodes[pos];
+        uintptr_t node_end = node->paddr + BIT(node->size_bits);
+        uintptr_t paddr = (MAX(node->paddr, start) + MASK(size_bits)) & ~MASK(size_bits);
+        if (node->size_bits < size_bits || paddr + BIT(size_bits) > MIN(node_end, end)) {
+            continue;
+        }
+        if (best == ALLOCMAN_NO_PADDR || node->size_bits < best_bits) {
+            best = paddr;
+            best_bits = node->size_bits;
+        }
+    }
+    return best;
+}
+
+seL4_Word _utspace_split_alloc_in_range(allocman_t *alloc, void *_split, size_t size_bits, seL4_Word type,
+                                        const cspacepath_t *slot, uintptr_t start, uintptr_t end, bool canBeDev,
+                                        int *error)
+{
+    utspace_split_t *split = (utspace_split_t *)_split;
+    uintptr_t paddr = ALLOCMAN_NO_PADDR;
+    if (canBeDev) {
+        paddr = _index_find_in_range(&split->dev_mem_index, size_bits, start, end);
+    }
+    if (paddr == ALLOCMAN_NO_PADDR) {
+        paddr = _index_find_in_range(&split->index, size_bits, start, end);
+    }
+    if (paddr == ALLOCMAN_NO_PADDR) {
+        ZF_LOGV("No free untyped of size %zu in range %p-%p", size_bits, (void *)start, (void *)end);
+        SET_ERROR(error, 1);
+        return 0;
+    }
+    return _utspace_split_alloc(alloc, split, size_bits, type, slot, paddr, canBeDev, error);
+}
+
+static bool _colours_allowed(uintptr_t paddr, size_t size_bits, size_t colour_bits, seL4_Word colours)
+{
+    size_t pages = size_bits > seL4_PageBits ? BIT(size_bits - seL4_PageBits) : 1;
+    /* colours repeat, so looking at more pages than there are colours tells us nothing new */
+    for (size_t i = 0; i < MIN(pages, BIT(colour_bits)); i++) {
+        size_t colour = ((paddr >> seL4_PageBits) + i) & MASK(colour_bits);
+        if (!(colours & BIT(colour))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Find the best (smallest) free node in the index with room for a size_bits object of only
+ * the given colours, returning the address to allocate at or ALLOCMAN_NO_PADDR */
+static uintptr_t _index_find_coloured(struct utspace_split_paddr_index *index, size_t size_bits,
+                                      size_t colour_bits, seL4_Word colours)
+{
+    uintptr_t best = ALLOCMAN_NO_PADDR;
+    size_t best_bits = 0;
+    /* the colours of every aligned address appear within one period of the start of a node */
+    uintptr_t period = MAX(BIT(seL4_PageBits + colour_bits), BIT(size_bits));
+    for (size_t pos = 0; pos < index->count; pos++) {
+        struct utspace_split_node *node = index->nodes[pos];
+        if (node->size_bits < size_bits || (best != ALLOCMAN_NO_PADDR && node->size_bits >= best_bits)) {
+            continue;
+        }
+        for (uintptr_t offset = 0; offset < MIN(period, BIT(node->size_bits)); offset += BIT(size_bits)) {
+            if (_colours_allowed(node->paddr + offset, size_bits, colour_bits, colours)) {
+                best = node->paddr + offset;
+                best_bits = node->size_bits;
+                break;
+            }
+        }
+        if (best != ALLOCMAN_NO_PADDR && best_bits == size_bits) {
+            /* can not do better than an exact fit */
+            break;
+        }
+    }
+    return best;
+}
+
+seL4_Word _utspace_split_alloc_coloured(allocman_t *alloc, void *_split, size_t size_bits, seL4_Word type,
+                                        const cspacepath_t *slot, size_t colour_bits, seL4_Word colours,
+                                        bool canBeDev, int *error)
+{
+    utspace_split_t *split = (utspace_split_t *)_split;
+    uintptr_t paddr = ALLOCMAN_NO_PADDR;
+    if (canBeDev) {
+        paddr = _index_find_coloured(&split->dev_mem_index, size_bits, colour_bits, colours);
+    }
+    if (paddr == ALLOCMAN_NO_PADDR) {
+        paddr = _index_find_coloured(&split->index, size_bits, colour_bits, colours);
+    }
+    if (paddr == ALLOCMAN_NO_PADDR) {
+        ZF_LOGV("No free untyped of size %zu in colours 0x%lx", size_bits, (long) colours);
+        SET_ERROR(error, 1);
+        return 0;
+    }
+    return _utspace_split_alloc(alloc, split, size_bits, type, slot, paddr, canBeDev, error);
+}
+
+int _utspace_split_presplit(allocman_t *alloc, void *_split, size_t size_bits, size_t target)
+{
+    utspace_split_t *split = (utspace_split_t *)_split;
+    struct utspace_split_node *node;
+    size_t count = 0;
+    for (node = split->heads[size_bits]; node && count < target; node = node->next) {
+        count++;
+    }
+    if (count >= target || size_bits >= sizeof(seL4_Word) * 8 - 2) {
+        return 0;
+    }
+    if (_refill_pool(alloc, split, split->heads, &split->index, size_bits + 1, ALLOCMAN_NO_PADDR)) {
+        return 0;
+    }
+    return _split_node(alloc, split, split->heads, split->heads[size_bits + 1], size_bits) ? 0 : 1;
+}
+
 void _utspace_split_free(allocman_t *alloc, void *_split, seL4_Word cookie, size_t size_bits)
 {
     utspace_split_t *split = (utspace_split_t *)_split;
     struct utspace_split_node *node = (struct utspace_split_node *)cookie;
     struct utspace_split_node *parent = node->parent;
-    /* see if our sibling is also free */
-    if (parent && !node->sibling->head) {
+    /* see if our sibling is also free. Nodes from before a checkpoint are not merged, as
+     * restoring the checkpoint needs them */
+    if (parent && !node->sibling->head && (!split->checkpoint.active || node->since_checkpoint)) {
         /* remove sibling from free list */
         _remove_node(node->sibling->origin_head, node->sibling);
         /* delete both of us */
-        _delete_node(alloc, node->sibling);
-        _delete_node(alloc, node);
+        _delete_node(alloc, split, node->sibling);
+        _delete_node(alloc, split, node);
         /* put the parent back in */
         _utspace_split_free(alloc, split, (seL4_Word) parent, size_bits + 1);
     } else {
@@ -338,8 +652,143 @@ void _utspace_split_free(allocman_t *alloc, void *_split, seL4_Word cookie, size
     }
 }
 
+static size_t _count_free(struct utspace_split_node **heads, struct utspace_split_node **nodes)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < CONFIG_WORD_SIZE; i++) {
+        for (struct utspace_split_node *node = heads[i]; node; node = node->next) {
+            if (nodes) {
+                nodes[count] = node;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+int _utspace_split_checkpoint(allocman_t *alloc, void *_split)
+{
+    utspace_split_t *split = (utspace_split_t *)_split;
+    struct utspace_split_checkpoint *checkpoint = &split->checkpoint;
+    struct utspace_split_node **nodes;
+    size_t num_nodes;
+    int error;
+
+    /* taking a new checkpoint makes everything from the old one permanent */
+    while (checkpoint->created) {
+        _untrack_node(split, checkpoint->created);
+    }
+    if (checkpoint->nodes) {
+        allocman_mspace_free(alloc, checkpoint->nodes, sizeof(*checkpoint->nodes) * MAX(checkpoint->num_nodes, 1));
+    }
+    checkpoint->active = false;
+    checkpoint->nodes = NULL;
+    checkpoint->num_nodes = 0;
+
+    /* allocate first, in case that takes anything from the free lists */
+    num_nodes = _count_free(split->heads, NULL) + _count_free(split->dev_heads, NULL) +
+                _count_free(split->dev_mem_heads, NULL);
+    nodes = allocman_mspace_alloc(alloc, sizeof(*nodes) * MAX(num_nodes, 1), &error);
+    if (error) {
+        ZF_LOGE("Failed to allocate checkpoint of %zu free untypeds", num_nodes);
+        return error;
+    }
+    num_nodes = _count_free(split->heads, nodes);
+    num_nodes += _count_free(split->dev_heads, nodes + num_nodes);
+    num_nodes += _count_free(split->dev_mem_heads, nodes + num_nodes);
+
+    checkpoint->nodes = nodes;
+    checkpoint->num_nodes = num_nodes;
+    checkpoint->active = true;
+    return 0;
+}
+
+int _utspace_split_restore(allocman_t *alloc, void *_split)
+{
+    utspace_split_t *split = (utspace_split_t *)_split;
+    struct utspace_split_checkpoint *checkpoint = &split->checkpoint;
+    struct utspace_split_node *node, *next;
+    bool added = false;
+    int error;
+
+    if (!checkpoint->active) {
+        ZF_LOGE("No checkpoint to restore");
+        return 1;
+    }
+    /* Everything made since the checkpoint descends from an untyped that was free
+     * at the checkpoint, or from one added since */
+    for (size_t i = 0; i < checkpoint->num_nodes; i++) {
+        cspacepath_t path = _node_path(split, checkpoint->nodes[i]);
+        error = vka_cnode_revoke(&path);
+        if (error != seL4_NoError) {
+            ZF_LOGE("Failed to revoke untyped, error %d", error);
+            return 1;
+        }
+    }
+    for (node = checkpoint->created; node; node = node->created_next) {
+        if (!node->parent) {
+            cspacepath_t path = _node_path(split, node);
+            error = vka_cnode_revoke(&path);
+            if (error != seL4_NoError) {
+                ZF_LOGE("Failed to revoke untyped, error %d", error);
+                return 1;
+            }
+        }
+    }
+    for (node = checkpoint->created; node; node = next) {
+        next = node->created_next;
+        if (!node->parent) {
+            /* added since the checkpoint, so keep it but make it free */
+            _untrack_node(split, node);
+            if (node->head) {
+                _insert_node(node->origin_head, node);
+            }
+            added = true;
+            continue;
+        }
+        if (!node->head) {
+            _remove_node(node->origin_head, node);
+        }
+        _release_node(alloc, split, node);
+    }
+    for (size_t i = 0; i < checkpoint->num_nodes; i++) {
+        node = checkpoint->nodes[i];
+        if (node->head) {
+            _insert_node(node->origin_head, node);
+        }
+    }
+    /* untypeds added since the checkpoint become part of it */
+    return added ? _utspace_split_checkpoint(alloc, split) : 0;
+}
+
 uintptr_t _utspace_split_paddr(void *_split, seL4_Word cookie, size_t size_bits)
 {
     struct utspace_split_node *node = (struct utspace_split_node *)cookie;
     return node->paddr;
 }
+
+static void _heads_stats(struct utspace_split_node **heads, size_t *free, uint64_t *free_bytes,
+                         size_t *largest_free_bits)
+{
+    for (size_t size_bits = 0; size_bits < CONFIG_WORD_SIZE; size_bits++) {
+        for (struct utspace_split_node *node = heads[size_bits]; node; node = node->next) {
+            free[size_bits]++;
+        }
+        *free_bytes += (uint64_t)free[size_bits] << size_bits;
+        if (free[size_bits]) {
+            *largest_free_bits = size_bits;
+        }
+    }
+}
+
+void _utspace_split_stats(void *_split, struct utspace_stats *stats)
+{
+    utspace_split_t *split = (utspace_split_t *)_split;
+    memset(stats, 0, sizeof(*stats));
+    _heads_stats(split->heads, stats->free[ALLOCMAN_UT_KERNEL], &stats->free_bytes[ALLOCMAN_UT_KERNEL],
+                 &stats->largest_free_bits[ALLOCMAN_UT_KERNEL]);
+    _heads_stats(split->dev_heads, stats->free[ALLOCMAN_UT_DEV], &stats->free_bytes[ALLOCMAN_UT_DEV],
+                 &stats->largest_free_bits[ALLOCMAN_UT_DEV]);
+    _heads_stats(split->dev_mem_heads, stats->free[ALLOCMAN_UT_DEV_MEM], &stats->free_bytes[ALLOCMAN_UT_DEV_MEM],
+                 &stats->largest_free_bits[ALLOCMAN_UT_DEV_MEM]);
+}
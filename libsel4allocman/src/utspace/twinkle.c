@@ -21,10 +21,74 @@ static inline size_t _round_up(size_t v, size_t bits)
     return v;
 }
 
+/* Largest object size that can still be created from an untyped, or UTSPACE_TWINKLE_NO_UT
+ * if the untyped is full */
+static size_t _max_fit_bits(struct utspace_twinkle_ut *ut)
+{
+    size_t bits = ut->size_bits + 1;
+    while (bits-- > 0) {
+        if (_round_up(ut->offset, bits) + BIT(bits) <= BIT(ut->size_bits)) {
+            return bits;
+        }
+    }
+    return UTSPACE_TWINKLE_NO_UT;
+}
+
+static void _bucket_remove(utspace_twinkle_t *twinkle, size_t i)
+{
+    struct utspace_twinkle_ut *ut = &twinkle->uts[i];
+    if (ut->bucket == UTSPACE_TWINKLE_NO_UT) {
+        return;
+    }
+    if (ut->prev != UTSPACE_TWINKLE_NO_UT) {
+        twinkle->uts[ut->prev].next = ut->next;
+    } else {
+        assert(twinkle->heads[ut->bucket] == i);
+        twinkle->heads[ut->bucket] = ut->next;
+        if (ut->next == UTSPACE_TWINKLE_NO_UT) {
+            twinkle->nonempty &= ~BIT(ut->bucket);
+        }
+    }
+    if (ut->next != UTSPACE_TWINKLE_NO_UT) {
+        twinkle->uts[ut->next].prev = ut->prev;
+    }
+    ut->bucket = UTSPACE_TWINKLE_NO_UT;
+}
+
+/* Put an untyped into the bucket matching its current free space */
+static void _bucket_insert(utspace_twinkle_t *twinkle, size_t i)
+{
+    struct utspace_twinkle_ut *ut = &twinkle->uts[i];
+    size_t bucket = _max_fit_bits(ut);
+    ut->bucket = bucket;
+    if (bucket == UTSPACE_TWINKLE_NO_UT) {
+        return;
+    }
+    ut->next = twinkle->heads[bucket];
+    ut->prev = UTSPACE_TWINKLE_NO_UT;
+    if (ut->next != UTSPACE_TWINKLE_NO_UT) {
+        twinkle->uts[ut->next].prev = i;
+    }
+    twinkle->heads[bucket] = i;
+    twinkle->nonempty |= BIT(bucket);
+}
+
 void utspace_twinkle_create(utspace_twinkle_t *twinkle)
 {
+    size_t i;
     twinkle->num_uts = 0;
     twinkle->uts = NULL;
+    twinkle->reclaim = 0;
+    twinkle->nonempty = 0;
+    for (i = 0; i < ARRAY_SIZE(twinkle->heads); i++) {
+        twinkle->heads[i] = UTSPACE_TWINKLE_NO_UT;
+    }
+}
+
+void utspace_twinkle_create_reclaiming(utspace_twinkle_t *twinkle)
+{
+    utspace_twinkle_create(twinkle);
+    twinkle->reclaim = 1;
 }
 
 int _utspace_twinkle_add_uts(allocman_t *alloc, void *_twinkle, size_t num, const cspacepath_t *uts, size_t *size_bits,
@@ -46,15 +110,57 @@ int _utspace_twinkle_add_uts(allocman_t *alloc, void *_twinkle, size_t num, cons
         memcpy(new_uts, twinkle->uts, sizeof(struct utspace_twinkle_ut) * twinkle->num_uts);
         allocman_mspace_free(alloc, twinkle->uts, sizeof(struct utspace_twinkle_ut) * twinkle->num_uts);
     }
+    twinkle->uts = new_uts;
     for (i = 0; i < num; i++, twinkle->num_uts++) {
         new_uts[twinkle->num_uts] = (struct utspace_twinkle_ut) {
-            uts[i], 0, size_bits[i]
+            .path = uts[i],
+            .offset = 0,
+            .size_bits = size_bits[i],
+            .refcount = 0,
+            .bucket = UTSPACE_TWINKLE_NO_UT,
+            .next = UTSPACE_TWINKLE_NO_UT,
+            .prev = UTSPACE_TWINKLE_NO_UT,
         };
+        if (twinkle->reclaim) {
+            _bucket_insert(twinkle, twinkle->num_uts);
+        }
     }
-    twinkle->uts = new_uts;
     return 0;
 }
 
+static seL4_Word _utspace_twinkle_alloc_reclaim(utspace_twinkle_t *twinkle, size_t size_bits, seL4_Word type,
+                                                size_t sel4_size_bits, const cspacepath_t *slot, int *error)
+{
+    seL4_Word candidates;
+    size_t i;
+    int sel4_error;
+    if (size_bits >= CONFIG_WORD_SIZE) {
+        SET_ERROR(error, 1);
+        return 0;
+    }
+    /* The smallest bucket that fits us is the closest to a best fit */
+    candidates = twinkle->nonempty & ~MASK(size_bits);
+    if (!candidates) {
+        SET_ERROR(error, 1);
+        return 0;
+    }
+    i = twinkle->heads[CTZL(candidates)];
+    sel4_error = seL4_Untyped_Retype(twinkle->uts[i].path.capPtr, type, sel4_size_bits, slot->root, slot->dest,
+                                     slot->destDepth, slot->offset, 1);
+    if (sel4_error != seL4_NoError) {
+        /* Well this shouldn't happen */
+        SET_ERROR(error, 1);
+        return 0;
+    }
+    _bucket_remove(twinkle, i);
+    twinkle->uts[i].offset = _round_up(twinkle->uts[i].offset, size_bits) + BIT(size_bits);
+    twinkle->uts[i].refcount++;
+    _bucket_insert(twinkle, i);
+    SET_ERROR(error, 0);
+    /* cookies of zero are reserved to mean no allocation */
+    return (seL4_Word)(i + 1);
+}
+
 seL4_Word _utspace_twinkle_alloc(allocman_t *alloc, void *_twinkle, size_t size_bits, seL4_Word type,
                                  const cspacepath_t *slot, uintptr_t paddr, bool canBeDev, int *error)
 {
@@ -72,6 +178,9 @@ seL4_Word _utspace_twinkle_alloc(allocman_t *alloc, void *_twinkle, size_t size_
         SET_ERROR(error, 1);
         return 0;
     }
+    if (twinkle->reclaim) {
+        return _utspace_twinkle_alloc_reclaim(twinkle, size_bits, type, sel4_size_bits, slot, error);
+    }
     /* Search for the first thing that will support us */
     for (i = 0; i < twinkle->num_uts; i++) {
         if (_round_up(twinkle->uts[i].offset, size_bits) + BIT(size_bits) <= BIT(twinkle->uts[i].size_bits)) {
@@ -111,5 +220,21 @@ seL4_Word _utspace_twinkle_alloc(allocman_t *alloc, void *_twinkle, size_t size_
 
 void _utspace_twinkle_free(allocman_t *alloc, void *_twinkle, seL4_Word cookie, size_t size_bits)
 {
-    /* Do nothing */
+    utspace_twinkle_t *twinkle = (utspace_twinkle_t *)_twinkle;
+    size_t i;
+    if (!twinkle->reclaim || cookie == 0) {
+        /* Do nothing */
+        return;
+    }
+    i = cookie - 1;
+    assert(i < twinkle->num_uts);
+    assert(twinkle->uts[i].refcount > 0);
+    twinkle->uts[i].refcount--;
+    if (twinkle->uts[i].refcount == 0) {
+        /* Nothing left in this untyped. The kernel resets an untyped with no children
+         * when it is next retyped, so the whole thing is available again */
+        _bucket_remove(twinkle, i);
+        twinkle->uts[i].offset = 0;
+        _bucket_insert(twinkle, i);
+    }
 }
@@ -23,7 +23,7 @@
  * @param res pointer to a cptr to store the allocated slot
  * @return 0 on success
  */
-static int am_vka_cspace_alloc(void *data, seL4_CPtr *res)
+int allocman_vka_cspace_alloc(void *data, seL4_CPtr *res)
 {
     int error;
     cspacepath_t path;
@@ -47,7 +47,7 @@ static int am_vka_cspace_alloc(void *data, seL4_CPtr *res)
  * @param slot a cslot allocated by the cspace alloc function
  * @param res pointer to a cspacepath struct to fill out
  */
-static void am_vka_cspace_make_path (void *data, seL4_CPtr slot, cspacepath_t *res)
+void allocman_vka_cspace_make_path (void *data, seL4_CPtr slot, cspacepath_t *res)
 {
     assert(data);
     assert(res);
@@ -61,7 +61,7 @@ static void am_vka_cspace_make_path (void *data, seL4_CPtr slot, cspacepath_t *r
  * @param data cookie for the underlying allocator
  * @param slot a cslot allocated by the cspace alloc function
  */
-static void am_vka_cspace_free (void *data, seL4_CPtr slot)
+void allocman_vka_cspace_free (void *data, seL4_CPtr slot)
 {
     cspacepath_t path;
     assert(data);
@@ -81,7 +81,7 @@ static void am_vka_cspace_free (void *data, seL4_CPtr slot)
  * @param res pointer to a location to store the cookie representing this allocation
  * @return 0 on success
  */
-static int am_vka_utspace_alloc_maybe_device (void *data, const cspacepath_t *dest,
+int allocman_vka_utspace_alloc_maybe_device (void *data, const cspacepath_t *dest,
                 seL4_Word type, seL4_Word size_bits, bool can_use_dev, seL4_Word *res)
 {
     int error;
@@ -109,9 +109,9 @@ static int am_vka_utspace_alloc_maybe_device (void *data, const cspacepath_t *de
  * @param res pointer to a location to store the cookie representing this allocation
  * @return 0 on success
  */
-static int am_vka_utspace_alloc (void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits, seL4_Word *res)
+int allocman_vka_utspace_alloc (void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits, seL4_Word *res)
 {
-    return am_vka_utspace_alloc_maybe_device(data, dest, type, size_bits, false, res);
+    return allocman_vka_utspace_alloc_maybe_device(data, dest, type, size_bits, false, res);
 }
 
 /**
@@ -125,7 +125,7 @@ static int am_vka_utspace_alloc (void *data, const cspacepath_t *dest, seL4_Word
  * @param res pointer to a location to store the cookie representing this allocation
  * @return 0 on success
  */
-static int am_vka_utspace_alloc_at (void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits, uintptr_t paddr, seL4_Word *res)
+int allocman_vka_utspace_alloc_at (void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits, uintptr_t paddr, seL4_Word *res)
 {
     int error;
 
@@ -151,7 +151,7 @@ static int am_vka_utspace_alloc_at (void *data, const cspacepath_t *dest, seL4_W
  * @param size_bits the size of the object that was allocated (as passed to Untyped_Retype)
  * @param target cookie to the allocation as given by the utspace alloc function
  */
-static void am_vka_utspace_free (void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
+void allocman_vka_utspace_free (void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
 {
     assert(data);
 
@@ -162,7 +162,7 @@ static void am_vka_utspace_free (void *data, seL4_Word type, seL4_Word size_bits
     allocman_utspace_free((allocman_t *)data, target, size_bits);
 }
 
-static uintptr_t am_vka_utspace_paddr (void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits)
+uintptr_t allocman_vka_utspace_paddr (void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits)
 {
     assert(data);
 
@@ -173,6 +173,106 @@ static uintptr_t am_vka_utspace_paddr (void *data, seL4_Word target, seL4_Word t
     return allocman_utspace_paddr((allocman_t *)data, target, size_bits);
 }
 
+/**
+ * Allocate several slots in a cspace. If the cspace supports ranges the slots
+ * are consecutive, otherwise they are allocated individually.
+ *
+ * @param data cookie for the underlying allocator
+ * @param num number of slots to allocate
+ * @param res array of num cptrs to store the allocated slots in
+ * @return 0 on success
+ */
+int allocman_vka_cspace_alloc_n(void *data, size_t num, seL4_CPtr *res)
+{
+    int error;
+    cspacepath_t path;
+    allocman_t *alloc = (allocman_t *) data;
+
+    assert(data);
+    assert(res);
+
+    error = allocman_cspace_alloc_range(alloc, num, &path);
+    if (!error) {
+        for (size_t i = 0; i < num; i++) {
+            res[i] = path.capPtr + i;
+        }
+        return 0;
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        error = allocman_cspace_alloc(alloc, &path);
+        if (error) {
+            while (i > 0) {
+                i--;
+                path = allocman_cspace_make_path(alloc, res[i]);
+                allocman_cspace_free(alloc, &path);
+            }
+            return error;
+        }
+        res[i] = path.capPtr;
+    }
+
+    return 0;
+}
+
+/**
+ * Allocate several objects of the same type from a single untyped
+ *
+ * @param data cookie for the underlying allocator
+ * @param dest array of num paths to empty cslots to place caps to the allocated objects
+ * @param type the seL4 object type to allocate (as passed to Untyped_Retype)
+ * @param size_bits the size of the objects to allocate (as passed to Untyped_Retype)
+ * @param num number of objects to allocate
+ * @param res pointer to a location to store the cookie representing this allocation
+ * @return 0 on success
+ */
+int allocman_vka_utspace_alloc_n(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                 size_t num, seL4_Word *res)
+{
+    int error;
+
+    assert(data);
+    assert(res);
+    assert(dest);
+
+    size_bits = vka_get_object_size(type, size_bits);
+
+    *res = allocman_utspace_alloc_n((allocman_t *) data, size_bits, type, dest, num, false, &error);
+
+    return error;
+}
+
+void allocman_vka_utspace_free_n(void *data, seL4_Word type, seL4_Word size_bits, size_t num, seL4_Word target)
+{
+    assert(data);
+
+    size_bits = vka_get_object_size(type, size_bits);
+
+    allocman_utspace_free_n((allocman_t *)data, target, size_bits, num);
+}
+
+/**
+ * Free a number of cslots, a run of consecutive slots at a time
+ *
+ * @param data cookie for the underlying allocator
+ * @param num number of slots to free
+ * @param slots the slots to free
+ */
+void allocman_vka_cspace_free_n(void *data, size_t num, const seL4_CPtr *slots)
+{
+    allocman_t *alloc = (allocman_t *) data;
+    assert(data);
+
+    size_t start = 0;
+    for (size_t i = 1; i <= num; i++) {
+        if (i == num || slots[i] != slots[i - 1] + 1) {
+            cspacepath_t first = allocman_cspace_make_path(alloc, slots[start]);
+            allocman_cspace_free_range(alloc, &first, i - start);
+            start = i;
+        }
+    }
+}
+
 /**
  * Make a VKA object using this allocman
  *
@@ -185,14 +285,18 @@ void allocman_make_vka(vka_t *vka, allocman_t *alloc)
     assert(alloc);
 
     vka->data = alloc;
-    vka->cspace_alloc = &am_vka_cspace_alloc;
-    vka->cspace_make_path = &am_vka_cspace_make_path;
-    vka->utspace_alloc = &am_vka_utspace_alloc;
-    vka->utspace_alloc_maybe_device = &am_vka_utspace_alloc_maybe_device;
-    vka->utspace_alloc_at = &am_vka_utspace_alloc_at;
-    vka->cspace_free = &am_vka_cspace_free;
-    vka->utspace_free = &am_vka_utspace_free;
-    vka->utspace_paddr = &am_vka_utspace_paddr;
+    vka->cspace_alloc = &allocman_vka_cspace_alloc;
+    vka->cspace_make_path = &allocman_vka_cspace_make_path;
+    vka->utspace_alloc = &allocman_vka_utspace_alloc;
+    vka->utspace_alloc_maybe_device = &allocman_vka_utspace_alloc_maybe_device;
+    vka->utspace_alloc_at = &allocman_vka_utspace_alloc_at;
+    vka->cspace_free = &allocman_vka_cspace_free;
+    vka->utspace_free = &allocman_vka_utspace_free;
+    vka->utspace_paddr = &allocman_vka_utspace_paddr;
+    vka->cspace_alloc_n = &allocman_vka_cspace_alloc_n;
+    vka->utspace_alloc_n = &allocman_vka_utspace_alloc_n;
+    vka->utspace_free_n = &allocman_vka_utspace_free_n;
+    vka->cspace_free_n = &allocman_vka_cspace_free_n;
 }
 
 int allocman_make_from_vka(vka_t *vka, allocman_t *alloc)
@@ -211,3 +315,184 @@ int allocman_make_from_vka(vka_t *vka, allocman_t *alloc)
     assert(!error);
     return 0;
 }
+
+static int am_local_vka_cspace_alloc(void *data, seL4_CPtr *res)
+{
+    return allocman_vka_cspace_alloc(((struct allocman_local_vka *)data)->alloc, res);
+}
+
+static void am_local_vka_cspace_make_path(void *data, seL4_CPtr slot, cspacepath_t *res)
+{
+    allocman_vka_cspace_make_path(((struct allocman_local_vka *)data)->alloc, slot, res);
+}
+
+static void am_local_vka_cspace_free(void *data, seL4_CPtr slot)
+{
+    allocman_vka_cspace_free(((struct allocman_local_vka *)data)->alloc, slot);
+}
+
+static int am_local_vka_utspace_alloc_maybe_device(void *data, const cspacepath_t *dest, seL4_Word type,
+                                                   seL4_Word size_bits, bool can_use_dev, seL4_Word *res)
+{
+    int error;
+    struct allocman_local_vka *local = (struct allocman_local_vka *)data;
+
+    assert(data);
+    assert(res);
+    assert(dest);
+
+    size_bits = vka_get_object_size(type, size_bits);
+
+    *res = allocman_utspace_alloc_near(local->alloc, local->core, size_bits, type, dest, can_use_dev, &error);
+
+    return error;
+}
+
+static int am_local_vka_utspace_alloc(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                      seL4_Word *res)
+{
+    return am_local_vka_utspace_alloc_maybe_device(data, dest, type, size_bits, false, res);
+}
+
+static int am_local_vka_utspace_alloc_at(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                         uintptr_t paddr, seL4_Word *res)
+{
+    return allocman_vka_utspace_alloc_at(((struct allocman_local_vka *)data)->alloc, dest, type, size_bits, paddr, res);
+}
+
+static void am_local_vka_utspace_free(void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
+{
+    allocman_vka_utspace_free(((struct allocman_local_vka *)data)->alloc, type, size_bits, target);
+}
+
+static uintptr_t am_local_vka_utspace_paddr(void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits)
+{
+    return allocman_vka_utspace_paddr(((struct allocman_local_vka *)data)->alloc, target, type, size_bits);
+}
+
+static int am_local_vka_cspace_alloc_n(void *data, size_t num, seL4_CPtr *res)
+{
+    return allocman_vka_cspace_alloc_n(((struct allocman_local_vka *)data)->alloc, num, res);
+}
+
+static void am_local_vka_cspace_free_n(void *data, size_t num, const seL4_CPtr *slots)
+{
+    allocman_vka_cspace_free_n(((struct allocman_local_vka *)data)->alloc, num, slots);
+}
+
+void allocman_make_local_vka(vka_t *vka, struct allocman_local_vka *local, allocman_t *alloc, int core)
+{
+    assert(vka);
+    assert(local);
+    assert(alloc);
+
+    local->alloc = alloc;
+    local->core = core;
+
+    vka->data = local;
+    vka->cspace_alloc = &am_local_vka_cspace_alloc;
+    vka->cspace_make_path = &am_local_vka_cspace_make_path;
+    vka->utspace_alloc = &am_local_vka_utspace_alloc;
+    vka->utspace_alloc_maybe_device = &am_local_vka_utspace_alloc_maybe_device;
+    vka->utspace_alloc_at = &am_local_vka_utspace_alloc_at;
+    vka->cspace_free = &am_local_vka_cspace_free;
+    vka->utspace_free = &am_local_vka_utspace_free;
+    vka->utspace_paddr = &am_local_vka_utspace_paddr;
+    vka->cspace_alloc_n = &am_local_vka_cspace_alloc_n;
+    vka->cspace_free_n = &am_local_vka_cspace_free_n;
+    /* batches fall back to the single object path, which is locality aware */
+    vka->utspace_alloc_n = NULL;
+    vka->utspace_free_n = NULL;
+}
+
+static int am_coloured_vka_cspace_alloc(void *data, seL4_CPtr *res)
+{
+    return allocman_vka_cspace_alloc(((struct allocman_coloured_vka *)data)->alloc, res);
+}
+
+static void am_coloured_vka_cspace_make_path(void *data, seL4_CPtr slot, cspacepath_t *res)
+{
+    allocman_vka_cspace_make_path(((struct allocman_coloured_vka *)data)->alloc, slot, res);
+}
+
+static void am_coloured_vka_cspace_free(void *data, seL4_CPtr slot)
+{
+    allocman_vka_cspace_free(((struct allocman_coloured_vka *)data)->alloc, slot);
+}
+
+static int am_coloured_vka_utspace_alloc_maybe_device(void *data, const cspacepath_t *dest, seL4_Word type,
+                                                      seL4_Word size_bits, bool can_use_dev, seL4_Word *res)
+{
+    int error;
+    struct allocman_coloured_vka *coloured = (struct allocman_coloured_vka *)data;
+
+    assert(data);
+    assert(res);
+    assert(dest);
+
+    size_bits = vka_get_object_size(type, size_bits);
+
+    *res = allocman_utspace_alloc_coloured(coloured->alloc, coloured->colours, size_bits, type, dest, can_use_dev,
+                                           &error);
+
+    return error;
+}
+
+static int am_coloured_vka_utspace_alloc(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                         seL4_Word *res)
+{
+    return am_coloured_vka_utspace_alloc_maybe_device(data, dest, type, size_bits, false, res);
+}
+
+static int am_coloured_vka_utspace_alloc_at(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                            uintptr_t paddr, seL4_Word *res)
+{
+    return allocman_vka_utspace_alloc_at(((struct allocman_coloured_vka *)data)->alloc, dest, type, size_bits, paddr,
+                                         res);
+}
+
+static void am_coloured_vka_utspace_free(void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
+{
+    allocman_vka_utspace_free(((struct allocman_coloured_vka *)data)->alloc, type, size_bits, target);
+}
+
+static uintptr_t am_coloured_vka_utspace_paddr(void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits)
+{
+    return allocman_vka_utspace_paddr(((struct allocman_coloured_vka *)data)->alloc, target, type, size_bits);
+}
+
+static int am_coloured_vka_cspace_alloc_n(void *data, size_t num, seL4_CPtr *res)
+{
+    return allocman_vka_cspace_alloc_n(((struct allocman_coloured_vka *)data)->alloc, num, res);
+}
+
+static void am_coloured_vka_cspace_free_n(void *data, size_t num, const seL4_CPtr *slots)
+{
+    allocman_vka_cspace_free_n(((struct allocman_coloured_vka *)data)->alloc, num, slots);
+}
+
+void allocman_make_coloured_vka(vka_t *vka, struct allocman_coloured_vka *coloured, allocman_t *alloc,
+                                seL4_Word colours)
+{
+    assert(vka);
+    assert(coloured);
+    assert(alloc);
+
+    coloured->alloc = alloc;
+    coloured->colours = colours;
+
+    vka->data = coloured;
+    vka->cspace_alloc = &am_coloured_vka_cspace_alloc;
+    vka->cspace_make_path = &am_coloured_vka_cspace_make_path;
+    vka->utspace_alloc = &am_coloured_vka_utspace_alloc;
+    vka->utspace_alloc_maybe_device = &am_coloured_vka_utspace_alloc_maybe_device;
+    vka->utspace_alloc_at = &am_coloured_vka_utspace_alloc_at;
+    vka->cspace_free = &am_coloured_vka_cspace_free;
+    vka->utspace_free = &am_coloured_vka_utspace_free;
+    vka->utspace_paddr = &am_coloured_vka_utspace_paddr;
+    vka->cspace_alloc_n = &am_coloured_vka_cspace_alloc_n;
+    vka->cspace_free_n = &am_coloured_vka_cspace_free_n;
+    /* a batch is carved from one untyped spanning every colour, so use the single object path */
+    vka->utspace_alloc_n = NULL;
+    vka->utspace_free_n = NULL;
+}
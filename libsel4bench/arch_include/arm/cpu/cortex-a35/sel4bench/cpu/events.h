@@ -7,8 +7,34 @@
  * Values from Cortex-A35 TRM. Table C2-3.
  */
 #pragma once
-#define SEL4BENCH_EVENT_BUS_ACCESS_LD         0x60
-#define SEL4BENCH_EVENT_BUS_ACCESS_ST         0x61
-#define SEL4BENCH_EVENT_BR_INDIRECT_SPEC      0x7A
-#define SEL4BENCH_EVENT_EXC_IRQ               0x86
-#define SEL4BENCH_EVENT_EXC_FIQ               0x87
+
+#define SEL4BENCH_EVENT_BUS_ACCESS_LD            0x60 /* Bus access, read */
+#define SEL4BENCH_EVENT_BUS_ACCESS_ST            0x61 /* Bus access, write */
+#define SEL4BENCH_EVENT_BR_INDIRECT_SPEC         0x7A /* Branch speculatively executed, indirect branch */
+#define SEL4BENCH_EVENT_EXC_IRQ                  0x86 /* Exception taken, IRQ */
+#define SEL4BENCH_EVENT_EXC_FIQ                  0x87 /* Exception taken, FIQ */
+#define SEL4BENCH_EVENT_EXT_MEM_REQ              0xC0 /* External memory request */
+#define SEL4BENCH_EVENT_EXT_MEM_REQ_NC           0xC1 /* Non-cacheable external memory request */
+#define SEL4BENCH_EVENT_PREFETCH_LINEFILL        0xC2 /* Linefill because of prefetch */
+#define SEL4BENCH_EVENT_PREFETCH_LINEFILL_DROP   0xC3 /* Instruction cache throttle */
+#define SEL4BENCH_EVENT_READ_ALLOC_ENTER         0xC4 /* Entering read allocate mode */
+#define SEL4BENCH_EVENT_READ_ALLOC               0xC5 /* Read allocate mode */
+#define SEL4BENCH_EVENT_PRE_DECODE_ERR           0xC6 /* Pre-decode error */
+#define SEL4BENCH_EVENT_STALL_SB_FULL            0xC7 /* Data write operation that stalls the pipeline because the store buffer is full */
+#define SEL4BENCH_EVENT_EXT_SNOOP                0xC8 /* SCU snooped data from another CPU for this CPU */
+#define SEL4BENCH_EVENT_BR_COND                  0xC9 /* Conditional branch executed */
+#define SEL4BENCH_EVENT_BR_INDIRECT_MISPRED      0xCA /* Indirect branch mispredicted */
+#define SEL4BENCH_EVENT_BR_INDIRECT_MISPRED_ADDR 0xCB /* Indirect branch mispredicted because of address miscompare */
+#define SEL4BENCH_EVENT_BR_COND_MISPRED          0xCC /* Conditional branch mispredicted */
+#define SEL4BENCH_EVENT_L1I_CACHE_ERR            0xD0 /* Level 1 instruction cache memory error */
+#define SEL4BENCH_EVENT_L1D_CACHE_ERR            0xD1 /* Level 1 data cache memory error */
+#define SEL4BENCH_EVENT_TLB_ERR                  0xD2 /* TLB memory error */
+#define SEL4BENCH_EVENT_OTHER_IQ_DEP_STALL       0xE0 /* Cycles the DPU IQ is empty and not because of an instruction cache miss, micro-TLB miss or pre-decode error */
+#define SEL4BENCH_EVENT_IC_DEP_STALL             0xE1 /* Cycles the DPU IQ is empty because of an instruction cache miss */
+#define SEL4BENCH_EVENT_IUTLB_DEP_STALL          0xE2 /* Cycles the DPU IQ is empty because of an instruction micro-TLB miss */
+#define SEL4BENCH_EVENT_DECODE_DEP_STALL         0xE3 /* Cycles the DPU IQ is empty because of a pre-decode error */
+#define SEL4BENCH_EVENT_OTHER_INTERLOCK_STALL    0xE4 /* Cycles there is an interlock other than for Advanced SIMD, floating-point, load or store */
+#define SEL4BENCH_EVENT_AGU_DEP_STALL            0xE5 /* Cycles there is an interlock for a load or store address generation */
+#define SEL4BENCH_EVENT_SIMD_DEP_STALL           0xE6 /* Cycles there is an interlock for an Advanced SIMD or floating-point instruction */
+#define SEL4BENCH_EVENT_LD_DEP_STALL             0xE7 /* Cycles the pipeline is stalled on a load that missed the level 1 data cache */
+#define SEL4BENCH_EVENT_ST_DEP_STALL             0xE8 /* Cycles the pipeline is stalled on a store */
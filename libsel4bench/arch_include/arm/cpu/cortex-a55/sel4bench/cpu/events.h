@@ -19,8 +19,67 @@
 // release incorporating BRBE, ETE, and TRBE"). See section D11.11.2 "The PMU
 // event number space and common events"
 
-#define SEL4BENCH_EVENT_BUS_ACCESS_LD         0x60 /* BUS_ACCESS_RD */
-#define SEL4BENCH_EVENT_BUS_ACCESS_ST         0x61 /* BUS_ACCESS_WR */
-#define SEL4BENCH_EVENT_BR_INDIRECT_SPEC      0x7A
-#define SEL4BENCH_EVENT_EXC_IRQ               0x86
-#define SEL4BENCH_EVENT_EXC_FIQ               0x87
+#define SEL4BENCH_EVENT_REMOTE_ACCESS             0x31 /* Access to another socket in a multi-socket system */
+#define SEL4BENCH_EVENT_DTLB_WALK                 0x34 /* Access to data TLB that caused a page table walk */
+#define SEL4BENCH_EVENT_ITLB_WALK                 0x35 /* Access to instruction TLB that caused a page table walk */
+#define SEL4BENCH_EVENT_LL_CACHE_RD               0x36 /* Last level cache access, read */
+#define SEL4BENCH_EVENT_LL_CACHE_MISS_RD          0x37 /* Last level cache miss, read */
+#define SEL4BENCH_EVENT_L1D_CACHE_LD              0x40 /* Level 1 data cache access, read */
+#define SEL4BENCH_EVENT_L1D_CACHE_ST              0x41 /* Level 1 data cache access, write */
+#define SEL4BENCH_EVENT_L1D_CACHE_REFILL_LD       0x42 /* Level 1 data cache refill, read */
+#define SEL4BENCH_EVENT_L1D_CACHE_REFILL_INNER    0x44 /* Level 1 data cache refill, inner */
+#define SEL4BENCH_EVENT_L1D_CACHE_REFILL_OUTER    0x45 /* Level 1 data cache refill, outer */
+#define SEL4BENCH_EVENT_L2D_CACHE_LD              0x50 /* Level 2 data cache access, read */
+#define SEL4BENCH_EVENT_L2D_CACHE_ST              0x51 /* Level 2 data cache access, write */
+#define SEL4BENCH_EVENT_L2D_CACHE_REFILL_LD       0x52 /* Level 2 data cache refill, read */
+#define SEL4BENCH_EVENT_BUS_ACCESS_LD             0x60 /* Bus access, read */
+#define SEL4BENCH_EVENT_BUS_ACCESS_ST             0x61 /* Bus access, write */
+#define SEL4BENCH_EVENT_MEM_ACCESS_LD             0x66 /* Data memory access, read */
+#define SEL4BENCH_EVENT_MEM_ACCESS_ST             0x67 /* Data memory access, write */
+#define SEL4BENCH_EVENT_LD_SPEC                   0x70 /* Instruction speculatively executed, load */
+#define SEL4BENCH_EVENT_ST_SPEC                   0x71 /* Instruction speculatively executed, store */
+#define SEL4BENCH_EVENT_DP_SPEC                   0x73 /* Instruction speculatively executed, integer data processing */
+#define SEL4BENCH_EVENT_ASE_SPEC                  0x74 /* Instruction speculatively executed, Advanced SIMD */
+#define SEL4BENCH_EVENT_VFP_SPEC                  0x75 /* Instruction speculatively executed, floating-point */
+#define SEL4BENCH_EVENT_CRYPTO_SPEC               0x77 /* Instruction speculatively executed, Cryptographic instruction */
+#define SEL4BENCH_EVENT_BR_IMMED_SPEC             0x78 /* Branch speculatively executed, immediate branch */
+#define SEL4BENCH_EVENT_BR_RETURN_SPEC            0x79 /* Branch speculatively executed, procedure return */
+#define SEL4BENCH_EVENT_BR_INDIRECT_SPEC          0x7A /* Branch speculatively executed, indirect branch */
+#define SEL4BENCH_EVENT_EXC_IRQ                   0x86 /* Exception taken, IRQ */
+#define SEL4BENCH_EVENT_EXC_FIQ                   0x87 /* Exception taken, FIQ */
+#define SEL4BENCH_EVENT_L3D_CACHE_LD              0xA0 /* Level 3 data cache access, read */
+#define SEL4BENCH_EVENT_L3D_CACHE_REFILL_LD       0xA2 /* Level 3 data cache refill, read */
+#define SEL4BENCH_EVENT_L3D_CACHE_REFILL_PREFETCH 0xC0 /* Level 3 data cache refill started due to prefetch */
+#define SEL4BENCH_EVENT_L2D_CACHE_REFILL_PREFETCH 0xC1 /* Level 2 data cache refill started due to prefetch */
+#define SEL4BENCH_EVENT_L1D_CACHE_REFILL_PREFETCH 0xC2 /* Level 1 data cache refill started due to prefetch */
+#define SEL4BENCH_EVENT_L2D_WS_MODE               0xC3 /* Level 2 data cache write streaming mode */
+#define SEL4BENCH_EVENT_L1D_WS_MODE_ENTRY         0xC4 /* Level 1 data cache entering write streaming mode */
+#define SEL4BENCH_EVENT_L1D_WS_MODE               0xC5 /* Level 1 data cache write streaming mode */
+#define SEL4BENCH_EVENT_L3D_WS_MODE               0xC7 /* Level 3 data cache write streaming mode */
+#define SEL4BENCH_EVENT_LL_WS_MODE                0xC8 /* Last level cache write streaming mode */
+#define SEL4BENCH_EVENT_BR_COND_PRED              0xC9 /* Predicted conditional branch executed */
+#define SEL4BENCH_EVENT_BR_INDIRECT_MISPRED       0xCA /* Indirect branch mispredicted */
+#define SEL4BENCH_EVENT_BR_INDIRECT_ADDR_MISPRED  0xCB /* Indirect branch mispredicted because of address miscompare */
+#define SEL4BENCH_EVENT_BR_COND_MISPRED           0xCC /* Conditional branch mispredicted */
+#define SEL4BENCH_EVENT_BR_INDIRECT_ADDR_PRED     0xCD /* Indirect branch with predicted address executed */
+#define SEL4BENCH_EVENT_BR_RETURN_ADDR_PRED       0xCE /* Procedure return with predicted address executed */
+#define SEL4BENCH_EVENT_BR_RETURN_ADDR_MISPRED    0xCF /* Procedure return mispredicted because of address miscompare */
+#define SEL4BENCH_EVENT_L2D_LLWALK_TLB            0xD0 /* Level 2 TLB last-level walk cache access */
+#define SEL4BENCH_EVENT_L2D_LLWALK_TLB_REFILL     0xD1 /* Level 2 TLB last-level walk cache refill */
+#define SEL4BENCH_EVENT_L2D_L2WALK_TLB            0xD2 /* Level 2 TLB level-2 walk cache access */
+#define SEL4BENCH_EVENT_L2D_L2WALK_TLB_REFILL     0xD3 /* Level 2 TLB level-2 walk cache refill */
+#define SEL4BENCH_EVENT_L2D_S2_TLB                0xD4 /* Level 2 TLB IPA cache access */
+#define SEL4BENCH_EVENT_L2D_S2_TLB_REFILL         0xD5 /* Level 2 TLB IPA cache refill */
+#define SEL4BENCH_EVENT_L2D_CACHE_STASH_DROPPED   0xD6 /* Level 2 data cache stash dropped */
+#define SEL4BENCH_EVENT_STALL_FRONTEND_CACHE      0xE1 /* No operation issued because of the frontend, cache miss */
+#define SEL4BENCH_EVENT_STALL_FRONTEND_TLB        0xE2 /* No operation issued because of the frontend, TLB miss */
+#define SEL4BENCH_EVENT_STALL_FRONTEND_PDERR      0xE3 /* No operation issued because of the frontend, pre-decode error */
+#define SEL4BENCH_EVENT_STALL_BACKEND_ILOCK       0xE4 /* No operation issued because of the backend, interlock */
+#define SEL4BENCH_EVENT_STALL_BACKEND_ILOCK_AGU   0xE5 /* No operation issued because of the backend, interlock, AGU */
+#define SEL4BENCH_EVENT_STALL_BACKEND_ILOCK_FPU   0xE6 /* No operation issued because of the backend, interlock, FPU */
+#define SEL4BENCH_EVENT_STALL_BACKEND_LD          0xE7 /* No operation issued because of the backend, load */
+#define SEL4BENCH_EVENT_STALL_BACKEND_ST          0xE8 /* No operation issued because of the backend, store */
+#define SEL4BENCH_EVENT_STALL_BACKEND_LD_CACHE    0xE9 /* No operation issued because of the backend, load, cache miss */
+#define SEL4BENCH_EVENT_STALL_BACKEND_LD_TLB      0xEA /* No operation issued because of the backend, load, TLB miss */
+#define SEL4BENCH_EVENT_STALL_BACKEND_ST_STB      0xEB /* No operation issued because of the backend, store, STB full */
+#define SEL4BENCH_EVENT_STALL_BACKEND_ST_TLB      0xEC /* No operation issued because of the backend, store, TLB miss */
@@ -17,10 +17,62 @@
 // "Initial Armv8.7 EAC release"). See section K3.1 "Arm recommendations for
 // IMPLEMENTATION DEFINED event numbers"
 
-#define SEL4BENCH_EVENT_BUS_ACCESS_LD         0x60
-#define SEL4BENCH_EVENT_BUS_ACCESS_ST         0x61
-
-#define SEL4BENCH_EVENT_BR_INDIRECT_SPEC      0x7A
-
-#define SEL4BENCH_EVENT_EXC_IRQ               0x86
-#define SEL4BENCH_EVENT_EXC_FIQ               0x87
+#define SEL4BENCH_EVENT_L1D_CACHE_LD          0x40 /* Level 1 data cache access, read */
+#define SEL4BENCH_EVENT_L1D_CACHE_ST          0x41 /* Level 1 data cache access, write */
+#define SEL4BENCH_EVENT_L1D_CACHE_REFILL_LD   0x42 /* Level 1 data cache refill, read */
+#define SEL4BENCH_EVENT_L1D_CACHE_REFILL_ST   0x43 /* Level 1 data cache refill, write */
+#define SEL4BENCH_EVENT_L1D_CACHE_WB_VICTIM   0x46 /* Level 1 data cache write-back, victim */
+#define SEL4BENCH_EVENT_L1D_CACHE_WB_CLEAN    0x47 /* Level 1 data cache write-back, cleaning and coherency */
+#define SEL4BENCH_EVENT_L1D_CACHE_INVAL       0x48 /* Level 1 data cache invalidate */
+#define SEL4BENCH_EVENT_L1D_TLB_REFILL_LD     0x4C /* Level 1 data TLB refill, read */
+#define SEL4BENCH_EVENT_L1D_TLB_REFILL_ST     0x4D /* Level 1 data TLB refill, write */
+#define SEL4BENCH_EVENT_L2D_CACHE_LD          0x50 /* Level 2 data cache access, read */
+#define SEL4BENCH_EVENT_L2D_CACHE_ST          0x51 /* Level 2 data cache access, write */
+#define SEL4BENCH_EVENT_L2D_CACHE_REFILL_LD   0x52 /* Level 2 data cache refill, read */
+#define SEL4BENCH_EVENT_L2D_CACHE_REFILL_ST   0x53 /* Level 2 data cache refill, write */
+#define SEL4BENCH_EVENT_L2D_CACHE_WB_VICTIM   0x56 /* Level 2 data cache write-back, victim */
+#define SEL4BENCH_EVENT_L2D_CACHE_WB_CLEAN    0x57 /* Level 2 data cache write-back, cleaning and coherency */
+#define SEL4BENCH_EVENT_L2D_CACHE_INVAL       0x58 /* Level 2 data cache invalidate */
+#define SEL4BENCH_EVENT_BUS_ACCESS_LD         0x60 /* Bus access, read */
+#define SEL4BENCH_EVENT_BUS_ACCESS_ST         0x61 /* Bus access, write */
+#define SEL4BENCH_EVENT_BUS_ACCESS_SHARED     0x62 /* Bus access, Normal, Cacheable, Shareable */
+#define SEL4BENCH_EVENT_BUS_ACCESS_NOT_SHARED 0x63 /* Bus access, not Normal, Cacheable, Shareable */
+#define SEL4BENCH_EVENT_BUS_ACCESS_NORMAL     0x64 /* Bus access, normal */
+#define SEL4BENCH_EVENT_BUS_ACCESS_PERIPH     0x65 /* Bus access, peripheral */
+#define SEL4BENCH_EVENT_MEM_ACCESS_LD         0x66 /* Data memory access, read */
+#define SEL4BENCH_EVENT_MEM_ACCESS_ST         0x67 /* Data memory access, write */
+#define SEL4BENCH_EVENT_UNALIGNED_LD_SPEC     0x68 /* Unaligned access, read */
+#define SEL4BENCH_EVENT_UNALIGNED_ST_SPEC     0x69 /* Unaligned access, write */
+#define SEL4BENCH_EVENT_UNALIGNED_LDST_SPEC   0x6A /* Unaligned access */
+#define SEL4BENCH_EVENT_LDREX_SPEC            0x6C /* Exclusive instruction speculatively executed, LDREX */
+#define SEL4BENCH_EVENT_STREX_PASS_SPEC       0x6D /* Exclusive instruction speculatively executed, STREX pass */
+#define SEL4BENCH_EVENT_STREX_FAIL_SPEC       0x6E /* Exclusive instruction speculatively executed, STREX fail */
+#define SEL4BENCH_EVENT_LD_SPEC               0x70 /* Instruction speculatively executed, load */
+#define SEL4BENCH_EVENT_ST_SPEC               0x71 /* Instruction speculatively executed, store */
+#define SEL4BENCH_EVENT_LDST_SPEC             0x72 /* Instruction speculatively executed, load or store */
+#define SEL4BENCH_EVENT_DP_SPEC               0x73 /* Instruction speculatively executed, integer data processing */
+#define SEL4BENCH_EVENT_ASE_SPEC              0x74 /* Instruction speculatively executed, Advanced SIMD Extension */
+#define SEL4BENCH_EVENT_VFP_SPEC              0x75 /* Instruction speculatively executed, Floating-point Extension */
+#define SEL4BENCH_EVENT_PC_WRITE_SPEC         0x76 /* Instruction speculatively executed, software change of the PC */
+#define SEL4BENCH_EVENT_CRYPTO_SPEC           0x77 /* Instruction speculatively executed, Cryptographic instruction */
+#define SEL4BENCH_EVENT_BR_IMMED_SPEC         0x78 /* Branch speculatively executed, immediate branch */
+#define SEL4BENCH_EVENT_BR_RETURN_SPEC        0x79 /* Branch speculatively executed, procedure return */
+#define SEL4BENCH_EVENT_BR_INDIRECT_SPEC      0x7A /* Branch speculatively executed, indirect branch */
+#define SEL4BENCH_EVENT_ISB_SPEC              0x7C /* Barrier speculatively executed, ISB */
+#define SEL4BENCH_EVENT_DSB_SPEC              0x7D /* Barrier speculatively executed, DSB */
+#define SEL4BENCH_EVENT_DMB_SPEC              0x7E /* Barrier speculatively executed, DMB */
+#define SEL4BENCH_EVENT_EXC_UNDEF             0x81 /* Exception taken, other synchronous */
+#define SEL4BENCH_EVENT_EXC_SVC               0x82 /* Exception taken, Supervisor Call */
+#define SEL4BENCH_EVENT_EXC_PABORT            0x83 /* Exception taken, Instruction Abort */
+#define SEL4BENCH_EVENT_EXC_DABORT            0x84 /* Exception taken, Data Abort or SError */
+#define SEL4BENCH_EVENT_EXC_IRQ               0x86 /* Exception taken, IRQ */
+#define SEL4BENCH_EVENT_EXC_FIQ               0x87 /* Exception taken, FIQ */
+#define SEL4BENCH_EVENT_EXC_SMC               0x88 /* Exception taken, Secure Monitor Call */
+#define SEL4BENCH_EVENT_EXC_HVC               0x8A /* Exception taken, Hypervisor Call */
+#define SEL4BENCH_EVENT_EXC_TRAP_PABORT       0x8B /* Exception taken, Instruction Abort not taken locally */
+#define SEL4BENCH_EVENT_EXC_TRAP_DABORT       0x8C /* Exception taken, Data Abort or SError not taken locally */
+#define SEL4BENCH_EVENT_EXC_TRAP_OTHER        0x8D /* Exception taken, other traps not taken locally */
+#define SEL4BENCH_EVENT_EXC_TRAP_IRQ          0x8E /* Exception taken, IRQ not taken locally */
+#define SEL4BENCH_EVENT_EXC_TRAP_FIQ          0x8F /* Exception taken, FIQ not taken locally */
+#define SEL4BENCH_EVENT_RC_LD_SPEC            0x90 /* Release consistency instruction speculatively executed, load-acquire */
+#define SEL4BENCH_EVENT_RC_ST_SPEC            0x91 /* Release consistency instruction speculatively executed, store-release */
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <autoconf.h>
+#include <sel4bench/gen_config.h>
+
+/* Events are the event_idx of the SBI PMU extension, which the SBI implementation
+ * maps to the mhpmevent encoding of the platform: a type in bits [19:16] and a code
+ * in bits [15:0]. Events that the SBI implementation does not know can be given
+ * raw, in which case they are written to mhpmevent as is. */
+#define SEL4BENCH_RISCV_SBI_EVENT(type, code) (((type) << 16) | (code))
+
+#define SEL4BENCH_RISCV_SBI_EVENT_TYPE_HW       0
+#define SEL4BENCH_RISCV_SBI_EVENT_TYPE_CACHE    1
+#define SEL4BENCH_RISCV_SBI_EVENT_TYPE_RAW      2
+
+#define SEL4BENCH_RISCV_HW_EVENT(code) \
+    SEL4BENCH_RISCV_SBI_EVENT(SEL4BENCH_RISCV_SBI_EVENT_TYPE_HW, code)
+
+/* cache events are an operation on a cache and whether it was an access or a miss */
+#define SEL4BENCH_RISCV_CACHE_L1D   0
+#define SEL4BENCH_RISCV_CACHE_L1I   1
+#define SEL4BENCH_RISCV_CACHE_LL    2
+#define SEL4BENCH_RISCV_CACHE_DTLB  3
+#define SEL4BENCH_RISCV_CACHE_ITLB  4
+#define SEL4BENCH_RISCV_CACHE_BPU   5
+
+#define SEL4BENCH_RISCV_CACHE_OP_READ      0
+#define SEL4BENCH_RISCV_CACHE_OP_WRITE     1
+#define SEL4BENCH_RISCV_CACHE_OP_PREFETCH  2
+
+#define SEL4BENCH_RISCV_CACHE_RESULT_ACCESS  0
+#define SEL4BENCH_RISCV_CACHE_RESULT_MISS    1
+
+#define SEL4BENCH_RISCV_CACHE_EVENT(cache, op, result) \
+    SEL4BENCH_RISCV_SBI_EVENT(SEL4BENCH_RISCV_SBI_EVENT_TYPE_CACHE, \
+                              ((SEL4BENCH_RISCV_CACHE_##cache) << 3) | \
+                              ((SEL4BENCH_RISCV_CACHE_OP_##op) << 1) | \
+                              (SEL4BENCH_RISCV_CACHE_RESULT_##result))
+
+/* A platform specific mhpmevent value. The top bit of the event id marks it as raw,
+ * so raw values are limited to the bits below it. */
+#define SEL4BENCH_RISCV_RAW_EVENT_FLAG  (1ul << (sizeof(unsigned long) * 8 - 1))
+#define SEL4BENCH_RISCV_RAW_EVENT(value) (SEL4BENCH_RISCV_RAW_EVENT_FLAG | (value))
+
+#ifdef CONFIG_SEL4BENCH_RISCV_SBI_PMU
+/* generic events */
+#define SEL4BENCH_EVENT_CACHE_L1I_MISS          SEL4BENCH_RISCV_CACHE_EVENT(L1I, READ, MISS)
+#define SEL4BENCH_EVENT_CACHE_L1D_MISS          SEL4BENCH_RISCV_CACHE_EVENT(L1D, READ, MISS)
+#define SEL4BENCH_EVENT_TLB_L1I_MISS            SEL4BENCH_RISCV_CACHE_EVENT(ITLB, READ, MISS)
+#define SEL4BENCH_EVENT_TLB_L1D_MISS            SEL4BENCH_RISCV_CACHE_EVENT(DTLB, READ, MISS)
+#define SEL4BENCH_EVENT_EXECUTE_INSTRUCTION     SEL4BENCH_RISCV_HW_EVENT(2)
+#define SEL4BENCH_EVENT_BRANCH_MISPREDICT       SEL4BENCH_RISCV_HW_EVENT(6)
+/* SBI has no event for all data accesses, this is loads only */
+#define SEL4BENCH_EVENT_MEMORY_ACCESS           SEL4BENCH_RISCV_CACHE_EVENT(L1D, READ, ACCESS)
+
+/* further hardware events */
+#define SEL4BENCH_EVENT_CPU_CYCLES              SEL4BENCH_RISCV_HW_EVENT(1)
+#define SEL4BENCH_EVENT_CACHE_REFERENCES        SEL4BENCH_RISCV_HW_EVENT(3)
+#define SEL4BENCH_EVENT_CACHE_MISSES            SEL4BENCH_RISCV_HW_EVENT(4)
+#define SEL4BENCH_EVENT_BRANCH_INSTRUCTIONS     SEL4BENCH_RISCV_HW_EVENT(5)
+#define SEL4BENCH_EVENT_BUS_CYCLES              SEL4BENCH_RISCV_HW_EVENT(7)
+#define SEL4BENCH_EVENT_STALLED_CYCLES_FRONTEND SEL4BENCH_RISCV_HW_EVENT(8)
+#define SEL4BENCH_EVENT_STALLED_CYCLES_BACKEND  SEL4BENCH_RISCV_HW_EVENT(9)
+#define SEL4BENCH_EVENT_REF_CPU_CYCLES          SEL4BENCH_RISCV_HW_EVENT(10)
+
+/* further cache events */
+#define SEL4BENCH_EVENT_CACHE_L1I_ACCESS        SEL4BENCH_RISCV_CACHE_EVENT(L1I, READ, ACCESS)
+#define SEL4BENCH_EVENT_CACHE_L1D_WRITE         SEL4BENCH_RISCV_CACHE_EVENT(L1D, WRITE, ACCESS)
+#define SEL4BENCH_EVENT_CACHE_L1D_WRITE_MISS    SEL4BENCH_RISCV_CACHE_EVENT(L1D, WRITE, MISS)
+#define SEL4BENCH_EVENT_CACHE_LL_ACCESS         SEL4BENCH_RISCV_CACHE_EVENT(LL, READ, ACCESS)
+#define SEL4BENCH_EVENT_CACHE_LL_MISS           SEL4BENCH_RISCV_CACHE_EVENT(LL, READ, MISS)
+#define SEL4BENCH_EVENT_CACHE_LL_WRITE          SEL4BENCH_RISCV_CACHE_EVENT(LL, WRITE, ACCESS)
+#define SEL4BENCH_EVENT_CACHE_LL_WRITE_MISS     SEL4BENCH_RISCV_CACHE_EVENT(LL, WRITE, MISS)
+#define SEL4BENCH_EVENT_TLB_L1D_WRITE_MISS      SEL4BENCH_RISCV_CACHE_EVENT(DTLB, WRITE, MISS)
+#define SEL4BENCH_EVENT_BRANCH_PREDICTED        SEL4BENCH_RISCV_CACHE_EVENT(BPU, READ, ACCESS)
+#else
+/* Without the SBI, events are written to mhpmevent as they are, so the generic events are
+ * those of the FU540, see SiFive FU540 Manual Chapter 4.10 */
+#define SEL4BENCH_EVENT_EXECUTE_INSTRUCTION 0x3FFFF00
+#define SEL4BENCH_EVENT_CACHE_L1I_MISS      0x102
+#define SEL4BENCH_EVENT_CACHE_L1D_MISS      0x202
+#define SEL4BENCH_EVENT_TLB_L1I_MISS        0x802
+#define SEL4BENCH_EVENT_TLB_L1D_MISS        0x1002
+#define SEL4BENCH_EVENT_BRANCH_MISPREDICT   0x6001
+#define SEL4BENCH_EVENT_MEMORY_ACCESS       0x202
+#endif /* CONFIG_SEL4BENCH_RISCV_SBI_PMU */
+
+/* Check out SiFive FU540 Manual Chapter 4.10 for details.
+ * These are event selectors of the u54 cores, given as raw mhpmevent values.
+ */
+#define SEL4BENCH_FU540_EVENT_INSTRUCTION_RETIRED   SEL4BENCH_RISCV_RAW_EVENT(0x3FFFF00)
+#define SEL4BENCH_FU540_EVENT_CACHE_L1I_MISS        SEL4BENCH_RISCV_RAW_EVENT(0x102)
+#define SEL4BENCH_FU540_EVENT_CACHE_L1D_MISS        SEL4BENCH_RISCV_RAW_EVENT(0x202)
+#define SEL4BENCH_FU540_EVENT_TLB_L1I_MISS          SEL4BENCH_RISCV_RAW_EVENT(0x802)
+#define SEL4BENCH_FU540_EVENT_TLB_L1D_MISS          SEL4BENCH_RISCV_RAW_EVENT(0x1002)
+#define SEL4BENCH_FU540_EVENT_BRANCH_MISPREDICT     SEL4BENCH_RISCV_RAW_EVENT(0x6001)
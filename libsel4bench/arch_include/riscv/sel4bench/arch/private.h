@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <autoconf.h>
+#include <sel4bench/gen_config.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+#include <utils/util.h>
+
+//function attributes
+//ultra-short, time-sensitive functions
+#define FASTFN inline __attribute__((always_inline))
+
+//functions that will be passed to seL4_DebugRun() -- fast, but obviously not inlined
+#define KERNELFN __attribute__((noinline, flatten))
+
+#include "events.h"
+
+#ifdef CONFIG_SEL4BENCH_RISCV_SBI_PMU
+
+//hpmcounter3 is the first event counter, and counter 0 for sel4bench
+#define SEL4BENCH_RISCV_FIRST_HPM       3
+#define SEL4BENCH_RISCV_LAST_HPM        31
+#define SEL4BENCH_RISCV_MAX_COUNTERS    (SEL4BENCH_RISCV_LAST_HPM - SEL4BENCH_RISCV_FIRST_HPM + 1)
+#define SEL4BENCH_RISCV_CSR_HPMCOUNTER  0xC00
+
+//scounteren bits that give user mode the event counters
+#define SEL4BENCH_RISCV_SCOUNTEREN_HPM  0xFFFFFFF8ul
+
+//SBI extensions and functions
+#define SBI_EXT_BASE                    0x10
+#define SBI_EXT_BASE_PROBE_EXT          3
+#define SBI_EXT_PMU                     0x504D55
+#define SBI_EXT_PMU_NUM_COUNTERS        0
+#define SBI_EXT_PMU_COUNTER_GET_INFO    1
+#define SBI_EXT_PMU_COUNTER_CFG_MATCH   2
+#define SBI_EXT_PMU_COUNTER_START       3
+#define SBI_EXT_PMU_COUNTER_STOP        4
+
+//SBI PMU flags
+#define SBI_PMU_CFG_FLAG_CLEAR_VALUE    BIT(1)
+#define SBI_PMU_START_FLAG_SET_INIT     BIT(0)
+#define SBI_PMU_STOP_FLAG_RESET         BIT(0)
+
+//SBI PMU counter info
+#define SBI_PMU_INFO_CSR(info)          ((info) & MASK(12))
+#define SBI_PMU_INFO_FIRMWARE(info)     ((info) >> (sizeof(seL4_Word) * 8 - 1))
+
+typedef struct sel4bench_riscv_sbi_call {
+    seL4_Word eid;
+    seL4_Word fid;
+    seL4_Word args[5];
+    long error;
+    seL4_Word value;
+} sel4bench_riscv_sbi_call_t;
+
+#ifdef CONFIG_SEL4BENCH_RISCV_USER_PMC
+//enable user-level reads of the event counters
+static KERNELFN void sel4bench_private_enable_user_pmc(void *arg)
+{
+    asm volatile("csrs scounteren, %0" :: "r"(SEL4BENCH_RISCV_SCOUNTEREN_HPM));
+}
+
+//disable user-level reads of the event counters
+static KERNELFN void sel4bench_private_disable_user_pmc(void *arg)
+{
+    asm volatile("csrc scounteren, %0" :: "r"(SEL4BENCH_RISCV_SCOUNTEREN_HPM));
+}
+#endif
+
+//make an SBI call from supervisor mode; the event selectors are only writable from machine mode
+static KERNELFN void sel4bench_private_sbi_call(void *arg)
+{
+    sel4bench_riscv_sbi_call_t *call = arg;
+
+    register seL4_Word a0 asm("a0") = call->args[0];
+    register seL4_Word a1 asm("a1") = call->args[1];
+    register seL4_Word a2 asm("a2") = call->args[2];
+    register seL4_Word a3 asm("a3") = call->args[3];
+    register seL4_Word a4 asm("a4") = call->args[4];
+    /* upper half of the 64 bit arguments on 32 bit, which are always 0 here */
+    register seL4_Word a5 asm("a5") = 0;
+    register seL4_Word a6 asm("a6") = call->fid;
+    register seL4_Word a7 asm("a7") = call->eid;
+    asm volatile(
+        "ecall"
+        : "+r"(a0), "+r"(a1)
+        : "r"(a2), "r"(a3), "r"(a4), "r"(a5), "r"(a6), "r"(a7)
+        : "memory"
+    );
+    call->error = a0;
+    call->value = a1;
+}
+#endif /* CONFIG_SEL4BENCH_RISCV_SBI_PMU */
@@ -6,12 +6,27 @@
 #pragma once
 
 #include <autoconf.h>
+#include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <sel4bench/types.h>
+#include <sel4bench/arch/private.h>
 #include <sel4/sel4.h>
 #include <utils/util.h>
 
-#define FASTFN inline __attribute__((always_inline))
+/* The event counters are hpmcounter3..31, and counter n of sel4bench is hpmcounter(n + 3).
+ *
+ * They are read directly once the kernel has enabled them in scounteren, but the event
+ * selectors, mhpmevent3..31, can only be written from machine mode. With
+ * CONFIG_SEL4BENCH_RISCV_SBI_PMU they are programmed through the SBI PMU extension, with
+ * the SBI calls made from the kernel, and the SBI implementation maps the SBI events of
+ * events.h to the encoding of the platform. sel4bench_init() then counts the counters that
+ * the SBI implementation has, up to the first one that is missing or not a hardware counter.
+ *
+ * Otherwise sel4bench_init() does nothing, the FU540's two counters are the only ones
+ * known, and their events are written to mhpmevent directly, which only works where
+ * something has given user mode access to them.
+ */
 
 #if __riscv_xlen == 32
 #define SEL4BENCH_READ_CCNT(var) \
@@ -40,9 +55,9 @@
 #define SEL4BENCH_READ_PCNT(idx, var) \
     do { \
         uint32_t nH1, nL, nH2; \
-        asm volatile("csrr %0, hpmcounterh" #idx \
-                    "csrr %1, hpmcounter" #idx \
-                    "csrr %2, hpmcounterh" #idx \
+        asm volatile("csrr %0, hpmcounter" #idx "h\n" \
+                    "csrr %1, hpmcounter" #idx "\n" \
+                    "csrr %2, hpmcounter" #idx "h\n" \
                     : "=r"(nH1), "=r"(nL), "=r"(nH2)); \
         if (nH1 < nH2) { \
             asm volatile("csrr %0, hpmcounter" #idx : "=r"(nL)); \
@@ -55,21 +70,247 @@
     asm volatile("csrr %0, hpmcounter" #idx : "=r"(var));
 #endif
 
-/* Check out SiFive FU540 Manual Chapter 4.10 for details
- * These settings are platform specific, however, they
- * might become part of the RISCV spec in the future.
- */
-#define SEL4BENCH_EVENT_EXECUTE_INSTRUCTION 0x3FFFF00
-#define SEL4BENCH_EVENT_CACHE_L1I_MISS      0x102
-#define SEL4BENCH_EVENT_CACHE_L1D_MISS      0x202
-#define SEL4BENCH_EVENT_TLB_L1I_MISS        0x802
-#define SEL4BENCH_EVENT_TLB_L1D_MISS        0x1002
-#define SEL4BENCH_EVENT_BRANCH_MISPREDICT   0x6001
-#define SEL4BENCH_EVENT_MEMORY_ACCESS       0x202
+#define SEL4BENCH_READ_PCNT_CASE(idx, var) \
+    case (idx) - SEL4BENCH_RISCV_FIRST_HPM: \
+        SEL4BENCH_READ_PCNT(idx, var); \
+        break
 
 #define CCNT_FORMAT "%"PRIu64
 typedef uint64_t ccnt_t;
 
+static FASTFN ccnt_t sel4bench_get_cycle_count()
+{
+    ccnt_t val;
+
+    SEL4BENCH_READ_CCNT(val);
+
+    return val;
+}
+
+#ifdef CONFIG_SEL4BENCH_RISCV_SBI_PMU
+/* Found by sel4bench_init(), and the counters with an event set and those counting */
+extern seL4_Word sel4bench_riscv_num_counters;
+extern counter_bitfield_t sel4bench_riscv_configured_counters;
+extern counter_bitfield_t sel4bench_riscv_running_counters;
+
+/* Silence warnings about including the following functions when seL4_DebugRun
+ * is not enabled when we are not calling them. If we actually call these
+ * functions without seL4_DebugRun enabled, we'll get a link failure, so this
+ * should be OK.
+ */
+void seL4_DebugRun(void (* userfn)(void *), void *userarg);
+
+static inline long sel4bench_riscv_sbi_pmu(seL4_Word fid, seL4_Word arg0, seL4_Word arg1, seL4_Word arg2,
+                                           seL4_Word arg3, seL4_Word arg4, seL4_Word *value)
+{
+    sel4bench_riscv_sbi_call_t call = {
+        .eid = SBI_EXT_PMU,
+        .fid = fid,
+        .args = { arg0, arg1, arg2, arg3, arg4 },
+    };
+
+    seL4_DebugRun(&sel4bench_private_sbi_call, &call);
+    if (value != NULL) {
+        *value = call.value;
+    }
+    return call.error;
+}
+
+static inline bool sel4bench_riscv_has_sbi_pmu(void)
+{
+    sel4bench_riscv_sbi_call_t call = {
+        .eid = SBI_EXT_BASE,
+        .fid = SBI_EXT_BASE_PROBE_EXT,
+        .args = { SBI_EXT_PMU },
+    };
+
+    seL4_DebugRun(&sel4bench_private_sbi_call, &call);
+    return call.error == 0 && call.value != 0;
+}
+
+static inline void sel4bench_init()
+{
+    seL4_Word num_sbi_counters;
+    seL4_Word info;
+
+    sel4bench_riscv_num_counters = 0;
+    sel4bench_riscv_configured_counters = 0;
+    sel4bench_riscv_running_counters = 0;
+
+    //enable user-mode reads of the event counters
+#ifdef CONFIG_SEL4BENCH_RISCV_USER_PMC
+    seL4_DebugRun(&sel4bench_private_enable_user_pmc, NULL);
+#endif
+
+    if (!sel4bench_riscv_has_sbi_pmu()) {
+        return;
+    }
+    if (sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_NUM_COUNTERS, 0, 0, 0, 0, 0, &num_sbi_counters) != 0) {
+        return;
+    }
+
+    for (seL4_Word idx = SEL4BENCH_RISCV_FIRST_HPM;
+         idx < num_sbi_counters && idx <= SEL4BENCH_RISCV_LAST_HPM; idx++) {
+        if (sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_GET_INFO, idx, 0, 0, 0, 0, &info) != 0 ||
+            SBI_PMU_INFO_FIRMWARE(info) ||
+            SBI_PMU_INFO_CSR(info) != SEL4BENCH_RISCV_CSR_HPMCOUNTER + idx) {
+            break;
+        }
+        sel4bench_riscv_num_counters++;
+    }
+}
+
+static inline void sel4bench_destroy()
+{
+    //stop all performance counters and release their events
+    if (sel4bench_riscv_configured_counters != 0) {
+        sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_STOP, SEL4BENCH_RISCV_FIRST_HPM,
+                                sel4bench_riscv_configured_counters, SBI_PMU_STOP_FLAG_RESET, 0, 0, NULL);
+    }
+    sel4bench_riscv_configured_counters = 0;
+    sel4bench_riscv_running_counters = 0;
+
+    //disable user-mode event counter access
+#ifdef CONFIG_SEL4BENCH_RISCV_USER_PMC
+    seL4_DebugRun(&sel4bench_private_disable_user_pmc, NULL);
+#endif
+}
+
+static FASTFN seL4_Word sel4bench_get_num_counters()
+{
+    return sel4bench_riscv_num_counters;
+}
+
+/* Being declared FASTFN allows this function (once inlined) to cache miss; I
+ * think it's worthwhile in the general case, for performance reasons.
+ * moreover, it's small enough that it'll be suitably aligned most of the time
+ */
+static FASTFN ccnt_t sel4bench_get_counter(counter_t counter)
+{
+    ccnt_t val;
+
+    switch (counter) {
+        SEL4BENCH_READ_PCNT_CASE(3, val);
+        SEL4BENCH_READ_PCNT_CASE(4, val);
+        SEL4BENCH_READ_PCNT_CASE(5, val);
+        SEL4BENCH_READ_PCNT_CASE(6, val);
+        SEL4BENCH_READ_PCNT_CASE(7, val);
+        SEL4BENCH_READ_PCNT_CASE(8, val);
+        SEL4BENCH_READ_PCNT_CASE(9, val);
+        SEL4BENCH_READ_PCNT_CASE(10, val);
+        SEL4BENCH_READ_PCNT_CASE(11, val);
+        SEL4BENCH_READ_PCNT_CASE(12, val);
+        SEL4BENCH_READ_PCNT_CASE(13, val);
+        SEL4BENCH_READ_PCNT_CASE(14, val);
+        SEL4BENCH_READ_PCNT_CASE(15, val);
+        SEL4BENCH_READ_PCNT_CASE(16, val);
+        SEL4BENCH_READ_PCNT_CASE(17, val);
+        SEL4BENCH_READ_PCNT_CASE(18, val);
+        SEL4BENCH_READ_PCNT_CASE(19, val);
+        SEL4BENCH_READ_PCNT_CASE(20, val);
+        SEL4BENCH_READ_PCNT_CASE(21, val);
+        SEL4BENCH_READ_PCNT_CASE(22, val);
+        SEL4BENCH_READ_PCNT_CASE(23, val);
+        SEL4BENCH_READ_PCNT_CASE(24, val);
+        SEL4BENCH_READ_PCNT_CASE(25, val);
+        SEL4BENCH_READ_PCNT_CASE(26, val);
+        SEL4BENCH_READ_PCNT_CASE(27, val);
+        SEL4BENCH_READ_PCNT_CASE(28, val);
+        SEL4BENCH_READ_PCNT_CASE(29, val);
+        SEL4BENCH_READ_PCNT_CASE(30, val);
+        SEL4BENCH_READ_PCNT_CASE(31, val);
+    default:
+        val = 0;
+        break;
+    }
+
+    return val;
+}
+
+/* The counter is stopped, and starts again from 0 with sel4bench_start_counters() */
+static inline void sel4bench_set_count_event(counter_t counter, event_id_t event)
+{
+    counter_bitfield_t bit = BIT(counter);
+    seL4_Word event_idx = event;
+    seL4_Word event_data = 0;
+    seL4_Word chosen;
+
+    if (counter >= sel4bench_riscv_num_counters) {
+        return;
+    }
+
+    //release the event the counter had, so that the SBI implementation will choose it again
+    if (sel4bench_riscv_configured_counters & bit) {
+        sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_STOP, SEL4BENCH_RISCV_FIRST_HPM, bit,
+                                SBI_PMU_STOP_FLAG_RESET, 0, 0, NULL);
+        sel4bench_riscv_configured_counters &= ~bit;
+        sel4bench_riscv_running_counters &= ~bit;
+    }
+
+    if (event & SEL4BENCH_RISCV_RAW_EVENT_FLAG) {
+        event_idx = SEL4BENCH_RISCV_SBI_EVENT(SEL4BENCH_RISCV_SBI_EVENT_TYPE_RAW, 0);
+        event_data = event & ~SEL4BENCH_RISCV_RAW_EVENT_FLAG;
+    }
+
+    if (sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_CFG_MATCH, SEL4BENCH_RISCV_FIRST_HPM, bit,
+                                SBI_PMU_CFG_FLAG_CLEAR_VALUE, event_idx, event_data, &chosen) != 0) {
+        ZF_LOGE("Counter %lu can't count event %lx", (unsigned long) counter, (unsigned long) event);
+        return;
+    }
+    assert(chosen == SEL4BENCH_RISCV_FIRST_HPM + counter);
+    sel4bench_riscv_configured_counters |= bit;
+}
+
+/* Only counters with an event set can be started */
+static inline void sel4bench_start_counters(counter_bitfield_t mask)
+{
+    mask &= sel4bench_riscv_configured_counters & ~sel4bench_riscv_running_counters;
+    if (mask == 0) {
+        return;
+    }
+
+    if (sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_START, SEL4BENCH_RISCV_FIRST_HPM, mask,
+                                0, 0, 0, NULL) == 0) {
+        sel4bench_riscv_running_counters |= mask;
+    }
+}
+
+static inline void sel4bench_stop_counters(counter_bitfield_t mask)
+{
+    mask &= sel4bench_riscv_running_counters;
+    if (mask == 0) {
+        return;
+    }
+
+    sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_STOP, SEL4BENCH_RISCV_FIRST_HPM, mask, 0, 0, 0, NULL);
+    sel4bench_riscv_running_counters &= ~mask;
+}
+
+/* SBI only sets the value of a counter as it starts, so every counter is started from 0
+ * and those that weren't running are stopped again.
+ */
+static inline void sel4bench_reset_counters(void)
+{
+    counter_bitfield_t configured = sel4bench_riscv_configured_counters;
+    counter_bitfield_t running = sel4bench_riscv_running_counters;
+
+    if (configured == 0) {
+        return;
+    }
+
+    if (running != 0) {
+        sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_STOP, SEL4BENCH_RISCV_FIRST_HPM, running, 0, 0, 0, NULL);
+    }
+    sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_START, SEL4BENCH_RISCV_FIRST_HPM, configured,
+                            SBI_PMU_START_FLAG_SET_INIT, 0, 0, NULL);
+    if (configured & ~running) {
+        sel4bench_riscv_sbi_pmu(SBI_EXT_PMU_COUNTER_STOP, SEL4BENCH_RISCV_FIRST_HPM, configured & ~running,
+                                0, 0, 0, NULL);
+    }
+}
+
+#else /* !CONFIG_SEL4BENCH_RISCV_SBI_PMU */
+
 static FASTFN void sel4bench_init()
 {
     /* Nothing to do */
@@ -89,15 +330,6 @@ static FASTFN seL4_Word sel4bench_get_num_counters()
 #endif
 }
 
-static FASTFN ccnt_t sel4bench_get_cycle_count()
-{
-    ccnt_t val;
-
-    SEL4BENCH_READ_CCNT(val);
-
-    return val;
-}
-
 /* Being declared FASTFN allows this function (once inlined) to cache miss; I
  * think it's worthwhile in the general case, for performance reasons.
  * moreover, it's small enough that it'll be suitably aligned most of the time
@@ -122,24 +354,11 @@ static FASTFN ccnt_t sel4bench_get_counter(counter_t counter)
     return val;
 }
 
-static inline ccnt_t sel4bench_get_counters(counter_bitfield_t mask, ccnt_t *values)
-{
-    ccnt_t ccnt;
-    unsigned int counter = 0;
-
-    for (; mask != 0 ; mask >>= 1, counter++) {
-        if (mask & 1) {
-            values[counter] = sel4bench_get_counter(counter);
-        }
-    }
-
-    SEL4BENCH_READ_CCNT(ccnt);
-
-    return ccnt;
-}
-
 static FASTFN void sel4bench_set_count_event(counter_t counter, event_id_t event)
 {
+    /* there is no SBI to map events, so raw events are as good as any */
+    event &= ~SEL4BENCH_RISCV_RAW_EVENT_FLAG;
+
     /* Sifive U540 only supports two event counters */
     switch (counter) {
     case 0:
@@ -148,7 +367,7 @@ static FASTFN void sel4bench_set_count_event(counter_t counter, event_id_t event
 
         /* Reset and start the counter*/
 #if __riscv_xlen == 32
-        asm volatile("csrw mhpmcounterh3, 0");
+        asm volatile("csrw mhpmcounter3h, 0");
 #endif
         asm volatile("csrw mhpmcounter3, 0\n"
                      "csrw mhpmevent3, %0\n"
@@ -157,7 +376,7 @@ static FASTFN void sel4bench_set_count_event(counter_t counter, event_id_t event
     case 1:
         asm volatile("csrw mhpmevent4, 0");
 #if __riscv_xlen == 32
-        asm volatile("csrw mhpmcounterh4, 0");
+        asm volatile("csrw mhpmcounter4h, 0");
 #endif
         asm volatile("csrw mhpmcounter4, 0\n"
                      "csrw mhpmevent4, %0\n"
@@ -196,3 +415,21 @@ static FASTFN void sel4bench_reset_counters(void)
 {
     /* Nothing to do */
 }
+
+#endif /* CONFIG_SEL4BENCH_RISCV_SBI_PMU */
+
+static inline ccnt_t sel4bench_get_counters(counter_bitfield_t mask, ccnt_t *values)
+{
+    ccnt_t ccnt;
+    unsigned int counter = 0;
+
+    for (; mask != 0 ; mask >>= 1, counter++) {
+        if (mask & 1) {
+            values[counter] = sel4bench_get_counter(counter);
+        }
+    }
+
+    SEL4BENCH_READ_CCNT(ccnt);
+
+    return ccnt;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <autoconf.h>
+#include <sel4bench/sel4bench.h>
+
+/*
+ * Cycle counts comparable across cores.
+ *
+ * Each core's cycle counter starts at its own time, so a timestamp taken on
+ * one core means nothing on another. Calibration estimates the offset of
+ * each core's counter from core 0's by ping-ponging over shared memory
+ * between a reference thread on core 0 and a thread on each other core:
+ * the reference reads its counter, the remote replies with its own, and the
+ * reference reads its counter again. Taking the remote read to be halfway
+ * through the round trip, the offset is known to within half of it, and the
+ * shortest of several round trips is kept.
+ *
+ * The threads must each be pinned to their core, with
+ * sel4utils_set_sched_affinity or when they are configured, and must each
+ * have called sel4bench_init before calibrating, as that can reset the
+ * counter. The counters are assumed to run at the same rate, so calibrate
+ * again if they can drift, such as with frequency scaling.
+ */
+
+#define SEL4BENCH_GLOBAL_CYCLES_ROUNDS 64
+
+typedef struct sel4bench_global_cycles_sync {
+    /* core being calibrated, 0 when none is */
+    volatile seL4_Word core;
+    volatile seL4_Word state;
+    volatile ccnt_t remote;
+} sel4bench_global_cycles_sync_t;
+
+/* Offset of each core's counter from core 0's, and its error bound */
+extern ccnt_t sel4bench_core_offsets[CONFIG_MAX_NUM_NODES];
+extern ccnt_t sel4bench_core_offset_errors[CONFIG_MAX_NUM_NODES];
+/* core the calling thread calibrated on */
+extern __thread seL4_Word sel4bench_global_cycles_core;
+
+/**
+ * Initialise the memory the threads calibrate through.
+ */
+void sel4bench_global_cycles_sync_init(sel4bench_global_cycles_sync_t *sync);
+
+/**
+ * Calibrate the counters of cores 1 to n_cores - 1 against this one, which is
+ * core 0. Returns once every remote thread has been calibrated.
+ *
+ * @param sync    shared with the remote threads
+ * @param n_cores number of cores, as from simple_get_core_count
+ */
+void sel4bench_global_cycles_reference(sel4bench_global_cycles_sync_t *sync, seL4_Word n_cores);
+
+/**
+ * Calibrate the counter of this core against the reference thread's.
+ *
+ * @param sync shared with the reference thread
+ * @param core core this thread is pinned to, from 1 to n_cores - 1
+ */
+void sel4bench_global_cycles_remote(sel4bench_global_cycles_sync_t *sync, seL4_Word core);
+
+/**
+ * Set the core of a thread that did not take part in calibration, once it is
+ * pinned to a calibrated core.
+ */
+static inline void sel4bench_global_cycles_set_core(seL4_Word core)
+{
+    sel4bench_global_cycles_core = core;
+}
+
+/**
+ * Query the cycle counter, corrected to core 0's time.
+ *
+ * @return current cycle count in core 0's time
+ */
+static inline ccnt_t sel4bench_get_global_cycle_count(void)
+{
+    return sel4bench_get_cycle_count() - sel4bench_core_offsets[sel4bench_global_cycles_core];
+}
+
+/**
+ * @return cycles by which a global cycle count taken on core may be off
+ */
+static inline ccnt_t sel4bench_global_cycle_count_error(seL4_Word core)
+{
+    return sel4bench_core_offset_errors[core];
+}
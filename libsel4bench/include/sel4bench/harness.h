@@ -0,0 +1,126 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sel4bench/sel4bench.h>
+
+/*
+ * A harness for timing a piece of code with the cycle counter.
+ *
+ * The code is run for a number of warmup iterations, which are discarded,
+ * and then once for each sample, with each sample stored in a caller
+ * provided array. The cost of reading the counter around an empty body is
+ * measured the same way and its median subtracted from every sample.
+ *
+ * Outliers, such as runs hit by an interrupt, are rejected by their distance
+ * from the median in units of the median absolute deviation (MAD), scaled so
+ * that one unit is a standard deviation for normally distributed samples.
+ * Everything in sel4bench_stats_t but the outlier count and the MAD is
+ * computed over the remaining samples.
+ */
+
+/* Scaled MADs from the median beyond which a sample is an outlier */
+#define SEL4BENCH_HARNESS_DEFAULT_MAD_THRESHOLD 3.5
+
+typedef struct sel4bench_harness {
+    const char *name;
+    seL4_Word warmup;
+    seL4_Word n_samples;
+    ccnt_t *samples;
+    /* median cycles of a sample with nothing in it */
+    ccnt_t overhead;
+    /* 0 to keep every sample */
+    double mad_threshold;
+} sel4bench_harness_t;
+
+typedef struct sel4bench_stats {
+    seL4_Word samples;
+    seL4_Word outliers;
+    ccnt_t overhead;
+    ccnt_t min;
+    ccnt_t median;
+    ccnt_t p90;
+    ccnt_t p99;
+    ccnt_t max;
+    ccnt_t mad;
+    double mean;
+    double stddev;
+} sel4bench_stats_t;
+
+typedef void (*sel4bench_harness_fn_t)(void *cookie);
+
+/*
+ * Take the samples for a harness by timing body, a statement or block, in a
+ * loop. Avoids the indirect call of sel4bench_harness_run, for code that is
+ * short enough for it to matter, but does not calibrate the overhead: call
+ * sel4bench_harness_calibrate first.
+ */
+#define SEL4BENCH_HARNESS_MEASURE(harness, body) do {                          \
+    sel4bench_harness_t *_h = (harness);                                       \
+    for (seL4_Word _i = 0; _i < _h->warmup + _h->n_samples; _i++) {            \
+        ccnt_t _start, _end;                                                   \
+        SEL4BENCH_READ_CCNT(_start);                                           \
+        body;                                                                  \
+        SEL4BENCH_READ_CCNT(_end);                                             \
+        if (_i >= _h->warmup) {                                                \
+            _h->samples[_i - _h->warmup] = _end - _start;                      \
+        }                                                                      \
+    }                                                                          \
+} while (0)
+
+/**
+ * Initialise a harness.
+ *
+ * @param harness   harness to initialise
+ * @param name      name to report results under
+ * @param samples   array of n_samples to measure into
+ * @param n_samples number of samples to take
+ * @param warmup    number of iterations to run and discard before sampling
+ *
+ * @return 0 on success, -1 on invalid arguments
+ */
+int sel4bench_harness_init(sel4bench_harness_t *harness, const char *name, ccnt_t *samples,
+                           seL4_Word n_samples, seL4_Word warmup);
+
+/**
+ * Measure the overhead of SEL4BENCH_HARNESS_MEASURE with an empty body.
+ * Overwrites the samples.
+ *
+ * @return the overhead, which is also stored in the harness
+ */
+ccnt_t sel4bench_harness_calibrate(sel4bench_harness_t *harness);
+
+/**
+ * Calibrate the overhead of calling a function through the harness, and
+ * then take the samples by timing calls of fn.
+ *
+ * @param harness an initialised harness
+ * @param fn      function to time
+ * @param cookie  passed to fn
+ */
+void sel4bench_harness_run(sel4bench_harness_t *harness, sel4bench_harness_fn_t fn, void *cookie);
+
+/**
+ * Compute statistics of the samples. Sorts the samples and subtracts the
+ * overhead from them, so call it only once per run.
+ *
+ * @param harness a harness that has taken its samples
+ * @param stats   filled in with the results
+ *
+ * @return 0 on success, -1 if there are no samples
+ */
+int sel4bench_harness_stats(sel4bench_harness_t *harness, sel4bench_stats_t *stats);
+
+/* Print statistics as a single JSON object on one line */
+void sel4bench_harness_print_json(sel4bench_harness_t *harness, sel4bench_stats_t *stats);
+
+/* Print the header line for sel4bench_harness_print_csv */
+void sel4bench_harness_print_csv_header(void);
+
+/* Print statistics as a line of CSV */
+void sel4bench_harness_print_csv(sel4bench_harness_t *harness, sel4bench_stats_t *stats);
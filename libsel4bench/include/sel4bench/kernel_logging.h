@@ -22,11 +22,48 @@ typedef benchmark_tracepoint_log_entry_t  kernel_log_entry_t;
 typedef void *kernel_log_entry_t;
 #endif
 
+/* Reads the entries of the kernel log in place, in the buffer given to
+ * kernel_logging_attach_log_buffer. Each call to kernel_logging_read_new returns the
+ * entries the kernel has added since the last, so a log can be streamed out while
+ * it is being written. */
+typedef struct kernel_logging_reader {
+    /* entries already returned */
+    unsigned int next;
+} kernel_logging_reader_t;
+
+/* Tell the library where the frame given to kernel_logging_set_log_buffer is mapped in
+ * the caller's vspace, so that the log can be read without any copies. The frame should
+ * be mapped once, for as long as the log is used.
+ */
+void kernel_logging_attach_log_buffer(const void *buffer);
+
 /* Copies up to n entries from the kernel's internal log to the specified array,
- * returning the number of entries copied.
+ * returning the number of entries copied. Only entries created before the most
+ * recent kernel_logging_finalize_log are copied, and nothing is copied unless the
+ * log buffer has been attached.
  */
 unsigned int kernel_logging_sync_log(kernel_log_entry_t log[], unsigned int n);
 
+/* Returns the entries created before the most recent kernel_logging_finalize_log
+ * where they are in the log buffer, and sets *n to the number of them. Returns NULL
+ * if the log buffer has not been attached.
+ */
+const kernel_log_entry_t *kernel_logging_get_log(unsigned int *n);
+
+/* Start reading the log from its first entry. */
+static inline void kernel_logging_reader_init(kernel_logging_reader_t *reader)
+{
+    reader->next = 0;
+}
+
+/* Finalizes the log and sets *entries to the entries the kernel has added since the
+ * last call with this reader, where they are in the log buffer, returning how many
+ * there are. The entries stay valid until the log is reset, after which the reader
+ * should be initialised again (a reset is only noticed by the reader if the log then
+ * has fewer entries than it has read).
+ */
+unsigned int kernel_logging_read_new(kernel_logging_reader_t *reader, const kernel_log_entry_t **entries);
+
 /* Returns the key field of a log entry. */
 static inline seL4_Word kernel_logging_entry_get_key(kernel_log_entry_t *entry)
 {
@@ -73,13 +110,9 @@ static inline void kernel_logging_reset_log(void)
 
 /* Calls to kernel_logging_sync_log will extract entries created before
  * the most-recent call to this function. Call this function before calling
- * kernel_logging_sync_log. */
-static inline void kernel_logging_finalize_log(void)
-{
-#ifdef CONFIG_ENABLE_BENCHMARKS
-    seL4_BenchmarkFinalizeLog();
-#endif /* CONFIG_ENABLE_BENCHMARKS */
-}
+ * kernel_logging_sync_log. Returns the number of entries the kernel has
+ * logged, which may be more than fit in the buffer. */
+seL4_Word kernel_logging_finalize_log(void);
 
 /* Tell the kernel about the allocated user-level buffer
  * so that it can write to it. Note, this function has to
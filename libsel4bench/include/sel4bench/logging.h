@@ -14,7 +14,7 @@
  * This will be used as a generic log entry struct.
  */
 
-/* Dynamically expanding array */
+/* Dynamically expanding array, or a fixed one in memory provided by the caller */
 typedef struct log_buffer {
     seL4_Word *buffer;
     unsigned int capacity;
@@ -22,15 +22,52 @@ typedef struct log_buffer {
 
     /* Flag set when length == capacity and the most recent
      * call to realloc has failed (indicating a lack of
-     * available heap).
+     * available heap), or a fixed buffer has filled up.
      */
     unsigned int full;
+
+    /* Set for buffers from logging_init_fixed_log_buffer, which never allocate */
+    unsigned int fixed;
+    /* Set for fixed buffers that overwrite their oldest entries once full */
+    unsigned int ring;
+    /* Entries ever appended to a ring, of which the last capacity are kept */
+    unsigned int appended;
 } log_buffer_t;
 
 /* Allocates initial memory for the log buffer's internal buffer */
 void logging_init_log_buffer(log_buffer_t *log_buffer, unsigned int initial_capacity);
 
-/* Adds a new entry to the log buffer, reallocating memory to expand its buffer if necessary */
+/* Uses memory provided by the caller for the log buffer, so that appending never allocates.
+ * The memory should be mapped before measuring starts, ideally with large pages, so that
+ * appends do not fault or miss in the TLB.
+ * If ring is set, appending to a full buffer overwrites the oldest entry instead of setting
+ * full, and capacity must be a power of 2. Call logging_unwrap_log_buffer once done
+ * appending to put the entries of a ring in order.
+ */
+void logging_init_fixed_log_buffer(log_buffer_t *log_buffer, seL4_Word *memory, unsigned int capacity,
+                                   unsigned int ring);
+
+/* Appends to a buffer from logging_init_fixed_log_buffer: a store and an increment */
+static inline void logging_append_fixed_log_buffer(log_buffer_t *log_buffer, seL4_Word data)
+{
+    if (log_buffer->ring) {
+        log_buffer->buffer[log_buffer->appended & (log_buffer->capacity - 1)] = data;
+        log_buffer->appended++;
+    } else if (log_buffer->length < log_buffer->capacity) {
+        log_buffer->buffer[log_buffer->length] = data;
+        log_buffer->length++;
+    } else {
+        log_buffer->full = 1;
+    }
+}
+
+/* Rotates the entries of a ring buffer so that they are oldest first from buffer[0], and sets
+ * length to how many there are. Does nothing for other buffers.
+ */
+void logging_unwrap_log_buffer(log_buffer_t *log_buffer);
+
+/* Adds a new entry to the log buffer, reallocating memory to expand its buffer if necessary,
+ * unless it is fixed */
 void logging_append_log_buffer(log_buffer_t *log_buffer, seL4_Word data);
 
 /* Given an array of log entries and an array of buffers, copies the data field of each array entry
@@ -48,6 +85,15 @@ void logging_sort_log(kernel_log_entry_t *logs, unsigned int num_logs);
  */
 void logging_stable_sort_log(kernel_log_entry_t *logs, unsigned int num_logs);
 
+/* Sorts an array of logs by key into sorted, which must have room for num_logs entries, and
+ * records for each key below max_groups the offset in sorted of its first entry and how many
+ * entries have it, as logging_group_log_by_key would. Entries with larger keys go after all
+ * the groups. Stable, and linear in num_logs + max_groups, so it replaces sorting and then
+ * grouping when the keys are small, as trace point ids are.
+ */
+void logging_sort_group_log(kernel_log_entry_t *logs, unsigned int num_logs, kernel_log_entry_t *sorted,
+                            unsigned int *sizes, unsigned int *offsets, unsigned int max_groups);
+
 /* Given a sorted array of logs, for each distinct key, records the offset in the now sorted array
  * containing the first occurence of that key, and the number of elements in the array with that key.
  */
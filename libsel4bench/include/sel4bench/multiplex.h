@@ -0,0 +1,148 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <sel4bench/sel4bench.h>
+#include <utils/util.h>
+
+/*
+ * Time multiplexed event counting.
+ *
+ * Instead of running a benchmark once per chunk of events, as
+ * `sel4bench_enable_counters()` needs when there are more events than
+ * counters, the chunks are rotated onto the counters during a single run.
+ * Call `sel4bench_multiplex_rotate()` periodically, typically from the handler
+ * of a platsupport timer interrupt, and each event's count is scaled up at the
+ * end by the share of cycles its chunk was counting for. The scaled counts are
+ * estimates, which are good for workloads that behave the same way over many
+ * rotations.
+ *
+ * The counters belong to the core, so rotation has to happen on the core
+ * being measured, and often enough that no counter wraps within one period.
+ */
+
+typedef struct sel4bench_multiplex {
+    seL4_Word n_events;
+    event_id_t *events;
+    seL4_Word n_counters;
+    seL4_Word n_chunks;
+    /* chunk on the counters, and the mask sel4bench_enable_counters gave for it */
+    seL4_Word chunk;
+    counter_bitfield_t mask;
+    /* cycle count when counting started, and when the current chunk was enabled */
+    ccnt_t start;
+    ccnt_t enabled_at;
+    /* raw count of each event, and cycles each chunk has been counting for */
+    uint64_t *counts;
+    uint64_t *chunk_cycles;
+    /* scratch for reading the counters */
+    ccnt_t values[sizeof(seL4_Word) * 8];
+} sel4bench_multiplex_t;
+
+/**
+ * Start counting a set of events, rotating between chunks of them.
+ *
+ * @param mux          state to initialise
+ * @param n_events     number of events of interest
+ * @param events       events to track
+ * @param n_counters   number of counters available, as from `sel4bench_get_num_counters()`
+ * @param counts       array of n_events counts to accumulate into
+ * @param chunk_cycles array of `sel4bench_get_num_counter_chunks(n_counters, n_events)`
+ *                     cycle counts to accumulate into
+ */
+static inline void sel4bench_multiplex_start(sel4bench_multiplex_t *mux, seL4_Word n_events, event_id_t *events,
+                                             seL4_Word n_counters, uint64_t *counts, uint64_t *chunk_cycles)
+{
+    assert(n_counters <= ARRAY_SIZE(mux->values));
+    mux->n_events = n_events;
+    mux->events = events;
+    mux->n_counters = n_counters;
+    mux->n_chunks = sel4bench_get_num_counter_chunks(n_counters, n_events);
+    mux->counts = counts;
+    mux->chunk_cycles = chunk_cycles;
+    for (seL4_Word i = 0; i < n_events; i++) {
+        counts[i] = 0;
+    }
+    for (seL4_Word i = 0; i < mux->n_chunks; i++) {
+        chunk_cycles[i] = 0;
+    }
+
+    mux->chunk = 0;
+    mux->mask = sel4bench_enable_counters(n_events, events, 0, n_counters);
+    mux->start = mux->enabled_at = sel4bench_get_cycle_count();
+}
+
+/* Add what the current chunk has counted since it was enabled */
+static inline void sel4bench_multiplex_accumulate(sel4bench_multiplex_t *mux)
+{
+    ccnt_t now = sel4bench_get_counters(mux->mask, mux->values);
+    sel4bench_stop_counters(mux->mask);
+
+    for (seL4_Word i = 0; i < mux->n_counters; i++) {
+        if (mux->mask & BIT(i)) {
+            mux->counts[mux->chunk * mux->n_counters + i] += mux->values[i];
+        }
+    }
+    mux->chunk_cycles[mux->chunk] += (ccnt_t)(now - mux->enabled_at);
+}
+
+/**
+ * Move the counters on to the next chunk of events. With a single chunk this
+ * just folds the counters into the totals, which keeps them from wrapping.
+ *
+ * @param mux state from `sel4bench_multiplex_start()`
+ */
+static inline void sel4bench_multiplex_rotate(sel4bench_multiplex_t *mux)
+{
+    sel4bench_multiplex_accumulate(mux);
+    mux->chunk = (mux->chunk + 1) % mux->n_chunks;
+    mux->mask = sel4bench_enable_counters(mux->n_events, mux->events, mux->chunk, mux->n_counters);
+    mux->enabled_at = sel4bench_get_cycle_count();
+}
+
+/**
+ * Stop counting, and estimate what each event would have counted had it been
+ * counted for the whole run.
+ *
+ * @param mux     state from `sel4bench_multiplex_start()`
+ * @param results array of n_events estimates, 0 for events whose chunk was never
+ *                on the counters
+ *
+ * @return cycles the run took
+ */
+static inline uint64_t sel4bench_multiplex_stop(sel4bench_multiplex_t *mux, uint64_t results[])
+{
+    sel4bench_multiplex_accumulate(mux);
+    uint64_t total = (ccnt_t)(sel4bench_get_cycle_count() - mux->start);
+
+    for (seL4_Word i = 0; i < mux->n_events; i++) {
+        uint64_t enabled = mux->chunk_cycles[i / mux->n_counters];
+        if (enabled == 0) {
+            results[i] = 0;
+        } else if (enabled >= total) {
+            results[i] = mux->counts[i];
+        } else {
+            /* in floating point, as count * total overflows on long runs */
+            results[i] = (uint64_t)((double)mux->counts[i] * (double)total / (double)enabled);
+        }
+    }
+    return total;
+}
+
+/**
+ * Call `sel4bench_multiplex_start()` on the `GENERIC_EVENTS`, so that all of
+ * them are counted in one run.
+ */
+static inline void sel4bench_multiplex_start_generic(sel4bench_multiplex_t *mux, seL4_Word n_counters,
+                                                     uint64_t counts[SEL4BENCH_NUM_GENERIC_EVENTS],
+                                                     uint64_t *chunk_cycles)
+{
+    sel4bench_multiplex_start(mux, SEL4BENCH_NUM_GENERIC_EVENTS, GENERIC_EVENTS, n_counters, counts,
+                              chunk_cycles);
+}
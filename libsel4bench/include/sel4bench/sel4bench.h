@@ -18,7 +18,7 @@
  * @file
  *
  * libsel4bench is a library designed to abstract over the performance
- * monitoring counters (PMCs) in modern IA-32 and ARM processors, so that you
+ * monitoring counters (PMCs) in modern IA-32, ARM and RISC-V processors, so that you
  * can measure the performance of your software.  It will also work out whether
  * certain operations need to be done in kernel mode, and perform kernel code
  * injection calls to make them happen.  As a result, expect that any library
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <sel4bench/sel4bench.h>
+#include <utils/util.h>
+
+/*
+ * Per thread event counts.
+ *
+ * The counters count everything on the core. To attribute events to a
+ * thread, a user level scheduler calls sel4bench_thread_counters_switch as it
+ * switches between threads, and each thread accumulates what the counters
+ * and the cycle counter advanced by while it was switched in. The counters
+ * are read, never reset, so other users of them are not disturbed.
+ *
+ * The kernel switches threads without telling user level, so this only sees
+ * switches made cooperatively. A thread that blocks in the kernel should be
+ * switched out before and in after, which also leaves the kernel's own
+ * events out of its counts.
+ *
+ * Set up the events with sel4bench_set_count_event and start them before
+ * switching any thread in. No counter may wrap while a thread is switched in.
+ */
+
+typedef struct sel4bench_thread_counters {
+    counter_bitfield_t mask;
+    bool running;
+    ccnt_t cycles;
+    ccnt_t counts[sizeof(seL4_Word) * 8];
+    /* counter values when last switched in */
+    ccnt_t cycles_in;
+    ccnt_t counts_in[sizeof(seL4_Word) * 8];
+} sel4bench_thread_counters_t;
+
+/**
+ * Initialise a thread's counts.
+ *
+ * @param tc   counts to initialise
+ * @param mask counters to attribute, which must be set up the same way for
+ *             every thread
+ */
+static inline void sel4bench_thread_counters_init(sel4bench_thread_counters_t *tc, counter_bitfield_t mask)
+{
+    assert(sel4bench_get_num_counters() <= ARRAY_SIZE(tc->counts));
+    tc->mask = mask;
+    tc->running = false;
+    tc->cycles = 0;
+    for (seL4_Word i = 0; i < ARRAY_SIZE(tc->counts); i++) {
+        tc->counts[i] = 0;
+    }
+}
+
+/**
+ * Start attributing events to a thread.
+ */
+static inline void sel4bench_thread_counters_switch_in(sel4bench_thread_counters_t *tc)
+{
+    assert(!tc->running);
+    tc->cycles_in = sel4bench_get_counters(tc->mask, tc->counts_in);
+    tc->running = true;
+}
+
+/**
+ * Stop attributing events to a thread, adding what they advanced by since
+ * it was switched in to its counts.
+ */
+static inline void sel4bench_thread_counters_switch_out(sel4bench_thread_counters_t *tc)
+{
+    ccnt_t now[ARRAY_SIZE(tc->counts)];
+
+    assert(tc->running);
+    ccnt_t cycles = sel4bench_get_counters(tc->mask, now);
+    tc->cycles += cycles - tc->cycles_in;
+    for (seL4_Word i = 0; i < ARRAY_SIZE(tc->counts); i++) {
+        if (tc->mask & BIT(i)) {
+            tc->counts[i] += now[i] - tc->counts_in[i];
+        }
+    }
+    tc->running = false;
+}
+
+/**
+ * Hook for a scheduler switching from one thread to another. Either may be
+ * NULL for a thread that is not being counted.
+ */
+static inline void sel4bench_thread_counters_switch(sel4bench_thread_counters_t *from,
+                                                    sel4bench_thread_counters_t *to)
+{
+    if (from != NULL) {
+        sel4bench_thread_counters_switch_out(from);
+    }
+    if (to != NULL) {
+        sel4bench_thread_counters_switch_in(to);
+    }
+}
+
+/**
+ * Read a thread's counts, including the events since it was switched in if
+ * it is running and the caller is that thread.
+ *
+ * @param tc     counts to read
+ * @param values array of counts, indexed by counter, of which the counters in
+ *               the mask are filled in
+ *
+ * @return cycles the thread has been switched in for
+ */
+static inline ccnt_t sel4bench_thread_counters_read(sel4bench_thread_counters_t *tc, ccnt_t values[])
+{
+    ccnt_t cycles = tc->cycles;
+
+    if (tc->running) {
+        cycles += sel4bench_get_counters(tc->mask, values) - tc->cycles_in;
+    }
+    for (seL4_Word i = 0; i < ARRAY_SIZE(tc->counts); i++) {
+        if (tc->mask & BIT(i)) {
+            values[i] = tc->counts[i] + (tc->running ? values[i] - tc->counts_in[i] : 0);
+        }
+    }
+    return cycles;
+}
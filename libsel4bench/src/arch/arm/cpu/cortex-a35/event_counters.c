@@ -0,0 +1,46 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "../../event_counters.h"
+
+const char* const sel4bench_cpu_event_counter_data[] = {
+    NAME_EVENT(BUS_ACCESS_LD           , "Bus access, read"),
+    NAME_EVENT(BUS_ACCESS_ST           , "Bus access, write"),
+    NAME_EVENT(BR_INDIRECT_SPEC        , "Branch speculatively executed, indirect branch"),
+    NAME_EVENT(EXC_IRQ                 , "Exception taken, IRQ"),
+    NAME_EVENT(EXC_FIQ                 , "Exception taken, FIQ"),
+    NAME_EVENT(EXT_MEM_REQ             , "External memory request"),
+    NAME_EVENT(EXT_MEM_REQ_NC          , "Non-cacheable external memory request"),
+    NAME_EVENT(PREFETCH_LINEFILL       , "Linefill because of prefetch"),
+    NAME_EVENT(PREFETCH_LINEFILL_DROP  , "Instruction cache throttle"),
+    NAME_EVENT(READ_ALLOC_ENTER        , "Entering read allocate mode"),
+    NAME_EVENT(READ_ALLOC              , "Read allocate mode"),
+    NAME_EVENT(PRE_DECODE_ERR          , "Pre-decode error"),
+    NAME_EVENT(STALL_SB_FULL           , "Data write operation that stalls the pipeline because the store buffer is full"),
+    NAME_EVENT(EXT_SNOOP               , "SCU snooped data from another CPU for this CPU"),
+    NAME_EVENT(BR_COND                 , "Conditional branch executed"),
+    NAME_EVENT(BR_INDIRECT_MISPRED     , "Indirect branch mispredicted"),
+    NAME_EVENT(BR_INDIRECT_MISPRED_ADDR, "Indirect branch mispredicted because of address miscompare"),
+    NAME_EVENT(BR_COND_MISPRED         , "Conditional branch mispredicted"),
+    NAME_EVENT(L1I_CACHE_ERR           , "Level 1 instruction cache memory error"),
+    NAME_EVENT(L1D_CACHE_ERR           , "Level 1 data cache memory error"),
+    NAME_EVENT(TLB_ERR                 , "TLB memory error"),
+    NAME_EVENT(OTHER_IQ_DEP_STALL      , "Cycles the DPU IQ is empty and not because of an instruction cache miss, micro-TLB miss or pre-decode error"),
+    NAME_EVENT(IC_DEP_STALL            , "Cycles the DPU IQ is empty because of an instruction cache miss"),
+    NAME_EVENT(IUTLB_DEP_STALL         , "Cycles the DPU IQ is empty because of an instruction micro-TLB miss"),
+    NAME_EVENT(DECODE_DEP_STALL        , "Cycles the DPU IQ is empty because of a pre-decode error"),
+    NAME_EVENT(OTHER_INTERLOCK_STALL   , "Cycles there is an interlock other than for Advanced SIMD, floating-point, load or store"),
+    NAME_EVENT(AGU_DEP_STALL           , "Cycles there is an interlock for a load or store address generation"),
+    NAME_EVENT(SIMD_DEP_STALL          , "Cycles there is an interlock for an Advanced SIMD or floating-point instruction"),
+    NAME_EVENT(LD_DEP_STALL            , "Cycles the pipeline is stalled on a load that missed the level 1 data cache"),
+    NAME_EVENT(ST_DEP_STALL            , "Cycles the pipeline is stalled on a store")
+};
+
+int
+sel4bench_cpu_get_num_counters(void)
+{
+    return ARRAY_SIZE(sel4bench_cpu_event_counter_data);
+}
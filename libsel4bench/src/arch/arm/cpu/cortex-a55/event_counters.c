@@ -0,0 +1,80 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "../../event_counters.h"
+
+const char* const sel4bench_cpu_event_counter_data[] = {
+    NAME_EVENT(REMOTE_ACCESS            , "Access to another socket in a multi-socket system"),
+    NAME_EVENT(DTLB_WALK                , "Access to data TLB that caused a page table walk"),
+    NAME_EVENT(ITLB_WALK                , "Access to instruction TLB that caused a page table walk"),
+    NAME_EVENT(LL_CACHE_RD              , "Last level cache access, read"),
+    NAME_EVENT(LL_CACHE_MISS_RD         , "Last level cache miss, read"),
+    NAME_EVENT(L1D_CACHE_LD             , "Level 1 data cache access, read"),
+    NAME_EVENT(L1D_CACHE_ST             , "Level 1 data cache access, write"),
+    NAME_EVENT(L1D_CACHE_REFILL_LD      , "Level 1 data cache refill, read"),
+    NAME_EVENT(L1D_CACHE_REFILL_INNER   , "Level 1 data cache refill, inner"),
+    NAME_EVENT(L1D_CACHE_REFILL_OUTER   , "Level 1 data cache refill, outer"),
+    NAME_EVENT(L2D_CACHE_LD             , "Level 2 data cache access, read"),
+    NAME_EVENT(L2D_CACHE_ST             , "Level 2 data cache access, write"),
+    NAME_EVENT(L2D_CACHE_REFILL_LD      , "Level 2 data cache refill, read"),
+    NAME_EVENT(BUS_ACCESS_LD            , "Bus access, read"),
+    NAME_EVENT(BUS_ACCESS_ST            , "Bus access, write"),
+    NAME_EVENT(MEM_ACCESS_LD            , "Data memory access, read"),
+    NAME_EVENT(MEM_ACCESS_ST            , "Data memory access, write"),
+    NAME_EVENT(LD_SPEC                  , "Instruction speculatively executed, load"),
+    NAME_EVENT(ST_SPEC                  , "Instruction speculatively executed, store"),
+    NAME_EVENT(DP_SPEC                  , "Instruction speculatively executed, integer data processing"),
+    NAME_EVENT(ASE_SPEC                 , "Instruction speculatively executed, Advanced SIMD"),
+    NAME_EVENT(VFP_SPEC                 , "Instruction speculatively executed, floating-point"),
+    NAME_EVENT(CRYPTO_SPEC              , "Instruction speculatively executed, Cryptographic instruction"),
+    NAME_EVENT(BR_IMMED_SPEC            , "Branch speculatively executed, immediate branch"),
+    NAME_EVENT(BR_RETURN_SPEC           , "Branch speculatively executed, procedure return"),
+    NAME_EVENT(BR_INDIRECT_SPEC         , "Branch speculatively executed, indirect branch"),
+    NAME_EVENT(EXC_IRQ                  , "Exception taken, IRQ"),
+    NAME_EVENT(EXC_FIQ                  , "Exception taken, FIQ"),
+    NAME_EVENT(L3D_CACHE_LD             , "Level 3 data cache access, read"),
+    NAME_EVENT(L3D_CACHE_REFILL_LD      , "Level 3 data cache refill, read"),
+    NAME_EVENT(L3D_CACHE_REFILL_PREFETCH, "Level 3 data cache refill started due to prefetch"),
+    NAME_EVENT(L2D_CACHE_REFILL_PREFETCH, "Level 2 data cache refill started due to prefetch"),
+    NAME_EVENT(L1D_CACHE_REFILL_PREFETCH, "Level 1 data cache refill started due to prefetch"),
+    NAME_EVENT(L2D_WS_MODE              , "Level 2 data cache write streaming mode"),
+    NAME_EVENT(L1D_WS_MODE_ENTRY        , "Level 1 data cache entering write streaming mode"),
+    NAME_EVENT(L1D_WS_MODE              , "Level 1 data cache write streaming mode"),
+    NAME_EVENT(L3D_WS_MODE              , "Level 3 data cache write streaming mode"),
+    NAME_EVENT(LL_WS_MODE               , "Last level cache write streaming mode"),
+    NAME_EVENT(BR_COND_PRED             , "Predicted conditional branch executed"),
+    NAME_EVENT(BR_INDIRECT_MISPRED      , "Indirect branch mispredicted"),
+    NAME_EVENT(BR_INDIRECT_ADDR_MISPRED , "Indirect branch mispredicted because of address miscompare"),
+    NAME_EVENT(BR_COND_MISPRED          , "Conditional branch mispredicted"),
+    NAME_EVENT(BR_INDIRECT_ADDR_PRED    , "Indirect branch with predicted address executed"),
+    NAME_EVENT(BR_RETURN_ADDR_PRED      , "Procedure return with predicted address executed"),
+    NAME_EVENT(BR_RETURN_ADDR_MISPRED   , "Procedure return mispredicted because of address miscompare"),
+    NAME_EVENT(L2D_LLWALK_TLB           , "Level 2 TLB last-level walk cache access"),
+    NAME_EVENT(L2D_LLWALK_TLB_REFILL    , "Level 2 TLB last-level walk cache refill"),
+    NAME_EVENT(L2D_L2WALK_TLB           , "Level 2 TLB level-2 walk cache access"),
+    NAME_EVENT(L2D_L2WALK_TLB_REFILL    , "Level 2 TLB level-2 walk cache refill"),
+    NAME_EVENT(L2D_S2_TLB               , "Level 2 TLB IPA cache access"),
+    NAME_EVENT(L2D_S2_TLB_REFILL        , "Level 2 TLB IPA cache refill"),
+    NAME_EVENT(L2D_CACHE_STASH_DROPPED  , "Level 2 data cache stash dropped"),
+    NAME_EVENT(STALL_FRONTEND_CACHE     , "No operation issued because of the frontend, cache miss"),
+    NAME_EVENT(STALL_FRONTEND_TLB       , "No operation issued because of the frontend, TLB miss"),
+    NAME_EVENT(STALL_FRONTEND_PDERR     , "No operation issued because of the frontend, pre-decode error"),
+    NAME_EVENT(STALL_BACKEND_ILOCK      , "No operation issued because of the backend, interlock"),
+    NAME_EVENT(STALL_BACKEND_ILOCK_AGU  , "No operation issued because of the backend, interlock, AGU"),
+    NAME_EVENT(STALL_BACKEND_ILOCK_FPU  , "No operation issued because of the backend, interlock, FPU"),
+    NAME_EVENT(STALL_BACKEND_LD         , "No operation issued because of the backend, load"),
+    NAME_EVENT(STALL_BACKEND_ST         , "No operation issued because of the backend, store"),
+    NAME_EVENT(STALL_BACKEND_LD_CACHE   , "No operation issued because of the backend, load, cache miss"),
+    NAME_EVENT(STALL_BACKEND_LD_TLB     , "No operation issued because of the backend, load, TLB miss"),
+    NAME_EVENT(STALL_BACKEND_ST_STB     , "No operation issued because of the backend, store, STB full"),
+    NAME_EVENT(STALL_BACKEND_ST_TLB     , "No operation issued because of the backend, store, TLB miss")
+};
+
+int
+sel4bench_cpu_get_num_counters(void)
+{
+    return ARRAY_SIZE(sel4bench_cpu_event_counter_data);
+}
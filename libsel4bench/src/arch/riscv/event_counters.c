@@ -0,0 +1,56 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sel4bench/sel4bench.h>
+#include <utils/util.h>
+
+#include "../../event_counters.h"
+
+/* SBI event ids are sparse, so the names are looked up rather than indexed */
+#define EVENT_COUNTER_FORMAT(id, name) { id, name }
+
+static const struct {
+    event_id_t event;
+    const char *name;
+} sel4bench_riscv_event_counter_data[] = {
+    NAME_EVENT(EXECUTE_INSTRUCTION      , "Instructions retired"),
+    NAME_EVENT(BRANCH_MISPREDICT        , "Branch mispredictions"),
+    NAME_EVENT(CACHE_L1D_MISS           , "L1 data cache read miss"),
+    NAME_EVENT(MEMORY_ACCESS            , "L1 data cache read access"),
+    NAME_EVENT(CACHE_L1I_MISS           , "L1 instruction cache miss"),
+    NAME_EVENT(TLB_L1D_MISS             , "Data TLB read miss"),
+    NAME_EVENT(TLB_L1I_MISS             , "Instruction TLB miss"),
+#ifdef CONFIG_SEL4BENCH_RISCV_SBI_PMU
+    NAME_EVENT(CPU_CYCLES               , "CPU cycles"),
+    NAME_EVENT(CACHE_REFERENCES         , "Cache references"),
+    NAME_EVENT(CACHE_MISSES             , "Cache misses"),
+    NAME_EVENT(BRANCH_INSTRUCTIONS      , "Branch instructions"),
+    NAME_EVENT(BUS_CYCLES               , "Bus cycles"),
+    NAME_EVENT(STALLED_CYCLES_FRONTEND  , "Stalled cycles, frontend"),
+    NAME_EVENT(STALLED_CYCLES_BACKEND   , "Stalled cycles, backend"),
+    NAME_EVENT(REF_CPU_CYCLES           , "Reference cycles"),
+    NAME_EVENT(CACHE_L1D_WRITE          , "L1 data cache write access"),
+    NAME_EVENT(CACHE_L1D_WRITE_MISS     , "L1 data cache write miss"),
+    NAME_EVENT(CACHE_L1I_ACCESS         , "L1 instruction cache access"),
+    NAME_EVENT(CACHE_LL_ACCESS          , "Last level cache read access"),
+    NAME_EVENT(CACHE_LL_MISS            , "Last level cache read miss"),
+    NAME_EVENT(CACHE_LL_WRITE           , "Last level cache write access"),
+    NAME_EVENT(CACHE_LL_WRITE_MISS      , "Last level cache write miss"),
+    NAME_EVENT(TLB_L1D_WRITE_MISS       , "Data TLB write miss"),
+    NAME_EVENT(BRANCH_PREDICTED         , "Branch predictor access"),
+#endif
+};
+
+const char*
+sel4bench_arch_get_counter_description(counter_t counter)
+{
+    for (int i = 0; i < ARRAY_SIZE(sel4bench_riscv_event_counter_data); i++) {
+        if (sel4bench_riscv_event_counter_data[i].event == counter) {
+            return sel4bench_riscv_event_counter_data[i].name;
+        }
+    }
+    return NULL;
+}
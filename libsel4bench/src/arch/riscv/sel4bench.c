@@ -0,0 +1,14 @@
+/*
+ * Copyright 2020, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sel4bench/sel4bench.h>
+
+#ifdef CONFIG_SEL4BENCH_RISCV_SBI_PMU
+/* Set up by sel4bench_init(), see sel4bench/arch/sel4bench.h */
+seL4_Word sel4bench_riscv_num_counters;
+counter_bitfield_t sel4bench_riscv_configured_counters;
+counter_bitfield_t sel4bench_riscv_running_counters;
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sel4bench/global_cycles.h>
+#include <assert.h>
+#include <utils/util.h>
+
+enum {
+    STATE_IDLE,
+    STATE_PING,
+    STATE_PONG,
+};
+
+ccnt_t sel4bench_core_offsets[CONFIG_MAX_NUM_NODES];
+ccnt_t sel4bench_core_offset_errors[CONFIG_MAX_NUM_NODES];
+__thread seL4_Word sel4bench_global_cycles_core;
+
+static void
+wait_for_state(sel4bench_global_cycles_sync_t *sync, seL4_Word state)
+{
+    while (__atomic_load_n(&sync->state, __ATOMIC_ACQUIRE) != state);
+}
+
+void
+sel4bench_global_cycles_sync_init(sel4bench_global_cycles_sync_t *sync)
+{
+    sync->core = 0;
+    sync->state = STATE_IDLE;
+    sync->remote = 0;
+}
+
+void
+sel4bench_global_cycles_reference(sel4bench_global_cycles_sync_t *sync, seL4_Word n_cores)
+{
+    assert(n_cores <= CONFIG_MAX_NUM_NODES);
+    sel4bench_core_offsets[0] = 0;
+    sel4bench_core_offset_errors[0] = 0;
+    sel4bench_global_cycles_core = 0;
+
+    for (seL4_Word core = 1; core < n_cores; core++) {
+        ccnt_t best_rtt = (ccnt_t) -1;
+        ccnt_t offset = 0;
+
+        __atomic_store_n(&sync->core, core, __ATOMIC_RELEASE);
+        for (int round = 0; round < SEL4BENCH_GLOBAL_CYCLES_ROUNDS; round++) {
+            ccnt_t start = sel4bench_get_cycle_count();
+            __atomic_store_n(&sync->state, STATE_PING, __ATOMIC_RELEASE);
+            wait_for_state(sync, STATE_PONG);
+            ccnt_t end = sel4bench_get_cycle_count();
+
+            ccnt_t rtt = end - start;
+            if (rtt < best_rtt) {
+                best_rtt = rtt;
+                /* unsigned, so this is right even if the counters wrap */
+                offset = sync->remote - (start + rtt / 2);
+            }
+        }
+        __atomic_store_n(&sync->state, STATE_IDLE, __ATOMIC_RELEASE);
+        sel4bench_core_offsets[core] = offset;
+        sel4bench_core_offset_errors[core] = DIV_ROUND_UP(best_rtt, 2);
+    }
+    __atomic_store_n(&sync->core, 0, __ATOMIC_RELEASE);
+}
+
+void
+sel4bench_global_cycles_remote(sel4bench_global_cycles_sync_t *sync, seL4_Word core)
+{
+    assert(core > 0 && core < CONFIG_MAX_NUM_NODES);
+    while (__atomic_load_n(&sync->core, __ATOMIC_ACQUIRE) != core);
+
+    /* The reference only pings again once it has seen the last pong. */
+    for (int round = 0; round < SEL4BENCH_GLOBAL_CYCLES_ROUNDS; round++) {
+        wait_for_state(sync, STATE_PING);
+        sync->remote = sel4bench_get_cycle_count();
+        __atomic_store_n(&sync->state, STATE_PONG, __ATOMIC_RELEASE);
+    }
+    /* The reference publishes the offset before moving on from this core. */
+    while (__atomic_load_n(&sync->core, __ATOMIC_ACQUIRE) == core);
+    sel4bench_global_cycles_core = core;
+}
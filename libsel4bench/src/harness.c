@@ -0,0 +1,197 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sel4bench/harness.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <utils/util.h>
+
+/* scales a MAD to a standard deviation, for normally distributed samples */
+#define MAD_TO_STDDEV 1.4826
+
+static int
+ccnt_compare(const void *a, const void *b)
+{
+    ccnt_t x = *(const ccnt_t *)a;
+    ccnt_t y = *(const ccnt_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static ccnt_t
+median_overhead(sel4bench_harness_t *harness)
+{
+    qsort(harness->samples, harness->n_samples, sizeof(ccnt_t), ccnt_compare);
+    harness->overhead = harness->samples[(harness->n_samples - 1) / 2];
+    return harness->overhead;
+}
+
+static NO_INLINE void
+empty_fn(UNUSED void *cookie)
+{
+    COMPILER_MEMORY_FENCE();
+}
+
+int
+sel4bench_harness_init(sel4bench_harness_t *harness, const char *name, ccnt_t *samples,
+                       seL4_Word n_samples, seL4_Word warmup)
+{
+    if (harness == NULL || samples == NULL || n_samples == 0) {
+        ZF_LOGE("Invalid arguments to sel4bench_harness_init");
+        return -1;
+    }
+
+    harness->name = name;
+    harness->samples = samples;
+    harness->n_samples = n_samples;
+    harness->warmup = warmup;
+    harness->overhead = 0;
+    harness->mad_threshold = SEL4BENCH_HARNESS_DEFAULT_MAD_THRESHOLD;
+    return 0;
+}
+
+ccnt_t
+sel4bench_harness_calibrate(sel4bench_harness_t *harness)
+{
+    SEL4BENCH_HARNESS_MEASURE(harness, COMPILER_MEMORY_FENCE());
+    return median_overhead(harness);
+}
+
+static void
+measure_calls(sel4bench_harness_t *harness, sel4bench_harness_fn_t fn, void *cookie)
+{
+    SEL4BENCH_HARNESS_MEASURE(harness, fn(cookie));
+}
+
+void
+sel4bench_harness_run(sel4bench_harness_t *harness, sel4bench_harness_fn_t fn, void *cookie)
+{
+    measure_calls(harness, empty_fn, NULL);
+    median_overhead(harness);
+    measure_calls(harness, fn, cookie);
+}
+
+/* The median absolute deviation of sorted samples from their median at
+ * samples[mid]. Deviations grow outwards from mid on both sides, so merging
+ * the two sides finds the middle deviation without another array. */
+static ccnt_t
+sorted_mad(ccnt_t *samples, seL4_Word n, seL4_Word mid)
+{
+    ccnt_t median = samples[mid];
+    seL4_Word left = mid + 1;
+    seL4_Word right = mid + 1;
+    ccnt_t deviation = 0;
+
+    for (seL4_Word k = 0; k <= (n - 1) / 2; k++) {
+        if (right == n || (left > 0 && median - samples[left - 1] <= samples[right] - median)) {
+            left--;
+            deviation = median - samples[left];
+        } else {
+            deviation = samples[right] - median;
+            right++;
+        }
+    }
+    return deviation;
+}
+
+/* nearest rank percentile of n sorted samples */
+static ccnt_t
+percentile(ccnt_t *samples, seL4_Word n, unsigned int p)
+{
+    seL4_Word rank = DIV_ROUND_UP(n * p, 100);
+
+    return samples[rank == 0 ? 0 : rank - 1];
+}
+
+int
+sel4bench_harness_stats(sel4bench_harness_t *harness, sel4bench_stats_t *stats)
+{
+    if (harness == NULL || stats == NULL || harness->n_samples == 0) {
+        ZF_LOGE("Invalid arguments to sel4bench_harness_stats");
+        return -1;
+    }
+
+    ccnt_t *samples = harness->samples;
+    seL4_Word n = harness->n_samples;
+
+    /* Subtracting after sorting keeps the order, even with the clamp. */
+    qsort(samples, n, sizeof(ccnt_t), ccnt_compare);
+    for (seL4_Word i = 0; i < n; i++) {
+        samples[i] = samples[i] > harness->overhead ? samples[i] - harness->overhead : 0;
+    }
+
+    seL4_Word mid = (n - 1) / 2;
+    ccnt_t median = samples[mid];
+    ccnt_t mad = sorted_mad(samples, n, mid);
+    seL4_Word lo = 0;
+    seL4_Word hi = n;
+
+    if (harness->mad_threshold > 0) {
+        /* Runs are often identical to the cycle, so take the counter's
+         * resolution as the least MAD rather than rejecting every other run. */
+        double limit = harness->mad_threshold * MAD_TO_STDDEV * MAX(mad, 1);
+        while ((double)(median - samples[lo]) > limit) {
+            lo++;
+        }
+        while ((double)(samples[hi - 1] - median) > limit) {
+            hi--;
+        }
+    }
+
+    ccnt_t *kept = samples + lo;
+    seL4_Word n_kept = hi - lo;
+    double sum = 0;
+    for (seL4_Word i = 0; i < n_kept; i++) {
+        sum += kept[i];
+    }
+    double mean = sum / n_kept;
+    double squares = 0;
+    for (seL4_Word i = 0; i < n_kept; i++) {
+        squares += (kept[i] - mean) * (kept[i] - mean);
+    }
+
+    stats->samples = n_kept;
+    stats->outliers = n - n_kept;
+    stats->overhead = harness->overhead;
+    stats->min = kept[0];
+    stats->median = kept[(n_kept - 1) / 2];
+    stats->p90 = percentile(kept, n_kept, 90);
+    stats->p99 = percentile(kept, n_kept, 99);
+    stats->max = kept[n_kept - 1];
+    stats->mad = mad;
+    stats->mean = mean;
+    stats->stddev = n_kept > 1 ? sqrt(squares / (n_kept - 1)) : 0;
+    return 0;
+}
+
+void
+sel4bench_harness_print_json(sel4bench_harness_t *harness, sel4bench_stats_t *stats)
+{
+    printf("{\"name\": \"%s\", \"samples\": %zu, \"outliers\": %zu, \"overhead\": "CCNT_FORMAT
+           ", \"min\": "CCNT_FORMAT", \"median\": "CCNT_FORMAT", \"p90\": "CCNT_FORMAT
+           ", \"p99\": "CCNT_FORMAT", \"max\": "CCNT_FORMAT", \"mad\": "CCNT_FORMAT
+           ", \"mean\": %.2f, \"stddev\": %.2f}\n",
+           harness->name, (size_t)stats->samples, (size_t)stats->outliers, stats->overhead,
+           stats->min, stats->median, stats->p90, stats->p99, stats->max, stats->mad,
+           stats->mean, stats->stddev);
+}
+
+void
+sel4bench_harness_print_csv_header(void)
+{
+    printf("name,samples,outliers,overhead,min,median,p90,p99,max,mad,mean,stddev\n");
+}
+
+void
+sel4bench_harness_print_csv(sel4bench_harness_t *harness, sel4bench_stats_t *stats)
+{
+    printf("%s,%zu,%zu,"CCNT_FORMAT","CCNT_FORMAT","CCNT_FORMAT","CCNT_FORMAT","CCNT_FORMAT
+           ","CCNT_FORMAT","CCNT_FORMAT",%.2f,%.2f\n",
+           harness->name, (size_t)stats->samples, (size_t)stats->outliers, stats->overhead,
+           stats->min, stats->median, stats->p90, stats->p99, stats->max, stats->mad,
+           stats->mean, stats->stddev);
+}
@@ -4,12 +4,82 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <string.h>
+#include <utils/util.h>
 #include <sel4bench/kernel_logging.h>
 
+/* where the log buffer is mapped, see kernel_logging_attach_log_buffer */
+static const kernel_log_entry_t *kernel_log_buffer;
+/* entries logged before the most recent finalize that are in the buffer */
+static unsigned int kernel_log_finalized;
+
+void kernel_logging_attach_log_buffer(const void *buffer)
+{
+    kernel_log_buffer = buffer;
+}
+
+seL4_Word kernel_logging_finalize_log(void)
+{
+    seL4_Word index = 0;
+#ifdef CONFIG_ENABLE_BENCHMARKS
+    index = seL4_BenchmarkFinalizeLog();
+#endif /* CONFIG_ENABLE_BENCHMARKS */
+    kernel_log_finalized = MIN(index, KERNEL_MAX_NUM_LOG_ENTRIES);
+    return index;
+}
+
 #if CONFIG_MAX_NUM_TRACE_POINTS > 0
 unsigned int
 kernel_logging_sync_log(kernel_log_entry_t log[], unsigned int n)
 {
+    unsigned int num;
+    const kernel_log_entry_t *entries = kernel_logging_get_log(&num);
+    if (entries == NULL) {
+        return 0;
+    }
+    num = MIN(num, n);
+    memcpy(log, entries, num * sizeof(*log));
+    return num;
+}
+
+const kernel_log_entry_t *kernel_logging_get_log(unsigned int *n)
+{
+    *n = kernel_log_buffer ? kernel_log_finalized : 0;
+    return kernel_log_buffer;
+}
+
+unsigned int kernel_logging_read_new(kernel_logging_reader_t *reader, const kernel_log_entry_t **entries)
+{
+    *entries = NULL;
+    if (kernel_log_buffer == NULL) {
+        return 0;
+    }
+    kernel_logging_finalize_log();
+    if (kernel_log_finalized < reader->next) {
+        /* the log was reset */
+        reader->next = 0;
+    }
+    unsigned int num = kernel_log_finalized - reader->next;
+    *entries = kernel_log_buffer + reader->next;
+    reader->next = kernel_log_finalized;
+    return num;
+}
+#else
+unsigned int
+kernel_logging_sync_log(kernel_log_entry_t log[], unsigned int n)
+{
+    return 0;
+}
+
+const kernel_log_entry_t *kernel_logging_get_log(unsigned int *n)
+{
+    *n = 0;
+    return NULL;
+}
+
+unsigned int kernel_logging_read_new(kernel_logging_reader_t *reader, const kernel_log_entry_t **entries)
+{
+    *entries = NULL;
     return 0;
 }
 #endif
@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <malloc.h>
 #include <assert.h>
+#include <string.h>
+#include <utils/util.h>
 
 void
 logging_init_log_buffer(log_buffer_t *log_buffer, unsigned int initial_capacity)
@@ -16,15 +18,65 @@ logging_init_log_buffer(log_buffer_t *log_buffer, unsigned int initial_capacity)
     log_buffer->length = 0;
     log_buffer->buffer = (seL4_Word*)malloc(initial_capacity * sizeof(seL4_Word));
     log_buffer->full = 0;
+    log_buffer->fixed = 0;
+    log_buffer->ring = 0;
+    log_buffer->appended = 0;
     assert(log_buffer->buffer);
 }
 
+void
+logging_init_fixed_log_buffer(log_buffer_t *log_buffer, seL4_Word *memory, unsigned int capacity,
+                              unsigned int ring)
+{
+    assert(memory != NULL);
+    assert(!ring || (capacity != 0 && IS_POWER_OF_2(capacity)));
+    log_buffer->buffer = memory;
+    log_buffer->capacity = capacity;
+    log_buffer->length = 0;
+    log_buffer->full = 0;
+    log_buffer->fixed = 1;
+    log_buffer->ring = ring;
+    log_buffer->appended = 0;
+}
+
+static void
+reverse_words(seL4_Word *words, unsigned int n)
+{
+    for (unsigned int i = 0; i < n / 2; ++i) {
+        seL4_Word tmp = words[i];
+        words[i] = words[n - 1 - i];
+        words[n - 1 - i] = tmp;
+    }
+}
+
+void
+logging_unwrap_log_buffer(log_buffer_t *log_buffer)
+{
+    if (!log_buffer->ring) {
+        return;
+    }
+    if (log_buffer->appended <= log_buffer->capacity) {
+        log_buffer->length = log_buffer->appended;
+        return;
+    }
+
+    /* The oldest entry is where the next one would have gone. Rotate it to
+     * the front in place by reversing both halves and then the whole. */
+    unsigned int oldest = log_buffer->appended & (log_buffer->capacity - 1);
+    reverse_words(log_buffer->buffer, oldest);
+    reverse_words(log_buffer->buffer + oldest, log_buffer->capacity - oldest);
+    reverse_words(log_buffer->buffer, log_buffer->capacity);
+    log_buffer->length = log_buffer->capacity;
+    log_buffer->appended = log_buffer->capacity;
+}
+
 static void
 expand_log_buffer(log_buffer_t *log_buffer)
 {
     unsigned int new_capacity = log_buffer->capacity * 2;
     seL4_Word* new_buffer = (seL4_Word*)realloc(log_buffer->buffer, new_capacity * sizeof(seL4_Word));
     if (new_buffer == NULL) {
+        ZF_LOGW("Failed to grow log buffer to %u entries, dropping entries from now on", new_capacity);
         log_buffer->full = 1;
     } else {
         log_buffer->buffer = new_buffer;
@@ -36,7 +88,11 @@ expand_log_buffer(log_buffer_t *log_buffer)
 void
 logging_append_log_buffer(log_buffer_t *log_buffer, seL4_Word data)
 {
-    if (log_buffer->length == log_buffer->capacity) {
+    if (log_buffer->fixed) {
+        logging_append_fixed_log_buffer(log_buffer, data);
+        return;
+    }
+    if (log_buffer->length == log_buffer->capacity && !log_buffer->full) {
         expand_log_buffer(log_buffer);
     }
     if (!log_buffer->full) {
@@ -61,8 +117,9 @@ logging_separate_log(kernel_log_entry_t *logs, unsigned int num_logs, log_buffer
 static int
 log_compare(const void *a, const void *b)
 {
-    return kernel_logging_entry_get_key((kernel_log_entry_t*)a) -
-           kernel_logging_entry_get_key((kernel_log_entry_t*)b);
+    seL4_Word key_a = kernel_logging_entry_get_key((kernel_log_entry_t*)a);
+    seL4_Word key_b = kernel_logging_entry_get_key((kernel_log_entry_t*)b);
+    return key_a < key_b ? -1 : key_a > key_b;
 }
 
 void
@@ -71,23 +128,92 @@ logging_sort_log(kernel_log_entry_t *logs, unsigned int num_logs)
     qsort(logs, num_logs, sizeof(kernel_log_entry_t), log_compare);
 }
 
+#define LOGGING_RADIX_BITS 8
+#define LOGGING_RADIX BIT(LOGGING_RADIX_BITS)
+
 void
 logging_stable_sort_log(kernel_log_entry_t *logs, unsigned int num_logs)
 {
-    /* Modify the keys so sorting preserves order within a single key */
-    for (int i = 0; i < num_logs; ++i) {
-        kernel_log_entry_t *entry = &logs[i];
-        seL4_Word key = kernel_logging_entry_get_key(entry);
-        key = key * num_logs + i;
+    seL4_Word max_key = 0;
+    for (unsigned int i = 0; i < num_logs; ++i) {
+        max_key = MAX(max_key, kernel_logging_entry_get_key(&logs[i]));
     }
 
-    logging_sort_log(logs, num_logs);
+    kernel_log_entry_t *tmp = malloc(num_logs * sizeof(kernel_log_entry_t));
+    if (tmp == NULL) {
+        /* Insertion sort is stable too, just slow. */
+        ZF_LOGW("No memory to radix sort %u logs, falling back to insertion sort", num_logs);
+        for (unsigned int i = 1; i < num_logs; ++i) {
+            kernel_log_entry_t entry = logs[i];
+            seL4_Word key = kernel_logging_entry_get_key(&entry);
+            unsigned int j = i;
+            for (; j > 0 && kernel_logging_entry_get_key(&logs[j - 1]) > key; --j) {
+                logs[j] = logs[j - 1];
+            }
+            logs[j] = entry;
+        }
+        return;
+    }
 
-    /* Restore the original key values */
-    for (int i = 0; i < num_logs; ++i) {
-        kernel_log_entry_t *entry = &logs[i];
-        seL4_Word key = kernel_logging_entry_get_key(entry);
-        key = key / num_logs;
+    /* Least significant digit first radix sort, only over the digits the keys use.
+     * Each pass is a stable counting sort, so the whole sort is stable. */
+    kernel_log_entry_t *src = logs, *dst = tmp;
+    for (unsigned int shift = 0; shift < sizeof(seL4_Word) * 8 && (max_key >> shift) != 0;
+         shift += LOGGING_RADIX_BITS) {
+        unsigned int offsets[LOGGING_RADIX] = {0};
+        for (unsigned int i = 0; i < num_logs; ++i) {
+            offsets[(kernel_logging_entry_get_key(&src[i]) >> shift) & (LOGGING_RADIX - 1)]++;
+        }
+        unsigned int total = 0;
+        for (unsigned int d = 0; d < LOGGING_RADIX; ++d) {
+            unsigned int count = offsets[d];
+            offsets[d] = total;
+            total += count;
+        }
+        for (unsigned int i = 0; i < num_logs; ++i) {
+            dst[offsets[(kernel_logging_entry_get_key(&src[i]) >> shift) & (LOGGING_RADIX - 1)]++] = src[i];
+        }
+        kernel_log_entry_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != logs) {
+        memcpy(logs, src, num_logs * sizeof(kernel_log_entry_t));
+    }
+    free(tmp);
+}
+
+void
+logging_sort_group_log(kernel_log_entry_t *logs, unsigned int num_logs, kernel_log_entry_t *sorted,
+                       unsigned int *sizes, unsigned int *offsets, unsigned int max_groups)
+{
+    unsigned int others = 0;
+
+    for (unsigned int k = 0; k < max_groups; ++k) {
+        sizes[k] = 0;
+    }
+    for (unsigned int i = 0; i < num_logs; ++i) {
+        seL4_Word key = kernel_logging_entry_get_key(&logs[i]);
+        if (key < max_groups) {
+            sizes[key]++;
+        }
+    }
+
+    unsigned int total = 0;
+    for (unsigned int k = 0; k < max_groups; ++k) {
+        offsets[k] = total;
+        total += sizes[k];
+        /* counts back up again as the group is filled in */
+        sizes[k] = 0;
+    }
+
+    for (unsigned int i = 0; i < num_logs; ++i) {
+        seL4_Word key = kernel_logging_entry_get_key(&logs[i]);
+        if (key < max_groups) {
+            sorted[offsets[key] + sizes[key]++] = logs[i];
+        } else {
+            sorted[total + others++] = logs[i];
+        }
     }
 }
 
@@ -48,6 +48,10 @@ static UNUSED const char *register_names[] = {
     "tp",
 };
 
+/* registers a stack walk of the thread starts from, see sel4debug/stack_trace.h */
+#define SEL4DEBUG_CONTEXT_PC(context) ((context)->pc)
+#define SEL4DEBUG_CONTEXT_FP(context) ((context)->s0)
+
 /* assert that register_names correspond to seL4_UserContext */
 compile_time_assert(register_names_correct_size, sizeof(register_names) == sizeof(seL4_UserContext));
 
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Inspection of the heap tracked by the allocation wrappers in alloc.c. Every
+ * live allocation is tracked with its size and the return address of its
+ * allocation call, if LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES is not 0.
+ *
+ * With LIBSEL4DEBUG_ALLOC_PROFILE on, the wrappers also profile every Nth
+ * allocation, N being LIBSEL4DEBUG_ALLOC_PROFILE_SAMPLE_RATE, by call site.
+ * The counts are of sampled allocations only, so multiply them by N for an
+ * estimate of the total.
+ */
+
+#include <stddef.h>
+
+/* Live allocations made from one call site */
+typedef struct sel4debug_alloc_site {
+    void *caller;
+    size_t allocations;
+    size_t bytes;
+} sel4debug_alloc_site_t;
+
+/* Group the live allocations by call site into the sites array, sorted by
+ * bytes, largest first, and return the number of sites. Once the array is
+ * full the allocations of further sites are left out, so for the sites with
+ * the most live bytes the array needs room for every call site. This does not
+ * allocate memory.
+ */
+size_t sel4debug_alloc_snapshot(sel4debug_alloc_site_t *sites, size_t max_sites);
+
+/* Print the number and bytes of the live allocations, and then their call
+ * sites, one "<caller> <allocations> <bytes>" line each, of the first 32 sites
+ * found.
+ */
+void sel4debug_alloc_dump(void);
+
+/* Number of buckets in the size histogram of a profiled call site */
+#define SEL4DEBUG_ALLOC_PROFILE_BUCKETS 32
+
+/* Sampled allocations made from one call site. The caller is NULL for the
+ * site that counts the allocations of sites that did not fit in the table.
+ */
+typedef struct sel4debug_alloc_profile_site {
+    void *caller;
+    size_t allocations;
+    size_t bytes;
+    /* bytes of the sampled allocations that have not been freed */
+    size_t live_bytes;
+    /* allocations of 0 bytes in bucket 0, of [2^(n-1), 2^n) bytes in bucket
+     * n, and of any more in the last bucket */
+    size_t sizes[SEL4DEBUG_ALLOC_PROFILE_BUCKETS];
+} sel4debug_alloc_profile_site_t;
+
+/* Copy out the max_sites profiled call sites with the most bytes allocated,
+ * sorted by bytes, largest first, and return the number copied. This does not
+ * allocate memory.
+ */
+size_t sel4debug_alloc_profile(sel4debug_alloc_profile_site_t *sites, size_t max_sites);
+
+/* Print the sample rate, and the 32 profiled call sites with the most bytes
+ * allocated, one "<caller> <allocations> <bytes> <live bytes>" line each,
+ * followed by a "<bucket>:<allocations>" for each non-empty histogram bucket.
+ */
+void sel4debug_alloc_profile_dump(void);
+
+/* Start counting allocations and bytes again, for example after start up.
+ * Live bytes are kept, as they are still live.
+ */
+void sel4debug_alloc_profile_reset(void);
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Bulk inspection of a cspace, for auditing it for leaked caps. A scan covers
+ * a range of cptrs and counts the types seL4_DebugCapIdentify reports for
+ * them. Slots an allocator knows to be free are skipped without entering the
+ * kernel, by passing its bitmap of free slots, in the layout of allocman's
+ * cspace_single_level_t: one bit per slot, set if the slot is free, starting
+ * at the first slot of the range.
+ *
+ * For an allocman single level cspace that is
+ *   debug_cspace_scan(cspace->config.first_slot,
+ *                     cspace->config.end_slot - cspace->config.first_slot,
+ *                     cspace->bitmap, &scan, NULL);
+ * and a two level cspace is scanned one second level at a time, starting at
+ * cptr (index << config.level_two_bits) with the second level's bitmap.
+ *
+ * This needs a kernel with CONFIG_DEBUG_BUILD.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+
+/* Types counted in a scan. Types from seL4_DebugCapIdentify above this are
+ * counted in the last. */
+#define DEBUG_CSPACE_SCAN_TYPES 32
+
+/* Written to the types array for a slot that was skipped as free */
+#define DEBUG_CSPACE_SCAN_SKIPPED 0xff
+
+typedef struct debug_cspace_scan {
+    /* slots identified with the kernel */
+    size_t identified;
+    /* slots skipped as free */
+    size_t skipped;
+    /* identified slots of each type, 0 being the null cap */
+    size_t counts[DEBUG_CSPACE_SCAN_TYPES];
+} debug_cspace_scan_t;
+
+/* Scan the num_slots cptrs from first, adding to the counts in scan, which the
+ * caller zeroes before the first scan. free_bitmap may be NULL to identify
+ * every slot. If types is not NULL it gets a byte per slot, the type or
+ * DEBUG_CSPACE_SCAN_SKIPPED, for a binary dump of the whole range.
+ *
+ * Returns 0 on success, or -1 if the kernel can't identify caps.
+ */
+int debug_cspace_scan(seL4_CPtr first, size_t num_slots, const size_t *free_bitmap,
+                      debug_cspace_scan_t *scan, uint8_t *types);
+
+/* Print the counts of a scan, one line for each type seen. */
+void debug_cspace_scan_print(debug_cspace_scan_t *scan);
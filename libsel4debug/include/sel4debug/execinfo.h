@@ -11,7 +11,10 @@
  * elements that will fit into buffer. The return value is the actual number of
  * entries that are obtained, and is at most size.
  *
- * This requires the setting LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_BACKTRACE.
+ * With the setting LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_BACKTRACE or
+ * LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_PROFILE the entries are the functions
+ * on the instrumentation's stack. Otherwise they are return addresses found by
+ * walking frame pointers, see sel4debug/stack_trace.h.
  */
 int backtrace(void **buffer, int size) __attribute__((no_instrument_function));
 
@@ -19,3 +19,29 @@ __attribute__((no_instrument_function));
 void __cyg_profile_func_exit(void *func, void *caller)
 __attribute__((no_instrument_function));
 
+
+/* With LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_RING, print the function entry
+ * and exit records in the ring of the thread with the given IPC buffer, oldest
+ * first, for tools/function_trace.py to read. A NULL ipc_buffer means the
+ * calling thread, and a fault handler in the same address space can pass the
+ * IPC buffer of the thread that faulted.
+ */
+void debug_function_trace_dump(void *ipc_buffer)
+__attribute__((no_instrument_function));
+
+/* Empty the ring of the thread with the given IPC buffer, or of the calling
+ * thread if it is NULL.
+ */
+void debug_function_trace_reset(void *ipc_buffer)
+__attribute__((no_instrument_function));
+
+/* With LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_PROFILE, print one
+ * "FPROFILE <function> <calls> <inclusive cycles> <self cycles>" line for each
+ * function profiled so far, by every thread.
+ */
+void debug_function_profile_dump(void)
+__attribute__((no_instrument_function));
+
+/* Start profiling again from 0 for every function. */
+void debug_function_profile_reset(void)
+__attribute__((no_instrument_function));
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A poor man's profiler for another thread. Each sample reads the thread's
+ * registers through its TCB and walks its stack by frame pointer, as in
+ * sel4debug/stack_trace.h, reading the frames through a mapping of the stack.
+ * Identical call stacks are counted together, and the dump is in the folded
+ * format flame graph tools read. The target doesn't need rebuilding, only to
+ * have been built with frame pointers.
+ *
+ * Sampling is driven by the caller, which calls sel4debug_stack_sampler_sample
+ * from its own timer loop.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+
+/* Deepest call stack recorded, deeper stacks are cut off at their callers' end */
+#define SEL4DEBUG_STACK_SAMPLER_DEPTH 16
+/* Number of distinct call stacks counted */
+#define SEL4DEBUG_STACK_SAMPLER_STACKS 256
+
+typedef struct sel4debug_stack_sample {
+    uint32_t hash;
+    int depth;
+    /* the sampled pc first, then the return addresses */
+    void *pcs[SEL4DEBUG_STACK_SAMPLER_DEPTH];
+    size_t count;
+} sel4debug_stack_sample_t;
+
+typedef struct sel4debug_stack_sampler {
+    seL4_CPtr tcb;
+    /* suspend the target for each sample, rather than walk its stack as it
+     * runs on another core */
+    bool suspend;
+    seL4_Word stack_base;
+    size_t stack_size;
+    void *stack_mapping;
+    /* samples that found no room in the table, or failed to read the target */
+    size_t dropped;
+    size_t num_stacks;
+    /* open addressed by hash */
+    sel4debug_stack_sample_t stacks[SEL4DEBUG_STACK_SAMPLER_STACKS];
+} sel4debug_stack_sampler_t;
+
+/* Start sampling the thread tcb, whose stack of stack_size bytes at
+ * stack_base in its address space is mapped at stack_mapping in this one, for
+ * example with vspace_share_mem. The sampler is large, so it is best static.
+ *
+ * A suspended thread is resumed after the sample, which restarts an IPC it was
+ * blocked in, so only sample without suspending where that is a problem. Without
+ * suspending, a target running on another core can be seen in the middle of
+ * changing its stack, and the walk stops early.
+ */
+void sel4debug_stack_sampler_init(sel4debug_stack_sampler_t *sampler, seL4_CPtr tcb, bool suspend,
+                                  seL4_Word stack_base, size_t stack_size, void *stack_mapping);
+
+/* Take one sample. Returns 0 on success, or -1 if it was dropped. */
+int sel4debug_stack_sampler_sample(sel4debug_stack_sampler_t *sampler);
+
+/* Print the samples in folded format, one "<outermost>;...;<pc> <count>" line per
+ * call stack, with addresses in hex for symbolising offline, followed by the
+ * number of dropped samples.
+ */
+void sel4debug_stack_sampler_dump(sel4debug_stack_sampler_t *sampler);
+
+/* Forget every sample taken so far. */
+void sel4debug_stack_sampler_reset(sel4debug_stack_sampler_t *sampler);
@@ -6,5 +6,39 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <sel4/sel4.h>
+
 void print_stack_trace(void);
 
+/* Stack walking by frame pointer, which needs no instrumentation, only code
+ * built with -fno-omit-frame-pointer. It works on x86, aarch64 and riscv. On
+ * aarch32 the frame layout depends on the compiler and instruction set, so
+ * nothing is walked. Code without frame pointers ends the walk early, and the
+ * caller of a leaf function that doesn't set up a frame can be missed.
+ */
+
+/* Walk the frames starting at the frame pointer fp, in the current address
+ * space, writing up to size return addresses into buffer. The walk stops at a
+ * frame that doesn't lie further up the stack than the last. Returns the
+ * number of addresses written.
+ */
+int sel4debug_stack_walk(seL4_Word fp, void **buffer, int size);
+
+/* As sel4debug_stack_walk, but for a stack of stack_size bytes at stack_base
+ * in another address space, which is mapped at mapping in this one. The walk
+ * also stops at a frame outside the stack.
+ */
+int sel4debug_stack_walk_mapped(seL4_Word fp, seL4_Word stack_base, size_t stack_size, void *mapping,
+                                void **buffer, int size);
+
+/* Walk the stack of a thread that is stopped, for example because it faulted,
+ * and that runs in the current address space. buffer[0] is the thread's pc
+ * and the rest are return addresses. Returns the number of addresses written,
+ * or -1 if the registers of tcb can't be read.
+ */
+int sel4debug_thread_backtrace(seL4_CPtr tcb, void **buffer, int size);
+
+/* Print the backtrace of a thread as found by sel4debug_thread_backtrace. */
+void sel4debug_dump_backtrace(seL4_CPtr tcb);
+void sel4debug_dump_backtrace_prefix(seL4_CPtr tcb, char *prefix);
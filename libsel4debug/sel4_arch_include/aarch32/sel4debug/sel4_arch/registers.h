@@ -32,6 +32,10 @@ static UNUSED const char *register_names[] = {
     "tpidruro"
 };
 
+/* registers a stack walk of the thread starts from, see sel4debug/stack_trace.h */
+#define SEL4DEBUG_CONTEXT_PC(context) ((context)->pc)
+#define SEL4DEBUG_CONTEXT_FP(context) ((context)->r11)
+
 /* assert that register_names correspond to seL4_UserContext */
 compile_time_assert(pc_correct_position, offsetof(seL4_UserContext, pc)     == 0);
 compile_time_assert(sp_correct_position, offsetof(seL4_UserContext, sp)     == 1 *  sizeof(seL4_Word));
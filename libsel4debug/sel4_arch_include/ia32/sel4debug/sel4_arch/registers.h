@@ -26,6 +26,10 @@ static UNUSED const char *register_names[] = {
 };
 compile_time_assert(register_names_correct_size, sizeof(register_names) == sizeof(seL4_UserContext));
 
+/* registers a stack walk of the thread starts from, see sel4debug/stack_trace.h */
+#define SEL4DEBUG_CONTEXT_PC(context) ((context)->eip)
+#define SEL4DEBUG_CONTEXT_FP(context) ((context)->ebp)
+
 /* assert that register_names correspond to seL4_UserContext */
 compile_time_assert(eip_correct_position, offsetof(seL4_UserContext, eip)           == 0);
 compile_time_assert(esp_correct_position, offsetof(seL4_UserContext, esp)           == 1 *  sizeof(seL4_Word));
@@ -27,7 +27,33 @@
  *
  * In addition to checking for corruption within the heap, this functionality
  * also tracks pointers that have been allocated. If you try and free (or
- * realloc) a pointer that was never allocated, it will be detected.
+ * realloc) a pointer that was never allocated, it will be detected. Pointers
+ * are tracked with their size and the return address of the allocation call,
+ * so sel4debug/alloc.h can show which call sites the live heap came from.
+ *
+ * Separately from checking, which LIBSEL4DEBUG_ALLOC_CHECK turns off, the
+ * wrappers can profile allocations by call site. With
+ * LIBSEL4DEBUG_ALLOC_PROFILE on, every Nth allocation is counted against the
+ * return address of its allocation call, in a fixed table of sites. Every
+ * allocation then carries a header in front of everything else, naming its
+ * site if it was sampled, so its bytes can be taken off the site's live bytes
+ * when it is freed:
+ *   |site|size|canary|size|memory...|canary|
+ *
+ * With LIBSEL4DEBUG_ALLOC_GUARD on, allocations of at least
+ * LIBSEL4DEBUG_ALLOC_GUARD_THRESHOLD bytes are instead given their own
+ * mapping from muslcsys's vspace, and placed at the end of it with a page
+ * that is never mapped after it. Overruns then fault on the access that runs
+ * off the end, as they would with eFence:
+ *                                   q         r
+ *                                   ↓         ↓
+ *   |unused|site|size|canary|size|memory...|fill|unmapped page|
+ * q is still aligned, so up to MAX_ALIGNMENT - 1 bytes come between the end
+ * of the memory and the guard page. These are filled with a known value that
+ * is checked on free in place of the trailing canary. The leading canary of a
+ * guarded allocation differs from that of others, which is how free tells
+ * them apart. Freed guarded allocations are unmapped, so later uses of them
+ * fault too.
  *
  * To use this, you will need to instruct the linker to wrap your calls to
  * allocation functions. You will need to append something like the following
@@ -41,10 +67,13 @@
 #include <assert.h>
 #include <autoconf.h>
 #include <sel4debug/gen_config.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h> /* for size_t */
 #include <string.h>
+#include <sel4debug/alloc.h>
+#include <utils/util.h>
 
 /* Maximum alignment of a data type. The malloc spec requires that returned
  * pointers are aligned to this.
@@ -59,6 +88,7 @@
  */
 #define PRE_EXTRA_BITS  0x7
 #define POST_EXTRA_BITS 0x3
+#define GUARD_EXTRA_BITS 0x5
 
 /* Algorithms for calculating a canary value to use before and after the
  * allocated region. The actual algorithm used here is more or less irrelevant
@@ -72,6 +102,10 @@ static uintptr_t post_canary(void *ptr)
 {
     return ((uintptr_t)ptr) | POST_EXTRA_BITS;
 }
+static uintptr_t guard_canary(void *ptr)
+{
+    return ((uintptr_t)ptr) | GUARD_EXTRA_BITS;
+}
 
 typedef struct {
     uintptr_t canary;
@@ -92,18 +126,47 @@ typedef uintptr_t unaligned_uintptr_t __attribute__((aligned(1)));
  */
 static int err = 0;
 
+#ifdef CONFIG_LIBSEL4DEBUG_ALLOC_CHECK
+#define ALLOC_CHECK 1
+#else
+#define ALLOC_CHECK 0
+#endif
+
+#ifdef CONFIG_LIBSEL4DEBUG_ALLOC_GUARD
+#define ALLOC_GUARD 1
+#else
+#define ALLOC_GUARD 0
+#endif
+
+#ifdef CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE
+typedef struct {
+    /* NULL if the allocation was not sampled */
+    sel4debug_alloc_profile_site_t *site;
+    size_t size;
+} __attribute__((aligned(MAX_ALIGNMENT))) profile_header_t;
+#define PROFILE_HEADER_SIZE sizeof(profile_header_t)
+#else
+#define PROFILE_HEADER_SIZE 0
+#endif
+
 /* Adjust a size that is about to be passed to the real allocation functions in
  * order to account for our instrumentation.
  */
 static size_t adjust_size(size_t size)
 {
-    return size + sizeof(metadata_t) + sizeof(uintptr_t);
+    if (ALLOC_CHECK) {
+        size += sizeof(metadata_t) + sizeof(uintptr_t);
+    }
+    return size + PROFILE_HEADER_SIZE;
 }
 
+/* Value the bytes between a guarded allocation and its guard page are set to */
+#define GUARD_FILL 0xa5
+
 /* Wrap a (just-allocated) region with canary values. */
-static void *box(void *ptr, size_t size)
+static void *box(void *ptr, size_t size, bool guarded)
 {
-    if (ptr == NULL) {
+    if (!ALLOC_CHECK || ptr == NULL) {
         return ptr;
     }
 
@@ -111,6 +174,14 @@ static void *box(void *ptr, size_t size)
     ptr += sizeof(*pre);
     unaligned_uintptr_t *post = ptr + size;
 
+    if (guarded) {
+        /* There may not be room for a trailing canary before the guard page. */
+        pre->canary = guard_canary(ptr);
+        pre->size = size;
+        memset(post, GUARD_FILL, ROUND_UP(size, MAX_ALIGNMENT) - size);
+        return ptr;
+    }
+
     /* Write the leading canary. */
     pre->canary = pre_canary(ptr);
     pre->size = size;
@@ -135,13 +206,24 @@ static void *box(void *ptr, size_t size)
 /* Unwrap a canary-endowed region into the original allocated pointer. */
 static void *unbox(void *ptr, void *ret_addr)
 {
-    if (ptr == NULL) {
+    if (!ALLOC_CHECK || ptr == NULL) {
         return ptr;
     }
 
     metadata_t *pre = (metadata_t *)(ptr - sizeof(*pre));
     unaligned_uintptr_t *post = ptr + pre->size;
 
+    if (ALLOC_GUARD && pre->canary == guard_canary(ptr)) {
+        /* Overruns past the fill would have faulted on the guard page. */
+        for (size_t i = pre->size; i < ROUND_UP(pre->size, MAX_ALIGNMENT); i++) {
+            if (((unsigned char *)ptr)[i] != GUARD_FILL) {
+                error("Buffer overflow in heap memory pointed to by %p (called "
+                      "prior to %p)\n", ptr, ret_addr);
+            }
+        }
+        return (void *)pre;
+    }
+
     /* Check the leading canary (underflow). */
     if (pre->canary != pre_canary(ptr)) {
         error("Leading corruption in heap memory pointed to by %p (called "
@@ -162,59 +244,463 @@ static void *unbox(void *ptr, void *ret_addr)
     return (void *)pre;
 }
 
-/* Buffer for tracking currently live heap pointers. This is used to detect
- * when the user attempts to free an invalid pointer. Note that we always track
- * *boxed* pointers as these are the ones seen by the user.
+/* Table for tracking currently live heap pointers. This is used to detect
+ * when the user attempts to free an invalid pointer, and to see what the heap
+ * holds with sel4debug_alloc_snapshot. Note that we always track *boxed*
+ * pointers as these are the ones seen by the user.
+ *
+ * The table is open addressed, with twice as many entries as pointers that
+ * can be tracked so that probe sequences stay short, so tracking is O(1).
  */
 #ifndef CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES
 #define CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES 128
 #endif
-static uintptr_t alloced[CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES];
+/* never 0, so it can be divided by even with tracking disabled */
+#define ALLOC_TABLE_ENTRIES \
+    (CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES > 0 ? CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES * 2 : 1)
+
+typedef struct {
+    /* 0 if the entry is empty */
+    uintptr_t ptr;
+    size_t size;
+    /* return address of the call that allocated it */
+    void *caller;
+} alloc_entry_t;
+
+static alloc_entry_t alloced[ALLOC_TABLE_ENTRIES];
+static size_t alloced_count;
+
+static size_t alloc_hash(uintptr_t ptr)
+{
+    /* Fibonacci hashing, of the pointer without its always 0 low bits. */
+    uintptr_t key = ptr / MAX_ALIGNMENT;
+#if UINTPTR_MAX > UINT32_MAX
+    key *= UINT64_C(0x9E3779B97F4A7C15);
+#else
+    key *= UINT32_C(0x9E3779B9);
+#endif
+    return (key >> (sizeof(uintptr_t) * 4)) % ALLOC_TABLE_ENTRIES;
+}
+
+/* Find the entry for ptr, or the empty entry where it would go. */
+static alloc_entry_t *find(uintptr_t ptr)
+{
+    size_t i = alloc_hash(ptr);
+    while (alloced[i].ptr != 0 && alloced[i].ptr != ptr) {
+        i = (i + 1) % ALLOC_TABLE_ENTRIES;
+    }
+    return &alloced[i];
+}
+
+/* Empty an entry, moving back any later entries in its probe sequence so that
+ * lookups never have to skip over deleted entries.
+ */
+static void remove_entry(alloc_entry_t *entry)
+{
+    size_t hole = entry - alloced;
+    size_t i = hole;
+
+    for (;;) {
+        i = (i + 1) % ALLOC_TABLE_ENTRIES;
+        if (alloced[i].ptr == 0) {
+            break;
+        }
+        size_t home = alloc_hash(alloced[i].ptr);
+        /* Move the entry into the hole unless its home is cyclically in (hole, i]. */
+        size_t from_home = (i + ALLOC_TABLE_ENTRIES - home) % ALLOC_TABLE_ENTRIES;
+        size_t from_hole = (i + ALLOC_TABLE_ENTRIES - hole) % ALLOC_TABLE_ENTRIES;
+        if (from_home >= from_hole) {
+            alloced[hole] = alloced[i];
+            hole = i;
+        }
+    }
+    alloced[hole].ptr = 0;
+    alloced_count--;
+}
 
 /* Track the given heap pointer as currently live. */
-static void track(void *ptr)
+static void track(void *ptr, size_t size, void *caller)
 {
-    if (sizeof(alloced) == 0 || ptr == NULL) {
+    if (!ALLOC_CHECK || CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES == 0 || ptr == NULL) {
         /* Disable tracking if we have no buffer and never track NULL. */
         return;
     }
-    for (unsigned int i = 0; i < sizeof(alloced) / sizeof(uintptr_t); i++) {
-        if (alloced[i] == 0) {
-            /* Found a free slot. */
-            alloced[i] = (uintptr_t)ptr;
-            return;
-        }
+    if (alloced_count == CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES) {
+        error("Exhausted pointer tracking buffer; try increasing "
+              "CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES value\n");
     }
-    /* Failed to find a free slot. */
-    error("Exhausted pointer tracking buffer; try increasing "
-          "CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES value\n");
+    alloc_entry_t *entry = find((uintptr_t)ptr);
+    entry->ptr = (uintptr_t)ptr;
+    entry->size = size;
+    entry->caller = caller;
+    alloced_count++;
 }
 
 /* Stop tracking the given pointer (mark it as dead). */
 static void untrack(void *ptr, void *ret_addr)
 {
-    if (sizeof(alloced) == 0 || ptr == NULL) {
+    if (!ALLOC_CHECK || CONFIG_LIBSEL4DEBUG_ALLOC_BUFFER_ENTRIES == 0 || ptr == NULL) {
         /* Ignore tracking if we have no buffer or are freeing NULL. */
         return;
     }
-    for (unsigned int i = 0; i < sizeof(alloced) / sizeof(uintptr_t); i++) {
-        if (alloced[i] == (uintptr_t)ptr) {
-            /* Found it. */
-            alloced[i] = 0;
-            return;
-        }
+    alloc_entry_t *entry = find((uintptr_t)ptr);
+    if (entry->ptr == (uintptr_t)ptr) {
+        /* Found it. */
+        remove_entry(entry);
+        return;
     }
     /* Failed to find it. */
     error("Attempt to free pointer %p that was never malloced (called prior "
           "to %p)\n", ptr, ret_addr);
 }
 
+static int compare_sites(const void *a, const void *b)
+{
+    const sel4debug_alloc_site_t *x = a;
+    const sel4debug_alloc_site_t *y = b;
+    return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+size_t sel4debug_alloc_snapshot(sel4debug_alloc_site_t *sites, size_t max_sites)
+{
+    size_t recorded = 0;
+
+    for (size_t i = 0; i < ALLOC_TABLE_ENTRIES; i++) {
+        if (alloced[i].ptr == 0) {
+            continue;
+        }
+        size_t j;
+        for (j = 0; j < recorded && sites[j].caller != alloced[i].caller; j++);
+        if (j == recorded) {
+            if (recorded == max_sites) {
+                continue;
+            }
+            sites[j].caller = alloced[i].caller;
+            sites[j].allocations = 0;
+            sites[j].bytes = 0;
+            recorded++;
+        }
+        sites[j].allocations++;
+        sites[j].bytes += alloced[i].size;
+    }
+
+    qsort(sites, recorded, sizeof(*sites), compare_sites);
+    return recorded;
+}
+
+/* Number of call sites printed by sel4debug_alloc_dump */
+#define ALLOC_DUMP_SITES 32
+
+void sel4debug_alloc_dump(void)
+{
+    static sel4debug_alloc_site_t sites[ALLOC_DUMP_SITES];
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < ALLOC_TABLE_ENTRIES; i++) {
+        if (alloced[i].ptr != 0) {
+            bytes += alloced[i].size;
+        }
+    }
+    size_t num_sites = sel4debug_alloc_snapshot(sites, ALLOC_DUMP_SITES);
+
+    printf("%zu live allocations of %zu bytes\n", alloced_count, bytes);
+    for (size_t i = 0; i < num_sites; i++) {
+        printf("%p %zu %zu\n", sites[i].caller, sites[i].allocations, sites[i].bytes);
+    }
+}
+
+/* Call site profiling. Sites are kept in an open addressed table keyed by
+ * caller, and once it is full the allocations of any new sites are counted
+ * against a single site with a NULL caller. Sites are never removed, as the
+ * headers of live allocations point at them.
+ */
+#ifdef CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE
+
+static sel4debug_alloc_profile_site_t profile_sites[CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE_SITES];
+static sel4debug_alloc_profile_site_t profile_other;
+static size_t profile_count;
+
+static sel4debug_alloc_profile_site_t *profile_site(void *caller)
+{
+    uintptr_t key = (uintptr_t)caller;
+#if UINTPTR_MAX > UINT32_MAX
+    key *= UINT64_C(0x9E3779B97F4A7C15);
+#else
+    key *= UINT32_C(0x9E3779B9);
+#endif
+    size_t i = (key >> (sizeof(uintptr_t) * 4)) % CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE_SITES;
+
+    for (size_t probes = 0; probes < CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE_SITES; probes++) {
+        if (profile_sites[i].caller == caller) {
+            return &profile_sites[i];
+        }
+        if (profile_sites[i].caller == NULL) {
+            profile_sites[i].caller = caller;
+            return &profile_sites[i];
+        }
+        i = (i + 1) % CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE_SITES;
+    }
+    return &profile_other;
+}
+
+/* Bucket 0 is for 0 bytes and bucket n for [2^(n-1), 2^n) bytes. */
+static size_t profile_bucket(size_t size)
+{
+    if (size == 0) {
+        return 0;
+    }
+    size_t bucket = CONFIG_WORD_SIZE - CLZL(size);
+    return MIN(bucket, SEL4DEBUG_ALLOC_PROFILE_BUCKETS - 1);
+}
+
+/* Write the profiling header of a just-allocated region and count it if it is
+ * sampled. */
+static void *profile(void *ptr, size_t size, void *caller)
+{
+    if (ptr == NULL) {
+        return ptr;
+    }
+
+    profile_header_t *header = ptr;
+    header->site = NULL;
+    header->size = size;
+    profile_count++;
+    if (profile_count % CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE_SAMPLE_RATE == 0) {
+        sel4debug_alloc_profile_site_t *site = profile_site(caller);
+        site->allocations++;
+        site->bytes += size;
+        site->live_bytes += size;
+        site->sizes[profile_bucket(size)]++;
+        header->site = site;
+    }
+    return ptr + sizeof(*header);
+}
+
+/* Take a region that is about to be freed off its site's live bytes, and
+ * return the originally allocated pointer. */
+static void *unprofile(void *ptr)
+{
+    if (ptr == NULL) {
+        return ptr;
+    }
+
+    profile_header_t *header = ptr - sizeof(*header);
+    if (header->site != NULL) {
+        header->site->live_bytes -= header->size;
+    }
+    return header;
+}
+
+static bool profile_site_used(sel4debug_alloc_profile_site_t *site)
+{
+    return site->allocations != 0 || site->live_bytes != 0;
+}
+
+/* Insert a site into the array of recorded sites, sorted by bytes, largest
+ * first, dropping the smallest if it is full. */
+static size_t profile_record(sel4debug_alloc_profile_site_t *sites, size_t recorded, size_t max_sites,
+                             sel4debug_alloc_profile_site_t *site)
+{
+    size_t i = recorded < max_sites ? recorded : max_sites;
+    if (i == max_sites && (i == 0 || sites[i - 1].bytes >= site->bytes)) {
+        return recorded;
+    }
+    if (i == max_sites) {
+        i--;
+    }
+    for (; i > 0 && sites[i - 1].bytes < site->bytes; i--) {
+        sites[i] = sites[i - 1];
+    }
+    sites[i] = *site;
+    return recorded < max_sites ? recorded + 1 : recorded;
+}
+
+size_t sel4debug_alloc_profile(sel4debug_alloc_profile_site_t *sites, size_t max_sites)
+{
+    size_t recorded = 0;
+
+    for (size_t i = 0; i < CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE_SITES; i++) {
+        if (profile_sites[i].caller != NULL && profile_site_used(&profile_sites[i])) {
+            recorded = profile_record(sites, recorded, max_sites, &profile_sites[i]);
+        }
+    }
+    if (profile_site_used(&profile_other)) {
+        recorded = profile_record(sites, recorded, max_sites, &profile_other);
+    }
+    return recorded;
+}
+
+void sel4debug_alloc_profile_reset(void)
+{
+    /* Live bytes are left alone, as the allocations they count are still live. */
+    for (size_t i = 0; i < CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE_SITES; i++) {
+        profile_sites[i].allocations = 0;
+        profile_sites[i].bytes = 0;
+        memset(profile_sites[i].sizes, 0, sizeof(profile_sites[i].sizes));
+    }
+    profile_other.allocations = 0;
+    profile_other.bytes = 0;
+    memset(profile_other.sizes, 0, sizeof(profile_other.sizes));
+}
+
+void sel4debug_alloc_profile_dump(void)
+{
+    static sel4debug_alloc_profile_site_t sites[ALLOC_DUMP_SITES];
+    size_t num_sites = sel4debug_alloc_profile(sites, ALLOC_DUMP_SITES);
+
+    printf("allocation profile, 1 in %zu allocations sampled\n",
+           (size_t) CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE_SAMPLE_RATE);
+    for (size_t i = 0; i < num_sites; i++) {
+        printf("%p %zu %zu %zu", sites[i].caller, sites[i].allocations, sites[i].bytes,
+               sites[i].live_bytes);
+        for (size_t j = 0; j < SEL4DEBUG_ALLOC_PROFILE_BUCKETS; j++) {
+            if (sites[i].sizes[j] != 0) {
+                printf(" %zu:%zu", j, sites[i].sizes[j]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+#else
+
+static void *profile(void *ptr, UNUSED size_t size, UNUSED void *caller)
+{
+    return ptr;
+}
+
+static void *unprofile(void *ptr)
+{
+    return ptr;
+}
+
+size_t sel4debug_alloc_profile(UNUSED sel4debug_alloc_profile_site_t *sites, UNUSED size_t max_sites)
+{
+    return 0;
+}
+
+void sel4debug_alloc_profile_reset(void)
+{
+}
+
+void sel4debug_alloc_profile_dump(void)
+{
+}
+
+#endif /* CONFIG_LIBSEL4DEBUG_ALLOC_PROFILE */
+
+/* Guarded allocations, see the top of this file. The mappings come from
+ * libsel4muslcsys, which is where the vspace is, when it is linked in. */
+#ifdef CONFIG_LIBSEL4DEBUG_ALLOC_GUARD
+
+void *muslcsys_guarded_map(size_t bytes) WEAK;
+void muslcsys_guarded_unmap(void *vaddr, size_t bytes) WEAK;
+
+/* Bytes of the mapping before the memory of an allocation of size bytes, and
+ * the bytes of the whole mapping */
+#define GUARD_HEAD_SIZE (PROFILE_HEADER_SIZE + sizeof(metadata_t))
+#define GUARD_MAP_SIZE(size) ROUND_UP(GUARD_HEAD_SIZE + ROUND_UP(size, MAX_ALIGNMENT), PAGE_SIZE_4K)
+
+static bool wants_guard(size_t size)
+{
+    return size >= CONFIG_LIBSEL4DEBUG_ALLOC_GUARD_THRESHOLD && muslcsys_guarded_map != NULL;
+}
+
+/* Map a region for an allocation of size bytes that ends at a guard page, and
+ * return it unboxed, or NULL if it could not be mapped. */
+static void *guard_alloc(size_t size)
+{
+    void *base = muslcsys_guarded_map(GUARD_MAP_SIZE(size));
+    if (base == NULL) {
+        return NULL;
+    }
+    return base + GUARD_MAP_SIZE(size) - ROUND_UP(size, MAX_ALIGNMENT) - GUARD_HEAD_SIZE;
+}
+
+/* Unmap an unboxed guarded region. Its mapping starts in the same page. */
+static void guard_free(void *ptr, size_t size)
+{
+    muslcsys_guarded_unmap((void *)ROUND_DOWN((uintptr_t)ptr, PAGE_SIZE_4K), GUARD_MAP_SIZE(size));
+}
+
+/* Whether the boxed pointer ptr is of a guarded allocation. */
+static bool is_guarded(void *ptr)
+{
+    return ptr != NULL && ((metadata_t *)(ptr - sizeof(metadata_t)))->canary == guard_canary(ptr);
+}
+
+#else
+
+static bool wants_guard(UNUSED size_t size)
+{
+    return false;
+}
+
+static void *guard_alloc(UNUSED size_t size)
+{
+    return NULL;
+}
+
+static void guard_free(UNUSED void *ptr, UNUSED size_t size)
+{
+}
+
+static bool is_guarded(UNUSED void *ptr)
+{
+    return false;
+}
+
+#endif /* CONFIG_LIBSEL4DEBUG_ALLOC_GUARD */
+
 /* Wrapped functions that will be exported to us from libmuslc. */
 void *__real_malloc(size_t size);
 void __real_free(void *ptr);
 void *__real_calloc(size_t num, size_t size);
 void *__real_realloc(void *ptr, size_t size);
 
+/* Allocate and instrument size bytes for a call from caller, guarded if it is
+ * large enough. */
+static void *instrumented_malloc(size_t size, void *caller)
+{
+    void *ptr = wants_guard(size) ? guard_alloc(size) : NULL;
+    bool guarded = ptr != NULL;
+    if (!guarded) {
+        ptr = __real_malloc(adjust_size(size));
+    }
+    ptr = profile(ptr, size, caller);
+    ptr = box(ptr, size, guarded);
+    track(ptr, size, caller);
+    return ptr;
+}
+
+static void instrumented_free(void *ptr, void *caller)
+{
+    untrack(ptr, caller);
+
+    bool guarded = is_guarded(ptr);
+    size_t size = 0;
+    /* Write garbage all over the region we were handed back to try to expose
+     * use-after-free bugs. If we fault while doing this, it probably means the
+     * user underran their buffer and overwrote the 'size' metadata. Guarded
+     * regions are unmapped instead.
+     */
+    if (ALLOC_CHECK && ptr != NULL) {
+        metadata_t *pre = (metadata_t *)(ptr - sizeof(*pre));
+        size = pre->size;
+        for (unsigned int i = 0; !guarded && i < pre->size; i++) {
+            ((char *)ptr)[i] ^= (char)~i;
+        }
+    }
+
+    ptr = unbox(ptr, caller);
+    ptr = unprofile(ptr);
+    if (guarded) {
+        guard_free(ptr, size);
+    } else {
+        __real_free(ptr);
+    }
+}
+
 /* Actual allocation wrappers follow. */
 
 void *__wrap_malloc(size_t size)
@@ -223,11 +709,9 @@ void *__wrap_malloc(size_t size)
         return __real_malloc(size);
     }
 
-    size_t new_size = adjust_size(size);
-    void *ptr = __real_malloc(new_size);
-    ptr = box(ptr, size);
-    track(ptr);
-    return ptr;
+    void *ret = __builtin_extract_return_addr(__builtin_return_address(0));
+
+    return instrumented_malloc(size, ret);
 }
 
 void __wrap_free(void *ptr)
@@ -239,19 +723,7 @@ void __wrap_free(void *ptr)
 
     void *ret = __builtin_extract_return_addr(__builtin_return_address(0));
 
-    untrack(ptr, ret);
-
-    /* Write garbage all over the region we were handed back to try to expose
-     * use-after-free bugs. If we fault while doing this, it probably means the
-     * user underran their buffer and overwrote the 'size' metadata.
-     */
-    metadata_t *pre = (metadata_t *)(ptr - sizeof(*pre));
-    for (unsigned int i = 0; i < pre->size; i++) {
-        ((char *)ptr)[i] ^= (char)~i;
-    }
-
-    ptr = unbox(ptr, ret);
-    __real_free(ptr);
+    instrumented_free(ptr, ret);
 }
 
 void *__wrap_calloc(size_t num, size_t size)
@@ -260,15 +732,30 @@ void *__wrap_calloc(size_t num, size_t size)
         return __real_calloc(num, size);
     }
 
+    void *ret = __builtin_extract_return_addr(__builtin_return_address(0));
+
+    if (wants_guard(num * size)) {
+        /* Fresh frames are not necessarily zeroed, whatever the vspace's
+         * allocator did with them before. */
+        void *ptr = instrumented_malloc(num * size, ret);
+        if (ptr != NULL) {
+            memset(ptr, 0, num * size);
+        }
+        return ptr;
+    }
+
     size_t sz = adjust_size(num * size);
-    size_t new_num = sz / size;
-    if (sz % size != 0) {
+    /* never divide by 0, the instrumentation needs room even for 0 bytes */
+    size_t elem = size != 0 ? size : 1;
+    size_t new_num = sz / elem;
+    if (sz % elem != 0) {
         new_num++;
     }
 
-    void *ptr = __real_calloc(new_num, size);
-    ptr = box(ptr, num * size);
-    track(ptr);
+    void *ptr = __real_calloc(new_num, elem);
+    ptr = profile(ptr, num * size, ret);
+    ptr = box(ptr, num * size, false);
+    track(ptr, num * size, ret);
     return ptr;
 }
 
@@ -280,11 +767,30 @@ void *__wrap_realloc(void *ptr, size_t size)
 
     void *ret = __builtin_extract_return_addr(__builtin_return_address(0));
 
+    if (is_guarded(ptr) || wants_guard(size)) {
+        /* Guarded regions can't be resized in place by the real realloc, so
+         * a new allocation is made to copy into. */
+        void *new_ptr = instrumented_malloc(size, ret);
+        if (new_ptr == NULL) {
+            return NULL;
+        }
+        if (ptr != NULL) {
+            size_t old_size = ((metadata_t *)(ptr - sizeof(metadata_t)))->size;
+            memcpy(new_ptr, ptr, MIN(old_size, size));
+            instrumented_free(ptr, ret);
+        }
+        return new_ptr;
+    }
+
     untrack(ptr, ret);
     ptr = unbox(ptr, ret);
+    /* Profiled as freeing the old region and allocating the new one, whether
+     * or not it moves. */
+    ptr = unprofile(ptr);
     size_t new_size = adjust_size(size);
     ptr = __real_realloc(ptr, new_size);
-    ptr = box(ptr, size);
-    track(ptr);
+    ptr = profile(ptr, size, ret);
+    ptr = box(ptr, size, false);
+    track(ptr, size, ret);
     return ptr;
 }
@@ -14,8 +14,13 @@
 LIBSEL4_INLINE_FUNC seL4_IPCBuffer *seL4_GetIPCBuffer(void) __attribute__((no_instrument_function));
 
 #include <sel4debug/gen_config.h>
+#include <stdint.h>
 #include <sel4/sel4.h>
+#include <sel4debug/debug.h>
 #include <sel4debug/instrumentation.h>
+#include <sel4debug/stack_trace.h>
+#include <utils/util.h>
+#include "cycles-internal.h"
 
 
 /* We can't just store backtrace information in a single static area because it
@@ -33,25 +38,60 @@ LIBSEL4_INLINE_FUNC seL4_IPCBuffer *seL4_GetIPCBuffer(void) __attribute__((no_in
  *   +-----------------+
  *   |   stack size    |
  *   +-----------------+ BACKTRACE_BASE
+ *
+ * With LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_PROFILE each entry of the stack
+ * is a profile_frame_t, which also holds the cycle count at entry.
  */
 #define BACKTRACE_BASE (((void*)seL4_GetIPCBuffer()) + sizeof(seL4_IPCBuffer))
 
+#ifdef CONFIG_LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_PROFILE
+typedef struct {
+    void *func;
+    uint64_t start;
+    /* inclusive cycles of the calls made by this one so far */
+    uint64_t children;
+} profile_frame_t;
+#define FRAME_FUNC(stack, i) (((profile_frame_t *)(stack))[i].func)
+
+/* frames that fit in the page of the IPC buffer; deeper calls are not profiled */
+#define PROFILE_MAX_DEPTH \
+    ((int)((BIT(seL4_PageBits) - sizeof(seL4_IPCBuffer) - sizeof(int)) / sizeof(profile_frame_t)))
+#define FRAMES(stack_sz) MIN(stack_sz, PROFILE_MAX_DEPTH)
+#else
+#define FRAME_FUNC(stack, i) (((void **)(stack))[i])
+#define FRAMES(stack_sz) (stack_sz)
+#endif
+
+#if !defined(CONFIG_LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_BACKTRACE) && \
+    !defined(CONFIG_LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_PROFILE)
+
+/* Without instrumentation there is no backtrace stack, so walk the frames. */
+int backtrace(void **buffer, int size)
+{
+    return sel4debug_stack_walk((seL4_Word) __builtin_frame_address(0), buffer, size);
+}
+
+#else
+
 int backtrace(void **buffer, int size)
 {
     int *bt_stack_sz = (int *)BACKTRACE_BASE;
-    void **bt_stack = (void **)(BACKTRACE_BASE + sizeof(int));
+    void *bt_stack = BACKTRACE_BASE + sizeof(int);
 
     /* Write as many entries as we can, starting from the top of the stack,
      * into the caller's buffer.
      */
+    int frames = FRAMES(*bt_stack_sz);
     int i;
-    for (i = 0; i < size && i < *bt_stack_sz; i++) {
-        buffer[i] = bt_stack[*bt_stack_sz - 1 - i];
+    for (i = 0; i < size && i < frames; i++) {
+        buffer[i] = FRAME_FUNC(bt_stack, frames - 1 - i);
     }
 
     return i;
 }
 
+#endif
+
 #ifdef CONFIG_LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_BACKTRACE
 
 void __cyg_profile_func_enter(void *func, void *caller)
@@ -82,3 +122,130 @@ void __cyg_profile_func_exit(void *func, void *caller)
 }
 
 #endif
+
+#ifdef CONFIG_LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_PROFILE
+
+/* Per-function cycle profiling. Each function gets its calls, its inclusive
+ * cycles, from entry to exit, and its self cycles, which leave out the
+ * inclusive cycles of the functions it called. A recursive function's
+ * inclusive cycles count the time of each level, so they can add up to more
+ * than the time spent in it, as in gprof. The cycle counts are from
+ * debug_read_cycles.
+ *
+ * Functions are kept in a table shared by every thread, open addressed and
+ * keyed by the function's address. Threads claim entries and add to them with
+ * atomic operations, so the hooks never wait on a lock. Once the table is full
+ * further functions are left out.
+ */
+#define PROFILE_ENTRIES CONFIG_LIBSEL4DEBUG_FUNCTION_PROFILE_ENTRIES
+
+typedef struct {
+    /* NULL if the entry is empty */
+    void *func;
+    uint64_t calls;
+    uint64_t inclusive;
+    uint64_t self;
+} profile_entry_t;
+
+static profile_entry_t profile_table[PROFILE_ENTRIES];
+
+static profile_entry_t *profile_entry(void *func) __attribute__((no_instrument_function));
+static profile_entry_t *profile_entry(void *func)
+{
+    /* Fibonacci hashing, so that neighbouring functions spread over the table. */
+    uintptr_t key = (uintptr_t)func;
+#if UINTPTR_MAX > UINT32_MAX
+    key *= UINT64_C(0x9E3779B97F4A7C15);
+#else
+    key *= UINT32_C(0x9E3779B9);
+#endif
+    size_t i = (key >> (sizeof(uintptr_t) * 4)) % PROFILE_ENTRIES;
+
+    for (size_t probes = 0; probes < PROFILE_ENTRIES; probes++) {
+        void *found = __atomic_load_n(&profile_table[i].func, __ATOMIC_RELAXED);
+        if (found == NULL) {
+            /* If another thread claims the entry first it fails and sees
+             * which function it went to. */
+            __atomic_compare_exchange_n(&profile_table[i].func, &found, func, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        if (found == NULL || found == func) {
+            return &profile_table[i];
+        }
+        i = (i + 1) % PROFILE_ENTRIES;
+    }
+    return NULL;
+}
+
+void __cyg_profile_func_enter(void *func, void *caller)
+{
+    if (seL4_GetIPCBuffer() == NULL) {
+        /* As for the backtrace, skip functions called before the IPC buffer
+         * is set up. */
+        return;
+    }
+    int *bt_stack_sz = (int *)BACKTRACE_BASE;
+    profile_frame_t *bt_stack = (profile_frame_t *)(BACKTRACE_BASE + sizeof(int));
+
+    /* The depth is counted even past the end, so that exits still match. */
+    if (*bt_stack_sz < PROFILE_MAX_DEPTH) {
+        profile_frame_t *frame = &bt_stack[*bt_stack_sz];
+        frame->func = func;
+        frame->children = 0;
+        /* last, so that as little as possible of the hook is counted */
+        frame->start = debug_read_cycles();
+    }
+    *bt_stack_sz += 1;
+}
+
+void __cyg_profile_func_exit(void *func, void *caller)
+{
+    uint64_t end = debug_read_cycles();
+    if (seL4_GetIPCBuffer() == NULL) {
+        return;
+    }
+    int *bt_stack_sz = (int *)BACKTRACE_BASE;
+    profile_frame_t *bt_stack = (profile_frame_t *)(BACKTRACE_BASE + sizeof(int));
+
+    *bt_stack_sz -= 1;
+    int depth = *bt_stack_sz;
+    if (depth < 0 || depth >= PROFILE_MAX_DEPTH) {
+        return;
+    }
+    profile_frame_t *frame = &bt_stack[depth];
+    uint64_t inclusive = end - frame->start;
+    if (depth > 0) {
+        bt_stack[depth - 1].children += inclusive;
+    }
+
+    profile_entry_t *entry = profile_entry(frame->func);
+    if (entry != NULL) {
+        __atomic_fetch_add(&entry->calls, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&entry->inclusive, inclusive, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&entry->self, inclusive - frame->children, __ATOMIC_RELAXED);
+    }
+}
+
+void debug_function_profile_dump(void)
+{
+    for (size_t i = 0; i < PROFILE_ENTRIES; i++) {
+        profile_entry_t *entry = &profile_table[i];
+        if (entry->func != NULL && entry->calls != 0) {
+            debug_safe_printf("FPROFILE %p %llu %llu %llu\n", entry->func,
+                              (unsigned long long) entry->calls, (unsigned long long) entry->inclusive,
+                              (unsigned long long) entry->self);
+        }
+    }
+}
+
+void debug_function_profile_reset(void)
+{
+    /* Entries keep their functions, as a thread may be about to add to one. */
+    for (size_t i = 0; i < PROFILE_ENTRIES; i++) {
+        __atomic_store_n(&profile_table[i].calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&profile_table[i].inclusive, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&profile_table[i].self, 0, __ATOMIC_RELAXED);
+    }
+}
+
+#endif
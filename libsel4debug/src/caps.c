@@ -6,9 +6,12 @@
 
 #include <autoconf.h>
 #include <sel4debug/gen_config.h>
+#include <sel4debug/cspace_scan.h>
 #include <sel4debug/debug.h>
 #include <sel4/sel4.h>
 #include <stdio.h>
+#include <string.h>
+#include <utils/util.h>
 
 void debug_cap_identify(seL4_CPtr cap)
 {
@@ -19,3 +22,54 @@ void debug_cap_identify(seL4_CPtr cap)
     printf("DEBUG_BUILD not set, can't get type of cap %"SEL4_PRIu_word"\n", cap);
 #endif
 }
+
+#define BITS_PER_WORD (sizeof(size_t) * 8)
+
+int debug_cspace_scan(seL4_CPtr first, size_t num_slots, const size_t *free_bitmap,
+                      debug_cspace_scan_t *scan, uint8_t *types)
+{
+#ifdef CONFIG_DEBUG_BUILD
+    size_t i = 0;
+    while (i < num_slots) {
+        if (free_bitmap != NULL && i % BITS_PER_WORD == 0 && num_slots - i >= BITS_PER_WORD
+            && free_bitmap[i / BITS_PER_WORD] == (size_t) -1) {
+            /* A whole word of free slots is skipped in one go. */
+            if (types != NULL) {
+                memset(&types[i], DEBUG_CSPACE_SCAN_SKIPPED, BITS_PER_WORD);
+            }
+            scan->skipped += BITS_PER_WORD;
+            i += BITS_PER_WORD;
+            continue;
+        }
+        if (free_bitmap != NULL && (free_bitmap[i / BITS_PER_WORD] & BIT(i % BITS_PER_WORD))) {
+            if (types != NULL) {
+                types[i] = DEBUG_CSPACE_SCAN_SKIPPED;
+            }
+            scan->skipped++;
+            i++;
+            continue;
+        }
+        seL4_Uint32 type = seL4_DebugCapIdentify(first + i);
+        scan->counts[MIN(type, DEBUG_CSPACE_SCAN_TYPES - 1)]++;
+        scan->identified++;
+        if (types != NULL) {
+            types[i] = MIN(type, DEBUG_CSPACE_SCAN_SKIPPED - 1);
+        }
+        i++;
+    }
+    return 0;
+#else
+    ZF_LOGE("DEBUG_BUILD not set, can't scan cspace");
+    return -1;
+#endif
+}
+
+void debug_cspace_scan_print(debug_cspace_scan_t *scan)
+{
+    printf("%zu slots identified, %zu skipped as free\n", scan->identified, scan->skipped);
+    for (int i = 0; i < DEBUG_CSPACE_SCAN_TYPES; i++) {
+        if (scan->counts[i] != 0) {
+            printf("type %d%s: %zu\n", i, i == DEBUG_CSPACE_SCAN_TYPES - 1 ? "+" : "", scan->counts[i]);
+        }
+    }
+}
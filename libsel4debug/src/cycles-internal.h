@@ -0,0 +1,44 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* A timestamp for the function instrumentation, from whatever cycle counter
+ * user level can read, or 0 if it can't read one. This doesn't use
+ * sel4bench, whose inline functions would themselves be instrumented and
+ * recurse into the hooks.
+ */
+
+#pragma once
+
+#include <autoconf.h>
+#include <stdint.h>
+
+static inline uint64_t debug_read_cycles(void) __attribute__((no_instrument_function));
+static inline uint64_t debug_read_cycles(void)
+{
+#if defined(CONFIG_ARCH_X86)
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t) high << 32) | low;
+#elif defined(CONFIG_ARCH_AARCH64) && defined(CONFIG_EXPORT_PMU_USER)
+    uint64_t count;
+    asm volatile("mrs %0, pmccntr_el0" : "=r"(count));
+    return count;
+#elif defined(CONFIG_ARCH_AARCH64) && defined(CONFIG_EXPORT_VCNT_USER)
+    uint64_t count;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(count));
+    return count;
+#elif defined(CONFIG_ARCH_AARCH32) && defined(CONFIG_EXPORT_PMU_USER)
+    uint32_t count;
+    asm volatile("mrc p15, 0, %0, c9, c13, 0" : "=r"(count));
+    return count;
+#elif defined(CONFIG_ARCH_RISCV) && defined(CONFIG_ARCH_RISCV64)
+    uint64_t count;
+    asm volatile("rdcycle %0" : "=r"(count));
+    return count;
+#else
+    return 0;
+#endif
+}
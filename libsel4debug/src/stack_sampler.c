@@ -0,0 +1,116 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <stdio.h>
+#include <string.h>
+#include <sel4/sel4.h>
+#include <sel4debug/arch/registers.h>
+#include <sel4debug/stack_sampler.h>
+#include <sel4debug/stack_trace.h>
+#include <utils/util.h>
+#include <utils/zf_log.h>
+
+void sel4debug_stack_sampler_init(sel4debug_stack_sampler_t *sampler, seL4_CPtr tcb, bool suspend,
+                                  seL4_Word stack_base, size_t stack_size, void *stack_mapping)
+{
+    sampler->tcb = tcb;
+    sampler->suspend = suspend;
+    sampler->stack_base = stack_base;
+    sampler->stack_size = stack_size;
+    sampler->stack_mapping = stack_mapping;
+    sel4debug_stack_sampler_reset(sampler);
+}
+
+void sel4debug_stack_sampler_reset(sel4debug_stack_sampler_t *sampler)
+{
+    sampler->dropped = 0;
+    sampler->num_stacks = 0;
+    for (int i = 0; i < SEL4DEBUG_STACK_SAMPLER_STACKS; i++) {
+        sampler->stacks[i].count = 0;
+    }
+}
+
+static uint32_t hash_stack(void **pcs, int depth)
+{
+    /* FNV-1a over the addresses */
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uint32_t)(uintptr_t) pcs[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Keep one slot free, so that looking up a stack that isn't there ends. */
+static int record_stack(sel4debug_stack_sampler_t *sampler, void **pcs, int depth)
+{
+    uint32_t hash = hash_stack(pcs, depth);
+    size_t i = hash % SEL4DEBUG_STACK_SAMPLER_STACKS;
+
+    for (;; i = (i + 1) % SEL4DEBUG_STACK_SAMPLER_STACKS) {
+        sel4debug_stack_sample_t *stack = &sampler->stacks[i];
+        if (stack->count == 0) {
+            if (sampler->num_stacks == SEL4DEBUG_STACK_SAMPLER_STACKS - 1) {
+                return -1;
+            }
+            stack->hash = hash;
+            stack->depth = depth;
+            memcpy(stack->pcs, pcs, depth * sizeof(*pcs));
+            stack->count = 1;
+            sampler->num_stacks++;
+            return 0;
+        }
+        if (stack->hash == hash && stack->depth == depth
+            && memcmp(stack->pcs, pcs, depth * sizeof(*pcs)) == 0) {
+            stack->count++;
+            return 0;
+        }
+    }
+}
+
+int sel4debug_stack_sampler_sample(sel4debug_stack_sampler_t *sampler)
+{
+    seL4_UserContext context;
+    const int num_regs = sizeof(context) / sizeof(seL4_Word);
+    int error = seL4_TCB_ReadRegisters(sampler->tcb, sampler->suspend, 0, num_regs, &context);
+    if (error) {
+        ZF_LOGE("Failed to read registers for tcb 0x%"SEL4_PRIx_word", error %d",
+                sampler->tcb, error);
+        sampler->dropped++;
+        return -1;
+    }
+
+    void *pcs[SEL4DEBUG_STACK_SAMPLER_DEPTH];
+    pcs[0] = (void *) SEL4DEBUG_CONTEXT_PC(&context);
+    int depth = 1 + sel4debug_stack_walk_mapped(SEL4DEBUG_CONTEXT_FP(&context), sampler->stack_base,
+                                                sampler->stack_size, sampler->stack_mapping, pcs + 1,
+                                                SEL4DEBUG_STACK_SAMPLER_DEPTH - 1);
+    if (sampler->suspend) {
+        error = seL4_TCB_Resume(sampler->tcb);
+        ZF_LOGE_IF(error, "Failed to resume tcb 0x%"SEL4_PRIx_word", error %d", sampler->tcb, error);
+    }
+
+    if (record_stack(sampler, pcs, depth) != 0) {
+        sampler->dropped++;
+        return -1;
+    }
+    return 0;
+}
+
+void sel4debug_stack_sampler_dump(sel4debug_stack_sampler_t *sampler)
+{
+    for (int i = 0; i < SEL4DEBUG_STACK_SAMPLER_STACKS; i++) {
+        sel4debug_stack_sample_t *stack = &sampler->stacks[i];
+        if (stack->count == 0) {
+            continue;
+        }
+        for (int j = stack->depth - 1; j >= 0; j--) {
+            printf("%p%s", stack->pcs[j], j > 0 ? ";" : "");
+        }
+        printf(" %zu\n", stack->count);
+    }
+    printf("# %zu samples dropped\n", sampler->dropped);
+}
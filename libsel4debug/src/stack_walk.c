@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sel4/sel4.h>
+#include <sel4debug/arch/registers.h>
+#include <sel4debug/stack_trace.h>
+#include <utils/util.h>
+#include <utils/zf_log.h>
+
+/* Where the frame record, which holds the caller's frame pointer and the
+ * return address, is relative to the frame pointer on each architecture.
+ */
+#if defined(CONFIG_ARCH_X86) || defined(CONFIG_ARCH_AARCH64)
+#define FRAME_RECORD_OFFSET 0
+#elif defined(CONFIG_ARCH_RISCV)
+/* s0 points just past the record */
+#define FRAME_RECORD_OFFSET (-2 * (long) sizeof(seL4_Word))
+#endif
+
+/* Frames bigger than this are taken as the end of the stack, as a stale frame
+ * pointer is likelier than a frame this large. */
+#define STACK_WALK_MAX_FRAME BIT(20)
+
+/* Depth printed by sel4debug_dump_backtrace */
+#define DUMP_BACKTRACE_DEPTH 32
+
+int sel4debug_stack_walk_mapped(seL4_Word fp, seL4_Word stack_base, size_t stack_size, void *mapping,
+                                void **buffer, int size)
+{
+    int i = 0;
+
+#ifdef FRAME_RECORD_OFFSET
+    while (i < size && fp != 0 && IS_ALIGNED(fp, seL4_WordSizeBits)) {
+        seL4_Word record = fp + FRAME_RECORD_OFFSET;
+        /* Only read records that are wholly in the stack. */
+        if (record < stack_base || record - stack_base > stack_size - 2 * sizeof(seL4_Word)) {
+            break;
+        }
+        seL4_Word *local = mapping + (record - stack_base);
+        seL4_Word ret = local[1];
+        if (ret == 0) {
+            break;
+        }
+        buffer[i] = (void *) ret;
+        i++;
+        /* Each frame is further up the stack than the one it called, so
+         * anything else is a frame pointer that isn't one. */
+        seL4_Word next = local[0];
+        if (next <= fp || next - fp > STACK_WALK_MAX_FRAME) {
+            break;
+        }
+        fp = next;
+    }
+#endif
+
+    return i;
+}
+
+int sel4debug_stack_walk(seL4_Word fp, void **buffer, int size)
+{
+    /* The current address space, mapped at itself */
+    return sel4debug_stack_walk_mapped(fp, 0, SIZE_MAX, NULL, buffer, size);
+}
+
+int sel4debug_thread_backtrace(seL4_CPtr tcb, void **buffer, int size)
+{
+    seL4_UserContext context;
+    const int num_regs = sizeof(context) / sizeof(seL4_Word);
+    int error = seL4_TCB_ReadRegisters(tcb, false, 0, num_regs, &context);
+    if (error) {
+        ZF_LOGE("Failed to read registers for tcb 0x%"SEL4_PRIx_word", error %d",
+                tcb, error);
+        return -1;
+    }
+    if (size < 1) {
+        return 0;
+    }
+
+    buffer[0] = (void *) SEL4DEBUG_CONTEXT_PC(&context);
+    return 1 + sel4debug_stack_walk(SEL4DEBUG_CONTEXT_FP(&context), buffer + 1, size - 1);
+}
+
+void sel4debug_dump_backtrace(seL4_CPtr tcb)
+{
+    sel4debug_dump_backtrace_prefix(tcb, "");
+}
+
+void sel4debug_dump_backtrace_prefix(seL4_CPtr tcb, char *prefix)
+{
+    void *buffer[DUMP_BACKTRACE_DEPTH];
+    int depth = sel4debug_thread_backtrace(tcb, buffer, ARRAY_SIZE(buffer));
+    if (depth < 0) {
+        return;
+    }
+
+    printf("%sBacktrace:\n", prefix);
+    for (int i = 0; i < depth; i++) {
+        printf("%s#%d %p\n", prefix, i, buffer[i]);
+    }
+}
@@ -5,9 +5,19 @@
  */
 
 #include <autoconf.h>
+#include <sel4/types.h>
+
+/* Don't instrument seL4_GetIPCBuffer as it's called in the __cyg_profile_func_*
+ * functions below and we don't want to recurse. See backtrace.c.
+ */
+LIBSEL4_INLINE_FUNC seL4_IPCBuffer *seL4_GetIPCBuffer(void) __attribute__((no_instrument_function));
+
+#include <stdint.h>
 #include <sel4debug/gen_config.h>
 #include <sel4debug/debug.h>
 #include <sel4debug/instrumentation.h>
+#include <utils/util.h>
+#include "cycles-internal.h"
 
 #ifdef CONFIG_LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_TRACE
 
@@ -33,3 +43,101 @@ void __cyg_profile_func_exit(void *func, void *caller)
 }
 
 #endif
+
+#ifdef CONFIG_LIBSEL4DEBUG_FUNCTION_INSTRUMENTATION_RING
+
+/* Function entry and exit recording into a per-thread ring of binary records,
+ * which costs a few stores per call rather than a printf. The ring lives in
+ * the area following the IPC buffer, like the backtrace stack in backtrace.c,
+ * with the same assumptions: that the area is mapped, not used for anything
+ * else, and zeroed when the thread starts.
+ *
+ *   |     records     |
+ *   +-----------------+
+ *   |      head       |
+ *   +-----------------+ TRACE_BASE
+ *
+ * head counts every record ever written, so the newest is at (head - 1) modulo
+ * the number of records. The timestamp is from debug_read_cycles. Enable this
+ * with the same CFLAGS as the printing trace above, and read the dumps with
+ * tools/function_trace.py.
+ */
+#define TRACE_BASE(ipc_buffer) (((void *)(ipc_buffer)) + sizeof(seL4_IPCBuffer))
+#define TRACE_ENTRIES CONFIG_LIBSEL4DEBUG_FUNCTION_TRACE_ENTRIES
+
+compile_time_assert(trace_entries_power_of_2, (TRACE_ENTRIES & (TRACE_ENTRIES - 1)) == 0);
+
+/* set in the timestamp of a function exit */
+#define TRACE_EXIT BIT_ULL(63)
+
+typedef struct {
+    uint64_t timestamp;
+    void *func;
+    void *caller;
+} trace_record_t;
+
+typedef struct {
+    seL4_Word head;
+    trace_record_t records[TRACE_ENTRIES];
+} trace_ring_t;
+
+compile_time_assert(trace_ring_fits, sizeof(seL4_IPCBuffer) + sizeof(trace_ring_t) <= BIT(seL4_PageBits));
+
+static inline void trace_record(void *func, void *caller, uint64_t exit) __attribute__((no_instrument_function));
+static inline void trace_record(void *func, void *caller, uint64_t exit)
+{
+    seL4_IPCBuffer *ipc_buffer = seL4_GetIPCBuffer();
+    if (ipc_buffer == NULL) {
+        /* No IPC buffer has been set up yet, so there is nowhere to record. */
+        return;
+    }
+    trace_ring_t *ring = TRACE_BASE(ipc_buffer);
+    trace_record_t *record = &ring->records[ring->head % TRACE_ENTRIES];
+
+    record->timestamp = (debug_read_cycles() & ~TRACE_EXIT) | exit;
+    record->func = func;
+    record->caller = caller;
+    ring->head++;
+}
+
+void __cyg_profile_func_enter(void *func, void *caller)
+{
+    trace_record(func, caller, 0);
+}
+
+void __cyg_profile_func_exit(void *func, void *caller)
+{
+    trace_record(func, caller, TRACE_EXIT);
+}
+
+void debug_function_trace_dump(void *ipc_buffer)
+{
+    if (ipc_buffer == NULL) {
+        ipc_buffer = seL4_GetIPCBuffer();
+    }
+    trace_ring_t *ring = TRACE_BASE(ipc_buffer);
+    /* Read once, so that records the thread makes while this prints are left
+     * out rather than printed half written. */
+    seL4_Word head = ring->head;
+    seL4_Word start = head > TRACE_ENTRIES ? head - TRACE_ENTRIES : 0;
+
+    debug_safe_printf("FTRACE BEGIN %p %zu\n", ipc_buffer, (size_t)(head - start));
+    for (seL4_Word i = start; i != head; i++) {
+        trace_record_t *record = &ring->records[i % TRACE_ENTRIES];
+        debug_safe_printf("FTRACE %c %llu %p %p\n", (record->timestamp & TRACE_EXIT) ? 'X' : 'E',
+                          (unsigned long long)(record->timestamp & ~TRACE_EXIT), record->func,
+                          record->caller);
+    }
+    debug_safe_printf("FTRACE END %p\n", ipc_buffer);
+}
+
+void debug_function_trace_reset(void *ipc_buffer)
+{
+    if (ipc_buffer == NULL) {
+        ipc_buffer = seL4_GetIPCBuffer();
+    }
+    trace_ring_t *ring = TRACE_BASE(ipc_buffer);
+    ring->head = 0;
+}
+
+#endif
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+"""
+Build a per-function profile from the function trace rings printed by
+debug_function_trace_dump in libsel4debug.
+
+Each function gets its calls, its inclusive time, from entry to exit, and its
+exclusive time, which leaves out the inclusive time of the functions it called.
+Times are in whatever counter the trace read, normally cycles. Calls whose
+entry was overwritten in the ring, or which had not returned when it was
+dumped, are left out.
+"""
+import argparse
+import bisect
+import collections
+import re
+import subprocess
+import sys
+
+RECORD = re.compile(r'FTRACE ([EX]) (\d+) (\S+) (\S+)')
+BEGIN = re.compile(r'FTRACE BEGIN (\S+)')
+
+
+class Function:
+    def __init__(self):
+        self.calls = 0
+        self.inclusive = 0
+        self.exclusive = 0
+        # frames of this function on the stack, so recursion is only counted once
+        self.active = 0
+
+
+class Frame:
+    def __init__(self, func, start):
+        self.func = func
+        self.start = start
+        self.children = 0
+
+
+def parse_dumps(f):
+    '''Yield the records of each dump in f, as a list of (exit, timestamp, func).'''
+    records = None
+    for line in f:
+        if BEGIN.search(line):
+            records = []
+            continue
+        if 'FTRACE END' in line and records is not None:
+            yield records
+            records = None
+            continue
+        m = RECORD.search(line)
+        if m and records is not None:
+            records.append((m.group(1) == 'X', int(m.group(2)), int(m.group(3), 16)))
+    if records:
+        # a dump cut off by a crash still has something to say
+        yield records
+
+
+def profile(dumps, counter_mask):
+    functions = collections.defaultdict(Function)
+    for records in dumps:
+        stack = []
+        for exit, timestamp, func in records:
+            if not exit:
+                stack.append(Frame(func, timestamp))
+                functions[func].active += 1
+                continue
+            # Unwind to the matching entry. An exit with no entry on the stack
+            # is from a call made before the oldest record.
+            if not any(frame.func == func for frame in stack):
+                stack = []
+                continue
+            while stack:
+                frame = stack.pop()
+                functions[frame.func].active -= 1
+                if frame.func == func:
+                    break
+            elapsed = (timestamp - frame.start) & counter_mask
+            function = functions[func]
+            function.calls += 1
+            function.exclusive += elapsed - frame.children
+            if function.active == 0:
+                function.inclusive += elapsed
+            if stack:
+                stack[-1].children += elapsed
+        for frame in stack:
+            functions[frame.func].active -= 1
+    return functions
+
+
+class Symbols:
+    def __init__(self, elf):
+        self.addresses = []
+        self.names = []
+        if elf is None:
+            return
+        out = subprocess.check_output(['nm', '-C', '--defined-only', elf], universal_newlines=True)
+        symbols = []
+        for line in out.splitlines():
+            parts = line.split(None, 2)
+            if len(parts) == 3 and parts[1] in 'tTwW':
+                symbols.append((int(parts[0], 16), parts[2]))
+        symbols.sort()
+        self.addresses = [address for address, _ in symbols]
+        self.names = [name for _, name in symbols]
+
+    def name(self, address):
+        i = bisect.bisect_right(self.addresses, address) - 1
+        if i < 0 or self.addresses[i] != address:
+            return '0x%x' % address
+        return self.names[i]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('input', nargs='?', type=argparse.FileType('r'), default=sys.stdin,
+                        help='log with the output of debug_function_trace_dump (default: stdin)')
+    parser.add_argument('--elf', help='image to name the functions from')
+    parser.add_argument('--counter-bits', type=int, default=63,
+                        help='width of the counter, for counters that wrap (default: 63)')
+    parser.add_argument('--sort', choices=['inclusive', 'exclusive', 'calls'], default='exclusive')
+    args = parser.parse_args()
+
+    functions = profile(parse_dumps(args.input), (1 << args.counter_bits) - 1)
+    symbols = Symbols(args.elf)
+    print('%12s %16s %16s  %s' % ('calls', 'inclusive', 'exclusive', 'function'))
+    for func, function in sorted(functions.items(), key=lambda item: getattr(item[1], args.sort),
+                                 reverse=True):
+        if function.calls:
+            print('%12d %16d %16d  %s' % (function.calls, function.inclusive, function.exclusive,
+                                          symbols.name(func)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Emulation of the futex syscall, which musl's pthread mutexes, condition
+ * variables and joins block with.
+ *
+ * Waiters are kept in a table of buckets that addresses hash to, as for
+ * sync_wait in libsel4sync, but each waiter records the word and bitset it
+ * waits on so that FUTEX_WAKE only wakes the waiters it matches. A thread
+ * blocks on its own notification, given with muslcsys_futex_register_thread,
+ * and a thread that has none yields until it is woken instead. FUTEX_WAIT,
+ * FUTEX_WAIT_BITSET, FUTEX_WAKE, FUTEX_WAKE_BITSET and FUTEX_REQUEUE are
+ * supported, with timeouts measured on CLOCK_MONOTONIC. */
+
+#include <autoconf.h>
+#include <sel4muslcsys/gen_config.h>
+#include <sel4/sel4.h>
+#include <platsupport/ltimer.h>
+
+/* Give the calling thread a notification to block on in futex waits, and a
+ * timer for waits with a timeout.
+ * @param notification  Notification only this thread waits on, or seL4_CapNull
+ *                      to yield while waiting.
+ * @param ltimer        Timer that signals notification when a timeout set on
+ *                      it fires, such as an rpc ltimer of the time server whose
+ *                      client notification is notification, or NULL if the
+ *                      thread never waits with a timeout. The thread's own
+ *                      timeout on it is replaced by each timed wait, and by
+ *                      each sleep, see muslcsys/time.h. */
+void muslcsys_futex_register_thread(seL4_CPtr notification, ltimer_t *ltimer);
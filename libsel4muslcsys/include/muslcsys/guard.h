@@ -0,0 +1,26 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Mappings from the vspace given to muslcsys for a dynamic morecore, each
+ * followed by a page that is reserved but never mapped, so that running off
+ * the end of the mapping faults straight away. Used by the guard mode of the
+ * sel4debug allocation instrumentation. */
+
+#include <stddef.h>
+
+/* Map fresh pages to hold bytes, followed by an unmapped guard page
+ * @param bytes Size of the mapping, rounded up to whole pages.
+ * @return The page aligned start of the mapping, or NULL if there is no vspace,
+ *         as with a static morecore, or it could not be mapped. */
+void *muslcsys_guarded_map(size_t bytes);
+
+/* Unmap and free the pages of a mapping from muslcsys_guarded_map, along with
+ * its guard page
+ * @param vaddr Start of the mapping.
+ * @param bytes Size the mapping was made with. */
+void muslcsys_guarded_unmap(void *vaddr, size_t bytes);
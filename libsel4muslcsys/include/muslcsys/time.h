@@ -0,0 +1,34 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Emulation of clock_gettime, gettimeofday, nanosleep and clock_nanosleep.
+ *
+ * CLOCK_MONOTONIC is read from a page shared by the time server where there
+ * is one, which reads a calibrated counter without entering the kernel, and
+ * from an ltimer otherwise. CLOCK_REALTIME adds the offset the time server
+ * publishes in the page to it, and is the same as CLOCK_MONOTONIC without a
+ * page.
+ *
+ * Sleeps shorter than a spin threshold spin on the clock. Longer ones set a
+ * timeout for the threshold before the end on the thread's timer given with
+ * muslcsys_futex_register_thread, block on the thread's notification and spin
+ * for the rest, or yield until the end if the thread has no timer. */
+
+#include <autoconf.h>
+#include <sel4muslcsys/gen_config.h>
+#include <stdint.h>
+#include <platsupport/ltimer.h>
+#include <sel4utils/time_server/client.h>
+
+/* Give the time syscalls a clock
+ * @param ltimer            Timer to read the time from when there is no page,
+ *                          such as an rpc ltimer of the time server.
+ * @param time_page         Page shared by the time server, or NULL.
+ * @param spin_threshold_ns Sleeps, and the ends of sleeps, shorter than this
+ *                          are spun for. */
+void muslcsys_time_init(ltimer_t *ltimer, sel4utils_time_page_t *time_page, uint64_t spin_threshold_ns);
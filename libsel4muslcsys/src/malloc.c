@@ -0,0 +1,470 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* A malloc for multi threaded programs, used in place of musl's when LibSel4MuslcSysMalloc is
+ * set, by wrapping the allocation functions at link time the same way libsel4debug's alloc.c
+ * does. The two cannot be used together.
+ *
+ * Small allocations come from slabs of one size class each. Every thread has its own slabs
+ * of each class, so allocating and freeing on the owning thread never takes a lock. Another
+ * thread freeing an object pushes it onto the slab's remote free list, which the owner takes
+ * over in one go when the slab runs out. Slabs are carved from arenas mapped with mmap, and
+ * slabs that become empty go back to a pool shared by all threads. Allocations too large for
+ * a slab are mapped on their own.
+ *
+ * Slabs and large allocations are aligned to SLAB_SIZE with their header at the start, so
+ * free finds the header of a pointer by rounding it down. Slabs stay owned by a thread after
+ * it exits, and what is freed to them afterwards is never reused, so threads that allocate
+ * should be long lived.
+ */
+
+/* defining _GNU_SOURCE to make certain constants appear in muslc. This is rather hacky */
+#define _GNU_SOURCE
+
+#include <autoconf.h>
+#include <sel4muslcsys/gen_config.h>
+
+#ifdef CONFIG_LIB_SEL4_MUSLC_SYS_MALLOC
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <sel4/sel4.h>
+#include <utils/util.h>
+
+#define SLAB_BITS 16
+#define SLAB_SIZE BIT(SLAB_BITS)
+#define SLABS_PER_ARENA 32
+#define MIN_ALIGN 16
+/* objects in a slab start on this boundary */
+#define SLAB_DATA_ALIGN 64
+
+#define SLAB_MAGIC 0x51ab51abu
+#define LARGE_MAGIC 0x1a26e1a2u
+
+static const uint32_t class_sizes[] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+    6144, 8192, 12288, 16384
+};
+#define NUM_CLASSES ARRAY_SIZE(class_sizes)
+#define MAX_SMALL 16384
+/* classes up to here are every MIN_ALIGN bytes */
+#define LINEAR_CLASSES 8
+
+typedef struct free_obj {
+    struct free_obj *next;
+} free_obj_t;
+
+struct thread_cache;
+
+typedef struct slab {
+    uint32_t magic;
+    uint32_t size_class;
+    uint32_t obj_size;
+    uint32_t capacity;
+    /* objects handed out and not yet back on local_free */
+    uint32_t used;
+    /* objects from here on have never been handed out */
+    uint32_t bump;
+    struct thread_cache *owner;
+    /* only touched by the owner */
+    free_obj_t *local_free;
+    /* pushed to by other threads, taken all at once by the owner */
+    free_obj_t *remote_free;
+    /* in the owner's list of the class, or the pool of empty slabs */
+    struct slab *next;
+    struct slab *prev;
+} slab_t;
+
+#define SLAB_DATA ROUND_UP(sizeof(slab_t), SLAB_DATA_ALIGN)
+
+typedef struct large {
+    uint32_t magic;
+    /* from the header to the allocation */
+    size_t offset;
+    size_t map_len;
+} large_t;
+
+typedef struct thread_cache {
+    /* slab allocated from, then every other slab the thread owns, of each class */
+    slab_t *current[NUM_CLASSES];
+    slab_t *others[NUM_CLASSES];
+} thread_cache_t;
+
+static __thread thread_cache_t thread_cache;
+
+/* empty slabs and the unused part of the last arena, protected by pool_lock */
+static volatile int pool_lock;
+static slab_t *pool;
+static uintptr_t arena_next;
+static uintptr_t arena_end;
+
+static void lock_pool(void)
+{
+    while (__atomic_exchange_n(&pool_lock, 1, __ATOMIC_ACQUIRE)) {
+        seL4_Yield();
+    }
+}
+
+static void unlock_pool(void)
+{
+    __atomic_store_n(&pool_lock, 0, __ATOMIC_RELEASE);
+}
+
+static unsigned int size_to_class(size_t size)
+{
+    if (size <= LINEAR_CLASSES * MIN_ALIGN) {
+        return size == 0 ? 0 : (size - 1) / MIN_ALIGN;
+    }
+    unsigned int class = LINEAR_CLASSES;
+    while (class_sizes[class] < size) {
+        class++;
+    }
+    return class;
+}
+
+/* Only a dynamic morecore can unmap, the static one would complain about every call */
+static void unmap(void *addr, size_t len)
+{
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_BYTES == 0
+    extern char *morecore_area;
+    if (morecore_area == NULL) {
+        munmap(addr, len);
+    }
+#endif
+}
+
+/* Map len bytes aligned to SLAB_SIZE, trimming what mmap gives beyond that */
+static void *map_aligned(size_t len)
+{
+    len = ROUND_UP(len, PAGE_SIZE_4K);
+    if (len > SIZE_MAX - SLAB_SIZE) {
+        return NULL;
+    }
+    void *map = mmap(NULL, len + SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    uintptr_t start = (uintptr_t) map;
+    uintptr_t aligned = ROUND_UP(start, SLAB_SIZE);
+    if (aligned != start) {
+        unmap(map, aligned - start);
+    }
+    if (start + SLAB_SIZE != aligned) {
+        unmap((void *)(aligned + len), start + SLAB_SIZE - aligned);
+    }
+    return (void *) aligned;
+}
+
+static slab_t *slab_new(unsigned int class)
+{
+    slab_t *slab;
+
+    lock_pool();
+    if (pool != NULL) {
+        slab = pool;
+        pool = slab->next;
+    } else {
+        if (arena_next == arena_end) {
+            void *arena = map_aligned(SLABS_PER_ARENA * SLAB_SIZE);
+            if (arena == NULL) {
+                unlock_pool();
+                return NULL;
+            }
+            arena_next = (uintptr_t) arena;
+            arena_end = arena_next + SLABS_PER_ARENA * SLAB_SIZE;
+        }
+        slab = (slab_t *) arena_next;
+        arena_next += SLAB_SIZE;
+    }
+    unlock_pool();
+
+    slab->magic = SLAB_MAGIC;
+    slab->size_class = class;
+    slab->obj_size = class_sizes[class];
+    slab->capacity = (SLAB_SIZE - SLAB_DATA) / slab->obj_size;
+    slab->used = 0;
+    slab->bump = 0;
+    slab->owner = &thread_cache;
+    slab->local_free = NULL;
+    slab->remote_free = NULL;
+    slab->next = NULL;
+    slab->prev = NULL;
+    return slab;
+}
+
+static void slab_release(slab_t *slab)
+{
+    slab->magic = 0;
+    lock_pool();
+    slab->next = pool;
+    pool = slab;
+    unlock_pool();
+}
+
+static void others_push(slab_t *slab)
+{
+    slab_t **head = &thread_cache.others[slab->size_class];
+
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void others_remove(slab_t *slab)
+{
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        thread_cache.others[slab->size_class] = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/* Move objects other threads have freed onto the owner's free list */
+static void collect_remote(slab_t *slab)
+{
+    free_obj_t *obj = __atomic_exchange_n(&slab->remote_free, NULL, __ATOMIC_ACQUIRE);
+
+    while (obj != NULL) {
+        free_obj_t *next = obj->next;
+        obj->next = slab->local_free;
+        slab->local_free = obj;
+        slab->used--;
+        obj = next;
+    }
+}
+
+static void *slab_alloc(slab_t *slab)
+{
+    if (slab->local_free == NULL && slab->bump == slab->capacity) {
+        collect_remote(slab);
+    }
+    if (slab->local_free != NULL) {
+        free_obj_t *obj = slab->local_free;
+        slab->local_free = obj->next;
+        slab->used++;
+        return obj;
+    }
+    if (slab->bump < slab->capacity) {
+        void *obj = (void *)((uintptr_t) slab + SLAB_DATA + slab->bump * slab->obj_size);
+        slab->bump++;
+        slab->used++;
+        return obj;
+    }
+    return NULL;
+}
+
+static void *small_alloc(unsigned int class)
+{
+    slab_t *current = thread_cache.current[class];
+
+    if (current != NULL) {
+        void *obj = slab_alloc(current);
+        if (obj != NULL) {
+            return obj;
+        }
+    }
+
+    /* Find another slab with room, which only happens once per slab's worth of allocations */
+    slab_t *slab;
+    for (slab = thread_cache.others[class]; slab != NULL; slab = slab->next) {
+        collect_remote(slab);
+        if (slab->local_free != NULL || slab->bump < slab->capacity) {
+            others_remove(slab);
+            break;
+        }
+    }
+    if (slab == NULL) {
+        slab = slab_new(class);
+        if (slab == NULL) {
+            return NULL;
+        }
+    }
+    if (current != NULL) {
+        others_push(current);
+    }
+    thread_cache.current[class] = slab;
+    return slab_alloc(slab);
+}
+
+static void slab_free(slab_t *slab, void *ptr)
+{
+    free_obj_t *obj = ptr;
+
+    if (slab->owner != &thread_cache) {
+        obj->next = __atomic_load_n(&slab->remote_free, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&slab->remote_free, &obj->next, obj, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        return;
+    }
+
+    obj->next = slab->local_free;
+    slab->local_free = obj;
+    slab->used--;
+    if (slab->used == 0 && slab != thread_cache.current[slab->size_class]) {
+        /* nothing on it is in use, so no other thread can be freeing to it */
+        others_remove(slab);
+        slab_release(slab);
+    }
+}
+
+static void *large_alloc(size_t size, size_t align)
+{
+    size_t offset = ROUND_UP(sizeof(large_t), MAX(align, (size_t) MIN_ALIGN));
+    if (offset >= SLAB_SIZE || size > SIZE_MAX - offset - SLAB_SIZE - PAGE_SIZE_4K) {
+        return NULL;
+    }
+
+    size_t map_len = ROUND_UP(offset + size, PAGE_SIZE_4K);
+    large_t *large = map_aligned(map_len);
+    if (large == NULL) {
+        return NULL;
+    }
+    large->magic = LARGE_MAGIC;
+    large->offset = offset;
+    large->map_len = map_len;
+    return (void *)((uintptr_t) large + offset);
+}
+
+/* Header of an allocation, which is a slab_t or large_t told apart by their magic */
+static uint32_t *header_of(void *ptr)
+{
+    return (uint32_t *) ROUND_DOWN((uintptr_t) ptr, SLAB_SIZE);
+}
+
+static size_t usable_size(void *ptr)
+{
+    uint32_t *header = header_of(ptr);
+
+    if (*header == SLAB_MAGIC) {
+        return ((slab_t *) header)->obj_size;
+    }
+    large_t *large = (large_t *) header;
+    return large->map_len - large->offset;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    void *ptr = size <= MAX_SMALL ? small_alloc(size_to_class(size)) : large_alloc(size, MIN_ALIGN);
+    if (ptr == NULL) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    uint32_t *header = header_of(ptr);
+    if (*header == SLAB_MAGIC) {
+        slab_free((slab_t *) header, ptr);
+    } else if (*header == LARGE_MAGIC) {
+        large_t *large = (large_t *) header;
+        large->magic = 0;
+        unmap(large, large->map_len);
+    } else {
+        ZF_LOGE("Freeing %p, which was not allocated by this malloc", ptr);
+        assert(!"invalid free");
+    }
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *ptr = __wrap_malloc(nmemb * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return __wrap_malloc(size);
+    }
+    if (size == 0) {
+        __wrap_free(ptr);
+        return NULL;
+    }
+
+    size_t old_size = usable_size(ptr);
+    if (size <= old_size) {
+        return ptr;
+    }
+    void *new_ptr = __wrap_malloc(size);
+    if (new_ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size);
+        __wrap_free(ptr);
+    }
+    return new_ptr;
+}
+
+int __wrap_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || !IS_POWER_OF_2(alignment)) {
+        return EINVAL;
+    }
+
+    void *ptr;
+    if (alignment <= MIN_ALIGN) {
+        ptr = __wrap_malloc(size);
+    } else if (alignment <= SLAB_DATA_ALIGN && size <= MAX_SMALL) {
+        /* objects of a class that is a multiple of the alignment are aligned */
+        unsigned int class = size_to_class(size);
+        while (class < NUM_CLASSES && class_sizes[class] % alignment != 0) {
+            class++;
+        }
+        ptr = class < NUM_CLASSES ? small_alloc(class) : large_alloc(size, alignment);
+    } else {
+        ptr = large_alloc(size, alignment);
+    }
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size)
+{
+    void *ptr;
+    int error = __wrap_posix_memalign(&ptr, alignment, size);
+    if (error) {
+        errno = error;
+        return NULL;
+    }
+    return ptr;
+}
+
+void *__wrap_memalign(size_t alignment, size_t size)
+{
+    return __wrap_aligned_alloc(alignment, size);
+}
+
+size_t __wrap_malloc_usable_size(void *ptr)
+{
+    return ptr == NULL ? 0 : usable_size(ptr);
+}
+
+#endif /* CONFIG_LIB_SEL4_MUSLC_SYS_MALLOC */
@@ -0,0 +1,337 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4muslcsys/gen_config.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sel4/sel4.h>
+#include <utils/util.h>
+#include <platsupport/ltimer.h>
+
+#include <muslcsys/futex.h>
+#include "syscalls.h"
+
+/* musl does not export the futex constants */
+#define MUSLCSYS_FUTEX_WAIT 0
+#define MUSLCSYS_FUTEX_WAKE 1
+#define MUSLCSYS_FUTEX_REQUEUE 3
+#define MUSLCSYS_FUTEX_WAIT_BITSET 9
+#define MUSLCSYS_FUTEX_WAKE_BITSET 10
+#define MUSLCSYS_FUTEX_PRIVATE_FLAG 128
+#define MUSLCSYS_FUTEX_CLOCK_REALTIME 256
+#define MUSLCSYS_FUTEX_BITSET_MATCH_ANY 0xffffffffu
+
+/* log2 of the number of buckets in the table */
+#define FUTEX_BUCKET_BITS 6
+#define FUTEX_BUCKETS BIT(FUTEX_BUCKET_BITS)
+
+/* Lives on the stack of a waiting thread, in the list of its bucket */
+typedef struct futex_waiter {
+    volatile int *addr;
+    uint32_t bitset;
+    seL4_CPtr notification;
+    /* set once the waiter has been taken off the list by a wake */
+    volatile bool woken;
+    struct futex_waiter *prev;
+    struct futex_waiter *next;
+} futex_waiter_t;
+
+typedef struct futex_bucket {
+    /* protects the list, held for a few instructions at a time */
+    volatile int lock;
+    futex_waiter_t *waiters;
+} futex_bucket_t;
+
+static futex_bucket_t buckets[FUTEX_BUCKETS];
+
+static __thread seL4_CPtr thread_notification;
+static __thread ltimer_t *thread_ltimer;
+
+void muslcsys_futex_register_thread(seL4_CPtr notification, ltimer_t *ltimer)
+{
+    thread_notification = notification;
+    thread_ltimer = ltimer;
+}
+
+seL4_CPtr sys_futex_thread_notification(void)
+{
+    return thread_notification;
+}
+
+ltimer_t *sys_futex_thread_ltimer(void)
+{
+    return thread_ltimer;
+}
+
+static futex_bucket_t *bucket_of(volatile int *addr)
+{
+    uintptr_t key = (uintptr_t)addr / sizeof(int);
+
+    /* Fibonacci hashing, so that neighbouring words spread over the table. */
+#if UINTPTR_MAX > UINT32_MAX
+    key *= UINT64_C(0x9E3779B97F4A7C15);
+#else
+    key *= UINT32_C(0x9E3779B9);
+#endif
+    return &buckets[key >> (sizeof(uintptr_t) * 8 - FUTEX_BUCKET_BITS)];
+}
+
+static void bucket_lock(futex_bucket_t *bucket)
+{
+    while (__atomic_exchange_n(&bucket->lock, 1, __ATOMIC_ACQUIRE)) {
+        seL4_Yield();
+    }
+}
+
+static void bucket_unlock(futex_bucket_t *bucket)
+{
+    __atomic_store_n(&bucket->lock, 0, __ATOMIC_RELEASE);
+}
+
+static void bucket_insert(futex_bucket_t *bucket, futex_waiter_t *waiter)
+{
+    waiter->prev = NULL;
+    waiter->next = bucket->waiters;
+    if (bucket->waiters != NULL) {
+        bucket->waiters->prev = waiter;
+    }
+    bucket->waiters = waiter;
+}
+
+static void bucket_remove(futex_bucket_t *bucket, futex_waiter_t *waiter)
+{
+    if (waiter->prev != NULL) {
+        waiter->prev->next = waiter->next;
+    } else {
+        bucket->waiters = waiter->next;
+    }
+    if (waiter->next != NULL) {
+        waiter->next->prev = waiter->prev;
+    }
+}
+
+/* Take a waiter off its list and let it run. Once woken is set the waiter can
+ * return and its memory go away, so it is the last thing touched. */
+static void wake_waiter(futex_bucket_t *bucket, futex_waiter_t *waiter)
+{
+    seL4_CPtr notification = waiter->notification;
+
+    bucket_remove(bucket, waiter);
+    __atomic_store_n(&waiter->woken, true, __ATOMIC_RELEASE);
+    if (notification != seL4_CapNull) {
+        seL4_Signal(notification);
+    }
+}
+
+/* Lock the bucket a waiter is in, which futex_requeue can change until it is
+ * locked, as it changes the waiter's addr with both buckets locked. */
+static futex_bucket_t *lock_waiter_bucket(futex_waiter_t *waiter)
+{
+    for (;;) {
+        volatile int *addr = __atomic_load_n(&waiter->addr, __ATOMIC_RELAXED);
+        futex_bucket_t *bucket = bucket_of(addr);
+        bucket_lock(bucket);
+        if (waiter->addr == addr) {
+            return bucket;
+        }
+        bucket_unlock(bucket);
+    }
+}
+
+static int timespec_to_ns(const struct timespec *ts, uint64_t *ns)
+{
+    if (ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= NS_IN_S) {
+        return -EINVAL;
+    }
+    *ns = ts->tv_sec * NS_IN_S + ts->tv_nsec;
+    return 0;
+}
+
+static long futex_wait(volatile int *addr, int val, uint32_t bitset, const struct timespec *timeout,
+                       bool absolute)
+{
+    uint64_t deadline = 0;
+
+    if (bitset == 0) {
+        return -EINVAL;
+    }
+    if (timeout != NULL) {
+        if (thread_ltimer == NULL) {
+            ZF_LOGE("Timed futex waits need a timer from muslcsys_futex_register_thread");
+            return -ENOSYS;
+        }
+        int error = timespec_to_ns(timeout, &deadline);
+        if (error) {
+            return error;
+        }
+        if (!absolute) {
+            uint64_t now;
+            if (ltimer_get_time(thread_ltimer, &now) != 0) {
+                return -EINVAL;
+            }
+            deadline += now;
+        }
+        /* Set before checking addr, a timeout that fires before the thread
+         * blocks leaves the notification signalled. */
+        if (ltimer_set_timeout(thread_ltimer, deadline, TIMEOUT_ABSOLUTE) != 0) {
+            ZF_LOGE("Failed to set the timeout of a futex wait");
+            return -EINVAL;
+        }
+    }
+
+    futex_bucket_t *bucket = bucket_of(addr);
+    futex_waiter_t waiter = {
+        .addr = addr,
+        .bitset = bitset,
+        .notification = thread_notification,
+        .woken = false,
+    };
+
+    bucket_lock(bucket);
+    /* Checked under the bucket lock, so a wake after addr was changed either
+     * finds us on the list or we see the change. */
+    if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != val) {
+        bucket_unlock(bucket);
+        return -EAGAIN;
+    }
+    bucket_insert(bucket, &waiter);
+    bucket_unlock(bucket);
+
+    for (;;) {
+        if (__atomic_load_n(&waiter.woken, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        /* Signals left over from earlier wakes or timeouts look like this
+         * one, so each time the thread runs it checks again why. */
+        if (waiter.notification != seL4_CapNull) {
+            seL4_Wait(waiter.notification, NULL);
+        } else {
+            seL4_Yield();
+        }
+        if (timeout != NULL) {
+            uint64_t now;
+            int error = ltimer_get_time(thread_ltimer, &now);
+            if (error || now >= deadline) {
+                bucket = lock_waiter_bucket(&waiter);
+                bool woken = waiter.woken;
+                if (!woken) {
+                    bucket_remove(bucket, &waiter);
+                }
+                bucket_unlock(bucket);
+                return woken ? 0 : -ETIMEDOUT;
+            }
+        }
+    }
+}
+
+static long futex_wake(volatile int *addr, int n, uint32_t bitset)
+{
+    if (bitset == 0) {
+        return -EINVAL;
+    }
+
+    futex_bucket_t *bucket = bucket_of(addr);
+    long woken = 0;
+
+    bucket_lock(bucket);
+    futex_waiter_t *waiter = bucket->waiters;
+    while (waiter != NULL && woken < n) {
+        futex_waiter_t *next = waiter->next;
+        if (waiter->addr == addr && (waiter->bitset & bitset) != 0) {
+            wake_waiter(bucket, waiter);
+            woken++;
+        }
+        waiter = next;
+    }
+    bucket_unlock(bucket);
+    return woken;
+}
+
+/* Wake n waiters on addr and move up to n_requeue of the rest to wait on addr2 */
+static long futex_requeue(volatile int *addr, int n, int n_requeue, volatile int *addr2)
+{
+    futex_bucket_t *bucket = bucket_of(addr);
+    futex_bucket_t *bucket2 = bucket_of(addr2);
+    long woken = 0;
+    long requeued = 0;
+
+    /* Locked in address order, so two requeues the other way around can't
+     * each hold the lock the other wants. */
+    if (bucket <= bucket2) {
+        bucket_lock(bucket);
+    }
+    if (bucket != bucket2) {
+        bucket_lock(bucket2);
+    }
+    if (bucket > bucket2) {
+        bucket_lock(bucket);
+    }
+
+    futex_waiter_t *waiter = bucket->waiters;
+    while (waiter != NULL && (woken < n || requeued < n_requeue)) {
+        futex_waiter_t *next = waiter->next;
+        if (waiter->addr == addr) {
+            if (woken < n) {
+                wake_waiter(bucket, waiter);
+                woken++;
+            } else {
+                bucket_remove(bucket, waiter);
+                __atomic_store_n(&waiter->addr, addr2, __ATOMIC_RELAXED);
+                bucket_insert(bucket2, waiter);
+                requeued++;
+            }
+        }
+        waiter = next;
+    }
+
+    if (bucket != bucket2) {
+        bucket_unlock(bucket2);
+    }
+    bucket_unlock(bucket);
+    return woken + requeued;
+}
+
+/* On 32-bit platforms this is installed for both futex and futex_time64. musl
+ * only uses futex with a timeout if futex_time64 is not implemented, so the
+ * timeout is always a 64-bit struct timespec. */
+long sys_futex(va_list ap)
+{
+    volatile int *addr = va_arg(ap, volatile int *);
+    int op = va_arg(ap, int);
+    int val = va_arg(ap, int);
+    /* the third argument is a timeout or a number of waiters depending on op */
+    void *arg = va_arg(ap, void *);
+    volatile int *addr2 = va_arg(ap, volatile int *);
+    uint32_t val3 = va_arg(ap, uint32_t);
+
+    /* every futex is private to the process */
+    int cmd = op & ~(MUSLCSYS_FUTEX_PRIVATE_FLAG | MUSLCSYS_FUTEX_CLOCK_REALTIME);
+    if (op & MUSLCSYS_FUTEX_CLOCK_REALTIME) {
+        ZF_LOGE("Futex waits on CLOCK_REALTIME are not supported");
+        return -ENOSYS;
+    }
+
+    switch (cmd) {
+    case MUSLCSYS_FUTEX_WAIT:
+        return futex_wait(addr, val, MUSLCSYS_FUTEX_BITSET_MATCH_ANY, arg, false);
+    case MUSLCSYS_FUTEX_WAIT_BITSET:
+        return futex_wait(addr, val, val3, arg, true);
+    case MUSLCSYS_FUTEX_WAKE:
+        return futex_wake(addr, val, MUSLCSYS_FUTEX_BITSET_MATCH_ANY);
+    case MUSLCSYS_FUTEX_WAKE_BITSET:
+        return futex_wake(addr, val, val3);
+    case MUSLCSYS_FUTEX_REQUEUE:
+        return futex_requeue(addr, val, (int)(uintptr_t) arg, addr2);
+    default:
+        return -ENOSYS;
+    }
+}
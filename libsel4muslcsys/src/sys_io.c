@@ -27,146 +27,295 @@
 #include <bits/syscall.h>
 
 #include <sel4utils/util.h>
+#include <cpio/cpio.h>
 
 #include <muslcsys/io.h>
 #include "arch_stdio.h"
-
-#define FD_TABLE_SIZE(x) (sizeof(muslcsys_fd_t) * (x))
-/* this implementation does not allow users to close STDOUT or STDERR, so they can't be freed */
-#define FREE_FD_TABLE_SIZE(x) (sizeof(int) * ((x) - FIRST_USER_FD))
+#include "syscalls.h"
 
 static void const *cpio_archive_symbol;
 static unsigned long cpio_archive_len;
 static muslcsys_cpio_get_file_fn_t cpio_get_file_impl;
 
+/* Index of the files in the archive by path, so that open does not walk the archive. Only
+ * built for the default cpio_get_file, whose archive format we know. */
+typedef struct cpio_index_entry {
+    uint32_t hash;
+    char const *name;
+    char const *start;
+    unsigned long size;
+} cpio_index_entry_t;
+
+static cpio_index_entry_t *cpio_index;
+/* power of 2 */
+static size_t cpio_index_slots;
+static size_t cpio_index_used;
+/* set if the index could not be built, open falls back to cpio_get_file_impl */
+static bool cpio_index_failed;
+
+#define CPIO_INDEX_MIN_SLOTS 64
+
 /* We need to wrap this in the config to prevent linker errors */
 #ifdef CONFIG_LIB_SEL4_MUSLC_SYS_CPIO_FS
 extern char _cpio_archive[];
 #endif
 
-/* file table, indexed by file descriptor */
-static muslcsys_fd_t *fd_table = NULL;
-/* stack of free file descriptors */
-static int *free_fd_table = NULL;
-/* head of the stack */
-static int free_fd_table_index;
-/* total number of fds */
-static int num_fds = 256;
+/* The file table is a directory of page sized chunks of fds, so growing it
+ * only adds chunks and an fd is found with two loads. Free fds are kept on a
+ * stack linked through their data, so the free stack never has to grow. Only
+ * allocating, freeing and growing take fd_lock, using an fd that is already
+ * open does not. */
+#define FD_CHUNK_FDS (PAGE_SIZE_4K / sizeof(muslcsys_fd_t))
+/* the most fds there can be, and so the RLIMIT_NOFILE hard limit */
+#define MAX_FDS 65536
+#define FD_MAX_CHUNKS DIV_ROUND_UP(MAX_FDS - FIRST_USER_FD, FD_CHUNK_FDS)
+
+static muslcsys_fd_t *fd_chunks[FD_MAX_CHUNKS];
+static int num_fd_chunks;
+/* total number of fds, published once the chunks they are in are */
+static int num_fds;
+/* fds to have the first time one is allocated */
+#define INITIAL_NUM_FDS 256
+/* top of the stack of free file descriptors, linked through their data, -1 if empty */
+static int free_fd_head = -1;
+/* protects the free stack and growth of the table */
+static volatile int fd_lock;
+
+static void fd_table_lock(void)
+{
+    while (__atomic_exchange_n(&fd_lock, 1, __ATOMIC_ACQUIRE)) {
+        seL4_Yield();
+    }
+}
+
+static void fd_table_unlock(void)
+{
+    __atomic_store_n(&fd_lock, 0, __ATOMIC_RELEASE);
+}
+
+/* with fd_lock held */
+static void push_free_fd(int fd)
+{
+    muslcsys_fd_t *fds = get_fd_struct(fd);
+    fds->filetype = FILE_TYPE_FREE;
+    fds->data = (void *)(intptr_t) free_fd_head;
+    free_fd_head = fd;
+}
 
 void add_free_fd(int fd)
 {
-    get_fd_struct(fd)->filetype = FILE_TYPE_FREE;
-    free_fd_table_index++;
-    assert(free_fd_table_index < num_fds);
-    free_fd_table[free_fd_table_index] = fd;
+    fd_table_lock();
+    push_free_fd(fd);
+    fd_table_unlock();
 }
 
 int get_free_fd(void)
 {
-    if (free_fd_table_index == -1) {
+    fd_table_lock();
+    int fd = free_fd_head;
+    if (fd == -1) {
+        fd_table_unlock();
         return -EMFILE;
     }
-
-    free_fd_table_index--;
-    return free_fd_table[free_fd_table_index + 1];
+    free_fd_head = (int)(intptr_t) get_fd_struct(fd)->data;
+    fd_table_unlock();
+    return fd;
 }
 
 int valid_fd(int fd)
 {
-    return fd < num_fds && fd >= FIRST_USER_FD;
+    return fd < __atomic_load_n(&num_fds, __ATOMIC_ACQUIRE) && fd >= FIRST_USER_FD;
 }
 
-static int allocate_file_table(void)
+/* Add chunks until there are at least new_num_fds, with fd_lock held */
+static int add_fd_chunks(int new_num_fds)
 {
-    fd_table = malloc(FD_TABLE_SIZE(num_fds));
-    if (fd_table == NULL) {
-        return -ENOMEM;
+    if (new_num_fds > MAX_FDS) {
+        return -EPERM;
     }
-
-    free_fd_table = malloc(FREE_FD_TABLE_SIZE(num_fds));
-    if (free_fd_table == NULL) {
-        free(fd_table);
-        return -ENOMEM;
-    }
-
-    free_fd_table_index = -1;
-
-    /* populate free list */
-    for (int i = FIRST_USER_FD; i < num_fds; i++) {
-        add_free_fd(i);
+    while (num_fds < new_num_fds) {
+        muslcsys_fd_t *chunk = malloc(FD_CHUNK_FDS * sizeof(muslcsys_fd_t));
+        if (chunk == NULL) {
+            ZF_LOGE("Failed to allocate fd table chunk\n");
+            return -ENOMEM;
+        }
+        int first = FIRST_USER_FD + num_fd_chunks * FD_CHUNK_FDS;
+        fd_chunks[num_fd_chunks] = chunk;
+        num_fd_chunks++;
+        __atomic_store_n(&num_fds, first + FD_CHUNK_FDS, __ATOMIC_RELEASE);
+
+        /* in reverse, so the lowest fds are handed out first */
+        for (int fd = first + FD_CHUNK_FDS - 1; fd >= first; fd--) {
+            push_free_fd(fd);
+        }
     }
-
     return 0;
 }
 
+static int allocate_file_table(void)
+{
+    fd_table_lock();
+    int error = num_fd_chunks == 0 ? add_fd_chunks(INITIAL_NUM_FDS) : 0;
+    fd_table_unlock();
+    return error;
+}
+
 int grow_fds(int how_much)
 {
-    int new_num_fds = num_fds + how_much;
+    fd_table_lock();
+    int error = add_fd_chunks(MAX(num_fds, INITIAL_NUM_FDS) + how_much);
+    fd_table_unlock();
+    return error;
+}
 
-    /* Ensure file table exists */
-    if (fd_table == NULL) {
+int allocate_fd()
+{
+    if (__atomic_load_n(&num_fds, __ATOMIC_ACQUIRE) == 0) {
         if (allocate_file_table() == -ENOMEM) {
             return -ENOMEM;
         }
     }
 
-    /* allocate new arrays */
-    muslcsys_fd_t *new_fd_table = malloc(FD_TABLE_SIZE(new_num_fds));
-    if (!new_fd_table) {
-        LOG_ERROR("Failed to allocate new_vfds\n");
-        return -ENOMEM;
-    }
-
-    int *new_free_fd_table = malloc(FREE_FD_TABLE_SIZE(new_num_fds));
-    if (!new_free_fd_table) {
-        free(new_fd_table);
-        ZF_LOGE("Failed to allocate free fd table\n");
-        return -ENOMEM;
-    }
+    return get_free_fd();
+}
 
-    /* copy old contents */
-    memcpy(new_free_fd_table, free_fd_table, FREE_FD_TABLE_SIZE(num_fds));
-    memcpy(new_fd_table, fd_table, FD_TABLE_SIZE(num_fds));
+muslcsys_fd_t *get_fd_struct(int fd)
+{
+    assert(valid_fd(fd));
+    int index = fd - FIRST_USER_FD;
+    return &fd_chunks[index / FD_CHUNK_FDS][index % FD_CHUNK_FDS];
+}
 
-    /* free old tables */
-    free(fd_table);
-    free(free_fd_table);
+static size_t sys_platform_write(void *data, size_t count)
+{
+    char *realdata = data;
+    return __arch_write(realdata, count);
+}
 
-    /* update global pointers */
-    fd_table = new_fd_table;
-    free_fd_table = new_free_fd_table;
+/* Paths in an archive are relative, and created with or without a "./" */
+static char const *cpio_normalise_path(char const *path)
+{
+    while (strncmp(path, "./", 2) == 0) {
+        path += 2;
+    }
+    return path;
+}
 
-    /* Update the size */
-    num_fds = new_num_fds;
+/* FNV-1a */
+static uint32_t cpio_path_hash(char const *path)
+{
+    uint32_t hash = 2166136261u;
+    for (; *path != '\0'; path++) {
+        hash = (hash ^ (unsigned char) *path) * 16777619u;
+    }
+    return hash;
+}
 
-    /* add all of the new available fds to the free list */
-    for (int i = num_fds; i < new_num_fds; i++) {
-        add_free_fd(i);
+static cpio_index_entry_t *cpio_index_slot(cpio_index_entry_t *index, size_t slots, uint32_t hash,
+                                           char const *name)
+{
+    for (size_t i = hash & (slots - 1);; i = (i + 1) & (slots - 1)) {
+        if (index[i].name == NULL || (index[i].hash == hash && strcmp(index[i].name, name) == 0)) {
+            return &index[i];
+        }
     }
-    return 0;
 }
 
-int allocate_fd()
+static int cpio_index_grow(void)
 {
-    if (fd_table == NULL) {
-        if (allocate_file_table() == -ENOMEM) {
-            return -ENOMEM;
+    size_t slots = cpio_index_slots == 0 ? CPIO_INDEX_MIN_SLOTS : cpio_index_slots * 2;
+    cpio_index_entry_t *index = calloc(slots, sizeof(*index));
+    if (index == NULL) {
+        return -ENOMEM;
+    }
+    for (size_t i = 0; i < cpio_index_slots; i++) {
+        if (cpio_index[i].name != NULL) {
+            *cpio_index_slot(index, slots, cpio_index[i].hash, cpio_index[i].name) = cpio_index[i];
         }
     }
+    free(cpio_index);
+    cpio_index = index;
+    cpio_index_slots = slots;
+    return 0;
+}
 
-    return get_free_fd();
+static void cpio_index_free(void)
+{
+    free(cpio_index);
+    cpio_index = NULL;
+    cpio_index_slots = 0;
+    cpio_index_used = 0;
+    cpio_index_failed = false;
 }
 
-muslcsys_fd_t *get_fd_struct(int fd)
+/* Index every file in the archive in one pass over its headers */
+static int cpio_index_build(void)
 {
-    assert(fd < num_fds && fd >= FIRST_USER_FD);
-    return &fd_table[fd - FIRST_USER_FD];
+    struct cpio_header *header = (struct cpio_header *) cpio_archive_symbol;
+    uintptr_t end = (uintptr_t) cpio_archive_symbol + cpio_archive_len;
+
+    while ((uintptr_t) header < end) {
+        struct cpio_header_info info;
+        int error = cpio_parse_header(header, end - (uintptr_t) header, &info);
+        if (error == 1) {
+            /* the trailer */
+            return 0;
+        } else if (error) {
+            ZF_LOGE("Failed to parse the cpio archive to index it");
+            return -EINVAL;
+        }
+        header = info.next;
+
+        /* keep the load factor at most 1/2, so probe sequences stay short */
+        if ((cpio_index_used + 1) * 2 > cpio_index_slots && cpio_index_grow() != 0) {
+            return -ENOMEM;
+        }
+        char const *name = cpio_normalise_path(info.filename);
+        uint32_t hash = cpio_path_hash(name);
+        cpio_index_entry_t *slot = cpio_index_slot(cpio_index, cpio_index_slots, hash, name);
+        if (slot->name != NULL) {
+            /* cpio_get_file finds the first of files with the same path */
+            continue;
+        }
+        *slot = (cpio_index_entry_t) {
+            .hash = hash,
+            .name = name,
+            .start = info.data,
+            .size = info.filesize,
+        };
+        cpio_index_used++;
+    }
+    return 0;
 }
 
-static size_t sys_platform_write(void *data, size_t count)
+static char const *cpio_lookup(char const *pathname, unsigned long *size)
 {
-    char *realdata = data;
-    return __arch_write(realdata, count);
+    if (cpio_get_file_impl == NULL || cpio_archive_symbol == NULL) {
+        return NULL;
+    }
+
+    if (cpio_index == NULL && !cpio_index_failed
+        && cpio_get_file_impl == (muslcsys_cpio_get_file_fn_t) cpio_get_file) {
+        if (cpio_index_build() != 0) {
+            cpio_index_free();
+            cpio_index_failed = true;
+        }
+    }
+    if (cpio_index != NULL) {
+        char const *name = cpio_normalise_path(pathname);
+        cpio_index_entry_t *slot = cpio_index_slot(cpio_index, cpio_index_slots, cpio_path_hash(name), name);
+        if (slot->name == NULL) {
+            return NULL;
+        }
+        *size = slot->size;
+        return slot->start;
+    }
+
+    char const *file = cpio_get_file_impl(cpio_archive_symbol, cpio_archive_len, pathname, size);
+    if (!file && strncmp(pathname, "./", 2) == 0) {
+        file = cpio_get_file_impl(cpio_archive_symbol, cpio_archive_len, pathname + 2, size);
+    }
+    return file;
 }
 
 static long sys_open_impl(const char *pathname, int flags, mode_t mode)
@@ -181,13 +330,7 @@ static long sys_open_impl(const char *pathname, int flags, mode_t mode)
     }
     /* as we do not support create, ignore the mode */
     long unsigned int size;
-    char const *file = NULL;
-    if (cpio_get_file_impl && cpio_archive_symbol) {
-        file = cpio_get_file_impl(cpio_archive_symbol, cpio_archive_len, pathname, &size);
-        if (!file && strncmp(pathname, "./", 2) == 0) {
-            file = cpio_get_file_impl(cpio_archive_symbol, cpio_archive_len, pathname + 2, &size);
-        }
-    }
+    char const *file = cpio_lookup(pathname, &size);
     if (!file) {
         ZF_LOGE("Failed to open file %s\n", pathname);
         return -ENOENT;
@@ -250,6 +393,10 @@ long sys_close(va_list ap)
     }
 
     muslcsys_fd_t *fds = get_fd_struct(fd);
+    if (fds->filetype == FILE_TYPE_FREE) {
+        /* pushing it on the free stack again would hand it out twice */
+        return -EBADF;
+    }
 
     if (fds->filetype == FILE_TYPE_CPIO) {
         free(fds->data);
@@ -269,6 +416,48 @@ write_buf_fn sel4muslcsys_register_stdio_write_fn(write_buf_fn write_fn)
 }
 
 
+#if CONFIG_LIB_SEL4_MUSLC_SYS_STDIO_STAGING_BYTES > 0
+/* small iovecs are gathered here, so that each writev calls stdio_write as
+ * few times as possible */
+static __thread char stdio_staging[CONFIG_LIB_SEL4_MUSLC_SYS_STDIO_STAGING_BYTES];
+#endif
+
+static size_t stdio_writev(struct iovec *iov, int iovcnt)
+{
+    size_t ret = 0;
+#if CONFIG_LIB_SEL4_MUSLC_SYS_STDIO_STAGING_BYTES > 0
+    size_t staged = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        size_t len = iov[i].iov_len;
+        if (len <= sizeof(stdio_staging) - staged) {
+            memcpy(&stdio_staging[staged], iov[i].iov_base, len);
+            staged += len;
+            continue;
+        }
+        if (staged > 0) {
+            ret += stdio_write(stdio_staging, staged);
+            staged = 0;
+        }
+        if (len <= sizeof(stdio_staging) / 2) {
+            memcpy(stdio_staging, iov[i].iov_base, len);
+            staged = len;
+        } else {
+            /* big enough to not be worth copying */
+            ret += stdio_write(iov[i].iov_base, len);
+        }
+    }
+    if (staged > 0) {
+        ret += stdio_write(stdio_staging, staged);
+    }
+#else
+    for (int i = 0; i < iovcnt; i++) {
+        ret += stdio_write(iov[i].iov_base, iov[i].iov_len);
+    }
+#endif
+    return ret;
+}
+
 /* Writev syscall implementation for muslc. Only implemented for stdin and stdout. */
 long sys_writev(va_list ap)
 {
@@ -302,13 +491,9 @@ long sys_writev(va_list ap)
     if (fildes == STDOUT_FILENO || fildes == STDERR_FILENO) {
         if (stdio_write == NULL) {
             ZF_LOGD("No standard out function registered");
-        }
-        for (int i = 0; i < iovcnt; i++) {
-            if (stdio_write == NULL) {
-                ret += iov[i].iov_len;
-            } else {
-                ret += stdio_write(iov[i].iov_base, iov[i].iov_len);
-            }
+            ret = sum;
+        } else {
+            ret = stdio_writev(iov, iovcnt);
         }
     } else {
         assert(!"Not implemented");
@@ -401,18 +586,20 @@ long sys_prlimit64(va_list ap)
     (void) pid;
 
     if (resource == RLIMIT_NOFILE) {
+        int limit = MAX(__atomic_load_n(&num_fds, __ATOMIC_ACQUIRE), INITIAL_NUM_FDS);
         if (old_limit) {
-            old_limit->rlim_cur = num_fds;
-            /* pick some arbitrarily big number for max. In practice we are only constrained
-             * by how large an array we can malloc */
-            old_limit->rlim_max = 65536;
+            old_limit->rlim_cur = limit;
+            /* the size of the directory of fd chunks */
+            old_limit->rlim_max = MAX_FDS;
         }
 
         if (new_limit) {
-            if (new_limit->rlim_cur < num_fds) {
+            if (new_limit->rlim_cur < limit) {
                 printf("Trying to reduce open file limit. Operation not supported, ignoring\n");
+            } else if (new_limit->rlim_cur > MAX_FDS) {
+                result = -EPERM;
             } else {
-                result = grow_fds(new_limit->rlim_cur - num_fds);
+                result = grow_fds(new_limit->rlim_cur - limit);
             }
         }
     } else {
@@ -530,10 +717,64 @@ long sys_access(va_list ap)
     return -EACCES;
 }
 
+bool sys_mmap_in_cpio_archive(void *addr)
+{
+    uintptr_t start = (uintptr_t) cpio_archive_symbol;
+    return cpio_archive_symbol != NULL && (uintptr_t) addr >= start && (uintptr_t) addr < start + cpio_archive_len;
+}
+
+/* Files in the archive never change, so a read only mapping of one can be the file in the
+ * archive itself. mmap has to return a page aligned address, and data in a cpio archive is
+ * only 4 byte aligned, so a file that is not page aligned in the archive is copied into
+ * anonymous pages instead, which is still one copy less than reading it into a buffer. Like
+ * a file mapping on Linux the bytes past the end of the file up to the end of the last page
+ * are not part of the file, when mapped in place they are whatever follows it in the archive. */
+long sys_mmap_file(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    if (fd < FIRST_USER_FD || !valid_fd(fd)) {
+        return -EBADF;
+    }
+    muslcsys_fd_t *muslc_fd = get_fd_struct(fd);
+    if (muslc_fd->filetype != FILE_TYPE_CPIO) {
+        return -EBADF;
+    }
+    if (prot & (PROT_WRITE | PROT_EXEC)) {
+        ZF_LOGE("Files can only be mapped PROT_READ");
+        return -EACCES;
+    }
+    if (flags & MAP_FIXED) {
+        ZF_LOGE("Files cannot be mapped MAP_FIXED");
+        return -EINVAL;
+    }
+    if (length == 0 || offset < 0 || (offset % PAGE_SIZE_4K) != 0) {
+        return -EINVAL;
+    }
+
+    cpio_file_data_t *cpio_fd = muslc_fd->data;
+    if (offset > cpio_fd->size) {
+        return -ENXIO;
+    }
+    char const *file = cpio_fd->start + offset;
+    size_t file_length = MIN(length, cpio_fd->size - offset);
+    if (IS_ALIGNED_4K((uintptr_t) file)) {
+        return (long) file;
+    }
+
+    /* Errors are small negative numbers, or 0, so never page aligned */
+    long copy = sys_mmap_impl(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == 0 || !IS_ALIGNED_4K((uintptr_t) copy)) {
+        return -ENOMEM;
+    }
+    memcpy((void *) copy, file, file_length);
+    return copy;
+}
+
 void muslcsys_install_cpio_interface(void const *cpio_symbol, unsigned long cpio_len,
                                      muslcsys_cpio_get_file_fn_t fn)
 {
     cpio_archive_symbol = cpio_symbol;
     cpio_archive_len = cpio_len;
     cpio_get_file_impl = fn;
+    /* built again on the next open, once malloc is usable */
+    cpio_index_free();
 }
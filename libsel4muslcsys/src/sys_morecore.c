@@ -9,17 +9,23 @@
 
 #include <autoconf.h>
 #include <sel4muslcsys/gen_config.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdarg.h>
 #include <sys/mman.h>
 #include <errno.h>
 #include <assert.h>
+#include <string.h>
 
 #include <vspace/vspace.h>
 
 #include <sel4utils/util.h>
 #include <sel4utils/mapping.h>
+#include <sel4utils/vspace.h>
+
+#include <muslcsys/guard.h>
+#include "syscalls.h"
 
 /* If we have a nonzero static morecore then we are just doing dodgy hacky morecore */
 #if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_BYTES > 0
@@ -72,8 +78,7 @@ long sys_mmap_impl(void *addr, size_t length, int prot, int flags, int fd, off_t
         morecore_top -= length;
         return morecore_top;
     }
-    assert(!"not implemented");
-    return -ENOMEM;
+    return sys_mmap_file(addr, length, prot, flags, fd, offset);
 }
 
 long sys_mremap(va_list ap)
@@ -82,6 +87,16 @@ long sys_mremap(va_list ap)
     return -ENOMEM;
 }
 
+/* There is no vspace to reserve a guard page in */
+void *muslcsys_guarded_map(size_t bytes)
+{
+    return NULL;
+}
+
+void muslcsys_guarded_unmap(void *vaddr, size_t bytes)
+{
+}
+
 #else
 
 /* dynamic morecore based on a vspace. These need to be defined somewhere (probably in the
@@ -105,7 +120,59 @@ size_t morecore_size = 0;
 static uintptr_t morecore_base = 0;
 uintptr_t morecore_top = 0;
 
+/* the brk, and the end of the pages mapped for it, which is ahead of the brk by up to a chunk */
 static uintptr_t brk_start;
+static uintptr_t brk_mapped;
+#ifdef CONFIG_LIB_SEL4_MUSLC_SYS_BRK_LARGE_PAGES
+/* cleared once a large page could not be allocated, to not keep trying */
+static bool brk_large_pages = true;
+#else
+static bool brk_large_pages = false;
+#endif
+
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_EARLY_BYTES > 0
+/* Static area for the heap to start in before there is a vspace. The brk grows up from the
+ * bottom and mmaps are taken from the top. A heap that starts here stays here, as malloc
+ * only asks for the start of the brk once, and falls back to mmap when the brk cannot grow.
+ * Memory of the area is never given back. */
+static char __attribute__((aligned(PAGE_SIZE_4K))) early_area[CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_EARLY_BYTES];
+static uintptr_t early_brk = (uintptr_t) early_area;
+static uintptr_t early_top = (uintptr_t) early_area + sizeof(early_area);
+/* set once the start of the brk has been given out from the early area */
+static bool early_heap = false;
+#endif
+
+static bool in_early_area(uintptr_t vaddr)
+{
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_EARLY_BYTES > 0
+    return vaddr >= (uintptr_t) early_area && vaddr < (uintptr_t) early_area + sizeof(early_area);
+#else
+    return false;
+#endif
+}
+
+/* Whether the brk is in the early area, or allocations come from it as there is no vspace yet */
+static bool use_early_area(void)
+{
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_EARLY_BYTES > 0
+    return morecore_area == NULL && (early_heap || muslc_this_vspace == NULL);
+#else
+    return false;
+#endif
+}
+
+/* Whether the brk reservation has been made lazy with sel4utils_reservation_set_lazy, in
+ * which case the heap is mapped by the lazy fault handler as it is touched */
+static bool brk_is_lazy(void)
+{
+    return ((sel4utils_res_t *) muslc_brk_reservation.res)->lazy_cluster != 0;
+}
+
+static bool in_brk_reservation(uintptr_t vaddr)
+{
+    sel4utils_res_t *res = muslc_brk_reservation.res;
+    return res != NULL && vaddr >= res->start && vaddr < res->end;
+}
 
 static void init_morecore_region(void)
 {
@@ -137,10 +204,42 @@ static long sys_brk_static(va_list ap)
     return ret;
 }
 
+/* Map pages for the brk up to top, with as few calls into the vspace as the page sizes allow */
+static int brk_map_to(uintptr_t top)
+{
+    while (brk_mapped < top) {
+        if (brk_large_pages && IS_ALIGNED(brk_mapped, seL4_LargePageBits)
+            && top - brk_mapped >= BIT(seL4_LargePageBits)) {
+            size_t pages = (top - brk_mapped) >> seL4_LargePageBits;
+            int error = vspace_new_pages_at_vaddr(muslc_this_vspace, (void *) brk_mapped, pages,
+                                                  seL4_LargePageBits, muslc_brk_reservation);
+            if (!error) {
+                brk_mapped += pages << seL4_LargePageBits;
+                continue;
+            }
+            ZF_LOGW("Failed to extend brk with large pages, using small pages from now on");
+            brk_large_pages = false;
+        }
+
+        /* small pages up to the end, or to the next large page boundary to try from there */
+        uintptr_t end = top;
+        if (brk_large_pages) {
+            end = MIN(top, ROUND_UP(brk_mapped + 1, BIT(seL4_LargePageBits)));
+        }
+        int error = vspace_new_pages_at_vaddr(muslc_this_vspace, (void *) brk_mapped,
+                                              (end - brk_mapped) >> seL4_PageBits, seL4_PageBits,
+                                              muslc_brk_reservation);
+        if (error) {
+            return error;
+        }
+        brk_mapped = end;
+    }
+    return 0;
+}
+
 static long sys_brk_dynamic(va_list ap)
 {
 
-    uintptr_t ret;
     uintptr_t newbrk = va_arg(ap, uintptr_t);
     if (!muslc_this_vspace || !muslc_brk_reservation.res || !muslc_brk_reservation_start) {
         ZF_LOGE("Need to assign vspace for sys_brk to work!\n");
@@ -148,28 +247,70 @@ static long sys_brk_dynamic(va_list ap)
         return 0;
     }
 
+    if (brk_mapped == 0) {
+        brk_start = brk_mapped = (uintptr_t)muslc_brk_reservation_start;
+    }
+
     /*if the newbrk is 0, return the bottom of the heap*/
     if (newbrk == 0) {
-        brk_start = (uintptr_t)muslc_brk_reservation_start;
-        ret = brk_start;
-    } else {
-        /* try and map pages until this point */
-        while (brk_start < newbrk) {
-            int error = vspace_new_pages_at_vaddr(muslc_this_vspace, (void *) brk_start, 1,
-                                                  seL4_PageBits, muslc_brk_reservation);
-            if (error) {
-                ZF_LOGE("Mapping new pages to extend brk region failed\n");
-                return 0;
-            }
-            brk_start += PAGE_SIZE_4K;
+        return brk_start;
+    }
+
+    uintptr_t top = ROUND_UP(newbrk, PAGE_SIZE_4K);
+    if (top > brk_mapped && !brk_is_lazy()) {
+        /* Map ahead of the brk, which may run past the end of the reservation, so fall
+         * back to mapping just what was asked for. */
+        uintptr_t ahead = top;
+        if (brk_large_pages && IS_ALIGNED(brk_mapped, seL4_LargePageBits)) {
+            ahead = ROUND_UP(top, BIT(seL4_LargePageBits));
+        } else if (CONFIG_LIB_SEL4_MUSLC_SYS_BRK_CHUNK_BYTES > 0) {
+            ahead = ROUND_UP(top, ROUND_UP(CONFIG_LIB_SEL4_MUSLC_SYS_BRK_CHUNK_BYTES, PAGE_SIZE_4K));
+        }
+        if (brk_map_to(ahead) != 0 && brk_map_to(top) != 0) {
+            ZF_LOGE("Mapping new pages to extend brk region failed\n");
+            return 0;
         }
-        ret = brk_start;
     }
-    return ret;
+    brk_start = top;
+    return brk_start;
 }
 
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_EARLY_BYTES > 0
+static long sys_brk_early(va_list ap)
+{
+    uintptr_t newbrk = va_arg(ap, uintptr_t);
+
+    if (!newbrk) {
+        early_heap = true;
+        return early_brk;
+    } else if (newbrk >= (uintptr_t) early_area && newbrk <= early_top) {
+        early_brk = newbrk;
+        return early_brk;
+    }
+    return 0;
+}
+
+static long sys_mmap_impl_early(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    if (flags & MAP_ANONYMOUS) {
+        uintptr_t adjusted_length = BYTES_TO_4K_PAGES(length) * PAGE_SIZE_4K;
+        if (adjusted_length > early_top - early_brk) {
+            return -ENOMEM;
+        }
+        early_top -= adjusted_length;
+        return early_top;
+    }
+    return sys_mmap_file(addr, length, prot, flags, fd, offset);
+}
+#endif
+
 long sys_brk(va_list ap)
 {
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_EARLY_BYTES > 0
+    if (use_early_area()) {
+        return sys_brk_early(ap);
+    }
+#endif
     if (morecore_area != NULL) {
         return sys_brk_static(ap);
     } else if (muslc_this_vspace != NULL) {
@@ -203,8 +344,7 @@ static long sys_mmap_impl_static(void *addr, size_t length, int prot, int flags,
         ZF_LOGF_IF((base % 0x1000) != 0, "return address: 0x%"PRIxPTR" requires alignment: 0x%x ", base, 0x1000);
         return base;
     }
-    assert(!"not implemented");
-    return -ENOMEM;
+    return sys_mmap_file(addr, length, prot, flags, fd, offset);
 }
 
 static long sys_mmap_impl_dynamic(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
@@ -222,12 +362,16 @@ static long sys_mmap_impl_dynamic(void *addr, size_t length, int prot, int flags
                    0x1000);
         return (long)ret;
     }
-    assert(!"not implemented");
-    return -ENOMEM;
+    return sys_mmap_file(addr, length, prot, flags, fd, offset);
 }
 
 long sys_mmap_impl(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
 {
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_EARLY_BYTES > 0
+    if (morecore_area == NULL && muslc_this_vspace == NULL) {
+        return sys_mmap_impl_early(addr, length, prot, flags, fd, offset);
+    }
+#endif
     if (morecore_area != NULL) {
         return sys_mmap_impl_static(addr, length, prot, flags, fd, offset);
     } else if (muslc_this_vspace != NULL) {
@@ -239,6 +383,43 @@ long sys_mmap_impl(void *addr, size_t length, int prot, int flags, int fd, off_t
     }
 }
 
+/* Pages moved by mremap per round of looking up, unmapping and mapping caps */
+#define MREMAP_BATCH_PAGES 64
+
+/* Move the frames mapped at from to to, which is in reservation, a batch at a time so that
+ * the caps being moved fit on the stack. On failure *moved pages have been moved, and the
+ * rest are still mapped at from. */
+static int mremap_move_pages(void *from, void *to, size_t num_pages, reservation_t reservation, size_t *moved)
+{
+    seL4_CPtr caps[MREMAP_BATCH_PAGES];
+    uintptr_t cookies[MREMAP_BATCH_PAGES];
+
+    for (*moved = 0; *moved < num_pages; *moved += MREMAP_BATCH_PAGES) {
+        size_t batch = MIN(MREMAP_BATCH_PAGES, num_pages - *moved);
+        void *src = from + *moved * PAGE_SIZE_4K;
+        void *dst = to + *moved * PAGE_SIZE_4K;
+
+        for (size_t i = 0; i < batch; i++) {
+            caps[i] = vspace_get_cap(muslc_this_vspace, src + i * PAGE_SIZE_4K);
+            cookies[i] = vspace_get_cookie(muslc_this_vspace, src + i * PAGE_SIZE_4K);
+        }
+        vspace_unmap_pages(muslc_this_vspace, src, batch, seL4_PageBits, VSPACE_PRESERVE);
+        int error = vspace_map_pages_at_vaddr(muslc_this_vspace, caps, cookies, dst, batch, seL4_PageBits,
+                                              reservation);
+        if (error) {
+            /* put this batch back where it was */
+            reservation_t back = vspace_reserve_range_at(muslc_this_vspace, src, batch * PAGE_SIZE_4K,
+                                                         seL4_AllRights, 1);
+            assert(back.res);
+            error = vspace_map_pages_at_vaddr(muslc_this_vspace, caps, cookies, src, batch, seL4_PageBits, back);
+            assert(!error);
+            vspace_free_reservation(muslc_this_vspace, back);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static long sys_mremap_dynamic(va_list ap)
 {
 
@@ -259,55 +440,65 @@ static long sys_mremap_dynamic(va_list ap)
         new_address_arg = va_arg(ap, void *);
     }
 
-    /* first find all the old caps */
-    int num_pages = old_size >> seL4_PageBits;
-    seL4_CPtr caps[num_pages];
-    uintptr_t cookies[num_pages];
-    int i;
-    for (i = 0; i < num_pages; i++) {
-        void *vaddr = old_address + i * BIT(seL4_PageBits);
-        caps[i] = vspace_get_cap(muslc_this_vspace, vaddr);
-        cookies[i] = vspace_get_cookie(muslc_this_vspace, vaddr);
+    size_t num_pages = old_size >> seL4_PageBits;
+    size_t new_pages = new_size >> seL4_PageBits;
+    if (new_pages == num_pages) {
+        return (long)old_address;
     }
-    /* unmap the previous mapping */
-    vspace_unmap_pages(muslc_this_vspace, old_address, num_pages, seL4_PageBits, VSPACE_PRESERVE);
-    /* reserve a new region */
+
+    /* If the range after the mapping is free, grow into it and leave the old pages alone */
     int error;
+    reservation_t reservation = vspace_reserve_range_at(muslc_this_vspace, old_address + old_size,
+                                                        new_size - old_size, seL4_AllRights, 1);
+    if (reservation.res) {
+        error = vspace_new_pages_at_vaddr(muslc_this_vspace, old_address + old_size, new_pages - num_pages,
+                                          seL4_PageBits, reservation);
+        vspace_free_reservation(muslc_this_vspace, reservation);
+        if (!error) {
+            return (long)old_address;
+        }
+        ZF_LOGE("Creating new pages to grow remap region in place failed\n");
+        return -ENOMEM;
+    }
+
+    /* reserve a new region */
     void *new_address;
-    int new_pages = new_size >> seL4_PageBits;
-    reservation_t reservation = vspace_reserve_range(muslc_this_vspace, new_pages * PAGE_SIZE_4K, seL4_AllRights, 1,
-                                                     &new_address);
+    reservation = vspace_reserve_range(muslc_this_vspace, new_pages * PAGE_SIZE_4K, seL4_AllRights, 1,
+                                       &new_address);
     if (!reservation.res) {
         ZF_LOGE("Failed to make reservation for remap\n");
-        goto restore;
-    }
-    /* map all the existing pages into the reservation */
-    error = vspace_map_pages_at_vaddr(muslc_this_vspace, caps, cookies, new_address, num_pages, seL4_PageBits, reservation);
-    if (error) {
-        ZF_LOGE("Mapping existing pages into new reservation failed\n");
-        vspace_free_reservation(muslc_this_vspace, reservation);
-        goto restore;
+        return -ENOMEM;
     }
-    /* create any new pages */
-    error = vspace_new_pages_at_vaddr(muslc_this_vspace, new_address + num_pages * PAGE_SIZE_4K, new_pages - num_pages,
+    /* create any new pages first, as they are the easier to undo */
+    error = vspace_new_pages_at_vaddr(muslc_this_vspace, new_address + old_size, new_pages - num_pages,
                                       seL4_PageBits, reservation);
     if (error) {
         ZF_LOGE("Creating new pages for remap region failed\n");
-        vspace_unmap_pages(muslc_this_vspace, new_address, num_pages, seL4_PageBits, VSPACE_PRESERVE);
         vspace_free_reservation(muslc_this_vspace, reservation);
-        goto restore;
+        return -ENOMEM;
+    }
+    /* move all the existing pages into the reservation */
+    size_t moved;
+    if (mremap_move_pages(old_address, new_address, num_pages, reservation, &moved)) {
+        ZF_LOGE("Mapping existing pages into new reservation failed\n");
+        /* try and recreate the original mapping */
+        reservation_t back = vspace_reserve_range_at(muslc_this_vspace, old_address, moved * PAGE_SIZE_4K,
+                                                     seL4_AllRights, 1);
+        assert(moved == 0 || back.res);
+        if (moved != 0) {
+            size_t moved_back;
+            error = mremap_move_pages(new_address, old_address, moved, back, &moved_back);
+            assert(!error);
+            vspace_free_reservation(muslc_this_vspace, back);
+        }
+        vspace_unmap_pages(muslc_this_vspace, new_address + old_size, new_pages - num_pages, seL4_PageBits,
+                           VSPACE_FREE);
+        vspace_free_reservation(muslc_this_vspace, reservation);
+        return -ENOMEM;
     }
     /* free the reservation book keeping */
     vspace_free_reservation(muslc_this_vspace, reservation);
     return (long)new_address;
-restore:
-    /* try and recreate the original mapping */
-    reservation = vspace_reserve_range_at(muslc_this_vspace, old_address, num_pages * PAGE_SIZE_4K, seL4_AllRights, 1);
-    assert(reservation.res);
-    error = vspace_map_pages_at_vaddr(muslc_this_vspace, caps, cookies, old_address,
-                                      num_pages, seL4_PageBits, reservation);
-    assert(!error);
-    return -ENOMEM;
 }
 
 static long sys_mremap_static(va_list ap)
@@ -318,6 +509,15 @@ static long sys_mremap_static(va_list ap)
 
 long sys_mremap(va_list ap)
 {
+    va_list copy;
+    va_copy(copy, ap);
+    uintptr_t old_address = (uintptr_t) va_arg(copy, void *);
+    va_end(copy);
+    if (in_early_area(old_address)) {
+        /* realloc copies into a new allocation instead */
+        return -ENOMEM;
+    }
+
     if (morecore_area != NULL) {
         return sys_mremap_static(ap);
     } else if (muslc_this_vspace != NULL) {
@@ -329,11 +529,92 @@ long sys_mremap(va_list ap)
     }
 }
 
+static long sys_munmap_dynamic(void *addr, size_t length)
+{
+    if (!IS_ALIGNED_4K((uintptr_t) addr)) {
+        return -EINVAL;
+    }
+    /* Frames go back to the vspace's allocator. Book keeping of pages in a reservation, such
+     * as of the brk, goes back to reserved rather than free, so a lazy reservation maps
+     * them again when they are next touched. Pages that were never mapped are skipped. */
+    vspace_unmap_pages(muslc_this_vspace, addr, BYTES_TO_4K_PAGES(length), seL4_PageBits, VSPACE_FREE);
+    return 0;
+}
+
+static long sys_madvise_dynamic(void *addr, size_t length, int advice)
+{
+    if (advice != MADV_DONTNEED) {
+        /* only a hint */
+        return 0;
+    }
+    if (!IS_ALIGNED_4K((uintptr_t) addr)) {
+        return -EINVAL;
+    }
+
+    uintptr_t start = (uintptr_t) addr;
+    uintptr_t end = start + BYTES_TO_4K_PAGES(length) * PAGE_SIZE_4K;
+    if (in_brk_reservation(start) && in_brk_reservation(end - 1) && brk_is_lazy()) {
+        /* Give the frames back, the lazy fault handler maps fresh zeroed frames if the pages
+         * are touched again. */
+        vspace_unmap_pages(muslc_this_vspace, addr, (end - start) >> seL4_PageBits, seL4_PageBits, VSPACE_FREE);
+        return 0;
+    }
+
+    /* Nothing would map the pages again, so only the contents can be dropped. */
+    for (uintptr_t v = start; v < end; v += PAGE_SIZE_4K) {
+        if (vspace_get_cap(muslc_this_vspace, (void *) v) != seL4_CapNull) {
+            memset((void *) v, 0, PAGE_SIZE_4K);
+        }
+    }
+    return 0;
+}
+
+void *muslcsys_guarded_map(size_t bytes)
+{
+    if (morecore_area != NULL || muslc_this_vspace == NULL) {
+        return NULL;
+    }
+    size_t pages = BYTES_TO_4K_PAGES(bytes);
+    void *vaddr;
+    /* The guard page stays reserved, so nothing else is mapped there while this
+     * mapping is live */
+    reservation_t reservation = vspace_reserve_range(muslc_this_vspace, (pages + 1) * PAGE_SIZE_4K,
+                                                     seL4_AllRights, 1, &vaddr);
+    if (reservation.res == NULL) {
+        ZF_LOGE("Failed to reserve %zu pages for a guarded mapping", pages + 1);
+        return NULL;
+    }
+    int error = vspace_new_pages_at_vaddr(muslc_this_vspace, vaddr, pages, seL4_PageBits, reservation);
+    if (error) {
+        ZF_LOGE("Failed to map %zu pages for a guarded mapping", pages);
+        vspace_free_reservation(muslc_this_vspace, reservation);
+        return NULL;
+    }
+    return vaddr;
+}
+
+void muslcsys_guarded_unmap(void *vaddr, size_t bytes)
+{
+    vspace_unmap_pages(muslc_this_vspace, vaddr, BYTES_TO_4K_PAGES(bytes), seL4_PageBits, VSPACE_FREE);
+    vspace_free_reservation_by_vaddr(muslc_this_vspace, vaddr);
+}
+
 #endif
 
-/* This is a "dummy" implementation of sys_madvise() to satisfy free() in muslc. */
+/* With a dynamic morecore MADV_DONTNEED drops the contents of the pages, and gives their frames
+ * back if they are in a lazy brk reservation, otherwise this is a dummy to satisfy free() in
+ * muslc. */
 long sys_madvise(va_list ap)
 {
+    UNUSED void *addr = va_arg(ap, void *);
+    UNUSED size_t length = va_arg(ap, size_t);
+    UNUSED int advice = va_arg(ap, int);
+
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_BYTES == 0
+    if (morecore_area == NULL && muslc_this_vspace != NULL && !in_early_area((uintptr_t) addr)) {
+        return sys_madvise_dynamic(addr, length, advice);
+    }
+#endif
     ZF_LOGV("calling dummy version of sys_madvise()\n");
     return 0;
 }
@@ -364,6 +645,22 @@ long sys_mmap2(va_list ap)
 
 long sys_munmap(va_list ap)
 {
+    void *addr = va_arg(ap, void *);
+    UNUSED size_t length = va_arg(ap, size_t);
+
+    if (sys_mmap_in_cpio_archive(addr)) {
+        /* a file mapped in place, which stays in the archive */
+        return 0;
+    }
+#if CONFIG_LIB_SEL4_MUSLC_SYS_MORECORE_BYTES == 0
+    if (in_early_area((uintptr_t) addr)) {
+        /* the early area is never given back */
+        return 0;
+    }
+    if (morecore_area == NULL && muslc_this_vspace != NULL) {
+        return sys_munmap_dynamic(addr, length);
+    }
+#endif
     ZF_LOGE("%s is unsupported. This may have been called due to a "
             "large malloc'd region being free'd.", __func__);
     return 0;
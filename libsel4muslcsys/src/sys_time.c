@@ -0,0 +1,237 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4muslcsys/gen_config.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <bits/syscall.h>
+
+#include <sel4/sel4.h>
+#include <utils/util.h>
+#include <platsupport/ltimer.h>
+#include <sel4utils/time_server/client.h>
+
+#include <muslcsys/time.h>
+#include "syscalls.h"
+
+#define MUSLCSYS_CLOCK_REALTIME 0
+#define MUSLCSYS_CLOCK_MONOTONIC 1
+#define MUSLCSYS_CLOCK_MONOTONIC_RAW 4
+#define MUSLCSYS_CLOCK_REALTIME_COARSE 5
+#define MUSLCSYS_CLOCK_MONOTONIC_COARSE 6
+#define MUSLCSYS_CLOCK_BOOTTIME 7
+#define MUSLCSYS_TIMER_ABSTIME 1
+
+static ltimer_t *clock_ltimer;
+static sel4utils_time_page_t *clock_time_page;
+static uint64_t clock_spin_threshold_ns;
+
+void muslcsys_time_init(ltimer_t *ltimer, sel4utils_time_page_t *time_page, uint64_t spin_threshold_ns)
+{
+    clock_ltimer = ltimer;
+    clock_time_page = time_page;
+    clock_spin_threshold_ns = spin_threshold_ns;
+}
+
+/* Read the monotonic time and the offset of the wall clock time from it */
+static int clock_read(uint64_t *time, uint64_t *realtime_offset_ns)
+{
+    if (clock_time_page != NULL && sel4utils_time_page_get_time(clock_time_page, time, realtime_offset_ns)) {
+        return 0;
+    }
+    *realtime_offset_ns = 0;
+    if (clock_ltimer == NULL) {
+        ZF_LOGE("The time syscalls need a clock from muslcsys_time_init");
+        return -ENOSYS;
+    }
+    return ltimer_get_time(clock_ltimer, time) == 0 ? 0 : -EINVAL;
+}
+
+static bool clock_is_realtime(clockid_t clock)
+{
+    return clock == MUSLCSYS_CLOCK_REALTIME || clock == MUSLCSYS_CLOCK_REALTIME_COARSE;
+}
+
+static bool clock_is_monotonic(clockid_t clock)
+{
+    return clock == MUSLCSYS_CLOCK_MONOTONIC || clock == MUSLCSYS_CLOCK_MONOTONIC_RAW
+           || clock == MUSLCSYS_CLOCK_MONOTONIC_COARSE || clock == MUSLCSYS_CLOCK_BOOTTIME;
+}
+
+static int clock_get_ns(clockid_t clock, uint64_t *ns)
+{
+    if (!clock_is_realtime(clock) && !clock_is_monotonic(clock)) {
+        return -EINVAL;
+    }
+    uint64_t offset;
+    int error = clock_read(ns, &offset);
+    if (error) {
+        return error;
+    }
+    if (clock_is_realtime(clock)) {
+        *ns += offset;
+    }
+    return 0;
+}
+
+/* Block until the monotonic time is deadline */
+static int clock_sleep_until(uint64_t deadline)
+{
+    seL4_CPtr notification = sys_futex_thread_notification();
+    ltimer_t *ltimer = sys_futex_thread_ltimer();
+    uint64_t time, offset;
+
+    int error = clock_read(&time, &offset);
+    while (!error && time < deadline) {
+        if (deadline - time > clock_spin_threshold_ns) {
+            /* A signal for something else only makes the thread check the time early. */
+            if (notification != seL4_CapNull && ltimer != NULL
+                && ltimer_set_timeout(ltimer, deadline - clock_spin_threshold_ns, TIMEOUT_ABSOLUTE) == 0) {
+                seL4_Wait(notification, NULL);
+            } else {
+                seL4_Yield();
+            }
+        }
+        error = clock_read(&time, &offset);
+    }
+    return error;
+}
+
+static int clock_sleep(clockid_t clock, int flags, uint64_t ns)
+{
+    if (!clock_is_realtime(clock) && !clock_is_monotonic(clock)) {
+        return -EINVAL;
+    }
+    uint64_t time, offset;
+    int error = clock_read(&time, &offset);
+    if (error) {
+        return error;
+    }
+
+    uint64_t deadline;
+    if (!(flags & MUSLCSYS_TIMER_ABSTIME)) {
+        deadline = time + ns;
+    } else if (clock_is_realtime(clock)) {
+        deadline = ns > offset ? ns - offset : 0;
+    } else {
+        deadline = ns;
+    }
+    return clock_sleep_until(deadline);
+}
+
+/* The syscalls that take a struct timespec on 32-bit platforms with 64-bit
+ * time, the time64 variants, use musl's struct timespec. Those from before
+ * take the kernel's, which is two longs on every platform. */
+
+static int timespec_to_ns(time_t sec, long nsec, uint64_t *ns)
+{
+    if (sec < 0 || nsec < 0 || nsec >= NS_IN_S) {
+        return -EINVAL;
+    }
+    *ns = sec * NS_IN_S + nsec;
+    return 0;
+}
+
+long sys_clock_gettime(va_list ap)
+{
+    clockid_t clock = va_arg(ap, clockid_t);
+    long *ts = va_arg(ap, long *);
+
+    uint64_t ns;
+    int error = clock_get_ns(clock, &ns);
+    if (error) {
+        return error;
+    }
+    ts[0] = ns / NS_IN_S;
+    ts[1] = ns % NS_IN_S;
+    return 0;
+}
+
+long sys_gettimeofday(va_list ap)
+{
+    long *tv = va_arg(ap, long *);
+    int *tz = va_arg(ap, int *);
+
+    uint64_t ns;
+    int error = clock_get_ns(MUSLCSYS_CLOCK_REALTIME, &ns);
+    if (error) {
+        return error;
+    }
+    if (tv != NULL) {
+        tv[0] = ns / NS_IN_S;
+        tv[1] = (ns % NS_IN_S) / NS_IN_US;
+    }
+    if (tz != NULL) {
+        /* minutes west of Greenwich, and no daylight saving */
+        tz[0] = 0;
+        tz[1] = 0;
+    }
+    return 0;
+}
+
+long sys_nanosleep(va_list ap)
+{
+    const long *req = va_arg(ap, const long *);
+
+    uint64_t ns;
+    int error = timespec_to_ns(req[0], req[1], &ns);
+    if (error) {
+        return error;
+    }
+    return clock_sleep(MUSLCSYS_CLOCK_MONOTONIC, 0, ns);
+}
+
+long sys_clock_nanosleep(va_list ap)
+{
+    clockid_t clock = va_arg(ap, clockid_t);
+    int flags = va_arg(ap, int);
+    const long *req = va_arg(ap, const long *);
+
+    uint64_t ns;
+    int error = timespec_to_ns(req[0], req[1], &ns);
+    if (error) {
+        return error;
+    }
+    return clock_sleep(clock, flags, ns);
+}
+
+#ifdef __NR_clock_gettime64
+long sys_clock_gettime64(va_list ap)
+{
+    clockid_t clock = va_arg(ap, clockid_t);
+    struct timespec *ts = va_arg(ap, struct timespec *);
+
+    uint64_t ns;
+    int error = clock_get_ns(clock, &ns);
+    if (error) {
+        return error;
+    }
+    ts->tv_sec = ns / NS_IN_S;
+    ts->tv_nsec = ns % NS_IN_S;
+    return 0;
+}
+#endif
+
+#ifdef __NR_clock_nanosleep_time64
+long sys_clock_nanosleep_time64(va_list ap)
+{
+    clockid_t clock = va_arg(ap, clockid_t);
+    int flags = va_arg(ap, int);
+    const struct timespec *req = va_arg(ap, const struct timespec *);
+
+    uint64_t ns;
+    int error = timespec_to_ns(req->tv_sec, req->tv_nsec, &ns);
+    if (error) {
+        return error;
+    }
+    return clock_sleep(clock, flags, ns);
+}
+#endif
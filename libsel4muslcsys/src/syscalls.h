@@ -7,6 +7,11 @@
 #pragma once
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sel4/sel4.h>
+#include <platsupport/ltimer.h>
 
 /* prototype all the syscalls we implement */
 long sys_set_thread_area(va_list ap);
@@ -37,3 +42,21 @@ long sys_mremap(va_list ap);
 long sys_write(va_list ap);
 long sys_writev(va_list ap);
 long sys_madvise(va_list ap);
+long sys_futex(va_list ap);
+long sys_clock_gettime(va_list ap);
+long sys_gettimeofday(va_list ap);
+long sys_nanosleep(va_list ap);
+long sys_clock_nanosleep(va_list ap);
+/* only on 32-bit platforms with 64-bit time */
+long sys_clock_gettime64(va_list ap);
+long sys_clock_nanosleep_time64(va_list ap);
+
+/* shared between the syscall implementations */
+long sys_mmap_impl(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+/* mmap of an open file, open files are all in the cpio archive */
+long sys_mmap_file(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+/* whether addr was returned by sys_mmap_file without copying, in which case there is nothing to unmap */
+bool sys_mmap_in_cpio_archive(void *addr);
+/* the notification and timer the calling thread registered with muslcsys_futex_register_thread */
+seL4_CPtr sys_futex_thread_notification(void);
+ltimer_t *sys_futex_thread_ltimer(void);
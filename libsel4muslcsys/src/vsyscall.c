@@ -157,59 +157,66 @@ static muslcsys_syscall_t syscall_table[MUSLC_NUM_SYSCALLS] = {
 #endif
     [__NR_mremap] = sys_mremap,
     [__NR_madvise] = sys_madvise,
-};
-
-/* Additional syscall lookup table for handling spare syscalls or syscalls that have large
- * numbers. Currently The number of these is very small and so it's an unordered list that
- * must be searched to find a syscall */
-typedef struct sparse_syscall {
-    int sysnum;
-    muslcsys_syscall_t syscall;
-} sparse_syscall_t;
-
-static sparse_syscall_t sparse_syscall_table[] = {
-#ifdef __ARM_NR_breakpoint
-    {__ARM_NR_breakpoint, NULL},
+#ifdef __NR_futex
+    [__NR_futex] = sys_futex,
+#endif
+#ifdef __NR_futex_time64
+    [__NR_futex_time64] = sys_futex,
 #endif
-#ifdef __ARM_NR_cacheflush
-    {__ARM_NR_cacheflush, NULL},
+    [__NR_clock_gettime] = sys_clock_gettime,
+#ifdef __NR_clock_gettime64
+    [__NR_clock_gettime64] = sys_clock_gettime64,
 #endif
-#ifdef __ARM_NR_usr26
-    {__ARM_NR_usr26, NULL},
+#ifdef __NR_gettimeofday
+    [__NR_gettimeofday] = sys_gettimeofday,
 #endif
-#ifdef __ARM_NR_usr32
-    {__ARM_NR_usr32, NULL},
+#ifdef __NR_nanosleep
+    [__NR_nanosleep] = sys_nanosleep,
 #endif
+    [__NR_clock_nanosleep] = sys_clock_nanosleep,
+#ifdef __NR_clock_nanosleep_time64
+    [__NR_clock_nanosleep_time64] = sys_clock_nanosleep_time64,
+#endif
+};
+
+/* Additional syscall table for the ARM private syscalls, which are numbered from 0x0f0000
+ * so are far past the end of syscall_table. They are few and consecutive, so this is indexed
+ * directly from the base as well, so that every syscall is found without searching */
+#ifdef __ARM_NR_breakpoint
+#define MUSLC_SPARSE_SYSCALL_BASE 0x0f0000
+#define MUSLC_NUM_SPARSE_SYSCALLS 8
+
+static muslcsys_syscall_t sparse_syscall_table[MUSLC_NUM_SPARSE_SYSCALLS] = {
 #ifdef __ARM_NR_set_tls
-    {__ARM_NR_set_tls, boot_set_thread_area},
+    [__ARM_NR_set_tls - MUSLC_SPARSE_SYSCALL_BASE] = boot_set_thread_area,
 #endif
 };
+#endif
 
-static int find_sparse_syscall(int syscall)
+/* Returns the entry for a syscall in either table, or NULL if it is in neither */
+static muslcsys_syscall_t *find_syscall(long syscall)
 {
-    for (int i = 0; i < ARRAY_SIZE(sparse_syscall_table); i++) {
-        if (sparse_syscall_table[i].sysnum == syscall) {
-            return i;
-        }
+    if (syscall >= 0 && syscall < ARRAY_SIZE(syscall_table)) {
+        return &syscall_table[syscall];
+    }
+#ifdef MUSLC_SPARSE_SYSCALL_BASE
+    if (syscall >= MUSLC_SPARSE_SYSCALL_BASE && syscall - MUSLC_SPARSE_SYSCALL_BASE < ARRAY_SIZE(sparse_syscall_table)) {
+        return &sparse_syscall_table[syscall - MUSLC_SPARSE_SYSCALL_BASE];
     }
-    return -1;
+#endif
+    return NULL;
 }
 
 muslcsys_syscall_t muslcsys_install_syscall(int syscall, muslcsys_syscall_t new_syscall)
 {
-    muslcsys_syscall_t ret;
-    if (syscall >= ARRAY_SIZE(syscall_table)) {
-        int index = find_sparse_syscall(syscall);
-        if (index < 0) {
-            ZF_LOGF("Syscall %d exceeds syscall table size of %zu and not found in sparse table", syscall,
-                    ARRAY_SIZE(syscall_table));
-        }
-        ret = sparse_syscall_table[index].syscall;
-        sparse_syscall_table[index].syscall = ret;
-    } else {
-        ret = syscall_table[syscall];
-        syscall_table[syscall] = new_syscall;
+    muslcsys_syscall_t *entry = find_syscall(syscall);
+    if (entry == NULL) {
+        ZF_LOGF("Syscall %d exceeds syscall table size of %zu and not found in sparse table", syscall,
+                ARRAY_SIZE(syscall_table));
+        return NULL;
     }
+    muslcsys_syscall_t ret = *entry;
+    *entry = new_syscall;
     return ret;
 }
 
@@ -266,17 +273,8 @@ long sel4_vsyscall(long sysnum, ...)
 {
     va_list al;
     va_start(al, sysnum);
-    muslcsys_syscall_t syscall;
-    if (sysnum < 0 || sysnum >= ARRAY_SIZE(syscall_table)) {
-        int index = find_sparse_syscall(sysnum);
-        if (index < 0) {
-            debug_error(sysnum);
-            return -ENOSYS;
-        }
-        syscall = sparse_syscall_table[index].syscall;
-    } else {
-        syscall = syscall_table[sysnum];
-    }
+    muslcsys_syscall_t *entry = find_syscall(sysnum);
+    muslcsys_syscall_t syscall = entry != NULL ? *entry : NULL;
     /* Check a syscall is implemented there */
     if (!syscall) {
         debug_error(sysnum);
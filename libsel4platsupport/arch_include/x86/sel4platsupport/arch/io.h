@@ -23,3 +23,47 @@
  */
 int sel4platsupport_get_io_port_ops(ps_io_port_ops_t *ops, simple_t *simple, vka_t *vka);
 
+/*
+ * Keep an IOPort capability for a window of ports, such as the registers of a device, so
+ * that accesses within it are a single invocation rather than minting and deleting a
+ * capability each time. Accesses outside every window still mint one for just the ports
+ * accessed, which fails if they overlap a window, as IOPort capabilities can not overlap.
+ *
+ * @param ops   interface filled in by sel4platsupport_get_io_port_ops
+ * @param first first port of the window
+ * @param last  last port of the window, inclusive
+ *
+ * @return 0 on success, -1 if the window overlaps another or its capability could not be
+ *         made.
+ */
+int sel4platsupport_io_port_ops_add_range(ps_io_port_ops_t *ops, uint32_t first, uint32_t last);
+
+/*
+ * Delete the capability kept for a window added with sel4platsupport_io_port_ops_add_range.
+ *
+ * @return 0 on success, -1 if there is no such window.
+ */
+int sel4platsupport_io_port_ops_remove_range(ps_io_port_ops_t *ops, uint32_t first, uint32_t last);
+
+/*
+ * Read count values from one port into buf, as the ins instructions do. With ops from
+ * sel4platsupport_get_io_port_ops the capability for the port is looked up, or minted, once
+ * and each value is then a single invocation; other ops are called once per value.
+ *
+ * @param ops     io port interface
+ * @param port    port to read
+ * @param io_size size of each value, 1, 2 or 4 bytes
+ * @param count   number of values to read
+ * @param buf     array of count values of io_size bytes each
+ *
+ * @return 0 on success, or the error of the first failed read, after which the rest of buf
+ *         is left unwritten.
+ */
+int sel4platsupport_io_port_in_n(ps_io_port_ops_t *ops, uint32_t port, int io_size, size_t count, void *buf);
+
+/*
+ * Write count values from buf to one port, as the outs instructions do. See
+ * sel4platsupport_io_port_in_n.
+ */
+int sel4platsupport_io_port_out_n(ps_io_port_ops_t *ops, uint32_t port, int io_size, size_t count,
+                                  const void *buf);
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sel4/sel4.h>
+#include <simple/simple.h>
+#include <vka/vka.h>
+#include <vspace/vspace.h>
+#include <platsupport/io.h>
+
+/* The offset of the node with each phandle in an FDT, sorted by phandle */
+typedef struct sel4platsupport_fdt_phandle {
+    uint32_t phandle;
+    int offset;
+} sel4platsupport_fdt_phandle_t;
+
+typedef struct sel4platsupport_fdt_index {
+    const void *fdt;
+    size_t num_phandles;
+    sel4platsupport_fdt_phandle_t *phandles;
+} sel4platsupport_fdt_index_t;
+
+/*
+ * Map the FDT from the extended bootinfo into another vspace read only, sharing the
+ * frames of the bootinfo rather than copying it. The vspace can be torn down with vka
+ * as normal, which only deletes the cap copies this makes.
+ *
+ * @param simple to find the FDT and its frames with
+ * @param vka to allocate slots for the copies of the frame caps with
+ * @param to vspace to map the FDT into
+ * @return address of the FDT in to, or NULL if there is no FDT in the bootinfo or on error
+ */
+void *sel4platsupport_share_fdt(simple_t *simple, vka_t *vka, vspace_t *to);
+
+/*
+ * Index the nodes of an FDT by phandle with a single walk of the tree, for drivers
+ * that follow a lot of phandles. The FDT must not change while the index is used.
+ *
+ * @param index to fill in
+ * @param fdt the FDT, such as from ps_io_fdt_get
+ * @param malloc_ops to allocate the index with
+ * @return 0 on success
+ */
+int sel4platsupport_fdt_index_init(sel4platsupport_fdt_index_t *index, const void *fdt,
+                                   ps_malloc_ops_t *malloc_ops);
+
+/*
+ * Find the node with a phandle.
+ *
+ * @param index initialised with sel4platsupport_fdt_index_init
+ * @param phandle of the node
+ * @return offset of the node in the FDT, or -FDT_ERR_NOTFOUND
+ */
+int sel4platsupport_fdt_index_node(sel4platsupport_fdt_index_t *index, uint32_t phandle);
+
+/*
+ * Free an index.
+ *
+ * @param index initialised with sel4platsupport_fdt_index_init
+ * @param malloc_ops the index was allocated with
+ */
+void sel4platsupport_fdt_index_destroy(sel4platsupport_fdt_index_t *index, ps_malloc_ops_t *malloc_ops);
@@ -28,7 +28,9 @@
 
 /**
  * Creates a new implementation of the platsupport io_mapper interface using a
- * provided simple, vspace and vka
+ * provided simple, vspace and vka. Mapping a region (paddr, size and cacheability)
+ * that is already mapped returns the existing mapping, which is only unmapped once
+ * every mapping of it has been unmapped
  *
  * @param vspace VSpace interface to use for mapping
  * @param vka VKA interface for allocating physical frames, and any extra objects or cslots
@@ -47,7 +49,9 @@ int sel4platsupport_new_io_mapper(vspace_t *vspace, vka_t *vka, ps_io_mapper_t *
 int sel4platsupport_new_malloc_ops(ps_malloc_ops_t *ops);
 
 /**
- * Create a new FDT ops structure using a provided simple
+ * Create a new FDT ops structure using a provided simple. If simple can find the FDT in
+ * place in the extended bootinfo it is used from there, otherwise it is copied into memory
+ * from malloc_ops.
  *
  * @param io_fdt Interface to fill in
  * @param simple An initialised simple interface
@@ -179,6 +179,22 @@ int sel4platsupport_irq_unset_ntfn(ps_irq_ops_t *irq_ops, irq_id_t irq_id);
  */
 int sel4platsupport_irq_handle(ps_irq_ops_t *irq_ops, ntfn_id_t ntfn_id, seL4_Word handle_mask);
 
+/*
+ * Registers a block of IRQs with the same callback, such as the vectors of a device.
+ * Either all of them are registered or none are.
+ *
+ * @param irq_ops Initialised IRQ interface
+ * @param num_irqs Number of IRQs to register
+ * @param irqs Array of num_irqs IRQs to register
+ * @param callback Callback to call for each of them
+ * @param callback_data Array of num_irqs pieces of data for each IRQ's callback, can be NULL
+ * @param[out] ret_ids Array of num_irqs to write the IDs the IRQs were assigned to
+ *
+ * @return 0 on success, otherwise an error code
+ */
+int sel4platsupport_irq_register_n(ps_irq_ops_t *irq_ops, size_t num_irqs, ps_irq_t *irqs,
+                                   irq_callback_fn_t callback, void **callback_data, irq_id_t *ret_ids);
+
 /*
  * Waits on a registered notification.
  *
@@ -208,3 +224,61 @@ int sel4platsupport_irq_wait(ps_irq_ops_t *irq_ops, ntfn_id_t ntfn_id,
  */
 int sel4platsupport_irq_poll(ps_irq_ops_t *irq_ops, ntfn_id_t ntfn_id,
                              seL4_Word poll_mask, seL4_Word *ret_leftover_bits);
+
+/* Cycles spent in one stage of handling an IRQ, over the samples kept when tracing */
+typedef struct sel4platsupport_irq_trace_stage {
+    uint64_t min;
+    uint64_t avg;
+    uint64_t p99;
+    uint64_t max;
+} sel4platsupport_irq_trace_stage_t;
+
+typedef struct sel4platsupport_irq_trace_summary {
+    size_t num_samples;
+    /* from the wait returning to the interface dispatching the IRQ */
+    sel4platsupport_irq_trace_stage_t dispatch;
+    /* from the dispatch to calling the callback */
+    sel4platsupport_irq_trace_stage_t callback;
+    /* from calling the callback to it acknowledging the IRQ */
+    sel4platsupport_irq_trace_stage_t ack;
+    /* from the wait returning to the IRQ being acknowledged */
+    sel4platsupport_irq_trace_stage_t total;
+} sel4platsupport_irq_trace_summary_t;
+
+/*
+ * Records that a thread has returned from waiting on a provided notification, for users that
+ * wait on it themselves and then call sel4platsupport_irq_handle. Does nothing unless
+ * LibSel4PlatSupportIrqTrace is set.
+ *
+ * @param irq_ops Initialised IRQ interface
+ * @param ntfn_id ID of the notification that was waited on
+ */
+void sel4platsupport_irq_trace_wake(ps_irq_ops_t *irq_ops, ntfn_id_t ntfn_id);
+
+/*
+ * Summarises how long the most recent deliveries of an IRQ spent in each stage of being
+ * handled, in cycles. Only deliveries that were acknowledged are counted.
+ *
+ * @param irq_ops Initialised IRQ interface
+ * @param irq_id ID of the IRQ
+ * @param[out] summary Summary to fill in
+ *
+ * @return 0 on success, -ENOSYS if LibSel4PlatSupportIrqTrace is not set, otherwise an error code
+ */
+int sel4platsupport_irq_trace_summary(ps_irq_ops_t *irq_ops, irq_id_t irq_id,
+                                      sel4platsupport_irq_trace_summary_t *summary);
+
+/*
+ * Counts the deliveries of an IRQ that were acknowledged, and the cycles they took from the
+ * wait returning to the acknowledgement, since it was registered. The difference between two
+ * calls is how much time handling the IRQ took in between.
+ *
+ * @param irq_ops Initialised IRQ interface
+ * @param irq_id ID of the IRQ
+ * @param[out] ret_deliveries Pointer to write the number of deliveries to, can be NULL
+ * @param[out] ret_cycles Pointer to write the number of cycles to, can be NULL
+ *
+ * @return 0 on success, -ENOSYS if LibSel4PlatSupportIrqTrace is not set, otherwise an error code
+ */
+int sel4platsupport_irq_trace_load(ps_irq_ops_t *irq_ops, irq_id_t irq_id,
+                                   uint64_t *ret_deliveries, uint64_t *ret_cycles);
@@ -6,6 +6,9 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include <vspace/vspace.h>
 #include <simple/simple.h>
 #include <vka/vka.h>
@@ -31,9 +34,40 @@ platsupport_serial_setup_io_ops(ps_io_ops_t* io_ops);
 void
 register_console(ps_chardevice_t* user_console);
 
+/* How console output is buffered before it is written to the device */
+typedef enum {
+    /* written out a character at a time as it comes, the default */
+    PLATSUPPORT_CONSOLE_UNBUFFERED,
+    /* written out in one go at each newline, or once the buffer fills */
+    PLATSUPPORT_CONSOLE_LINE_BUFFERED,
+    /* written out in one go once the buffer fills, or on platsupport_console_flush */
+    PLATSUPPORT_CONSOLE_FULLY_BUFFERED,
+} platsupport_console_mode_t;
+
+/* Set how console output is buffered, writing out anything already buffered first. When
+ * nonblocking, the device is only offered output once each time it would be written out:
+ * whatever the device does not take stays buffered, and output that does not fit in the
+ * buffer is dropped rather than waited for. How much the device takes at once depends on
+ * its driver, many wait for the whole write regardless. */
+void
+platsupport_console_set_mode(platsupport_console_mode_t mode, bool nonblocking);
+
+/* Write out all buffered console output, waiting for the device */
+void
+platsupport_console_flush(void);
+
+/* Number of bytes of console output dropped in nonblocking mode */
+size_t
+platsupport_console_dropped(void);
+
 void
 platsupport_undo_serial_setup(void);
 
 void
 platsupport_serial_input_init_IRQ(void);
 
+/* The device console output goes to and console input comes from, for users that
+ * take over reading it, such as from its receive interrupt */
+ps_chardevice_t *
+platsupport_get_console(void);
+
@@ -18,6 +18,10 @@
 #define MAX_IRQS 4
 #define MAX_OBJS 4
 
+/* Buckets of the lateness histograms. Bucket 0 counts timeouts that were on time, bucket n
+ * those that were [2^(n-1), 2^n) ns late, and the last bucket anything later */
+#define SEL4PLATSUPPORT_TIMER_LATENESS_BUCKETS 32
+
 typedef struct seL4_timer seL4_timer_t;
 
 typedef void (*handle_irq_fn_t)(seL4_timer_t *timer, uint32_t irq);
@@ -32,6 +36,18 @@ typedef struct timer_objects {
     sel4ps_pmem_t objs[MAX_OBJS];
 } timer_objects_t;
 
+/* Hybrid timeouts for sel4platsupport_timer_wait_until */
+typedef struct timer_hybrid {
+    /* deadlines closer than this are spun for instead of waiting for an interrupt */
+    uint64_t spin_threshold_ns;
+    /* how early to have the interrupt come for deadlines further away, the rest is spun for */
+    uint64_t early_ns;
+    /* how late interrupts came compared to when they were asked for */
+    uint64_t irq_lateness[SEL4PLATSUPPORT_TIMER_LATENESS_BUCKETS];
+    /* how late sel4platsupport_timer_wait_until returned compared to the deadline */
+    uint64_t lateness[SEL4PLATSUPPORT_TIMER_LATENESS_BUCKETS];
+} timer_hybrid_t;
+
 struct seL4_timer {
     /* os independent timer interface */
     ltimer_t ltimer;
@@ -44,6 +60,9 @@ struct seL4_timer {
 
     /* destroy this timer, it will no longer be valid */
     destroy_fn_t destroy;
+
+    /* configuration and statistics of sel4platsupport_timer_wait_until */
+    timer_hybrid_t hybrid;
 };
 
 /**
@@ -137,3 +156,30 @@ void sel4platsupport_destroy_timer(seL4_timer_t *timer, vka_t *vka);
  * @return         IRQ cap on success, otherwise seL4_CapNull on failure.
  */
 seL4_CPtr sel4platsupport_timer_objs_get_irq_cap(timer_objects_t *to, int id, irq_type_t type);
+
+/*
+ * Configure the hybrid timeouts of sel4platsupport_timer_wait_until. Both default to 0,
+ * which always waits for an interrupt.
+ *
+ * @param timer             initialised timer.
+ * @param spin_threshold_ns deadlines closer than this are spun for.
+ * @param early_ns          how early to ask for the interrupt for other deadlines, which
+ *                          should cover the irq lateness seen in the statistics.
+ */
+void sel4platsupport_timer_set_hybrid(seL4_timer_t *timer, uint64_t spin_threshold_ns, uint64_t early_ns);
+
+/*
+ * Block until a deadline with low jitter. Deadlines closer than the spin threshold are spun
+ * for on the timer. For others a timeout is set for early_ns before the deadline, the
+ * notification is waited on, and the rest is spun for. How late the interrupt and the
+ * return were are recorded in timer->hybrid.
+ *
+ * The notification must only be used for this timer's irqs, as any other badges that come
+ * in while waiting are lost.
+ *
+ * @param timer       initialised timer.
+ * @param ntfn        notification the timer was initialised with.
+ * @param deadline_ns time to return at.
+ * @return            0 on success.
+ */
+int sel4platsupport_timer_wait_until(seL4_timer_t *timer, seL4_CPtr ntfn, uint64_t deadline_ns);
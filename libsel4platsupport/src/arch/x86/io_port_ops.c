@@ -9,32 +9,104 @@
 #include <sel4platsupport/io.h>
 #include <sel4platsupport/arch/io.h>
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <utils/util.h>
 #include <vka/capops.h>
 
+/* An IOPort cap kept for a window of ports */
+typedef struct io_port_range {
+    uint32_t first;
+    uint32_t last;
+    cspacepath_t path;
+} io_port_range_t;
+
 typedef struct io_cookie {
     simple_t *simple;
     vka_t *vka;
+    /* sorted by first port, and never overlapping */
+    size_t num_ranges;
+    size_t max_ranges;
+    io_port_range_t *ranges;
 } io_cookie_t;
 
+/* Index of the first range that does not end before port */
+static size_t
+io_port_range_search(io_cookie_t *io_cookie, uint32_t port)
+{
+    size_t low = 0, high = io_cookie->num_ranges;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (io_cookie->ranges[mid].last < port) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* The cached cap covering [port, last_port], if there is one */
+static io_port_range_t *
+io_port_range_find(io_cookie_t *io_cookie, uint32_t port, uint32_t last_port)
+{
+    size_t i = io_port_range_search(io_cookie, port);
+    if (i < io_cookie->num_ranges && io_cookie->ranges[i].first <= port && last_port <= io_cookie->ranges[i].last) {
+        return &io_cookie->ranges[i];
+    }
+    return NULL;
+}
+
+/* Find a cap to access [port, last_port] with, minting one into a new slot if none is
+ * cached. A minted cap must be given back with io_port_put_cap */
 static int
-sel4platsupport_io_port_in(void *cookie, uint32_t port, int io_size, uint32_t *result)
+io_port_get_cap(io_cookie_t *io_cookie, uint32_t port, uint32_t last_port, cspacepath_t *path, bool *minted)
 {
-    io_cookie_t *io_cookie = cookie;
-    uint32_t last_port = port + io_size - 1;
-    cspacepath_t path;
-    int error;
-    error = vka_cspace_alloc_path(io_cookie->vka, &path);
+    io_port_range_t *range = io_port_range_find(io_cookie, port, last_port);
+    if (range != NULL) {
+        *path = range->path;
+        *minted = false;
+        return 0;
+    }
+
+    int error = vka_cspace_alloc_path(io_cookie->vka, path);
     if (error) {
         ZF_LOGE("Failed to allocate slot");
         return error;
     }
-    error = simple_get_IOPort_cap(io_cookie->simple, port, last_port, path.root, path.capPtr, path.capDepth);
+    error = simple_get_IOPort_cap(io_cookie->simple, port, last_port, path->root, path->capPtr, path->capDepth);
     if (error) {
         ZF_LOGE("Failed to get capability for IOPort range 0x%x-0x%x", port, last_port);
+        vka_cspace_free_path(io_cookie->vka, *path);
         return -1;
     }
+    *minted = true;
+    return 0;
+}
+
+static void
+io_port_put_cap(io_cookie_t *io_cookie, cspacepath_t *path, bool minted)
+{
+    if (minted) {
+        vka_cnode_delete(path);
+        vka_cspace_free_path(io_cookie->vka, *path);
+    }
+}
+
+static int
+sel4platsupport_io_port_in(void *cookie, uint32_t port, int io_size, uint32_t *result)
+{
+    io_cookie_t *io_cookie = cookie;
+    uint32_t last_port = port + io_size - 1;
+    cspacepath_t path;
+    bool minted;
+    int error;
+    error = io_port_get_cap(io_cookie, port, last_port, &path, &minted);
+    if (error) {
+        return error;
+    }
 
     switch (io_size) {
     case 1: {
@@ -61,8 +133,7 @@ sel4platsupport_io_port_in(void *cookie, uint32_t port, int io_size, uint32_t *r
         break;
     }
 
-    vka_cnode_delete(&path);
-    vka_cspace_free_path(io_cookie->vka, path);
+    io_port_put_cap(io_cookie, &path, minted);
     return error;
 }
 
@@ -72,17 +143,12 @@ sel4platsupport_io_port_out(void *cookie, uint32_t port, int io_size, uint32_t v
     io_cookie_t *io_cookie = cookie;
     uint32_t last_port = port + io_size - 1;
     cspacepath_t path;
+    bool minted;
     int error;
-    error = vka_cspace_alloc_path(io_cookie->vka, &path);
+    error = io_port_get_cap(io_cookie, port, last_port, &path, &minted);
     if (error) {
-        ZF_LOGE("Failed to allocate slot");
         return error;
     }
-    error = simple_get_IOPort_cap(io_cookie->simple, port, last_port, path.root, path.capPtr, path.capDepth);
-    if (error) {
-        ZF_LOGE("Failed to get capability for IOPort range 0x%x-0x%x", port, last_port);
-        return -1;
-    }
 
     int result;
     switch (io_size) {
@@ -100,18 +166,226 @@ sel4platsupport_io_port_out(void *cookie, uint32_t port, int io_size, uint32_t v
         result = -1;
         break;
     }
-    vka_cnode_delete(&path);
-    vka_cspace_free_path(io_cookie->vka, path);
+    io_port_put_cap(io_cookie, &path, minted);
     return result;
 }
 
+int
+sel4platsupport_io_port_ops_add_range(ps_io_port_ops_t *ops, uint32_t first, uint32_t last)
+{
+    assert(ops != NULL);
+    io_cookie_t *io_cookie = ops->cookie;
+    if (first > last) {
+        ZF_LOGE("Invalid IOPort range 0x%x-0x%x", first, last);
+        return -1;
+    }
+
+    size_t i = io_port_range_search(io_cookie, first);
+    if (i < io_cookie->num_ranges && io_cookie->ranges[i].first <= last) {
+        ZF_LOGE("IOPort range 0x%x-0x%x overlaps 0x%x-0x%x", first, last,
+                io_cookie->ranges[i].first, io_cookie->ranges[i].last);
+        return -1;
+    }
+
+    if (io_cookie->num_ranges == io_cookie->max_ranges) {
+        size_t max_ranges = MAX(io_cookie->max_ranges * 2, 4);
+        io_port_range_t *ranges = realloc(io_cookie->ranges, max_ranges * sizeof(*ranges));
+        if (ranges == NULL) {
+            ZF_LOGE("Failed to grow IOPort range table");
+            return -1;
+        }
+        io_cookie->ranges = ranges;
+        io_cookie->max_ranges = max_ranges;
+    }
+
+    cspacepath_t path;
+    int error = vka_cspace_alloc_path(io_cookie->vka, &path);
+    if (error) {
+        ZF_LOGE("Failed to allocate slot");
+        return error;
+    }
+    error = simple_get_IOPort_cap(io_cookie->simple, first, last, path.root, path.capPtr, path.capDepth);
+    if (error) {
+        ZF_LOGE("Failed to get capability for IOPort range 0x%x-0x%x", first, last);
+        vka_cspace_free_path(io_cookie->vka, path);
+        return -1;
+    }
+
+    memmove(&io_cookie->ranges[i + 1], &io_cookie->ranges[i], (io_cookie->num_ranges - i) * sizeof(*io_cookie->ranges));
+    io_cookie->ranges[i] = (io_port_range_t) {
+        .first = first,
+        .last = last,
+        .path = path,
+    };
+    io_cookie->num_ranges++;
+    return 0;
+}
+
+int
+sel4platsupport_io_port_ops_remove_range(ps_io_port_ops_t *ops, uint32_t first, uint32_t last)
+{
+    assert(ops != NULL);
+    io_cookie_t *io_cookie = ops->cookie;
+    size_t i = io_port_range_search(io_cookie, first);
+    if (i == io_cookie->num_ranges || io_cookie->ranges[i].first != first || io_cookie->ranges[i].last != last) {
+        ZF_LOGE("No IOPort range 0x%x-0x%x", first, last);
+        return -1;
+    }
+
+    vka_cnode_delete(&io_cookie->ranges[i].path);
+    vka_cspace_free_path(io_cookie->vka, io_cookie->ranges[i].path);
+    io_cookie->num_ranges--;
+    memmove(&io_cookie->ranges[i], &io_cookie->ranges[i + 1], (io_cookie->num_ranges - i) * sizeof(*io_cookie->ranges));
+    return 0;
+}
+
+/* Generic version for ops that are not ours, one call per value */
+static int
+io_port_in_n_slow(ps_io_port_ops_t *ops, uint32_t port, int io_size, size_t count, void *buf)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t val;
+        int error = ps_io_port_in(ops, port, io_size, &val);
+        if (error) {
+            return error;
+        }
+        switch (io_size) {
+        case 1:
+            ((uint8_t *) buf)[i] = val;
+            break;
+        case 2:
+            ((uint16_t *) buf)[i] = val;
+            break;
+        default:
+            ((uint32_t *) buf)[i] = val;
+            break;
+        }
+    }
+    return 0;
+}
+
+static int
+io_port_out_n_slow(ps_io_port_ops_t *ops, uint32_t port, int io_size, size_t count, const void *buf)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint32_t val;
+        switch (io_size) {
+        case 1:
+            val = ((const uint8_t *) buf)[i];
+            break;
+        case 2:
+            val = ((const uint16_t *) buf)[i];
+            break;
+        default:
+            val = ((const uint32_t *) buf)[i];
+            break;
+        }
+        int error = ps_io_port_out(ops, port, io_size, val);
+        if (error) {
+            return error;
+        }
+    }
+    return 0;
+}
+
+int
+sel4platsupport_io_port_in_n(ps_io_port_ops_t *ops, uint32_t port, int io_size, size_t count, void *buf)
+{
+    assert(ops != NULL);
+    if (io_size != 1 && io_size != 2 && io_size != 4) {
+        ZF_LOGE("Invalid io_size %d, expected 1, 2 or 4", io_size);
+        return -1;
+    }
+    if (ops->io_port_in_fn != sel4platsupport_io_port_in) {
+        return io_port_in_n_slow(ops, port, io_size, count, buf);
+    }
+
+    io_cookie_t *io_cookie = ops->cookie;
+    cspacepath_t path;
+    bool minted;
+    int error = io_port_get_cap(io_cookie, port, port + io_size - 1, &path, &minted);
+    if (error) {
+        return error;
+    }
+
+    /* the cap is found once, then each value is one invocation */
+    seL4_CPtr cap = path.capPtr;
+    switch (io_size) {
+    case 1:
+        for (size_t i = 0; i < count && !error; i++) {
+            seL4_X86_IOPort_In8_t x = seL4_X86_IOPort_In8(cap, port);
+            ((uint8_t *) buf)[i] = x.result;
+            error = x.error;
+        }
+        break;
+    case 2:
+        for (size_t i = 0; i < count && !error; i++) {
+            seL4_X86_IOPort_In16_t x = seL4_X86_IOPort_In16(cap, port);
+            ((uint16_t *) buf)[i] = x.result;
+            error = x.error;
+        }
+        break;
+    case 4:
+        for (size_t i = 0; i < count && !error; i++) {
+            seL4_X86_IOPort_In32_t x = seL4_X86_IOPort_In32(cap, port);
+            ((uint32_t *) buf)[i] = x.result;
+            error = x.error;
+        }
+        break;
+    }
+    io_port_put_cap(io_cookie, &path, minted);
+    return error;
+}
+
+int
+sel4platsupport_io_port_out_n(ps_io_port_ops_t *ops, uint32_t port, int io_size, size_t count, const void *buf)
+{
+    assert(ops != NULL);
+    if (io_size != 1 && io_size != 2 && io_size != 4) {
+        ZF_LOGE("Invalid io_size %d, expected 1, 2 or 4", io_size);
+        return -1;
+    }
+    if (ops->io_port_out_fn != sel4platsupport_io_port_out) {
+        return io_port_out_n_slow(ops, port, io_size, count, buf);
+    }
+
+    io_cookie_t *io_cookie = ops->cookie;
+    cspacepath_t path;
+    bool minted;
+    int error = io_port_get_cap(io_cookie, port, port + io_size - 1, &path, &minted);
+    if (error) {
+        return error;
+    }
+
+    seL4_CPtr cap = path.capPtr;
+    switch (io_size) {
+    case 1:
+        for (size_t i = 0; i < count && !error; i++) {
+            error = seL4_X86_IOPort_Out8(cap, port, ((const uint8_t *) buf)[i]);
+        }
+        break;
+    case 2:
+        for (size_t i = 0; i < count && !error; i++) {
+            error = seL4_X86_IOPort_Out16(cap, port, ((const uint16_t *) buf)[i]);
+        }
+        break;
+    case 4:
+        for (size_t i = 0; i < count && !error; i++) {
+            error = seL4_X86_IOPort_Out32(cap, port, ((const uint32_t *) buf)[i]);
+        }
+        break;
+    }
+    io_port_put_cap(io_cookie, &path, minted);
+    return error;
+}
+
 int
 sel4platsupport_get_io_port_ops(ps_io_port_ops_t *ops, simple_t *simple, vka_t *vka)
 {
     assert(ops != NULL);
     assert(simple != NULL);
     assert(vka != NULL);
-    io_cookie_t *cookie = malloc(sizeof(*cookie));
+    io_cookie_t *cookie = calloc(1, sizeof(*cookie));
     if (!cookie) {
         return -1;
     }
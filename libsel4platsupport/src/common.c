@@ -307,10 +307,18 @@ WEAK
 #endif
 __arch_write(char *data, size_t count)
 {
+#ifdef CONFIG_LIB_SEL4_MUSLC_SYS_ARCH_PUTCHAR_WEAK
+    /* __arch_putchar may have been overridden, so it has to see every character */
     for (size_t i = 0; i < count; i++) {
         __arch_putchar(data[i]);
     }
     return count;
+#else
+    if (setup_status != SETUP_COMPLETE) {
+        __serial_setup();
+    }
+    return __plat_write(data, count);
+#endif
 }
 
 int __arch_getchar(void)
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <libfdt.h>
+
+#include <sel4platsupport/fdt.h>
+#include <utils/util.h>
+#include <vka/capops.h>
+#include <vspace/page.h>
+
+void *sel4platsupport_share_fdt(simple_t *simple, vka_t *vka, vspace_t *to)
+{
+    if (!simple || !vka || !to) {
+        ZF_LOGE("arguments are NULL");
+        return NULL;
+    }
+
+    const seL4_BootInfoHeader *header = simple_get_extended_bootinfo_ptr(simple, SEL4_BOOTINFO_HEADER_FDT);
+    if (header == NULL) {
+        return NULL;
+    }
+    const void *fdt = header + 1;
+    uintptr_t start = ROUND_DOWN((uintptr_t) fdt, PAGE_SIZE_4K);
+    uintptr_t end = ROUND_UP((uintptr_t) fdt + fdt_totalsize(fdt), PAGE_SIZE_4K);
+    size_t num_pages = (end - start) / PAGE_SIZE_4K;
+
+    seL4_CPtr caps[num_pages];
+    size_t i;
+    for (i = 0; i < num_pages; i++) {
+        seL4_CPtr frame = simple_get_extended_bootinfo_frame(simple, (void *)(start + i * PAGE_SIZE_4K));
+        if (frame == seL4_CapNull) {
+            ZF_LOGE("No cap to the frame of the bootinfo at %p", (void *)(start + i * PAGE_SIZE_4K));
+            goto error;
+        }
+        cspacepath_t src, dest;
+        vka_cspace_make_path(vka, frame, &src);
+        if (vka_cspace_alloc_path(vka, &dest)) {
+            ZF_LOGE("Failed to allocate slot for the FDT");
+            goto error;
+        }
+        if (vka_cnode_copy(&dest, &src, seL4_CanRead) != seL4_NoError) {
+            ZF_LOGE("Failed to copy cap to the FDT");
+            vka_cspace_free_path(vka, dest);
+            goto error;
+        }
+        caps[i] = dest.capPtr;
+    }
+
+    void *mapping = vspace_map_pages(to, caps, NULL, seL4_CanRead, num_pages, PAGE_BITS_4K, 1);
+    if (mapping == NULL) {
+        ZF_LOGE("Failed to map the FDT");
+        goto error;
+    }
+    return mapping + ((uintptr_t) fdt - start);
+
+error:
+    while (i-- > 0) {
+        cspacepath_t path;
+        vka_cspace_make_path(vka, caps[i], &path);
+        vka_cnode_delete(&path);
+        vka_cspace_free(vka, caps[i]);
+    }
+    return NULL;
+}
+
+static int compare_phandles(const void *a, const void *b)
+{
+    const sel4platsupport_fdt_phandle_t *pa = a;
+    const sel4platsupport_fdt_phandle_t *pb = b;
+    return pa->phandle < pb->phandle ? -1 : pa->phandle > pb->phandle;
+}
+
+int sel4platsupport_fdt_index_init(sel4platsupport_fdt_index_t *index, const void *fdt,
+                                   ps_malloc_ops_t *malloc_ops)
+{
+    if (!index || !fdt || !malloc_ops) {
+        ZF_LOGE("arguments are NULL");
+        return -1;
+    }
+    memset(index, 0, sizeof(*index));
+    index->fdt = fdt;
+
+    /* count first, so that the index is a single allocation */
+    size_t count = 0;
+    for (int node = fdt_next_node(fdt, -1, NULL); node >= 0; node = fdt_next_node(fdt, node, NULL)) {
+        uint32_t phandle = fdt_get_phandle(fdt, node);
+        if (phandle != 0 && phandle != (uint32_t) -1) {
+            count++;
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    int error = ps_calloc(malloc_ops, count, sizeof(*index->phandles), (void **) &index->phandles);
+    if (error) {
+        ZF_LOGE("Failed to allocate the FDT phandle index");
+        return -1;
+    }
+    for (int node = fdt_next_node(fdt, -1, NULL); node >= 0; node = fdt_next_node(fdt, node, NULL)) {
+        uint32_t phandle = fdt_get_phandle(fdt, node);
+        if (phandle != 0 && phandle != (uint32_t) -1) {
+            index->phandles[index->num_phandles++] = (sel4platsupport_fdt_phandle_t) {
+                .phandle = phandle,
+                .offset = node,
+            };
+        }
+    }
+    qsort(index->phandles, index->num_phandles, sizeof(*index->phandles), compare_phandles);
+    return 0;
+}
+
+int sel4platsupport_fdt_index_node(sel4platsupport_fdt_index_t *index, uint32_t phandle)
+{
+    size_t low = 0;
+    size_t high = index->num_phandles;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->phandles[mid].phandle == phandle) {
+            return index->phandles[mid].offset;
+        } else if (index->phandles[mid].phandle < phandle) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return -FDT_ERR_NOTFOUND;
+}
+
+void sel4platsupport_fdt_index_destroy(sel4platsupport_fdt_index_t *index, ps_malloc_ops_t *malloc_ops)
+{
+    if (index->phandles != NULL) {
+        ZF_LOGF_IF(ps_free(malloc_ops, index->num_phandles * sizeof(*index->phandles), index->phandles),
+                   "Failed to free the FDT phandle index");
+    }
+    memset(index, 0, sizeof(*index));
+}
@@ -33,15 +33,40 @@ typedef struct io_mapping {
     seL4_CPtr *caps;
     /* allocation cookie for allocation(s) */
     seL4_Word *alloc_cookies;
-    struct io_mapping *next, *prev;
+    /* if set the frames were retyped from these device untypeds, rather than allocated
+     * one by one, and alloc_cookies are all 0 */
+    size_t num_untypeds;
+    struct io_untyped *untypeds;
+    /* region the user asked for, mapping it again hands out this mapping again */
+    uintptr_t paddr;
+    size_t size;
+    bool cached;
+    size_t refcount;
+    /* hash chains by returned_addr and by region */
+    struct io_mapping *vaddr_next, *region_next;
 } io_mapping_t;
 
+typedef struct io_untyped {
+    seL4_CPtr cptr;
+    seL4_Word cookie;
+    size_t size_bits;
+} io_untyped_t;
+
+#define IO_MAPPING_BUCKETS 64
+
 typedef struct sel4platsupport_io_mapper_cookie {
     vspace_t *vspace;
     vka_t *vka;
-    io_mapping_t *head;
+    io_mapping_t *by_vaddr[IO_MAPPING_BUCKETS];
+    io_mapping_t *by_region[IO_MAPPING_BUCKETS];
 } sel4platsupport_io_mapper_cookie_t;
 
+static inline size_t io_mapping_bucket(uintptr_t key)
+{
+    /* mappings are rarely closer than a page apart */
+    return ((key >> PAGE_BITS_4K) * 2654435761u) % IO_MAPPING_BUCKETS;
+}
+
 static void free_node(io_mapping_t *node)
 {
     assert(node);
@@ -51,6 +76,9 @@ static void free_node(io_mapping_t *node)
     if (node->alloc_cookies) {
         free(node->alloc_cookies);
     }
+    if (node->untypeds) {
+        free(node->untypeds);
+    }
     free(node);
 }
 
@@ -78,9 +106,33 @@ static io_mapping_t *new_node(size_t num_pages)
     return ret;
 }
 
+static void free_untypeds(vka_t *vka, io_mapping_t *mapping)
+{
+    cspacepath_t path;
+    for (size_t i = 0; i < mapping->num_untypeds; i++) {
+        vka_cspace_make_path(vka, mapping->untypeds[i].cptr, &path);
+        vka_cnode_revoke(&path);
+        vka_cnode_delete(&path);
+        vka_cspace_free(vka, mapping->untypeds[i].cptr);
+        vka_utspace_free(vka, seL4_UntypedObject, mapping->untypeds[i].size_bits, mapping->untypeds[i].cookie);
+    }
+    free(mapping->untypeds);
+    mapping->untypeds = NULL;
+    mapping->num_untypeds = 0;
+}
+
 static void destroy_node(vka_t *vka, io_mapping_t *mapping)
 {
     cspacepath_t path;
+    if (mapping->untypeds) {
+        /* revoking the untypeds deletes the frames */
+        for (size_t i = 0; i < mapping->num_pages; i++) {
+            vka_cspace_free(vka, mapping->caps[i]);
+        }
+        free_untypeds(vka, mapping);
+        free_node(mapping);
+        return;
+    }
     for (size_t i = 0; i < mapping->num_pages; i++) {
         /* free the allocation */
         vka_utspace_free(vka, kobject_get_type(KOBJECT_FRAME, mapping->page_size_bits),
@@ -95,18 +147,19 @@ static void destroy_node(vka_t *vka, io_mapping_t *mapping)
 
 static void insert_node(sel4platsupport_io_mapper_cookie_t *io_mapper, io_mapping_t *node)
 {
-    node->prev = NULL;
-    node->next = io_mapper->head;
-    if (io_mapper->head) {
-        io_mapper->head->prev = node;
-    }
-    io_mapper->head = node;
+    size_t vaddr_bucket = io_mapping_bucket((uintptr_t) node->returned_addr);
+    size_t region_bucket = io_mapping_bucket(node->paddr);
+    node->vaddr_next = io_mapper->by_vaddr[vaddr_bucket];
+    io_mapper->by_vaddr[vaddr_bucket] = node;
+    node->region_next = io_mapper->by_region[region_bucket];
+    io_mapper->by_region[region_bucket] = node;
 }
 
 static io_mapping_t *find_node(sel4platsupport_io_mapper_cookie_t *io_mapper, void *returned_addr)
 {
     io_mapping_t *current;
-    for (current = io_mapper->head; current; current = current->next) {
+    for (current = io_mapper->by_vaddr[io_mapping_bucket((uintptr_t) returned_addr)]; current;
+         current = current->vaddr_next) {
         if (current->returned_addr == returned_addr) {
             return current;
         }
@@ -114,17 +167,118 @@ static io_mapping_t *find_node(sel4platsupport_io_mapper_cookie_t *io_mapper, vo
     return NULL;
 }
 
+static io_mapping_t *find_region(sel4platsupport_io_mapper_cookie_t *io_mapper, uintptr_t paddr, size_t size,
+                                 bool cached)
+{
+    io_mapping_t *current;
+    for (current = io_mapper->by_region[io_mapping_bucket(paddr)]; current; current = current->region_next) {
+        if (current->paddr == paddr && current->size == size && current->cached == cached) {
+            return current;
+        }
+    }
+    return NULL;
+}
+
 static void remove_node(sel4platsupport_io_mapper_cookie_t *io_mapper, io_mapping_t *node)
 {
-    if (node->prev) {
-        node->prev->next = node->next;
-    } else {
-        assert(io_mapper->head == node);
-        io_mapper->head = node->next;
+    io_mapping_t **link = &io_mapper->by_vaddr[io_mapping_bucket((uintptr_t) node->returned_addr)];
+    while (*link != node) {
+        assert(*link);
+        link = &(*link)->vaddr_next;
+    }
+    *link = node->vaddr_next;
+    link = &io_mapper->by_region[io_mapping_bucket(node->paddr)];
+    while (*link != node) {
+        assert(*link);
+        link = &(*link)->region_next;
+    }
+    *link = node->region_next;
+}
+
+/* Size of the largest naturally aligned block at paddr that does not go past end */
+static size_t block_bits(uintptr_t paddr, uintptr_t end)
+{
+    size_t bits = LOG_BASE_2(end - paddr);
+    if (paddr != 0) {
+        bits = MIN(bits, (size_t) CTZL(paddr));
+    }
+    return MIN(bits, (size_t) seL4_MaxUntypedBits);
+}
+
+static int retype_frames(vka_t *vka, seL4_CPtr ut, seL4_Word type, size_t page_size_bits, seL4_CPtr *caps,
+                         size_t num)
+{
+    cspacepath_t first, last;
+    vka_cspace_make_path(vka, caps[0], &first);
+    vka_cspace_make_path(vka, caps[num - 1], &last);
+    bool consecutive = last.root == first.root && last.offset == first.offset + num - 1;
+    for (size_t created = 0; created < num;) {
+        size_t count = consecutive ? MIN(num - created, CONFIG_RETYPE_FAN_OUT_LIMIT) : 1;
+        cspacepath_t path;
+        vka_cspace_make_path(vka, caps[created], &path);
+        int error = seL4_Untyped_Retype(ut, type, page_size_bits, path.root, path.dest, path.destDepth, path.offset,
+                                        count);
+        if (error != seL4_NoError) {
+            return error;
+        }
+        created += count;
+    }
+    return 0;
+}
+
+/* Allocate all of the frames of mapping in one go: the slots in one batch, then for each
+ * naturally aligned block of the range a single device untyped that is retyped into all
+ * of the block's frames at once. Returns 0 on success, on failure nothing is left allocated */
+static int alloc_frames_batched(vka_t *vka, io_mapping_t *mapping, uintptr_t start, seL4_Word type)
+{
+    size_t page_size_bits = mapping->page_size_bits;
+    uintptr_t end = start + (mapping->num_pages << page_size_bits);
+    size_t num_untypeds = 0;
+    for (uintptr_t paddr = start; paddr < end; paddr += BIT(block_bits(paddr, end))) {
+        num_untypeds++;
+    }
+    mapping->untypeds = calloc(num_untypeds, sizeof(io_untyped_t));
+    if (!mapping->untypeds) {
+        return -1;
+    }
+    int error = vka_cspace_alloc_n(vka, mapping->num_pages, mapping->caps);
+    if (error) {
+        free(mapping->untypeds);
+        mapping->untypeds = NULL;
+        return error;
+    }
+    size_t frame = 0;
+    for (uintptr_t paddr = start; paddr < end; paddr += BIT(block_bits(paddr, end))) {
+        io_untyped_t *ut = &mapping->untypeds[mapping->num_untypeds];
+        ut->size_bits = block_bits(paddr, end);
+        error = vka_cspace_alloc(vka, &ut->cptr);
+        if (error) {
+            break;
+        }
+        cspacepath_t path;
+        vka_cspace_make_path(vka, ut->cptr, &path);
+        error = vka_utspace_alloc_at(vka, &path, seL4_UntypedObject, ut->size_bits, paddr, &ut->cookie);
+        if (error) {
+            vka_cspace_free(vka, ut->cptr);
+            break;
+        }
+        mapping->num_untypeds++;
+        size_t num = BIT(ut->size_bits - page_size_bits);
+        error = retype_frames(vka, ut->cptr, type, page_size_bits, &mapping->caps[frame], num);
+        if (error) {
+            break;
+        }
+        frame += num;
     }
-    if (node->next) {
-        node->next->prev = node->prev;
+    if (error) {
+        for (size_t i = 0; i < mapping->num_pages; i++) {
+            vka_cspace_free(vka, mapping->caps[i]);
+        }
+        free_untypeds(vka, mapping);
+        memset(mapping->caps, 0, mapping->num_pages * sizeof(seL4_CPtr));
+        return error;
     }
+    return 0;
 }
 
 static void *sel4platsupport_map_paddr_with_page_size(sel4platsupport_io_mapper_cookie_t *io_mapper, uintptr_t paddr,
@@ -138,6 +292,7 @@ static void *sel4platsupport_map_paddr_with_page_size(sel4platsupport_io_mapper_
     int page_size = BIT(page_size_bits);
     uintptr_t start = ROUND_DOWN(paddr, page_size);
     uintptr_t offset = paddr - start;
+    size_t region_size = size;
     size += offset;
 
     io_mapping_t *mapping = new_node(BYTES_TO_SIZE_BITS_PAGES(size, page_size_bits));
@@ -149,8 +304,10 @@ static void *sel4platsupport_map_paddr_with_page_size(sel4platsupport_io_mapper_
     mapping->page_size_bits = page_size_bits;
 
     seL4_Word type = kobject_get_type(KOBJECT_FRAME, mapping->page_size_bits);
-    /* allocate all of the physical frame caps */
-    for (unsigned int i = 0; i < mapping->num_pages; i++) {
+    /* allocate all of the physical frame caps, one at a time if the allocator cannot give
+     * us the covering untypeds */
+    bool batched = alloc_frames_batched(vka, mapping, start, type) == 0;
+    for (unsigned int i = 0; !batched && i < mapping->num_pages; i++) {
         /* allocate a cslot */
         int error = vka_cspace_alloc(vka, &mapping->caps[i]);
         if (error) {
@@ -184,6 +341,10 @@ static void *sel4platsupport_map_paddr_with_page_size(sel4platsupport_io_mapper_
     if (mapping->mapped_addr != NULL) {
         /* fill out and insert node */
         mapping->returned_addr = mapping->mapped_addr + offset;
+        mapping->paddr = paddr;
+        mapping->size = region_size;
+        mapping->cached = cached;
+        mapping->refcount = 1;
         insert_node(io_mapper, mapping);
         return mapping->returned_addr;
     }
@@ -201,10 +362,20 @@ static void *sel4platsupport_map_paddr(void *cookie, uintptr_t paddr, size_t siz
     }
 
     sel4platsupport_io_mapper_cookie_t *io_mapper = (sel4platsupport_io_mapper_cookie_t *)cookie;
+    /* hand out the existing mapping if this region is already mapped */
+    io_mapping_t *existing = find_region(io_mapper, paddr, size, cached);
+    if (existing) {
+        existing->refcount++;
+        return existing->returned_addr;
+    }
+
     int frame_size_index = 0;
-    /* find the largest reasonable frame size */
+    /* find the largest reasonable frame size, that the region is also aligned to so that
+     * we do not map memory before it */
+    uintptr_t start = ROUND_DOWN(paddr, PAGE_SIZE_4K);
     while (frame_size_index + 1 < SEL4_NUM_PAGE_SIZES) {
-        if (size >> sel4_page_sizes[frame_size_index + 1] == 0) {
+        size_t bits = sel4_page_sizes[frame_size_index + 1];
+        if (size >> bits == 0 || !IS_ALIGNED(start, bits)) {
             break;
         }
         frame_size_index++;
@@ -240,6 +411,12 @@ static void sel4platsupport_unmap_vaddr(void *cookie, void *vaddr, UNUSED size_t
         return;
     }
 
+    mapping->refcount--;
+    if (mapping->refcount > 0) {
+        /* someone else mapped the same region and is still using it */
+        return;
+    }
+
     /* unmap the pages */
     vspace_unmap_pages(vspace, mapping->mapped_addr, mapping->num_pages, mapping->page_size_bits,
                        VSPACE_PRESERVE);
@@ -284,8 +461,14 @@ int sel4platsupport_new_fdt_ops(ps_io_fdt_t *io_fdt, simple_t *simple, ps_malloc
         return -1;
     }
 
+    /* Use the FDT where it is in the bootinfo if simple can find it there, rather than
+     * copying it. The FDT header carries its own size, so the padding after it the
+     * copy clears does not need clearing here */
+    const seL4_BootInfoHeader *header = simple_get_extended_bootinfo_ptr(simple, SEL4_BOOTINFO_HEADER_FDT);
     ssize_t block_size = simple_get_extended_bootinfo_length(simple, SEL4_BOOTINFO_HEADER_FDT);
-    if (block_size > 0) {
+    if (header != NULL) {
+        io_fdt->cookie = (void *)(header + 1);
+    } else if (block_size > 0) {
         int error = ps_calloc(malloc_ops, 1, block_size, &io_fdt->cookie);
         if (error) {
             ZF_LOGE("Failed to allocate %zu bytes for the FDT", block_size);
@@ -352,9 +535,9 @@ int sel4platsupport_new_io_ops(vspace_t *vspace, vka_t *vka, simple_t *simple, p
         free(io_ops->io_mapper.cookie);
         io_ops->io_mapper.cookie = NULL;
         ssize_t fdt_size = simple_get_extended_bootinfo_length(simple, SEL4_BOOTINFO_HEADER_FDT);
-        if (fdt_size > 0) {
+        if (fdt_size > 0 && simple_get_extended_bootinfo_ptr(simple, SEL4_BOOTINFO_HEADER_FDT) == NULL) {
             /* The FDT is available on this platform and we actually copied it, so we free it */
-            ps_free(&io_ops->malloc_ops, fdt_size, &io_ops->io_fdt.cookie);
+            ps_free(&io_ops->malloc_ops, fdt_size, io_ops->io_fdt.cookie);
         }
         return error;
     }
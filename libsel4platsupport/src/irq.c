@@ -10,7 +10,9 @@
 #include <stdbool.h>
 #include <limits.h>
 #include <errno.h>
+#include <string.h>
 
+#include <sel4platsupport/gen_config.h>
 #include <sel4/sel4.h>
 #include <sel4platsupport/irq.h>
 #include <sel4platsupport/device.h>
@@ -21,6 +23,32 @@
 #include <vka/vka.h>
 #include <vka/capops.h>
 
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+#include <sel4bench/sel4bench.h>
+
+#define IRQ_TRACE_SAMPLES CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE_SAMPLES
+compile_time_assert(irq_trace_samples_power_of_2, (IRQ_TRACE_SAMPLES & (IRQ_TRACE_SAMPLES - 1)) == 0);
+
+/* Cycles spent in each stage of one delivery */
+typedef struct {
+    uint32_t dispatch;
+    uint32_t callback;
+    uint32_t ack;
+} irq_trace_sample_t;
+
+typedef struct {
+    /* timestamps of the delivery in progress */
+    ccnt_t wake;
+    ccnt_t dispatch;
+    ccnt_t callback;
+    /* ring of the most recent deliveries */
+    size_t num_samples;
+    irq_trace_sample_t samples[IRQ_TRACE_SAMPLES];
+    /* cycles from wake to acknowledgement, over every delivery */
+    uint64_t total_cycles;
+} irq_trace_t;
+#endif /* CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE */
+
 #define UNPAIRED_ID -1
 #define UNALLOCATED_BADGE_INDEX -1
 
@@ -29,6 +57,13 @@ typedef enum irq_iface_type {
     MINI_IFACE
 } irq_iface_type_t;
 
+struct irq_cookie;
+
+typedef struct {
+    struct irq_cookie *irq_cookie;
+    irq_id_t irq_id;
+} ack_data_t;
+
 typedef struct {
     /* These are always non-empty if this particular IRQ ID is in use */
     bool allocated;
@@ -45,6 +80,14 @@ typedef struct {
     cspacepath_t ntfn_path;
     ntfn_id_t paired_ntfn;
     int8_t allocated_badge_index;
+
+    /* Handed to the callback to acknowledge with. An IRQ cannot be delivered again until
+     * it is acknowledged, so one per IRQ ID is enough and we never allocate one */
+    ack_data_t ack_data;
+
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    irq_trace_t trace;
+#endif
 } irq_entry_t;
 
 typedef struct {
@@ -59,9 +102,15 @@ typedef struct {
     seL4_Word pending_bitfield;
 
     irq_id_t bound_irqs[MAX_INTERRUPTS_TO_NOTIFICATIONS];
+
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    /* when a thread last returned from waiting on the notification, 0 if it has not since
+     * the IRQs it woke for were dispatched */
+    ccnt_t last_wake;
+#endif
 } ntfn_entry_t;
 
-typedef struct {
+typedef struct irq_cookie {
     irq_iface_type_t iface_type;
     size_t num_registered_irqs;
     size_t num_allocated_ntfns;
@@ -73,6 +122,11 @@ typedef struct {
     /* Array of bitfields tracking which IDs have been allocated */
     seL4_Word *allocated_irq_bitfields;
     seL4_Word *allocated_ntfn_bitfields;
+    /* One bit per bitfield above, set if it has an ID left to allocate */
+    size_t num_irq_summaries;
+    size_t num_ntfn_summaries;
+    seL4_Word *free_irq_summary;
+    seL4_Word *free_ntfn_summary;
 
     irq_entry_t *irq_table;
     ntfn_entry_t *ntfn_table;
@@ -81,10 +135,36 @@ typedef struct {
     ps_malloc_ops_t *malloc_ops;
 } irq_cookie_t;
 
-typedef struct {
-    irq_cookie_t *irq_cookie;
-    irq_id_t irq_id;
-} ack_data_t;
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+static inline uint32_t trace_cycles(ccnt_t from, ccnt_t to)
+{
+    return MIN(to - from, UINT32_MAX);
+}
+
+static inline void trace_dispatch(irq_entry_t *irq_entry, ccnt_t wake)
+{
+    irq_entry->trace.dispatch = sel4bench_get_cycle_count();
+    irq_entry->trace.wake = wake ? wake : irq_entry->trace.dispatch;
+}
+
+static inline void trace_ack(irq_entry_t *irq_entry)
+{
+    irq_trace_t *trace = &irq_entry->trace;
+    ccnt_t ack = sel4bench_get_cycle_count();
+    if (trace->callback == 0) {
+        /* acknowledged outside of a callback */
+        return;
+    }
+    trace->samples[trace->num_samples % IRQ_TRACE_SAMPLES] = (irq_trace_sample_t) {
+        .dispatch = trace_cycles(trace->wake, trace->dispatch),
+        .callback = trace_cycles(trace->dispatch, trace->callback),
+        .ack = trace_cycles(trace->callback, ack),
+    };
+    trace->num_samples++;
+    trace->total_cycles += ack - trace->wake;
+    trace->callback = 0;
+}
+#endif /* CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE */
 
 static inline bool check_irq_id_is_valid(irq_cookie_t *irq_cookie, irq_id_t id)
 {
@@ -134,64 +214,49 @@ static inline bool check_irq_id_is_allocated(irq_cookie_t *irq_cookie, irq_id_t
     return false;
 }
 
-static inline void fill_bit_in_bitfield(seL4_Word *bitfield_array, int index)
+#define BITS_IN_WORD (sizeof(seL4_Word) * CHAR_BIT)
+
+static inline void fill_bit_in_bitfield(seL4_Word *bitfield_array, seL4_Word *summary, int index)
 {
-    int bitfield_index = index % (sizeof(seL4_Word) * CHAR_BIT);
-    int array_index  = index / (sizeof(seL4_Word) * CHAR_BIT);
+    int bitfield_index = index % BITS_IN_WORD;
+    int array_index  = index / BITS_IN_WORD;
     bitfield_array[array_index] |= BIT(bitfield_index);
+    if (bitfield_array[array_index] == (seL4_Word) -1) {
+        summary[array_index / BITS_IN_WORD] &= ~BIT(array_index % BITS_IN_WORD);
+    }
 }
 
-static inline void unfill_bit_in_bitfield(seL4_Word *bitfield_array, int index)
+static inline void unfill_bit_in_bitfield(seL4_Word *bitfield_array, seL4_Word *summary, int index)
 {
-    int bitfield_index = index % (sizeof(seL4_Word) * CHAR_BIT);
-    int array_index  = index / (sizeof(seL4_Word) * CHAR_BIT);
+    int bitfield_index = index % BITS_IN_WORD;
+    int array_index  = index / BITS_IN_WORD;
     bitfield_array[array_index] &= ~(BIT(bitfield_index));
+    summary[array_index / BITS_IN_WORD] |= BIT(array_index % BITS_IN_WORD);
 }
 
-static irq_id_t find_free_irq_id(irq_cookie_t *irq_cookie)
+/* Lowest clear bit, found through the summary of which bitfields have any */
+static int find_free_bit(seL4_Word *bitfield_array, seL4_Word *summary, size_t num_summaries)
 {
-    for (int i = 0; i < irq_cookie->num_irq_bitfields; i++) {
-        unsigned long unallocated_bitfield = ~(irq_cookie->allocated_irq_bitfields[i]);
-        if (i == irq_cookie->num_irq_bitfields - 1) {
-            /* Hide the bits that cannot be allocated, i.e. max_irq_ids is
-             * not a multiple of sizeof(seL4_Word) */
-            unsigned long num_leftover_bits = irq_cookie->num_irq_bitfields * sizeof(seL4_Word) -
-                                              irq_cookie->max_irq_ids;
-            unsigned long mask = MASK(num_leftover_bits);
-            /* Reverse the mask, (bit 0 is the smallest ID of that bitfield) */
-            mask = BSWAP_WORD(mask);
-
-            unallocated_bitfield &= mask;
-        }
+    for (int i = 0; i < num_summaries; i++) {
         /* Check to avoid undefined behaviour of CTZL(0) */
-        if (likely(unallocated_bitfield)) {
-            return CTZL(unallocated_bitfield) + (i * sizeof(seL4_Word) * CHAR_BIT);
+        if (likely(summary[i])) {
+            int array_index = i * BITS_IN_WORD + CTZL(summary[i]);
+            return array_index * BITS_IN_WORD + CTZL(~bitfield_array[array_index]);
         }
     }
     return -1;
 }
 
+static irq_id_t find_free_irq_id(irq_cookie_t *irq_cookie)
+{
+    return find_free_bit(irq_cookie->allocated_irq_bitfields, irq_cookie->free_irq_summary,
+                         irq_cookie->num_irq_summaries);
+}
+
 static ntfn_id_t find_free_ntfn_id(irq_cookie_t *irq_cookie)
 {
-    for (int i = 0; i < irq_cookie->num_ntfn_bitfields; i++) {
-        unsigned long unallocated_bitfield = ~(irq_cookie->allocated_ntfn_bitfields[i]);
-        if (i == irq_cookie->num_irq_bitfields - 1) {
-            /* Hide the bits that cannot be allocated, i.e. max_irq_ids is
-             * not a multiple of sizeof(seL4_Word) */
-            unsigned long num_leftover_bits = irq_cookie->num_ntfn_bitfields * sizeof(seL4_Word) -
-                                              irq_cookie->max_ntfn_ids;
-            unsigned long mask = MASK(num_leftover_bits);
-            /* Reverse the mask, (bit 0 is the smallest ID of that bitfield) */
-            mask = BSWAP_WORD(mask);
-
-            unallocated_bitfield &= mask;
-        }
-        /* Check to avoid undefined behaviour of CTZL(0) */
-        if (likely(unallocated_bitfield)) {
-            return CTZL(unallocated_bitfield) + (i * sizeof(seL4_Word) * CHAR_BIT);
-        }
-    }
-    return -1;
+    return find_free_bit(irq_cookie->allocated_ntfn_bitfields, irq_cookie->free_ntfn_summary,
+                         irq_cookie->num_ntfn_summaries);
 }
 
 static int find_free_ntfn_badge_index(ntfn_entry_t *ntfn_entry)
@@ -320,7 +385,7 @@ static irq_id_t irq_register_common(irq_cookie_t *irq_cookie, ps_irq_t irq, irq_
     irq_entry->callback_data = callback_data;
 
     irq_cookie->num_registered_irqs++;
-    fill_bit_in_bitfield(irq_cookie->allocated_irq_bitfields, free_id);
+    fill_bit_in_bitfield(irq_cookie->allocated_irq_bitfields, irq_cookie->free_irq_summary, free_id);
 
     return free_id;
 }
@@ -339,7 +404,7 @@ static void provide_ntfn_common(irq_cookie_t *irq_cookie, seL4_CPtr ntfn, seL4_W
     ntfn_entry->usable_mask = usable_mask;
 
     irq_cookie->num_allocated_ntfns++;
-    fill_bit_in_bitfield(irq_cookie->allocated_ntfn_bitfields, allocated_id);
+    fill_bit_in_bitfield(irq_cookie->allocated_ntfn_bitfields, irq_cookie->free_ntfn_summary, allocated_id);
 }
 
 static irq_cookie_t *new_irq_ops_common(vka_t *vka, simple_t *simple, irq_interface_config_t irq_config,
@@ -347,9 +412,10 @@ static irq_cookie_t *new_irq_ops_common(vka_t *vka, simple_t *simple, irq_interf
 {
     int err = 0;
     /* Figure out how many bitfields we need to keep track of the allocation status of the IDs */
-    size_t bits_in_seL4_Word = sizeof(seL4_Word) * CHAR_BIT;
-    size_t num_irq_bitfields = ALIGN_UP(irq_config.max_irq_ids, bits_in_seL4_Word) / sizeof(seL4_Word);
-    size_t num_ntfn_bitfields = ALIGN_UP(irq_config.max_ntfn_ids, bits_in_seL4_Word) / sizeof(seL4_Word);
+    size_t num_irq_bitfields = DIV_ROUND_UP(irq_config.max_irq_ids, BITS_IN_WORD);
+    size_t num_ntfn_bitfields = DIV_ROUND_UP(irq_config.max_ntfn_ids, BITS_IN_WORD);
+    size_t num_irq_summaries = DIV_ROUND_UP(num_irq_bitfields, BITS_IN_WORD);
+    size_t num_ntfn_summaries = DIV_ROUND_UP(num_ntfn_bitfields, BITS_IN_WORD);
 
     irq_cookie_t *cookie = 0;
     err = ps_calloc(malloc_ops, 1, sizeof(irq_cookie_t), (void **) &cookie);
@@ -392,6 +458,29 @@ static irq_cookie_t *new_irq_ops_common(vka_t *vka, simple_t *simple, irq_interf
         ZF_LOGE("Failed to allocate the notification bitfields");
         goto error;
     }
+    err = ps_calloc(malloc_ops, 1, num_irq_summaries * sizeof(seL4_Word), (void **) & (cookie->free_irq_summary));
+    if (err) {
+        ZF_LOGE("Failed to allocate the IRQ bitfield summary");
+        goto error;
+    }
+    err = ps_calloc(malloc_ops, 1, num_ntfn_summaries * sizeof(seL4_Word), (void **) & (cookie->free_ntfn_summary));
+    if (err) {
+        ZF_LOGE("Failed to allocate the notification bitfield summary");
+        goto error;
+    }
+    /* Every bitfield starts with IDs to give out, apart from the IDs past the maximum */
+    for (int i = 0; i < num_irq_bitfields; i++) {
+        cookie->free_irq_summary[i / BITS_IN_WORD] |= BIT(i % BITS_IN_WORD);
+    }
+    for (int i = irq_config.max_irq_ids; i < num_irq_bitfields * BITS_IN_WORD; i++) {
+        fill_bit_in_bitfield(cookie->allocated_irq_bitfields, cookie->free_irq_summary, i);
+    }
+    for (int i = 0; i < num_ntfn_bitfields; i++) {
+        cookie->free_ntfn_summary[i / BITS_IN_WORD] |= BIT(i % BITS_IN_WORD);
+    }
+    for (int i = irq_config.max_ntfn_ids; i < num_ntfn_bitfields * BITS_IN_WORD; i++) {
+        fill_bit_in_bitfield(cookie->allocated_ntfn_bitfields, cookie->free_ntfn_summary, i);
+    }
 
     cookie->iface_type = iface_type;
     cookie->simple = simple;
@@ -401,6 +490,8 @@ static irq_cookie_t *new_irq_ops_common(vka_t *vka, simple_t *simple, irq_interf
     cookie->max_ntfn_ids = irq_config.max_ntfn_ids;
     cookie->num_irq_bitfields = num_irq_bitfields;
     cookie->num_ntfn_bitfields = num_ntfn_bitfields;
+    cookie->num_irq_summaries = num_irq_summaries;
+    cookie->num_ntfn_summaries = num_ntfn_summaries;
 
     return cookie;
 
@@ -419,6 +510,18 @@ error:
             ps_free(malloc_ops, sizeof(seL4_Word) * num_irq_bitfields, cookie->allocated_irq_bitfields);
         }
 
+        if (cookie->allocated_ntfn_bitfields) {
+            ps_free(malloc_ops, sizeof(seL4_Word) * num_ntfn_bitfields, cookie->allocated_ntfn_bitfields);
+        }
+
+        if (cookie->free_irq_summary) {
+            ps_free(malloc_ops, sizeof(seL4_Word) * num_irq_summaries, cookie->free_irq_summary);
+        }
+
+        if (cookie->free_ntfn_summary) {
+            ps_free(malloc_ops, sizeof(seL4_Word) * num_ntfn_summaries, cookie->free_ntfn_summary);
+        }
+
         ps_free(malloc_ops, sizeof(irq_cookie_t), cookie);
     }
 
@@ -471,7 +574,7 @@ static int sel4platsupport_irq_unregister(void *cookie, irq_id_t irq_id)
     irq_entry->allocated_badge_index = UNALLOCATED_BADGE_INDEX;
 
     irq_cookie->num_registered_irqs--;
-    unfill_bit_in_bitfield(irq_cookie->allocated_irq_bitfields, irq_id);
+    unfill_bit_in_bitfield(irq_cookie->allocated_irq_bitfields, irq_cookie->free_irq_summary, irq_id);
 
     return 0;
 }
@@ -521,29 +624,55 @@ static int sel4platsupport_irq_acknowledge(void *ack_data)
     irq_id_t irq_id = data->irq_id;
 
     if (!check_irq_id_is_valid(irq_cookie, irq_id)) {
-        ret = -EINVAL;
-        goto exit;
+        return -EINVAL;
     }
 
     if (!check_irq_id_is_allocated(irq_cookie, irq_id)) {
-        ret = -EINVAL;
-        goto exit;
+        return -EINVAL;
     }
 
     irq_entry_t *irq_entry = &(irq_cookie->irq_table[irq_id]);
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    trace_ack(irq_entry);
+#endif
     int error = seL4_IRQHandler_Ack(irq_entry->handler_path.capPtr);
     if (error) {
         ZF_LOGE("Failed to acknowledge IRQ");
         ret = -EFAULT;
-        goto exit;
     }
 
-exit:
-    ps_free(irq_cookie->malloc_ops, sizeof(ack_data_t), data);
-
     return ret;
 }
 
+int sel4platsupport_irq_register_n(ps_irq_ops_t *irq_ops, size_t num_irqs, ps_irq_t *irqs,
+                                   irq_callback_fn_t callback, void **callback_data, irq_id_t *ret_ids)
+{
+    if (!irq_ops || !irqs || !callback || !ret_ids) {
+        return -EINVAL;
+    }
+
+    irq_cookie_t *irq_cookie = irq_ops->cookie;
+
+    /* Fail up front rather than half way through the block */
+    if (irq_cookie->num_registered_irqs + num_irqs > irq_cookie->max_irq_ids) {
+        return -EMFILE;
+    }
+
+    for (size_t i = 0; i < num_irqs; i++) {
+        ret_ids[i] = ps_irq_register(irq_ops, irqs[i], callback, callback_data ? callback_data[i] : NULL);
+        if (ret_ids[i] < 0) {
+            int error = ret_ids[i];
+            while (i > 0) {
+                i--;
+                ZF_LOGF_IF(ps_irq_unregister(irq_ops, ret_ids[i]), "Failed to clean-up a failure situation");
+            }
+            return error;
+        }
+    }
+
+    return 0;
+}
+
 int sel4platsupport_new_irq_ops(ps_irq_ops_t *irq_ops, vka_t *vka, simple_t *simple,
                                 irq_interface_config_t irq_config, ps_malloc_ops_t *malloc_ops)
 {
@@ -708,7 +837,7 @@ int sel4platsupport_irq_return_ntfn(ps_irq_ops_t *irq_ops, ntfn_id_t ntfn_id,
     memset(ntfn_entry->bound_irqs, UNPAIRED_ID, sizeof(irq_id_t) * MAX_INTERRUPTS_TO_NOTIFICATIONS);
 
     irq_cookie->num_allocated_ntfns--;
-    unfill_bit_in_bitfield(irq_cookie->allocated_ntfn_bitfields, ntfn_id);
+    unfill_bit_in_bitfield(irq_cookie->allocated_ntfn_bitfields, irq_cookie->free_ntfn_summary, ntfn_id);
 
     return 0;
 }
@@ -799,12 +928,13 @@ static bool perform_callback(irq_cookie_t *irq_cookie, irq_id_t irq_id, unsigned
 
     /* Check if callback was registered, if so, then run it */
     if (callback) {
-        ack_data_t *ack_data = NULL;
-        int error = ps_calloc(irq_cookie->malloc_ops, 1, sizeof(ack_data_t), (void **) &ack_data);
-        ZF_LOGF_IF(error, "Failed to allocate memory for a cookie for the acknowledge function");
+        ack_data_t *ack_data = &irq_entry->ack_data;
         *ack_data = (ack_data_t) {
             .irq_cookie = irq_cookie, .irq_id = irq_id
         };
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+        irq_entry->trace.callback = sel4bench_get_cycle_count();
+#endif
         callback(irq_entry->callback_data,
                  sel4platsupport_irq_acknowledge, ack_data);
         return true;
@@ -828,12 +958,21 @@ int sel4platsupport_irq_handle(ps_irq_ops_t *irq_ops, ntfn_id_t ntfn_id, seL4_Wo
     ntfn_entry_t *ntfn_entry = &(irq_cookie->ntfn_table[ntfn_id]);
 
     /* Just in case, but probably should throw an error at the user for passing in bits that
-     * we dont' handle */
-    unsigned long unchecked_bits = handle_mask & ntfn_entry->usable_mask;
+     * we dont' handle. Bits of IRQs that have been unpaired since they were signalled are
+     * dropped too */
+    unsigned long unchecked_bits = handle_mask & ntfn_entry->status_bitfield;
+
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    ccnt_t wake = ntfn_entry->last_wake;
+    ntfn_entry->last_wake = 0;
+#endif
 
     while (unchecked_bits) {
         unsigned long bit_index = CTZL(unchecked_bits);
         irq_id_t paired_irq_id = ntfn_entry->bound_irqs[bit_index];
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+        trace_dispatch(&irq_cookie->irq_table[paired_irq_id], wake);
+#endif
         bool callback_called = perform_callback(irq_cookie, paired_irq_id, bit_index);
         if (callback_called && ntfn_entry->pending_bitfield & BIT(bit_index)) {
             /* Unset the bit, we've performed the callback for that interrupt */
@@ -852,16 +991,24 @@ static void serve_irq(irq_cookie_t *irq_cookie, ntfn_id_t id, seL4_Word mask,
 
     ntfn_entry_t *ntfn_entry = &(irq_cookie->ntfn_table[id]);
 
-    /* Mask out the bits the are not relevant to us */
-    unsigned long unchecked_bits = badge & ntfn_entry->usable_mask;
+    /* Mask out the bits the are not relevant to us, or no longer paired with an IRQ */
+    unsigned long unchecked_bits = badge & ntfn_entry->status_bitfield;
     /* Also check the interrupts that were leftover and not served */
     unchecked_bits |= ntfn_entry->pending_bitfield;
 
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    ccnt_t wake = ntfn_entry->last_wake;
+    ntfn_entry->last_wake = 0;
+#endif
+
     while (unchecked_bits) {
         unsigned long bit_index = CTZL(unchecked_bits);
 
         if (likely(BIT(bit_index) & mask)) {
             irq_id_t paired_irq_id = ntfn_entry->bound_irqs[bit_index];
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+            trace_dispatch(&irq_cookie->irq_table[paired_irq_id], wake);
+#endif
             if (perform_callback(irq_cookie, paired_irq_id, bit_index)) {
                 /* Record that this particular IRQ was served */
                 served_mask |= BIT(bit_index);
@@ -873,7 +1020,7 @@ static void serve_irq(irq_cookie_t *irq_cookie, ntfn_id_t id, seL4_Word mask,
 
     /* Record the IRQs that were not served but arrived, note that we don't want to
      * override the leftover IRQs still inside the pending bitfield */
-    ntfn_entry->pending_bitfield ^= badge & ntfn_entry->usable_mask & ~(served_mask);
+    ntfn_entry->pending_bitfield ^= badge & ntfn_entry->status_bitfield & ~(served_mask);
 
     /* Write bits that are leftover */
     if (ret_leftover_bits) {
@@ -905,6 +1052,7 @@ int sel4platsupport_irq_wait(ps_irq_ops_t *irq_ops, ntfn_id_t ntfn_id,
 
     /* Wait on the notification object */
     seL4_Wait(ntfn, &badge);
+    sel4platsupport_irq_trace_wake(irq_ops, ntfn_id);
 
     serve_irq(irq_cookie, ntfn_id, wait_mask, badge, ret_leftover_bits);
 
@@ -936,8 +1084,118 @@ int sel4platsupport_irq_poll(ps_irq_ops_t *irq_ops, ntfn_id_t ntfn_id,
 
     /* Poll the notification object */
     seL4_Poll(ntfn, &badge);
+    sel4platsupport_irq_trace_wake(irq_ops, ntfn_id);
 
     serve_irq(irq_cookie, ntfn_id, poll_mask, badge, ret_leftover_bits);
 
     return 0;
 }
+
+void sel4platsupport_irq_trace_wake(UNUSED ps_irq_ops_t *irq_ops, UNUSED ntfn_id_t ntfn_id)
+{
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    irq_cookie_t *irq_cookie = irq_ops->cookie;
+    if (check_ntfn_id_is_valid(irq_cookie, ntfn_id)) {
+        irq_cookie->ntfn_table[ntfn_id].last_wake = sel4bench_get_cycle_count();
+    }
+#endif
+}
+
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+static int compare_cycles(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void summarise_stage(uint32_t *cycles, size_t num, sel4platsupport_irq_trace_stage_t *stage)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < num; i++) {
+        sum += cycles[i];
+    }
+    qsort(cycles, num, sizeof(*cycles), compare_cycles);
+    *stage = (sel4platsupport_irq_trace_stage_t) {
+        .min = cycles[0],
+        .avg = sum / num,
+        .p99 = cycles[(num * 99) / 100],
+        .max = cycles[num - 1],
+    };
+}
+#endif /* CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE */
+
+int sel4platsupport_irq_trace_summary(UNUSED ps_irq_ops_t *irq_ops, UNUSED irq_id_t irq_id,
+                                      UNUSED sel4platsupport_irq_trace_summary_t *summary)
+{
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    if (!irq_ops || !summary) {
+        return -EINVAL;
+    }
+
+    irq_cookie_t *irq_cookie = irq_ops->cookie;
+
+    if (!check_irq_id_is_valid(irq_cookie, irq_id) ||
+        !check_irq_id_is_allocated(irq_cookie, irq_id)) {
+        return -EINVAL;
+    }
+
+    irq_trace_t *trace = &irq_cookie->irq_table[irq_id].trace;
+    size_t num = MIN(trace->num_samples, IRQ_TRACE_SAMPLES);
+    memset(summary, 0, sizeof(*summary));
+    summary->num_samples = num;
+    if (num == 0) {
+        return 0;
+    }
+
+    uint32_t cycles[IRQ_TRACE_SAMPLES];
+    for (size_t i = 0; i < num; i++) {
+        cycles[i] = trace->samples[i].dispatch;
+    }
+    summarise_stage(cycles, num, &summary->dispatch);
+    for (size_t i = 0; i < num; i++) {
+        cycles[i] = trace->samples[i].callback;
+    }
+    summarise_stage(cycles, num, &summary->callback);
+    for (size_t i = 0; i < num; i++) {
+        cycles[i] = trace->samples[i].ack;
+    }
+    summarise_stage(cycles, num, &summary->ack);
+    for (size_t i = 0; i < num; i++) {
+        cycles[i] = MIN((uint64_t) trace->samples[i].dispatch + trace->samples[i].callback +
+                        trace->samples[i].ack, UINT32_MAX);
+    }
+    summarise_stage(cycles, num, &summary->total);
+    return 0;
+#else
+    return -ENOSYS;
+#endif
+}
+
+int sel4platsupport_irq_trace_load(UNUSED ps_irq_ops_t *irq_ops, UNUSED irq_id_t irq_id,
+                                   UNUSED uint64_t *ret_deliveries, UNUSED uint64_t *ret_cycles)
+{
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    if (!irq_ops) {
+        return -EINVAL;
+    }
+
+    irq_cookie_t *irq_cookie = irq_ops->cookie;
+
+    if (!check_irq_id_is_valid(irq_cookie, irq_id) ||
+        !check_irq_id_is_allocated(irq_cookie, irq_id)) {
+        return -EINVAL;
+    }
+
+    irq_trace_t *trace = &irq_cookie->irq_table[irq_id].trace;
+    if (ret_deliveries) {
+        *ret_deliveries = trace->num_samples;
+    }
+    if (ret_cycles) {
+        *ret_cycles = trace->total_cycles;
+    }
+    return 0;
+#else
+    return -ENOSYS;
+#endif
+}
@@ -9,7 +9,9 @@
 #include <platsupport/chardev.h>
 #include <sel4platsupport/gen_config.h>
 #include <stddef.h>
+#include <string.h>
 #include <vka/object.h>
+#include <sel4platsupport/platsupport.h>
 
 static ssize_t debug_write(ps_chardevice_t *device UNUSED, const void *vdata, size_t count,
                            chardev_callback_t cb UNUSED, void *token UNUSED)
@@ -34,6 +36,8 @@ static struct ps_chardevice *console = &console_device;
 
 void register_console(struct ps_chardevice *user_console)
 {
+    /* buffered output was meant for the old console */
+    platsupport_console_flush();
     console = user_console;
 }
 
@@ -53,11 +57,114 @@ int __plat_serial_init(ps_io_ops_t *io_ops)
     }
 }
 
+static platsupport_console_mode_t console_mode = PLATSUPPORT_CONSOLE_UNBUFFERED;
+static bool console_nonblocking;
+static char console_buf[CONFIG_LIB_SEL4_PLAT_SUPPORT_CONSOLE_BUFFER_BYTES];
+static size_t console_buffered;
+static size_t console_dropped;
+
+/* Hand the device as much as it will take at once, rather than a character at a
+ * time. Unless block is set, the device is only offered the data once. */
+static size_t console_device_write(const char *data, size_t count, bool block)
+{
+    size_t sent = 0;
+
+    while (sent < count) {
+        ssize_t n = ps_cdev_write(console, (void *)&data[sent], count - sent, NULL, NULL);
+        if (n <= 0) {
+            break;
+        }
+        sent += n;
+        if (!block) {
+            break;
+        }
+    }
+    return sent;
+}
+
+static void console_drain(bool block)
+{
+    size_t sent = console_device_write(console_buf, console_buffered, block);
+
+    memmove(console_buf, &console_buf[sent], console_buffered - sent);
+    console_buffered -= sent;
+}
+
+static void console_buffer(const char *data, size_t count)
+{
+    bool newline = console_mode == PLATSUPPORT_CONSOLE_LINE_BUFFERED
+                   && memchr(data, '\n', count) != NULL;
+
+    while (count > 0) {
+        if (console_buffered == sizeof(console_buf)) {
+            console_drain(!console_nonblocking);
+            if (console_buffered == sizeof(console_buf)) {
+                /* the device is busy, and we may not wait for it */
+                console_dropped += count;
+                return;
+            }
+        }
+        size_t n = MIN(count, sizeof(console_buf) - console_buffered);
+        memcpy(&console_buf[console_buffered], data, n);
+        console_buffered += n;
+        data += n;
+        count -= n;
+    }
+    if (newline) {
+        console_drain(!console_nonblocking);
+    }
+}
+
+void platsupport_console_set_mode(platsupport_console_mode_t mode, bool nonblocking)
+{
+    platsupport_console_flush();
+    console_mode = mode;
+    console_nonblocking = nonblocking;
+}
+
+void platsupport_console_flush(void)
+{
+    if (console && console_buffered > 0) {
+        console_drain(true);
+    }
+}
+
+size_t platsupport_console_dropped(void)
+{
+    return console_dropped;
+}
+
 void __plat_putchar(int c)
 {
     if (console) {
-        ps_cdev_putchar(console, c);
+        if (console_mode == PLATSUPPORT_CONSOLE_UNBUFFERED) {
+            ps_cdev_putchar(console, c);
+        } else {
+            char ch = c;
+            console_buffer(&ch, 1);
+        }
+    }
+}
+
+size_t __plat_write(const char *data, size_t count)
+{
+    size_t sent;
+
+    if (console == NULL) {
+        return count;
+    }
+    if (console_mode != PLATSUPPORT_CONSOLE_UNBUFFERED) {
+        console_buffer(data, count);
+        return count;
     }
+    sent = console_device_write(data, count, !console_nonblocking);
+    console_dropped += count - sent;
+    return count;
+}
+
+ps_chardevice_t *platsupport_get_console(void)
+{
+    return console;
 }
 
 int __plat_getchar(void)
@@ -117,6 +117,8 @@ static int init_timer_internal(vka_t *vka, simple_t *simple, seL4_CPtr ntfn,
                                seL4_timer_t *timer, size_t nirqs)
 {
 
+    memset(&timer->hybrid, 0, sizeof(timer->hybrid));
+
     /* set up the irq caps the timer needs */
     timer->to.nirqs = 0;
     for (size_t i = 0; i < nirqs; i++) {
@@ -291,3 +293,71 @@ seL4_CPtr sel4platsupport_timer_objs_get_irq_cap(timer_objects_t *to, int id, ir
     ZF_LOGE("Could not find irq");
     return seL4_CapNull;
 }
+
+void sel4platsupport_timer_set_hybrid(seL4_timer_t *timer, uint64_t spin_threshold_ns, uint64_t early_ns)
+{
+    timer->hybrid.spin_threshold_ns = spin_threshold_ns;
+    timer->hybrid.early_ns = early_ns;
+}
+
+static void record_lateness(uint64_t *histogram, uint64_t target, uint64_t time)
+{
+    size_t bucket = 0;
+    if (time > target) {
+        /* number of bits in the lateness */
+        bucket = MIN(64 - CLZLL(time - target), SEL4PLATSUPPORT_TIMER_LATENESS_BUCKETS - 1);
+    }
+    histogram[bucket]++;
+}
+
+static int spin_until(seL4_timer_t *timer, uint64_t deadline_ns, uint64_t *time)
+{
+    int error;
+    do {
+        error = ltimer_get_time(&timer->ltimer, time);
+    } while (!error && *time < deadline_ns);
+    return error;
+}
+
+int sel4platsupport_timer_wait_until(seL4_timer_t *timer, seL4_CPtr ntfn, uint64_t deadline_ns)
+{
+    timer_hybrid_t *hybrid = &timer->hybrid;
+    uint64_t time;
+    int error = ltimer_get_time(&timer->ltimer, &time);
+    if (error) {
+        ZF_LOGE("Failed to get time");
+        return error;
+    }
+
+    if (time + hybrid->spin_threshold_ns < deadline_ns) {
+        uint64_t irq_time = deadline_ns > hybrid->early_ns ? deadline_ns - hybrid->early_ns : 0;
+        error = ltimer_set_timeout(&timer->ltimer, irq_time, TIMEOUT_ABSOLUTE);
+        if (error == ETIME || error == -ETIME) {
+            /* already past the point to want the interrupt at */
+            error = 0;
+        } else if (error) {
+            ZF_LOGE("Failed to set timeout");
+            return error;
+        } else {
+            while (!error && time < irq_time) {
+                seL4_Word badge;
+                seL4_Wait(ntfn, &badge);
+                sel4platsupport_handle_timer_irq(timer, badge);
+                error = ltimer_get_time(&timer->ltimer, &time);
+            }
+            if (error) {
+                ZF_LOGE("Failed to get time");
+                return error;
+            }
+            record_lateness(hybrid->irq_lateness, irq_time, time);
+        }
+    }
+
+    error = spin_until(timer, deadline_ns, &time);
+    if (error) {
+        ZF_LOGE("Failed to get time");
+        return error;
+    }
+    record_lateness(hybrid->lateness, deadline_ns, time);
+    return 0;
+}
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <sys/types.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <sel4/sel4.h>
@@ -40,6 +41,23 @@
  * that point on, by passing the serial_client_context_t object:
  *  serial_server_printf(&conn, "Hello world from %s!", "john");
  *
+ * Clients that print often can instead connect with
+ * serial_server_client_connect_async(). Their writes are copied into a ring in
+ * the shared memory and return without waiting for the server, which is only
+ * signalled when the ring was empty, and only called when the ring is full.
+ *
+ * Synchronous connections that print a lot of small messages can be made
+ * buffered with serial_server_set_buffered(), so that output accumulates in
+ * the shared memory and the server is only called once it fills up, after a
+ * number of lines, or on serial_server_flush().
+ *
+ * Connections can also read the input the server reads from the serial device,
+ * once the parent has turned that on with serial_server_parent_enable_input().
+ * serial_server_input_connect() registers a connection as a reader, and the
+ * server hands input to the reader that has the focus through a ring in its
+ * shared memory, signalling a Notification so that serial_server_read() can
+ * block rather than poll.
+ *
  * You can easily abstract away the long function name using preprocessor
  * defines or wrapper functions such as:
  *  #define printf(fmt, ...) serial_server_printf(&global_client_conn, ## __VA_ARGS__)
@@ -49,6 +67,24 @@
  * reference must remain functional throughout the lifetime of the server.
  */
 
+/* Levels of output, most important first. The server can be told to drop
+ * output above a level, see serial_server_parent_set_limits(). */
+enum serial_server_levels {
+    /* never dropped, even by rate limiting */
+    SERIAL_SERVER_LEVEL_CRITICAL = 0,
+    SERIAL_SERVER_LEVEL_ERROR,
+    SERIAL_SERVER_LEVEL_WARNING,
+    /* what connections start at */
+    SERIAL_SERVER_LEVEL_INFO,
+    SERIAL_SERVER_LEVEL_DEBUG,
+};
+
+/* How much of a client's output the server has dropped */
+typedef struct serial_server_stats {
+    seL4_Word dropped_msgs;
+    seL4_Word dropped_bytes;
+} serial_server_stats_t;
+
 /* Context given to each client to preserve state.
  *
  * This is an opaque handle data type, and clients are not to assume the
@@ -59,6 +95,22 @@ typedef struct _serial_client_context {
     cspacepath_t badged_server_ep_cspath;
     volatile char *shmem;
     size_t shmem_size;
+    /* one of serial_server_modes */
+    int mode;
+    /* Notification to signal the server on, for asynchronous connections */
+    cspacepath_t server_ntfn_cspath;
+    vka_t *client_vka;
+    /* Buffered connections accumulate output in shmem */
+    bool buffered;
+    size_t buffered_len;
+    size_t buffered_lines;
+    size_t flush_lines;
+    /* one of serial_server_levels, for the output that follows */
+    int level;
+    /* Input ring in shmem and the Notification the server signals when it
+     * writes to it, for connections that read input */
+    void *input;
+    seL4_CPtr input_ntfn;
 } serial_client_context_t;
 
 /** Establishes a connection to the server thread and returns a connection
@@ -88,6 +140,60 @@ int serial_server_client_connect(seL4_CPtr server_ep_cap,
                                  vspace_t *client_vspace,
                                  serial_client_context_t *conn);
 
+/** Establishes an asynchronous connection to the server thread. Arguments are
+ * as for serial_server_client_connect().
+ *
+ * printf() and write() on the connection copy into a ring in the shared memory
+ * and return once it has been copied, blocking only while the ring is full.
+ * Output from a connection is written out in order, but output from different
+ * connections may be interleaved differently than it was written. Use
+ * serial_server_flush() to wait for the server to write out everything
+ * written so far.
+ *
+ * @return Error value: 0 on success, non-zero on failure.
+ */
+int serial_server_client_connect_async(seL4_CPtr server_ep_cap,
+                                       vka_t *client_vka,
+                                       vspace_t *client_vspace,
+                                       serial_client_context_t *conn);
+
+/** Establishes a connection to the server thread with a shared memory buffer
+ * of a given size, rather than the default of one page. Other arguments are as
+ * for serial_server_client_connect().
+ *
+ * The buffer bounds the length of a single printf() or write() on a
+ * synchronous connection, and what can be written before blocking on an
+ * asynchronous one. If the server will not accept a buffer that large, the
+ * largest it will accept is used instead, see conn->shmem_size.
+ *
+ * @param shmem_size Requested size of the shared memory buffer in bytes.
+ * @param async Whether to connect asynchronously, as with
+ *              serial_server_client_connect_async().
+ * @return Error value: 0 on success, non-zero on failure.
+ */
+int serial_server_client_connect_sized(seL4_CPtr server_ep_cap,
+                                       vka_t *client_vka,
+                                       vspace_t *client_vspace,
+                                       size_t shmem_size,
+                                       bool async,
+                                       serial_client_context_t *conn);
+
+/** Turns buffering on or off for a synchronous connection.
+ *
+ * While buffered, printf() and write() copy into the shared memory buffer and
+ * only call the server when the buffer is full, when it holds flush_lines
+ * newlines, or on serial_server_flush(ctxt, 0). Turning buffering off, and
+ * disconnecting, sends off whatever is buffered.
+ *
+ * @param ctxt Valid connection token returned by serial_server_client_connect().
+ * @param buffered Whether to buffer output.
+ * @param flush_lines Number of lines after which to send output off, 0 to
+ *                    only do so when the buffer is full or flushed.
+ * @return 0 on success, non-zero on failure.
+ */
+int serial_server_set_buffered(serial_client_context_t *ctxt, bool buffered,
+                               size_t flush_lines);
+
 /** Sends a request to the server to print a message to the serial.
  *
  * @param ctxt Valid connection token returned by serial_server_client_connect().
@@ -102,6 +208,10 @@ ssize_t serial_server_printf(serial_client_context_t *ctxt, const char *fmt, ...
 /** Sends the server a request to print the current contents of the shared memory buffer.
  *  For use when the client uses the shared memory buffer directly.
  *
+ * On an asynchronous connection, waits for the server to write out everything
+ * written so far instead, and len must be 0. On a buffered connection, sends
+ * off everything buffered instead, and len must be 0.
+ *
  * @param ctxt Valid connection token returned by serial_server_client_connect().
  * @param len the size of the buffer data.
  * @return The number of bytes written (positive integer), or a negative integer
@@ -130,6 +240,85 @@ ssize_t serial_server_write(serial_client_context_t *ctxt, const char *in_buff,
  */
 void serial_server_disconnect(serial_client_context_t *ctxt);
 
+/** Sets the level of the output written on a connection from here on. Output
+ * that was buffered or written asynchronously before is sent off first, so it
+ * keeps its old level.
+ *
+ * @param ctxt Valid connection token returned by serial_server_client_connect().
+ * @param level One of serial_server_levels.
+ * @return 0 on success, non-zero on failure.
+ */
+int serial_server_set_level(serial_client_context_t *ctxt, int level);
+
+/** Asks the server how much of this connection's output it has dropped, for
+ * being above its level or over its rate.
+ *
+ * @param ctxt Valid connection token returned by serial_server_client_connect().
+ * @param stats [out] The counts for this connection.
+ * @return 0 on success, non-zero on failure.
+ */
+int serial_server_get_stats(serial_client_context_t *ctxt, serial_server_stats_t *stats);
+
+/** Registers a connection as a reader of the input the server reads from the
+ * serial device. Input goes to one reader at a time, the one with the focus,
+ * and waits in the server while there is none. When the reader with the focus
+ * disconnects, another reader gets it.
+ *
+ * The input ring takes some of the shared memory away from output, so anything
+ * buffered or written asynchronously is sent off first.
+ *
+ * @param ctxt Valid connection token returned by serial_server_client_connect().
+ * @param notification Notification for the server to signal when there is
+ *                     input. The connection must have been made with an
+ *                     Endpoint that can grant, for the server to get a copy.
+ * @param focus Whether to take the focus, rather than only getting it if no
+ *              other reader has it.
+ * @return 0 on success, non-zero on failure.
+ */
+int serial_server_input_connect(serial_client_context_t *ctxt, seL4_CPtr notification,
+                                bool focus);
+
+/** Gives a connection that reads input the focus, so that input goes to it.
+ *
+ * @param ctxt Connection registered with serial_server_input_connect().
+ * @return 0 on success, non-zero on failure.
+ */
+int serial_server_take_focus(serial_client_context_t *ctxt);
+
+/** Reads input handed to this connection by the server.
+ *
+ * @param ctxt Connection registered with serial_server_input_connect().
+ * @param buff Buffer to read into.
+ * @param len Size of buff.
+ * @param block Whether to wait on the connection's Notification for input to
+ *              arrive if there is none, rather than return 0.
+ * @return The number of bytes read, or a negative integer for error condition.
+ */
+ssize_t serial_server_read(serial_client_context_t *ctxt, char *buff, size_t len, bool block);
+
+/** Waits for and reads a single character of input, see serial_server_read().
+ *
+ * @return The character as an unsigned char, or EOF on error.
+ */
+int serial_server_getchar(serial_client_context_t *ctxt);
+
+/** Sets the connection that serial_server_stdio_write() writes to.
+ *
+ * Together they can back the stdout and stderr of a whole process, by passing
+ * serial_server_stdio_write to sel4muslcsys_register_stdio_write_fn(). Making
+ * the connection buffered then coalesces the process' output.
+ *
+ * @param ctxt Valid connection token, or NULL to drop output.
+ */
+void serial_server_set_stdio_conn(serial_client_context_t *ctxt);
+
+/** Writes to the connection set with serial_server_set_stdio_conn(). Matches
+ * write_buf_fn from libsel4muslcsys.
+ *
+ * @return The number of bytes written, 0 on error.
+ */
+size_t serial_server_stdio_write(void *data, size_t count);
+
 /** Sends a request to the server to "kill" itself.
  *
  * In practice, right now that means that the server exits its message loop and
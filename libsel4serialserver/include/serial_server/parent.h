@@ -13,6 +13,7 @@
 #include <vka/vka.h>
 #include <vspace/vspace.h>
 #include <sel4utils/process.h>
+#include <platsupport/irq.h>
 
 /** @file API for allowing a thread to act as the parent to a serial server
  * thread.
@@ -43,6 +44,43 @@ seL4_Error serial_server_parent_spawn_thread(simple_t *parent_simple,
                                              vspace_t *parent_vspace,
                                              uint8_t priority);
 
+/* Limits on the output of each client */
+typedef struct serial_server_limits {
+    /* Output of a higher level than this is dropped, see serial_server_levels */
+    int max_level;
+    /* Average bytes per second each client may write, 0 for no limit. Output
+     * is dropped while a client is over, except SERIAL_SERVER_LEVEL_CRITICAL. */
+    size_t bytes_per_second;
+    /* Bytes a client may write at once after being quiet */
+    size_t burst_bytes;
+    /* Frequency in Hz of the counter in sel4utils/arch/counter.h, 0 to ask
+     * the counter itself */
+    uint64_t counter_freq;
+} serial_server_limits_t;
+
+/** Sets the limits on client output, after the server has been spawned.
+ * Nothing is dropped until this is called.
+ *
+ * @param limits The new limits.
+ * @return 0 if successful, seL4_IllegalOperation if a rate was asked for but
+ *         there is no counter to measure it with.
+ */
+int serial_server_parent_set_limits(const serial_server_limits_t *limits);
+
+/** Has the server read input from the serial device, after the server has been
+ * spawned. The device's receive interrupt is registered with an IRQ server
+ * thread, which hands it to the server through a ring rather than by IPC. The
+ * server then reads everything the device has received into a buffer of
+ * BIT(LibSel4SerialServerRxBufferBits) bytes, and hands it on to the client
+ * that has the focus, see serial_server_input_connect().
+ *
+ * @param irq The receive interrupt of the platform serial device.
+ * @param priority Priority of the IRQ server thread, which should be at least
+ *                 that of the server.
+ * @return 0 if successful, seL4_Error value on error.
+ */
+seL4_Error serial_server_parent_enable_input(ps_irq_t irq, uint8_t priority);
+
 /** Mints a new, badged copy of the Server's Endpoint cap into the caller's
  * already-provided slot, dest_slot.
  *
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Throughput, latency and fairness of the serial server with several clients.
+ *
+ * Each client is a thread that writes a number of messages of the same size,
+ * timing each write with the cycle counter. Results are printed rather than
+ * checked, only that every write went through is tested. Times are in cycles,
+ * throughput is per million cycles and fairness is Jain's index over the
+ * throughput of each client, in thousandths: 1000 when every client got the
+ * same share. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <sel4/sel4.h>
+#include <sel4bench/sel4bench.h>
+#include <vka/capops.h>
+#include <vka/object.h>
+#include <sel4utils/thread.h>
+#include <serial_server/parent.h>
+#include <serial_server/client.h>
+
+#include <sel4test/test.h>
+#include <sel4test/testutil.h>
+
+#define SERSERV_BENCH_PRIO_SERVER   (seL4_MaxPrio - 1)
+#define SERSERV_BENCH_PRIO_CLIENT   (seL4_MaxPrio - 2)
+
+#define SERSERV_BENCH_MAX_CLIENTS   4
+#define SERSERV_BENCH_N_MSGS        32
+
+static const size_t bench_msg_sizes[] = { 16, 128 };
+
+typedef struct bench_client {
+    serial_client_context_t conn;
+    cspacepath_t badged_server_ep_cspath;
+    sel4utils_thread_t thread;
+    /* waited on before starting, so that every client starts together */
+    seL4_CPtr go_ep;
+    vka_object_t done;
+    bool async;
+    const char *msg;
+    size_t msg_len;
+    ccnt_t latencies[SERSERV_BENCH_N_MSGS];
+    ccnt_t start, end;
+    size_t n_written;
+} bench_client_t;
+
+static char bench_msg[128];
+static bench_client_t bench_clients[SERSERV_BENCH_MAX_CLIENTS];
+static ccnt_t bench_latencies[SERSERV_BENCH_MAX_CLIENTS * SERSERV_BENCH_N_MSGS];
+
+static void
+bench_client_main(void *arg0, void *arg1 UNUSED, void *ipc_buf UNUSED)
+{
+    bench_client_t *client = arg0;
+
+    seL4_Wait(client->go_ep, NULL);
+    client->start = sel4bench_get_cycle_count();
+    for (int i = 0; i < SERSERV_BENCH_N_MSGS; i++) {
+        ccnt_t before = sel4bench_get_cycle_count();
+        if (serial_server_write(&client->conn, client->msg, client->msg_len) == (ssize_t)client->msg_len) {
+            client->n_written++;
+        }
+        client->latencies[i] = sel4bench_get_cycle_count() - before;
+    }
+    /* Asynchronous output only counts once the server has written it out. */
+    if (client->async) {
+        serial_server_flush(&client->conn, 0);
+    }
+    client->end = sel4bench_get_cycle_count();
+
+    seL4_Signal(client->done.cptr);
+    seL4_TCB_Suspend(client->thread.tcb.cptr);
+}
+
+static int
+bench_compare_ccnt(const void *a, const void *b)
+{
+    ccnt_t x = *(const ccnt_t *)a, y = *(const ccnt_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int
+bench_run(struct env *env, size_t n_clients, bool async, size_t msg_len)
+{
+    int error;
+    vka_object_t go_ep;
+    ccnt_t start = (ccnt_t)-1, end = 0;
+    uint64_t total_bytes = 0, sum_x = 0, sum_x2 = 0;
+    size_t n_latencies = 0;
+
+    error = vka_alloc_endpoint(&env->vka, &go_ep);
+    test_eq(error, 0);
+
+    for (size_t i = 0; i < n_clients; i++) {
+        bench_client_t *client = &bench_clients[i];
+
+        memset(client, 0, sizeof(*client));
+        client->msg = bench_msg;
+        client->msg_len = msg_len;
+        client->go_ep = go_ep.cptr;
+        client->async = async;
+
+        /* The vka isn't thread safe, so connect on the clients' behalf. */
+        error = serial_server_parent_vka_mint_endpoint(&env->vka, &client->badged_server_ep_cspath);
+        test_eq(error, 0);
+        if (async) {
+            error = serial_server_client_connect_async(client->badged_server_ep_cspath.capPtr,
+                                                       &env->vka, &env->vspace, &client->conn);
+        } else {
+            error = serial_server_client_connect(client->badged_server_ep_cspath.capPtr,
+                                                 &env->vka, &env->vspace, &client->conn);
+        }
+        test_eq(error, 0);
+        error = vka_alloc_notification(&env->vka, &client->done);
+        test_eq(error, 0);
+
+        sel4utils_thread_config_t config = thread_config_default(&env->simple, env->cspace_root,
+                                                                 seL4_NilData, seL4_CapNull,
+                                                                 SERSERV_BENCH_PRIO_CLIENT);
+        error = sel4utils_configure_thread_config(&env->vka, &env->vspace, &env->vspace,
+                                                  config, &client->thread);
+        test_eq(error, 0);
+        error = sel4utils_start_thread(&client->thread, bench_client_main, client, NULL, 1);
+        test_eq(error, 0);
+    }
+
+    /* Send blocks until a client is waiting, so none miss the start. */
+    for (size_t i = 0; i < n_clients; i++) {
+        seL4_Send(go_ep.cptr, seL4_MessageInfo_new(0, 0, 0, 0));
+    }
+    for (size_t i = 0; i < n_clients; i++) {
+        seL4_Wait(bench_clients[i].done.cptr, NULL);
+    }
+
+    for (size_t i = 0; i < n_clients; i++) {
+        bench_client_t *client = &bench_clients[i];
+        uint64_t bytes = (uint64_t)client->n_written * msg_len;
+        /* bytes per million cycles */
+        uint64_t x = client->end > client->start ? bytes * 1000000 / (client->end - client->start) : 0;
+
+        test_eq(client->n_written, SERSERV_BENCH_N_MSGS);
+        start = MIN(start, client->start);
+        end = MAX(end, client->end);
+        total_bytes += bytes;
+        sum_x += x;
+        sum_x2 += x * x;
+        memcpy(&bench_latencies[n_latencies], client->latencies, sizeof(client->latencies));
+        n_latencies += SERSERV_BENCH_N_MSGS;
+    }
+    qsort(bench_latencies, n_latencies, sizeof(ccnt_t), bench_compare_ccnt);
+
+    printf("serserv bench: %s, %zu clients, %zuB msgs: %"PRIu64" B/Mcycle, "
+           "%"PRIu64" msgs/Mcycle, latency p50 %"PRIu64" p99 %"PRIu64" cycles, "
+           "fairness %"PRIu64"/1000\n",
+           async ? "async" : "sync", n_clients, msg_len,
+           end > start ? total_bytes * 1000000 / (end - start) : 0,
+           end > start ? (uint64_t)n_latencies * 1000000 / (end - start) : 0,
+           (uint64_t)bench_latencies[n_latencies / 2],
+           (uint64_t)bench_latencies[n_latencies * 99 / 100],
+           sum_x2 > 0 ? sum_x * sum_x * 1000 / (n_clients * sum_x2) : 0);
+
+    for (size_t i = 0; i < n_clients; i++) {
+        bench_client_t *client = &bench_clients[i];
+
+        sel4utils_clean_up_thread(&env->vka, &env->vspace, &client->thread);
+        serial_server_disconnect(&client->conn);
+        vka_cnode_delete(&client->badged_server_ep_cspath);
+        vka_cspace_free_path(&env->vka, client->badged_server_ep_cspath);
+        vka_free_object(&env->vka, &client->done);
+    }
+    vka_free_object(&env->vka, &go_ep);
+    return sel4test_get_result();
+}
+
+static int
+bench_sizes(struct env *env, size_t n_clients, bool async)
+{
+    int error;
+
+    error = serial_server_parent_spawn_thread(&env->simple,
+                                              &env->vka, &env->vspace,
+                                              SERSERV_BENCH_PRIO_SERVER);
+    test_eq(error, 0);
+
+    memset(bench_msg, '.', sizeof(bench_msg));
+    sel4bench_init();
+    for (size_t i = 0; i < ARRAY_SIZE(bench_msg_sizes); i++) {
+        size_t len = bench_msg_sizes[i];
+
+        /* Each message is a line of its own. */
+        bench_msg[len - 1] = '\n';
+        bench_run(env, n_clients, async, len);
+        bench_msg[len - 1] = '.';
+    }
+    sel4bench_destroy();
+    return sel4test_get_result();
+}
+
+static int
+bench_sync_one_client(struct env *env)
+{
+    return bench_sizes(env, 1, false);
+}
+DEFINE_TEST(SERSERV_BENCH_001, "Throughput and latency of one synchronous client",
+            bench_sync_one_client, true)
+
+static int
+bench_sync_clients(struct env *env)
+{
+    return bench_sizes(env, SERSERV_BENCH_MAX_CLIENTS, false);
+}
+DEFINE_TEST(SERSERV_BENCH_002, "Throughput, latency and fairness of several synchronous clients",
+            bench_sync_clients, true)
+
+static int
+bench_async_clients(struct env *env)
+{
+    return bench_sizes(env, SERSERV_BENCH_MAX_CLIENTS, true);
+}
+DEFINE_TEST(SERSERV_BENCH_003, "Throughput, latency and fairness of several asynchronous clients",
+            bench_async_clients, true)
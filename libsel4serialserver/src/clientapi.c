@@ -6,9 +6,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 #include <sel4/sel4.h>
 
+#include <sel4utils/page_copy.h>
 #include <sel4utils/strerror.h>
 #include <vka/vka.h>
 #include <vka/capops.h>
@@ -18,6 +20,9 @@
 #include "serial_server.h"
 #include <serial_server/client.h>
 
+/* Connection that serial_server_stdio_write() writes to */
+static serial_client_context_t *stdio_conn;
+
 /** Single-call connection to the server thread, using the parent as a
  * proxy.
  *
@@ -30,30 +35,58 @@
  * communicate directly with the server thread from then on.
  */
 
-int
-serial_server_client_connect(seL4_CPtr badged_server_ep_cap,
-                             vka_t *client_vka, vspace_t *client_vspace,
-                             serial_client_context_t *conn)
+/** Sends one message of a connect request: the first carries the requested
+ * shmem size and mode, the others the index of the Frame they carry.
+ */
+static int
+serial_server_connect_ipc_invoke(seL4_CPtr badged_server_ep_cap, int func,
+                                 seL4_Word arg0, seL4_Word arg1,
+                                 seL4_CPtr frame_cap, seL4_MessageInfo_t *tag)
+{
+    seL4_SetMR(SSMSGREG_FUNC, func);
+    seL4_SetCap(0, frame_cap);
+    if (func == FUNC_CONNECT_REQ) {
+        seL4_SetMR(SSMSGREG_CONNECT_REQ_SHMEM_SIZE, arg0);
+        seL4_SetMR(SSMSGREG_CONNECT_REQ_MODE, arg1);
+        *tag = seL4_MessageInfo_new(0, 0, 1, SSMSGREG_CONNECT_REQ_END);
+    } else {
+        seL4_SetMR(SSMSGREG_CONNECT_FRAME_REQ_INDEX, arg0);
+        *tag = seL4_MessageInfo_new(0, 0, 1, SSMSGREG_CONNECT_FRAME_REQ_END);
+    }
+
+    *tag = seL4_Call(badged_server_ep_cap, *tag);
+
+    /* It makes sense to verify that the message we're getting back is an
+     * ACK response to our request message.
+     */
+    if (seL4_GetMR(SSMSGREG_FUNC) != func + 1) {
+        ZF_LOGE(SERSERVC"connect: Reply message was not a CONNECT_ACK as "
+                "expected.");
+        return seL4_IllegalOperation;
+    }
+    return seL4_MessageInfo_get_label(*tag);
+}
+
+static int
+serial_server_client_connect_mode(seL4_CPtr badged_server_ep_cap,
+                                  vka_t *client_vka, vspace_t *client_vspace,
+                                  size_t shmem_size, int mode,
+                                  serial_client_context_t *conn)
 {
-    seL4_Error error;
-    int shmem_n_pages;
-    uintptr_t shmem_tmp_vaddr;
+    int error;
+    size_t shmem_n_pages;
     seL4_MessageInfo_t tag;
     cspacepath_t frame_cspath;
 
     if (badged_server_ep_cap == 0 || client_vka == NULL || client_vspace == NULL
-            || conn == NULL) {
+            || conn == NULL || shmem_size == 0) {
         return seL4_InvalidArgument;
     }
 
     memset(conn, 0, sizeof(serial_client_context_t));
 
-    shmem_n_pages = BYTES_TO_4K_PAGES(SERIAL_SERVER_SHMEM_MAX_SIZE);
-    if (shmem_n_pages > seL4_MsgMaxExtraCaps) {
-        ZF_LOGE(SERSERVC"connect: Currently unsupported shared memory size: "
-                "IPC cap transfer capability is inadequate.");
-        return seL4_RangeError;
-    }
+retry:
+    shmem_n_pages = BYTES_TO_4K_PAGES(ROUND_UP(shmem_size, BIT(seL4_PageBits)));
     conn->shmem = vspace_new_pages(client_vspace,
                                    seL4_AllRights,
                                    shmem_n_pages,
@@ -64,64 +97,86 @@ serial_server_client_connect(seL4_CPtr badged_server_ep_cap,
     }
     assert(IS_ALIGNED((uintptr_t)conn->shmem, seL4_PageBits));
 
+    /* An asynchronous connection is sent back a Notification cap to signal
+     * the server with, in the reply to the message with the last Frame.
+     */
+    if (mode == SERIAL_SERVER_MODE_ASYNC && conn->server_ntfn_cspath.capPtr == 0) {
+        error = vka_cspace_alloc_path(client_vka, &conn->server_ntfn_cspath);
+        if (error != 0) {
+            ZF_LOGE(SERSERVC"connect: Failed to alloc slot for Notification.");
+            goto out;
+        }
+    }
+
     /* Look up the Frame cap behind each page in the shmem range, and marshal
-     * all of those Frame caps to the parent. The parent will then map those
-     * Frames into its VSpace and establish a shmem link.
+     * them to the server one per message, since the kernel only transfers one
+     * cap per message. The server then maps those Frames into its VSpace and
+     * establishes a shmem link.
      */
-    shmem_tmp_vaddr = (uintptr_t)conn->shmem;
-    for (int i = 0; i < shmem_n_pages; i++) {
+    for (size_t i = 0; i < shmem_n_pages; i++) {
         vka_cspace_make_path(client_vka,
                              vspace_get_cap(client_vspace,
-                                            (void *)shmem_tmp_vaddr),
+                                            (void *)((uintptr_t)conn->shmem + i * BIT(seL4_PageBits))),
                              &frame_cspath);
+        if (i == shmem_n_pages - 1 && mode == SERIAL_SERVER_MODE_ASYNC) {
+            seL4_SetCapReceivePath(conn->server_ntfn_cspath.root,
+                                   conn->server_ntfn_cspath.capPtr,
+                                   conn->server_ntfn_cspath.capDepth);
+        }
 
-        seL4_SetCap(i, frame_cspath.capPtr);
-        shmem_tmp_vaddr += BIT(seL4_PageBits);
-    }
-
-    /* Call the server asking it to establish the shmem mapping with us, and
-     * get us connected up.
-     */
-    seL4_SetMR(SSMSGREG_FUNC, FUNC_CONNECT_REQ);
-    seL4_SetMR(SSMSGREG_CONNECT_REQ_SHMEM_SIZE,
-               SERIAL_SERVER_SHMEM_MAX_SIZE);
-    /* extraCaps doubles up as the number of shmem pages. */
-    tag = seL4_MessageInfo_new(0, 0,
-                               shmem_n_pages,
-                               SSMSGREG_CONNECT_REQ_END);
-
-    tag = seL4_Call(badged_server_ep_cap, tag);
+        if (i == 0) {
+            error = serial_server_connect_ipc_invoke(badged_server_ep_cap, FUNC_CONNECT_REQ,
+                                                     shmem_size, mode, frame_cspath.capPtr,
+                                                     &tag);
+        } else {
+            error = serial_server_connect_ipc_invoke(badged_server_ep_cap, FUNC_CONNECT_FRAME_REQ,
+                                                     i, 0, frame_cspath.capPtr, &tag);
+        }
 
-    /* It makes sense to verify that the message we're getting back is an
-     * ACK response to our request message.
-     */
-    if (seL4_GetMR(SSMSGREG_FUNC) != FUNC_CONNECT_ACK) {
-        error = seL4_IllegalOperation;
-        ZF_LOGE(SERSERVC"connect: Reply message was not a CONNECT_ACK as "
-                "expected.");
-        goto out;
+        if (i == 0 && error == (int)SERIAL_SERVER_ERROR_SHMEM_TOO_LARGE) {
+            /* Settle for the largest shmem the server will take. */
+            size_t max_size = seL4_GetMR(SSMSGREG_CONNECT_ACK_MAX_SHMEM_SIZE);
+            ZF_LOGI(SERSERVC"connect: Requested shmem of %zuB is too large, "
+                    "falling back to the server's max of %zuB.", shmem_size, max_size);
+            vspace_unmap_pages(client_vspace, (void *)conn->shmem, shmem_n_pages,
+                               seL4_PageBits, VSPACE_FREE);
+            conn->shmem = NULL;
+            if (max_size == 0 || max_size >= shmem_size) {
+                goto out;
+            }
+            shmem_size = max_size;
+            goto retry;
+        }
+        if (error != (int)SERIAL_SERVER_NOERROR) {
+            ZF_LOGE(SERSERVC"connect ERR %d: Failed to connect to the server.",
+                    error);
+            goto out;
+        }
     }
-    /* When the parent replies, we check to see if it was successful, etc. */
-    error = seL4_MessageInfo_get_label(tag);
-    if (error != (int)SERIAL_SERVER_NOERROR) {
-        ZF_LOGE(SERSERVC"connect ERR %d: Failed to connect to the server.",
-                error);
 
-        if (error == (int)SERIAL_SERVER_ERROR_SHMEM_TOO_LARGE) {
-            ZF_LOGE(SERSERVC"connect: Your requested shmem mapping size is too "
-                    "large.\n\tServer's max shmem size is %luB.",
-                    (long)seL4_GetMR(SSMSGREG_CONNECT_ACK_MAX_SHMEM_SIZE));
-        }
+    if (mode == SERIAL_SERVER_MODE_ASYNC && seL4_MessageInfo_get_extraCaps(tag) != 1) {
+        ZF_LOGE(SERSERVC"connect: Server did not send a Notification for an "
+                "asynchronous connection.");
+        error = seL4_FailedLookup;
         goto out;
     }
 
-    conn->shmem_size = SERIAL_SERVER_SHMEM_MAX_SIZE;
+    conn->shmem_size = shmem_size;
+    conn->mode = mode;
+    conn->client_vka = client_vka;
+    conn->level = SERIAL_SERVER_LEVEL_INFO;
+    if (mode == SERIAL_SERVER_MODE_ASYNC) {
+        ((serial_server_ring_t *)conn->shmem)->level = conn->level;
+    }
     vka_cspace_make_path(client_vka, badged_server_ep_cap,
                          &conn->badged_server_ep_cspath);
 
     return seL4_NoError;
 
 out:
+    if (conn->server_ntfn_cspath.capPtr != 0) {
+        vka_cspace_free_path(client_vka, conn->server_ntfn_cspath);
+    }
     if (conn->shmem != NULL) {
         vspace_unmap_pages(client_vspace, (void *)conn->shmem, shmem_n_pages,
                            seL4_PageBits, VSPACE_FREE);
@@ -129,6 +184,38 @@ out:
     return error;
 }
 
+int
+serial_server_client_connect(seL4_CPtr badged_server_ep_cap,
+                             vka_t *client_vka, vspace_t *client_vspace,
+                             serial_client_context_t *conn)
+{
+    return serial_server_client_connect_mode(badged_server_ep_cap, client_vka,
+                                             client_vspace, SERIAL_SERVER_SHMEM_DEFAULT_SIZE,
+                                             SERIAL_SERVER_MODE_SYNC, conn);
+}
+
+int
+serial_server_client_connect_async(seL4_CPtr badged_server_ep_cap,
+                                   vka_t *client_vka, vspace_t *client_vspace,
+                                   serial_client_context_t *conn)
+{
+    return serial_server_client_connect_mode(badged_server_ep_cap, client_vka,
+                                             client_vspace, SERIAL_SERVER_SHMEM_DEFAULT_SIZE,
+                                             SERIAL_SERVER_MODE_ASYNC, conn);
+}
+
+int
+serial_server_client_connect_sized(seL4_CPtr badged_server_ep_cap,
+                                   vka_t *client_vka, vspace_t *client_vspace,
+                                   size_t shmem_size, bool async,
+                                   serial_client_context_t *conn)
+{
+    return serial_server_client_connect_mode(badged_server_ep_cap, client_vka,
+                                             client_vspace, shmem_size,
+                                             async ? SERIAL_SERVER_MODE_ASYNC : SERIAL_SERVER_MODE_SYNC,
+                                             conn);
+}
+
 /** Performs the IPC register setup for a write() call to the server.
  *
  * The Server's ABI for the write() request has changed a little: the server
@@ -149,6 +236,7 @@ serial_server_write_ipc_invoke(serial_client_context_t *conn, ssize_t len)
 
     seL4_SetMR(SSMSGREG_FUNC, FUNC_WRITE_REQ);
     seL4_SetMR(SSMSGREG_WRITE_REQ_BUFF_LEN, len);
+    seL4_SetMR(SSMSGREG_WRITE_REQ_LEVEL, conn->level);
     tag = seL4_MessageInfo_new(0, 0, 0, SSMSGREG_WRITE_REQ_END);
 
     tag = seL4_Call(conn->badged_server_ep_cspath.capPtr, tag);
@@ -165,6 +253,224 @@ serial_server_write_ipc_invoke(serial_client_context_t *conn, ssize_t len)
     return seL4_GetMR(SSMSGREG_WRITE_ACK_N_BYTES_WRITTEN);
 }
 
+/** Asks the server to write out everything in an asynchronous connection's
+ * ring, and waits for it to have done so.
+ *
+ * @return 0 on success, or negative integer error value on error.
+ */
+static int
+serial_server_drain_ipc_invoke(serial_client_context_t *conn)
+{
+    seL4_MessageInfo_t tag;
+
+    seL4_SetMR(SSMSGREG_FUNC, FUNC_DRAIN_REQ);
+    tag = seL4_MessageInfo_new(0, 0, 0, SSMSGREG_DRAIN_REQ_END);
+
+    tag = seL4_Call(conn->badged_server_ep_cspath.capPtr, tag);
+
+    if (seL4_GetMR(SSMSGREG_FUNC) != FUNC_DRAIN_ACK) {
+        ZF_LOGE(SERSERVC"drain: Reply message was not a DRAIN_ACK as "
+                "expected.");
+        return - seL4_IllegalOperation;
+    }
+    return - seL4_MessageInfo_get_label(tag);
+}
+
+/** Copies a buffer into an asynchronous connection's ring.
+ *
+ * The server is signalled only if the ring was empty, since otherwise it has
+ * already been signalled and not yet caught up. If the ring fills up, the
+ * server is called to empty it.
+ *
+ * @return The number of bytes written, or negative integer error value if
+ *         none could be.
+ */
+static ssize_t
+serial_server_ring_write(serial_client_context_t *conn, const char *in_buff, size_t len)
+{
+    serial_server_ring_t *ring = (serial_server_ring_t *)conn->shmem;
+    size_t capacity = serial_server_ring_capacity(conn->shmem_size);
+    size_t done = 0;
+
+    while (done < len) {
+        uint32_t head = ring->head;
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        size_t space = (tail + capacity - head - 1) % capacity;
+
+        if (space == 0) {
+            int error = serial_server_drain_ipc_invoke(conn);
+            if (error != 0) {
+                return done > 0 ? done : error;
+            }
+            continue;
+        }
+
+        /* Only copy up to the end of the ring, the rest goes in next time
+         * around. */
+        size_t n = MIN(MIN(len - done, space), capacity - head);
+        memcpy(&ring->data[head], &in_buff[done], n);
+        __atomic_store_n(&ring->head, (head + n) % capacity, __ATOMIC_RELEASE);
+        /* Pairs with the fence in the server's drain */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == head) {
+            seL4_Signal(conn->server_ntfn_cspath.capPtr);
+        }
+        done += n;
+    }
+    return done;
+}
+
+/* printf()s into a buffer this large on the stack before resorting to malloc() */
+#define SERIAL_SERVER_ASYNC_PRINTF_BUFF_SIZE 256
+
+static ssize_t
+serial_server_ring_vprintf(serial_client_context_t *conn, const char *fmt, va_list args)
+{
+    char stack_buff[SERIAL_SERVER_ASYNC_PRINTF_BUFF_SIZE];
+    char *buff = stack_buff;
+    ssize_t expanded_fmt_length, ret;
+    va_list args_copy;
+
+    va_copy(args_copy, args);
+    expanded_fmt_length = vsnprintf(stack_buff, sizeof(stack_buff), fmt, args);
+    if (expanded_fmt_length >= (ssize_t)sizeof(stack_buff)) {
+        buff = malloc(expanded_fmt_length + 1);
+        if (buff == NULL) {
+            va_end(args_copy);
+            return -seL4_NotEnoughMemory;
+        }
+        vsnprintf(buff, expanded_fmt_length + 1, fmt, args_copy);
+    }
+    va_end(args_copy);
+    if (expanded_fmt_length < 0) {
+        return -1;
+    }
+
+    ret = serial_server_ring_write(conn, buff, expanded_fmt_length);
+    if (buff != stack_buff) {
+        free(buff);
+    }
+    return ret;
+}
+
+/** Sends off everything buffered on a buffered connection.
+ *
+ * @return 0 on success, or negative integer error value on error.
+ */
+static ssize_t
+serial_server_buffer_flush(serial_client_context_t *conn)
+{
+    ssize_t ret;
+
+    if (conn->buffered_len == 0) {
+        return 0;
+    }
+    ret = serial_server_write_ipc_invoke(conn, conn->buffered_len);
+    conn->buffered_len = 0;
+    conn->buffered_lines = 0;
+    return ret < 0 ? ret : 0;
+}
+
+/** Accounts for len bytes just added at the end of the buffer, sending it off
+ * once it holds flush_lines lines or is full.
+ */
+static ssize_t
+serial_server_buffer_added(serial_client_context_t *conn, size_t len)
+{
+    const char *start = (const char *)conn->shmem + conn->buffered_len;
+    const char *end = start + len;
+
+    conn->buffered_len += len;
+    if (conn->flush_lines != 0) {
+        for (const char *nl = memchr(start, '\n', len); nl != NULL;
+             nl = memchr(nl + 1, '\n', end - nl - 1)) {
+            conn->buffered_lines++;
+        }
+    }
+    if (conn->buffered_len == conn->shmem_size
+        || (conn->flush_lines != 0 && conn->buffered_lines >= conn->flush_lines)) {
+        return serial_server_buffer_flush(conn);
+    }
+    return 0;
+}
+
+static ssize_t
+serial_server_buffer_vprintf(serial_client_context_t *conn, const char *fmt, va_list args)
+{
+    ssize_t expanded_fmt_length, error;
+    va_list args_copy;
+
+    va_copy(args_copy, args);
+    expanded_fmt_length = vsnprintf((char *)conn->shmem + conn->buffered_len,
+                                    conn->shmem_size - conn->buffered_len, fmt, args);
+    if (expanded_fmt_length >= 0
+        && (size_t)expanded_fmt_length >= conn->shmem_size - conn->buffered_len
+        && conn->buffered_len > 0) {
+        /* Doesn't fit after what is already buffered, send that off first. */
+        error = serial_server_buffer_flush(conn);
+        if (error != 0) {
+            va_end(args_copy);
+            return error;
+        }
+        expanded_fmt_length = vsnprintf((char *)conn->shmem, conn->shmem_size,
+                                        fmt, args_copy);
+    }
+    va_end(args_copy);
+    if (expanded_fmt_length < 0) {
+        return -1;
+    }
+    if ((size_t)expanded_fmt_length >= conn->shmem_size) {
+        ZF_LOGE(SERSERVC"printf: This printf call's total expanded length (%zd) "
+                "exceeds your %zd bytes shmem buffer.\n\tMessage not sent to "
+                "server.",
+                expanded_fmt_length,
+                conn->shmem_size);
+        return -seL4_RangeError;
+    }
+
+    error = serial_server_buffer_added(conn, expanded_fmt_length);
+    return error != 0 ? error : expanded_fmt_length;
+}
+
+static ssize_t
+serial_server_buffer_write(serial_client_context_t *conn, const char *in_buff, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        size_t n = MIN(len - done, conn->shmem_size - conn->buffered_len);
+        sel4utils_copy((char *)conn->shmem + conn->buffered_len, &in_buff[done], n);
+        ssize_t error = serial_server_buffer_added(conn, n);
+        if (error != 0) {
+            return error;
+        }
+        done += n;
+    }
+    return done;
+}
+
+int
+serial_server_set_buffered(serial_client_context_t *conn, bool buffered,
+                           size_t flush_lines)
+{
+    if (conn == NULL || conn->shmem == NULL) {
+        return seL4_InvalidArgument;
+    }
+    if (conn->mode != SERIAL_SERVER_MODE_SYNC) {
+        /* Asynchronous connections don't wait for the server anyway. */
+        return seL4_IllegalOperation;
+    }
+    if (!buffered) {
+        ssize_t error = serial_server_buffer_flush(conn);
+        if (error != 0) {
+            return -error;
+        }
+    }
+    conn->buffered = buffered;
+    conn->flush_lines = flush_lines;
+    return 0;
+}
+
 ssize_t
 serial_server_printf(serial_client_context_t *conn, const char *fmt, ...)
 {
@@ -180,6 +486,19 @@ serial_server_printf(serial_client_context_t *conn, const char *fmt, ...)
         return -seL4_InvalidArgument;
     }
 
+    if (conn->mode == SERIAL_SERVER_MODE_ASYNC) {
+        va_start(args, fmt);
+        expanded_fmt_length = serial_server_ring_vprintf(conn, fmt, args);
+        va_end(args);
+        return expanded_fmt_length;
+    }
+    if (conn->buffered) {
+        va_start(args, fmt);
+        expanded_fmt_length = serial_server_buffer_vprintf(conn, fmt, args);
+        va_end(args);
+        return expanded_fmt_length;
+    }
+
     va_start(args, fmt);
     expanded_fmt_length = vsnprintf((char *)conn->shmem, conn->shmem_size,
                                     fmt, args);
@@ -203,6 +522,19 @@ serial_server_printf(serial_client_context_t *conn, const char *fmt, ...)
 
 ssize_t serial_server_flush(serial_client_context_t *conn, ssize_t len)
 {
+    if (conn->mode == SERIAL_SERVER_MODE_ASYNC) {
+        if (len != 0) {
+            return -seL4_InvalidArgument;
+        }
+        return serial_server_drain_ipc_invoke(conn);
+    }
+    if (conn->buffered) {
+        if (len != 0) {
+            return -seL4_InvalidArgument;
+        }
+        return serial_server_buffer_flush(conn);
+    }
+
     if (len > conn->shmem_size) {
         return -seL4_RangeError;
     }
@@ -222,6 +554,12 @@ serial_server_write(serial_client_context_t *conn, const char *in_buff, ssize_t
                 "\tIs connection handle valid?");
         return -seL4_InvalidArgument;
     }
+    if (conn->mode == SERIAL_SERVER_MODE_ASYNC) {
+        return len > 0 ? serial_server_ring_write(conn, in_buff, len) : 0;
+    }
+    if (conn->buffered) {
+        return len > 0 ? serial_server_buffer_write(conn, in_buff, len) : 0;
+    }
     if (len > conn->shmem_size) {
         return -seL4_RangeError;
     }
@@ -230,7 +568,7 @@ serial_server_write(serial_client_context_t *conn, const char *in_buff, ssize_t
         return 0;
     }
 
-    memcpy((void *)conn->shmem, in_buff, len);
+    sel4utils_copy((void *)conn->shmem, in_buff, len);
 
     /* Else, send it off to the server. */
     return serial_server_write_ipc_invoke(conn, len);
@@ -245,6 +583,13 @@ serial_server_disconnect(serial_client_context_t *conn)
         return;
     }
 
+    if (conn->buffered) {
+        serial_server_buffer_flush(conn);
+    }
+    if (stdio_conn == conn) {
+        stdio_conn = NULL;
+    }
+
     seL4_SetMR(SSMSGREG_FUNC, FUNC_DISCONNECT_REQ);
     tag = seL4_MessageInfo_new(0, 0, 0, SSMSGREG_DISCONNECT_REQ_END);
 
@@ -254,6 +599,208 @@ serial_server_disconnect(serial_client_context_t *conn)
         ZF_LOGE(SERSERVC"disconnect: reply message was not a DISCONNECT_ACK "
                 "as expected.");
     }
+
+    if (conn->mode == SERIAL_SERVER_MODE_ASYNC) {
+        vka_cnode_delete(&conn->server_ntfn_cspath);
+        vka_cspace_free_path(conn->client_vka, conn->server_ntfn_cspath);
+        conn->server_ntfn_cspath.capPtr = 0;
+    }
+    conn->input = NULL;
+}
+
+int
+serial_server_set_level(serial_client_context_t *conn, int level)
+{
+    ssize_t error = 0;
+
+    if (conn == NULL || conn->shmem == NULL
+        || level < SERIAL_SERVER_LEVEL_CRITICAL || level > SERIAL_SERVER_LEVEL_DEBUG) {
+        return seL4_InvalidArgument;
+    }
+    if (level == conn->level) {
+        return 0;
+    }
+
+    /* Output already written keeps the level it was written at. */
+    if (conn->mode == SERIAL_SERVER_MODE_ASYNC) {
+        error = serial_server_drain_ipc_invoke(conn);
+        if (error == 0) {
+            ((serial_server_ring_t *)conn->shmem)->level = level;
+        }
+    } else if (conn->buffered) {
+        error = serial_server_buffer_flush(conn);
+    }
+    if (error != 0) {
+        return -error;
+    }
+    conn->level = level;
+    return 0;
+}
+
+int
+serial_server_get_stats(serial_client_context_t *conn, serial_server_stats_t *stats)
+{
+    seL4_MessageInfo_t tag;
+
+    if (conn == NULL || stats == NULL) {
+        return seL4_InvalidArgument;
+    }
+
+    seL4_SetMR(SSMSGREG_FUNC, FUNC_GET_STATS_REQ);
+    tag = seL4_MessageInfo_new(0, 0, 0, SSMSGREG_GET_STATS_REQ_END);
+
+    tag = seL4_Call(conn->badged_server_ep_cspath.capPtr, tag);
+
+    if (seL4_GetMR(SSMSGREG_FUNC) != FUNC_GET_STATS_ACK) {
+        ZF_LOGE(SERSERVC"get_stats: Reply message was not a GET_STATS_ACK as "
+                "expected.");
+        return seL4_IllegalOperation;
+    }
+    stats->dropped_msgs = seL4_GetMR(SSMSGREG_GET_STATS_ACK_DROPPED_MSGS);
+    stats->dropped_bytes = seL4_GetMR(SSMSGREG_GET_STATS_ACK_DROPPED_BYTES);
+    return seL4_MessageInfo_get_label(tag);
+}
+
+int
+serial_server_input_connect(serial_client_context_t *conn, seL4_CPtr notification,
+                            bool focus)
+{
+    seL4_MessageInfo_t tag;
+    ssize_t error;
+
+    if (conn == NULL || conn->shmem == NULL || conn->input != NULL
+        || notification == seL4_CapNull) {
+        return seL4_InvalidArgument;
+    }
+    /* The server empties an asynchronous connection's ring itself. */
+    if (conn->buffered) {
+        error = serial_server_buffer_flush(conn);
+        if (error != 0) {
+            return -error;
+        }
+    }
+
+    seL4_SetMR(SSMSGREG_FUNC, FUNC_INPUT_REQ);
+    seL4_SetMR(SSMSGREG_INPUT_REQ_FOCUS, focus);
+    seL4_SetCap(0, notification);
+    tag = seL4_MessageInfo_new(0, 0, 1, SSMSGREG_INPUT_REQ_END);
+
+    tag = seL4_Call(conn->badged_server_ep_cspath.capPtr, tag);
+
+    if (seL4_GetMR(SSMSGREG_FUNC) != FUNC_INPUT_ACK) {
+        ZF_LOGE(SERSERVC"input_connect: Reply message was not an INPUT_ACK as "
+                "expected.");
+        return seL4_IllegalOperation;
+    }
+    if (seL4_MessageInfo_get_label(tag) != 0) {
+        return seL4_MessageInfo_get_label(tag);
+    }
+
+    conn->shmem_size = seL4_GetMR(SSMSGREG_INPUT_ACK_RING_OFFSET);
+    conn->input = (void *)((uintptr_t)conn->shmem + conn->shmem_size);
+    conn->input_ntfn = notification;
+    return 0;
+}
+
+/** Sends one of the input requests that carry nothing but their function. */
+static int
+serial_server_input_ipc_invoke(serial_client_context_t *conn, int func)
+{
+    seL4_MessageInfo_t tag;
+
+    seL4_SetMR(SSMSGREG_FUNC, func);
+    tag = seL4_MessageInfo_new(0, 0, 0, SSMSGREG_LABEL0);
+
+    tag = seL4_Call(conn->badged_server_ep_cspath.capPtr, tag);
+
+    if (seL4_GetMR(SSMSGREG_FUNC) != func + 1) {
+        ZF_LOGE(SERSERVC"input: Reply message was not the ACK to %d as "
+                "expected.", func);
+        return seL4_IllegalOperation;
+    }
+    return seL4_MessageInfo_get_label(tag);
+}
+
+int
+serial_server_take_focus(serial_client_context_t *conn)
+{
+    if (conn == NULL || conn->input == NULL) {
+        return seL4_InvalidArgument;
+    }
+    return serial_server_input_ipc_invoke(conn, FUNC_FOCUS_REQ);
+}
+
+ssize_t
+serial_server_read(serial_client_context_t *conn, char *buff, size_t len, bool block)
+{
+    serial_server_input_ring_t *ring;
+    const size_t capacity = SERIAL_SERVER_INPUT_RING_CAPACITY;
+    size_t done = 0;
+
+    if (conn == NULL || conn->input == NULL || buff == NULL) {
+        return - seL4_InvalidArgument;
+    }
+    ring = conn->input;
+
+    while (done == 0 && len > 0) {
+        uint32_t tail = ring->tail;
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        bool was_full;
+
+        if (head == tail) {
+            if (!block) {
+                break;
+            }
+            /* The server signals after each time it writes to the ring, so
+             * anything written since we looked is not missed. */
+            seL4_Wait(conn->input_ntfn, NULL);
+            continue;
+        }
+
+        was_full = (head + 1) % capacity == tail;
+        while (head != tail && done < len) {
+            buff[done++] = ring->data[tail];
+            tail = (tail + 1) % capacity;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        if (was_full) {
+            /* The server may be holding on to more. */
+            int error = serial_server_input_ipc_invoke(conn, FUNC_INPUT_PULL_REQ);
+            if (error != 0) {
+                return - error;
+            }
+        }
+    }
+    return done;
+}
+
+int
+serial_server_getchar(serial_client_context_t *conn)
+{
+    char c;
+
+    if (serial_server_read(conn, &c, 1, true) != 1) {
+        return EOF;
+    }
+    return (unsigned char)c;
+}
+
+void
+serial_server_set_stdio_conn(serial_client_context_t *conn)
+{
+    stdio_conn = conn;
+}
+
+size_t
+serial_server_stdio_write(void *data, size_t count)
+{
+    ssize_t ret;
+
+    if (stdio_conn == NULL) {
+        return 0;
+    }
+    ret = serial_server_write(stdio_conn, data, count);
+    return ret < 0 ? 0 : ret;
 }
 
 int
@@ -14,6 +14,8 @@
 #include <vka/vka.h>
 #include <vka/object.h>
 #include <vka/object_capops.h>
+#include <sel4utils/arch/counter.h>
+#include <sel4platsupport/platsupport.h>
 
 #include "serial_server.h"
 #include <serial_server/parent.h>
@@ -79,31 +81,39 @@ serial_server_parent_spawn_thread(simple_t *parent_simple, vka_t *parent_vka,
         goto out;
     }
 
-    /* Allocate enough Cnode slots in our CSpace to enable us to receive
-     * frame caps from our clients, sufficient to cover "shmem_max_size".
-     * The problem here is that we're sort of forced to assume that we get
-     * these slots contiguously. If they're not, we have a problem.
+    /* Allocate a Cnode slot in our CSpace to receive frame caps from our
+     * clients in. The kernel only transfers one cap per message, so clients
+     * send their shmem one Frame per message, and the Server moves each out of
+     * this slot before receiving the next.
      *
      * If a client tries to send us too many frames, we respond with an error,
      * and indicate our shmem_max_size in the SSMSGREG_RESPONSE
      * message register.
      */
-    get_serial_server()->frame_cap_recv_cspaths = calloc(shmem_max_n_pages,
-                                                         sizeof(cspacepath_t));
-    if (get_serial_server()->frame_cap_recv_cspaths == NULL) {
-        error = seL4_NotEnoughMemory;
+    error = vka_cspace_alloc_path(parent_vka,
+                                  &get_serial_server()->frame_cap_recv_cspath);
+    if (error != 0) {
+        ZF_LOGE(SERSERVP"spawn_thread: Failed to alloc cnode slot to receive "
+                "shmem frame caps.");
         goto out;
     }
 
-    for (size_t i = 0; i < shmem_max_n_pages; i++) {
-        error = vka_cspace_alloc_path(parent_vka,
-                                      &get_serial_server()->frame_cap_recv_cspaths[i]);
-        if (error != 0) {
-            ZF_LOGE(SERSERVP"spawn_thread: Failed to alloc enough cnode slots "
-                    "to receive shmem frame caps equal to %zd bytes.",
-                    shmem_max_size);
-            goto out;
-        }
+    /* Asynchronous clients signal the Server on a Notification bound to its
+     * TCB, so that the Server waits for both them and synchronous requests
+     * in the one seL4_Recv().
+     */
+    error = vka_alloc_notification(parent_vka, &get_serial_server()->server_ntfn_obj);
+    if (error != 0) {
+        ZF_LOGE(SERSERVP"spawn_thread: failed to alloc notification, err=%d.",
+                error);
+        goto out;
+    }
+    error = vka_mint_object(parent_vka, &get_serial_server()->server_ntfn_obj,
+                            &get_serial_server()->_badged_server_ntfn_cspath,
+                            seL4_CanWrite, SERIAL_SERVER_ASYNC_BADGE);
+    if (error != 0) {
+        ZF_LOGE(SERSERVP"spawn_thread: Failed to mint badged Notification cap.");
+        goto out;
     }
 
     sel4utils_thread_config_t config = thread_config_default(parent_simple, parent_cspace_cspath.root,
@@ -116,6 +126,14 @@ serial_server_parent_spawn_thread(simple_t *parent_simple, vka_t *parent_vka,
         goto out;
     }
 
+    error = seL4_TCB_BindNotification(get_serial_server()->server_thread.tcb.cptr,
+                                      get_serial_server()->server_ntfn_obj.cptr);
+    if (error != 0) {
+        ZF_LOGE(SERSERVP"spawn_thread: Failed to bind Notification to the "
+                "server thread, err=%d.", error);
+        goto out;
+    }
+
     NAME_THREAD(get_serial_server()->server_thread.tcb.cptr, "serial server");
     error = sel4utils_start_thread(&get_serial_server()->server_thread,
                                    (sel4utils_thread_entry_fn)&serial_server_main,
@@ -153,19 +171,9 @@ serial_server_parent_spawn_thread(simple_t *parent_simple, vka_t *parent_vka,
     return 0;
 
 out:
-    if (get_serial_server()->frame_cap_recv_cspaths != NULL) {
-        for (size_t i = 0; i < shmem_max_n_pages; i++) {
-            /* Since the array was allocated with calloc(), it was zero'd out. So
-             * those indexes that didn't get allocated will have NULL in them.
-             * Break early on the first index that has NULL.
-             */
-            if (get_serial_server()->frame_cap_recv_cspaths[i].capPtr == 0) {
-                break;
-            }
-            vka_cspace_free_path(parent_vka, get_serial_server()->frame_cap_recv_cspaths[i]);
-        }
+    if (get_serial_server()->frame_cap_recv_cspath.capPtr != 0) {
+        vka_cspace_free_path(parent_vka, get_serial_server()->frame_cap_recv_cspath);
     }
-    free(get_serial_server()->frame_cap_recv_cspaths);
 
     if (get_serial_server()->_badged_server_ep_cspath.capPtr != 0) {
         vka_cspace_free_path(parent_vka, get_serial_server()->_badged_server_ep_cspath);
@@ -173,6 +181,13 @@ out:
     if (get_serial_server()->parent_badge_value != SERIAL_SERVER_BADGE_VALUE_EMPTY) {
         serial_server_badge_value_free(get_serial_server()->parent_badge_value);
     }
+    if (get_serial_server()->_badged_server_ntfn_cspath.capPtr != 0) {
+        vka_cnode_delete(&get_serial_server()->_badged_server_ntfn_cspath);
+        vka_cspace_free_path(parent_vka, get_serial_server()->_badged_server_ntfn_cspath);
+    }
+    if (get_serial_server()->server_ntfn_obj.cptr != 0) {
+        vka_free_object(parent_vka, &get_serial_server()->server_ntfn_obj);
+    }
     vka_free_object(parent_vka, &get_serial_server()->server_ep_obj);
     return error;
 }
@@ -243,3 +258,113 @@ serial_server_parent_mint_endpoint_to_process(sel4utils_process_t *p)
                                          seL4_AllRights,
                                          new_badge_value);
 }
+
+int
+serial_server_parent_set_limits(const serial_server_limits_t *limits)
+{
+    if (limits == NULL) {
+        return seL4_InvalidArgument;
+    }
+
+    get_serial_server()->limits = *limits;
+    if (limits->bytes_per_second != 0) {
+#ifdef SEL4UTILS_HAVE_USER_COUNTER
+        if (get_serial_server()->limits.counter_freq == 0) {
+            get_serial_server()->limits.counter_freq = sel4utils_counter_freq();
+        }
+        if (get_serial_server()->limits.counter_freq == 0) {
+            ZF_LOGE(SERSERVP"set_limits: Frequency of the counter is not known.");
+            get_serial_server()->limited = false;
+            return seL4_IllegalOperation;
+        }
+#else
+        ZF_LOGE(SERSERVP"set_limits: No counter to rate limit with.");
+        get_serial_server()->limited = false;
+        return seL4_IllegalOperation;
+#endif
+    }
+    get_serial_server()->limited = true;
+    return 0;
+}
+
+/* Events the IRQ server can queue for us before it drops them, the server
+ * reads everything the device has received on each one anyway */
+#define SERIAL_SERVER_RX_RING_BITS 4
+
+static ps_malloc_ops_t rx_malloc_ops;
+
+seL4_Error
+serial_server_parent_enable_input(ps_irq_t irq, uint8_t priority)
+{
+    serial_server_context_t *server = get_serial_server();
+    irq_server_t *irq_server;
+    thread_id_t thread_id;
+    irq_id_t irq_id;
+    int error;
+
+    if (server->server_vka == NULL || server->rx_irq_server != NULL) {
+        ZF_LOGE(SERSERVP"enable_input: Server is not running, or already "
+                "reads input.");
+        return seL4_IllegalOperation;
+    }
+    if (platsupport_get_console() == NULL) {
+        ZF_LOGE(SERSERVP"enable_input: No serial device to read input from.");
+        return seL4_IllegalOperation;
+    }
+
+    error = ps_new_stdlib_malloc_ops(&rx_malloc_ops);
+    if (error != 0) {
+        return seL4_NotEnoughMemory;
+    }
+    error = vka_mint_object(server->server_vka, &server->server_ntfn_obj,
+                            &server->_badged_rx_ntfn_cspath,
+                            seL4_AllRights, SERIAL_SERVER_RX_BADGE);
+    if (error != 0) {
+        ZF_LOGE(SERSERVP"enable_input: Failed to mint badged Notification cap "
+                "for the IRQ server.");
+        return error;
+    }
+
+    /* The IRQ server thread only puts an event on the ring and signals us, the
+     * server thread calls the handler, so there is nothing to synchronise. */
+    irq_server = irq_server_new(server->server_vspace, server->server_vka, priority,
+                                server->server_simple, server->server_cspace,
+                                seL4_CapNull, 0, 1, &rx_malloc_ops);
+    if (irq_server == NULL) {
+        ZF_LOGE(SERSERVP"enable_input: Failed to create IRQ server.");
+        error = seL4_NotEnoughMemory;
+        goto out;
+    }
+    error = irq_server_new_ring_delivery(irq_server, SERIAL_SERVER_RX_RING_BITS,
+                                         server->_badged_rx_ntfn_cspath.capPtr);
+    if (error != 0) {
+        ZF_LOGE(SERSERVP"enable_input: Failed to set up IRQ delivery ring, err=%d.",
+                error);
+        goto out;
+    }
+    server->rx_irq_server = irq_server;
+
+    thread_id = irq_server_thread_new(irq_server, seL4_CapNull, 0, -1);
+    if (thread_id < 0) {
+        ZF_LOGE(SERSERVP"enable_input: Failed to create IRQ server thread.");
+        error = seL4_NotEnoughMemory;
+        goto out;
+    }
+    irq_id = irq_server_register_irq(irq_server, irq, serial_server_rx_irq, NULL);
+    if (irq_id < 0) {
+        ZF_LOGE(SERSERVP"enable_input: Failed to register receive IRQ, err=%d.",
+                irq_id);
+        error = seL4_InvalidArgument;
+        goto out;
+    }
+    return seL4_NoError;
+
+out:
+    /* The IRQ server can't be torn down, but it gets no IRQs and we stop
+     * listening for it. */
+    server->rx_irq_server = NULL;
+    vka_cnode_delete(&server->_badged_rx_ntfn_cspath);
+    vka_cspace_free_path(server->server_vka, server->_badged_rx_ntfn_cspath);
+    server->_badged_rx_ntfn_cspath.capPtr = 0;
+    return error;
+}
@@ -5,15 +5,22 @@
  */
 #pragma once
 
+#include <autoconf.h>
+#include <sel4serialserver/gen_config.h>
+
+#include <stddef.h>
 #include <stdint.h>
 
 #include <sel4/sel4.h>
 
 #include <simple/simple.h>
 #include <sel4utils/thread.h>
+#include <sel4utils/irq_server.h>
 #include <vka/vka.h>
 #include <vka/object.h>
 #include <vspace/vspace.h>
+#include <serial_server/client.h>
+#include <serial_server/parent.h>
 
 /** @file APIs for managing and interacting with the serial server thread.
  *
@@ -31,7 +38,66 @@
 
 #define SERIAL_SERVER_BADGE_VALUE_EMPTY (0)
 
-#define SERIAL_SERVER_SHMEM_MAX_SIZE (BIT(seL4_PageBits))
+/* Number of entries the registry starts with, it doubles whenever it fills */
+#define SERIAL_SERVER_REGISTRY_MIN_ENTRIES 8
+
+#define SERIAL_SERVER_SHMEM_MAX_SIZE (CONFIG_SERIAL_SERVER_SHMEM_MAX_PAGES * BIT(seL4_PageBits))
+/* Size of the shmem of clients that don't ask for a size */
+#define SERIAL_SERVER_SHMEM_DEFAULT_SIZE (BIT(seL4_PageBits))
+
+/* Badge of the notification asynchronous clients signal the server with. Client badge
+ * values are allocated from 1 upwards and never reach it. */
+#define SERIAL_SERVER_ASYNC_BADGE BIT(seL4_BadgeBits - 1)
+/* Badge of the notification the IRQ server signals when the serial device has
+ * received input, see serial_server_parent_enable_input() */
+#define SERIAL_SERVER_RX_BADGE BIT(seL4_BadgeBits - 2)
+
+#define SERIAL_SERVER_RING_CACHE_LINE 64
+
+/* Layout of the shared memory of an asynchronous client: a single producer, single consumer
+ * ring of bytes. Both indices are offsets into data, the ring is empty when they are equal
+ * and one byte is always left free to tell a full ring from an empty one. */
+typedef struct serial_server_ring {
+    /* written by the client: bytes before head are ready */
+    uint32_t head __attribute__((aligned(SERIAL_SERVER_RING_CACHE_LINE)));
+    /* level of the bytes in the ring, the client drains it before changing it */
+    uint32_t level;
+    /* written by the server: bytes before tail have been written out */
+    uint32_t tail __attribute__((aligned(SERIAL_SERVER_RING_CACHE_LINE)));
+    char data[] __attribute__((aligned(SERIAL_SERVER_RING_CACHE_LINE)));
+} serial_server_ring_t;
+
+static inline size_t serial_server_ring_capacity(size_t shmem_size)
+{
+    return shmem_size - offsetof(serial_server_ring_t, data);
+}
+
+/* Layout of the input ring at the end of the shmem of a client that reads input,
+ * which takes SERIAL_SERVER_INPUT_RING_SIZE bytes away from the rest of the shmem.
+ * Indices are as for serial_server_ring_t, but the server produces and the
+ * client consumes. */
+#define SERIAL_SERVER_INPUT_RING_SIZE 1024
+
+typedef struct serial_server_input_ring {
+    /* written by the server: bytes before head have been received */
+    uint32_t head __attribute__((aligned(SERIAL_SERVER_RING_CACHE_LINE)));
+    /* written by the client: bytes before tail have been read */
+    uint32_t tail __attribute__((aligned(SERIAL_SERVER_RING_CACHE_LINE)));
+    char data[] __attribute__((aligned(SERIAL_SERVER_RING_CACHE_LINE)));
+} serial_server_input_ring_t;
+
+#define SERIAL_SERVER_INPUT_RING_CAPACITY \
+    (SERIAL_SERVER_INPUT_RING_SIZE - offsetof(serial_server_input_ring_t, data))
+
+/* Offset into a shmem of shmem_size bytes that its input ring goes at, which is
+ * also what is left of the shmem for output */
+static inline size_t serial_server_input_ring_offset(size_t shmem_size)
+{
+    if (shmem_size < SERIAL_SERVER_INPUT_RING_SIZE) {
+        return 0;
+    }
+    return ROUND_DOWN(shmem_size - SERIAL_SERVER_INPUT_RING_SIZE, SERIAL_SERVER_RING_CACHE_LINE);
+}
 
 /* IPC values returned in the "label" message header. */
 enum serial_server_errors {
@@ -61,6 +127,38 @@ enum serial_server_funcs {
 
     FUNC_KILL_REQ,
     FUNC_KILL_ACK,
+
+    FUNC_DRAIN_REQ,
+    FUNC_DRAIN_ACK,
+
+    /* The kernel only transfers one cap per message, so a CONNECT_REQ carries
+     * the first Frame of the client's shmem and each following Frame is sent
+     * in a CONNECT_FRAME_REQ. */
+    FUNC_CONNECT_FRAME_REQ,
+    FUNC_CONNECT_FRAME_ACK,
+
+    FUNC_GET_STATS_REQ,
+    FUNC_GET_STATS_ACK,
+
+    /* Carries a Notification cap for the server to signal when there is input */
+    FUNC_INPUT_REQ,
+    FUNC_INPUT_ACK,
+
+    FUNC_FOCUS_REQ,
+    FUNC_FOCUS_ACK,
+
+    /* The client emptied an input ring that had filled up */
+    FUNC_INPUT_PULL_REQ,
+    FUNC_INPUT_PULL_ACK,
+};
+
+/* Values for SSMSGREG_CONNECT_REQ_MODE */
+enum serial_server_modes {
+    /* each write is a call that returns once the server has written it out */
+    SERIAL_SERVER_MODE_SYNC = 0,
+    /* writes go to a serial_server_ring_t in the shmem, and the client is given a
+     * notification to signal the server with when it was empty */
+    SERIAL_SERVER_MODE_ASYNC,
 };
 
 /* Designated purposes of each message register in the mini-protocol. */
@@ -71,6 +169,7 @@ enum serial_server_msgregs {
     SSMSGREG_LABEL0,
 
     SSMSGREG_CONNECT_REQ_SHMEM_SIZE = SSMSGREG_LABEL0,
+    SSMSGREG_CONNECT_REQ_MODE,
     SSMSGREG_CONNECT_REQ_END,
 
     SSMSGREG_CONNECT_ACK_MAX_SHMEM_SIZE = SSMSGREG_LABEL0,
@@ -87,6 +186,7 @@ enum serial_server_msgregs {
     SSMSGREG_PRINTF_ACK_END,
 
     SSMSGREG_WRITE_REQ_BUFF_LEN = SSMSGREG_LABEL0,
+    SSMSGREG_WRITE_REQ_LEVEL,
     SSMSGREG_WRITE_REQ_END,
 
     SSMSGREG_WRITE_ACK_N_BYTES_WRITTEN = SSMSGREG_LABEL0,
@@ -98,7 +198,36 @@ enum serial_server_msgregs {
 
     SSMSGREG_KILL_REQ_END = SSMSGREG_LABEL0,
 
-    SSMSGREG_KILL_ACK_END = SSMSGREG_LABEL0
+    SSMSGREG_KILL_ACK_END = SSMSGREG_LABEL0,
+
+    SSMSGREG_DRAIN_REQ_END = SSMSGREG_LABEL0,
+
+    SSMSGREG_DRAIN_ACK_END = SSMSGREG_LABEL0,
+
+    SSMSGREG_CONNECT_FRAME_REQ_INDEX = SSMSGREG_LABEL0,
+    SSMSGREG_CONNECT_FRAME_REQ_END,
+
+    SSMSGREG_CONNECT_FRAME_ACK_END = SSMSGREG_LABEL0,
+
+    SSMSGREG_GET_STATS_REQ_END = SSMSGREG_LABEL0,
+
+    SSMSGREG_GET_STATS_ACK_DROPPED_MSGS = SSMSGREG_LABEL0,
+    SSMSGREG_GET_STATS_ACK_DROPPED_BYTES,
+    SSMSGREG_GET_STATS_ACK_END,
+
+    SSMSGREG_INPUT_REQ_FOCUS = SSMSGREG_LABEL0,
+    SSMSGREG_INPUT_REQ_END,
+
+    SSMSGREG_INPUT_ACK_RING_OFFSET = SSMSGREG_LABEL0,
+    SSMSGREG_INPUT_ACK_END,
+
+    SSMSGREG_FOCUS_REQ_END = SSMSGREG_LABEL0,
+
+    SSMSGREG_FOCUS_ACK_END = SSMSGREG_LABEL0,
+
+    SSMSGREG_INPUT_PULL_REQ_END = SSMSGREG_LABEL0,
+
+    SSMSGREG_INPUT_PULL_ACK_END = SSMSGREG_LABEL0,
 };
 
 /* Per-client context maintained by the server. */
@@ -107,6 +236,24 @@ typedef struct _serial_server_registry_entry {
     volatile char *shmem;
     seL4_CPtr *shmem_frame_caps;
     size_t shmem_size;
+    /* one of serial_server_modes */
+    int mode;
+    /* The range the shmem Frames are mapped into as they arrive, and how many
+     * have. shmem is only set once all of them have arrived. */
+    void *shmem_pending;
+    reservation_t shmem_reservation;
+    size_t shmem_n_received;
+    /* badge value of the next free entry while this one is free */
+    seL4_Word next_free;
+    /* rate limiting: bytes the client may still write, and when that was
+     * last worked out */
+    int64_t tokens;
+    uint64_t tokens_time;
+    serial_server_stats_t stats;
+    /* input ring in the shmem and the Notification to signal when it is
+     * written to, for clients that read input */
+    serial_server_input_ring_t *input;
+    cspacepath_t input_ntfn_cspath;
 } serial_server_registry_entry_t;
 
 /* State maintained by the server. */
@@ -114,14 +261,41 @@ typedef struct _serial_server_context {
     simple_t *server_simple;
     vka_t *server_vka;
     seL4_CPtr server_cspace;
-    cspacepath_t *frame_cap_recv_cspaths;
+    /* where the Frame cap a client sends with a connect request is received */
+    cspacepath_t frame_cap_recv_cspath;
     vspace_t *server_vspace;
     sel4utils_thread_t server_thread;
     vka_object_t server_ep_obj;
+    /* bound to the server thread, asynchronous clients get a copy badged with
+     * SERIAL_SERVER_ASYNC_BADGE */
+    vka_object_t server_ntfn_obj;
+    cspacepath_t _badged_server_ntfn_cspath;
     size_t shmem_max_size, shmem_max_n_pages;
 
     int registry_n_entries;
     serial_server_registry_entry_t *registry;
+    /* badge value of the first free registry entry, the rest are linked
+     * through next_free */
+    seL4_Word registry_free_head;
+
+    /* set with serial_server_parent_set_limits */
+    bool limited;
+    serial_server_limits_t limits;
+    /* registry index to start draining asynchronous clients from */
+    int drain_next;
+    /* bytes of the output queue before head have been queued, before tail
+     * have been written out */
+    size_t tx_head, tx_tail;
+    /* set up by serial_server_parent_enable_input, and signals us on a copy of
+     * our notification badged with SERIAL_SERVER_RX_BADGE */
+    irq_server_t *rx_irq_server;
+    cspacepath_t _badged_rx_ntfn_cspath;
+    /* bytes of input before rx_head have been received, before rx_tail handed
+     * to the focus */
+    size_t rx_head, rx_tail;
+    seL4_Word rx_dropped;
+    /* badge value of the client input goes to, 0 for none */
+    seL4_Word rx_focus;
 
     seL4_Word parent_badge_value;
     cspacepath_t _badged_server_ep_cspath;
@@ -134,6 +308,11 @@ serial_server_context_t *get_serial_server(void);
  */
 void serial_server_main(void);
 
+/** Internal library function: the handler for the serial device's receive IRQ,
+ * called on the server thread from irq_server_handle_irq_ring().
+ */
+void serial_server_rx_irq(void *data, irq_acknowledge_fn_t acknowledge_fn, void *ack_data);
+
 serial_server_registry_entry_t *serial_server_registry_get_entry_by_badge(seL4_Word badge_value);
 
 /** Determines whether or not a badge value has been reserved and given out.
@@ -17,6 +17,7 @@
 #include <utils/arith.h>
 #include <utils/ansi.h>
 #include <sel4utils/api.h>
+#include <sel4utils/arch/counter.h>
 #include <sel4utils/strerror.h>
 #include <sel4platsupport/platsupport.h>
 
@@ -57,6 +58,20 @@ static char *colors[] = {
     ANSI_COLOR(CYAN, UNDERLINE),
 };
 
+#ifdef CONFIG_SERIAL_SERVER_TX_QUEUE
+/* Output from clients waiting to be written out to the serial device */
+static char tx_queue[BIT(CONFIG_SERIAL_SERVER_TX_QUEUE_BITS)];
+#define TX_QUEUE_SIZE sizeof(tx_queue)
+/* Bytes to write out between requests, about a UART FIFO's worth, so that a
+ * new request doesn't wait long behind queued output. */
+#define TX_CHUNK 64
+#endif
+
+/* Input from the serial device waiting for the client with the focus to have
+ * room for it */
+static char rx_buffer[BIT(CONFIG_SERIAL_SERVER_RX_BUFFER_BITS)];
+#define RX_BUFFER_SIZE sizeof(rx_buffer)
+
 #define NUM_COLORS ARRAY_SIZE(colors)
 #define BADGE_TO_COLOR(badge) (colors[(badge) % NUM_COLORS])
 
@@ -70,6 +85,11 @@ static inline seL4_MessageInfo_t recv(seL4_Word *sender_badge)
     return api_recv(get_serial_server()->server_ep_obj.cptr, sender_badge, get_serial_server()->server_thread.reply.cptr);
 }
 
+static inline seL4_MessageInfo_t nbrecv(seL4_Word *sender_badge)
+{
+    return api_nbrecv(get_serial_server()->server_ep_obj.cptr, sender_badge, get_serial_server()->server_thread.reply.cptr);
+}
+
 static inline void reply(seL4_MessageInfo_t tag)
 {
     api_reply(get_serial_server()->server_thread.reply.cptr, tag);
@@ -105,29 +125,30 @@ bool serial_server_badge_is_allocated(seL4_Word badge_value)
 
 seL4_Word serial_server_badge_value_get_unused(void)
 {
-    if (get_serial_server()->registry == NULL) {
-        return SERIAL_SERVER_BADGE_VALUE_EMPTY;
-    }
-
-    for (int i = 0; i < get_serial_server()->registry_n_entries; i++) {
-        if (get_serial_server()->registry[i].badge_value != SERIAL_SERVER_BADGE_VALUE_EMPTY) {
-            continue;
-        }
+    seL4_Word badge_value = get_serial_server()->registry_free_head;
+    serial_server_registry_entry_t *tmp;
 
-        /* Badge value 0 will never be allocated, so index 0 is actually
-         * badge 1, and index 1 is badge 2, and so on ad infinitum.
-         */
-        get_serial_server()->registry[i].badge_value = i + 1;
-        return get_serial_server()->registry[i].badge_value;
+    if (get_serial_server()->registry == NULL
+        || badge_value == SERIAL_SERVER_BADGE_VALUE_EMPTY) {
+        return SERIAL_SERVER_BADGE_VALUE_EMPTY;
     }
 
-    return SERIAL_SERVER_BADGE_VALUE_EMPTY;
+    /* Badge value 0 will never be allocated, so index 0 is actually
+     * badge 1, and index 1 is badge 2, and so on ad infinitum.
+     */
+    tmp = &get_serial_server()->registry[badge_value - 1];
+    get_serial_server()->registry_free_head = tmp->next_free;
+    memset(tmp, 0, sizeof(*tmp));
+    tmp->badge_value = badge_value;
+    return badge_value;
 }
 
 seL4_Word serial_server_badge_value_alloc(void)
 {
     serial_server_registry_entry_t *tmp;
     seL4_Word ret;
+    int n_entries = get_serial_server()->registry_n_entries;
+    int new_n_entries;
 
     ret = serial_server_badge_value_get_unused();
     if (ret != SERIAL_SERVER_BADGE_VALUE_EMPTY) {
@@ -135,18 +156,24 @@ seL4_Word serial_server_badge_value_alloc(void)
         return ret;
     }
 
+    /* Double the pool, so that allocating n badge values costs O(n) copying
+     * overall. */
+    new_n_entries = MAX(n_entries * 2, SERIAL_SERVER_REGISTRY_MIN_ENTRIES);
     tmp = realloc(get_serial_server()->registry,
-                  sizeof(*get_serial_server()->registry)
-                  * (get_serial_server()->registry_n_entries + 1));
+                  sizeof(*get_serial_server()->registry) * new_n_entries);
     if (tmp == NULL) {
         ZF_LOGD(SERSERVS"badge_value_alloc: Failed resize pool.");
         return SERIAL_SERVER_BADGE_VALUE_EMPTY;
     }
 
     get_serial_server()->registry = tmp;
-    get_serial_server()->registry[get_serial_server()->registry_n_entries].badge_value =
-        SERIAL_SERVER_BADGE_VALUE_EMPTY;
-    get_serial_server()->registry_n_entries++;
+    memset(&tmp[n_entries], 0, sizeof(*tmp) * (new_n_entries - n_entries));
+    /* Put the new entries on the free list lowest badge value first. */
+    for (int i = new_n_entries - 1; i >= n_entries; i--) {
+        tmp[i].next_free = get_serial_server()->registry_free_head;
+        get_serial_server()->registry_free_head = i + 1;
+    }
+    get_serial_server()->registry_n_entries = new_n_entries;
 
     /* If it fails again (some other caller raced us and got the new ID before
      * we did) that's tough luck -- the caller should probably look into
@@ -169,26 +196,8 @@ void serial_server_badge_value_free(seL4_Word badge_value)
     }
 
     tmp->badge_value = SERIAL_SERVER_BADGE_VALUE_EMPTY;
-}
-
-static void serial_server_registry_insert(seL4_Word badge_value, void *shmem,
-                                          seL4_CPtr *shmem_frame_caps,
-                                          size_t shmem_size)
-{
-    serial_server_registry_entry_t *tmp;
-
-    tmp = serial_server_registry_get_entry_by_badge(badge_value);
-    /* If this is NULL, something went very wrong, because this function is only
-     * called after the server checks to ensure that the badge value has been
-     * allocated in the registry. Technically, this should never happen, but
-     * an assert doesn't hurt.
-     */
-    assert(tmp != NULL);
-
-    tmp->badge_value = badge_value;
-    tmp->shmem = shmem;
-    tmp->shmem_size = shmem_size;
-    tmp->shmem_frame_caps = shmem_frame_caps;
+    tmp->next_free = get_serial_server()->registry_free_head;
+    get_serial_server()->registry_free_head = badge_value;
 }
 
 static void serial_server_registry_remove(seL4_Word badge_value)
@@ -205,31 +214,171 @@ static void serial_server_registry_remove(seL4_Word badge_value)
 static void serial_server_set_frame_recv_path(void)
 {
     seL4_SetCapReceivePath(get_serial_server()->server_cspace,
-                           get_serial_server()->frame_cap_recv_cspaths[0].capPtr,
-                           get_serial_server()->frame_cap_recv_cspaths[0].capDepth);
+                           get_serial_server()->frame_cap_recv_cspath.capPtr,
+                           get_serial_server()->frame_cap_recv_cspath.capDepth);
+}
+
+/** Stops handing input to a client, and moves the focus on to another client
+ * that reads input if it had it.
+ */
+static void serial_server_input_teardown(serial_server_registry_entry_t *client_data)
+{
+    if (client_data->input == NULL) {
+        return;
+    }
+    vka_cnode_delete(&client_data->input_ntfn_cspath);
+    vka_cspace_free_path(get_serial_server()->server_vka, client_data->input_ntfn_cspath);
+    client_data->input_ntfn_cspath.capPtr = 0;
+    client_data->input = NULL;
+
+    if (get_serial_server()->rx_focus != client_data->badge_value) {
+        return;
+    }
+    get_serial_server()->rx_focus = SERIAL_SERVER_BADGE_VALUE_EMPTY;
+    for (int i = 0; i < get_serial_server()->registry_n_entries; i++) {
+        serial_server_registry_entry_t *curr = &get_serial_server()->registry[i];
+
+        if (curr->badge_value != SERIAL_SERVER_BADGE_VALUE_EMPTY && curr->input != NULL) {
+            get_serial_server()->rx_focus = curr->badge_value;
+            break;
+        }
+    }
+}
+
+/** Unmaps whatever a client has of its shmem, including a partly received
+ * one, and releases the Frame caps.
+ */
+static void serial_server_shmem_teardown(serial_server_registry_entry_t *client_data)
+{
+    serial_server_input_teardown(client_data);
+    if (client_data->shmem_pending == NULL) {
+        return;
+    }
+    vspace_unmap_pages(get_serial_server()->server_vspace,
+                       client_data->shmem_pending,
+                       client_data->shmem_n_received,
+                       seL4_PageBits, get_serial_server()->server_vka);
+    vspace_free_reservation(get_serial_server()->server_vspace,
+                            client_data->shmem_reservation);
+    free(client_data->shmem_frame_caps);
+    client_data->shmem_frame_caps = NULL;
+    client_data->shmem_pending = NULL;
+    client_data->shmem_n_received = 0;
+    client_data->shmem = NULL;
+}
+
+/** Maps the Frame cap a client sent with its message in as page "index" of its
+ * shmem. Once every page has arrived, the client is connected.
+ */
+static seL4_Error serial_server_connect_add_frame(serial_server_registry_entry_t *client_data,
+                                                  seL4_MessageInfo_t tag,
+                                                  size_t index)
+{
+    seL4_Error error;
+    cspacepath_t client_frame_cspath;
+    size_t client_shmem_n_pages = BYTES_TO_4K_PAGES(client_data->shmem_size);
+    void *vaddr;
+
+    if (client_data->shmem_pending == NULL || client_data->shmem != NULL
+        || index != client_data->shmem_n_received) {
+        ZF_LOGW(SERSERVS"connect: Client badge %lx sent shmem frame %zu out of "
+                "order.", (long)client_data->badge_value, index);
+        return seL4_IllegalOperation;
+    }
+    if (seL4_MessageInfo_get_extraCaps(tag) != 1) {
+        ZF_LOGW(SERSERVS"connect: Received %d Frame caps from client "
+                "badge %lx for frame %zu of %zu.\n\tPossible cap transfer error.",
+                (int)seL4_MessageInfo_get_extraCaps(tag), (long)client_data->badge_value,
+                index + 1, client_shmem_n_pages);
+        return seL4_InvalidCapability;
+    }
+
+    /* Move the frame cap out of the recv slot before the next message comes
+     * in, or else when the slot is reused the frame will be lost.
+     */
+    error = vka_cspace_alloc_path(get_serial_server()->server_vka,
+                                  &client_frame_cspath);
+    if (error != 0) {
+        ZF_LOGE(SERSERVS"connect: Failed to alloc CSpace slot for frame "
+                "%zd of %zd received from client badge %lx.",
+                index + 1, client_shmem_n_pages, (long)client_data->badge_value);
+        return seL4_NotEnoughMemory;
+    }
+    error = vka_cnode_move(&client_frame_cspath,
+                           &get_serial_server()->frame_cap_recv_cspath);
+    if (error != 0) {
+        ZF_LOGE(SERSERVS"connect: Failed to move %zuth frame-cap received "
+                " from client badge %lx.", index + 1, (long)client_data->badge_value);
+        vka_cspace_free_path(get_serial_server()->server_vka, client_frame_cspath);
+        return error;
+    }
+
+    vaddr = (char *)client_data->shmem_pending + index * BIT(seL4_PageBits);
+    error = vspace_map_pages_at_vaddr(get_serial_server()->server_vspace,
+                                      &client_frame_cspath.capPtr, NULL, vaddr,
+                                      1, seL4_PageBits,
+                                      client_data->shmem_reservation);
+    if (error != 0) {
+        ZF_LOGE(SERSERVS"connect: Failed to map frame %zu of client badge %lx.",
+                index + 1, (long)client_data->badge_value);
+        vka_cnode_delete(&client_frame_cspath);
+        vka_cspace_free_path(get_serial_server()->server_vka, client_frame_cspath);
+        return seL4_NotEnoughMemory;
+    }
+    client_data->shmem_frame_caps[index] = client_frame_cspath.capPtr;
+    client_data->shmem_n_received++;
+    ZF_LOGD("connect: mapped client Frame cap %zu in slot %"PRIxPTR" at %p.",
+            index + 1, client_frame_cspath.capPtr, vaddr);
+
+    if (client_data->shmem_n_received < client_shmem_n_pages) {
+        return seL4_NoError;
+    }
+
+    if (client_data->mode == SERIAL_SERVER_MODE_ASYNC) {
+        serial_server_ring_t *ring = client_data->shmem_pending;
+        ring->head = 0;
+        ring->tail = 0;
+    }
+    client_data->shmem = client_data->shmem_pending;
+
+    ZF_LOGI(SERSERVS"connect: New client: badge %lx, shmem %p, %zu pages.",
+            (long)client_data->badge_value, client_data->shmem, client_shmem_n_pages);
+    return seL4_NoError;
 }
 
 /** Processes all FUNC_CONNECT_REQ IPC messages. Establishes
  * shared mem mappings with new clients and sets up book-keeping metadata.
  *
- * Clients calling connect() will pass us a list of Frame caps which we must
- * map in order to establish shared mem with those clients. In this function,
- * the library maps the client's frames into the server's VSpace.
+ * Clients calling connect() will pass us the first of the Frame caps which we
+ * must map in order to establish shared mem with those clients, and the rest
+ * in FUNC_CONNECT_FRAME_REQ messages. In this function, the library reserves
+ * a contiguous range in the server's VSpace for the client's frames, and maps
+ * the first one in.
  */
 seL4_Error serial_server_func_connect(seL4_MessageInfo_t tag,
                                       seL4_Word client_badge_value,
-                                      size_t client_shmem_size)
+                                      size_t client_shmem_size,
+                                      int mode)
 {
-    seL4_Error error;
     size_t client_shmem_n_pages;
-    void *shmem_tmp = NULL;
-    seL4_CPtr *client_frame_caps = NULL;
-    cspacepath_t client_frame_cspath_tmp;
+    serial_server_registry_entry_t *client_data;
+    void *vaddr;
+    seL4_Error error;
 
     if (client_shmem_size == 0) {
         ZF_LOGW(SERSERVS"connect: Invalid shared mem window size of 0B.\n");
         return seL4_InvalidArgument;
     }
+    if (mode != SERIAL_SERVER_MODE_SYNC && mode != SERIAL_SERVER_MODE_ASYNC) {
+        ZF_LOGW(SERSERVS"connect: Invalid mode %d.\n", mode);
+        return seL4_InvalidArgument;
+    }
+    if (mode == SERIAL_SERVER_MODE_ASYNC
+        && client_shmem_size <= offsetof(serial_server_ring_t, data) + 1) {
+        ZF_LOGW(SERSERVS"connect: Shared mem window of %zuB is too small for a ring.\n",
+                client_shmem_size);
+        return seL4_InvalidArgument;
+    }
 
     client_shmem_n_pages = BYTES_TO_4K_PAGES(client_shmem_size);
     /* The client should be allocated a badge value by the Parent, before it
@@ -260,100 +409,166 @@ seL4_Error serial_server_func_connect(seL4_MessageInfo_t tag,
         return (seL4_Error) SERIAL_SERVER_ERROR_SHMEM_TOO_LARGE;
     }
 
-    if (seL4_MessageInfo_get_extraCaps(tag) != client_shmem_n_pages) {
-        ZF_LOGW(SERSERVS"connect: Received %d Frame caps from client "
-                "badge %x.\n\tbut client requested shmem mapping of %d "
-                "frames. Possible cap transfer error.",
-                seL4_MessageInfo_get_extraCaps(tag), client_badge_value,
-                client_shmem_n_pages);
-        return seL4_InvalidCapability;
-    }
+    /* A client that connects again without disconnecting starts over. */
+    client_data = serial_server_registry_get_entry_by_badge(client_badge_value);
+    assert(client_data != NULL);
+    serial_server_shmem_teardown(client_data);
 
-    /* Prepare an array of the client's shmem Frame caps to be mapped into our
-     * VSpace.
-     */
-    client_frame_caps = calloc((client_shmem_n_pages + 1), sizeof(seL4_CPtr));
-    if (client_frame_caps == NULL) {
+    client_data->shmem_frame_caps = calloc((client_shmem_n_pages + 1), sizeof(seL4_CPtr));
+    if (client_data->shmem_frame_caps == NULL) {
         ZF_LOGE(SERSERVS"connect: Failed to alloc frame cap list for client "
                 "shmem.");
         return seL4_NotEnoughMemory;
     }
-    for (size_t i = 0; i < client_shmem_n_pages; i++) {
-        /* For each frame, we need to make an seL4_CNode_Copy of it before
-         * we zero-out the receive slots, or else when we delete the receive
-         * slots, the frames will be revoked and unmapped.
-         */
-        error = vka_cspace_alloc_path(get_serial_server()->server_vka,
-                                      &client_frame_cspath_tmp);
-        if (error != 0) {
-            ZF_LOGE(SERSERVS"connect: Failed to alloc CSpace slot for frame "
-                    "%zd of %zd received from client badge %lx.",
-                    i + 1, client_shmem_n_pages, (long)client_badge_value);
-            goto out;
-        }
+    client_data->shmem_reservation = vspace_reserve_range(get_serial_server()->server_vspace,
+                                                          client_shmem_n_pages * BIT(seL4_PageBits),
+                                                          seL4_AllRights, true, &vaddr);
+    if (client_data->shmem_reservation.res == NULL) {
+        ZF_LOGE(SERSERVS"connect: Failed to reserve %zu pages for shmem.",
+                client_shmem_n_pages);
+        free(client_data->shmem_frame_caps);
+        client_data->shmem_frame_caps = NULL;
+        return seL4_NotEnoughMemory;
+    }
+    client_data->shmem_pending = vaddr;
+    client_data->shmem_size = client_shmem_size;
+    client_data->mode = mode;
 
-        /* Copy the frame cap from the recv slot to the perm slot now. */
-        error = vka_cnode_move(&client_frame_cspath_tmp,
-                               &get_serial_server()->frame_cap_recv_cspaths[i]);
-        if (error != 0) {
-            ZF_LOGE(SERSERVS"connect: Failed to move %zuth frame-cap received "
-                    " from client badge %lx.", i + 1, (long)client_badge_value);
-            goto out;
-        }
+    error = serial_server_connect_add_frame(client_data, tag, 0);
+    if (error != seL4_NoError) {
+        serial_server_shmem_teardown(client_data);
+    }
+    return error;
+}
+
+/** Processes FUNC_CONNECT_FRAME_REQ IPC messages, which carry the rest of the
+ * Frames of a client's shmem after the first.
+ */
+static seL4_Error serial_server_func_connect_frame(serial_server_registry_entry_t *client_data,
+                                                   seL4_MessageInfo_t tag,
+                                                   size_t index)
+{
+    seL4_Error error;
 
-        client_frame_caps[i] = client_frame_cspath_tmp.capPtr;
-        ZF_LOGD("connect: moved received client Frame cap %d from recv slot %"PRIxPTR" to slot %"PRIxPTR".",
-                i + 1, get_serial_server()->frame_cap_recv_cspaths[i].capPtr,
-                client_frame_caps[i]);
+    error = serial_server_connect_add_frame(client_data, tag, index);
+    if (error != seL4_NoError) {
+        serial_server_shmem_teardown(client_data);
     }
+    return error;
+}
 
-    /* Map the frames into the vspace. */
-    shmem_tmp = vspace_map_pages(get_serial_server()->server_vspace, client_frame_caps,
-                                 NULL,
-                                 seL4_AllRights, client_shmem_n_pages,
-                                 seL4_PageBits,
-                                 true);
-    if (shmem_tmp == NULL) {
-        ZF_LOGE(SERSERVS"connect: Failed to map shmem.");
-        error = seL4_NotEnoughMemory;
-        goto out;
+#ifdef CONFIG_SERIAL_SERVER_TX_QUEUE
+static inline size_t serial_server_tx_pending(void)
+{
+    return get_serial_server()->tx_head - get_serial_server()->tx_tail;
+}
+
+/** Writes up to max bytes from the output queue out to the serial device. */
+static void serial_server_tx_pump(size_t max)
+{
+    size_t tail = get_serial_server()->tx_tail;
+    size_t offset = tail & (TX_QUEUE_SIZE - 1);
+    size_t n = MIN(MIN(max, serial_server_tx_pending()), TX_QUEUE_SIZE - offset);
+
+    fwrite(&tx_queue[offset], n, 1, stdout);
+    get_serial_server()->tx_tail = tail + n;
+}
+
+/** Queues output, writing out the oldest output to make room if the queue is
+ * full. */
+static void serial_server_tx_put(const volatile char *buff, size_t len)
+{
+    while (len > 0) {
+        size_t head = get_serial_server()->tx_head;
+        size_t offset = head & (TX_QUEUE_SIZE - 1);
+        size_t space = TX_QUEUE_SIZE - serial_server_tx_pending();
+
+        if (space == 0) {
+            serial_server_tx_pump(TX_CHUNK);
+            continue;
+        }
+        size_t n = MIN(MIN(len, space), TX_QUEUE_SIZE - offset);
+        memcpy(&tx_queue[offset], (const void *)buff, n);
+        get_serial_server()->tx_head = head + n;
+        buff += n;
+        len -= n;
     }
+}
+#endif
 
-    serial_server_registry_insert(client_badge_value, shmem_tmp,
-                                  client_frame_caps, client_shmem_size);
+static void serial_server_emit(const volatile char *buff, size_t len)
+{
+#ifdef CONFIG_SERIAL_SERVER_TX_QUEUE
+    serial_server_tx_put(buff, len);
+#else
+    fwrite((const void *)buff, len, 1, stdout);
+#endif
+}
 
-    ZF_LOGI(SERSERVS"connect: New client: badge %x, shmem %p, %d pages.",
-            client_badge_value, shmem_tmp, client_shmem_n_pages);
+static void serial_server_output(serial_server_registry_entry_t *client_data,
+                                 volatile char *buff, size_t len)
+{
+    if (config_set(CONFIG_SERIAL_SERVER_COLOURED_OUTPUT)) {
+        serial_server_emit(COLOR_RESET, strlen(COLOR_RESET));
+        serial_server_emit(BADGE_TO_COLOR(client_data->badge_value),
+                           strlen(BADGE_TO_COLOR(client_data->badge_value)));
+    }
+    serial_server_emit(buff, len);
+    if (config_set(CONFIG_SERIAL_SERVER_COLOURED_OUTPUT)) {
+        serial_server_emit(COLOR_RESET, strlen(COLOR_RESET));
+    }
+}
 
-    return seL4_NoError;
+/** Decides whether a client's message of len bytes at a level may be written
+ * out, under the limits set with serial_server_parent_set_limits(). Dropped
+ * messages are counted in the client's stats.
+ *
+ * Rate limiting is a token bucket that admits messages while it is not empty
+ * and may go into debt, so messages are never cut short.
+ */
+static bool serial_server_admit(serial_server_registry_entry_t *client_data,
+                                int level, size_t len)
+{
+    serial_server_limits_t *limits = &get_serial_server()->limits;
 
-out:
-    if (shmem_tmp != NULL) {
-        vspace_unmap_pages(get_serial_server()->server_vspace, shmem_tmp,
-                           client_shmem_n_pages, seL4_PageBits,
-                           VSPACE_PRESERVE);
+    if (!get_serial_server()->limited || level == SERIAL_SERVER_LEVEL_CRITICAL) {
+        return true;
+    }
+    if (level > limits->max_level) {
+        goto drop;
     }
 
-    if (client_frame_caps != NULL) {
-        for (size_t i = 0; i < client_shmem_n_pages; i++) {
-            /* Because client_frame_caps was alloc'd with calloc, we can depend on
-             * the unused slots being filled with 0s. Break on first unallocated.
-             */
-            if (client_frame_caps[i] == 0) {
-                break;
-            }
-            client_frame_cspath_tmp.capPtr = client_frame_caps[i];
-            vka_cspace_free_path(get_serial_server()->server_vka,
-                                 client_frame_cspath_tmp);
+#ifdef SEL4UTILS_HAVE_USER_COUNTER
+    if (limits->bytes_per_second != 0) {
+        uint64_t now = sel4utils_read_counter();
+        uint64_t elapsed = now - client_data->tokens_time;
+
+        client_data->tokens_time = now;
+        if (elapsed >= limits->counter_freq) {
+            client_data->tokens = limits->burst_bytes;
+        } else {
+            client_data->tokens = MIN(client_data->tokens
+                                      + (int64_t)(elapsed * limits->bytes_per_second
+                                                  / limits->counter_freq),
+                                      (int64_t)limits->burst_bytes);
         }
+        if (client_data->tokens <= 0) {
+            goto drop;
+        }
+        client_data->tokens -= (int64_t)len;
     }
+#endif
+    return true;
 
-    free(client_frame_caps);
-    return error;
+drop:
+    client_data->stats.dropped_msgs++;
+    client_data->stats.dropped_bytes += len;
+    return false;
 }
 
 static int serial_server_func_write(serial_server_registry_entry_t *client_data,
-                                    size_t message_len, size_t *bytes_written)
+                                    size_t message_len, int level,
+                                    size_t *bytes_written)
 {
     *bytes_written = 0;
 
@@ -361,31 +576,224 @@ static int serial_server_func_write(serial_server_registry_entry_t *client_data,
         ZF_LOGE(SERSERVS"printf: Got NULL for required argument.");
         return seL4_InvalidArgument;
     }
+    if (client_data->shmem == NULL || client_data->mode != SERIAL_SERVER_MODE_SYNC) {
+        return seL4_IllegalOperation;
+    }
     if (message_len > client_data->shmem_size) {
         return seL4_RangeError;
     }
 
-    /* Write out */
-    if (config_set(CONFIG_SERIAL_SERVER_COLOURED_OUTPUT)) {
-        printf("%s", COLOR_RESET);
-        printf("%s", BADGE_TO_COLOR(client_data->badge_value));
-    }
-    fwrite((void *)client_data->shmem, message_len, 1, stdout);
-    if (config_set(CONFIG_SERIAL_SERVER_COLOURED_OUTPUT)) {
-        printf("%s", COLOR_RESET);
+    /* Write out, or drop it. Either way the client is told it was written, so
+     * that it doesn't try again. */
+    if (serial_server_admit(client_data, level, message_len)) {
+        serial_server_output(client_data, client_data->shmem, message_len);
     }
     *bytes_written = message_len;
     return 0;
 }
 
+/** Writes out everything that an asynchronous client has put in its ring. */
+static void serial_server_drain_ring(serial_server_registry_entry_t *client_data)
+{
+    serial_server_ring_t *ring = (serial_server_ring_t *)client_data->shmem;
+    size_t capacity = serial_server_ring_capacity(client_data->shmem_size);
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        if (head >= capacity) {
+            ZF_LOGW(SERSERVS"drain: Client badge %lx has a corrupt ring.",
+                    (long)client_data->badge_value);
+            return;
+        }
+        if (!serial_server_admit(client_data, ring->level,
+                                 (head + capacity - tail) % capacity)) {
+            tail = head;
+        }
+        if (head < tail) {
+            /* Wrapped around, write out up to the end first. */
+            serial_server_output(client_data, &ring->data[tail], capacity - tail);
+            tail = 0;
+        }
+        if (head > tail) {
+            serial_server_output(client_data, &ring->data[tail], head - tail);
+        }
+        tail = head;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        /* Pairs with the fence in the client's write: either we see what it
+         * wrote after this, or it sees that we had emptied the ring and
+         * signals us. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+}
+
+/** Drains the rings of every asynchronous client, starting from a different
+ * client each time so that none are always last. */
+static void serial_server_drain_all(void)
+{
+    int n_entries = get_serial_server()->registry_n_entries;
+
+    for (int i = 0; i < n_entries; i++) {
+        int idx = (get_serial_server()->drain_next + i) % n_entries;
+        serial_server_registry_entry_t *curr = &get_serial_server()->registry[idx];
+
+        if (curr->badge_value != SERIAL_SERVER_BADGE_VALUE_EMPTY
+            && curr->shmem != NULL && curr->mode == SERIAL_SERVER_MODE_ASYNC) {
+            serial_server_drain_ring(curr);
+        }
+    }
+    if (n_entries > 0) {
+        get_serial_server()->drain_next = (get_serial_server()->drain_next + 1) % n_entries;
+    }
+}
+
+void serial_server_rx_irq(UNUSED void *data, irq_acknowledge_fn_t acknowledge_fn, void *ack_data)
+{
+    serial_server_context_t *server = get_serial_server();
+    ps_chardevice_t *console = platsupport_get_console();
+    int c;
+
+    /* Taking everything the device has received also clears its receive
+     * interrupt, so one IRQ covers however much arrived. */
+    while ((c = ps_cdev_getchar(console)) >= 0) {
+        if (server->rx_head - server->rx_tail == RX_BUFFER_SIZE) {
+            server->rx_dropped++;
+            continue;
+        }
+        rx_buffer[server->rx_head % RX_BUFFER_SIZE] = c;
+        server->rx_head++;
+    }
+    acknowledge_fn(ack_data);
+}
+
+/** Hands as much buffered input as fits to the client with the focus, and
+ * signals it if there was any. */
+static void serial_server_rx_deliver(void)
+{
+    serial_server_context_t *server = get_serial_server();
+    serial_server_registry_entry_t *focus;
+    serial_server_input_ring_t *ring;
+    const size_t capacity = SERIAL_SERVER_INPUT_RING_CAPACITY;
+    uint32_t head, tail;
+    size_t n;
+
+    if (server->rx_head == server->rx_tail
+        || server->rx_focus == SERIAL_SERVER_BADGE_VALUE_EMPTY) {
+        return;
+    }
+    focus = serial_server_registry_get_entry_by_badge(server->rx_focus);
+    if (focus == NULL || focus->input == NULL) {
+        return;
+    }
+    ring = focus->input;
+    head = ring->head;
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head >= capacity || tail >= capacity) {
+        ZF_LOGW(SERSERVS"input: Client badge %lx has a corrupt input ring.",
+                (long)focus->badge_value);
+        return;
+    }
+
+    n = MIN(server->rx_head - server->rx_tail, (tail + capacity - head - 1) % capacity);
+    if (n == 0) {
+        /* The client pulls the rest once it has emptied the ring. */
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        ring->data[head] = rx_buffer[server->rx_tail % RX_BUFFER_SIZE];
+        head = (head + 1) % capacity;
+        server->rx_tail++;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    seL4_Signal(focus->input_ntfn_cspath.capPtr);
+}
+
+/** Handles the IRQs the IRQ server has queued for us, then passes on the
+ * input they brought. */
+static void serial_server_rx_handle(void)
+{
+    if (get_serial_server()->rx_irq_server != NULL) {
+        while (irq_server_handle_irq_ring(get_serial_server()->rx_irq_server, SIZE_MAX) > 0);
+    }
+    serial_server_rx_deliver();
+}
+
+/** Processes FUNC_INPUT_REQ IPC messages, which carry the Notification cap to
+ * signal the client with when there is input. The client's input ring is
+ * carved out of the end of its shmem.
+ */
+static seL4_Error serial_server_func_input(serial_server_registry_entry_t *client_data,
+                                           seL4_MessageInfo_t tag,
+                                           bool focus,
+                                           size_t *ring_offset)
+{
+    size_t offset = serial_server_input_ring_offset(client_data->shmem_size);
+    size_t min_output = 1;
+    cspacepath_t ntfn_cspath;
+    seL4_Error error;
+
+    if (seL4_MessageInfo_get_extraCaps(tag) != 1
+        || seL4_MessageInfo_get_capsUnwrapped(tag) != 0) {
+        ZF_LOGW(SERSERVS"input: Client badge %lx did not send a Notification cap.",
+                (long)client_data->badge_value);
+        return seL4_InvalidCapability;
+    }
+
+    if (client_data->mode == SERIAL_SERVER_MODE_ASYNC) {
+        min_output = offsetof(serial_server_ring_t, data) + 2;
+    }
+    if (client_data->shmem == NULL || client_data->input != NULL || offset < min_output) {
+        ZF_LOGW(SERSERVS"input: Client badge %lx is not connected, already reads "
+                "input or has too small a shmem.", (long)client_data->badge_value);
+        error = seL4_IllegalOperation;
+        goto out;
+    }
+
+    error = vka_cspace_alloc_path(get_serial_server()->server_vka, &ntfn_cspath);
+    if (error != 0) {
+        error = seL4_NotEnoughMemory;
+        goto out;
+    }
+    error = vka_cnode_move(&ntfn_cspath, &get_serial_server()->frame_cap_recv_cspath);
+    if (error != 0) {
+        vka_cspace_free_path(get_serial_server()->server_vka, ntfn_cspath);
+        goto out;
+    }
+
+    if (client_data->mode == SERIAL_SERVER_MODE_ASYNC) {
+        /* The output ring shrinks, so empty it first. The client is waiting
+         * for our reply, so it won't write to it meanwhile. */
+        serial_server_ring_t *ring = (serial_server_ring_t *)client_data->shmem;
+        serial_server_drain_ring(client_data);
+        ring->head = 0;
+        ring->tail = 0;
+    }
+    client_data->shmem_size = offset;
+    client_data->input = (serial_server_input_ring_t *)((uintptr_t)client_data->shmem + offset);
+    client_data->input->head = 0;
+    client_data->input->tail = 0;
+    client_data->input_ntfn_cspath = ntfn_cspath;
+    if (focus || get_serial_server()->rx_focus == SERIAL_SERVER_BADGE_VALUE_EMPTY) {
+        get_serial_server()->rx_focus = client_data->badge_value;
+    }
+    *ring_offset = offset;
+    return seL4_NoError;
+
+out:
+    vka_cnode_delete(&get_serial_server()->frame_cap_recv_cspath);
+    return error;
+}
+
 static void serial_server_func_disconnect(serial_server_registry_entry_t *client_data)
 {
+    if (client_data->shmem != NULL && client_data->mode == SERIAL_SERVER_MODE_ASYNC) {
+        /* Don't lose whatever the client wrote last. */
+        serial_server_drain_ring(client_data);
+    }
+
     /* Tear down shmem and release the badge value for reuse. */
-    vspace_unmap_pages(get_serial_server()->server_vspace,
-                       (void *)client_data->shmem,
-                       BYTES_TO_4K_PAGES(client_data->shmem_size),
-                       seL4_PageBits, get_serial_server()->server_vka);
-    free(client_data->shmem_frame_caps);
+    serial_server_shmem_teardown(client_data);
     serial_server_registry_remove(client_data->badge_value);
 }
 
@@ -396,7 +804,7 @@ static void serial_server_func_kill(void)
         serial_server_registry_entry_t *curr = &get_serial_server()->registry[i];
 
         if (curr->badge_value == SERIAL_SERVER_BADGE_VALUE_EMPTY
-            || BYTES_TO_4K_PAGES(curr->shmem_size) == 0) {
+            || curr->shmem_pending == NULL) {
             continue;
         }
 
@@ -428,13 +836,28 @@ void serial_server_registry_dump(bool dump_frame_caps)
             continue;
         }
 
-        for (int j = 0; j < BYTES_TO_4K_PAGES(tmp->shmem_size); j++) {
+        for (int j = 0; j < tmp->shmem_n_received; j++) {
             ZF_LOGD("Reg badge %d: frame cap %d: %"PRIxPTR".",
                     tmp->badge_value, j + 1, tmp->shmem_frame_caps[j]);
         }
     }
 }
 
+/** Sets up the caps to send back with the reply that completes a connection,
+ * and returns how many there are: asynchronous clients are handed the
+ * notification to signal us with.
+ */
+static int serial_server_connected_caps(serial_server_registry_entry_t *client_data,
+                                        seL4_Error error)
+{
+    if (error != 0 || client_data == NULL || client_data->shmem == NULL
+        || client_data->mode != SERIAL_SERVER_MODE_ASYNC) {
+        return 0;
+    }
+    seL4_SetCap(0, get_serial_server()->_badged_server_ntfn_cspath.capPtr);
+    return 1;
+}
+
 void serial_server_main(void)
 {
     seL4_MessageInfo_t tag;
@@ -444,6 +867,7 @@ void serial_server_main(void)
     UNUSED seL4_Error error;
     serial_server_registry_entry_t *client_data = NULL;
     size_t buff_len, bytes_written;
+    int mode;
 
     /* Bind to the serial driver. */
     error = platsupport_serial_setup_simple(get_serial_server()->server_vspace,
@@ -482,9 +906,34 @@ void serial_server_main(void)
         /* Set the CNode slots where caps from clients will go */
         serial_server_set_frame_recv_path();
 
+#ifdef CONFIG_SERIAL_SERVER_TX_QUEUE
+        if (serial_server_tx_pending() > 0) {
+            /* Keep writing out queued output while no requests come in. */
+            tag = nbrecv(&sender_badge);
+            if (sender_badge == SERIAL_SERVER_BADGE_VALUE_EMPTY) {
+                serial_server_tx_pump(TX_CHUNK);
+                continue;
+            }
+        } else {
+            tag = recv(&sender_badge);
+        }
+#else
         tag = recv(&sender_badge);
+#endif
         ZF_LOGD(SERSERVS "main: Got message from %x", sender_badge);
 
+        if (sender_badge & (SERIAL_SERVER_ASYNC_BADGE | SERIAL_SERVER_RX_BADGE)) {
+            /* Our bound notification: an asynchronous client's ring went
+             * non-empty, or the serial device received input. */
+            if (sender_badge & SERIAL_SERVER_RX_BADGE) {
+                serial_server_rx_handle();
+            }
+            if (sender_badge & SERIAL_SERVER_ASYNC_BADGE) {
+                serial_server_drain_all();
+            }
+            continue;
+        }
+
         func = seL4_GetMR(SSMSGREG_FUNC);
 
         /* Lookup the registry entry for this sender to make sure that the sender
@@ -506,14 +955,28 @@ void serial_server_main(void)
         case FUNC_CONNECT_REQ:
             ZF_LOGD(SERSERVS"main: Got connect request from client badge %x.",
                     sender_badge);
+            mode = seL4_GetMR(SSMSGREG_CONNECT_REQ_MODE);
             error = serial_server_func_connect(tag,
                                                sender_badge,
-                                               seL4_GetMR(SSMSGREG_CONNECT_REQ_SHMEM_SIZE));
+                                               seL4_GetMR(SSMSGREG_CONNECT_REQ_SHMEM_SIZE),
+                                               mode);
 
             seL4_SetMR(SSMSGREG_FUNC, FUNC_CONNECT_ACK);
             seL4_SetMR(SSMSGREG_CONNECT_ACK_MAX_SHMEM_SIZE,
                        get_serial_server()->shmem_max_size);
-            tag = seL4_MessageInfo_new(error, 0, 0, SSMSGREG_CONNECT_ACK_END);
+            client_data = serial_server_registry_get_entry_by_badge(sender_badge);
+            tag = seL4_MessageInfo_new(error, 0, serial_server_connected_caps(client_data, error),
+                                       SSMSGREG_CONNECT_ACK_END);
+            reply(tag);
+            break;
+
+        case FUNC_CONNECT_FRAME_REQ:
+            error = serial_server_func_connect_frame(client_data, tag,
+                                                     seL4_GetMR(SSMSGREG_CONNECT_FRAME_REQ_INDEX));
+
+            seL4_SetMR(SSMSGREG_FUNC, FUNC_CONNECT_FRAME_ACK);
+            tag = seL4_MessageInfo_new(error, 0, serial_server_connected_caps(client_data, error),
+                                       SSMSGREG_CONNECT_FRAME_ACK_END);
             reply(tag);
             break;
 
@@ -540,6 +1003,7 @@ void serial_server_main(void)
                     sender_badge);
             buff_len = seL4_GetMR(SSMSGREG_WRITE_REQ_BUFF_LEN);
             error = serial_server_func_write(client_data, buff_len,
+                                             seL4_GetMR(SSMSGREG_WRITE_REQ_LEVEL),
                                              &bytes_written);
 
             seL4_SetMR(SSMSGREG_FUNC, FUNC_WRITE_ACK);
@@ -548,6 +1012,67 @@ void serial_server_main(void)
             reply(tag);
             break;
 
+        case FUNC_DRAIN_REQ:
+            /* An asynchronous client's ring is full, or it wants to know that
+             * everything it wrote has been written out. */
+            if (client_data->shmem != NULL && client_data->mode == SERIAL_SERVER_MODE_ASYNC) {
+                serial_server_drain_ring(client_data);
+                error = 0;
+            } else {
+                error = seL4_IllegalOperation;
+            }
+
+            seL4_SetMR(SSMSGREG_FUNC, FUNC_DRAIN_ACK);
+            tag = seL4_MessageInfo_new(error, 0, 0, SSMSGREG_DRAIN_ACK_END);
+            reply(tag);
+            break;
+
+        case FUNC_GET_STATS_REQ:
+            seL4_SetMR(SSMSGREG_FUNC, FUNC_GET_STATS_ACK);
+            seL4_SetMR(SSMSGREG_GET_STATS_ACK_DROPPED_MSGS, client_data->stats.dropped_msgs);
+            seL4_SetMR(SSMSGREG_GET_STATS_ACK_DROPPED_BYTES, client_data->stats.dropped_bytes);
+            tag = seL4_MessageInfo_new(0, 0, 0, SSMSGREG_GET_STATS_ACK_END);
+            reply(tag);
+            break;
+
+        case FUNC_INPUT_REQ:
+            ZF_LOGD(SERSERVS"main: Got input request from client badge %x.",
+                    sender_badge);
+            buff_len = 0;
+            error = serial_server_func_input(client_data, tag,
+                                             seL4_GetMR(SSMSGREG_INPUT_REQ_FOCUS),
+                                             &buff_len);
+
+            seL4_SetMR(SSMSGREG_FUNC, FUNC_INPUT_ACK);
+            seL4_SetMR(SSMSGREG_INPUT_ACK_RING_OFFSET, buff_len);
+            tag = seL4_MessageInfo_new(error, 0, 0, SSMSGREG_INPUT_ACK_END);
+            reply(tag);
+            /* Input that came in before anyone was reading it */
+            serial_server_rx_deliver();
+            break;
+
+        case FUNC_FOCUS_REQ:
+            if (client_data->input != NULL) {
+                get_serial_server()->rx_focus = client_data->badge_value;
+                error = 0;
+            } else {
+                error = seL4_IllegalOperation;
+            }
+
+            seL4_SetMR(SSMSGREG_FUNC, FUNC_FOCUS_ACK);
+            tag = seL4_MessageInfo_new(error, 0, 0, SSMSGREG_FOCUS_ACK_END);
+            reply(tag);
+            serial_server_rx_deliver();
+            break;
+
+        case FUNC_INPUT_PULL_REQ:
+            seL4_SetMR(SSMSGREG_FUNC, FUNC_INPUT_PULL_ACK);
+            tag = seL4_MessageInfo_new(client_data->input == NULL ? seL4_IllegalOperation : 0,
+                                       0, 0, SSMSGREG_INPUT_PULL_ACK_END);
+            reply(tag);
+            serial_server_rx_deliver();
+            break;
+
         case FUNC_DISCONNECT_REQ:
             ZF_LOGD(SERSERVS"main: Got disconnect request from client badge %x.",
                     sender_badge);
@@ -576,6 +1101,11 @@ void serial_server_main(void)
     }
 
     serial_server_func_kill();
+#ifdef CONFIG_SERIAL_SERVER_TX_QUEUE
+    while (serial_server_tx_pending() > 0) {
+        serial_server_tx_pump(TX_QUEUE_SIZE);
+    }
+#endif
     /* After we break out of the loop, seL4_TCB_Suspend ourselves */
     ZF_LOGI(SERSERVS"main: Suspending.");
     seL4_TCB_Suspend(get_serial_server()->server_thread.tcb.cptr);
@@ -314,3 +314,209 @@ test_write_inputs(struct env *env)
 DEFINE_TEST(SERSERV_PARENT_010, "Test a series of unexpected input values to write()",
             test_write_inputs, true)
 
+
+static int
+test_parent_async_printf_and_write(struct env *env)
+{
+    int error;
+    serial_client_context_t conn;
+    cspacepath_t badged_server_ep_cspath;
+
+    error = serial_server_parent_spawn_thread(&env->simple,
+                                              &env->vka, &env->vspace,
+                                              SERSERV_TEST_PRIO_SERVER);
+    test_eq(error, 0);
+
+    error = serial_server_parent_vka_mint_endpoint(&env->vka, &badged_server_ep_cspath);
+    test_eq(error, 0);
+
+    error = serial_server_client_connect_async(badged_server_ep_cspath.capPtr,
+                                               &env->vka, &env->vspace, &conn);
+    test_eq(error, 0);
+
+    /* Write enough to wrap around the ring a few times. */
+    for (int i = 0; i < 1024; i++) {
+        error = serial_server_printf(&conn, test_str);
+        test_eq(error, (int)strlen(test_str));
+        error = serial_server_write(&conn, test_str, strlen(test_str));
+        test_eq(error, (int)strlen(test_str));
+    }
+
+    error = serial_server_flush(&conn, 0);
+    test_eq(error, 0);
+
+    serial_server_disconnect(&conn);
+    return sel4test_get_result();
+}
+DEFINE_TEST(SERSERV_PARENT_011, "Printf() and write() on an asynchronous connection",
+            test_parent_async_printf_and_write, true)
+
+static int
+test_parent_sized_connect_write(struct env *env)
+{
+    int error;
+    serial_client_context_t conn;
+    cspacepath_t badged_server_ep_cspath;
+
+    error = serial_server_parent_spawn_thread(&env->simple,
+                                              &env->vka, &env->vspace,
+                                              SERSERV_TEST_PRIO_SERVER);
+    test_eq(error, 0);
+
+    error = serial_server_parent_vka_mint_endpoint(&env->vka, &badged_server_ep_cspath);
+    test_eq(error, 0);
+
+    /* Ask for more than the server may accept: it should settle for its max. */
+    error = serial_server_client_connect_sized(badged_server_ep_cspath.capPtr,
+                                               &env->vka, &env->vspace,
+                                               4 * BIT(seL4_PageBits), false, &conn);
+    test_eq(error, 0);
+    test_leq(conn.shmem_size, (size_t)(4 * BIT(seL4_PageBits)));
+
+    /* Fill the whole buffer in one write. */
+    memset((void *)conn.shmem, '.', conn.shmem_size - 1);
+    conn.shmem[conn.shmem_size - 1] = '\n';
+    error = serial_server_flush(&conn, conn.shmem_size);
+    test_eq(error, (int)conn.shmem_size);
+
+    serial_server_disconnect(&conn);
+    return sel4test_get_result();
+}
+DEFINE_TEST(SERSERV_PARENT_012, "Write() a whole multi-page buffer from a connected parent thread",
+            test_parent_sized_connect_write, true)
+
+static int
+test_parent_buffered_printf(struct env *env)
+{
+    int error;
+    serial_client_context_t conn;
+    cspacepath_t badged_server_ep_cspath;
+
+    error = serial_server_parent_spawn_thread(&env->simple,
+                                              &env->vka, &env->vspace,
+                                              SERSERV_TEST_PRIO_SERVER);
+    test_eq(error, 0);
+
+    error = serial_server_parent_vka_mint_endpoint(&env->vka, &badged_server_ep_cspath);
+    test_eq(error, 0);
+
+    error = serial_server_client_connect(badged_server_ep_cspath.capPtr,
+                                         &env->vka, &env->vspace, &conn);
+    test_eq(error, 0);
+
+    error = serial_server_set_buffered(&conn, true, 16);
+    test_eq(error, 0);
+
+    /* Enough to fill the buffer and hit the line threshold a few times. */
+    for (int i = 0; i < 512; i++) {
+        error = serial_server_printf(&conn, test_str);
+        test_eq(error, (int)strlen(test_str));
+        error = serial_server_write(&conn, test_str, strlen(test_str));
+        test_eq(error, (int)strlen(test_str));
+    }
+    test_neq(serial_server_flush(&conn, 1), 0);
+    test_eq(serial_server_flush(&conn, 0), 0);
+    test_eq(conn.buffered_len, 0);
+
+    error = serial_server_set_buffered(&conn, false, 0);
+    test_eq(error, 0);
+
+    serial_server_disconnect(&conn);
+    return sel4test_get_result();
+}
+DEFINE_TEST(SERSERV_PARENT_013, "Printf() and write() on a buffered connection",
+            test_parent_buffered_printf, true)
+
+static int
+test_parent_level_filter(struct env *env)
+{
+    int error;
+    serial_client_context_t conn;
+    cspacepath_t badged_server_ep_cspath;
+    serial_server_stats_t stats;
+    serial_server_limits_t limits = {
+        .max_level = SERIAL_SERVER_LEVEL_INFO,
+    };
+
+    error = serial_server_parent_spawn_thread(&env->simple,
+                                              &env->vka, &env->vspace,
+                                              SERSERV_TEST_PRIO_SERVER);
+    test_eq(error, 0);
+    error = serial_server_parent_set_limits(&limits);
+    test_eq(error, 0);
+
+    error = serial_server_parent_vka_mint_endpoint(&env->vka, &badged_server_ep_cspath);
+    test_eq(error, 0);
+
+    error = serial_server_client_connect(badged_server_ep_cspath.capPtr,
+                                         &env->vka, &env->vspace, &conn);
+    test_eq(error, 0);
+
+    /* Written out. */
+    error = serial_server_printf(&conn, test_str);
+    test_eq(error, (int)strlen(test_str));
+
+    /* Dropped, but reported as written. */
+    error = serial_server_set_level(&conn, SERIAL_SERVER_LEVEL_DEBUG);
+    test_eq(error, 0);
+    error = serial_server_write(&conn, test_str, strlen(test_str));
+    test_eq(error, (int)strlen(test_str));
+
+    error = serial_server_get_stats(&conn, &stats);
+    test_eq(error, 0);
+    test_eq(stats.dropped_msgs, 1);
+    test_eq(stats.dropped_bytes, strlen(test_str));
+
+    serial_server_disconnect(&conn);
+    return sel4test_get_result();
+}
+DEFINE_TEST(SERSERV_PARENT_014, "Output above the server's max level is dropped and counted",
+            test_parent_level_filter, true)
+
+static int
+test_parent_input_connect(struct env *env)
+{
+    int error;
+    serial_client_context_t conn;
+    cspacepath_t badged_server_ep_cspath;
+    vka_object_t ntfn;
+    size_t shmem_size;
+    char c;
+
+    error = serial_server_parent_spawn_thread(&env->simple,
+                                              &env->vka, &env->vspace,
+                                              SERSERV_TEST_PRIO_SERVER);
+    test_eq(error, 0);
+
+    error = serial_server_parent_vka_mint_endpoint(&env->vka, &badged_server_ep_cspath);
+    test_eq(error, 0);
+
+    error = serial_server_client_connect_async(badged_server_ep_cspath.capPtr,
+                                               &env->vka, &env->vspace, &conn);
+    test_eq(error, 0);
+    error = vka_alloc_notification(&env->vka, &ntfn);
+    test_eq(error, 0);
+
+    /* Output written before is sent off, and output still works after with
+     * what is left of the shmem. */
+    error = serial_server_printf(&conn, test_str);
+    test_eq(error, (int)strlen(test_str));
+    shmem_size = conn.shmem_size;
+    error = serial_server_input_connect(&conn, ntfn.cptr, true);
+    test_eq(error, 0);
+    test_lt(conn.shmem_size, shmem_size);
+    error = serial_server_printf(&conn, test_str);
+    test_eq(error, (int)strlen(test_str));
+    test_eq(serial_server_flush(&conn, 0), 0);
+
+    /* Nothing has been typed, as input was never enabled. */
+    test_eq(serial_server_read(&conn, &c, 1, false), 0);
+    test_eq(serial_server_take_focus(&conn), 0);
+    test_neq(serial_server_input_connect(&conn, ntfn.cptr, true), 0);
+
+    serial_server_disconnect(&conn);
+    vka_free_object(&env->vka, &ntfn);
+    return sel4test_get_result();
+}
+DEFINE_TEST(SERSERV_PARENT_015, "Register a connection as a reader of input",
+            test_parent_input_connect, true)
@@ -19,34 +19,86 @@
 #include <vspace/page.h>
 #include <vka/kobject_t.h>
 
+/* The untypeds of the bootinfo given to simple_default_init_bootinfo, in order
+ * of paddr, so that the frame lookups below can binary search them. Untypeds
+ * from the kernel never overlap, so at most one can contain a given frame. */
+static struct {
+    seL4_BootInfo *bi;
+    seL4_Word count;
+    seL4_Word order[CONFIG_MAX_NUM_BOOTINFO_UNTYPED_CAPS];
+} untyped_index;
+
+static void untyped_index_init(seL4_BootInfo *bi)
+{
+    seL4_Word count = MIN(bi->untyped.end - bi->untyped.start, CONFIG_MAX_NUM_BOOTINFO_UNTYPED_CAPS);
+
+    /* insertion sort, as this is done once over a list that is mostly in order */
+    for (seL4_Word i = 0; i < count; i++) {
+        seL4_Word j = i;
+        while (j > 0 && bi->untypedList[untyped_index.order[j - 1]].paddr > bi->untypedList[i].paddr) {
+            untyped_index.order[j] = untyped_index.order[j - 1];
+            j--;
+        }
+        untyped_index.order[j] = i;
+    }
+    untyped_index.count = count;
+    untyped_index.bi = bi;
+}
+
+/* Find the untyped with the highest paddr at or below paddr, returning its
+ * index in the untypedList or -1 if there is none. */
+static long untyped_index_find(seL4_BootInfo *bi, seL4_Word paddr)
+{
+    long found = -1;
+
+    if (untyped_index.bi != bi) {
+        /* not the bootinfo we indexed, so look through it all */
+        for (seL4_Word i = 0; i < bi->untyped.end - bi->untyped.start; i++) {
+            if (bi->untypedList[i].paddr <= paddr &&
+                (found == -1 || bi->untypedList[i].paddr > bi->untypedList[found].paddr)) {
+                found = i;
+            }
+        }
+        return found;
+    }
+
+    seL4_Word low = 0;
+    seL4_Word high = untyped_index.count;
+    while (low < high) {
+        seL4_Word mid = low + (high - low) / 2;
+        if (bi->untypedList[untyped_index.order[mid]].paddr <= paddr) {
+            found = untyped_index.order[mid];
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return found;
+}
+
 void *simple_default_get_frame_info(void *data, void *paddr, int size_bits, seL4_CPtr *frame_cap, seL4_Word *offset)
 {
-    unsigned int i;
     seL4_BootInfo *bi = (seL4_BootInfo *) data;
     assert(bi && paddr && offset && frame_cap);
 
-    for (i = 0; i < bi->untyped.end - bi->untyped.start; i++) {
-        if (bi->untypedList[i].paddr <= (seL4_Word)paddr &&
-            bi->untypedList[i].paddr + BIT(bi->untypedList[i].sizeBits) >= (seL4_Word)paddr + BIT(size_bits)) {
-            *frame_cap = bi->untyped.start + i;
-            *offset = (seL4_Word)paddr - bi->untypedList[i].paddr;
-            break;
-        }
+    long i = untyped_index_find(bi, (seL4_Word)paddr);
+    if (i != -1 &&
+        bi->untypedList[i].paddr + BIT(bi->untypedList[i].sizeBits) >= (seL4_Word)paddr + BIT(size_bits)) {
+        *frame_cap = bi->untyped.start + i;
+        *offset = (seL4_Word)paddr - bi->untypedList[i].paddr;
     }
     return NULL;
 }
 seL4_Error simple_default_get_frame_cap(void *data, void *paddr, int size_bits, cspacepath_t *path)
 {
-    unsigned int i;
     seL4_BootInfo *bi = (seL4_BootInfo *) data;
     assert(bi && paddr);
 
-    for (i = 0; i < bi->untyped.end - bi->untyped.start; i++) {
-        if (bi->untypedList[i].paddr == (seL4_Word)paddr &&
-            bi->untypedList[i].sizeBits >= size_bits) {
-            return seL4_Untyped_Retype(bi->untyped.start + i, kobject_get_type(KOBJECT_FRAME, size_bits),
-                                       size_bits, path->root, path->dest, path->destDepth, path->offset, 1);
-        }
+    long i = untyped_index_find(bi, (seL4_Word)paddr);
+    if (i != -1 && bi->untypedList[i].paddr == (seL4_Word)paddr &&
+        bi->untypedList[i].sizeBits >= size_bits) {
+        return seL4_Untyped_Retype(bi->untyped.start + i, kobject_get_type(KOBJECT_FRAME, size_bits),
+                                   size_bits, path->root, path->dest, path->destDepth, path->offset, 1);
     }
     return seL4_FailedLookup;
 }
@@ -202,49 +254,120 @@ seL4_CPtr simple_default_sched_control(void *data, int core)
 #endif
 }
 
-ssize_t simple_default_get_extended_bootinfo_size(void *data, seL4_Word type)
-{
-    if (data == NULL) {
-        ZF_LOGE("Data is null!");
-        return -1;
-    }
-    seL4_BootInfo *bi = data;
+/* Where each kind of extended bootinfo is in the bootinfo given to
+ * simple_default_init_bootinfo, found with a single walk of the chain. */
+static struct {
+    seL4_BootInfo *bi;
+    seL4_BootInfoHeader *headers[SEL4_BOOTINFO_HEADER_NUM];
+} extended_index;
 
+/* Find the first header of type by walking the chain */
+static seL4_BootInfoHeader *extended_walk(seL4_BootInfo *bi, seL4_Word type)
+{
     /* start of the extended bootinfo is defined to be 4K from the start of regular bootinfo */
     uintptr_t cur = (uintptr_t)bi + PAGE_SIZE_4K;
     uintptr_t end = cur + bi->extraLen;
     while (cur < end) {
         seL4_BootInfoHeader *header = (seL4_BootInfoHeader *)cur;
         if (header->id == type) {
-            return header->len;
+            return header;
+        }
+        if (header->len == 0) {
+            ZF_LOGE("Extended bootinfo header with no length");
+            break;
+        }
+        cur += header->len;
+    }
+    return NULL;
+}
+
+static void extended_index_init(seL4_BootInfo *bi)
+{
+    uintptr_t cur = (uintptr_t)bi + PAGE_SIZE_4K;
+    uintptr_t end = cur + bi->extraLen;
+
+    memset(extended_index.headers, 0, sizeof(extended_index.headers));
+    while (cur < end) {
+        seL4_BootInfoHeader *header = (seL4_BootInfoHeader *)cur;
+        /* the first of each type is the one that is found by walking the chain */
+        if (header->id < SEL4_BOOTINFO_HEADER_NUM && extended_index.headers[header->id] == NULL) {
+            extended_index.headers[header->id] = header;
+        }
+        if (header->len == 0) {
+            ZF_LOGE("Extended bootinfo header with no length");
+            break;
         }
         cur += header->len;
     }
-    return -1;
+    extended_index.bi = bi;
+}
+
+static seL4_BootInfoHeader *extended_find(seL4_BootInfo *bi, seL4_Word type)
+{
+    if (extended_index.bi == bi && type < SEL4_BOOTINFO_HEADER_NUM) {
+        return extended_index.headers[type];
+    }
+    return extended_walk(bi, type);
+}
+
+ssize_t simple_default_get_extended_bootinfo_size(void *data, seL4_Word type)
+{
+    if (data == NULL) {
+        ZF_LOGE("Data is null!");
+        return -1;
+    }
+
+    seL4_BootInfoHeader *header = extended_find(data, type);
+    return header != NULL ? header->len : -1;
 }
 
 ssize_t simple_default_get_extended_bootinfo(void *data, seL4_Word type, void *dest, ssize_t max_len)
 {
     assert(data);
-    seL4_BootInfo *bi = data;
 
     if (max_len < 0) {
         ZF_LOGE("Unexpected negative size");
         return -1;
     }
-    /* start of the extended bootinfo is defined to be 4K from the start of regular bootinfo */
-    uintptr_t cur = (uintptr_t)bi + PAGE_SIZE_4K;
-    uintptr_t end = cur + bi->extraLen;
-    while (cur < end) {
-        seL4_BootInfoHeader *header = (seL4_BootInfoHeader *)cur;
-        if (header->id == type) {
-            ssize_t copy_len = MIN(header->len, max_len);
-            memcpy(dest, (void *)cur, copy_len);
-            return copy_len;
-        }
-        cur += header->len;
+    seL4_BootInfoHeader *header = extended_find(data, type);
+    if (header == NULL) {
+        return -1;
+    }
+    ssize_t copy_len = MIN(header->len, max_len);
+    memcpy(dest, header, copy_len);
+    return copy_len;
+}
+
+const seL4_BootInfoHeader *simple_default_get_extended_bootinfo_ptr(void *data, seL4_Word type)
+{
+    assert(data);
+    return extended_find(data, type);
+}
+
+seL4_CPtr simple_default_get_extended_bootinfo_frame(void *data, const void *vaddr)
+{
+    assert(data);
+    seL4_BootInfo *bi = data;
+
+    uintptr_t base = (uintptr_t)bi + PAGE_SIZE_4K;
+    if ((uintptr_t)vaddr < base || (uintptr_t)vaddr >= base + bi->extraLen) {
+        return seL4_CapNull;
     }
-    return -1;
+    seL4_Word page = ((uintptr_t)vaddr - base) / PAGE_SIZE_4K;
+    if (page >= bi->extraBIPages.end - bi->extraBIPages.start) {
+        return seL4_CapNull;
+    }
+    return bi->extraBIPages.start + page;
+}
+
+int simple_default_get_empty_slots(void *data, seL4_CPtr *start, seL4_CPtr *end)
+{
+    assert(data && start && end);
+
+    seL4_BootInfo *bi = data;
+    *start = bi->empty.start;
+    *end = bi->empty.end;
+    return 0;
 }
 
 void simple_default_init_bootinfo(simple_t *simple, seL4_BootInfo *bi)
@@ -252,6 +375,9 @@ void simple_default_init_bootinfo(simple_t *simple, seL4_BootInfo *bi)
     assert(simple);
     assert(bi);
 
+    untyped_index_init(bi);
+    extended_index_init(bi);
+
     simple->data = bi;
     simple->frame_info = &simple_default_get_frame_info;
     simple->frame_cap = &simple_default_get_frame_cap;
@@ -270,5 +396,8 @@ void simple_default_init_bootinfo(simple_t *simple, seL4_BootInfo *bi)
     simple->sched_ctrl = &simple_default_sched_control;
     simple->extended_bootinfo_len = &simple_default_get_extended_bootinfo_size;
     simple->extended_bootinfo = &simple_default_get_extended_bootinfo;
+    simple->empty_slots = &simple_default_get_empty_slots;
+    simple->extended_bootinfo_ptr = &simple_default_get_extended_bootinfo_ptr;
+    simple->extended_bootinfo_frame = &simple_default_get_extended_bootinfo_frame;
     simple_default_init_arch_simple(&simple->arch_simple, NULL);
 }
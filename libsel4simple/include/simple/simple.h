@@ -218,6 +218,43 @@ typedef ssize_t (*simple_get_extended_bootinfo_len_fn)(void *data, seL4_Word typ
  */
 typedef ssize_t (*simple_get_extended_bootinfo_fn)(void *data, seL4_Word type, void *dest, ssize_t max_len);
 
+/**
+ * Find a particular kind of extended boot information where it is, rather than copying
+ * it. The information starts with its seL4_BootInfoHeader, and remains valid for as long
+ * as the boot information is mapped. Optional; use simple_get_extended_bootinfo if it is
+ * not implemented.
+ *
+ * @param data cookie for the underlying implementation
+ * @param type Type corresponding to a valid 'id' in a seL4_BootInfoHeader
+ *
+ * @return The header of the information or NULL if the type could not be found
+ */
+typedef const seL4_BootInfoHeader *(*simple_get_extended_bootinfo_ptr_fn)(void *data, seL4_Word type);
+
+/**
+ * Get the cap to the frame that backs an address in the extended boot information, as
+ * returned by simple_get_extended_bootinfo_ptr. Optional.
+ *
+ * @param data cookie for the underlying implementation
+ * @param vaddr Address in the extended boot information
+ *
+ * @return The cap to the 4K frame mapped at vaddr, or seL4_CapNull
+ */
+typedef seL4_CPtr (*simple_get_extended_bootinfo_frame_fn)(void *data, const void *vaddr);
+
+/**
+ * Get the range of slots in the cnode that are known to be empty, such as the
+ * empty region from bootinfo. Optional; things that allocate slots look for
+ * them with syscalls if it is not implemented.
+ *
+ * @param data cookie for the underlying implementation
+ * @param start For returning the first empty slot
+ * @param end For returning the slot after the last empty slot
+ *
+ * @return 0 on success
+ */
+typedef int (*simple_get_empty_slots_fn)(void *data, seL4_CPtr *start, seL4_CPtr *end);
+
 typedef struct simple_t {
     void *data;
     simple_get_frame_cap_fn frame_cap;
@@ -237,6 +274,9 @@ typedef struct simple_t {
     simple_get_sched_ctrl_fn sched_ctrl;
     simple_get_extended_bootinfo_len_fn extended_bootinfo_len;
     simple_get_extended_bootinfo_fn extended_bootinfo;
+    simple_get_empty_slots_fn empty_slots;
+    simple_get_extended_bootinfo_ptr_fn extended_bootinfo_ptr;
+    simple_get_extended_bootinfo_frame_fn extended_bootinfo_frame;
     arch_simple_t arch_simple;
 } simple_t;
 
@@ -624,3 +664,41 @@ static inline ssize_t simple_get_extended_bootinfo(simple_t *simple, seL4_Word t
     return simple->extended_bootinfo(simple->data, type, dest, max_len);
 }
 
+static inline const seL4_BootInfoHeader *simple_get_extended_bootinfo_ptr(simple_t *simple, seL4_Word type)
+{
+    if (!simple) {
+        ZF_LOGE("Simple is NULL");
+        return NULL;
+    }
+    if (!simple->extended_bootinfo_ptr) {
+        /* optional, so not worth an error */
+        return NULL;
+    }
+    return simple->extended_bootinfo_ptr(simple->data, type);
+}
+
+static inline seL4_CPtr simple_get_extended_bootinfo_frame(simple_t *simple, const void *vaddr)
+{
+    if (!simple) {
+        ZF_LOGE("Simple is NULL");
+        return seL4_CapNull;
+    }
+    if (!simple->extended_bootinfo_frame) {
+        ZF_LOGE("%s not implemented", __FUNCTION__);
+        return seL4_CapNull;
+    }
+    return simple->extended_bootinfo_frame(simple->data, vaddr);
+}
+
+static inline int simple_get_empty_slots(simple_t *simple, seL4_CPtr *start, seL4_CPtr *end)
+{
+    if (!simple) {
+        ZF_LOGE("Simple is NULL");
+        return -1;
+    }
+    if (!simple->empty_slots) {
+        /* optional, so not worth an error */
+        return -1;
+    }
+    return simple->empty_slots(simple->data, start, end);
+}
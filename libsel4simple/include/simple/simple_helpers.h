@@ -17,4 +17,8 @@ bool simple_is_untyped_cap(simple_t *simple, seL4_CPtr pos);
  * at the end of cspace to be found */
 seL4_CPtr simple_last_valid_cap(simple_t *simple);
 
+/* Make a vka that can only allocate cslots. If the simple knows its empty slots the
+ * vka hands them out from a bitmap without syscalls, so nothing else should
+ * allocate slots from that region while the vka is in use. Otherwise it looks
+ * for free slots with syscalls. */
 void simple_make_vka(simple_t *simple, vka_t *vka);
@@ -4,13 +4,28 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <autoconf.h>
+#include <string.h>
+#include <utils/util.h>
 #include <simple/simple_helpers.h>
 
 bool simple_is_untyped_cap(simple_t *simple, seL4_CPtr pos)
 {
     int i;
+    int count = simple_get_untyped_count(simple);
 
-    for (i = 0; i < simple_get_untyped_count(simple); i++) {
+    if (count <= 0) {
+        return false;
+    }
+    /* Untypeds normally take a contiguous run of slots, in which case checking
+     * the ends of the run is enough. */
+    seL4_CPtr first = simple_get_nth_untyped(simple, 0, NULL, NULL, NULL);
+    seL4_CPtr last = simple_get_nth_untyped(simple, count - 1, NULL, NULL, NULL);
+    if (last >= first && last - first == count - 1) {
+        return pos >= first && pos <= last;
+    }
+
+    for (i = 0; i < count; i++) {
         seL4_CPtr ut_pos = simple_get_nth_untyped(simple, i, NULL, NULL, NULL);
         if (ut_pos == pos) {
             return true;
@@ -20,11 +35,90 @@ bool simple_is_untyped_cap(simple_t *simple, seL4_CPtr pos)
     return false;
 }
 
+/* Free slots of the simple whose empty slots were given to simple_make_vka,
+ * so the vka can find a slot without a search through the cspace. A set bit
+ * is a slot that this vka has not handed out. Something else, such as an
+ * allocator set up on the same empty slots, may have used it since, so each
+ * slot is checked with the kernel before it is handed out. Other simples
+ * fall back to looking for slots with syscalls. */
+#define SIMPLE_VKA_SLOT_WORDS DIV_ROUND_UP(BIT(CONFIG_ROOT_CNODE_SIZE_BITS), seL4_WordBits)
+
+static struct {
+    simple_t *simple;
+    seL4_CPtr start;
+    seL4_CPtr end;
+    /* no free slots before this word */
+    size_t hint;
+    seL4_Word free[SIMPLE_VKA_SLOT_WORDS];
+} vka_slots;
+
+static void simple_vka_slots_init(simple_t *simple)
+{
+    seL4_CPtr start, end;
+
+    if (vka_slots.simple == simple) {
+        /* keep the slots from any earlier vka for the same simple */
+        return;
+    }
+    if (simple_get_empty_slots(simple, &start, &end) != 0 || end <= start) {
+        return;
+    }
+    end = MIN(end, start + SIMPLE_VKA_SLOT_WORDS * seL4_WordBits);
+    memset(vka_slots.free, 0, sizeof(vka_slots.free));
+    for (seL4_CPtr slot = start; slot < end; slot++) {
+        vka_slots.free[(slot - start) / seL4_WordBits] |= BIT((slot - start) % seL4_WordBits);
+    }
+    vka_slots.start = start;
+    vka_slots.end = end;
+    vka_slots.hint = 0;
+    vka_slots.simple = simple;
+}
+
+static void simple_vka_cspace_free(void *data, seL4_CPtr slot)
+{
+    if (data != vka_slots.simple || slot < vka_slots.start || slot >= vka_slots.end) {
+        /* not from the bitmap, so there is nothing to give it back to */
+        return;
+    }
+    size_t word = (slot - vka_slots.start) / seL4_WordBits;
+    assert(!(vka_slots.free[word] & BIT((slot - vka_slots.start) % seL4_WordBits)));
+    vka_slots.free[word] |= BIT((slot - vka_slots.start) % seL4_WordBits);
+    vka_slots.hint = MIN(vka_slots.hint, word);
+}
+
+/* Moving an empty slot onto itself fails to look up the source, while a slot
+ * that is in use fails as the destination is not empty, and nothing changes */
+static bool simple_vka_slot_is_empty(simple_t *simple, seL4_CPtr slot)
+{
+    seL4_CNode cnode = simple_get_cnode(simple);
+    return seL4_CNode_Move(cnode, slot, seL4_WordBits, cnode, slot, seL4_WordBits) != seL4_DeleteFirst;
+}
+
 int simple_vka_cspace_alloc(void *data, seL4_CPtr *slot)
 {
     assert(data && slot);
 
     simple_t *simple = data;
+
+    if (simple == vka_slots.simple) {
+        for (size_t word = vka_slots.hint; word < ARRAY_SIZE(vka_slots.free); word++) {
+            while (vka_slots.free[word]) {
+                seL4_Word bit = CTZL(vka_slots.free[word]);
+                seL4_CPtr candidate = vka_slots.start + word * seL4_WordBits + bit;
+                /* slots in use are dropped, they aren't ours to give back */
+                vka_slots.free[word] &= ~BIT(bit);
+                vka_slots.hint = word;
+                if (simple_vka_slot_is_empty(simple, candidate)) {
+                    *slot = candidate;
+                    return seL4_NoError;
+                }
+            }
+        }
+        vka_slots.hint = ARRAY_SIZE(vka_slots.free);
+        ZF_LOGE("Out of empty slots");
+        return seL4_NotEnoughMemory;
+    }
+
     seL4_CNode cnode = simple_get_cnode(simple);
     int i = 0;
 
@@ -65,19 +159,30 @@ void simple_vka_cspace_make_path(void *data, seL4_CPtr slot, cspacepath_t *path)
 
 void simple_make_vka(simple_t *simple, vka_t *vka)
 {
+    simple_vka_slots_init(simple);
     vka->data = simple;
     vka->cspace_alloc = &simple_vka_cspace_alloc;
     vka->cspace_make_path = &simple_vka_cspace_make_path;
     vka->utspace_alloc = NULL;
     vka->utspace_alloc_maybe_device = NULL;
-    vka->cspace_free = NULL;
+    vka->cspace_free = &simple_vka_cspace_free;
     vka->utspace_free = NULL;
+    vka->cspace_alloc_n = NULL;
+    vka->utspace_alloc_n = NULL;
+    vka->utspace_free_n = NULL;
+    vka->cspace_free_n = NULL;
 }
 
 seL4_CPtr simple_last_valid_cap(simple_t *simple)
 {
     seL4_CPtr largest = 0;
+    seL4_CPtr start, end;
     int i;
+
+    /* caps come before the empty region, so the last one is just before it */
+    if (simple_get_empty_slots(simple, &start, &end) == 0 && start > 0) {
+        return start - 1;
+    }
     for (i = 0; i < simple_get_cap_count(simple); i++) {
         seL4_CPtr cap = simple_get_nth_cap(simple, i);
         if (cap > largest) {
@@ -0,0 +1,581 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Cost of the sync primitives, alone and under contention.
+ *
+ * Each lock is measured three ways:
+ *
+ * uncontended  a lock and unlock by the test thread with nobody else around, as a
+ *              series of the suite checked against its baseline
+ * handoff      from a thread unlocking to a higher priority thread on the same core
+ *              that was blocked on the lock holding it, also as a series
+ * contention   1 to SYNC_BENCH_MAX_THREADS threads, spread over the cores, taking
+ *              the lock in turn and holding it for each of the critical section
+ *              lengths of LibSel4SyncBenchCriticalSections until they have taken it
+ *              SYNC_BENCH_OPS times between them
+ *
+ * Contention prints the acquisitions per million cycles of the test thread, the
+ * latency of an acquisition and a histogram of them by powers of two, and fairness
+ * as Jain's index over the acquisitions of each thread, in thousandths: 1000 when
+ * every thread got the same share. Condition variables are measured the same way
+ * with a token guarded by a binary semaphore standing in for the lock: a thread
+ * waits on the condition variable until the token is free, takes it, and gives it
+ * back with a signal after the critical section, so that every contended
+ * acquisition is a wake up.
+ */
+
+#include <autoconf.h>
+#include <sel4sync/gen_config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <sel4/sel4.h>
+#include <sel4bench/sel4bench.h>
+#include <vka/object.h>
+#include <sel4utils/thread.h>
+#include <sel4utils/thread_config.h>
+#include <sync/mutex.h>
+#include <sync/bin_sem.h>
+#include <sync/sem.h>
+#include <sync/recursive_mutex.h>
+#include <sync/adaptive_mutex.h>
+#include <sync/condition_var.h>
+
+#include <sel4test/benchmark.h>
+#include <sel4test/test.h>
+#include <sel4test/testutil.h>
+
+#define SYNC_BENCH_PRIO_WAITER  (seL4_MaxPrio - 1)
+#define SYNC_BENCH_PRIO_THREAD  (seL4_MaxPrio - 2)
+
+#define SYNC_BENCH_MAX_THREADS  8
+#define SYNC_BENCH_OPS          1024
+#define SYNC_BENCH_SAMPLES      256
+#define SYNC_BENCH_WARMUP       16
+/* buckets of the wait histogram, the last also holds anything longer */
+#define SYNC_BENCH_BUCKETS      24
+
+static const ccnt_t bench_critical_sections[] = { CONFIG_LIB_SEL4_SYNC_BENCH_CRITICAL_SECTIONS };
+
+typedef union bench_lock {
+    sync_mutex_t mutex;
+    sync_bin_sem_t bin_sem;
+    sync_sem_t sem;
+    sync_recursive_mutex_t recursive_mutex;
+    sync_adaptive_mutex_t adaptive_mutex;
+} bench_lock_t;
+
+typedef struct bench_lock_ops {
+    int (*new)(vka_t *vka, bench_lock_t *lock);
+    int (*lock)(bench_lock_t *lock);
+    int (*unlock)(bench_lock_t *lock);
+    int (*destroy)(vka_t *vka, bench_lock_t *lock);
+} bench_lock_ops_t;
+
+typedef struct bench_thread {
+    sel4utils_thread_t thread;
+    vka_object_t done;
+    size_t acquired;
+    ccnt_t waits[SYNC_BENCH_OPS];
+} bench_thread_t;
+
+/* everything the threads of a run share */
+static struct {
+    const bench_lock_ops_t *ops;
+    bench_lock_t lock;
+    sync_bin_sem_t cv_lock;
+    sync_cv_t cv;
+    seL4_CPtr go_ep;
+    ccnt_t critical_section;
+    size_t count;
+    /* set when the token of a condition variable is free */
+    size_t turn;
+    /* cycle count of the handoff thread just before it unlocked, and of the waiter
+     * once it had the lock */
+    volatile ccnt_t released;
+    volatile ccnt_t acquired;
+} bench;
+
+static bench_thread_t bench_threads[SYNC_BENCH_MAX_THREADS];
+static ccnt_t bench_waits[SYNC_BENCH_OPS];
+static ccnt_t bench_samples[SYNC_BENCH_SAMPLES];
+
+static int bench_mutex_new(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_mutex_new(vka, &lock->mutex);
+}
+
+static int bench_mutex_lock(bench_lock_t *lock)
+{
+    return sync_mutex_lock(&lock->mutex);
+}
+
+static int bench_mutex_unlock(bench_lock_t *lock)
+{
+    return sync_mutex_unlock(&lock->mutex);
+}
+
+static int bench_mutex_destroy(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_mutex_destroy(vka, &lock->mutex);
+}
+
+static int bench_bin_sem_new(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_bin_sem_new(vka, &lock->bin_sem, 1);
+}
+
+static int bench_bin_sem_lock(bench_lock_t *lock)
+{
+    return sync_bin_sem_wait(&lock->bin_sem);
+}
+
+static int bench_bin_sem_unlock(bench_lock_t *lock)
+{
+    return sync_bin_sem_post(&lock->bin_sem);
+}
+
+static int bench_bin_sem_destroy(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_bin_sem_destroy(vka, &lock->bin_sem);
+}
+
+static int bench_sem_new(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_sem_new(vka, &lock->sem, 1);
+}
+
+static int bench_sem_lock(bench_lock_t *lock)
+{
+    return sync_sem_wait(&lock->sem);
+}
+
+static int bench_sem_unlock(bench_lock_t *lock)
+{
+    return sync_sem_post(&lock->sem);
+}
+
+static int bench_sem_destroy(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_sem_destroy(vka, &lock->sem);
+}
+
+static int bench_recursive_mutex_new(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_recursive_mutex_new(vka, &lock->recursive_mutex);
+}
+
+static int bench_recursive_mutex_lock(bench_lock_t *lock)
+{
+    return sync_recursive_mutex_lock(&lock->recursive_mutex);
+}
+
+static int bench_recursive_mutex_unlock(bench_lock_t *lock)
+{
+    return sync_recursive_mutex_unlock(&lock->recursive_mutex);
+}
+
+static int bench_recursive_mutex_destroy(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_recursive_mutex_destroy(vka, &lock->recursive_mutex);
+}
+
+static int bench_adaptive_mutex_new(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_adaptive_mutex_new(vka, &lock->adaptive_mutex);
+}
+
+static int bench_adaptive_mutex_lock(bench_lock_t *lock)
+{
+    return sync_adaptive_mutex_lock(&lock->adaptive_mutex);
+}
+
+static int bench_adaptive_mutex_unlock(bench_lock_t *lock)
+{
+    return sync_adaptive_mutex_unlock(&lock->adaptive_mutex);
+}
+
+static int bench_adaptive_mutex_destroy(vka_t *vka, bench_lock_t *lock)
+{
+    return sync_adaptive_mutex_destroy(vka, &lock->adaptive_mutex);
+}
+
+#define BENCH_LOCK_OPS(_name) { \
+    .new = bench_##_name##_new, \
+    .lock = bench_##_name##_lock, \
+    .unlock = bench_##_name##_unlock, \
+    .destroy = bench_##_name##_destroy, \
+}
+
+static const bench_lock_ops_t bench_mutex_ops = BENCH_LOCK_OPS(mutex);
+static const bench_lock_ops_t bench_bin_sem_ops = BENCH_LOCK_OPS(bin_sem);
+static const bench_lock_ops_t bench_sem_ops = BENCH_LOCK_OPS(sem);
+static const bench_lock_ops_t bench_recursive_mutex_ops = BENCH_LOCK_OPS(recursive_mutex);
+static const bench_lock_ops_t bench_adaptive_mutex_ops = BENCH_LOCK_OPS(adaptive_mutex);
+
+static void bench_spin(ccnt_t cycles)
+{
+    ccnt_t start = sel4bench_get_cycle_count();
+    while (sel4bench_get_cycle_count() - start < cycles) {
+    }
+}
+
+static int bench_compare_ccnt(const void *a, const void *b)
+{
+    ccnt_t x = *(const ccnt_t *)a, y = *(const ccnt_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int bench_start_thread(env_t env, bench_thread_t *thread, seL4_Word core, uint8_t prio,
+                              sel4utils_thread_entry_fn entry_point)
+{
+    sel4utils_thread_config_t config = thread_config_default(&env->simple, env->cspace_root, seL4_NilData,
+                                                             seL4_CapNull, prio);
+    int error = sel4utils_configure_thread_config(&env->vka, &env->vspace, &env->vspace, config,
+                                                  &thread->thread);
+    if (error) {
+        return error;
+    }
+    if (core != 0) {
+        sched_params_t params = config.sched_params;
+        if (config_set(CONFIG_KERNEL_MCS)) {
+            seL4_Time timeslice_us = CONFIG_BOOT_THREAD_TIME_SLICE * US_IN_MS;
+            params = sched_params_round_robin(params, &env->simple, core, timeslice_us);
+        } else {
+            params = sched_params_core(params, core);
+        }
+        error = sel4utils_set_sched_affinity(&thread->thread, params);
+        if (error) {
+            sel4utils_clean_up_thread(&env->vka, &env->vspace, &thread->thread);
+            return error;
+        }
+    }
+    return sel4utils_start_thread(&thread->thread, entry_point, thread, NULL, 1);
+}
+
+static void bench_uncontended(const char *name)
+{
+    char full_name[64];
+
+    ccnt_t overhead = sel4test_benchmark_overhead(bench_samples, SYNC_BENCH_SAMPLES);
+
+    for (int i = -SYNC_BENCH_WARMUP; i < SYNC_BENCH_SAMPLES; i++) {
+        ccnt_t start, end;
+        SEL4BENCH_READ_CCNT(start);
+        if (bench.ops != NULL) {
+            bench.ops->lock(&bench.lock);
+            bench.ops->unlock(&bench.lock);
+        } else {
+            sync_bin_sem_wait(&bench.cv_lock);
+            sync_cv_signal(&bench.cv);
+            sync_bin_sem_post(&bench.cv_lock);
+        }
+        SEL4BENCH_READ_CCNT(end);
+        if (i >= 0) {
+            bench_samples[i] = end - start;
+        }
+    }
+    snprintf(full_name, sizeof(full_name), "%s uncontended", name);
+    sel4test_report_benchmark(full_name, bench_samples, SYNC_BENCH_SAMPLES, overhead, NULL);
+}
+
+static void bench_handoff_waiter(void *arg0, UNUSED void *arg1, UNUSED void *ipc_buf)
+{
+    bench_thread_t *thread = arg0;
+
+    while (true) {
+        seL4_Wait(bench.go_ep, NULL);
+        if (bench.ops != NULL) {
+            bench.ops->lock(&bench.lock);
+            bench.acquired = sel4bench_get_cycle_count();
+            bench.ops->unlock(&bench.lock);
+        } else {
+            sync_bin_sem_wait(&bench.cv_lock);
+            while (bench.turn == 0) {
+                sync_cv_wait(&bench.cv_lock, &bench.cv);
+            }
+            bench.acquired = sel4bench_get_cycle_count();
+            bench.turn = 0;
+            sync_bin_sem_post(&bench.cv_lock);
+        }
+        seL4_Signal(thread->done.cptr);
+    }
+}
+
+/* The waiter has a higher priority, so it runs as soon as it is sent go and blocks,
+ * and then runs again as soon as it is let go */
+static void bench_handoff_holder(void *arg0, UNUSED void *arg1, UNUSED void *ipc_buf)
+{
+    bench_thread_t *thread = arg0;
+    bench_thread_t *waiter = &bench_threads[1];
+
+    for (int i = -SYNC_BENCH_WARMUP; i < SYNC_BENCH_SAMPLES; i++) {
+        if (bench.ops != NULL) {
+            bench.ops->lock(&bench.lock);
+            seL4_Signal(bench.go_ep);
+            bench.released = sel4bench_get_cycle_count();
+            bench.ops->unlock(&bench.lock);
+        } else {
+            seL4_Signal(bench.go_ep);
+            sync_bin_sem_wait(&bench.cv_lock);
+            bench.turn = 1;
+            bench.released = sel4bench_get_cycle_count();
+            sync_cv_signal(&bench.cv);
+            sync_bin_sem_post(&bench.cv_lock);
+        }
+        seL4_Wait(waiter->done.cptr, NULL);
+        if (i >= 0) {
+            bench_samples[i] = bench.acquired - bench.released;
+        }
+    }
+    seL4_Signal(thread->done.cptr);
+    seL4_TCB_Suspend(thread->thread.tcb.cptr);
+}
+
+static int bench_handoff(env_t env, const char *name)
+{
+    vka_object_t go;
+    char full_name[64];
+
+    /* both on the core of the test thread so that their cycle counts agree */
+    int error = vka_alloc_notification(&env->vka, &go);
+    test_error_eq(error, 0);
+    bench.go_ep = go.cptr;
+    bench.turn = 0;
+    for (int i = 0; i < 2; i++) {
+        error = vka_alloc_notification(&env->vka, &bench_threads[i].done);
+        test_error_eq(error, 0);
+    }
+    error = bench_start_thread(env, &bench_threads[1], 0, SYNC_BENCH_PRIO_WAITER, bench_handoff_waiter);
+    test_error_eq(error, 0);
+    error = bench_start_thread(env, &bench_threads[0], 0, SYNC_BENCH_PRIO_THREAD, bench_handoff_holder);
+    test_error_eq(error, 0);
+    seL4_Wait(bench_threads[0].done.cptr, NULL);
+
+    snprintf(full_name, sizeof(full_name), "%s handoff", name);
+    sel4test_report_benchmark(full_name, bench_samples, SYNC_BENCH_SAMPLES, 0, NULL);
+
+    for (int i = 0; i < 2; i++) {
+        sel4utils_clean_up_thread(&env->vka, &env->vspace, &bench_threads[i].thread);
+        vka_free_object(&env->vka, &bench_threads[i].done);
+    }
+    vka_free_object(&env->vka, &go);
+    return SUCCESS;
+}
+
+static void bench_lock_thread(bench_thread_t *thread)
+{
+    while (true) {
+        ccnt_t before = sel4bench_get_cycle_count();
+        bench.ops->lock(&bench.lock);
+        ccnt_t after = sel4bench_get_cycle_count();
+        if (bench.count == SYNC_BENCH_OPS) {
+            bench.ops->unlock(&bench.lock);
+            return;
+        }
+        bench.count++;
+        thread->waits[thread->acquired++] = after - before;
+        bench_spin(bench.critical_section);
+        bench.ops->unlock(&bench.lock);
+    }
+}
+
+static void bench_cv_thread(bench_thread_t *thread)
+{
+    while (true) {
+        ccnt_t before = sel4bench_get_cycle_count();
+        sync_bin_sem_wait(&bench.cv_lock);
+        while (bench.turn == 0 && bench.count != SYNC_BENCH_OPS) {
+            sync_cv_wait(&bench.cv_lock, &bench.cv);
+        }
+        ccnt_t after = sel4bench_get_cycle_count();
+        if (bench.count == SYNC_BENCH_OPS) {
+            /* wake everyone else up to finish too */
+            sync_cv_broadcast(&bench.cv);
+            sync_bin_sem_post(&bench.cv_lock);
+            return;
+        }
+        bench.turn = 0;
+        bench.count++;
+        sync_bin_sem_post(&bench.cv_lock);
+        thread->waits[thread->acquired++] = after - before;
+
+        bench_spin(bench.critical_section);
+        sync_bin_sem_wait(&bench.cv_lock);
+        bench.turn = 1;
+        sync_cv_signal(&bench.cv);
+        sync_bin_sem_post(&bench.cv_lock);
+    }
+}
+
+static void bench_contention_thread(void *arg0, UNUSED void *arg1, UNUSED void *ipc_buf)
+{
+    bench_thread_t *thread = arg0;
+
+    seL4_Wait(bench.go_ep, NULL);
+    if (bench.ops != NULL) {
+        bench_lock_thread(thread);
+    } else {
+        bench_cv_thread(thread);
+    }
+    seL4_Signal(thread->done.cptr);
+    seL4_TCB_Suspend(thread->thread.tcb.cptr);
+}
+
+static void bench_histogram(const char *name, size_t num_waits)
+{
+    size_t buckets[SYNC_BENCH_BUCKETS] = {0};
+
+    for (size_t i = 0; i < num_waits; i++) {
+        size_t bucket = 0;
+        while (bucket < SYNC_BENCH_BUCKETS - 1 && bench_waits[i] >= (1ull << (bucket + 1))) {
+            bucket++;
+        }
+        buckets[bucket]++;
+    }
+    printf("sync bench: %s: wait histogram", name);
+    for (size_t i = 0; i < SYNC_BENCH_BUCKETS; i++) {
+        if (buckets[i] != 0) {
+            printf(" %s%llu:%zu", i == SYNC_BENCH_BUCKETS - 1 ? ">=" : "<", 1ull << (i + 1), buckets[i]);
+        }
+    }
+    printf("\n");
+}
+
+static int bench_contention(env_t env, const char *name, size_t num_threads, ccnt_t critical_section)
+{
+    vka_object_t go_ep;
+    char full_name[64];
+    uint64_t sum_x = 0, sum_x2 = 0;
+    size_t num_waits = 0;
+
+    int error = vka_alloc_endpoint(&env->vka, &go_ep);
+    test_error_eq(error, 0);
+    bench.go_ep = go_ep.cptr;
+    bench.critical_section = critical_section;
+    bench.count = 0;
+    bench.turn = 1;
+
+    for (size_t i = 0; i < num_threads; i++) {
+        bench_thread_t *thread = &bench_threads[i];
+        thread->acquired = 0;
+        error = vka_alloc_notification(&env->vka, &thread->done);
+        test_error_eq(error, 0);
+        seL4_Word core = i % MAX(env->cores, 1);
+        error = bench_start_thread(env, thread, core, SYNC_BENCH_PRIO_THREAD, bench_contention_thread);
+        test_error_eq(error, 0);
+    }
+
+    /* Send blocks until a thread is waiting, so none miss the start. */
+    ccnt_t start = sel4bench_get_cycle_count();
+    for (size_t i = 0; i < num_threads; i++) {
+        seL4_Send(go_ep.cptr, seL4_MessageInfo_new(0, 0, 0, 0));
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        seL4_Wait(bench_threads[i].done.cptr, NULL);
+    }
+    ccnt_t end = sel4bench_get_cycle_count();
+
+    for (size_t i = 0; i < num_threads; i++) {
+        bench_thread_t *thread = &bench_threads[i];
+        sum_x += thread->acquired;
+        sum_x2 += (uint64_t) thread->acquired * thread->acquired;
+        memcpy(&bench_waits[num_waits], thread->waits, thread->acquired * sizeof(ccnt_t));
+        num_waits += thread->acquired;
+        sel4utils_clean_up_thread(&env->vka, &env->vspace, &thread->thread);
+        vka_free_object(&env->vka, &thread->done);
+    }
+    vka_free_object(&env->vka, &go_ep);
+    test_eq(num_waits, (size_t) SYNC_BENCH_OPS);
+    qsort(bench_waits, num_waits, sizeof(ccnt_t), bench_compare_ccnt);
+
+    snprintf(full_name, sizeof(full_name), "%s, %zu threads, %llu cycle critical section", name, num_threads,
+             (unsigned long long) critical_section);
+    printf("sync bench: %s: %"PRIu64" acquisitions/Mcycle, wait p50 %"PRIu64" p99 %"PRIu64" cycles, "
+           "fairness %"PRIu64"/1000\n",
+           full_name, end > start ? (uint64_t) num_waits * 1000000 / (end - start) : 0,
+           (uint64_t) bench_waits[num_waits / 2], (uint64_t) bench_waits[num_waits * 99 / 100],
+           sum_x2 > 0 ? sum_x * sum_x * 1000 / (num_threads * sum_x2) : 0);
+    bench_histogram(full_name, num_waits);
+    return SUCCESS;
+}
+
+/* Run all the benchmarks of a lock, or of a condition variable if ops is NULL. A run that
+ * could not be set up stops the rest, failed checks and regressions only fail the test. */
+static int bench_primitive(env_t env, const char *name, const bench_lock_ops_t *ops)
+{
+    int error;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.ops = ops;
+    if (ops != NULL) {
+        error = ops->new(&env->vka, &bench.lock);
+        test_error_eq(error, 0);
+    } else {
+        error = sync_bin_sem_new(&env->vka, &bench.cv_lock, 1);
+        test_error_eq(error, 0);
+        error = sync_cv_new(&env->vka, &bench.cv);
+        test_error_eq(error, 0);
+    }
+
+    bench_uncontended(name);
+    if (bench_handoff(env, name) == SUCCESS) {
+        for (size_t i = 0; i < ARRAY_SIZE(bench_critical_sections); i++) {
+            for (size_t threads = 1; threads <= SYNC_BENCH_MAX_THREADS; threads *= 2) {
+                if (bench_contention(env, name, threads, bench_critical_sections[i]) != SUCCESS) {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (ops != NULL) {
+        ops->destroy(&env->vka, &bench.lock);
+    } else {
+        sync_cv_destroy(&env->vka, &bench.cv);
+        sync_bin_sem_destroy(&env->vka, &bench.cv_lock);
+    }
+    return sel4test_get_result();
+}
+
+static int bench_mutex(env_t env)
+{
+    return bench_primitive(env, "mutex", &bench_mutex_ops);
+}
+DEFINE_BENCHMARK_SUITE(SYNC_BENCH_001, "Cost of sync_mutex_t", bench_mutex)
+
+static int bench_bin_sem(env_t env)
+{
+    return bench_primitive(env, "bin_sem", &bench_bin_sem_ops);
+}
+DEFINE_BENCHMARK_SUITE(SYNC_BENCH_002, "Cost of sync_bin_sem_t", bench_bin_sem)
+
+static int bench_sem(env_t env)
+{
+    return bench_primitive(env, "sem", &bench_sem_ops);
+}
+DEFINE_BENCHMARK_SUITE(SYNC_BENCH_003, "Cost of sync_sem_t", bench_sem)
+
+static int bench_recursive_mutex(env_t env)
+{
+    return bench_primitive(env, "recursive_mutex", &bench_recursive_mutex_ops);
+}
+DEFINE_BENCHMARK_SUITE(SYNC_BENCH_004, "Cost of sync_recursive_mutex_t", bench_recursive_mutex)
+
+static int bench_adaptive_mutex(env_t env)
+{
+    return bench_primitive(env, "adaptive_mutex", &bench_adaptive_mutex_ops);
+}
+DEFINE_BENCHMARK_SUITE(SYNC_BENCH_005, "Cost of sync_adaptive_mutex_t", bench_adaptive_mutex)
+
+static int bench_cv(env_t env)
+{
+    return bench_primitive(env, "cv", NULL);
+}
+DEFINE_BENCHMARK_SUITE(SYNC_BENCH_006, "Cost of sync_cv_t", bench_cv)
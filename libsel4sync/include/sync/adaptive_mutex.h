@@ -0,0 +1,192 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A mutex that spins for a while before blocking. When the holder is running on
+ * another core and about to release the mutex, spinning for it is much cheaper
+ * than blocking on the notification and being woken again. Spinning backs off
+ * exponentially, with the architecture's spin loop hint, and gives up after a
+ * budget of hint iterations that can be set at runtime, or adjusted from how
+ * long previous lock attempts had to spin for. On a single core there is no
+ * point spinning and the budget defaults to 0.
+ */
+
+#include <autoconf.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <sel4/sel4.h>
+#ifdef CONFIG_DEBUG_BUILD
+#include <sel4debug/debug.h>
+#endif
+#include <vka/vka.h>
+#include <vka/object.h>
+#include <stddef.h>
+#include <utils/util.h>
+#include <sync/bin_sem_bare.h>
+#include <sync/spin_hint.h>
+
+#if CONFIG_MAX_NUM_NODES > 1
+#define SYNC_ADAPTIVE_MUTEX_DEFAULT_SPIN 1000
+#else
+#define SYNC_ADAPTIVE_MUTEX_DEFAULT_SPIN 0
+#endif
+/* Most the budget can be set to, or tune itself to */
+#define SYNC_ADAPTIVE_MUTEX_MAX_SPIN 100000
+/* Most hint iterations between two attempts to take the mutex */
+#define SYNC_ADAPTIVE_MUTEX_MAX_BACKOFF 64
+
+typedef struct {
+    vka_object_t notification;
+    /* as for sync_bin_sem_t: 1 when free, 0 when held, and less than 0 when
+     * held and other threads are waiting on the notification */
+    volatile int value;
+    /* hint iterations to spin for before blocking */
+    unsigned int spin_budget;
+    /* whether to adjust spin_budget from how long lock attempts spin for */
+    bool self_tuning;
+} sync_adaptive_mutex_t;
+
+/* Initialise an unmanaged adaptive mutex with a notification object
+ * @param mutex         A mutex object to be initialised.
+ * @param notification  A notification object to block on once spinning gives up.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_adaptive_mutex_init(sync_adaptive_mutex_t *mutex, seL4_CPtr notification)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_adaptive_mutex_init was NULL");
+        return -1;
+    }
+
+#ifdef CONFIG_DEBUG_BUILD
+    /* Check the cap actually is a notification. */
+    assert(debug_cap_is_notification(notification));
+#endif
+
+    mutex->notification.cptr = notification;
+    mutex->value = 1;
+    mutex->spin_budget = SYNC_ADAPTIVE_MUTEX_DEFAULT_SPIN;
+    mutex->self_tuning = false;
+    return 0;
+}
+
+/* Set how long an adaptive mutex spins before blocking
+ * @param mutex         An initialised mutex.
+ * @param spin_budget   Iterations of the spin loop hint to spin for, capped at
+ *                      SYNC_ADAPTIVE_MUTEX_MAX_SPIN. 0 to always block straight away.
+ * @param self_tuning   Whether to adjust the budget from then on towards how long
+ *                      lock attempts have had to spin for, starting from spin_budget.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_adaptive_mutex_set_spin(sync_adaptive_mutex_t *mutex, unsigned int spin_budget,
+                                               bool self_tuning)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_adaptive_mutex_set_spin was NULL");
+        return -1;
+    }
+    __atomic_store_n(&mutex->spin_budget, MIN(spin_budget, SYNC_ADAPTIVE_MUTEX_MAX_SPIN), __ATOMIC_RELAXED);
+    __atomic_store_n(&mutex->self_tuning, self_tuning, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static inline bool sync_adaptive_mutex_try(sync_adaptive_mutex_t *mutex)
+{
+    int val = 1;
+    return __atomic_compare_exchange_n(&mutex->value, &val, 0, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* Acquire an adaptive mutex
+ * @param mutex         An initialised mutex to acquire.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_adaptive_mutex_lock(sync_adaptive_mutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_adaptive_mutex_lock was NULL");
+        return -1;
+    }
+    if (sync_adaptive_mutex_try(mutex)) {
+        return 0;
+    }
+
+    unsigned int budget = __atomic_load_n(&mutex->spin_budget, __ATOMIC_RELAXED);
+    bool self_tuning = __atomic_load_n(&mutex->self_tuning, __ATOMIC_RELAXED);
+    /* A tuned budget is allowed to overshoot, so that it can grow. */
+    unsigned int limit = self_tuning ? MIN(budget * 2 + 10, SYNC_ADAPTIVE_MUTEX_MAX_SPIN) : budget;
+    unsigned int backoff = 1;
+    unsigned int spun = 0;
+    bool acquired = false;
+
+    while (spun < limit) {
+        for (unsigned int i = 0; i < backoff; i++) {
+            sync_spin_hint();
+        }
+        spun += backoff;
+        backoff = MIN(backoff * 2, SYNC_ADAPTIVE_MUTEX_MAX_BACKOFF);
+        /* Only try when it looks free, to keep the cache line shared while
+         * the holder has it. */
+        if (mutex->value == 1 && sync_adaptive_mutex_try(mutex)) {
+            acquired = true;
+            break;
+        }
+    }
+
+    if (self_tuning) {
+        /* Move an eighth of the way towards what this attempt took, which
+         * shrinks the budget for mutexes held too long to be worth spinning for. */
+        int delta = ((int)MIN(spun, limit) - (int)budget) / 8;
+        __atomic_store_n(&mutex->spin_budget, (unsigned int)((int)budget + delta), __ATOMIC_RELAXED);
+    }
+    if (acquired) {
+        return 0;
+    }
+    return sync_bin_sem_bare_wait(mutex->notification.cptr, &mutex->value);
+}
+
+/* Release an adaptive mutex
+ * @param mutex         An initialised mutex to release.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_adaptive_mutex_unlock(sync_adaptive_mutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_adaptive_mutex_unlock was NULL");
+        return -1;
+    }
+    /* Only enters the kernel if someone gave up spinning and blocked. */
+    return sync_bin_sem_bare_post(mutex->notification.cptr, &mutex->value);
+}
+
+/* Allocate and initialise a managed adaptive mutex
+ * @param vka           A VKA instance used to allocate a notification object.
+ * @param mutex         A mutex object to initialise.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_adaptive_mutex_new(vka_t *vka, sync_adaptive_mutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_adaptive_mutex_new was NULL");
+        return -1;
+    }
+    int error = vka_alloc_notification(vka, &(mutex->notification));
+
+    if (error != 0) {
+        return error;
+    } else {
+        return sync_adaptive_mutex_init(mutex, mutex->notification.cptr);
+    }
+}
+
+/* Deallocate a managed adaptive mutex (do not use with sync_adaptive_mutex_init)
+ * @param vka           A VKA instance used to deallocate the notification object.
+ * @param mutex         A mutex object initialised by sync_adaptive_mutex_new.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_adaptive_mutex_destroy(vka_t *vka, sync_adaptive_mutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_adaptive_mutex_destroy was NULL");
+        return -1;
+    }
+    vka_free_object(vka, &(mutex->notification));
+    return 0;
+}
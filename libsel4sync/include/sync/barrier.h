@@ -0,0 +1,235 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A reusable barrier for a fixed number of participants, such as one thread
+ * per core from simple_get_core_count.
+ *
+ * Participants arrive at a tree of counters, SYNC_BARRIER_RADIX to a node,
+ * so that no more than that many contend on any one cache line. The last to
+ * arrive at a node goes on to its parent, and the last to arrive at the root
+ * releases everyone by bumping the episode. Waiters spin on the episode for a
+ * while and then block on the notification for the episode's parity. Two
+ * notifications are needed, as a fast participant can be waiting in the
+ * next episode before a slow one has woken from the last.
+ */
+
+#include <autoconf.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <sel4/sel4.h>
+#ifdef CONFIG_DEBUG_BUILD
+#include <sel4debug/debug.h>
+#endif
+#include <vka/vka.h>
+#include <vka/object.h>
+#include <utils/util.h>
+#include <sync/spin_hint.h>
+
+#define SYNC_BARRIER_RADIX 4
+#define SYNC_BARRIER_CACHE_LINE 64
+
+#if CONFIG_MAX_NUM_NODES > 1
+#define SYNC_BARRIER_DEFAULT_SPIN 1000
+#else
+#define SYNC_BARRIER_DEFAULT_SPIN 0
+#endif
+
+/* Returned by sync_barrier_wait to one participant each episode */
+#define SYNC_BARRIER_SERIAL_THREAD 1
+
+typedef struct {
+    volatile unsigned int count;
+    unsigned int expected;
+    /* index of the parent node, -1 for the root */
+    int parent;
+} __attribute__((aligned(SYNC_BARRIER_CACHE_LINE))) sync_barrier_node_t;
+
+typedef struct {
+    vka_object_t notifications[2];
+    sync_barrier_node_t *nodes;
+    unsigned int participants;
+    /* spin loop hints to wait for before blocking */
+    unsigned int spin;
+    volatile unsigned int episode __attribute__((aligned(SYNC_BARRIER_CACHE_LINE)));
+    /* participants blocked on each notification */
+    volatile unsigned int sleepers[2];
+} sync_barrier_t;
+
+/* Number of nodes needed for a barrier
+ * @param participants  Number of participants.
+ * @return              Nodes to pass to sync_barrier_init. */
+static inline size_t sync_barrier_node_count(unsigned int participants)
+{
+    size_t total = 0;
+    unsigned int level = participants;
+
+    do {
+        level = DIV_ROUND_UP(level, SYNC_BARRIER_RADIX);
+        total += level;
+    } while (level > 1);
+    return total;
+}
+
+/* Initialise an unmanaged barrier
+ * @param barrier       A barrier to be initialised.
+ * @param even          A notification to block on in even episodes.
+ * @param odd           A notification to block on in odd episodes.
+ * @param nodes         sync_barrier_node_count(participants) nodes.
+ * @param participants  Number of participants, which identify as 0 to participants - 1.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_barrier_init(sync_barrier_t *barrier, seL4_CPtr even, seL4_CPtr odd,
+                                    sync_barrier_node_t *nodes, unsigned int participants)
+{
+    if (barrier == NULL || nodes == NULL) {
+        ZF_LOGE("Barrier or nodes passed to sync_barrier_init were NULL");
+        return -1;
+    }
+    if (participants == 0) {
+        ZF_LOGE("Barrier needs at least one participant");
+        return -1;
+    }
+
+#ifdef CONFIG_DEBUG_BUILD
+    /* Check the caps actually are notifications. */
+    assert(debug_cap_is_notification(even));
+    assert(debug_cap_is_notification(odd));
+#endif
+
+    /* Lay the tree out a level at a time from the leaves, each level
+     * counting the nodes of the one below as its children. */
+    size_t offset = 0;
+    unsigned int children = participants;
+    do {
+        unsigned int level = DIV_ROUND_UP(children, SYNC_BARRIER_RADIX);
+        for (unsigned int i = 0; i < level; i++) {
+            sync_barrier_node_t *node = &nodes[offset + i];
+            node->count = 0;
+            node->expected = MIN(SYNC_BARRIER_RADIX, children - i * SYNC_BARRIER_RADIX);
+            node->parent = level > 1 ? (int)(offset + level + i / SYNC_BARRIER_RADIX) : -1;
+        }
+        offset += level;
+        children = level;
+    } while (children > 1);
+
+    barrier->notifications[0].cptr = even;
+    barrier->notifications[1].cptr = odd;
+    barrier->nodes = nodes;
+    barrier->participants = participants;
+    barrier->spin = SYNC_BARRIER_DEFAULT_SPIN;
+    barrier->episode = 0;
+    barrier->sleepers[0] = 0;
+    barrier->sleepers[1] = 0;
+    return 0;
+}
+
+/* Wait for every participant to reach a barrier
+ * @param barrier       An initialised barrier.
+ * @param id            The calling participant, from 0 to participants - 1.
+ * @return              SYNC_BARRIER_SERIAL_THREAD for one participant, 0 for the
+ *                      others, or less than 0 on failure. */
+static inline int sync_barrier_wait(sync_barrier_t *barrier, unsigned int id)
+{
+    if (barrier == NULL || id >= barrier->participants) {
+        ZF_LOGE("Invalid barrier or participant passed to sync_barrier_wait");
+        return -1;
+    }
+
+    /* The episode can't end until we have arrived in it. */
+    unsigned int episode = __atomic_load_n(&barrier->episode, __ATOMIC_ACQUIRE);
+    int parity = episode & 1;
+    sync_barrier_node_t *node = &barrier->nodes[id / SYNC_BARRIER_RADIX];
+
+    for (;;) {
+        if (__atomic_add_fetch(&node->count, 1, __ATOMIC_ACQ_REL) != node->expected) {
+            break;
+        }
+        /* Last here, and nobody arrives again until the episode is over. */
+        __atomic_store_n(&node->count, 0, __ATOMIC_RELAXED);
+        if (node->parent < 0) {
+            __atomic_store_n(&barrier->episode, episode + 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&barrier->sleepers[parity], __ATOMIC_SEQ_CST) > 0) {
+                seL4_Signal(barrier->notifications[parity].cptr);
+            }
+            return SYNC_BARRIER_SERIAL_THREAD;
+        }
+        node = &barrier->nodes[node->parent];
+    }
+
+    for (unsigned int spun = 0; spun < barrier->spin; spun++) {
+        if (__atomic_load_n(&barrier->episode, __ATOMIC_ACQUIRE) != episode) {
+            return 0;
+        }
+        sync_spin_hint();
+    }
+
+    __atomic_fetch_add(&barrier->sleepers[parity], 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&barrier->episode, __ATOMIC_SEQ_CST) == episode) {
+        seL4_Wait(barrier->notifications[parity].cptr, NULL);
+    }
+    /* Signals coalesce, so pass the wake up on to the next sleeper. */
+    if (__atomic_sub_fetch(&barrier->sleepers[parity], 1, __ATOMIC_SEQ_CST) > 0) {
+        seL4_Signal(barrier->notifications[parity].cptr);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return 0;
+}
+
+/* Allocate and initialise a managed barrier
+ * @param vka           A VKA instance used to allocate the notification objects.
+ * @param barrier       A barrier to initialise.
+ * @param participants  Number of participants.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_barrier_new(vka_t *vka, sync_barrier_t *barrier, unsigned int participants)
+{
+    if (barrier == NULL) {
+        ZF_LOGE("Barrier passed to sync_barrier_new was NULL");
+        return -1;
+    }
+    if (participants == 0) {
+        ZF_LOGE("Barrier needs at least one participant");
+        return -1;
+    }
+
+    void *nodes;
+    if (posix_memalign(&nodes, SYNC_BARRIER_CACHE_LINE,
+                       sync_barrier_node_count(participants) * sizeof(sync_barrier_node_t)) != 0) {
+        ZF_LOGE("Failed to allocate barrier nodes");
+        return -1;
+    }
+    int error = vka_alloc_notification(vka, &barrier->notifications[0]);
+    if (error != 0) {
+        free(nodes);
+        return error;
+    }
+    error = vka_alloc_notification(vka, &barrier->notifications[1]);
+    if (error != 0) {
+        vka_free_object(vka, &barrier->notifications[0]);
+        free(nodes);
+        return error;
+    }
+    return sync_barrier_init(barrier, barrier->notifications[0].cptr, barrier->notifications[1].cptr,
+                             nodes, participants);
+}
+
+/* Deallocate a managed barrier (do not use with sync_barrier_init)
+ * @param vka           A VKA instance used to deallocate the notification objects.
+ * @param barrier       A barrier initialised by sync_barrier_new.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_barrier_destroy(vka_t *vka, sync_barrier_t *barrier)
+{
+    if (barrier == NULL) {
+        ZF_LOGE("Barrier passed to sync_barrier_destroy was NULL");
+        return -1;
+    }
+    vka_free_object(vka, &barrier->notifications[0]);
+    vka_free_object(vka, &barrier->notifications[1]);
+    free(barrier->nodes);
+    return 0;
+}
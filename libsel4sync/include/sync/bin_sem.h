@@ -16,10 +16,14 @@
 #include <vka/object.h>
 #include <stddef.h>
 #include <sync/bin_sem_bare.h>
+#include <sync/profile.h>
 
 typedef struct {
     vka_object_t notification;
     volatile int value;
+#ifdef CONFIG_LIB_SEL4_SYNC_PROFILE
+    sync_lock_profile_t profile;
+#endif
 } sync_bin_sem_t;
 
 /* Initialise an unmanaged binary semaphore with a notification object
@@ -46,6 +50,9 @@ static inline int sync_bin_sem_init(sync_bin_sem_t *sem, seL4_CPtr notification,
 
     sem->notification.cptr = notification;
     sem->value = value;
+#ifdef CONFIG_LIB_SEL4_SYNC_PROFILE
+    sync_profile_register(&sem->profile, sem);
+#endif
     return 0;
 }
 
@@ -58,7 +65,17 @@ static inline int sync_bin_sem_wait(sync_bin_sem_t *sem)
         ZF_LOGE("Semaphore passed to sync_bin_sem_wait was NULL");
         return -1;
     }
+#ifdef CONFIG_LIB_SEL4_SYNC_PROFILE
+    bool contended;
+    ccnt_t start = sync_profile_wait_start();
+    int error = sync_bin_sem_bare_wait_contended(sem->notification.cptr, &sem->value, &contended);
+    if (error == 0) {
+        sync_profile_acquired(&sem->profile, start, contended);
+    }
+    return error;
+#else
     return sync_bin_sem_bare_wait(sem->notification.cptr, &sem->value);
+#endif
 }
 
 /* Signal a binary semaphore
@@ -70,6 +87,9 @@ static inline int sync_bin_sem_post(sync_bin_sem_t *sem)
         ZF_LOGE("Semaphore passed to sync_bin_sem_post was NULL");
         return -1;
     }
+#ifdef CONFIG_LIB_SEL4_SYNC_PROFILE
+    sync_profile_releasing(&sem->profile);
+#endif
     return sync_bin_sem_bare_post(sem->notification.cptr, &sem->value);
 }
 
@@ -107,6 +127,9 @@ static inline int sync_bin_sem_destroy(vka_t *vka, sync_bin_sem_t *sem)
         ZF_LOGE("Semaphore passed to sync_bin_sem_destroy was NULL");
         return -1;
     }
+#ifdef CONFIG_LIB_SEL4_SYNC_PROFILE
+    sync_profile_unregister(&sem->profile);
+#endif
     vka_free_object(vka, &(sem->notification));
     return 0;
 }
@@ -13,17 +13,21 @@
  */
 
 #include <assert.h>
+#include <stdbool.h>
 #include <sel4/sel4.h>
 #include <stddef.h>
 #include <platsupport/sync/atomic.h>
 
-static inline int sync_bin_sem_bare_wait(seL4_CPtr notification, volatile int *value) {
+/* As sync_bin_sem_bare_wait, also saying whether the caller had to block */
+static inline int sync_bin_sem_bare_wait_contended(seL4_CPtr notification, volatile int *value,
+                                                   bool *contended) {
     int oldval;
     int result = sync_atomic_decrement_safe(value, &oldval, __ATOMIC_ACQUIRE);
     if (result != 0) {
         /* Failed decrement; too many outstanding lock holders. */
         return -1;
     }
+    *contended = oldval <= 0;
     if (oldval <= 0) {
         seL4_Wait(notification, NULL);
         /* Even though we performed an acquire barrier during the atomic
@@ -34,6 +38,11 @@ static inline int sync_bin_sem_bare_wait(seL4_CPtr notification, volatile int *v
     return 0;
 }
 
+static inline int sync_bin_sem_bare_wait(seL4_CPtr notification, volatile int *value) {
+    bool contended;
+    return sync_bin_sem_bare_wait_contended(notification, value, &contended);
+}
+
 static inline int sync_bin_sem_bare_post(seL4_CPtr notification, volatile int *value) {
     /* We can do an "unsafe" increment here because we know we are the only
      * lock holder.
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A one-shot latch: threads wait until it has been counted down to zero,
+ * after which it stays open. Waiters spin for a while and then block on the
+ * notification, and the count down that opens the latch wakes them. As
+ * signals coalesce, each woken waiter passes the wake up on to the next.
+ */
+
+#include <autoconf.h>
+#include <assert.h>
+#include <stddef.h>
+#include <sel4/sel4.h>
+#ifdef CONFIG_DEBUG_BUILD
+#include <sel4debug/debug.h>
+#endif
+#include <vka/vka.h>
+#include <vka/object.h>
+#include <utils/util.h>
+#include <sync/spin_hint.h>
+
+#if CONFIG_MAX_NUM_NODES > 1
+#define SYNC_LATCH_DEFAULT_SPIN 1000
+#else
+#define SYNC_LATCH_DEFAULT_SPIN 0
+#endif
+
+typedef struct {
+    vka_object_t notification;
+    volatile int count;
+    /* threads blocked on the notification */
+    volatile unsigned int sleepers;
+    /* spin loop hints to wait for before blocking */
+    unsigned int spin;
+} sync_latch_t;
+
+/* Initialise an unmanaged latch
+ * @param latch         A latch to be initialised.
+ * @param notification  A notification object for waiters to block on.
+ * @param count         Number of count downs that open the latch.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_latch_init(sync_latch_t *latch, seL4_CPtr notification, int count)
+{
+    if (latch == NULL) {
+        ZF_LOGE("Latch passed to sync_latch_init was NULL");
+        return -1;
+    }
+    if (count < 0) {
+        ZF_LOGE("Latch count must not be negative");
+        return -1;
+    }
+
+#ifdef CONFIG_DEBUG_BUILD
+    /* Check the cap actually is a notification. */
+    assert(debug_cap_is_notification(notification));
+#endif
+
+    latch->notification.cptr = notification;
+    latch->count = count;
+    latch->sleepers = 0;
+    latch->spin = SYNC_LATCH_DEFAULT_SPIN;
+    return 0;
+}
+
+/* Count a latch down, opening it when the count reaches zero
+ * @param latch         An initialised latch.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_latch_count_down(sync_latch_t *latch)
+{
+    if (latch == NULL) {
+        ZF_LOGE("Latch passed to sync_latch_count_down was NULL");
+        return -1;
+    }
+
+    int count = __atomic_sub_fetch(&latch->count, 1, __ATOMIC_SEQ_CST);
+    if (count < 0) {
+        ZF_LOGE("Latch counted down below zero");
+        return -1;
+    }
+    if (count == 0 && __atomic_load_n(&latch->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        seL4_Signal(latch->notification.cptr);
+    }
+    return 0;
+}
+
+/* Wait for a latch to open
+ * @param latch         An initialised latch.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_latch_wait(sync_latch_t *latch)
+{
+    if (latch == NULL) {
+        ZF_LOGE("Latch passed to sync_latch_wait was NULL");
+        return -1;
+    }
+
+    for (unsigned int spun = 0; spun < latch->spin; spun++) {
+        if (__atomic_load_n(&latch->count, __ATOMIC_ACQUIRE) <= 0) {
+            return 0;
+        }
+        sync_spin_hint();
+    }
+
+    __atomic_fetch_add(&latch->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&latch->count, __ATOMIC_SEQ_CST) > 0) {
+        seL4_Wait(latch->notification.cptr, NULL);
+    }
+    if (__atomic_sub_fetch(&latch->sleepers, 1, __ATOMIC_SEQ_CST) > 0) {
+        seL4_Signal(latch->notification.cptr);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return 0;
+}
+
+/* Allocate and initialise a managed latch
+ * @param vka           A VKA instance used to allocate a notification object.
+ * @param latch         A latch to initialise.
+ * @param count         Number of count downs that open the latch.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_latch_new(vka_t *vka, sync_latch_t *latch, int count)
+{
+    if (latch == NULL) {
+        ZF_LOGE("Latch passed to sync_latch_new was NULL");
+        return -1;
+    }
+    int error = vka_alloc_notification(vka, &(latch->notification));
+
+    if (error != 0) {
+        return error;
+    } else {
+        return sync_latch_init(latch, latch->notification.cptr, count);
+    }
+}
+
+/* Deallocate a managed latch (do not use with sync_latch_init)
+ * @param vka           A VKA instance used to deallocate the notification object.
+ * @param latch         A latch initialised by sync_latch_new.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_latch_destroy(vka_t *vka, sync_latch_t *latch)
+{
+    if (latch == NULL) {
+        ZF_LOGE("Latch passed to sync_latch_destroy was NULL");
+        return -1;
+    }
+    vka_free_object(vka, &(latch->notification));
+    return 0;
+}
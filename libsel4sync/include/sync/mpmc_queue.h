@@ -0,0 +1,198 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A bounded lock-free queue of words for any number of producers and
+ * consumers, after Dmitry Vyukov's. Each cell has a sequence number that says
+ * whether it is ready to be written or read for the current lap of the
+ * queue, so producers and consumers only contend on their own index and on
+ * the cell they claim with it.
+ *
+ * The queue is plain memory with no pointers in it, so it can live in memory
+ * shared between processes, as long as the words put in it mean the same to
+ * both sides. The blocking calls take each process's own notification caps,
+ * see queue_wait.h.
+ */
+
+#include <autoconf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+#include <utils/util.h>
+#include <sync/queue_wait.h>
+
+typedef struct {
+    volatile size_t sequence;
+    seL4_Word value;
+} sync_mpmc_cell_t;
+
+typedef struct {
+    size_t mask;
+    volatile size_t enqueue_pos __attribute__((aligned(SYNC_QUEUE_CACHE_LINE)));
+    volatile size_t dequeue_pos __attribute__((aligned(SYNC_QUEUE_CACHE_LINE)));
+    volatile unsigned int waiting_producers __attribute__((aligned(SYNC_QUEUE_CACHE_LINE)));
+    volatile unsigned int waiting_consumers;
+    sync_mpmc_cell_t cells[] __attribute__((aligned(SYNC_QUEUE_CACHE_LINE)));
+} sync_mpmc_queue_t;
+
+/* Bytes of memory needed for a queue
+ * @param capacity      Number of words the queue holds, a power of 2.
+ * @return              Size of the queue. */
+static inline size_t sync_mpmc_queue_size(size_t capacity)
+{
+    return sizeof(sync_mpmc_queue_t) + capacity * sizeof(sync_mpmc_cell_t);
+}
+
+/* Initialise a queue, before any other thread or process uses it
+ * @param queue         Memory for the queue, of sync_mpmc_queue_size(capacity) bytes.
+ * @param capacity      Number of words the queue holds, a power of 2 of at least 2.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_mpmc_queue_init(sync_mpmc_queue_t *queue, size_t capacity)
+{
+    if (queue == NULL) {
+        ZF_LOGE("Queue passed to sync_mpmc_queue_init was NULL");
+        return -1;
+    }
+    if (capacity < 2 || !IS_POWER_OF_2(capacity)) {
+        ZF_LOGE("Queue capacity %zu is not a power of 2 of at least 2", capacity);
+        return -1;
+    }
+
+    queue->mask = capacity - 1;
+    for (size_t i = 0; i < capacity; i++) {
+        queue->cells[i].sequence = i;
+    }
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+    queue->waiting_producers = 0;
+    queue->waiting_consumers = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Add a word to a queue without blocking
+ * @param queue         An initialised queue.
+ * @param value         The word to add.
+ * @return              true if it was added, false if the queue is full. */
+static inline bool sync_mpmc_queue_try_enqueue(sync_mpmc_queue_t *queue, seL4_Word value)
+{
+    sync_mpmc_cell_t *cell;
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            /* the cell still holds a word from the previous lap */
+            return false;
+        } else {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->value = value;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Take a word from a queue without blocking
+ * @param queue         An initialised queue.
+ * @param[out] value    The word taken.
+ * @return              true if a word was taken, false if the queue is empty. */
+static inline bool sync_mpmc_queue_try_dequeue(sync_mpmc_queue_t *queue, seL4_Word *value)
+{
+    sync_mpmc_cell_t *cell;
+    size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        size_t seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (dif < 0) {
+            /* nothing has been written to the cell this lap */
+            return false;
+        } else {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    *value = cell->value;
+    __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Add a word to a queue, blocking while it is full
+ * @param queue         An initialised queue.
+ * @param ntfns         This process's caps to the queue's notifications.
+ * @param value         The word to add.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_mpmc_queue_enqueue(sync_mpmc_queue_t *queue, const sync_queue_notifications_t *ntfns,
+                                          seL4_Word value)
+{
+    if (queue == NULL || ntfns == NULL) {
+        ZF_LOGE("Queue or notifications passed to sync_mpmc_queue_enqueue were NULL");
+        return -1;
+    }
+
+    if (!sync_mpmc_queue_try_enqueue(queue, value)) {
+        bool done;
+        do {
+            sync_queue_start_waiting(&queue->waiting_producers);
+            done = sync_mpmc_queue_try_enqueue(queue, value);
+            if (!done) {
+                seL4_Wait(ntfns->not_full, NULL);
+                done = sync_mpmc_queue_try_enqueue(queue, value);
+            }
+            sync_queue_stop_waiting(&queue->waiting_producers);
+        } while (!done);
+        sync_queue_wake(&queue->waiting_producers, ntfns->not_full);
+    }
+    sync_queue_wake(&queue->waiting_consumers, ntfns->not_empty);
+    return 0;
+}
+
+/* Take a word from a queue, blocking while it is empty
+ * @param queue         An initialised queue.
+ * @param ntfns         This process's caps to the queue's notifications.
+ * @param[out] value    The word taken.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_mpmc_queue_dequeue(sync_mpmc_queue_t *queue, const sync_queue_notifications_t *ntfns,
+                                          seL4_Word *value)
+{
+    if (queue == NULL || ntfns == NULL || value == NULL) {
+        ZF_LOGE("Queue, notifications or value passed to sync_mpmc_queue_dequeue were NULL");
+        return -1;
+    }
+
+    if (!sync_mpmc_queue_try_dequeue(queue, value)) {
+        bool done;
+        do {
+            sync_queue_start_waiting(&queue->waiting_consumers);
+            done = sync_mpmc_queue_try_dequeue(queue, value);
+            if (!done) {
+                seL4_Wait(ntfns->not_empty, NULL);
+                done = sync_mpmc_queue_try_dequeue(queue, value);
+            }
+            sync_queue_stop_waiting(&queue->waiting_consumers);
+        } while (!done);
+        sync_queue_wake(&queue->waiting_consumers, ntfns->not_empty);
+    }
+    sync_queue_wake(&queue->waiting_producers, ntfns->not_full);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A mutex that lends the priority of a waiter to the holder.
+ *
+ * Uncontended, it is a word taken and released with one atomic operation,
+ * as for sync_bin_sem_t. A thread that has to wait raises the holder to its
+ * own priority, if that is higher than any other waiter has, and blocks with
+ * seL4_Call on the mutex's endpoint. The releasing thread takes the call
+ * with seL4_Recv, drops back to its own priority and hands the mutex over by
+ * replying. Under CONFIG_KERNEL_MCS endpoint queues are ordered by priority,
+ * so the mutex always goes to the highest priority waiter next.
+ *
+ * Raising another thread's priority needs a cap to its TCB, so each thread
+ * locking the mutex registers its TCB and priority first with
+ * sync_pi_mutex_thread_init, and all of them must share a cspace. A thread
+ * that has not registered can still use the mutex, it is just not raised or
+ * raising. Priorities are lent on a best effort basis: a thread holding
+ * several of these mutexes goes back to its own priority when releasing
+ * any of them that it was raised for.
+ */
+
+#include <autoconf.h>
+#include <sel4/sel4.h>
+#include <vka/vka.h>
+#include <vka/object.h>
+
+typedef struct {
+    vka_object_t endpoint;
+    /* for the releasing thread to take a waiter's call with */
+    vka_object_t reply;
+    /* as for sync_bin_sem_t: 1 when free, 0 when held, and less than 0 when
+     * held and other threads are waiting on the endpoint */
+    volatile int value;
+    /* TCB and own priority of the holder, if it has registered */
+    volatile seL4_CPtr owner_tcb;
+    volatile seL4_Word owner_priority;
+    /* highest priority lent to the holder, 0 if none has been */
+    volatile seL4_Word lent_priority;
+} sync_pi_mutex_t;
+
+/* Register the calling thread for priority lending
+ * @param tcb           The calling thread's TCB, with an MCP of at least priority.
+ * @param priority      The thread's own priority.
+ * @return              0 on success, an error code on failure. */
+int sync_pi_mutex_thread_init(seL4_CPtr tcb, seL4_Word priority);
+
+/* Initialise an unmanaged mutex
+ * @param mutex         A mutex object to be initialised.
+ * @param endpoint      An endpoint object for waiters to block on.
+ * @param reply         A reply object for the releasing thread to receive
+ *                      with on MCS kernels, seL4_CapNull otherwise.
+ * @return              0 on success, an error code on failure. */
+int sync_pi_mutex_init(sync_pi_mutex_t *mutex, seL4_CPtr endpoint, seL4_CPtr reply);
+
+/* Acquire a mutex, lending the holder the caller's priority while waiting
+ * @param mutex         An initialised mutex to acquire.
+ * @return              0 on success, an error code on failure. */
+int sync_pi_mutex_lock(sync_pi_mutex_t *mutex);
+
+/* Release a mutex, handing it to the highest priority waiter if there is one
+ * @param mutex         An initialised mutex to release.
+ * @return              0 on success, an error code on failure. */
+int sync_pi_mutex_unlock(sync_pi_mutex_t *mutex);
+
+/* Allocate and initialise a managed mutex
+ * @param vka           A VKA instance used to allocate the endpoint and reply objects.
+ * @param mutex         A mutex object to initialise.
+ * @return              0 on success, an error code on failure. */
+int sync_pi_mutex_new(vka_t *vka, sync_pi_mutex_t *mutex);
+
+/* Deallocate a managed mutex (do not use with sync_pi_mutex_init)
+ * @param vka           A VKA instance used to deallocate the objects.
+ * @param mutex         A mutex object initialised by sync_pi_mutex_new.
+ * @return              0 on success, an error code on failure. */
+int sync_pi_mutex_destroy(vka_t *vka, sync_pi_mutex_t *mutex);
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Contention profiling of sync_bin_sem_t and sync_mutex_t, built with
+ * LibSel4SyncProfile.
+ *
+ * Each lock keeps a count of acquires and of acquires that had to block,
+ * the cycles spent blocked and the most cycles it was held for at a time,
+ * all updated by the holder so without atomics. Locks register themselves
+ * in a table when initialised, which sync_profile_scrape reports the same
+ * way as profile_scrape of sel4utils/profile.h does its variables, and which
+ * profile_scrape includes. Cycles come from sel4bench_get_cycle_count, so
+ * sel4bench_init must have been called where user level cannot read the
+ * cycle counter by default.
+ */
+
+#include <autoconf.h>
+#include <sel4sync/gen_config.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef CONFIG_LIB_SEL4_SYNC_PROFILE
+#include <sel4bench/sel4bench.h>
+
+#define SYNC_PROFILE_NAME_LEN 32
+
+typedef struct sync_lock_profile {
+    char name[SYNC_PROFILE_NAME_LEN];
+    uint64_t acquires;
+    uint64_t contended;
+    uint64_t wait_cycles;
+    uint64_t max_hold_cycles;
+    /* when the current holder got the lock */
+    ccnt_t acquired_at;
+    struct sync_lock_profile *next;
+    struct sync_lock_profile **pprev;
+} sync_lock_profile_t;
+
+/* Add a lock to the table, named after its address until sync_profile_name is called */
+void sync_profile_register(sync_lock_profile_t *profile, void *lock);
+
+/* Take a lock out of the table, before it is destroyed */
+void sync_profile_unregister(sync_lock_profile_t *profile);
+
+/* Give a lock a name to be reported under */
+void sync_profile_name(sync_lock_profile_t *profile, const char *name);
+
+static inline ccnt_t sync_profile_wait_start(void)
+{
+    return sel4bench_get_cycle_count();
+}
+
+/* Called by the new holder once it has the lock */
+static inline void sync_profile_acquired(sync_lock_profile_t *profile, ccnt_t wait_start, bool contended)
+{
+    ccnt_t now = sel4bench_get_cycle_count();
+
+    profile->acquires++;
+    if (contended) {
+        profile->contended++;
+        profile->wait_cycles += now - wait_start;
+    }
+    profile->acquired_at = now;
+}
+
+/* Called by the holder just before releasing the lock */
+static inline void sync_profile_releasing(sync_lock_profile_t *profile)
+{
+    /* A semaphore can be posted by a thread that never waited on it. */
+    if (profile->acquired_at != 0) {
+        uint64_t held = sel4bench_get_cycle_count() - profile->acquired_at;
+
+        if (held > profile->max_hold_cycles) {
+            profile->max_hold_cycles = held;
+        }
+        profile->acquired_at = 0;
+    }
+}
+#endif /* CONFIG_LIB_SEL4_SYNC_PROFILE */
+
+typedef void (*sync_profile_callback64)(uint64_t value, const char *varname, const char *description,
+                                        void *cookie);
+
+/* Call back with each statistic of each registered lock, with the lock's
+ * name as varname. Does nothing unless built with LibSel4SyncProfile. */
+void sync_profile_scrape(sync_profile_callback64 callback64, void *cookie);
+
+/* Zero the statistics of every registered lock */
+void sync_profile_reset(void);
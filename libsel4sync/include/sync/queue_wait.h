@@ -0,0 +1,51 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Blocking for the lock-free queues in mpmc_queue.h and spsc_channel.h.
+ *
+ * The queues themselves only hold plain memory, so that they can be put in
+ * memory shared between processes, and each process brings its own caps to
+ * the two notifications. A thread that finds a queue full or empty counts
+ * itself as waiting in the queue, tries again and only then blocks, and the
+ * other side only signals when it sees someone waiting. As signals coalesce,
+ * a thread that blocked passes the wake up on once it has got through, in
+ * case another thread is still blocked on the same notification.
+ */
+
+#include <autoconf.h>
+#include <sel4/sel4.h>
+
+/* Cache line the indices of a queue are kept apart by */
+#define SYNC_QUEUE_CACHE_LINE 64
+
+typedef struct {
+    /* signalled when something is added, waited on when empty */
+    seL4_CPtr not_empty;
+    /* signalled when something is removed, waited on when full */
+    seL4_CPtr not_full;
+} sync_queue_notifications_t;
+
+static inline void sync_queue_wake(volatile unsigned int *waiting, seL4_CPtr notification)
+{
+    /* Orders the change to the queue before the check, against the waiter
+     * counting itself before trying again. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) > 0) {
+        seL4_Signal(notification);
+    }
+}
+
+static inline void sync_queue_start_waiting(volatile unsigned int *waiting)
+{
+    __atomic_fetch_add(waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void sync_queue_stop_waiting(volatile unsigned int *waiting)
+{
+    __atomic_fetch_sub(waiting, 1, __ATOMIC_RELAXED);
+}
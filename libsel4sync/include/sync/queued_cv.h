@@ -0,0 +1,243 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A condition variable for sync_qmutex_t that keeps a queue of its waiters.
+ *
+ * Signalling and broadcasting do not wake anyone. The waiters are moved off
+ * the condition variable and onto the end of the mutex's queue (wait
+ * morphing), and each wakes up when the mutex is handed to it, already
+ * holding it. A broadcast to N waiters is then a single splice instead of N
+ * threads waking up to fight over the mutex, and each waiter costs one
+ * signal, made by whoever hands the mutex on.
+ *
+ * The waiter queue is protected by the mutex, so signal and broadcast must
+ * be called with it held. sync_qcv_wait_timeout gives up after a timeout set
+ * on an ltimer, such as a client of the time server in
+ * sel4utils/time_server/client.h.
+ */
+
+#include <autoconf.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+#include <platsupport/ltimer.h>
+#include <utils/util.h>
+#include <sync/queued_mutex.h>
+
+/* cv_state of a node on a condition variable */
+#define SYNC_QCV_WAITING    0
+/* moved onto the mutex, which will be handed to it */
+#define SYNC_QCV_REQUEUED   1
+/* the waiter gave up, and will lock the mutex itself */
+#define SYNC_QCV_TIMED_OUT  2
+
+typedef struct {
+    sync_qnode_t *head;
+    sync_qnode_t *tail;
+} sync_qcv_t;
+
+/* Initialise a queued condition variable, which needs no kernel objects of its own
+ * @param cv            A condition variable object to be initialised.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qcv_init(sync_qcv_t *cv)
+{
+    if (cv == NULL) {
+        ZF_LOGE("Condition variable passed to sync_qcv_init is NULL");
+        return -1;
+    }
+    cv->head = NULL;
+    cv->tail = NULL;
+    return 0;
+}
+
+static inline void sync_qcv_enqueue(sync_qcv_t *cv, sync_qnode_t *node)
+{
+    node->cv_state = SYNC_QCV_WAITING;
+    /* Only the thread handing the mutex over sets this again. */
+    node->granted = 0;
+    node->cv_next = NULL;
+    node->cv_prev = cv->tail;
+    if (cv->tail != NULL) {
+        cv->tail->cv_next = node;
+    } else {
+        cv->head = node;
+    }
+    cv->tail = node;
+    node->on_cv = true;
+}
+
+static inline void sync_qcv_unlink(sync_qcv_t *cv, sync_qnode_t *node)
+{
+    if (node->cv_prev != NULL) {
+        node->cv_prev->cv_next = node->cv_next;
+    } else {
+        cv->head = node->cv_next;
+    }
+    if (node->cv_next != NULL) {
+        node->cv_next->cv_prev = node->cv_prev;
+    } else {
+        cv->tail = node->cv_prev;
+    }
+    node->on_cv = false;
+}
+
+/* Take a waiter off the condition variable to requeue it, unless it has timed out */
+static inline bool sync_qcv_claim(sync_qcv_t *cv, sync_qnode_t *node)
+{
+    int expected = SYNC_QCV_WAITING;
+
+    sync_qcv_unlink(cv, node);
+    return __atomic_compare_exchange_n(&node->cv_state, &expected, SYNC_QCV_REQUEUED, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* Wait on a queued condition variable.
+ * This assumes that you already hold the mutex with node, and blocks until
+ * notified by sync_qcv_signal or sync_qcv_broadcast. It returns once you hold
+ * the mutex again, with the same node. The condition should still be checked
+ * again after sync_qcv_wait returns, as another thread may have changed it
+ * before the mutex got to this one.
+ * @param cv            The condition variable to wait on.
+ * @param mutex         The mutex on the monitor.
+ * @param node          The node the mutex is held with.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qcv_wait(sync_qcv_t *cv, sync_qmutex_t *mutex, sync_qnode_t *node)
+{
+    if (cv == NULL || node == NULL) {
+        ZF_LOGE("Condition variable or node passed to sync_qcv_wait is NULL");
+        return -1;
+    }
+
+    sync_qcv_enqueue(cv, node);
+    int error = sync_qmutex_unlock(mutex, node);
+    if (error != 0) {
+        return error;
+    }
+    sync_qmutex_block(node);
+    return 0;
+}
+
+/* Wait on a queued condition variable for at most ns nanoseconds.
+ * As for sync_qcv_wait, but the waiter gives up once the timeout has passed
+ * and it has not been signalled yet. Either way it returns with the mutex
+ * held. A waiter that has been signalled already only waits for the threads
+ * ahead of it in the mutex's queue.
+ * @param cv            The condition variable to wait on.
+ * @param mutex         The mutex on the monitor.
+ * @param node          The node the mutex is held with.
+ * @param timer         A timer used by this thread only, which signals the
+ *                      notification of node when its timeout fires.
+ * @param ns            How long to wait for.
+ * @return              0 when signalled, ETIMEDOUT if the timeout passed
+ *                      first, another error code on failure. */
+static inline int sync_qcv_wait_timeout(sync_qcv_t *cv, sync_qmutex_t *mutex, sync_qnode_t *node,
+                                        ltimer_t *timer, uint64_t ns)
+{
+    if (cv == NULL || node == NULL || timer == NULL) {
+        ZF_LOGE("Condition variable, node or timer passed to sync_qcv_wait_timeout is NULL");
+        return -1;
+    }
+
+    uint64_t now;
+    int error = ltimer_get_time(timer, &now);
+    if (error != 0) {
+        return error;
+    }
+    uint64_t deadline = now + ns;
+    error = ltimer_set_timeout(timer, deadline, TIMEOUT_ABSOLUTE);
+    if (error != 0) {
+        return error;
+    }
+
+    sync_qcv_enqueue(cv, node);
+    error = sync_qmutex_unlock(mutex, node);
+    if (error != 0) {
+        return error;
+    }
+
+    while (!__atomic_load_n(&node->granted, __ATOMIC_ACQUIRE)) {
+        seL4_Wait(node->notification.cptr, NULL);
+        if (__atomic_load_n(&node->granted, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        /* The wake up may be left over from an earlier timeout. */
+        if (ltimer_get_time(timer, &now) != 0 || now < deadline) {
+            continue;
+        }
+        int expected = SYNC_QCV_WAITING;
+        if (__atomic_compare_exchange_n(&node->cv_state, &expected, SYNC_QCV_TIMED_OUT, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            /* Nobody will requeue us now, so get the mutex ourselves and
+             * leave the condition variable if a signaller hasn't seen us. */
+            error = sync_qmutex_lock(mutex, node);
+            if (error != 0) {
+                return error;
+            }
+            if (node->on_cv) {
+                sync_qcv_unlink(cv, node);
+            }
+            return ETIMEDOUT;
+        }
+        /* Signalled just in time, the mutex is on its way. */
+    }
+    return 0;
+}
+
+/* Signal a queued condition variable.
+ * Moves the first waiter onto the mutex, which is handed to it once the
+ * calling thread and any threads already waiting for it have released it.
+ * @param cv            The condition variable to signal.
+ * @param mutex         The mutex on the monitor, held by the calling thread.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qcv_signal(sync_qcv_t *cv, sync_qmutex_t *mutex)
+{
+    if (cv == NULL || mutex == NULL) {
+        ZF_LOGE("Condition variable or mutex passed to sync_qcv_signal is NULL");
+        return -1;
+    }
+
+    sync_qnode_t *node;
+    while ((node = cv->head) != NULL) {
+        if (sync_qcv_claim(cv, node)) {
+            sync_qmutex_requeue(mutex, node, node);
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Broadcast to a queued condition variable.
+ * Moves every waiter onto the mutex in the order they started waiting,
+ * without waking any of them.
+ * @param cv            The condition variable to broadcast to.
+ * @param mutex         The mutex on the monitor, held by the calling thread.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qcv_broadcast(sync_qcv_t *cv, sync_qmutex_t *mutex)
+{
+    if (cv == NULL || mutex == NULL) {
+        ZF_LOGE("Condition variable or mutex passed to sync_qcv_broadcast is NULL");
+        return -1;
+    }
+
+    sync_qnode_t *first = NULL, *last = NULL, *node;
+    while ((node = cv->head) != NULL) {
+        if (sync_qcv_claim(cv, node)) {
+            if (last != NULL) {
+                last->next = node;
+            } else {
+                first = node;
+            }
+            last = node;
+        }
+    }
+    if (first != NULL) {
+        sync_qmutex_requeue(mutex, first, last);
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A mutex with a queue of waiters, in the style of an MCS lock. Each thread
+ * brings a node with a notification of its own, waiters queue their nodes
+ * behind the tail, and the lock is handed to the next waiter in order by
+ * signalling only that waiter's notification. Taking or releasing the mutex
+ * without contention is a single atomic operation and no syscall.
+ *
+ * Because the waiters are an explicit queue, sync_qcv_t can move threads
+ * waiting on a condition variable straight onto it, see queued_cv.h.
+ *
+ * A thread releasing the mutex while another is between joining the queue
+ * and linking itself in yields until the link appears. On a single core this
+ * relies on the joining thread being able to run when the releaser yields.
+ */
+
+#include <autoconf.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sel4/sel4.h>
+#ifdef CONFIG_DEBUG_BUILD
+#include <sel4debug/debug.h>
+#endif
+#include <vka/vka.h>
+#include <vka/object.h>
+#include <utils/util.h>
+
+typedef struct sync_qnode {
+    /* notification of the thread that owns the node, signalled when the
+     * mutex is handed to it */
+    vka_object_t notification;
+    /* next waiter in the mutex's queue */
+    struct sync_qnode *volatile next;
+    /* set by the releasing thread once the mutex is handed to this node */
+    volatile int granted;
+    /* used by sync_qcv_t while the thread waits on a condition variable */
+    volatile int cv_state;
+    struct sync_qnode *cv_next;
+    struct sync_qnode *cv_prev;
+    bool on_cv;
+} sync_qnode_t;
+
+typedef struct {
+    /* last node in the queue, the holder's if nobody is waiting, NULL when free */
+    sync_qnode_t *volatile tail;
+} sync_qmutex_t;
+
+/* Initialise an unmanaged queue node
+ * @param node          A node to be initialised, used by one thread at a time.
+ * @param notification  A notification object the thread using the node blocks on.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qnode_init(sync_qnode_t *node, seL4_CPtr notification)
+{
+    if (node == NULL) {
+        ZF_LOGE("Node passed to sync_qnode_init was NULL");
+        return -1;
+    }
+
+#ifdef CONFIG_DEBUG_BUILD
+    /* Check the cap actually is a notification. */
+    assert(debug_cap_is_notification(notification));
+#endif
+
+    node->notification.cptr = notification;
+    node->next = NULL;
+    node->granted = 0;
+    node->cv_next = NULL;
+    node->cv_prev = NULL;
+    node->on_cv = false;
+    return 0;
+}
+
+/* Allocate and initialise a managed queue node
+ * @param vka           A VKA instance used to allocate a notification object.
+ * @param node          A node to initialise.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qnode_new(vka_t *vka, sync_qnode_t *node)
+{
+    if (node == NULL) {
+        ZF_LOGE("Node passed to sync_qnode_new was NULL");
+        return -1;
+    }
+    int error = vka_alloc_notification(vka, &(node->notification));
+
+    if (error != 0) {
+        return error;
+    } else {
+        return sync_qnode_init(node, node->notification.cptr);
+    }
+}
+
+/* Deallocate a managed queue node (do not use with sync_qnode_init)
+ * @param vka           A VKA instance used to deallocate the notification object.
+ * @param node          A node initialised by sync_qnode_new, not in use.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qnode_destroy(vka_t *vka, sync_qnode_t *node)
+{
+    if (node == NULL) {
+        ZF_LOGE("Node passed to sync_qnode_destroy was NULL");
+        return -1;
+    }
+    vka_free_object(vka, &(node->notification));
+    return 0;
+}
+
+/* Initialise a queued mutex, which needs no kernel objects of its own
+ * @param mutex         A mutex object to be initialised.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qmutex_init(sync_qmutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_qmutex_init was NULL");
+        return -1;
+    }
+    mutex->tail = NULL;
+    return 0;
+}
+
+/* Block until the mutex has been handed to a node that is in its queue.
+ * Signals left over from earlier uses of the notification are ignored. */
+static inline void sync_qmutex_block(sync_qnode_t *node)
+{
+    while (!__atomic_load_n(&node->granted, __ATOMIC_ACQUIRE)) {
+        seL4_Wait(node->notification.cptr, NULL);
+    }
+}
+
+/* Try to acquire a queued mutex without waiting
+ * @param mutex         An initialised mutex to acquire.
+ * @param node          The calling thread's node, which must not be in use.
+ * @return              true if the mutex is now held with node. */
+static inline bool sync_qmutex_try(sync_qmutex_t *mutex, sync_qnode_t *node)
+{
+    sync_qnode_t *expected = NULL;
+
+    node->next = NULL;
+    node->granted = 1;
+    return __atomic_compare_exchange_n(&mutex->tail, &expected, node, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* Acquire a queued mutex
+ * @param mutex         An initialised mutex to acquire.
+ * @param node          The calling thread's node, which must not be in use. It
+ *                      stays in use until the mutex is released with it.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qmutex_lock(sync_qmutex_t *mutex, sync_qnode_t *node)
+{
+    if (mutex == NULL || node == NULL) {
+        ZF_LOGE("Mutex or node passed to sync_qmutex_lock was NULL");
+        return -1;
+    }
+
+    node->next = NULL;
+    node->granted = 0;
+    sync_qnode_t *prev = __atomic_exchange_n(&mutex->tail, node, __ATOMIC_ACQ_REL);
+    if (prev == NULL) {
+        node->granted = 1;
+        return 0;
+    }
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+    sync_qmutex_block(node);
+    return 0;
+}
+
+/* Release a queued mutex, handing it to the first waiter if there is one
+ * @param mutex         A mutex held by the calling thread.
+ * @param node          The node the mutex was acquired with. It is free to
+ *                      be reused once this returns.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_qmutex_unlock(sync_qmutex_t *mutex, sync_qnode_t *node)
+{
+    if (mutex == NULL || node == NULL) {
+        ZF_LOGE("Mutex or node passed to sync_qmutex_unlock was NULL");
+        return -1;
+    }
+
+    sync_qnode_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (next == NULL) {
+        sync_qnode_t *expected = node;
+        if (__atomic_compare_exchange_n(&mutex->tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+        /* Someone has joined the queue but not yet linked themselves in. */
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {
+            seL4_Yield();
+        }
+    }
+
+    /* node must not be touched once the next thread may run with the mutex. */
+    seL4_CPtr notification = next->notification.cptr;
+    __atomic_store_n(&next->granted, 1, __ATOMIC_RELEASE);
+    seL4_Signal(notification);
+    return 0;
+}
+
+/* Add a chain of nodes, linked by next from first to last, to the end of the
+ * queue of a mutex held by the calling thread. Each is handed the mutex in
+ * turn as if it had called sync_qmutex_lock, without anyone being woken now.
+ * The nodes' granted must be 0. */
+static inline void sync_qmutex_requeue(sync_qmutex_t *mutex, sync_qnode_t *first, sync_qnode_t *last)
+{
+    last->next = NULL;
+    sync_qnode_t *prev = __atomic_exchange_n(&mutex->tail, last, __ATOMIC_ACQ_REL);
+    /* The caller holds the mutex, so the queue is never empty here. */
+    assert(prev != NULL);
+    __atomic_store_n(&prev->next, first, __ATOMIC_RELEASE);
+}
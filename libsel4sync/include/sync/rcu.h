@@ -0,0 +1,246 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Read-copy-update with quiescent state based reclamation.
+ *
+ * Readers follow pointers published with sync_rcu_assign_pointer using
+ * sync_rcu_dereference, without taking any lock. Each reading thread
+ * registers a sync_rcu_reader_t, and calls sync_rcu_quiescent whenever it
+ * holds no pointers into the protected data, such as between packets. That
+ * only writes the reader's own cache line, and only when the epoch has moved
+ * on since it last did. A thread that stops reading for a while goes offline
+ * so that it doesn't hold up writers.
+ *
+ * A writer replaces data by publishing a new version, and then either calls
+ * sync_rcu_synchronize, which blocks on the notification until every online
+ * reader has passed a quiescent point, or hands the old version to
+ * sync_rcu_defer to be freed by the next synchronize. Writers must be
+ * serialised by the caller, for example with a sync_mutex_t.
+ */
+
+#include <autoconf.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sel4/sel4.h>
+#ifdef CONFIG_DEBUG_BUILD
+#include <sel4debug/debug.h>
+#endif
+#include <vka/vka.h>
+#include <vka/object.h>
+#include <utils/util.h>
+
+#define SYNC_RCU_CACHE_LINE 64
+/* epoch of a reader that is offline */
+#define SYNC_RCU_OFFLINE 0
+
+/* Read a pointer published with sync_rcu_assign_pointer */
+#define sync_rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+/* Publish a pointer, after the data it points to has been written */
+#define sync_rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+typedef struct sync_rcu_reader {
+    /* last epoch the reader was quiescent in, SYNC_RCU_OFFLINE when offline */
+    volatile seL4_Word epoch __attribute__((aligned(SYNC_RCU_CACHE_LINE)));
+    struct sync_rcu_reader *next;
+} sync_rcu_reader_t;
+
+struct sync_rcu_deferred;
+typedef void (*sync_rcu_free_fn_t)(struct sync_rcu_deferred *deferred);
+
+/* Embedded in data handed to sync_rcu_defer */
+typedef struct sync_rcu_deferred {
+    struct sync_rcu_deferred *next;
+    sync_rcu_free_fn_t free;
+} sync_rcu_deferred_t;
+
+typedef struct {
+    vka_object_t notification;
+    volatile seL4_Word epoch;
+    /* number of writers in sync_rcu_synchronize, that readers signal */
+    volatile unsigned int synchronizing;
+    sync_rcu_reader_t *volatile readers;
+    sync_rcu_deferred_t *deferred;
+} sync_rcu_t;
+
+/* Initialise an unmanaged RCU domain with a notification object
+ * @param rcu           A domain to be initialised.
+ * @param notification  A notification object for writers to wait on readers with.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rcu_init(sync_rcu_t *rcu, seL4_CPtr notification)
+{
+    if (rcu == NULL) {
+        ZF_LOGE("RCU domain passed to sync_rcu_init was NULL");
+        return -1;
+    }
+
+#ifdef CONFIG_DEBUG_BUILD
+    /* Check the cap actually is a notification. */
+    assert(debug_cap_is_notification(notification));
+#endif
+
+    rcu->notification.cptr = notification;
+    rcu->epoch = 1;
+    rcu->synchronizing = 0;
+    rcu->readers = NULL;
+    rcu->deferred = NULL;
+    return 0;
+}
+
+static inline void sync_rcu_announce(sync_rcu_t *rcu, sync_rcu_reader_t *reader, seL4_Word epoch)
+{
+    __atomic_store_n(&reader->epoch, epoch, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&rcu->synchronizing, __ATOMIC_SEQ_CST) > 0) {
+        seL4_Signal(rcu->notification.cptr);
+    }
+}
+
+/* Register a reading thread, which starts online
+ * @param rcu           An initialised domain.
+ * @param reader        State of the reader, used by the calling thread only.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rcu_register(sync_rcu_t *rcu, sync_rcu_reader_t *reader)
+{
+    if (rcu == NULL || reader == NULL) {
+        ZF_LOGE("RCU domain or reader passed to sync_rcu_register was NULL");
+        return -1;
+    }
+
+    reader->epoch = __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST);
+    sync_rcu_reader_t *head = __atomic_load_n(&rcu->readers, __ATOMIC_RELAXED);
+    do {
+        reader->next = head;
+    } while (!__atomic_compare_exchange_n(&rcu->readers, &head, reader, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return 0;
+}
+
+/* Say that the calling reader holds no pointers into the protected data
+ * @param rcu           An initialised domain.
+ * @param reader        The calling thread's registered reader. */
+static inline void sync_rcu_quiescent(sync_rcu_t *rcu, sync_rcu_reader_t *reader)
+{
+    seL4_Word epoch = __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST);
+
+    if (reader->epoch != epoch) {
+        sync_rcu_announce(rcu, reader, epoch);
+    }
+}
+
+/* Stop reading for a while, so that writers don't wait for this reader
+ * @param rcu           An initialised domain.
+ * @param reader        The calling thread's registered reader. */
+static inline void sync_rcu_offline(sync_rcu_t *rcu, sync_rcu_reader_t *reader)
+{
+    sync_rcu_announce(rcu, reader, SYNC_RCU_OFFLINE);
+}
+
+/* Start reading again after sync_rcu_offline
+ * @param rcu           An initialised domain.
+ * @param reader        The calling thread's registered reader. */
+static inline void sync_rcu_online(sync_rcu_t *rcu, sync_rcu_reader_t *reader)
+{
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&rcu->epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    /* Pointers must not be read before writers can see we are online. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* Hand data that has been unpublished to be freed once no reader can hold
+ * a pointer to it, by the next sync_rcu_synchronize
+ * @param rcu           An initialised domain.
+ * @param deferred      Embedded in the data to free.
+ * @param fn            Called to free it. */
+static inline void sync_rcu_defer(sync_rcu_t *rcu, sync_rcu_deferred_t *deferred, sync_rcu_free_fn_t fn)
+{
+    deferred->free = fn;
+    deferred->next = rcu->deferred;
+    rcu->deferred = deferred;
+}
+
+static inline bool sync_rcu_readers_passed(sync_rcu_t *rcu, sync_rcu_reader_t *self, seL4_Word target)
+{
+    for (sync_rcu_reader_t *reader = __atomic_load_n(&rcu->readers, __ATOMIC_ACQUIRE);
+         reader != NULL; reader = reader->next) {
+        seL4_Word epoch = __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST);
+        if (reader != self && epoch != SYNC_RCU_OFFLINE && (long)(epoch - target) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Wait until every online reader has passed a quiescent point, and free
+ * everything deferred before the call.
+ * @param rcu           An initialised domain.
+ * @param self          The calling thread's reader if it has one, which is
+ *                      taken to be quiescent, otherwise NULL.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rcu_synchronize(sync_rcu_t *rcu, sync_rcu_reader_t *self)
+{
+    if (rcu == NULL) {
+        ZF_LOGE("RCU domain passed to sync_rcu_synchronize was NULL");
+        return -1;
+    }
+
+    sync_rcu_deferred_t *deferred = rcu->deferred;
+    rcu->deferred = NULL;
+
+    seL4_Word target = rcu->epoch + 1;
+    if (target == SYNC_RCU_OFFLINE) {
+        target++;
+    }
+    __atomic_store_n(&rcu->epoch, target, __ATOMIC_SEQ_CST);
+
+    __atomic_fetch_add(&rcu->synchronizing, 1, __ATOMIC_SEQ_CST);
+    while (!sync_rcu_readers_passed(rcu, self, target)) {
+        /* Readers signal every time they pass a quiescent point while we
+         * are here, so check them all again each time. */
+        seL4_Wait(rcu->notification.cptr, NULL);
+    }
+    __atomic_fetch_sub(&rcu->synchronizing, 1, __ATOMIC_SEQ_CST);
+
+    while (deferred != NULL) {
+        sync_rcu_deferred_t *next = deferred->next;
+        deferred->free(deferred);
+        deferred = next;
+    }
+    return 0;
+}
+
+/* Allocate and initialise a managed RCU domain
+ * @param vka           A VKA instance used to allocate a notification object.
+ * @param rcu           A domain to initialise.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rcu_new(vka_t *vka, sync_rcu_t *rcu)
+{
+    if (rcu == NULL) {
+        ZF_LOGE("RCU domain passed to sync_rcu_new was NULL");
+        return -1;
+    }
+    int error = vka_alloc_notification(vka, &(rcu->notification));
+
+    if (error != 0) {
+        return error;
+    } else {
+        return sync_rcu_init(rcu, rcu->notification.cptr);
+    }
+}
+
+/* Deallocate a managed RCU domain (do not use with sync_rcu_init)
+ * @param vka           A VKA instance used to deallocate the notification object.
+ * @param rcu           A domain initialised by sync_rcu_new.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rcu_destroy(vka_t *vka, sync_rcu_t *rcu)
+{
+    if (rcu == NULL) {
+        ZF_LOGE("RCU domain passed to sync_rcu_destroy was NULL");
+        return -1;
+    }
+    vka_free_object(vka, &(rcu->notification));
+    return 0;
+}
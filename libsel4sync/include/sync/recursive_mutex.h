@@ -12,6 +12,10 @@
  * Note that the address of your IPC buffer is used as a thread ID so if you
  * have a situation where threads share an IPC buffer or do not have a valid
  * IPC buffer, these locks will not work for you.
+ *
+ * An atomic count of lock holders and waiters is kept alongside the
+ * notification, so locking and unlocking a mutex that no other thread wants
+ * does not enter the kernel.
  */
 
 #pragma once
@@ -27,6 +31,9 @@ typedef struct {
     vka_object_t notification;
     void *owner;
     unsigned int held;
+    /* 1 when free, 0 when held, and less than 0 when held and other threads
+     * are waiting on the notification */
+    volatile int value;
 } sync_recursive_mutex_t;
 
 /* Initialise an unmanaged recursive mutex with a notification object
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A writer preferring reader-writer lock.
+ *
+ * The whole state of the lock is one atomic word, so taking and releasing it
+ * for reading is a single compare and swap while no writer holds it or is
+ * waiting for it. Once a writer is waiting, new readers wait behind it, so a
+ * stream of readers can't starve writers.
+ *
+ * Waiting readers and writers block on notifications of their own, and the
+ * lock is handed over to them directly by whoever releases it: a writer
+ * releasing the lock hands it to the next waiting writer if there is one, or
+ * else to all waiting readers at once; the last reader out hands it to a
+ * waiting writer. A notification can't count signals, so waiting readers are
+ * woken one after another, each signalling the next, and there is never more
+ * than one signal outstanding.
+ */
+
+#include <autoconf.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+#ifdef CONFIG_DEBUG_BUILD
+#include <sel4debug/debug.h>
+#endif
+#include <vka/vka.h>
+#include <vka/object.h>
+#include <stddef.h>
+
+/* Fields of the state word */
+#define SYNC_RWLOCK_READERS_SHIFT           0
+#define SYNC_RWLOCK_READERS_BITS            12
+#define SYNC_RWLOCK_WAITING_READERS_SHIFT   12
+#define SYNC_RWLOCK_WAITING_READERS_BITS    11
+#define SYNC_RWLOCK_WAITING_WRITERS_SHIFT   23
+#define SYNC_RWLOCK_WAITING_WRITERS_BITS    8
+#define SYNC_RWLOCK_WRITER                  ((uint32_t)1 << 31)
+
+#define SYNC_RWLOCK_FIELD(state, name) \
+    (((state) >> SYNC_RWLOCK_##name##_SHIFT) & (((uint32_t)1 << SYNC_RWLOCK_##name##_BITS) - 1))
+#define SYNC_RWLOCK_ONE(name) ((uint32_t)1 << SYNC_RWLOCK_##name##_SHIFT)
+#define SYNC_RWLOCK_MAX(name) (((uint32_t)1 << SYNC_RWLOCK_##name##_BITS) - 1)
+
+typedef struct {
+    vka_object_t reader_notification;
+    vka_object_t writer_notification;
+    /* readers holding the lock, readers and writers waiting for it, and
+     * whether a writer holds it */
+    volatile uint32_t state;
+    /* readers still to be woken after the lock was handed to the readers
+     * waiting for it, only touched by whoever is waking them */
+    volatile uint32_t readers_to_wake;
+} sync_rwlock_t;
+
+/* Initialise an unmanaged reader-writer lock with two notification objects
+ * @param lock          A lock object to be initialised.
+ * @param reader_notification  A notification object for readers to wait on.
+ * @param writer_notification  A notification object for writers to wait on.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rwlock_init(sync_rwlock_t *lock, seL4_CPtr reader_notification,
+                                   seL4_CPtr writer_notification)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_rwlock_init was NULL");
+        return -1;
+    }
+
+#ifdef CONFIG_DEBUG_BUILD
+    /* Check the caps actually are notifications. */
+    assert(debug_cap_is_notification(reader_notification));
+    assert(debug_cap_is_notification(writer_notification));
+#endif
+
+    lock->reader_notification.cptr = reader_notification;
+    lock->writer_notification.cptr = writer_notification;
+    lock->state = 0;
+    lock->readers_to_wake = 0;
+    return 0;
+}
+
+/* Try to acquire a reader-writer lock for reading without waiting
+ * @param lock          An initialised lock to acquire.
+ * @return              0 if the lock was acquired, -1 if it is held or wanted by a writer. */
+static inline int sync_rwlock_tryrdlock(sync_rwlock_t *lock)
+{
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+
+    while (!(state & SYNC_RWLOCK_WRITER) && SYNC_RWLOCK_FIELD(state, WAITING_WRITERS) == 0
+           && SYNC_RWLOCK_FIELD(state, READERS) < SYNC_RWLOCK_MAX(READERS)) {
+        if (__atomic_compare_exchange_n(&lock->state, &state, state + SYNC_RWLOCK_ONE(READERS), true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Acquire a reader-writer lock for reading
+ * @param lock          An initialised lock to acquire.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rwlock_rdlock(sync_rwlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_rwlock_rdlock was NULL");
+        return -1;
+    }
+
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    while (true) {
+        uint32_t new_state;
+        bool wait = (state & SYNC_RWLOCK_WRITER) || SYNC_RWLOCK_FIELD(state, WAITING_WRITERS) > 0;
+
+        if (wait) {
+            if (SYNC_RWLOCK_FIELD(state, WAITING_READERS) == SYNC_RWLOCK_MAX(WAITING_READERS)) {
+                /* Too many waiting readers. */
+                return -1;
+            }
+            new_state = state + SYNC_RWLOCK_ONE(WAITING_READERS);
+        } else {
+            if (SYNC_RWLOCK_FIELD(state, READERS) == SYNC_RWLOCK_MAX(READERS)) {
+                /* Too many readers. */
+                return -1;
+            }
+            new_state = state + SYNC_RWLOCK_ONE(READERS);
+        }
+        if (!__atomic_compare_exchange_n(&lock->state, &state, new_state, true,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (!wait) {
+            return 0;
+        }
+
+        /* The lock is ours once we are woken, pass the wake up on to the
+         * next reader the lock was handed to along with us. */
+        seL4_Wait(lock->reader_notification.cptr, NULL);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint32_t to_wake = __atomic_load_n(&lock->readers_to_wake, __ATOMIC_RELAXED);
+        if (to_wake > 0) {
+            __atomic_store_n(&lock->readers_to_wake, to_wake - 1, __ATOMIC_RELAXED);
+            seL4_Signal(lock->reader_notification.cptr);
+        }
+        return 0;
+    }
+}
+
+/* Release a reader-writer lock that was acquired for reading
+ * @param lock          An initialised lock to release.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rwlock_rdunlock(sync_rwlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_rwlock_rdunlock was NULL");
+        return -1;
+    }
+
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    uint32_t new_state;
+    bool hand_over;
+    do {
+        assert(SYNC_RWLOCK_FIELD(state, READERS) > 0);
+        assert(!(state & SYNC_RWLOCK_WRITER));
+        new_state = state - SYNC_RWLOCK_ONE(READERS);
+        /* The last reader out hands the lock to a waiting writer. */
+        hand_over = SYNC_RWLOCK_FIELD(state, READERS) == 1
+                    && SYNC_RWLOCK_FIELD(state, WAITING_WRITERS) > 0;
+        if (hand_over) {
+            new_state = (new_state - SYNC_RWLOCK_ONE(WAITING_WRITERS)) | SYNC_RWLOCK_WRITER;
+        }
+    } while (!__atomic_compare_exchange_n(&lock->state, &state, new_state, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (hand_over) {
+        seL4_Signal(lock->writer_notification.cptr);
+    }
+    return 0;
+}
+
+/* Try to acquire a reader-writer lock for writing without waiting
+ * @param lock          An initialised lock to acquire.
+ * @return              0 if the lock was acquired, -1 if it is held. */
+static inline int sync_rwlock_trywrlock(sync_rwlock_t *lock)
+{
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+
+    while (!(state & SYNC_RWLOCK_WRITER) && SYNC_RWLOCK_FIELD(state, READERS) == 0) {
+        if (__atomic_compare_exchange_n(&lock->state, &state, state | SYNC_RWLOCK_WRITER, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Acquire a reader-writer lock for writing
+ * @param lock          An initialised lock to acquire.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rwlock_wrlock(sync_rwlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_rwlock_wrlock was NULL");
+        return -1;
+    }
+
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    while (true) {
+        uint32_t new_state;
+        bool wait = (state & SYNC_RWLOCK_WRITER) || SYNC_RWLOCK_FIELD(state, READERS) > 0;
+
+        if (wait) {
+            if (SYNC_RWLOCK_FIELD(state, WAITING_WRITERS) == SYNC_RWLOCK_MAX(WAITING_WRITERS)) {
+                /* Too many waiting writers. */
+                return -1;
+            }
+            new_state = state + SYNC_RWLOCK_ONE(WAITING_WRITERS);
+        } else {
+            new_state = state | SYNC_RWLOCK_WRITER;
+        }
+        if (!__atomic_compare_exchange_n(&lock->state, &state, new_state, true,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (wait) {
+            /* The lock is ours once we are woken. */
+            seL4_Wait(lock->writer_notification.cptr, NULL);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        }
+        return 0;
+    }
+}
+
+/* Release a reader-writer lock that was acquired for writing
+ * @param lock          An initialised lock to release.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rwlock_wrunlock(sync_rwlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_rwlock_wrunlock was NULL");
+        return -1;
+    }
+
+    uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+    uint32_t new_state, readers;
+    do {
+        assert(state & SYNC_RWLOCK_WRITER);
+        assert(SYNC_RWLOCK_FIELD(state, READERS) == 0);
+        readers = 0;
+        if (SYNC_RWLOCK_FIELD(state, WAITING_WRITERS) > 0) {
+            /* Writers first: the lock stays held, by the next writer. */
+            new_state = state - SYNC_RWLOCK_ONE(WAITING_WRITERS);
+        } else {
+            /* Every waiting reader gets the lock at once. */
+            readers = SYNC_RWLOCK_FIELD(state, WAITING_READERS);
+            new_state = (state & ~SYNC_RWLOCK_WRITER) - readers * SYNC_RWLOCK_ONE(WAITING_READERS)
+                        + readers * SYNC_RWLOCK_ONE(READERS);
+        }
+    } while (!__atomic_compare_exchange_n(&lock->state, &state, new_state, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    if (new_state & SYNC_RWLOCK_WRITER) {
+        seL4_Signal(lock->writer_notification.cptr);
+    } else if (readers > 0) {
+        /* No reader can unlock, and so no writer can get in and hand the
+         * lock to readers again, before every reader has been woken. */
+        __atomic_store_n(&lock->readers_to_wake, readers - 1, __ATOMIC_RELAXED);
+        seL4_Signal(lock->reader_notification.cptr);
+    }
+    return 0;
+}
+
+/* Allocate and initialise a managed reader-writer lock
+ * @param vka           A VKA instance used to allocate the notification objects.
+ * @param lock          A lock object to initialise.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rwlock_new(vka_t *vka, sync_rwlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_rwlock_new was NULL");
+        return -1;
+    }
+    int error = vka_alloc_notification(vka, &(lock->reader_notification));
+    if (error != 0) {
+        return error;
+    }
+    error = vka_alloc_notification(vka, &(lock->writer_notification));
+    if (error != 0) {
+        vka_free_object(vka, &(lock->reader_notification));
+        return error;
+    }
+    return sync_rwlock_init(lock, lock->reader_notification.cptr, lock->writer_notification.cptr);
+}
+
+/* Deallocate a managed reader-writer lock (do not use with sync_rwlock_init)
+ * @param vka           A VKA instance used to deallocate the notification objects.
+ * @param lock          A lock object initialised by sync_rwlock_new.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_rwlock_destroy(vka_t *vka, sync_rwlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_rwlock_destroy was NULL");
+        return -1;
+    }
+    vka_free_object(vka, &(lock->reader_notification));
+    vka_free_object(vka, &(lock->writer_notification));
+    return 0;
+}
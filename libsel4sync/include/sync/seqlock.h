@@ -0,0 +1,112 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A sequence lock, for data that is read much more often than it is written.
+ *
+ * Readers write nothing: they note the sequence number, read the data, and
+ * retry if a writer was part way through or got in meanwhile. Writers make
+ * the sequence number odd while they update the data, and wait for each
+ * other by spinning, so write sections should be short.
+ *
+ *     unsigned int seq;
+ *     do {
+ *         seq = sync_seqlock_read_begin(&lock);
+ *         copy = table;
+ *     } while (sync_seqlock_read_retry(&lock, seq));
+ *
+ * A reader can see a torn copy of the data before it retries, so it must
+ * not follow pointers it read until sync_seqlock_read_retry has said that
+ * the copy is good.
+ */
+
+#include <autoconf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sel4/sel4.h>
+#include <utils/util.h>
+
+typedef struct {
+    /* odd while a writer is updating the data */
+    volatile unsigned int sequence;
+} sync_seqlock_t;
+
+/* Initialise a sequence lock
+ * @param lock          A lock to be initialised.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_seqlock_init(sync_seqlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_seqlock_init was NULL");
+        return -1;
+    }
+    lock->sequence = 0;
+    return 0;
+}
+
+/* Start reading the data protected by a sequence lock
+ * @param lock          An initialised lock.
+ * @return              The sequence number to pass to sync_seqlock_read_retry. */
+static inline unsigned int sync_seqlock_read_begin(sync_seqlock_t *lock)
+{
+    unsigned int seq;
+
+    while ((seq = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        seL4_Yield();
+    }
+    return seq;
+}
+
+/* Finish reading the data protected by a sequence lock
+ * @param lock          An initialised lock.
+ * @param seq           The value sync_seqlock_read_begin returned.
+ * @return              true if the data was written meanwhile and has to be read again. */
+static inline bool sync_seqlock_read_retry(sync_seqlock_t *lock, unsigned int seq)
+{
+    /* Orders the reads of the data before checking the sequence again. */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+/* Start writing the data protected by a sequence lock, waiting for any other writer
+ * @param lock          An initialised lock.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_seqlock_write_lock(sync_seqlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_seqlock_write_lock was NULL");
+        return -1;
+    }
+
+    unsigned int seq = __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED);
+    for (;;) {
+        if (!(seq & 1) && __atomic_compare_exchange_n(&lock->sequence, &seq, seq + 1, true,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+        if (seq & 1) {
+            seL4_Yield();
+            seq = __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED);
+        }
+    }
+    /* Readers must see the odd sequence before any of the new data. */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Finish writing the data protected by a sequence lock
+ * @param lock          A lock held for writing by the calling thread.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_seqlock_write_unlock(sync_seqlock_t *lock)
+{
+    if (lock == NULL) {
+        ZF_LOGE("Lock passed to sync_seqlock_write_unlock was NULL");
+        return -1;
+    }
+    __atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELEASE);
+    return 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <autoconf.h>
+
+/* Tell the core that we are spinning, so that it can save power or let
+ * another hardware thread run */
+static inline void sync_spin_hint(void)
+{
+#if defined(CONFIG_ARCH_X86)
+    __asm__ __volatile__("pause" ::: "memory");
+#elif defined(CONFIG_ARCH_ARM)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+#endif
+}
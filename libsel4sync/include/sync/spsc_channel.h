@@ -0,0 +1,165 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* A bounded lock-free channel of words from one producer to one consumer.
+ *
+ * The producer only writes head and the consumer only writes tail, each on a
+ * cache line of its own along with that side's last look at the other's
+ * index, so neither needs to read the other's line again until the channel
+ * looks full or empty. Like sync_mpmc_queue_t the channel is plain memory
+ * that can be shared between processes, and blocking uses the notifications
+ * of queue_wait.h.
+ */
+
+#include <autoconf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sel4/sel4.h>
+#include <utils/util.h>
+#include <sync/queue_wait.h>
+
+typedef struct {
+    size_t mask;
+    /* written by the producer */
+    volatile size_t head __attribute__((aligned(SYNC_QUEUE_CACHE_LINE)));
+    size_t producer_tail;
+    /* written by the consumer */
+    volatile size_t tail __attribute__((aligned(SYNC_QUEUE_CACHE_LINE)));
+    size_t consumer_head;
+    volatile unsigned int waiting_producers __attribute__((aligned(SYNC_QUEUE_CACHE_LINE)));
+    volatile unsigned int waiting_consumers;
+    seL4_Word slots[] __attribute__((aligned(SYNC_QUEUE_CACHE_LINE)));
+} sync_spsc_channel_t;
+
+/* Bytes of memory needed for a channel
+ * @param capacity      Number of words the channel holds, a power of 2.
+ * @return              Size of the channel. */
+static inline size_t sync_spsc_channel_size(size_t capacity)
+{
+    return sizeof(sync_spsc_channel_t) + capacity * sizeof(seL4_Word);
+}
+
+/* Initialise a channel, before either side uses it
+ * @param channel       Memory for the channel, of sync_spsc_channel_size(capacity) bytes.
+ * @param capacity      Number of words the channel holds, a power of 2.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_spsc_channel_init(sync_spsc_channel_t *channel, size_t capacity)
+{
+    if (channel == NULL) {
+        ZF_LOGE("Channel passed to sync_spsc_channel_init was NULL");
+        return -1;
+    }
+    if (capacity == 0 || !IS_POWER_OF_2(capacity)) {
+        ZF_LOGE("Channel capacity %zu is not a power of 2", capacity);
+        return -1;
+    }
+
+    channel->mask = capacity - 1;
+    channel->head = 0;
+    channel->producer_tail = 0;
+    channel->tail = 0;
+    channel->consumer_head = 0;
+    channel->waiting_producers = 0;
+    channel->waiting_consumers = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Send a word without blocking, from the producer only
+ * @param channel       An initialised channel.
+ * @param value         The word to send.
+ * @return              true if it was sent, false if the channel is full. */
+static inline bool sync_spsc_channel_try_send(sync_spsc_channel_t *channel, seL4_Word value)
+{
+    size_t head = channel->head;
+
+    if (head - channel->producer_tail > channel->mask) {
+        channel->producer_tail = __atomic_load_n(&channel->tail, __ATOMIC_ACQUIRE);
+        if (head - channel->producer_tail > channel->mask) {
+            return false;
+        }
+    }
+    channel->slots[head & channel->mask] = value;
+    __atomic_store_n(&channel->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Receive a word without blocking, from the consumer only
+ * @param channel       An initialised channel.
+ * @param[out] value    The word received.
+ * @return              true if a word was received, false if the channel is empty. */
+static inline bool sync_spsc_channel_try_recv(sync_spsc_channel_t *channel, seL4_Word *value)
+{
+    size_t tail = channel->tail;
+
+    if (tail == channel->consumer_head) {
+        channel->consumer_head = __atomic_load_n(&channel->head, __ATOMIC_ACQUIRE);
+        if (tail == channel->consumer_head) {
+            return false;
+        }
+    }
+    *value = channel->slots[tail & channel->mask];
+    __atomic_store_n(&channel->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Send a word, blocking while the channel is full
+ * @param channel       An initialised channel.
+ * @param ntfns         This process's caps to the channel's notifications.
+ * @param value         The word to send.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_spsc_channel_send(sync_spsc_channel_t *channel, const sync_queue_notifications_t *ntfns,
+                                         seL4_Word value)
+{
+    if (channel == NULL || ntfns == NULL) {
+        ZF_LOGE("Channel or notifications passed to sync_spsc_channel_send were NULL");
+        return -1;
+    }
+
+    /* With a single producer nobody else can be blocked on not_full, so
+     * there is no wake up to pass on. */
+    while (!sync_spsc_channel_try_send(channel, value)) {
+        sync_queue_start_waiting(&channel->waiting_producers);
+        if (!sync_spsc_channel_try_send(channel, value)) {
+            seL4_Wait(ntfns->not_full, NULL);
+            sync_queue_stop_waiting(&channel->waiting_producers);
+            continue;
+        }
+        sync_queue_stop_waiting(&channel->waiting_producers);
+        break;
+    }
+    sync_queue_wake(&channel->waiting_consumers, ntfns->not_empty);
+    return 0;
+}
+
+/* Receive a word, blocking while the channel is empty
+ * @param channel       An initialised channel.
+ * @param ntfns         This process's caps to the channel's notifications.
+ * @param[out] value    The word received.
+ * @return              0 on success, an error code on failure. */
+static inline int sync_spsc_channel_recv(sync_spsc_channel_t *channel, const sync_queue_notifications_t *ntfns,
+                                         seL4_Word *value)
+{
+    if (channel == NULL || ntfns == NULL || value == NULL) {
+        ZF_LOGE("Channel, notifications or value passed to sync_spsc_channel_recv were NULL");
+        return -1;
+    }
+
+    while (!sync_spsc_channel_try_recv(channel, value)) {
+        sync_queue_start_waiting(&channel->waiting_consumers);
+        if (!sync_spsc_channel_try_recv(channel, value)) {
+            seL4_Wait(ntfns->not_empty, NULL);
+            sync_queue_stop_waiting(&channel->waiting_consumers);
+            continue;
+        }
+        sync_queue_stop_waiting(&channel->waiting_consumers);
+        break;
+    }
+    sync_queue_wake(&channel->waiting_producers, ntfns->not_full);
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Waiting on arbitrary words of memory, in the style of a futex.
+ *
+ * Instead of a notification per lock, a process has one table of
+ * SYNC_WAIT_BUCKETS buckets, each with a notification, and a thread waiting
+ * on a word blocks on the bucket its address hashes to. Locks and other
+ * primitives can then be a single word of memory, and only need a kernel
+ * object between them all.
+ *
+ * As for a futex, sync_wait can return without a matching sync_wake, so
+ * callers check their word again and wait again if need be. Words whose
+ * addresses share a bucket wake each other up more often than they need to.
+ */
+
+#include <autoconf.h>
+#include <vka/vka.h>
+#include <utils/util.h>
+
+/* log2 of the number of buckets in the table */
+#define SYNC_WAIT_BUCKET_BITS 6
+#define SYNC_WAIT_BUCKETS BIT(SYNC_WAIT_BUCKET_BITS)
+
+/* Set up the process's table of buckets, before any thread waits
+ * @param vka           A VKA instance used to allocate the notification objects.
+ * @return              0 on success, an error code on failure. */
+int sync_wait_init(vka_t *vka);
+
+/* Free the process's table of buckets, once no thread is waiting
+ * @param vka           The VKA instance passed to sync_wait_init.
+ * @return              0 on success, an error code on failure. */
+int sync_wait_destroy(vka_t *vka);
+
+/* Block while a word holds a value
+ * @param addr          The word to wait on.
+ * @param expected      The value to wait while addr holds, checked
+ *                      atomically with starting to wait.
+ * @return              0 once woken, which may be spuriously, EAGAIN if addr
+ *                      did not hold expected, another error code on failure. */
+int sync_wait(volatile int *addr, int expected);
+
+/* Wake threads waiting on a word, to be called after changing it
+ * @param addr          The word to wake waiters of.
+ * @param n             Most threads waiting on addr to wake, INT_MAX for all.
+ * @return              0 on success, an error code on failure. */
+int sync_wake(volatile int *addr, int n);
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sync/pi_mutex.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <sel4/sel4.h>
+#ifdef CONFIG_DEBUG_BUILD
+#include <sel4debug/debug.h>
+#endif
+#include <utils/util.h>
+
+static __thread seL4_CPtr self_tcb;
+static __thread seL4_Word self_priority;
+
+int sync_pi_mutex_thread_init(seL4_CPtr tcb, seL4_Word priority)
+{
+    if (tcb == seL4_CapNull) {
+        ZF_LOGE("TCB passed to sync_pi_mutex_thread_init is null");
+        return -1;
+    }
+    self_tcb = tcb;
+    self_priority = priority;
+    return 0;
+}
+
+int sync_pi_mutex_init(sync_pi_mutex_t *mutex, seL4_CPtr endpoint, seL4_CPtr reply)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_pi_mutex_init is NULL");
+        return -1;
+    }
+#ifdef CONFIG_DEBUG_BUILD
+    /* Check the cap actually is an endpoint. */
+    assert(debug_cap_is_endpoint(endpoint));
+#endif
+#ifdef CONFIG_KERNEL_MCS
+    if (reply == seL4_CapNull) {
+        ZF_LOGE("Mutex needs a reply object on MCS kernels");
+        return -1;
+    }
+#endif
+
+    mutex->endpoint.cptr = endpoint;
+    mutex->reply.cptr = reply;
+    mutex->value = 1;
+    mutex->owner_tcb = seL4_CapNull;
+    mutex->owner_priority = 0;
+    mutex->lent_priority = 0;
+    return 0;
+}
+
+static void set_owner(sync_pi_mutex_t *mutex)
+{
+    __atomic_store_n(&mutex->owner_priority, self_priority, __ATOMIC_RELAXED);
+    __atomic_store_n(&mutex->owner_tcb, self_tcb, __ATOMIC_RELEASE);
+}
+
+/* Raise the holder to our priority, if no waiter has raised it higher */
+static void lend_priority(sync_pi_mutex_t *mutex)
+{
+    if (self_tcb == seL4_CapNull) {
+        return;
+    }
+
+    seL4_Word lent = __atomic_load_n(&mutex->lent_priority, __ATOMIC_RELAXED);
+    do {
+        if (lent >= self_priority) {
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&mutex->lent_priority, &lent, self_priority, true,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    seL4_CPtr owner = __atomic_load_n(&mutex->owner_tcb, __ATOMIC_SEQ_CST);
+    seL4_Word owner_priority = __atomic_load_n(&mutex->owner_priority, __ATOMIC_RELAXED);
+    if (owner == seL4_CapNull || owner_priority >= self_priority) {
+        return;
+    }
+    int error = seL4_TCB_SetPriority(owner, self_tcb, self_priority);
+    ZF_LOGE_IF(error != seL4_NoError, "Failed to lend priority %zu to mutex holder: %d",
+               (size_t)self_priority, error);
+
+    /* The holder may have let go of the mutex before we raised it, in which
+     * case nothing will lower it again but us. */
+    if (__atomic_load_n(&mutex->owner_tcb, __ATOMIC_SEQ_CST) != owner) {
+        seL4_TCB_SetPriority(owner, self_tcb, owner_priority);
+    }
+}
+
+int sync_pi_mutex_lock(sync_pi_mutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_pi_mutex_lock is NULL");
+        return -1;
+    }
+
+    int oldval = __atomic_fetch_sub(&mutex->value, 1, __ATOMIC_ACQUIRE);
+    if (oldval <= 0) {
+        lend_priority(mutex);
+        /* Returns once the mutex has been handed to us. */
+        seL4_Call(mutex->endpoint.cptr, seL4_MessageInfo_new(0, 0, 0, 0));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+    set_owner(mutex);
+    return 0;
+}
+
+int sync_pi_mutex_unlock(sync_pi_mutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_pi_mutex_unlock is NULL");
+        return -1;
+    }
+
+    __atomic_store_n(&mutex->owner_tcb, seL4_CapNull, __ATOMIC_SEQ_CST);
+    int oldval = __atomic_fetch_add(&mutex->value, 1, __ATOMIC_RELEASE);
+    if (oldval >= 0) {
+        return 0;
+    }
+
+    /* A waiter has committed to calling, so this only blocks until it has.
+     * Waiters lend their priority before calling, so once the call is in no
+     * lending from before it can still raise us. */
+    seL4_Word badge;
+#ifdef CONFIG_KERNEL_MCS
+    seL4_Recv(mutex->endpoint.cptr, &badge, mutex->reply.cptr);
+#else
+    seL4_Recv(mutex->endpoint.cptr, &badge);
+#endif
+    if (__atomic_exchange_n(&mutex->lent_priority, 0, __ATOMIC_SEQ_CST) != 0 && self_tcb != seL4_CapNull) {
+        int error = seL4_TCB_SetPriority(self_tcb, self_tcb, self_priority);
+        ZF_LOGE_IF(error != seL4_NoError, "Failed to drop back to priority %zu: %d",
+                   (size_t)self_priority, error);
+    }
+#ifdef CONFIG_KERNEL_MCS
+    seL4_Send(mutex->reply.cptr, seL4_MessageInfo_new(0, 0, 0, 0));
+#else
+    seL4_Reply(seL4_MessageInfo_new(0, 0, 0, 0));
+#endif
+    return 0;
+}
+
+int sync_pi_mutex_new(vka_t *vka, sync_pi_mutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_pi_mutex_new is NULL");
+        return -1;
+    }
+    int error = vka_alloc_endpoint(vka, &mutex->endpoint);
+    if (error != 0) {
+        return error;
+    }
+    mutex->reply.cptr = seL4_CapNull;
+    if (config_set(CONFIG_KERNEL_MCS)) {
+        error = vka_alloc_reply(vka, &mutex->reply);
+        if (error != 0) {
+            vka_free_object(vka, &mutex->endpoint);
+            return error;
+        }
+    }
+    return sync_pi_mutex_init(mutex, mutex->endpoint.cptr, mutex->reply.cptr);
+}
+
+int sync_pi_mutex_destroy(vka_t *vka, sync_pi_mutex_t *mutex)
+{
+    if (mutex == NULL) {
+        ZF_LOGE("Mutex passed to sync_pi_mutex_destroy is NULL");
+        return -1;
+    }
+    vka_free_object(vka, &mutex->endpoint);
+    if (config_set(CONFIG_KERNEL_MCS)) {
+        vka_free_object(vka, &mutex->reply);
+    }
+    return 0;
+}
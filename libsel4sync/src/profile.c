@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4sync/gen_config.h>
+#include <sync/profile.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <utils/util.h>
+
+#ifdef CONFIG_LIB_SEL4_SYNC_PROFILE
+
+static sync_lock_profile_t *profiles;
+/* protects profiles, held for a few instructions at a time */
+static volatile int profiles_lock;
+
+static void table_lock(void)
+{
+    while (__atomic_exchange_n(&profiles_lock, 1, __ATOMIC_ACQUIRE)) {
+        seL4_Yield();
+    }
+}
+
+static void table_unlock(void)
+{
+    __atomic_store_n(&profiles_lock, 0, __ATOMIC_RELEASE);
+}
+
+void sync_profile_register(sync_lock_profile_t *profile, void *lock)
+{
+    snprintf(profile->name, sizeof(profile->name), "lock@%p", lock);
+    profile->acquires = 0;
+    profile->contended = 0;
+    profile->wait_cycles = 0;
+    profile->max_hold_cycles = 0;
+    profile->acquired_at = 0;
+
+    table_lock();
+    profile->next = profiles;
+    if (profiles != NULL) {
+        profiles->pprev = &profile->next;
+    }
+    profile->pprev = &profiles;
+    profiles = profile;
+    table_unlock();
+}
+
+void sync_profile_unregister(sync_lock_profile_t *profile)
+{
+    table_lock();
+    if (profile->pprev != NULL) {
+        *profile->pprev = profile->next;
+        if (profile->next != NULL) {
+            profile->next->pprev = profile->pprev;
+        }
+        profile->pprev = NULL;
+    }
+    table_unlock();
+}
+
+void sync_profile_name(sync_lock_profile_t *profile, const char *name)
+{
+    strncpy(profile->name, name, sizeof(profile->name) - 1);
+    profile->name[sizeof(profile->name) - 1] = '\0';
+}
+
+void sync_profile_scrape(sync_profile_callback64 callback64, void *cookie)
+{
+    table_lock();
+    for (sync_lock_profile_t *p = profiles; p != NULL; p = p->next) {
+        callback64(p->acquires, p->name, "acquires", cookie);
+        callback64(p->contended, p->name, "contended acquires", cookie);
+        callback64(p->wait_cycles, p->name, "cycles waiting", cookie);
+        callback64(p->max_hold_cycles, p->name, "most cycles held", cookie);
+    }
+    table_unlock();
+}
+
+void sync_profile_reset(void)
+{
+    table_lock();
+    for (sync_lock_profile_t *p = profiles; p != NULL; p = p->next) {
+        p->acquires = 0;
+        p->contended = 0;
+        p->wait_cycles = 0;
+        p->max_hold_cycles = 0;
+    }
+    table_unlock();
+}
+
+#else
+
+void sync_profile_scrape(UNUSED sync_profile_callback64 callback64, UNUSED void *cookie)
+{
+}
+
+void sync_profile_reset(void)
+{
+}
+
+#endif /* CONFIG_LIB_SEL4_SYNC_PROFILE */
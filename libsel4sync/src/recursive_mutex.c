@@ -6,6 +6,7 @@
 
 #include <autoconf.h>
 #include <sync/recursive_mutex.h>
+#include <sync/bin_sem_bare.h>
 #include <stddef.h>
 #include <assert.h>
 #include <limits.h>
@@ -34,9 +35,7 @@ int sync_recursive_mutex_init(sync_recursive_mutex_t *mutex, seL4_CPtr notificat
     mutex->notification.cptr = notification;
     mutex->owner = NULL;
     mutex->held = 0;
-
-    /* Prime the endpoint. */
-    seL4_Signal(mutex->notification.cptr);
+    mutex->value = 1;
     return 0;
 }
 
@@ -46,10 +45,14 @@ int sync_recursive_mutex_lock(sync_recursive_mutex_t *mutex)
         ZF_LOGE("Mutex passed to sync_recursive_mutex_lock is NULL");
         return -1;
     }
-    if (thread_id() != mutex->owner) {
-        /* We don't already have the mutex. */
-        seL4_Wait(mutex->notification.cptr, NULL);
-        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    /* Only we ever set the owner to ourselves, so this is stable even while
+     * another thread holds the mutex. */
+    if (thread_id() != __atomic_load_n(&mutex->owner, __ATOMIC_RELAXED)) {
+        /* We don't already have the mutex. This only waits on the
+         * notification if another thread holds it. */
+        if (sync_bin_sem_bare_wait(mutex->notification.cptr, &mutex->value) != 0) {
+            return -1;
+        }
         assert(mutex->owner == NULL);
         mutex->owner = thread_id();
         assert(mutex->held == 0);
@@ -75,9 +78,10 @@ int sync_recursive_mutex_unlock(sync_recursive_mutex_t *mutex)
     assert(mutex->held > 0);
     mutex->held--;
     if (mutex->held == 0) {
-        /* This was the outermost lock we held. Wake the next person up. */
-        __atomic_store_n(&mutex->owner, NULL, __ATOMIC_RELEASE);
-        seL4_Signal(mutex->notification.cptr);
+        /* This was the outermost lock we held. Wake the next person up, if
+         * there is anyone waiting. */
+        __atomic_store_n(&mutex->owner, NULL, __ATOMIC_RELAXED);
+        sync_bin_sem_bare_post(mutex->notification.cptr, &mutex->value);
     }
     return 0;
 }
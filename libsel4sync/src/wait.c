@@ -0,0 +1,174 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sync/wait.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <vka/object.h>
+#include <utils/util.h>
+
+typedef struct {
+    vka_object_t notification;
+    /* protects the rest of the bucket, held for a few instructions at a time */
+    volatile int lock;
+    /* threads that have checked their word and are blocked, or about to block */
+    unsigned int waiters;
+    /* wake ups handed out by sync_wake that no waiter has taken yet. Signals
+     * coalesce, so each waiter that takes one signals again for the next. */
+    unsigned int to_wake;
+    /* the word the waiters are waiting on, unless shared is set because
+     * waiters on more than one word are in the bucket */
+    volatile int *addr;
+    bool shared;
+} sync_wait_bucket_t;
+
+static sync_wait_bucket_t buckets[SYNC_WAIT_BUCKETS];
+static bool initialised;
+
+static sync_wait_bucket_t *bucket_of(volatile int *addr)
+{
+    uintptr_t key = (uintptr_t)addr / sizeof(int);
+
+    /* Fibonacci hashing, so that neighbouring words spread over the table. */
+#if UINTPTR_MAX > UINT32_MAX
+    key *= UINT64_C(0x9E3779B97F4A7C15);
+#else
+    key *= UINT32_C(0x9E3779B9);
+#endif
+    return &buckets[key >> (sizeof(uintptr_t) * 8 - SYNC_WAIT_BUCKET_BITS)];
+}
+
+static void bucket_lock(sync_wait_bucket_t *bucket)
+{
+    while (__atomic_exchange_n(&bucket->lock, 1, __ATOMIC_ACQUIRE)) {
+        seL4_Yield();
+    }
+}
+
+static void bucket_unlock(sync_wait_bucket_t *bucket)
+{
+    __atomic_store_n(&bucket->lock, 0, __ATOMIC_RELEASE);
+}
+
+int sync_wait_init(vka_t *vka)
+{
+    if (vka == NULL) {
+        ZF_LOGE("vka passed to sync_wait_init is NULL");
+        return -1;
+    }
+    if (initialised) {
+        ZF_LOGE("sync_wait_init called twice");
+        return -1;
+    }
+
+    for (int i = 0; i < SYNC_WAIT_BUCKETS; i++) {
+        int error = vka_alloc_notification(vka, &buckets[i].notification);
+        if (error != 0) {
+            ZF_LOGE("Failed to allocate a notification for wait bucket %d", i);
+            while (i-- > 0) {
+                vka_free_object(vka, &buckets[i].notification);
+            }
+            return error;
+        }
+        buckets[i].lock = 0;
+        buckets[i].waiters = 0;
+        buckets[i].to_wake = 0;
+        buckets[i].addr = NULL;
+        buckets[i].shared = false;
+    }
+    initialised = true;
+    return 0;
+}
+
+int sync_wait_destroy(vka_t *vka)
+{
+    if (!initialised) {
+        ZF_LOGE("sync_wait_destroy called before sync_wait_init");
+        return -1;
+    }
+
+    for (int i = 0; i < SYNC_WAIT_BUCKETS; i++) {
+        vka_free_object(vka, &buckets[i].notification);
+    }
+    initialised = false;
+    return 0;
+}
+
+int sync_wait(volatile int *addr, int expected)
+{
+    if (!initialised) {
+        ZF_LOGE("sync_wait called before sync_wait_init");
+        return -1;
+    }
+
+    sync_wait_bucket_t *bucket = bucket_of(addr);
+
+    bucket_lock(bucket);
+    /* Checked under the bucket lock, so a sync_wake after addr was changed
+     * either sees us waiting or we see the change. */
+    if (__atomic_load_n(addr, __ATOMIC_ACQUIRE) != expected) {
+        bucket_unlock(bucket);
+        return EAGAIN;
+    }
+    if (bucket->waiters == 0) {
+        bucket->addr = addr;
+        bucket->shared = false;
+    } else if (bucket->addr != addr) {
+        bucket->shared = true;
+    }
+    bucket->waiters++;
+    bucket_unlock(bucket);
+
+    for (;;) {
+        seL4_Wait(bucket->notification.cptr, NULL);
+
+        bucket_lock(bucket);
+        if (bucket->to_wake > 0) {
+            bucket->to_wake--;
+            bucket->waiters--;
+            if (bucket->to_wake > 0) {
+                seL4_Signal(bucket->notification.cptr);
+            }
+            bucket_unlock(bucket);
+            return 0;
+        }
+        /* A signal left over from a chain of wake ups that ended early. */
+        bucket_unlock(bucket);
+    }
+}
+
+int sync_wake(volatile int *addr, int n)
+{
+    if (!initialised) {
+        ZF_LOGE("sync_wake called before sync_wait_init");
+        return -1;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+
+    sync_wait_bucket_t *bucket = bucket_of(addr);
+
+    bucket_lock(bucket);
+    unsigned int idle = bucket->waiters - bucket->to_wake;
+    if (idle > 0 && (bucket->shared || bucket->addr == addr)) {
+        /* Which waiter takes a wake up can't be chosen, so when the bucket
+         * holds waiters on other words too, wake all of them. */
+        unsigned int wake = bucket->shared ? idle : MIN(idle, (unsigned int)n);
+        bool signal = bucket->to_wake == 0;
+        bucket->to_wake += wake;
+        if (signal) {
+            seL4_Signal(bucket->notification.cptr);
+        }
+    }
+    bucket_unlock(bucket);
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+/* Reporting of the series of a benchmark suite, see DEFINE_BENCHMARK_SUITE. */
+
+#include <stddef.h>
+
+#include <sel4bench/harness.h>
+#include <sel4test/test.h>
+
+/**
+ * Measure the cost of reading the cycle counter around nothing, to subtract from the
+ * samples of a series. Overwrites samples.
+ *
+ * @param samples scratch space for the measurement
+ * @param num_samples size of samples
+ *
+ * @return the overhead in cycles.
+ */
+ccnt_t sel4test_benchmark_overhead(ccnt_t *samples, size_t num_samples);
+
+/**
+ * Compute the statistics of a series of samples taken by the running benchmark suite, print
+ * them and check them against the baseline of the series, failing the test if they
+ * regressed. The series is named after the suite followed by series. A series without
+ * samples is skipped.
+ *
+ * @param series name of the series within the suite
+ * @param samples samples in cycles, which are sorted and have the overhead subtracted
+ * @param num_samples number of samples
+ * @param overhead cycles to subtract from each sample
+ * @param stats filled in with the statistics of the series if they were computed, may be NULL
+ *
+ * @return SUCCESS, or FAILURE if the statistics could not be computed or regressed.
+ */
+test_result_t sel4test_report_benchmark(const char *series, ccnt_t *samples, size_t num_samples,
+                                        ccnt_t overhead, sel4bench_stats_t *stats);
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sel4/sel4.h>
+#include <vka/vka.h>
+#include <vka/cspacepath_t.h>
+#include <vspace/vspace.h>
+#include <sel4utils/process.h>
+
+/* A test process that is built once and reset between the tests it runs, rather than
+ * torn down and configured again for each of them.
+ *
+ * Everything a test creates must come from the untypeds the template lends it, and every
+ * cap it makes must be in the slots of its cspace that were free when the template was
+ * snapshot. Resetting revokes the untypeds, which deletes all the objects the test made,
+ * empties those slots and restores the pristine writable memory and registers of the
+ * process. Changes the test makes to the objects of the template itself, such as the
+ * priority of its TCB, are not undone.
+ */
+typedef struct sel4test_env_template {
+    sel4utils_process_t *process;
+    sel4utils_process_snapshot_t snapshot;
+    size_t num_untypeds;
+    /* untypeds in the cspace of the driver that the test carves its objects from */
+    const cspacepath_t *untypeds;
+    /* slots of the copies of those untypeds in the cspace of the process */
+    const seL4_CPtr *untyped_slots;
+    /* slots of the process from here up are emptied by a reset */
+    seL4_CPtr first_free_slot;
+    bool in_use;
+} sel4test_env_template_t;
+
+/* Templates handed out to the tests that are running, one per test */
+typedef struct sel4test_env_pool {
+    size_t num_templates;
+    sel4test_env_template_t *templates;
+} sel4test_env_pool_t;
+
+/**
+ * Make a template of a process that is ready to run a test. The process must be configured
+ * and spawned with resume false, with its untypeds already copied in and its arguments and
+ * any other data for the test already written to it, as the snapshot is taken here.
+ *
+ * @param template      to initialise
+ * @param process       the process, which must outlive the template
+ * @param vka           allocator the process was configured with
+ * @param vspace        vspace of the caller, which the snapshot is kept in
+ * @param num_untypeds  number of untypeds lent to the process
+ * @param untypeds      paths to the untypeds in the cspace of the caller, which must
+ *                      outlive the template
+ * @param untyped_slots slots of the copies of the untypeds in the process, which must
+ *                      outlive the template
+ * @return 0 on success
+ */
+int sel4test_env_template_init(sel4test_env_template_t *template, sel4utils_process_t *process,
+                               vka_t *vka, vspace_t *vspace, size_t num_untypeds,
+                               const cspacepath_t *untypeds, const seL4_CPtr *untyped_slots);
+
+/**
+ * Reset a template to how it was when it was made, ready for the next test.
+ *
+ * @param template made with sel4test_env_template_init
+ * @param vka      allocator the process was configured with
+ * @param vspace   vspace the template was made in
+ * @param resume   true to start the process again straight away
+ * @return 0 on success. On failure the process is in an unknown state and should be
+ *         destroyed.
+ */
+int sel4test_env_template_reset(sel4test_env_template_t *template, vka_t *vka, vspace_t *vspace,
+                                bool resume);
+
+/**
+ * Free a template and destroy its process.
+ *
+ * @param template made with sel4test_env_template_init
+ * @param vka      allocator the process was configured with
+ * @param vspace   vspace the template was made in
+ */
+void sel4test_env_template_destroy(sel4test_env_template_t *template, vka_t *vka, vspace_t *vspace);
+
+/**
+ * Start a pool of templates, all of which are free.
+ *
+ * @param pool          to initialise
+ * @param templates     templates made with sel4test_env_template_init, which must outlive
+ *                      the pool
+ * @param num_templates number of templates, such as the most tests that run at once
+ */
+void sel4test_env_pool_init(sel4test_env_pool_t *pool, sel4test_env_template_t *templates,
+                            size_t num_templates);
+
+/**
+ * Take a free template from a pool to run a test in. It is ready to be resumed.
+ *
+ * @return a template, or NULL if they are all in use
+ */
+sel4test_env_template_t *sel4test_env_pool_get(sel4test_env_pool_t *pool);
+
+/**
+ * Reset a template once its test has finished and give it back to the pool.
+ *
+ * @param pool     the template came from
+ * @param template from sel4test_env_pool_get
+ * @param vka      allocator the process was configured with
+ * @param vspace   vspace the template was made in
+ * @return 0 on success. On failure the template stays in use and should be destroyed,
+ *         and can be replaced by a new one made in its place.
+ */
+int sel4test_env_pool_put(sel4test_env_pool_t *pool, sel4test_env_template_t *template, vka_t *vka,
+                          vspace_t *vspace);
@@ -22,8 +22,10 @@
 #include <stdio.h>
 #define printf(x, ...)  do {\
     char buffer[SEL4TEST_PRINT_BUFFER];\
-    snprintf(buffer, SEL4TEST_PRINT_BUFFER, x, ##__VA_ARGS__);\
-    sel4test_printf(buffer);\
+    int _len = snprintf(buffer, SEL4TEST_PRINT_BUFFER, x, ##__VA_ARGS__);\
+    if (_len > 0) {\
+        sel4test_write(buffer, _len < SEL4TEST_PRINT_BUFFER ? _len : SEL4TEST_PRINT_BUFFER - 1);\
+    }\
 } while(0)
 #endif /* CONFIG_PRINT_XML */
 
@@ -13,6 +13,7 @@
 #include <sel4/sel4.h>
 
 #include <utils/attribute.h>
+#include <utils/arith.h>
 #include <sel4test/testutil.h>
 #include <vka/vka.h>
 #include <vspace/vspace.h>
@@ -77,7 +78,7 @@ typedef struct env *env_t;
 typedef int (*test_fn)(uintptr_t environment);
 
 /* Test type definitions. */
-typedef enum test_type_name {BOOTSTRAP = 0, BASIC} test_type_name_t;
+typedef enum test_type_name {BOOTSTRAP = 0, BASIC, BENCHMARK} test_type_name_t;
 typedef struct testcase testcase_t; // Forward type declaration.
 typedef struct test_type {
     /* Represents a single test type. See comment for `struct testcase` for info about ALIGN(32). */
@@ -141,9 +142,176 @@ typedef struct testcase ALIGN(sizeof(struct testcase)) testcase_t;
 
 #define DEFINE_TEST(_name, _description, _function, _enabled) DEFINE_TEST_WITH_TYPE(_name, _description, _function, BASIC, _enabled)
 
+/* Set in the enabled word of a test that must not run at the same time as any other,
+ * for tests that use a shared device or measure the whole system. A disabled test
+ * still has an enabled word of 0. */
+#define SERIAL_ONLY BIT(1)
+
+#define DEFINE_TEST_SERIAL_ONLY(_name, _description, _function, _enabled) \
+    DEFINE_TEST_WITH_TYPE(_name, _description, _function, BASIC, (_enabled) ? (1 | SERIAL_ONLY) : 0)
+
 #define DEFINE_TEST_BOOTSTRAP(_name, _description, _function, _enabled) DEFINE_TEST_WITH_TYPE(_name, _description, _function, BOOTSTRAP, _enabled)
 /**/
 
+/* Prototype of the body of a benchmark, which is timed once per iteration. */
+typedef void (*benchmark_fn)(uintptr_t environment);
+
+/* Statistic of a benchmark that is compared against its baseline */
+typedef enum benchmark_metric {
+    BENCHMARK_MEDIAN = 0,
+    BENCHMARK_MEAN,
+    BENCHMARK_MIN,
+    BENCHMARK_P90,
+    BENCHMARK_P99,
+} benchmark_metric_t;
+
+/* Which way a benchmark has to move against its baseline to count as a regression */
+typedef enum benchmark_direction {
+    BENCHMARK_LOWER_IS_BETTER = 0,
+    BENCHMARK_HIGHER_IS_BETTER,
+} benchmark_direction_t;
+
+/* Represents a single benchmark, run by the function of its testcase. */
+typedef struct benchmark {
+    const char *name;
+    benchmark_fn function;
+    seL4_Word iterations;
+    /* fail if the median in cycles is above this, 0 for no limit */
+    uint64_t max_median;
+    benchmark_metric_t metric;
+    benchmark_direction_t direction;
+} benchmark_t;
+
+/* Expected value of the metric of a benchmark, in cycles. See comment for `struct testcase`
+ * for info about the ALIGN. */
+typedef struct benchmark_baseline {
+    const char *name;
+    uint64_t value;
+} ALIGN(16) benchmark_baseline_t;
+
+/* Time a benchmark and report its statistics, see DEFINE_BENCHMARK. */
+test_result_t sel4test_run_benchmark(const benchmark_t *benchmark, uintptr_t environment);
+
+/* Declare a benchmark, a test of type BENCHMARK whose function runs _function for
+ * CONFIG_LIBSEL4TEST_BENCHMARK_WARMUP iterations and then _iterations more, timing each
+ * with the cycle counter. The statistics of the timed iterations are printed, as
+ * <property>s of the testcase when CONFIG_PRINT_XML is set, and the test passes unless
+ * the median is over _max_median cycles or _metric regressed against the baseline of the
+ * benchmark, if it has one. The test type can use the same run_test as BASIC tests do.
+ *
+ * A baseline is looked up by the name of the benchmark, first in
+ * CONFIG_LIBSEL4TEST_BENCHMARK_BASELINE_FILE, which is read with stdio so that it can come
+ * from the cpio archive once muslcsys_install_cpio_interface has been called, and then in
+ * the baselines declared with DEFINE_BENCHMARK_BASELINE. The metric regressed if it is
+ * worse than the baseline by more than CONFIG_LIBSEL4TEST_BENCHMARK_TOLERANCE percent of
+ * the baseline and by more than CONFIG_LIBSEL4TEST_BENCHMARK_NOISE_SIGMAS measured
+ * standard deviations, so that a noisy benchmark does not fail by chance.
+ */
+#define DEFINE_BENCHMARK_WITH_METRIC(_name, _description, _function, _iterations, _max_median, _metric, \
+                                     _direction) \
+    static const benchmark_t BENCHMARK_ ## _name = { \
+    #_name, \
+    _function, \
+    _iterations, \
+    _max_median, \
+    _metric, \
+    _direction, \
+}; \
+    static int BENCHMARK_RUN_ ## _name(uintptr_t environment) \
+    { \
+        return sel4test_run_benchmark(&BENCHMARK_ ## _name, environment); \
+    } \
+    DEFINE_TEST_WITH_TYPE(_name, _description, BENCHMARK_RUN_ ## _name, BENCHMARK, true)
+
+#define DEFINE_BENCHMARK_WITH_LIMIT(_name, _description, _function, _iterations, _max_median) \
+    DEFINE_BENCHMARK_WITH_METRIC(_name, _description, _function, _iterations, _max_median, BENCHMARK_MEDIAN, \
+                                 BENCHMARK_LOWER_IS_BETTER)
+
+#define DEFINE_BENCHMARK(_name, _description, _function, _iterations) \
+    DEFINE_BENCHMARK_WITH_LIMIT(_name, _description, _function, _iterations, 0)
+
+/* Run a benchmark suite, see DEFINE_BENCHMARK_SUITE. */
+test_result_t sel4test_run_benchmark_suite(const char *name, test_fn function, uintptr_t environment);
+
+/* Declare a benchmark suite, a test of type BENCHMARK whose function takes the samples of
+ * several series itself, such as one for each operation and configuration it measures, and
+ * reports each of them with sel4test_report_benchmark from sel4test/benchmark.h. The cycle
+ * counters are set up around _function, which returns the result of the test as any test
+ * function does.
+ *
+ * Every series is printed and checked against its baseline like a benchmark with the
+ * median as its metric, under the name of the suite followed by the name of the series.
+ * As those names have spaces in them, the baselines of a series can only come from
+ * CONFIG_LIBSEL4TEST_BENCHMARK_BASELINE_FILE, where the cycles follow the last space of
+ * a line.
+ */
+#define DEFINE_BENCHMARK_SUITE(_name, _description, _function) \
+    static int BENCHMARK_RUN_ ## _name(uintptr_t environment) \
+    { \
+        return sel4test_run_benchmark_suite(#_name, (test_fn)_function, environment); \
+    } \
+    DEFINE_TEST_WITH_TYPE(_name, _description, BENCHMARK_RUN_ ## _name, BENCHMARK, true)
+
+/* Declare the baseline of the benchmark _name, in cycles. */
+#define DEFINE_BENCHMARK_BASELINE(_name, _value) \
+    __attribute__((used)) __attribute__((section("_benchmark_baseline"))) \
+    benchmark_baseline_t BENCHMARK_BASELINE_ ## _name = { \
+    #_name, \
+    _value, \
+};
+
+/* Whether a test can run at the same time as other tests, each in its own process with its
+ * own env. Only BASIC tests can, and only if they were not declared SERIAL_ONLY. */
+static inline bool sel4test_test_is_concurrent(testcase_t *test)
+{
+    return test->test_type == BASIC && !(test->enabled & SERIAL_ONLY);
+}
+
+/* Order in which to start enabled tests when running up to a number at a time, see
+ * sel4test_schedule_init. */
+typedef struct sel4test_schedule {
+    testcase_t **tests;
+    size_t num_tests;
+    /* next test to start */
+    size_t next;
+    /* tests started and not yet done */
+    size_t running;
+    size_t max_running;
+    /* a test that must run alone is running */
+    bool exclusive;
+} sel4test_schedule_t;
+
+/**
+ * Start scheduling tests, which are run in the order given. Concurrent tests start while
+ * fewer than max_running tests are running, such as one per core. Any other test waits for
+ * everything before it to finish and runs alone.
+ *
+ * @param schedule    to initialise
+ * @param tests       sorted tests to run, which must outlive the schedule
+ * @param num_tests   number of tests
+ * @param max_running most tests to run at once
+ */
+void sel4test_schedule_init(sel4test_schedule_t *schedule, testcase_t **tests, size_t num_tests,
+                            size_t max_running);
+
+/**
+ * Get the next test to start, if it can start now. Call again after each test started to
+ * start as many as can run.
+ *
+ * @return the test to start, or NULL if there is none left or it must wait for a running
+ *         test to be done
+ */
+testcase_t *sel4test_schedule_next(sel4test_schedule_t *schedule);
+
+/* Record that a test from sel4test_schedule_next has finished */
+void sel4test_schedule_done(sel4test_schedule_t *schedule, testcase_t *test);
+
+/* Whether every test has been started and is done */
+static inline bool sel4test_schedule_finished(sel4test_schedule_t *schedule)
+{
+    return schedule->next == schedule->num_tests && schedule->running == 0;
+}
+
 /* Definitions so that we can find the test types */
 extern struct test_type __start__test_type[];
 extern struct test_type __stop__test_type[];
@@ -152,6 +320,10 @@ extern struct test_type __stop__test_type[];
 extern testcase_t __start__test_case[];
 extern testcase_t __stop__test_case[];
 
+/* Definitions so that we can find the benchmark baselines, there may be none */
+extern benchmark_baseline_t __start__benchmark_baseline[] WEAK;
+extern benchmark_baseline_t __stop__benchmark_baseline[] WEAK;
+
 static inline int test_type_comparator(const void *a, const void *b)
 {
     const struct test_type **ta = (const struct test_type **) a;
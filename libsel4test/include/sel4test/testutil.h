@@ -10,6 +10,7 @@
 #include <autoconf.h>
 #include <sel4test/gen_config.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef enum test_result {
     /* test passed */
@@ -50,10 +51,21 @@ typedef enum _sel4test_communication_codes {
 
 /* A buffered printf to avoid corrupting xml output */
 void sel4test_printf(const char *out);
+/* As sel4test_printf, for output whose length is already known */
+void sel4test_write(const char *out, size_t len);
+/* Give the printf buffer a larger region to move to once its own buffer is full, such as
+ * some mapped pages, or NULL to stop using one. Not while buffering */
+void sel4test_set_printf_spill(void *region, size_t size);
+/* Print the buffered output of a test as it is, without escaping it for xml, for runs
+ * whose output is known not to need it, such as benchmark results */
+void sel4test_set_raw_output(bool raw);
 /* enable printf buffering */
 void sel4test_start_printf_buffer(void);
 /* dump the current buffer and disable printf buffering */
 void sel4test_end_printf_buffer(void);
+/* Buffer printf even without xml output, for a test run at the same time as others in
+ * its own process, so that its output is printed in one piece by sel4test_end_printf_buffer */
+void sel4test_set_concurrent_output(bool concurrent);
 
 /* reset the test environment for the next test */
 void sel4test_reset(void);
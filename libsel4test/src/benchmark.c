@@ -0,0 +1,280 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4test/gen_config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sel4bench/harness.h>
+#include <sel4test/benchmark.h>
+#include <sel4test/test.h>
+#include <sel4test/testutil.h>
+
+#include <utils/util.h>
+
+/* Longest name of a series of a benchmark suite, including the name of the suite */
+#define BENCHMARK_NAME_MAX (TEST_NAME_MAX + 128)
+
+/* Name of the benchmark suite running, see DEFINE_BENCHMARK_SUITE */
+static const char *suite_name;
+
+typedef struct {
+    const benchmark_t *benchmark;
+    uintptr_t environment;
+} benchmark_run_t;
+
+static void run_iteration(void *cookie)
+{
+    benchmark_run_t *run = cookie;
+    run->benchmark->function(run->environment);
+}
+
+/* How a benchmark did against its baseline */
+typedef struct baseline_check {
+    bool found;
+    uint64_t baseline;
+    double value;
+    double tolerance;
+    bool regressed;
+} baseline_check_t;
+
+static double metric_value(benchmark_metric_t metric, sel4bench_stats_t *stats)
+{
+    switch (metric) {
+    case BENCHMARK_MEAN:
+        return stats->mean;
+    case BENCHMARK_MIN:
+        return stats->min;
+    case BENCHMARK_P90:
+        return stats->p90;
+    case BENCHMARK_P99:
+        return stats->p99;
+    case BENCHMARK_MEDIAN:
+    default:
+        return stats->median;
+    }
+}
+
+static const char *metric_name(benchmark_metric_t metric)
+{
+    switch (metric) {
+    case BENCHMARK_MEAN:
+        return "mean";
+    case BENCHMARK_MIN:
+        return "min";
+    case BENCHMARK_P90:
+        return "p90";
+    case BENCHMARK_P99:
+        return "p99";
+    case BENCHMARK_MEDIAN:
+    default:
+        return "median";
+    }
+}
+
+/* Lines of the baseline file are "<name> <cycles>", where the name of the series of a
+ * benchmark suite has spaces in it. Anything else is skipped. */
+static bool baseline_from_file(const char *name, uint64_t *value)
+{
+    if (strlen(CONFIG_LIBSEL4TEST_BENCHMARK_BASELINE_FILE) == 0) {
+        return false;
+    }
+    FILE *file = fopen(CONFIG_LIBSEL4TEST_BENCHMARK_BASELINE_FILE, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    char line[BENCHMARK_NAME_MAX + 32];
+    size_t len = strlen(name);
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file) != NULL) {
+        char *cycles = strrchr(line, ' ');
+        if (cycles != NULL && (size_t)(cycles - line) == len && strncmp(line, name, len) == 0) {
+            *value = strtoull(cycles + 1, NULL, 10);
+            found = true;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+static bool find_baseline(const char *name, uint64_t *value)
+{
+    if (baseline_from_file(name, value)) {
+        return true;
+    }
+    for (benchmark_baseline_t *i = __start__benchmark_baseline; i < __stop__benchmark_baseline; i++) {
+        if (strcmp(i->name, name) == 0) {
+            *value = i->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The metric regressed if it is worse than the baseline by more than both the tolerance
+ * and the noise of the measurement */
+static void check_baseline(const benchmark_t *benchmark, sel4bench_stats_t *stats, baseline_check_t *check)
+{
+    memset(check, 0, sizeof(*check));
+    check->found = find_baseline(benchmark->name, &check->baseline);
+    if (!check->found) {
+        return;
+    }
+
+    double baseline = check->baseline;
+    check->value = metric_value(benchmark->metric, stats);
+    check->tolerance = MAX(baseline * CONFIG_LIBSEL4TEST_BENCHMARK_TOLERANCE / 100,
+                           stats->stddev * CONFIG_LIBSEL4TEST_BENCHMARK_NOISE_SIGMAS);
+    double worse_by = benchmark->direction == BENCHMARK_HIGHER_IS_BETTER ? baseline - check->value
+                      : check->value - baseline;
+    check->regressed = worse_by > check->tolerance;
+}
+
+/* The properties of the series of a suite are prefixed with the name of the series, as
+ * they are all properties of the one testcase */
+static void print_stats(const benchmark_t *benchmark, const char *prefix, sel4bench_harness_t *harness,
+                        sel4bench_stats_t *stats, baseline_check_t *check)
+{
+    if (config_set(CONFIG_PRINT_XML)) {
+        printf("\t\t<properties>\n");
+        printf("\t\t\t<property name=\"%ssamples\" value=\"%zu\"/>\n", prefix, (size_t) stats->samples);
+        printf("\t\t\t<property name=\"%soutliers\" value=\"%zu\"/>\n", prefix, (size_t) stats->outliers);
+        printf("\t\t\t<property name=\"%soverhead\" value=\""CCNT_FORMAT"\"/>\n", prefix, stats->overhead);
+        printf("\t\t\t<property name=\"%smin\" value=\""CCNT_FORMAT"\"/>\n", prefix, stats->min);
+        printf("\t\t\t<property name=\"%smedian\" value=\""CCNT_FORMAT"\"/>\n", prefix, stats->median);
+        printf("\t\t\t<property name=\"%sp90\" value=\""CCNT_FORMAT"\"/>\n", prefix, stats->p90);
+        printf("\t\t\t<property name=\"%sp99\" value=\""CCNT_FORMAT"\"/>\n", prefix, stats->p99);
+        printf("\t\t\t<property name=\"%smax\" value=\""CCNT_FORMAT"\"/>\n", prefix, stats->max);
+        printf("\t\t\t<property name=\"%smad\" value=\""CCNT_FORMAT"\"/>\n", prefix, stats->mad);
+        printf("\t\t\t<property name=\"%smean\" value=\"%.2f\"/>\n", prefix, stats->mean);
+        printf("\t\t\t<property name=\"%sstddev\" value=\"%.2f\"/>\n", prefix, stats->stddev);
+        if (check->found) {
+            printf("\t\t\t<property name=\"%sbaseline\" value=\"%llu\"/>\n", prefix,
+                   (unsigned long long) check->baseline);
+            printf("\t\t\t<property name=\"%stolerance\" value=\"%.2f\"/>\n", prefix, check->tolerance);
+        }
+        printf("\t\t</properties>\n");
+    } else {
+        printf("\tBenchmark ");
+        sel4bench_harness_print_json(harness, stats);
+        if (check->found) {
+            printf("\tBenchmark %s %s %.2f against baseline %llu, tolerance %.2f: %s\n", benchmark->name,
+                   metric_name(benchmark->metric), check->value, (unsigned long long) check->baseline,
+                   check->tolerance, check->regressed ? "regressed" : "ok");
+        }
+    }
+}
+
+/* Compute the statistics of the samples of a harness into stats, print them and fail the
+ * test if they are over the limit of the benchmark or regressed against its baseline */
+static test_result_t report_benchmark(const benchmark_t *benchmark, const char *prefix,
+                                      sel4bench_harness_t *harness, sel4bench_stats_t *stats)
+{
+    baseline_check_t check;
+
+    if (sel4bench_harness_stats(harness, stats) != 0) {
+        _sel4test_failure("Failed to compute benchmark statistics", __FILE__, __LINE__);
+        return FAILURE;
+    }
+    check_baseline(benchmark, stats, &check);
+    print_stats(benchmark, prefix, harness, stats, &check);
+
+    if (benchmark->max_median != 0 && stats->median > benchmark->max_median) {
+        char buffer[__TEST_BUFFER_SIZE];
+        snprintf(buffer, sizeof(buffer), "Benchmark %s median "CCNT_FORMAT" over its limit of %llu cycles",
+                 benchmark->name, stats->median, (unsigned long long) benchmark->max_median);
+        _sel4test_failure(buffer, __FILE__, __LINE__);
+        return FAILURE;
+    }
+    if (check.regressed) {
+        char buffer[__TEST_BUFFER_SIZE];
+        snprintf(buffer, sizeof(buffer), "Benchmark %s %s %.2f regressed against its baseline of %llu cycles",
+                 benchmark->name, metric_name(benchmark->metric), check.value, (unsigned long long) check.baseline);
+        _sel4test_failure(buffer, __FILE__, __LINE__);
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+test_result_t sel4test_run_benchmark(const benchmark_t *benchmark, uintptr_t environment)
+{
+    if (benchmark->iterations == 0) {
+        _sel4test_failure("Benchmark has no iterations", __FILE__, __LINE__);
+        return FAILURE;
+    }
+
+    ccnt_t *samples = calloc(benchmark->iterations, sizeof(*samples));
+    if (samples == NULL) {
+        _sel4test_failure("Failed to allocate benchmark samples", __FILE__, __LINE__);
+        return FAILURE;
+    }
+
+    sel4bench_harness_t harness;
+    sel4bench_stats_t stats;
+    benchmark_run_t run = {
+        .benchmark = benchmark,
+        .environment = environment,
+    };
+
+    sel4bench_init();
+    sel4bench_harness_init(&harness, benchmark->name, samples, benchmark->iterations,
+                           CONFIG_LIBSEL4TEST_BENCHMARK_WARMUP);
+    sel4bench_harness_run(&harness, run_iteration, &run);
+    sel4bench_destroy();
+
+    test_result_t result = report_benchmark(benchmark, "", &harness, &stats);
+    free(samples);
+    if (result != SUCCESS) {
+        return result;
+    }
+    return sel4test_get_result();
+}
+
+test_result_t sel4test_run_benchmark_suite(const char *name, test_fn function, uintptr_t environment)
+{
+    suite_name = name;
+    sel4bench_init();
+    test_result_t result = function(environment);
+    sel4bench_destroy();
+    suite_name = NULL;
+    return result;
+}
+
+ccnt_t sel4test_benchmark_overhead(ccnt_t *samples, size_t num_samples)
+{
+    sel4bench_harness_t harness;
+
+    sel4bench_harness_init(&harness, "overhead", samples, num_samples, 0);
+    return sel4bench_harness_calibrate(&harness);
+}
+
+test_result_t sel4test_report_benchmark(const char *series, ccnt_t *samples, size_t num_samples,
+                                        ccnt_t overhead, sel4bench_stats_t *stats)
+{
+    char name[BENCHMARK_NAME_MAX];
+    char prefix[BENCHMARK_NAME_MAX];
+    sel4bench_harness_t harness;
+    sel4bench_stats_t series_stats;
+
+    if (num_samples == 0) {
+        return SUCCESS;
+    }
+    snprintf(name, sizeof(name), "%s %s", suite_name != NULL ? suite_name : "benchmark", series);
+    snprintf(prefix, sizeof(prefix), "%s ", series);
+    benchmark_t benchmark = {
+        .name = name,
+        .iterations = num_samples,
+        .metric = BENCHMARK_MEDIAN,
+        .direction = BENCHMARK_LOWER_IS_BETTER,
+    };
+    sel4bench_harness_init(&harness, name, samples, num_samples, 0);
+    harness.overhead = overhead;
+    return report_benchmark(&benchmark, prefix, &harness, stats != NULL ? stats : &series_stats);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4test/gen_config.h>
+
+#include <string.h>
+#include <assert.h>
+
+#include <utils/util.h>
+#include <vka/capops.h>
+#include <sel4test/env_pool.h>
+
+int sel4test_env_template_init(sel4test_env_template_t *template, sel4utils_process_t *process,
+                               vka_t *vka, vspace_t *vspace, size_t num_untypeds,
+                               const cspacepath_t *untypeds, const seL4_CPtr *untyped_slots)
+{
+    if (template == NULL || process == NULL || (num_untypeds > 0 && (untypeds == NULL || untyped_slots == NULL))) {
+        ZF_LOGE("Invalid arguments to sel4test_env_template_init");
+        return -1;
+    }
+
+    memset(template, 0, sizeof(*template));
+    template->process = process;
+    template->num_untypeds = num_untypeds;
+    template->untypeds = untypeds;
+    template->untyped_slots = untyped_slots;
+    template->first_free_slot = process->cspace_next_free;
+    if (sel4utils_process_snapshot(process, vka, vspace, &template->snapshot)) {
+        ZF_LOGE("Failed to snapshot test process");
+        return -1;
+    }
+    return 0;
+}
+
+static void process_path(sel4utils_process_t *process, seL4_CPtr slot, cspacepath_t *path)
+{
+    *path = (cspacepath_t) {
+        .root = process->cspace.cptr,
+        .capPtr = slot,
+        .capDepth = process->cspace_size,
+    };
+}
+
+int sel4test_env_template_reset(sel4test_env_template_t *template, vka_t *vka, vspace_t *vspace,
+                                bool resume)
+{
+    sel4utils_process_t *process = template->process;
+    cspacepath_t path;
+
+    /* stop the test before pulling its objects out from under it */
+    int error = seL4_TCB_Suspend(process->thread.tcb.cptr);
+    if (error) {
+        ZF_LOGE("Failed to suspend test process");
+        return -1;
+    }
+
+    /* deletes every object the test made, and the copies of the untypeds */
+    for (size_t i = 0; i < template->num_untypeds; i++) {
+        error = vka_cnode_revoke(&template->untypeds[i]);
+        if (error) {
+            ZF_LOGE("Failed to revoke untyped %zu of test process", i);
+            return -1;
+        }
+    }
+
+    /* anything left in the free slots refers to objects the test did not make */
+    process_path(process, template->first_free_slot, &path);
+    error = vka_cnode_delete_range(&path, BIT(process->cspace_size) - template->first_free_slot);
+    if (error) {
+        ZF_LOGE("Failed to empty free slots of test process");
+        return -1;
+    }
+
+    for (size_t i = 0; i < template->num_untypeds; i++) {
+        process_path(process, template->untyped_slots[i], &path);
+        error = vka_cnode_delete(&path);
+        if (!error) {
+            error = vka_cnode_copy(&path, &template->untypeds[i], seL4_AllRights);
+        }
+        if (error) {
+            ZF_LOGE("Failed to give untyped %zu back to test process", i);
+            return -1;
+        }
+    }
+
+    return sel4utils_process_reset(process, vka, vspace, &template->snapshot, resume);
+}
+
+void sel4test_env_template_destroy(sel4test_env_template_t *template, vka_t *vka, vspace_t *vspace)
+{
+    sel4utils_process_snapshot_free(&template->snapshot, vka, vspace);
+    sel4utils_destroy_process(template->process, vka);
+    memset(template, 0, sizeof(*template));
+}
+
+void sel4test_env_pool_init(sel4test_env_pool_t *pool, sel4test_env_template_t *templates,
+                            size_t num_templates)
+{
+    pool->templates = templates;
+    pool->num_templates = num_templates;
+    for (size_t i = 0; i < num_templates; i++) {
+        templates[i].in_use = false;
+    }
+}
+
+sel4test_env_template_t *sel4test_env_pool_get(sel4test_env_pool_t *pool)
+{
+    for (size_t i = 0; i < pool->num_templates; i++) {
+        if (!pool->templates[i].in_use) {
+            pool->templates[i].in_use = true;
+            return &pool->templates[i];
+        }
+    }
+    return NULL;
+}
+
+int sel4test_env_pool_put(sel4test_env_pool_t *pool, sel4test_env_template_t *template, vka_t *vka,
+                          vspace_t *vspace)
+{
+    assert(template >= pool->templates && template < pool->templates + pool->num_templates);
+    assert(template->in_use);
+
+    /* reset now, so that the next test does not have to wait for it */
+    if (sel4test_env_template_reset(template, vka, vspace, false)) {
+        return -1;
+    }
+    template->in_use = false;
+    return 0;
+}
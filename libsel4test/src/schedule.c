@@ -0,0 +1,58 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4test/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <sel4test/test.h>
+
+void sel4test_schedule_init(sel4test_schedule_t *schedule, testcase_t **tests, size_t num_tests,
+                            size_t max_running)
+{
+    schedule->tests = tests;
+    schedule->num_tests = num_tests;
+    schedule->next = 0;
+    schedule->running = 0;
+    schedule->max_running = max_running > 0 ? max_running : 1;
+    schedule->exclusive = false;
+}
+
+testcase_t *sel4test_schedule_next(sel4test_schedule_t *schedule)
+{
+    /* disabled tests are never started */
+    while (schedule->next < schedule->num_tests && !schedule->tests[schedule->next]->enabled) {
+        schedule->next++;
+    }
+    if (schedule->next == schedule->num_tests || schedule->exclusive
+        || schedule->running == schedule->max_running) {
+        return NULL;
+    }
+
+    testcase_t *test = schedule->tests[schedule->next];
+    if (!sel4test_test_is_concurrent(test)) {
+        /* wait for everything before it, so that it runs alone */
+        if (schedule->running > 0) {
+            return NULL;
+        }
+        schedule->exclusive = true;
+    }
+    schedule->next++;
+    schedule->running++;
+    return test;
+}
+
+void sel4test_schedule_done(sel4test_schedule_t *schedule, testcase_t *test)
+{
+    assert(schedule->running > 0);
+    schedule->running--;
+    if (!sel4test_test_is_concurrent(test)) {
+        schedule->exclusive = false;
+    }
+}
@@ -24,45 +24,137 @@
 
 /* buffer stdout here during a test if we're outputting xml */
 static char current_stdout_bank[STDOUT_CACHE];
-/* index we are up to in the buffer */
-static int buf_index = 0;
+/* buffer in use, the bank or the spill region once the bank has filled up */
+static char *buf = current_stdout_bank;
+static size_t buf_size = STDOUT_CACHE;
+/* length of the output in the buffer */
+static size_t buf_len = 0;
+/* output that did not fit in the buffer */
+static size_t buf_dropped = 0;
+/* larger region to move the output to once the bank is full */
+static char *spill_region = NULL;
+static size_t spill_size = 0;
 /* is the buffer currently enabled? otherwise just printf */
 static bool do_buffer_printf = false;
+/* print the buffer as it is rather than escaping it for xml */
+static bool raw_output = false;
 
 /* global to track if the current test has passed */
 static test_result_t current_test_result = SUCCESS;
 
+static void buffer_append(const char *string, size_t len)
+{
+    if (len > buf_size - buf_len && buf != spill_region && spill_size > buf_size) {
+        memcpy(spill_region, buf, buf_len);
+        buf = spill_region;
+        buf_size = spill_size;
+    }
+    size_t copy = MIN(len, buf_size - buf_len);
+    memcpy(buf + buf_len, string, copy);
+    buf_len += copy;
+    buf_dropped += len - copy;
+}
+
 #undef printf
-void sel4test_printf(const char *string)
+void sel4test_write(const char *string, size_t len)
 {
     if (!do_buffer_printf) {
-        printf("%s", string);
-    } else if (buf_index < STDOUT_CACHE && buf_index >= 0) {
-        size_t len = STDOUT_CACHE - buf_index;
-        snprintf(current_stdout_bank + buf_index, len, "%s", string);
-        /* NULL terminate the destination in case 'string' was too long. */
-        current_stdout_bank[STDOUT_CACHE - 1] = '\0';
-        buf_index += strlen(string);
+        fwrite(string, 1, len, stdout);
+    } else {
+        buffer_append(string, len);
     }
 }
 
+void sel4test_printf(const char *string)
+{
+    sel4test_write(string, strlen(string));
+}
+
+void sel4test_set_printf_spill(void *region, size_t size)
+{
+    assert(!do_buffer_printf);
+    spill_region = region;
+    spill_size = region != NULL ? size : 0;
+}
+
+void sel4test_set_raw_output(bool raw)
+{
+    raw_output = raw;
+}
+
+/* buffer even without xml output, so that the output of each of a number of concurrent
+ * tests comes out in one piece */
+static bool always_buffer_printf = false;
+
+void sel4test_set_concurrent_output(bool concurrent)
+{
+    always_buffer_printf = concurrent;
+}
+
 void sel4test_start_printf_buffer(void)
 {
     /* only enable the printf buffer if we are buffering output */
-    if (config_set(CONFIG_PRINT_XML)) {
-        buf_index = 0;
+    if (config_set(CONFIG_PRINT_XML) || always_buffer_printf) {
+        buf = current_stdout_bank;
+        buf_size = STDOUT_CACHE;
+        buf_len = 0;
+        buf_dropped = 0;
         do_buffer_printf = true;
     }
 }
 
+/* Write out the buffer with the characters that are special in xml escaped, a run of
+ * ordinary characters at a time */
+static void write_escaped(const char *string, size_t len)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        const char *entity;
+        switch (string[i]) {
+        case '<':
+            entity = "&lt;";
+            break;
+        case '>':
+            entity = "&gt;";
+            break;
+        case '&':
+            entity = "&amp;";
+            break;
+        default:
+            continue;
+        }
+        fwrite(string + start, 1, i - start, stdout);
+        fputs(entity, stdout);
+        start = i + 1;
+    }
+    fwrite(string + start, 1, len - start, stdout);
+}
+
 void sel4test_end_printf_buffer(void)
 {
     do_buffer_printf = false;
-    if (buf_index != 0) {
-        printf("\t\t<system-out>%s</system-out>\n", current_stdout_bank);
-        buf_index = 0;
+    if (buf_len != 0 || buf_dropped != 0) {
+        if (config_set(CONFIG_PRINT_XML)) {
+            fputs("\t\t<system-out>", stdout);
+            if (raw_output) {
+                fwrite(buf, 1, buf_len, stdout);
+            } else {
+                write_escaped(buf, buf_len);
+            }
+        } else {
+            fwrite(buf, 1, buf_len, stdout);
+        }
+        if (buf_dropped != 0) {
+            printf("\n[%zu bytes of output did not fit in the buffer]\n", buf_dropped);
+        }
+        if (config_set(CONFIG_PRINT_XML)) {
+            fputs("</system-out>\n", stdout);
+        }
+        buf = current_stdout_bank;
+        buf_size = STDOUT_CACHE;
+        buf_len = 0;
+        buf_dropped = 0;
     }
-
 }
 
 void _sel4test_report_error(const char *error, const char *file, int line)
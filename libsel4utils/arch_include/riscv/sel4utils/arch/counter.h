@@ -0,0 +1,8 @@
+/*
+ * Copyright 2018, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* No counter user level can rely on reading, so SEL4UTILS_HAVE_USER_COUNTER is left undefined */
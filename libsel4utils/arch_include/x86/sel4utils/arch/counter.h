@@ -0,0 +1,24 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* The TSC, its frequency can be found with x86_get_tsc_freq_from_simple in tsc.h */
+#define SEL4UTILS_HAVE_USER_COUNTER 1
+
+static inline uint64_t sel4utils_read_counter(void)
+{
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high) :: "memory");
+    return ((uint64_t) high << 32) | low;
+}
+
+/* frequency of the counter in Hz, 0 if it is not known */
+static inline uint64_t sel4utils_counter_freq(void)
+{
+    return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Latency of IPC and notifications between the test thread and a thread of its own,
+ * on the same core and on another core.
+ *
+ * The test thread is the client: it calls an endpoint, or signals a notification and
+ * waits on another, and the server thread, configured with sel4utils, answers. Each
+ * round trip is timed by the client. The server reads the cycle counter as soon as it
+ * wakes, which gives the one way time as well, but only on the same core as cycle
+ * counters of different cores are not in step. The server runs at the priority of
+ * the client, so on the same core the one way time of a signal includes the client
+ * blocking on its wait.
+ *
+ * The server and client either use the sel4utils/api.h wrappers or the raw system
+ * calls, so that the difference between the two is the cost of the wrappers. The
+ * kernel configuration is part of the name of every result, as the MCS kernel and
+ * the fastpath change them the most.
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include <sel4/sel4.h>
+#include <sel4bench/sel4bench.h>
+#include <vka/object.h>
+#include <sel4utils/api.h>
+#include <sel4utils/thread.h>
+#include <sel4utils/thread_config.h>
+
+#include <sel4test/benchmark.h>
+#include <sel4test/test.h>
+#include <sel4test/testutil.h>
+
+#define IPC_BENCH_SAMPLES 256
+#define IPC_BENCH_WARMUP  16
+
+typedef enum bench_kind {
+    BENCH_CALL,
+    BENCH_SIGNAL,
+} bench_kind_t;
+
+/* shared between the client and the server */
+typedef struct bench_ipc {
+    bench_kind_t kind;
+    bool api;
+    seL4_CPtr ep;
+    seL4_CPtr ping;
+    seL4_CPtr pong;
+    seL4_CPtr reply;
+    /* cycle count of the server when it last woke */
+    volatile ccnt_t received;
+} bench_ipc_t;
+
+static bench_ipc_t bench_ipc;
+static ccnt_t bench_round_trip[IPC_BENCH_SAMPLES];
+static ccnt_t bench_one_way[IPC_BENCH_SAMPLES];
+static ccnt_t bench_overhead;
+
+static const char *bench_kernel_config(void)
+{
+    if (config_set(CONFIG_KERNEL_MCS)) {
+        return config_set(CONFIG_FASTPATH) ? "mcs fastpath" : "mcs slowpath";
+    }
+    return config_set(CONFIG_FASTPATH) ? "fastpath" : "slowpath";
+}
+
+static inline void bench_received(bench_ipc_t *ipc)
+{
+    ccnt_t now;
+
+    SEL4BENCH_READ_CCNT(now);
+    ipc->received = now;
+}
+
+static void bench_call_server(bench_ipc_t *ipc)
+{
+    seL4_MessageInfo_t info = seL4_MessageInfo_new(0, 0, 0, 0);
+
+    if (ipc->api) {
+        api_recv(ipc->ep, NULL, ipc->reply);
+        while (true) {
+            bench_received(ipc);
+            api_reply_recv(ipc->ep, info, NULL, ipc->reply);
+        }
+    }
+#ifdef CONFIG_KERNEL_MCS
+    seL4_Recv(ipc->ep, NULL, ipc->reply);
+    while (true) {
+        bench_received(ipc);
+        seL4_ReplyRecv(ipc->ep, info, NULL, ipc->reply);
+    }
+#else
+    seL4_Recv(ipc->ep, NULL);
+    while (true) {
+        bench_received(ipc);
+        seL4_ReplyRecv(ipc->ep, info, NULL);
+    }
+#endif
+}
+
+static void bench_signal_server(bench_ipc_t *ipc)
+{
+    while (true) {
+        if (ipc->api) {
+            api_wait(ipc->ping, NULL);
+        } else {
+            seL4_Wait(ipc->ping, NULL);
+        }
+        bench_received(ipc);
+        seL4_Signal(ipc->pong);
+    }
+}
+
+static void bench_server(void *arg0, UNUSED void *arg1, UNUSED void *ipc_buf)
+{
+    bench_ipc_t *ipc = arg0;
+
+    if (ipc->kind == BENCH_CALL) {
+        bench_call_server(ipc);
+    } else {
+        bench_signal_server(ipc);
+    }
+}
+
+/* One round trip from the client, the one way time is up to the server waking */
+static void bench_sample(bench_ipc_t *ipc, int i)
+{
+    ccnt_t start, end;
+
+    if (ipc->kind == BENCH_CALL) {
+        SEL4BENCH_READ_CCNT(start);
+        seL4_Call(ipc->ep, seL4_MessageInfo_new(0, 0, 0, 0));
+        SEL4BENCH_READ_CCNT(end);
+    } else if (ipc->api) {
+        SEL4BENCH_READ_CCNT(start);
+        seL4_Signal(ipc->ping);
+        api_wait(ipc->pong, NULL);
+        SEL4BENCH_READ_CCNT(end);
+    } else {
+        SEL4BENCH_READ_CCNT(start);
+        seL4_Signal(ipc->ping);
+        seL4_Wait(ipc->pong, NULL);
+        SEL4BENCH_READ_CCNT(end);
+    }
+    if (i >= 0) {
+        bench_round_trip[i] = end - start;
+        bench_one_way[i] = ipc->received - start;
+    }
+}
+
+/* Start a server on a core, run the samples and report them. Fails if the server could not
+ * be set up, a regression is only recorded as the result of the test. */
+static int bench_run(env_t env, bench_kind_t kind, seL4_Word core, bool api, sel4bench_stats_t *round_trip)
+{
+    sel4utils_thread_t thread;
+    vka_object_t ep = {0}, ping = {0}, pong = {0};
+    char name[96];
+
+    int error = vka_alloc_endpoint(&env->vka, &ep);
+    test_error_eq(error, 0);
+    error = vka_alloc_notification(&env->vka, &ping);
+    test_error_eq(error, 0);
+    error = vka_alloc_notification(&env->vka, &pong);
+    test_error_eq(error, 0);
+
+    sel4utils_thread_config_t config = thread_config_default(&env->simple, env->cspace_root, seL4_NilData,
+                                                             seL4_CapNull, env->priority);
+    error = sel4utils_configure_thread_config(&env->vka, &env->vspace, &env->vspace, config, &thread);
+    test_error_eq(error, 0);
+    if (core != 0) {
+        sched_params_t params = config.sched_params;
+        if (config_set(CONFIG_KERNEL_MCS)) {
+            seL4_Time timeslice_us = CONFIG_BOOT_THREAD_TIME_SLICE * US_IN_MS;
+            params = sched_params_round_robin(params, &env->simple, core, timeslice_us);
+        } else {
+            params = sched_params_core(params, core);
+        }
+        error = sel4utils_set_sched_affinity(&thread, params);
+        test_error_eq(error, 0);
+    }
+
+    bench_ipc = (bench_ipc_t) {
+        .kind = kind,
+        .api = api,
+        .ep = ep.cptr,
+        .ping = ping.cptr,
+        .pong = pong.cptr,
+        .reply = thread.reply.cptr,
+    };
+    error = sel4utils_start_thread(&thread, bench_server, &bench_ipc, NULL, 1);
+    test_error_eq(error, 0);
+
+    for (int i = -IPC_BENCH_WARMUP; i < IPC_BENCH_SAMPLES; i++) {
+        bench_sample(&bench_ipc, i);
+    }
+
+    const char *op = kind == BENCH_CALL ? "Call/ReplyRecv" : "Signal/Wait";
+    snprintf(name, sizeof(name), "%s %s %s %s core round trip", bench_kernel_config(), op,
+             api ? "api" : "raw", core == 0 ? "same" : "cross");
+    sel4test_report_benchmark(name, bench_round_trip, IPC_BENCH_SAMPLES, bench_overhead, round_trip);
+    if (core == 0) {
+        snprintf(name, sizeof(name), "%s %s %s same core one way", bench_kernel_config(), op,
+                 api ? "api" : "raw");
+        sel4test_report_benchmark(name, bench_one_way, IPC_BENCH_SAMPLES, bench_overhead, NULL);
+    }
+
+    sel4utils_clean_up_thread(&env->vka, &env->vspace, &thread);
+    vka_free_object(&env->vka, &pong);
+    vka_free_object(&env->vka, &ping);
+    vka_free_object(&env->vka, &ep);
+    return SUCCESS;
+}
+
+static int bench_kind(env_t env, bench_kind_t kind)
+{
+    sel4bench_stats_t raw, api;
+
+    bench_overhead = sel4test_benchmark_overhead(bench_round_trip, IPC_BENCH_SAMPLES);
+
+    /* the other core is only used when there is one */
+    seL4_Word num_cores = env->cores > 1 ? 2 : 1;
+    for (seL4_Word core = 0; core < num_cores; core++) {
+        if (bench_run(env, kind, core, false, &raw) != SUCCESS ||
+            bench_run(env, kind, core, true, &api) != SUCCESS) {
+            break;
+        }
+        printf("ipc bench: %s %s %s core: api overhead %"PRId64" cycles\n", bench_kernel_config(),
+               kind == BENCH_CALL ? "Call/ReplyRecv" : "Signal/Wait", core == 0 ? "same" : "cross",
+               (int64_t) api.median - (int64_t) raw.median);
+    }
+    return sel4test_get_result();
+}
+
+static int bench_call(env_t env)
+{
+    return bench_kind(env, BENCH_CALL);
+}
+DEFINE_BENCHMARK_SUITE(IPC_BENCH_001, "Latency of Call and ReplyRecv", bench_call)
+
+static int bench_signal(env_t env)
+{
+    return bench_kind(env, BENCH_SIGNAL);
+}
+DEFINE_BENCHMARK_SUITE(IPC_BENCH_002, "Latency of Signal and Wait", bench_signal)
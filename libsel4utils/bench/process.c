@@ -0,0 +1,362 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Cost of the life of a process: configuring it, giving it caps, spawning it and
+ * destroying it again, for each ELF image in the cpio archive and a few cspace sizes
+ * and numbers of caps.
+ *
+ * The totals of each operation are timed with the cycle counter. With
+ * LibSel4UtilsProfile the trace points in process.c and elf.c also split them into
+ * their phases, such as creating the cspace, reserving and loading each ELF segment
+ * and writing the stack. The trace points are timestamped with the counter of
+ * sel4utils rather than the cycle counter, so the phases are scaled to the cycles of
+ * the operation they are part of. Platforms without a user counter only get totals.
+ */
+
+#include <sel4utils/gen_config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sel4/sel4.h>
+#include <sel4bench/sel4bench.h>
+#include <cpio/cpio.h>
+#include <elf/elf.h>
+#include <vka/capops.h>
+#include <vka/object.h>
+#include <sel4utils/process.h>
+#include <sel4utils/trace.h>
+
+#include <sel4test/benchmark.h>
+#include <sel4test/test.h>
+#include <sel4test/testutil.h>
+
+#define PROCESS_BENCH_RUNS   8
+#define PROCESS_BENCH_WARMUP 1
+/* most images of the archive benchmarked */
+#define PROCESS_BENCH_MAX_IMAGES 4
+#define PROCESS_BENCH_MAX_CAPS   1024
+/* most distinct phases of one configuration */
+#define PROCESS_BENCH_MAX_PHASES 32
+#define PROCESS_BENCH_TRACE_BITS 6
+
+extern char _cpio_archive[];
+extern char _cpio_archive_end[];
+
+/* size of the cspace of the process, and caps given to it after configuring it */
+typedef struct bench_caps_config {
+    int cspace_bits;
+    size_t num_caps;
+} bench_caps_config_t;
+
+static const bench_caps_config_t bench_caps_configs[] = {
+    { 8, 0 },
+    { 12, 64 },
+    { 12, PROCESS_BENCH_MAX_CAPS },
+};
+
+typedef struct bench_image {
+    const char *name;
+    unsigned long size;
+} bench_image_t;
+
+typedef struct bench_phase {
+    char name[48];
+    ccnt_t samples[PROCESS_BENCH_RUNS];
+    /* a phase is only in the runs that passed its trace point */
+    bool recorded[PROCESS_BENCH_RUNS];
+} bench_phase_t;
+
+static bench_image_t bench_images[PROCESS_BENCH_MAX_IMAGES];
+static size_t bench_num_images;
+
+static sel4utils_process_cap_t bench_caps[PROCESS_BENCH_MAX_CAPS];
+
+static ccnt_t bench_configure[PROCESS_BENCH_RUNS];
+static ccnt_t bench_give_caps[PROCESS_BENCH_RUNS];
+static ccnt_t bench_spawn[PROCESS_BENCH_RUNS];
+static ccnt_t bench_destroy[PROCESS_BENCH_RUNS];
+static ccnt_t bench_overhead;
+
+static bench_phase_t bench_phases[PROCESS_BENCH_MAX_PHASES];
+static size_t bench_num_phases;
+
+#ifdef CONFIG_SEL4UTILS_PROFILE
+static const char *bench_tracepoints[] = {
+    "process_configure_start",
+    "process_configure_cspace",
+    "process_configure_vspace",
+    "process_configure_elf",
+    "process_configure_done",
+    "process_spawn_start",
+    "process_spawn_stack",
+    "process_spawn_done",
+    "process_destroy_start",
+    "process_destroy_cspace",
+    "process_destroy_thread",
+    "process_destroy_vspace",
+    "process_destroy_done",
+    "elf_load_reserved",
+    "elf_load_segment",
+};
+
+static char bench_trace_memory[SEL4UTILS_TRACE_BUFFER_SIZE(PROCESS_BENCH_TRACE_BITS)]
+__attribute__((aligned(SEL4UTILS_TRACE_CACHE_LINE)));
+
+/* records of the last operation, in order */
+static sel4utils_trace_record_t bench_records[BIT(PROCESS_BENCH_TRACE_BITS)];
+static size_t bench_num_records;
+
+static void bench_read_record(UNUSED seL4_Word core, sel4utils_trace_record_t *record, UNUSED void *cookie)
+{
+    if (bench_num_records < ARRAY_SIZE(bench_records)) {
+        bench_records[bench_num_records++] = *record;
+    }
+}
+#endif /* CONFIG_SEL4UTILS_PROFILE */
+
+/* Find the ELF images in the archive, which is all of them in the usual test setup */
+static void bench_find_images(void)
+{
+    unsigned long len = _cpio_archive_end - _cpio_archive;
+    struct cpio_info info;
+
+    bench_num_images = 0;
+    if (cpio_info(_cpio_archive, len, &info) != 0) {
+        return;
+    }
+    for (int i = 0; i < info.file_count && bench_num_images < PROCESS_BENCH_MAX_IMAGES; i++) {
+        const char *name;
+        unsigned long size;
+        elf_t elf;
+        void *file = cpio_get_entry(_cpio_archive, len, i, &name, &size);
+        if (file != NULL && elf_newFile(file, size, &elf) == 0) {
+            bench_images[bench_num_images++] = (bench_image_t) {
+                .name = name,
+                .size = size,
+            };
+        }
+    }
+}
+
+static ccnt_t *bench_phase(const char *name, int run)
+{
+    bench_phase_t *phase = NULL;
+
+    for (size_t i = 0; i < bench_num_phases && phase == NULL; i++) {
+        if (strcmp(bench_phases[i].name, name) == 0) {
+            phase = &bench_phases[i];
+        }
+    }
+    if (phase == NULL) {
+        if (bench_num_phases == PROCESS_BENCH_MAX_PHASES) {
+            return NULL;
+        }
+        phase = &bench_phases[bench_num_phases++];
+        memset(phase, 0, sizeof(*phase));
+        strncpy(phase->name, name, sizeof(phase->name) - 1);
+    }
+    phase->recorded[run] = true;
+    return &phase->samples[run];
+}
+
+static void bench_start(ccnt_t *start)
+{
+#ifdef CONFIG_SEL4UTILS_PROFILE
+    sel4utils_trace_reset();
+#endif
+    SEL4BENCH_READ_CCNT(*start);
+}
+
+/* Record an operation, the warmup runs have a negative index. Each phase is the
+ * time from the trace point before it, and is named after the trace point that ends
+ * it. */
+static void bench_end(int run, ccnt_t start, ccnt_t *total)
+{
+    ccnt_t end;
+
+    SEL4BENCH_READ_CCNT(end);
+    if (run < 0) {
+        return;
+    }
+    total[run] = end - start;
+
+#ifdef CONFIG_SEL4UTILS_PROFILE
+    bench_num_records = 0;
+    sel4utils_trace_read(0, bench_read_record, NULL);
+    if (bench_num_records < 2) {
+        return;
+    }
+    uint64_t span = bench_records[bench_num_records - 1].timestamp - bench_records[0].timestamp;
+    if (span == 0) {
+        /* no counter to timestamp with */
+        return;
+    }
+    for (size_t i = 1; i < bench_num_records; i++) {
+        sel4utils_trace_record_t *record = &bench_records[i];
+        uint64_t ticks = record->timestamp - bench_records[i - 1].timestamp;
+        char name[48];
+
+        if (strcmp(record->tracepoint->name, "elf_load_segment") == 0) {
+            snprintf(name, sizeof(name), "%s %zu", record->tracepoint->name, (size_t) record->arg);
+        } else {
+            snprintf(name, sizeof(name), "%s", record->tracepoint->name);
+        }
+        ccnt_t *sample = bench_phase(name, run);
+        if (sample != NULL) {
+            *sample += ticks * total[run] / span;
+        }
+    }
+#endif /* CONFIG_SEL4UTILS_PROFILE */
+}
+
+static void bench_report_one(const char *name, const char *split, ccnt_t *samples, size_t num_samples,
+                             ccnt_t overhead)
+{
+    char full_name[128];
+
+    snprintf(full_name, sizeof(full_name), "%s %s", name, split);
+    sel4test_report_benchmark(full_name, samples, num_samples, overhead, NULL);
+}
+
+/* Report a phase over the runs that had it, rather than counting the others as free */
+static void bench_report_phase(const char *name, bench_phase_t *phase)
+{
+    size_t num_samples = 0;
+
+    for (size_t run = 0; run < PROCESS_BENCH_RUNS; run++) {
+        if (phase->recorded[run]) {
+            phase->samples[num_samples++] = phase->samples[run];
+        }
+    }
+    bench_report_one(name, phase->name, phase->samples, num_samples, 0);
+}
+
+static void bench_report(const char *name, size_t num_caps)
+{
+    bench_report_one(name, "configure", bench_configure, PROCESS_BENCH_RUNS, bench_overhead);
+    if (num_caps > 0) {
+        bench_report_one(name, "give caps", bench_give_caps, PROCESS_BENCH_RUNS, bench_overhead);
+    }
+    bench_report_one(name, "spawn", bench_spawn, PROCESS_BENCH_RUNS, bench_overhead);
+    bench_report_one(name, "destroy", bench_destroy, PROCESS_BENCH_RUNS, bench_overhead);
+    for (size_t i = 0; i < bench_num_phases; i++) {
+        bench_report_phase(name, &bench_phases[i]);
+    }
+}
+
+static int bench_init(env_t env, vka_object_t *endpoint)
+{
+    bench_overhead = sel4test_benchmark_overhead(bench_configure, PROCESS_BENCH_RUNS);
+
+    bench_find_images();
+
+    /* the caps given to each process are all badged copies of one endpoint */
+    int error = vka_alloc_endpoint(&env->vka, endpoint);
+    if (error) {
+        return error;
+    }
+    for (size_t i = 0; i < PROCESS_BENCH_MAX_CAPS; i++) {
+        vka_cspace_make_path(&env->vka, endpoint->cptr, &bench_caps[i].src);
+        bench_caps[i].rights = seL4_AllRights;
+        bench_caps[i].data = i + 1;
+    }
+
+#ifdef CONFIG_SEL4UTILS_PROFILE
+    error = sel4utils_trace_init_buffer(0, bench_trace_memory, PROCESS_BENCH_TRACE_BITS);
+    if (error) {
+        vka_free_object(&env->vka, endpoint);
+        return error;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(bench_tracepoints); i++) {
+        sel4utils_trace_enable(bench_tracepoints[i], true);
+    }
+#endif
+    return 0;
+}
+
+static void bench_fini(env_t env, vka_object_t *endpoint)
+{
+#ifdef CONFIG_SEL4UTILS_PROFILE
+    for (size_t i = 0; i < ARRAY_SIZE(bench_tracepoints); i++) {
+        sel4utils_trace_enable(bench_tracepoints[i], false);
+    }
+    sel4utils_trace_reset();
+#endif
+    vka_free_object(&env->vka, endpoint);
+}
+
+static int bench_lifecycle(env_t env, const bench_image_t *image, const bench_caps_config_t *caps)
+{
+    sel4utils_process_t process;
+    char *argv[] = { (char *) image->name };
+    ccnt_t start;
+
+    sel4utils_process_config_t config = process_config_default_simple(&env->simple, image->name,
+                                                                      env->priority);
+    config = process_config_create_cnode(config, caps->cspace_bits);
+
+    bench_num_phases = 0;
+    for (int run = -PROCESS_BENCH_WARMUP; run < PROCESS_BENCH_RUNS; run++) {
+        bench_start(&start);
+        int error = sel4utils_configure_process_custom(&process, &env->vka, &env->vspace, config);
+        bench_end(run, start, bench_configure);
+        test_error_eq(error, 0);
+
+        if (caps->num_caps > 0) {
+            bench_start(&start);
+            seL4_CPtr slot = sel4utils_copy_caps_to_process(&process, bench_caps, caps->num_caps);
+            bench_end(run, start, bench_give_caps);
+            if (slot == seL4_CapNull) {
+                sel4utils_destroy_process(&process, &env->vka);
+            }
+            test_assert(slot != seL4_CapNull);
+        }
+
+        bench_start(&start);
+        error = sel4utils_spawn_process_v(&process, &env->vka, &env->vspace, ARRAY_SIZE(argv), argv, 0);
+        bench_end(run, start, bench_spawn);
+        if (error) {
+            sel4utils_destroy_process(&process, &env->vka);
+        }
+        test_error_eq(error, 0);
+
+        bench_start(&start);
+        sel4utils_destroy_process(&process, &env->vka);
+        bench_end(run, start, bench_destroy);
+    }
+
+    char name[96];
+    snprintf(name, sizeof(name), "process %s (%lu bytes) cspace %d bits %zu caps", image->name, image->size,
+             caps->cspace_bits, caps->num_caps);
+    bench_report(name, caps->num_caps);
+    return sel4test_get_result();
+}
+
+static int bench_process_lifecycle(env_t env)
+{
+    vka_object_t endpoint;
+
+    int error = bench_init(env, &endpoint);
+    test_error_eq(error, 0);
+    if (bench_num_images == 0) {
+        bench_fini(env, &endpoint);
+    }
+    test_assert(bench_num_images > 0);
+    for (size_t i = 0; i < bench_num_images; i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(bench_caps_configs); j++) {
+            if (bench_lifecycle(env, &bench_images[i], &bench_caps_configs[j]) != SUCCESS) {
+                bench_fini(env, &endpoint);
+                return sel4test_get_result();
+            }
+        }
+    }
+    bench_fini(env, &endpoint);
+    return sel4test_get_result();
+}
+DEFINE_BENCHMARK_SUITE(PROCESS_BENCH_001, "Cost of configuring, spawning and destroying processes",
+                       bench_process_lifecycle)
@@ -0,0 +1,532 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Cost of the sel4utils vspace operations.
+ *
+ * Every operation runs on a vspace of its own, made with a vka and a map_page
+ * function that time themselves. This splits the cycles of each operation three
+ * ways:
+ *
+ * kernel       mapping pages, not counting the paging structures map_page allocates
+ * vka          allocating and freeing frames, paging structures and slots, which
+ *              includes the kernel retyping them
+ * book keeping everything else, done by the vspace itself
+ *
+ * Unmapping calls the kernel directly, so its kernel time is measured by mapping
+ * the same frames again with the kernel alone and timing unmapping them that way.
+ * Sharing memory copies caps and tearing down a vspace deletes them directly
+ * too, and that is left in their book keeping. Each split is reported as a series
+ * of the suite, in cycles, over a number of runs after a warmup run that also
+ * creates the paging structures.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <sel4/sel4.h>
+#include <sel4bench/sel4bench.h>
+#include <vka/capops.h>
+#include <vka/object.h>
+#include <vspace/vspace.h>
+#include <vspace/page.h>
+#include <sel4utils/vspace.h>
+#include <sel4utils/vspace_internal.h>
+
+#include <sel4test/benchmark.h>
+#include <sel4test/test.h>
+#include <sel4test/testutil.h>
+
+#define VSPACE_BENCH_RUNS   16
+#define VSPACE_BENCH_WARMUP 1
+/* most frames of any one run */
+#define VSPACE_BENCH_MAX_PAGES 256
+
+/* frames of a run, and their size */
+typedef struct bench_size {
+    size_t num_pages;
+    size_t size_bits;
+} bench_size_t;
+
+static const bench_size_t bench_sizes[] = {
+    { 1, seL4_PageBits },
+    { 16, seL4_PageBits },
+    { VSPACE_BENCH_MAX_PAGES, seL4_PageBits },
+    { 1, seL4_LargePageBits },
+    { 4, seL4_LargePageBits },
+};
+
+/* cycles spent in the kernel and in the vka since the start of a run */
+static struct {
+    ccnt_t kernel;
+    ccnt_t vka;
+} bench_time;
+
+static ccnt_t bench_total[VSPACE_BENCH_RUNS];
+static ccnt_t bench_kernel[VSPACE_BENCH_RUNS];
+static ccnt_t bench_vka_time[VSPACE_BENCH_RUNS];
+static ccnt_t bench_other[VSPACE_BENCH_RUNS];
+static ccnt_t bench_overhead;
+
+static seL4_CPtr bench_caps[VSPACE_BENCH_MAX_PAGES];
+static vka_object_t bench_frames[VSPACE_BENCH_MAX_PAGES];
+
+#define BENCH_TIME_VKA(expr) ({ \
+    ccnt_t _start, _end; \
+    SEL4BENCH_READ_CCNT(_start); \
+    typeof(expr) _ret = (expr); \
+    SEL4BENCH_READ_CCNT(_end); \
+    bench_time.vka += _end - _start; \
+    _ret; \
+})
+
+#define BENCH_TIME_VKA_VOID(expr) do { \
+    ccnt_t _start, _end; \
+    SEL4BENCH_READ_CCNT(_start); \
+    expr; \
+    SEL4BENCH_READ_CCNT(_end); \
+    bench_time.vka += _end - _start; \
+} while (0)
+
+static int bench_cspace_alloc(void *data, seL4_CPtr *res)
+{
+    return BENCH_TIME_VKA(vka_cspace_alloc(data, res));
+}
+
+static void bench_cspace_make_path(void *data, seL4_CPtr slot, cspacepath_t *res)
+{
+    vka_cspace_make_path(data, slot, res);
+}
+
+static void bench_cspace_free(void *data, seL4_CPtr slot)
+{
+    BENCH_TIME_VKA_VOID(vka_cspace_free(data, slot));
+}
+
+static int bench_utspace_alloc(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                               seL4_Word *res)
+{
+    return BENCH_TIME_VKA(vka_utspace_alloc(data, dest, type, size_bits, res));
+}
+
+static int bench_utspace_alloc_maybe_device(void *data, const cspacepath_t *dest, seL4_Word type,
+                                            seL4_Word size_bits, bool can_use_dev, seL4_Word *res)
+{
+    return BENCH_TIME_VKA(vka_utspace_alloc_maybe_device(data, dest, type, size_bits, can_use_dev, res));
+}
+
+static int bench_utspace_alloc_at(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                  uintptr_t paddr, seL4_Word *res)
+{
+    return BENCH_TIME_VKA(vka_utspace_alloc_at(data, dest, type, size_bits, paddr, res));
+}
+
+static void bench_utspace_free(void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
+{
+    BENCH_TIME_VKA_VOID(vka_utspace_free(data, type, size_bits, target));
+}
+
+static uintptr_t bench_utspace_paddr(void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits)
+{
+    return vka_utspace_paddr(data, target, type, size_bits);
+}
+
+static int bench_cspace_alloc_n(void *data, size_t num, seL4_CPtr *res)
+{
+    return BENCH_TIME_VKA(vka_cspace_alloc_n(data, num, res));
+}
+
+static int bench_utspace_alloc_n(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                 size_t num, seL4_Word *res)
+{
+    return BENCH_TIME_VKA(vka_utspace_alloc_n(data, dest, type, size_bits, num, res));
+}
+
+static void bench_utspace_free_n(void *data, seL4_Word type, seL4_Word size_bits, size_t num, seL4_Word target)
+{
+    BENCH_TIME_VKA_VOID(vka_utspace_free_n(data, type, size_bits, num, target));
+}
+
+static vka_t bench_vka;
+
+static void bench_vka_init(vka_t *delegate)
+{
+    bench_vka = (vka_t) {
+        .data = delegate,
+        .cspace_alloc = bench_cspace_alloc,
+        .cspace_make_path = bench_cspace_make_path,
+        .utspace_alloc = bench_utspace_alloc,
+        .utspace_alloc_maybe_device = bench_utspace_alloc_maybe_device,
+        .utspace_alloc_at = bench_utspace_alloc_at,
+        .cspace_free = bench_cspace_free,
+        .utspace_free = bench_utspace_free,
+        .utspace_paddr = bench_utspace_paddr,
+        .cspace_alloc_n = bench_cspace_alloc_n,
+        .utspace_alloc_n = bench_utspace_alloc_n,
+        .utspace_free_n = bench_utspace_free_n,
+    };
+}
+
+static int bench_map_page(vspace_t *vspace, seL4_CPtr cap, void *vaddr, seL4_CapRights_t rights, int cacheable,
+                          size_t size_bits)
+{
+    ccnt_t start, end;
+    ccnt_t vka = bench_time.vka;
+
+    SEL4BENCH_READ_CCNT(start);
+    int error = sel4utils_map_page_pd(vspace, cap, vaddr, rights, cacheable, size_bits);
+    SEL4BENCH_READ_CCNT(end);
+    /* paging structures that are missing are allocated from the vka */
+    bench_time.kernel += (end - start) - (bench_time.vka - vka);
+    return error;
+}
+
+typedef struct bench_vspace {
+    vka_object_t root;
+    vspace_t vspace;
+    sel4utils_alloc_data_t data;
+} bench_vspace_t;
+
+static int bench_vspace_create(env_t env, bench_vspace_t *bench)
+{
+    int error = vka_alloc_vspace_root(&env->vka, &bench->root);
+    if (error) {
+        return error;
+    }
+    error = seL4_ARCH_ASIDPool_Assign(env->asid_pool, bench->root.cptr);
+    if (error == seL4_NoError) {
+        error = sel4utils_get_vspace_with_map(&env->vspace, &bench->vspace, &bench->data, &bench_vka,
+                                              bench->root.cptr, NULL, NULL, bench_map_page);
+    }
+    if (error) {
+        vka_free_object(&env->vka, &bench->root);
+    }
+    return error;
+}
+
+static void bench_vspace_destroy(env_t env, bench_vspace_t *bench)
+{
+    vspace_tear_down(&bench->vspace, VSPACE_FREE);
+    vka_free_object(&env->vka, &bench->root);
+}
+
+static int bench_alloc_frames(env_t env, const bench_size_t *size)
+{
+    for (size_t i = 0; i < size->num_pages; i++) {
+        int error = vka_alloc_frame(&env->vka, size->size_bits, &bench_frames[i]);
+        if (error) {
+            while (i-- > 0) {
+                vka_free_object(&env->vka, &bench_frames[i]);
+            }
+            return error;
+        }
+        bench_caps[i] = bench_frames[i].cptr;
+    }
+    return 0;
+}
+
+static void bench_free_frames(env_t env, const bench_size_t *size)
+{
+    for (size_t i = 0; i < size->num_pages; i++) {
+        vka_free_object(&env->vka, &bench_frames[i]);
+    }
+}
+
+static void bench_start(ccnt_t *start)
+{
+    bench_time.kernel = 0;
+    bench_time.vka = 0;
+    SEL4BENCH_READ_CCNT(*start);
+}
+
+/* Record a run, the warmup runs have a negative index */
+static void bench_end(int run, ccnt_t start)
+{
+    ccnt_t end;
+
+    SEL4BENCH_READ_CCNT(end);
+    if (run >= 0) {
+        bench_total[run] = end - start;
+        bench_kernel[run] = bench_time.kernel;
+        bench_vka_time[run] = bench_time.vka;
+    }
+}
+
+static void bench_report_one(const char *name, const char *split, ccnt_t *samples, ccnt_t overhead)
+{
+    char full_name[96];
+
+    snprintf(full_name, sizeof(full_name), "%s %s", name, split);
+    sel4test_report_benchmark(full_name, samples, VSPACE_BENCH_RUNS, overhead, NULL);
+}
+
+static void bench_report(const char *name)
+{
+    for (int i = 0; i < VSPACE_BENCH_RUNS; i++) {
+        ccnt_t accounted = bench_kernel[i] + bench_vka_time[i];
+        bench_other[i] = bench_total[i] > accounted ? bench_total[i] - accounted : 0;
+    }
+    bench_report_one(name, "total", bench_total, bench_overhead);
+    bench_report_one(name, "kernel", bench_kernel, 0);
+    bench_report_one(name, "vka", bench_vka_time, 0);
+    bench_report_one(name, "book keeping", bench_other, 0);
+}
+
+static void bench_init(env_t env)
+{
+    bench_vka_init(&env->vka);
+    bench_overhead = sel4test_benchmark_overhead(bench_total, VSPACE_BENCH_RUNS);
+}
+
+static int bench_new_pages(env_t env)
+{
+    int error;
+    bench_vspace_t bench;
+    char name[64];
+    ccnt_t start;
+
+    bench_init(env);
+    for (size_t i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+        const bench_size_t *size = &bench_sizes[i];
+
+        error = bench_vspace_create(env, &bench);
+        test_error_eq(error, 0);
+        for (int run = -VSPACE_BENCH_WARMUP; run < VSPACE_BENCH_RUNS; run++) {
+            bench_start(&start);
+            void *vaddr = vspace_new_pages(&bench.vspace, seL4_AllRights, size->num_pages, size->size_bits);
+            bench_end(run, start);
+            test_assert(vaddr != NULL);
+            vspace_unmap_pages(&bench.vspace, vaddr, size->num_pages, size->size_bits, VSPACE_FREE);
+        }
+        bench_vspace_destroy(env, &bench);
+
+        snprintf(name, sizeof(name), "new_pages %zux%zu", size->num_pages, size->size_bits);
+        bench_report(name);
+    }
+    return sel4test_get_result();
+}
+DEFINE_BENCHMARK_SUITE(VSPACE_BENCH_001, "Cost of vspace_new_pages", bench_new_pages)
+
+static int bench_map_pages_at_vaddr(env_t env)
+{
+    int error;
+    bench_vspace_t bench;
+    char name[64];
+    ccnt_t start;
+    void *vaddr;
+
+    bench_init(env);
+    for (size_t i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+        const bench_size_t *size = &bench_sizes[i];
+
+        error = bench_alloc_frames(env, size);
+        test_error_eq(error, 0);
+        error = bench_vspace_create(env, &bench);
+        test_error_eq(error, 0);
+        reservation_t res = vspace_reserve_range_aligned(&bench.vspace, size->num_pages * BIT(size->size_bits),
+                                                         size->size_bits, seL4_AllRights, 1, &vaddr);
+        test_assert(res.res != NULL);
+        for (int run = -VSPACE_BENCH_WARMUP; run < VSPACE_BENCH_RUNS; run++) {
+            bench_start(&start);
+            error = vspace_map_pages_at_vaddr(&bench.vspace, bench_caps, NULL, vaddr, size->num_pages,
+                                                  size->size_bits, res);
+            bench_end(run, start);
+            test_error_eq(error, 0);
+            vspace_unmap_pages(&bench.vspace, vaddr, size->num_pages, size->size_bits, VSPACE_PRESERVE);
+        }
+        vspace_free_reservation(&bench.vspace, res);
+        bench_vspace_destroy(env, &bench);
+        bench_free_frames(env, size);
+
+        snprintf(name, sizeof(name), "map_pages_at_vaddr %zux%zu", size->num_pages, size->size_bits);
+        bench_report(name);
+    }
+    return sel4test_get_result();
+}
+DEFINE_BENCHMARK_SUITE(VSPACE_BENCH_002, "Cost of vspace_map_pages_at_vaddr", bench_map_pages_at_vaddr)
+
+static int bench_unmap_pages(env_t env)
+{
+    int error;
+    bench_vspace_t bench;
+    char name[64];
+    ccnt_t start, end;
+    void *vaddr;
+
+    bench_init(env);
+    for (size_t i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+        const bench_size_t *size = &bench_sizes[i];
+
+        error = bench_alloc_frames(env, size);
+        test_error_eq(error, 0);
+        error = bench_vspace_create(env, &bench);
+        test_error_eq(error, 0);
+        reservation_t res = vspace_reserve_range_aligned(&bench.vspace, size->num_pages * BIT(size->size_bits),
+                                                         size->size_bits, seL4_AllRights, 1, &vaddr);
+        test_assert(res.res != NULL);
+        for (int run = -VSPACE_BENCH_WARMUP; run < VSPACE_BENCH_RUNS; run++) {
+            error = vspace_map_pages_at_vaddr(&bench.vspace, bench_caps, NULL, vaddr, size->num_pages,
+                                                  size->size_bits, res);
+            test_error_eq(error, 0);
+            bench_start(&start);
+            vspace_unmap_pages(&bench.vspace, vaddr, size->num_pages, size->size_bits, VSPACE_PRESERVE);
+            bench_end(run, start);
+
+            /* The paging structures are still there, so mapping again only takes the kernel */
+            for (size_t j = 0; j < size->num_pages; j++) {
+                error = seL4_ARCH_Page_Map(bench_caps[j], bench.root.cptr,
+                                           (seL4_Word) vaddr + j * BIT(size->size_bits), seL4_AllRights,
+                                           seL4_ARCH_Default_VMAttributes);
+                test_error_eq(error, seL4_NoError);
+            }
+            SEL4BENCH_READ_CCNT(start);
+            for (size_t j = 0; j < size->num_pages; j++) {
+                seL4_ARCH_Page_Unmap(bench_caps[j]);
+            }
+            SEL4BENCH_READ_CCNT(end);
+            if (run >= 0) {
+                bench_kernel[run] = end - start;
+            }
+        }
+        vspace_free_reservation(&bench.vspace, res);
+        bench_vspace_destroy(env, &bench);
+        bench_free_frames(env, size);
+
+        snprintf(name, sizeof(name), "unmap_pages %zux%zu", size->num_pages, size->size_bits);
+        bench_report(name);
+    }
+    return sel4test_get_result();
+}
+DEFINE_BENCHMARK_SUITE(VSPACE_BENCH_003, "Cost of vspace_unmap_pages", bench_unmap_pages)
+
+/* number of holes left in the address space before reserving */
+static const size_t bench_holes[] = { 0, 64, 1024 };
+
+static reservation_t bench_fragments[2 * 1024];
+
+static int bench_reserve_range(env_t env)
+{
+    int error;
+    bench_vspace_t bench;
+    char name[64];
+    ccnt_t start;
+    void *vaddr;
+
+    bench_init(env);
+    for (size_t i = 0; i < ARRAY_SIZE(bench_holes); i++) {
+        size_t holes = bench_holes[i];
+
+        error = bench_vspace_create(env, &bench);
+        test_error_eq(error, 0);
+        /* reserve pages next to each other and free every other one */
+        for (size_t j = 0; j < 2 * holes; j++) {
+            bench_fragments[j] = vspace_reserve_range(&bench.vspace, PAGE_SIZE_4K, seL4_AllRights, 1, &vaddr);
+            test_assert(bench_fragments[j].res != NULL);
+        }
+        for (size_t j = 0; j < 2 * holes; j += 2) {
+            vspace_free_reservation(&bench.vspace, bench_fragments[j]);
+        }
+
+        /* a page fits in a hole, two do not */
+        for (size_t pages = 1; pages <= 2; pages++) {
+            for (int run = -VSPACE_BENCH_WARMUP; run < VSPACE_BENCH_RUNS; run++) {
+                bench_start(&start);
+                reservation_t res = vspace_reserve_range(&bench.vspace, pages * PAGE_SIZE_4K, seL4_AllRights, 1,
+                                                         &vaddr);
+                bench_end(run, start);
+                test_assert(res.res != NULL);
+                vspace_free_reservation(&bench.vspace, res);
+            }
+            snprintf(name, sizeof(name), "reserve_range %zu pages %zu holes", pages, holes);
+            bench_report(name);
+        }
+
+        for (size_t j = 1; j < 2 * holes; j += 2) {
+            vspace_free_reservation(&bench.vspace, bench_fragments[j]);
+        }
+        bench_vspace_destroy(env, &bench);
+    }
+    return sel4test_get_result();
+}
+DEFINE_BENCHMARK_SUITE(VSPACE_BENCH_004, "Cost of vspace_reserve_range in a fragmented address space",
+                       bench_reserve_range)
+
+static int bench_share_mem(env_t env)
+{
+    int error;
+    bench_vspace_t from, to;
+    char name[64];
+    ccnt_t start;
+    void *vaddr;
+
+    bench_init(env);
+    for (size_t i = 0; i < ARRAY_SIZE(bench_sizes); i++) {
+        const bench_size_t *size = &bench_sizes[i];
+
+        error = bench_vspace_create(env, &from);
+        test_error_eq(error, 0);
+        error = bench_vspace_create(env, &to);
+        test_error_eq(error, 0);
+        void *src = vspace_new_pages(&from.vspace, seL4_AllRights, size->num_pages, size->size_bits);
+        test_assert(src != NULL);
+        for (int run = -VSPACE_BENCH_WARMUP; run < VSPACE_BENCH_RUNS; run++) {
+            reservation_t res = vspace_reserve_range_aligned(&to.vspace, size->num_pages * BIT(size->size_bits),
+                                                             size->size_bits, seL4_AllRights, 1, &vaddr);
+            test_assert(res.res != NULL);
+            bench_start(&start);
+            error = sel4utils_share_mem_at_vaddr(&from.vspace, &to.vspace, src, size->num_pages,
+                                                     size->size_bits, vaddr, res);
+            bench_end(run, start);
+            test_error_eq(error, 0);
+            /* frees the copies of the caps, the frames belong to from */
+            vspace_unmap_pages(&to.vspace, vaddr, size->num_pages, size->size_bits, VSPACE_FREE);
+            vspace_free_reservation(&to.vspace, res);
+        }
+        bench_vspace_destroy(env, &to);
+        bench_vspace_destroy(env, &from);
+
+        snprintf(name, sizeof(name), "share_mem_at_vaddr %zux%zu", size->num_pages, size->size_bits);
+        bench_report(name);
+    }
+    return sel4test_get_result();
+}
+DEFINE_BENCHMARK_SUITE(VSPACE_BENCH_005, "Cost of sel4utils_share_mem_at_vaddr", bench_share_mem)
+
+/* pages of 4K mapped in the vspace torn down */
+static const size_t bench_tear_down_pages[] = { 256, 2048 };
+
+static int bench_tear_down(env_t env)
+{
+    int error;
+    bench_vspace_t bench;
+    char name[64];
+    ccnt_t start;
+
+    bench_init(env);
+    for (size_t i = 0; i < ARRAY_SIZE(bench_tear_down_pages); i++) {
+        size_t num_pages = bench_tear_down_pages[i];
+
+        for (int run = -VSPACE_BENCH_WARMUP; run < VSPACE_BENCH_RUNS; run++) {
+            error = bench_vspace_create(env, &bench);
+            test_error_eq(error, 0);
+            /* in pieces, so that the frames do not have to be contiguous and
+             * there are many reservations to free */
+            for (size_t j = 0; j < num_pages; j += VSPACE_BENCH_MAX_PAGES) {
+                void *vaddr = vspace_new_pages(&bench.vspace, seL4_AllRights, VSPACE_BENCH_MAX_PAGES, seL4_PageBits);
+                test_assert(vaddr != NULL);
+            }
+            bench_start(&start);
+            sel4utils_tear_down(&bench.vspace, VSPACE_FREE);
+            bench_end(run, start);
+            vka_free_object(&env->vka, &bench.root);
+        }
+
+        snprintf(name, sizeof(name), "tear_down %zu pages", num_pages);
+        bench_report(name);
+    }
+    return sel4test_get_result();
+}
+DEFINE_BENCHMARK_SUITE(VSPACE_BENCH_006, "Cost of sel4utils_tear_down of a large vspace", bench_tear_down)
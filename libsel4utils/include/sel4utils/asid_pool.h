@@ -0,0 +1,93 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sel4/sel4.h>
+#include <vka/vka.h>
+#include <vka/object.h>
+
+/* Hands out ASIDs from as many ASID pools as it takes.
+ *
+ * Each pool has BIT(seL4_ASIDPoolIndexBits) ASIDs. The manager counts how many of them
+ * each pool has given out, and fills the fullest pool that still has room first, so
+ * that pools it made itself empty out and can be deleted again. Once every pool is
+ * filled past a threshold, the next assignment makes a new one with the ASID control cap,
+ * so that processes created after that do not have to wait for it.
+ *
+ * The kernel gives an ASID back to its pool when the vspace root it was assigned to is
+ * deleted, so sel4utils_asid_manager_release must be called once it has been. When that
+ * leaves more than one of the manager's own pools empty, all but one are deleted.
+ *
+ * Pools given to the manager are only used, never deleted, and the manager assumes it
+ * is the only one assigning from them, but copes with the kernel finding one full.
+ */
+
+typedef struct sel4utils_asid_pool {
+    seL4_CPtr cap;
+    /* what the pool was made from, cptr 0 if it was given to the manager */
+    vka_object_t untyped;
+    /* ASIDs in use, as far as the manager knows */
+    size_t used;
+    /* the kernel refused to assign from the pool */
+    bool full;
+} sel4utils_asid_pool_t;
+
+typedef struct sel4utils_asid_manager {
+    vka_t *vka;
+    /* 0 if the manager may not make pools */
+    seL4_CPtr asid_control;
+    size_t threshold;
+    size_t num_pools;
+    size_t max_pools;
+    sel4utils_asid_pool_t *pools;
+    volatile int lock;
+} sel4utils_asid_manager_t;
+
+/**
+ * Initialise an ASID manager.
+ *
+ * @param manager manager to initialise
+ * @param vka allocator for pools the manager makes, and their slots
+ * @param asid_control ASID control cap to make pools with, or 0 to only use the given pool
+ * @param pool ASID pool to start with, such as seL4_CapInitThreadASIDPool, or 0 to make one
+ * @param threshold ASIDs every pool must have in use before another is made, 0 for 3/4 of
+ *                  a pool, or BIT(seL4_ASIDPoolIndexBits) to wait until they are all full
+ *
+ * @return 0 on success
+ */
+int sel4utils_asid_manager_init(sel4utils_asid_manager_t *manager, vka_t *vka, seL4_CPtr asid_control,
+                                seL4_CPtr pool, size_t threshold);
+
+/**
+ * Assign an ASID to a vspace root. Safe to call from several threads at once.
+ *
+ * @param manager the manager
+ * @param vspace_root the vspace root to assign an ASID to
+ * @param[out] pool the pool the ASID came from, to release it to
+ *
+ * @return 0 on success, or the error of the assignment if no pool has room and none could
+ *         be made.
+ */
+int sel4utils_asid_manager_assign(sel4utils_asid_manager_t *manager, seL4_CPtr vspace_root, seL4_CPtr *pool);
+
+/**
+ * Count an ASID as given back, after the vspace root it was assigned to has been deleted.
+ *
+ * @param manager the manager
+ * @param pool the pool the ASID came from
+ */
+void sel4utils_asid_manager_release(sel4utils_asid_manager_t *manager, seL4_CPtr pool);
+
+/**
+ * Delete every pool the manager made and free the manager. Every vspace root assigned from
+ * them must have been deleted.
+ *
+ * @param manager the manager
+ */
+void sel4utils_asid_manager_destroy(sel4utils_asid_manager_t *manager);
@@ -12,37 +12,132 @@
 #include <sel4/types.h>
 #include <sel4/benchmark_track_types.h>
 
+#include <stdint.h>
+#include <string.h>
+#include <utils/util.h>
+
+/* Kernel entry paths and system call numbers are small bit fields of kernel_entry_t */
+#define SEL4UTILS_TRACK_NUM_PATHS 8
+#define SEL4UTILS_TRACK_NUM_SYSCALLS 16
+/* Durations are histogrammed by their log2, bucket i holding [2^(i-1), 2^i) and bucket 0 zero */
+#define SEL4UTILS_TRACK_NUM_BUCKETS 33
+
+/* Number of entries the kernel has logged, up to the first unused one */
+static inline size_t seL4_BenchmarkTrackLogLength(benchmark_track_kernel_entry_t *logBuffer, size_t logSize)
+{
+    size_t max = logSize / sizeof(benchmark_track_kernel_entry_t);
+    size_t index = 0;
+
+    while (index < max && logBuffer[index].start_time != 0) {
+        index++;
+    }
+    return index;
+}
+
+typedef struct seL4_BenchmarkTrackSummary {
+    seL4_Word entries;
+    seL4_Word path_entries[SEL4UTILS_TRACK_NUM_PATHS];
+    seL4_Word syscall_entries[SEL4UTILS_TRACK_NUM_SYSCALLS];
+    uint64_t path_duration[SEL4UTILS_TRACK_NUM_PATHS];
+    seL4_Word path_histogram[SEL4UTILS_TRACK_NUM_PATHS][SEL4UTILS_TRACK_NUM_BUCKETS];
+} seL4_BenchmarkTrackSummary_t;
+
+/* Count the entries by path and system call, and histogram their durations, in one pass
+ * over the log. Every entry updates the same counters by index, with no branches on the
+ * path, so the loop is cheap however the entries are mixed. */
+static inline void seL4_BenchmarkTrackSummarise(benchmark_track_kernel_entry_t *logBuffer, size_t logSize,
+                                                seL4_BenchmarkTrackSummary_t *summary)
+{
+    size_t length = seL4_BenchmarkTrackLogLength(logBuffer, logSize);
+
+    memset(summary, 0, sizeof(*summary));
+    summary->entries = length;
+    for (size_t index = 0; index < length; index++) {
+        seL4_Word path = logBuffer[index].entry.path;
+        uint32_t duration = logBuffer[index].duration;
+        seL4_Word bucket = duration == 0 ? 0 : 32 - CLZ(duration);
+
+        summary->path_entries[path]++;
+        summary->path_duration[path] += duration;
+        summary->path_histogram[path][bucket]++;
+        /* only meaningful for system calls, so counted only for them */
+        summary->syscall_entries[logBuffer[index].entry.syscall_no] += (path == Entry_Syscall);
+    }
+}
+
 /* Print out a summary of what has been tracked */
 static inline void seL4_BenchmarkTrackDumpSummary(benchmark_track_kernel_entry_t *logBuffer, size_t logSize)
 {
-    seL4_Word index = 0;
-    seL4_Word syscall_entries = 0;
-    seL4_Word interrupt_entries = 0;
-    seL4_Word userlevelfault_entries = 0;
-    seL4_Word vmfault_entries = 0;
+    seL4_BenchmarkTrackSummary_t summary;
 
     /* Default driver to use for output now is serial.
      * Change this to use other drivers than serial, i.e ethernet
      */
     FILE *fd = stdout;
 
-    while (logBuffer[index].start_time != 0 && (index * sizeof(benchmark_track_kernel_entry_t)) < logSize) {
-        if (logBuffer[index].entry.path == Entry_Syscall) {
-            syscall_entries++;
-        } else if (logBuffer[index].entry.path == Entry_Interrupt) {
-            interrupt_entries++;
-        } else if (logBuffer[index].entry.path == Entry_UserLevelFault) {
-            userlevelfault_entries++;
-        } else if (logBuffer[index].entry.path == Entry_VMFault) {
-            vmfault_entries++;
-        }
-        index++;
+    seL4_BenchmarkTrackSummarise(logBuffer, logSize, &summary);
+    fprintf(fd, "Number of system call invocations %d\n", (int) summary.path_entries[Entry_Syscall]);
+    fprintf(fd, "Number of interrupt invocations %d\n", (int) summary.path_entries[Entry_Interrupt]);
+    fprintf(fd, "Number of user-level faults %d\n", (int) summary.path_entries[Entry_UserLevelFault]);
+    fprintf(fd, "Number of VM faults %d\n", (int) summary.path_entries[Entry_VMFault]);
+}
+
+/* Header of a binary export of the log, which is followed by the raw entries as the kernel
+ * wrote them. The entry size lets a host tool check it has the right layout. */
+#define SEL4UTILS_TRACK_EXPORT_MAGIC 0x4b435254 /* "TRCK" */
+#define SEL4UTILS_TRACK_EXPORT_VERSION 1
+
+typedef struct seL4_BenchmarkTrackExportHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;
+    uint64_t num_entries;
+} seL4_BenchmarkTrackExportHeader_t;
+
+static inline void seL4_BenchmarkTrackExportInitHeader(seL4_BenchmarkTrackExportHeader_t *header, size_t length)
+{
+    header->magic = SEL4UTILS_TRACK_EXPORT_MAGIC;
+    header->version = SEL4UTILS_TRACK_EXPORT_VERSION;
+    header->entry_size = sizeof(benchmark_track_kernel_entry_t);
+    header->num_entries = length;
+}
+
+/* Copy the log with a header into memory, such as a region shared with another component.
+ * Returns the number of bytes written, or 0 if the region is too small. */
+static inline size_t seL4_BenchmarkTrackExport(benchmark_track_kernel_entry_t *logBuffer, size_t logSize,
+                                               void *region, size_t regionSize)
+{
+    size_t length = seL4_BenchmarkTrackLogLength(logBuffer, logSize);
+    size_t bytes = length * sizeof(benchmark_track_kernel_entry_t);
+
+    if (regionSize < sizeof(seL4_BenchmarkTrackExportHeader_t) + bytes) {
+        ZF_LOGE("Region of %zu bytes too small to export %zu log entries", regionSize, length);
+        return 0;
     }
+    seL4_BenchmarkTrackExportInitHeader(region, length);
+    memcpy((char *) region + sizeof(seL4_BenchmarkTrackExportHeader_t), logBuffer, bytes);
+    return sizeof(seL4_BenchmarkTrackExportHeader_t) + bytes;
+}
 
-    fprintf(fd, "Number of system call invocations %d\n", syscall_entries);
-    fprintf(fd, "Number of interrupt invocations %d\n", interrupt_entries);
-    fprintf(fd, "Number of user-level faults %d\n", userlevelfault_entries);
-    fprintf(fd, "Number of VM faults %d\n", vmfault_entries);
+/* Write out some bytes, returning how many were written */
+typedef size_t (*seL4_BenchmarkTrackWriteFn)(const void *data, size_t len, void *cookie);
+
+/* Stream the log with a header through write_fn, such as fwrite to a host channel, straight
+ * from the log buffer. Returns 0 on success, -1 if a write came up short. */
+static inline int seL4_BenchmarkTrackStream(benchmark_track_kernel_entry_t *logBuffer, size_t logSize,
+                                            seL4_BenchmarkTrackWriteFn write_fn, void *cookie)
+{
+    seL4_BenchmarkTrackExportHeader_t header;
+    size_t length = seL4_BenchmarkTrackLogLength(logBuffer, logSize);
+    size_t bytes = length * sizeof(benchmark_track_kernel_entry_t);
+
+    seL4_BenchmarkTrackExportInitHeader(&header, length);
+    if (write_fn(&header, sizeof(header), cookie) != sizeof(header)
+        || write_fn(logBuffer, bytes, cookie) != bytes) {
+        ZF_LOGE("Failed to stream the kernel entry log");
+        return -1;
+    }
+    return 0;
 }
 
 /* Print out logged system call invocations */
@@ -40,6 +40,50 @@ typedef struct sel4utils_elf_region {
     int segment_index;
 } sel4utils_elf_region_t;
 
+/* Frames of the read only segments of one elf image, kept so that processes loaded
+ * from the same image can map them instead of getting their own copy */
+typedef struct sel4utils_elf_cached_image {
+    /* identity of the image */
+    const void *file;
+    size_t size;
+    uint32_t hash;
+    /* false if we ran out of resources taking over the original load. Such an image
+     * still owns frames but is never shared */
+    bool complete;
+    size_t num_frames;
+    /* original frame caps and their cookies in the cache's vka */
+    seL4_CPtr *caps;
+    seL4_Word *cookies;
+    uintptr_t *vaddrs;
+    size_t *size_bits;
+    /* region of the image each frame belongs to */
+    int *regions;
+    struct sel4utils_elf_cached_image *next;
+} sel4utils_elf_cached_image_t;
+
+typedef struct sel4utils_elf_cache {
+    /* allocator the cached frames came from, processes must be loaded with it */
+    vka_t *vka;
+    sel4utils_elf_cached_image_t *images;
+} sel4utils_elf_cache_t;
+
+/* Decompress the next bytes of an image into dest, which is a mapping of the loadee's
+ * frames. Returns 0 once all of them are written */
+typedef int (*sel4utils_elf_read_fn)(void *cookie, void *dest, size_t bytes);
+
+/* An elf image read as it is decompressed, such as from an lz4 or zstd file in a cpio
+ * archive, without the whole image ever being in memory */
+typedef struct sel4utils_elf_stream {
+    sel4utils_elf_read_fn read;
+    void *cookie;
+    /* Start of the uncompressed image, which the caller has already decompressed. It must
+     * hold at least the elf and program headers, and read continues from its end */
+    const void *prefix;
+    size_t prefix_size;
+    /* offset in the image of the next byte read will return, kept by the loader */
+    size_t offset;
+} sel4utils_elf_stream_t;
+
 /**
  * Load an elf file into a vspace.
  *
@@ -66,6 +110,23 @@ void *
 sel4utils_elf_load_record_regions(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka,
                                   vka_t *loader_vka, const elf_t *elf, sel4utils_elf_region_t *regions, int mapanywhere);
 
+/**
+ * As sel4utils_elf_load_record_regions, but with segment data read from a stream, straight
+ * into the loadee's frames while they are mapped into the loader. Bytes between segments
+ * are read and thrown away, so the segments must be in the same order in the file as in
+ * memory, as linkers lay them out.
+ *
+ * @param elf headers of the image, for example from elf_newFile_maybe_unsafe on the
+ *            stream's prefix. Only the elf and program headers are used
+ * @param stream the image
+ *
+ * @return The entry point of the new process, NULL on error
+ */
+void *
+sel4utils_elf_load_stream(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                          const elf_t *elf, sel4utils_elf_stream_t *stream, sel4utils_elf_region_t *regions,
+                          int mapanywhere);
+
 /**
  * Wrapper for sel4utils_elf_load_record_regions. Does not record/perform reservations and
  * maps into the correct virtual addresses
@@ -82,6 +143,50 @@ void *
 sel4utils_elf_load(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka,
                    vka_t *loader_vka, const elf_t *elf);
 
+/**
+ * As sel4utils_elf_load, but with a limit on the size of the frames segments are loaded
+ * with. By default any frames that a segment covers whole and that are aligned for it are
+ * large pages, with 4K frames at the edges of the segment.
+ *
+ * @param max_page_bits largest frames to use, seL4_PageBits for 4K frames only
+ *
+ * @return The entry point of the new process, NULL on error
+ */
+void *
+sel4utils_elf_load_max_page_bits(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                                 const elf_t *elf, size_t max_page_bits);
+
+/**
+ * Initialise an empty elf image cache.
+ *
+ * @param cache the cache to initialise
+ * @param vka allocator that processes loaded through the cache use as their loadee_vka
+ */
+void sel4utils_elf_cache_init(sel4utils_elf_cache_t *cache, vka_t *vka);
+
+/**
+ * As sel4utils_elf_load, but the read only segments (text, rodata) are shared with every
+ * other process loaded from the same image through the same cache. The first load of an
+ * image populates the cache; later loads only allocate and copy the writable segments.
+ *
+ * Shared frames are mapped into the loadee without a cookie, as with shared memory, so
+ * tearing down the loadee leaves the frames with the cache. If loadee_vka is not the cache's vka the image is
+ * loaded as normal and is not cached.
+ *
+ * @return The entry point of the new process, NULL on error
+ */
+void *
+sel4utils_elf_load_cached(sel4utils_elf_cache_t *cache, vspace_t *loadee, vspace_t *loader,
+                          vka_t *loadee_vka, vka_t *loader_vka, const elf_t *elf);
+
+/**
+ * Free all frames held by an elf image cache. Must only be called once every process
+ * loaded through the cache has been destroyed.
+ *
+ * @param cache the cache to destroy
+ */
+void sel4utils_elf_cache_destroy(sel4utils_elf_cache_t *cache);
+
 /**
  * Parses an elf file but does not actually load it. Merely reserves the regions in the vspace
  * for where the elf segments would go. This is used for lazy loading / copy on write
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* A fault handling service shared by many faulting threads.
+ *
+ * One handler thread runs on each core it is given, all of them waiting on a single
+ * endpoint. Each client, a thread whose faults the service handles, is given its own
+ * badged copy of the endpoint to use as its fault endpoint, and the badge says whose fault
+ * it is. Callbacks are registered for regions of a client's address space, keyed by the
+ * vspace reservation that covers them, and a VM fault in a region is handed to its
+ * callback. The callback either resumes the client, optionally with new registers, or
+ * leaves it blocked. Faults that no callback handles are printed with
+ * sel4utils_print_fault_message and leave the client blocked.
+ *
+ * Each handler counts the faults it sees and, where there is a user readable cycle
+ * counter, the cycles from receiving each fault to replying to it. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <simple/simple.h>
+#include <vka/vka.h>
+#include <vka/cspacepath_t.h>
+#include <vspace/vspace.h>
+#include <sel4utils/thread.h>
+
+struct sel4utils_fault_client;
+
+/* A fault, as given to a callback */
+typedef struct sel4utils_fault {
+    struct sel4utils_fault_client *client;
+    seL4_Fault_t fault;
+    /* address of a VM fault */
+    void *addr;
+    /* set by the callback to resume the client with regs rather than where it faulted,
+     * see sel4utils_fault_read_regs */
+    bool write_regs;
+    seL4_UserContext regs;
+} sel4utils_fault_t;
+
+typedef enum sel4utils_fault_result {
+    /* resume the client, restarting the faulting instruction unless regs were written */
+    SEL4UTILS_FAULT_RESUME,
+    /* the fault could not be handled, leave the client blocked */
+    SEL4UTILS_FAULT_UNHANDLED,
+} sel4utils_fault_result_t;
+
+/* Handle a fault in a region, on the handler thread it was delivered to. Callbacks of the
+ * same region may run on several cores at once for different clients */
+typedef sel4utils_fault_result_t (*sel4utils_fault_fn)(void *cookie, sel4utils_fault_t *fault);
+
+typedef struct sel4utils_fault_region {
+    uintptr_t start;
+    uintptr_t end;
+    sel4utils_fault_fn fn;
+    void *cookie;
+} sel4utils_fault_region_t;
+
+typedef struct sel4utils_fault_client {
+    bool in_use;
+    const char *name;
+    seL4_CPtr tcb;
+    vspace_t *vspace;
+    /* badged copy of the service endpoint in the cspace of the caller */
+    cspacepath_t endpoint;
+    /* sorted by start, protected by the service lock */
+    size_t num_regions;
+    size_t max_regions;
+    sel4utils_fault_region_t *regions;
+} sel4utils_fault_client_t;
+
+typedef struct sel4utils_fault_stats {
+    uint64_t faults;
+    uint64_t unhandled;
+    /* cycles from receiving a fault to replying to it, 0 without a user cycle counter */
+    uint64_t cycles;
+    uint64_t max_cycles;
+} sel4utils_fault_stats_t;
+
+struct sel4utils_fault_service;
+
+typedef struct sel4utils_fault_handler {
+    sel4utils_thread_t thread;
+    struct sel4utils_fault_service *service;
+    /* only written by the handler */
+    sel4utils_fault_stats_t stats;
+} sel4utils_fault_handler_t;
+
+typedef struct sel4utils_fault_service {
+    vka_object_t endpoint;
+    size_t num_handlers;
+    sel4utils_fault_handler_t *handlers;
+    /* client i has badge i + 1 */
+    size_t max_clients;
+    sel4utils_fault_client_t *clients;
+    int lock;
+} sel4utils_fault_service_t;
+
+/**
+ * Start a fault service with a handler thread per core, up to num_handlers.
+ *
+ * @param simple used to find the cores and configure the handlers
+ * @param vka allocator for the handlers and the endpoint
+ * @param vspace vspace to run the handlers in
+ * @param priority priority of the handlers, which should be above that of their clients
+ * @param num_handlers maximum number of handlers, 0 for one per core
+ * @param max_clients most clients the service can have at once
+ * @param service the service to initialise
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int sel4utils_fault_service_create(simple_t *simple, vka_t *vka, vspace_t *vspace, uint8_t priority,
+                                   size_t num_handlers, size_t max_clients, sel4utils_fault_service_t *service);
+
+/**
+ * Stop the handlers of a service and free it, along with the endpoints of any clients left.
+ *
+ * @param vka the vka the service was created with
+ * @param vspace the vspace the service was created with
+ * @param service the service to destroy
+ */
+void sel4utils_fault_service_destroy(vka_t *vka, vspace_t *vspace, sel4utils_fault_service_t *service);
+
+/**
+ * Add a client. Its fault endpoint must be set to client->endpoint.capPtr, which is in the
+ * cspace of the caller, so it must be copied into the client's cspace if the client looks it
+ * up there.
+ *
+ * @param service the service
+ * @param vka allocator for the badged endpoint
+ * @param name name to print the faults of the client with
+ * @param tcb tcb of the client, to write its registers with
+ * @param vspace vspace of the client, whose reservations regions are added for
+ * @param[out] client the client
+ *
+ * @return 0 on success, -1 if there is no room for the client or the endpoint could not
+ *         be made.
+ */
+int sel4utils_fault_service_add_client(sel4utils_fault_service_t *service, vka_t *vka, const char *name,
+                                       seL4_CPtr tcb, vspace_t *vspace, sel4utils_fault_client_t **client);
+
+/**
+ * Remove a client, after which any fault it is blocked on is never replied to. Faults it
+ * sent that the service has not received yet are cancelled, so that they are not taken for
+ * faults of a client added later with the same badge.
+ *
+ * @param service the service
+ * @param vka the vka the client was added with
+ * @param client from sel4utils_fault_service_add_client
+ */
+void sel4utils_fault_service_remove_client(sel4utils_fault_service_t *service, vka_t *vka,
+                                           sel4utils_fault_client_t *client);
+
+/**
+ * Handle VM faults of a client in a reservation of its vspace with fn. The range is that of
+ * the reservation when the region is added. Regions must not overlap.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_fault_service_add_region(sel4utils_fault_service_t *service, sel4utils_fault_client_t *client,
+                                       reservation_t reservation, sel4utils_fault_fn fn, void *cookie);
+
+/**
+ * Stop handling VM faults in a reservation. Must not be called while a callback of the
+ * region may be running.
+ *
+ * @return 0 on success, -1 if there is no region for the reservation.
+ */
+int sel4utils_fault_service_remove_region(sel4utils_fault_service_t *service, sel4utils_fault_client_t *client,
+                                          reservation_t reservation);
+
+/**
+ * Read the registers of the faulting client into fault->regs, for a callback to change them
+ * and set fault->write_regs.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_fault_read_regs(sel4utils_fault_t *fault);
+
+/**
+ * Add up the counters of every handler of a service. The counters of a handler that is
+ * handling a fault may be read part way through being updated. The fault rate is the
+ * difference in faults between two calls over the time between them.
+ *
+ * @param service the service
+ * @param[out] stats the totals, with max_cycles the largest of any handler
+ */
+void sel4utils_fault_service_stats(sel4utils_fault_service_t *service, sel4utils_fault_stats_t *stats);
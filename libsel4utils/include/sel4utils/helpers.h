@@ -24,6 +24,19 @@
 int sel4utils_stack_write(vspace_t *current_vspace, vspace_t *target_vspace,
                       vka_t *vka, void *buf, size_t len, uintptr_t *stack_top);
 
+/*
+ * Write the initial stack of a process: argv and envp strings, then argc, the argv and
+ * envp vectors and auxv, each NULL terminated. The whole image is built locally and
+ * written with a single call to sel4utils_stack_write.
+ *
+ * @param stack_top top of the space to write below, updated to the double word aligned
+ *                  stack pointer to start the process with.
+ * @return 0 on success.
+ */
+int sel4utils_stack_write_args(vspace_t *current_vspace, vspace_t *target_vspace, vka_t *vka,
+                               int argc, char *argv[], int envc, char *envp[],
+                               int auxc, Elf_auxv_t auxv[], uintptr_t *stack_top);
+
 /*
  * Initialize a threads user context for a specific architecture
  *
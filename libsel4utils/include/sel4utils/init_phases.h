@@ -0,0 +1,61 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* Dependency ordered init phases.
+ *
+ * Root task init can be given as a set of phases, each naming the phases that have to
+ * complete before it. Given a task runtime, the phases run on its workers as soon as what
+ * they depend on has completed, so independent phases, such as adding untypeds, building
+ * device mappings and starting servers, run in parallel across the cores. Without one they
+ * run one at a time in an order that respects their dependencies.
+ *
+ * The runtime needs an allocator and a vspace to start its workers, so the first phases of
+ * bootstrapping those run before it exists. Anything shared by phases that can run at the
+ * same time, such as the vka, has to be safe to use from several threads. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utils/util.h>
+#include <sel4utils/tasks.h>
+
+#define SEL4UTILS_INIT_PHASES_MAX 64
+
+/* For the after mask of a phase, that it runs after the phase at index i */
+#define SEL4UTILS_INIT_AFTER(i) BIT_ULL(i)
+
+typedef int (*sel4utils_init_phase_fn)(void *arg);
+
+struct sel4utils_init_run;
+
+typedef struct sel4utils_init_phase {
+    /* for error messages */
+    const char *name;
+    sel4utils_init_phase_fn fn;
+    void *arg;
+    /* SEL4UTILS_INIT_AFTER of the index of each phase that must complete first */
+    uint64_t after;
+    /* What fn returned, or -1 if it was not run because a phase it depends on failed */
+    int result;
+    /* private to sel4utils_init_phases_run */
+    size_t waiting;
+    struct sel4utils_init_run *run;
+    sel4utils_task_t task;
+} sel4utils_init_phase_t;
+
+/**
+ * Run init phases in dependency order, in parallel if given a runtime.
+ *
+ * @param runtime runtime to run the phases on, or NULL to run them on the current thread
+ * @param phases the phases, which after refers to by index
+ * @param num_phases number of phases, at most SEL4UTILS_INIT_PHASES_MAX
+ *
+ * @return 0 if every phase returned 0, -1 if one failed, or if the phases depend on each
+ *         other in a cycle or on phases that do not exist, in which case none are run.
+ */
+int sel4utils_init_phases_run(sel4utils_task_runtime_t *runtime, sel4utils_init_phase_t *phases,
+                              size_t num_phases);
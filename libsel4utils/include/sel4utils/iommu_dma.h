@@ -39,7 +39,8 @@ int sel4utils_make_iommu_dma_alloc(vka_t *vka, vspace_t *vspace, ps_dma_man_t *d
  * Variant of ps_dma_alloc that allows the caller to allocate memory in their address space for use
  * as the dma buffer. This function takes a description of a region of (virtual) memory, and maps
  * the frames that back the region into the dma manager's iospace such that the iovaddr of each frame
- * corresponds to its vaddr.
+ * corresponds to its vaddr. Mapped ranges are reference counted, so overlapping regions may be
+ * passed to this function and are each released separately when freed.
  *
  * The intended use case for this function is in environments without a dynamic heap (that is, where
  * malloc is not backed by a vspace). The dma_man argument must be a pointer to a dma manager that
@@ -57,4 +58,25 @@ int sel4utils_make_iommu_dma_alloc(vka_t *vka, vspace_t *vspace, ps_dma_man_t *d
  * @return 0 on success
  */
 int sel4utils_iommu_dma_alloc_iospace(void *dma_cookie, void *vaddr, size_t size);
+
+/**
+ * Put a dma manager created with sel4utils_make_iommu_dma_alloc into sticky mode. Ranges that are
+ * no longer allocated stay mapped in the iospaces, up to max_idle_pages pages of them, so that
+ * allocating from the same memory again costs no kernel calls. The least recently released
+ * ranges are unmapped first once the limit is reached, and all of them are unmapped if mapping
+ * a new range fails. While sticky, devices can still reach memory that has been freed, and the
+ * frames backing it must not be unmapped from the dma manager's vspace without a flush first.
+ *
+ * @param dma_man A dma manager initialised with sel4utils_make_iommu_dma_alloc.
+ * @param max_idle_pages Number of idle pages to keep mapped, 0 turns sticky mode off.
+ * @return 0 on success
+ */
+int sel4utils_iommu_dma_set_sticky(ps_dma_man_t *dma_man, size_t max_idle_pages);
+
+/**
+ * Unmap every idle range that sticky mode has kept mapped.
+ *
+ * @param dma_man A dma manager initialised with sel4utils_make_iommu_dma_alloc.
+ */
+void sel4utils_iommu_dma_flush(ps_dma_man_t *dma_man);
 #endif /* CONFIG_IOMMU */
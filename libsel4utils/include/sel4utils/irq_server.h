@@ -97,6 +97,101 @@ irq_server_t *irq_server_new(vspace_t *vspace, vka_t *vka, seL4_Word priority,
 thread_id_t irq_server_thread_new(irq_server_t *irq_server, seL4_CPtr provided_ntfn,
                                   seL4_Word usable_mask, thread_id_t id_hint);
 
+/**
+ * Creates a new thread to wait on IRQs, like irq_server_thread_new, that is pinned to a core.
+ * IRQs registered with irq_server_register_irq_on_core for the same core go to these threads.
+ * @param[in] irq_server        A handle to the IRQ server
+ * @param[in] provided_ntfn     As for irq_server_thread_new
+ * @param[in] usable_mask       As for irq_server_thread_new
+ * @param[in] id_hint           As for irq_server_thread_new
+ * @param[in] core              Core to run the thread on
+ */
+thread_id_t irq_server_thread_new_on_core(irq_server_t *irq_server, seL4_CPtr provided_ntfn,
+                                          seL4_Word usable_mask, thread_id_t id_hint, seL4_Word core);
+
+/**
+ * Enable an IRQ and register a callback function, like irq_server_register_irq, handled by a
+ * thread that was created on the given core. On ARM SMP the kernel is also asked to deliver the
+ * IRQ to that core. Other platforms give no control over delivery, where the IRQ is still raised
+ * on whichever core the kernel chooses and only the callback runs on the given core.
+ * @param[in] irq_server        The IRQ server which shall be responsible for the IRQ
+ * @param[in] irq               Information about the IRQ that will be registered
+ * @param[in] core              Core of the thread to handle the IRQ on
+ * @param[in] callback          A callback function to call when the requested IRQ arrives
+ * @param[in] callback_data     Client data which should be passed to the registered call
+ *                              back function
+ * @return                      As for irq_server_register_irq
+ */
+irq_id_t irq_server_register_irq_on_core(irq_server_t *irq_server, ps_irq_t irq, seL4_Word core,
+                                         irq_callback_fn_t callback, void *callback_data);
+
+/* Polling mode for an IRQ server thread. After handling an IRQ the thread keeps calling
+ * poll_fn, instead of going straight back to waiting, so a busy device can be served without
+ * an interrupt and a context switch each time. The driver's IRQ callback should leave the IRQ
+ * unacknowledged and have complete_fn acknowledge it once the thread stops polling */
+typedef struct irq_server_poll {
+    /* Does some work for the device and returns how much it did, 0 for an empty poll */
+    size_t (*poll_fn)(void *data);
+    /* Called before the thread goes back to waiting for IRQs, can be NULL */
+    void (*complete_fn)(void *data);
+    void *data;
+    /* Consecutive empty polls after which the thread goes back to waiting, at least 1 */
+    size_t max_empty_polls;
+    /* Polls after which the thread goes back to waiting even if there is work, 0 for none */
+    size_t max_polls;
+    /* Yield after every empty poll, to let other threads of the same priority run */
+    bool yield;
+} irq_server_poll_t;
+
+/**
+ * Puts an IRQ server thread into polling mode, or back out of it. Only available when the
+ * IRQ server threads call the callbacks directly, that is without a delivery endpoint.
+ * Should be set before any IRQs are registered to the thread.
+ * @param[in] irq_server        A handle to the IRQ server
+ * @param[in] thread_id         ID of the thread, as returned by irq_server_thread_new
+ * @param[in] poll              Polling configuration, copied, NULL to stop polling
+ * @return                      0 on success, otherwise an error code
+ */
+int irq_server_thread_set_polling(irq_server_t *irq_server, thread_id_t thread_id, irq_server_poll_t *poll);
+
+/* Load balancing of IRQs between IRQ server threads. Each call to irq_server_rebalance ends a
+ * window, measures how long the IRQs of each thread took to handle in it, and moves IRQs off
+ * threads that were hot to the least loaded thread on the same core, creating another thread
+ * when there is none with time to spare. Needs LibSel4PlatSupportIrqTrace, whose timestamps
+ * the handling time comes from */
+typedef struct irq_server_balance {
+    /* Percentage of a window spent handling IRQs above which a thread is hot, 1 to 100 */
+    unsigned int hot_pct;
+    /* Threads the server can have, counting those created by the user, before it stops
+     * creating more. 0 to only move IRQs between the threads there are */
+    size_t max_threads;
+} irq_server_balance_t;
+
+/**
+ * Turns load balancing on, or off. Threads in polling mode keep their IRQs and are given no
+ * more, and IRQs registered with irq_server_register_irq_on_core only move between threads
+ * on their core.
+ * @param[in] irq_server        A handle to the IRQ server
+ * @param[in] balance           Balancing configuration, copied, NULL to stop balancing
+ * @return                      0 on success, -ENOSYS without LibSel4PlatSupportIrqTrace,
+ *                              otherwise an error code
+ */
+int irq_server_set_balancing(irq_server_t *irq_server, irq_server_balance_t *balance);
+
+/**
+ * Ends a balancing window, and moves at most one IRQ off each hot thread. The first call
+ * only starts a window. Meant to be called periodically, such as from a timeout, by a single
+ * thread that also does all registering of IRQs and creating of threads.
+ *
+ * An IRQ is moved by pairing it with the notification of another thread, which
+ * acknowledges it. If it is delivered to the old thread while being moved, that delivery
+ * is dropped. A level triggered IRQ is raised again on the new thread, but one edge
+ * triggered delivery can be lost. A callback can be running on both threads at once.
+ * @param[in] irq_server        A handle to the IRQ server
+ * @return                      The number of IRQs moved, otherwise an error code
+ */
+int irq_server_rebalance(irq_server_t *irq_server);
+
 /**
  * Enable an IRQ and register a callback function. This functionality is
  * delegated to the IRQ interface in libplatsupport.
@@ -124,6 +219,30 @@ irq_id_t irq_server_register_irq(irq_server_t *irq_server, ps_irq_t irq,
  */
 void irq_server_handle_irq_ipc(irq_server_t *irq_server, seL4_MessageInfo_t msginfo);
 
+/**
+ * Has the IRQ server threads deliver IRQs through a ring in shared memory, rather than sending
+ * an IPC for each of them. The threads put an event on the ring for every notification they
+ * receive and never block on the consumer. The consumer's notification is only signalled when
+ * the ring goes from empty to non empty, so many IRQs can be handled per wake up with
+ * irq_server_handle_irq_ring. Must be called before any threads are created, and only if the
+ * IRQ server was created without a delivery endpoint.
+ * @param[in] irq_server        A handle to the IRQ server
+ * @param[in] size_bits         log2 of the number of events the ring holds
+ * @param[in] consumer_ntfn     Notification to signal when there are events to handle
+ * @return                      0 on success, otherwise an error code
+ */
+int irq_server_new_ring_delivery(irq_server_t *irq_server, size_t size_bits, seL4_CPtr consumer_ntfn);
+
+/**
+ * Calls the callbacks for IRQs waiting on the delivery ring set up with
+ * irq_server_new_ring_delivery. When this returns 0 the caller can wait on the consumer
+ * notification, which is signalled when more arrive.
+ * @param[in] irq_server        A handle to the IRQ server
+ * @param[in] max_events        Maximum number of events to handle
+ * @return                      Number of events handled
+ */
+size_t irq_server_handle_irq_ring(irq_server_t *irq_server, size_t max_events);
+
 /**
  * Waits on the IRQ delivery endpoint for the next IRQ. If an IPC is received, but the
  * label does not match that which was assigned to the IRQ server, the message info and
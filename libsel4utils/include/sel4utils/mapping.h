@@ -43,6 +43,7 @@ static inline int sel4utils_map_page_leaky(vka_t *vka, seL4_CPtr pd, seL4_CPtr f
 }
 
 #include <vspace/vspace.h>
+#include <sys/uio.h>
 
 /* Duplicate a page cap and map it into a vspace
  *
@@ -67,6 +68,93 @@ void *sel4utils_dup_and_map(vka_t *vka, vspace_t *vspace, seL4_CPtr page, size_t
  */
 void sel4utils_unmap_dup(vka_t *vka, vspace_t *vspace, void *mapping, size_t size_bits);
 
+/* A fixed set of reserved vaddrs, each with a cslot of its own, for temporary mappings of
+ * frames. Paging structures for all of the windows are created up front, so mapping a frame
+ * into a window is a cap copy and a map, and unmapping it an unmap and a delete */
+typedef struct sel4utils_map_windows {
+    vka_t *vka;
+    vspace_t *vspace;
+    reservation_t reservation;
+    void *base;
+    size_t size_bits;
+    size_t num_windows;
+    seL4_CPtr *slots;
+    /* stack of free window indices */
+    size_t num_free;
+    size_t *free;
+} sel4utils_map_windows_t;
+
+/* Create a set of mapping windows. The vka and vspace must outlive the windows
+ *
+ * @param vka Allocator for the slots and a frame to prepare the windows with
+ * @param vspace vspace to reserve the windows in
+ * @param num_windows number of frames that can be mapped at once
+ * @param size_bits size of the frames that will be mapped
+ * @param windows windows to initialise
+ *
+ * @return 0 on success
+ */
+int sel4utils_map_windows_init(vka_t *vka, vspace_t *vspace, size_t num_windows, size_t size_bits,
+                               sel4utils_map_windows_t *windows);
+
+/* Duplicate a page cap and map it into a free window, a cheaper sel4utils_dup_and_map
+ *
+ * @param windows windows to map into
+ * @param page cptr to duplicate and map, must be of the windows' size
+ *
+ * @return virtual address of mapping, NULL if no window is free
+ */
+void *sel4utils_map_windows_map(sel4utils_map_windows_t *windows, seL4_CPtr page);
+
+/* Unmap a page mapped with sel4utils_map_windows_map and free its window
+ *
+ * @param windows windows the page was mapped into
+ * @param mapping virtual address returned by sel4utils_map_windows_map
+ */
+void sel4utils_map_windows_unmap(sel4utils_map_windows_t *windows, void *mapping);
+
+/* Free the windows and their slots. Nothing may still be mapped into them
+ *
+ * @param windows windows to destroy
+ */
+void sel4utils_map_windows_destroy(sel4utils_map_windows_t *windows);
+
+/* Copy between the memory of another vspace and our own, as process_vm_writev and
+ * process_vm_readv do. Each run of frames of the target is mapped into consecutive free
+ * windows, as many at a time as there are, and copied in one go with sel4utils_copy.
+ * The frames must be of the size of the windows. Frames are only written to if writing
+ * changes nothing but target, so not read only frames, which may be shared with other
+ * vspaces, nor copy on write frames still shared with the vspace they were cloned from.
+ *
+ * @param windows windows to map the frames of the target into, with the current vspace
+ * @param target sel4utils vspace to copy to or from
+ * @param target_vaddr where in target to copy to or from
+ * @param src, dst buffer in the current vspace
+ * @param len bytes to copy
+ *
+ * @return 0 on success, -1 if a page of the range isn't mapped in target, is of another
+ *         size, can't be written to, or can't be mapped into a window. Part of the range
+ *         may have been copied.
+ */
+int sel4utils_vspace_copy_to(sel4utils_map_windows_t *windows, vspace_t *target, void *target_vaddr,
+                             const void *src, size_t len);
+int sel4utils_vspace_copy_from(sel4utils_map_windows_t *windows, vspace_t *target, void *target_vaddr,
+                               void *dst, size_t len);
+
+/* Scatter gather versions of sel4utils_vspace_copy_to and sel4utils_vspace_copy_from. The
+ * local buffers, in order, are copied to or from the remote ranges of target, in order,
+ * until either runs out.
+ *
+ * @return bytes copied, or -1 on failure, after which part of the data may have been
+ *         copied.
+ */
+ssize_t sel4utils_vspace_writev(sel4utils_map_windows_t *windows, vspace_t *target,
+                                const struct iovec *local, size_t local_count,
+                                const struct iovec *remote, size_t remote_count);
+ssize_t sel4utils_vspace_readv(sel4utils_map_windows_t *windows, vspace_t *target,
+                               const struct iovec *local, size_t local_count,
+                               const struct iovec *remote, size_t remote_count);
+
 #if defined(CONFIG_IOMMU) || defined(CONFIG_ARM_SMMU) || defined(CONFIG_TK1_SMMU)
 int sel4utils_map_iospace_page(vka_t *vka, seL4_CPtr iospace, seL4_CPtr frame, seL4_Word vaddr,
                                seL4_CapRights_t rights, int cacheable, seL4_Word size_bits,
@@ -78,5 +166,69 @@ int sel4utils_map_ept_page(vka_t *vka, seL4_CPtr pd, seL4_CPtr frame, seL4_Word
                            seL4_CapRights_t rights, int cacheable, seL4_Word size_bits, vka_object_t *pagetable, vka_object_t *pagedir,
                            vka_object_t *pdpt);
 
+/* A frame of guest RAM, see sel4utils_ept_ram_map */
+typedef struct sel4utils_ept_ram_frame {
+    /* guest physical address the frame is mapped at */
+    uintptr_t gpa;
+    vka_object_t frame;
+} sel4utils_ept_ram_frame_t;
+
+/* A range of guest RAM, backed by the largest frames that fit it and mapped into an EPT
+ * in one go, with a record of the frame at each guest physical address kept a frame at a
+ * time rather than a 4K page at a time */
+typedef struct sel4utils_ept_ram {
+    vka_t *vka;
+    seL4_CPtr ept;
+    uintptr_t gpa;
+    size_t size;
+    /* sorted by gpa */
+    size_t num_frames;
+    size_t max_frames;
+    sel4utils_ept_ram_frame_t *frames;
+    /* paging structures created for the range */
+    size_t num_tables;
+    size_t max_tables;
+    vka_object_t *tables;
+} sel4utils_ept_ram_t;
+
+/**
+ * Allocate and map guest RAM into an EPT. Each part of the range is backed by the largest
+ * frame, up to BIT(max_frame_bits), that it is aligned to and that fits, so a range aligned
+ * to 2M is mapped with 2M frames, and with 1G frames where CONFIG_HUGE_PAGE is set and the
+ * kernel can map them into an EPT. A frame size that cannot be allocated falls back to the
+ * next smaller one. The paging structures every frame needs are created before the frames
+ * are mapped, rather than after each mapping fails.
+ *
+ * The range is not known to any vspace_t of the EPT, so it should be reserved in one if
+ * there is one, to keep other mappings out of it.
+ *
+ * @param vka allocator for the frames and paging structures
+ * @param ept EPT to map into
+ * @param gpa guest physical address of the range, 4K aligned
+ * @param size bytes in the range, a multiple of 4K
+ * @param max_frame_bits size_bits of the largest frames to use
+ * @param cacheable whether the range is mapped cached
+ * @param[out] ram the mapped range
+ * @return 0 on success, with nothing left allocated on failure
+ */
+int sel4utils_ept_ram_map(vka_t *vka, seL4_CPtr ept, uintptr_t gpa, size_t size, size_t max_frame_bits,
+                          int cacheable, sel4utils_ept_ram_t *ram);
+
+/**
+ * Find the frame backing a guest physical address of a range.
+ *
+ * @param ram range from sel4utils_ept_ram_map
+ * @param gpa guest physical address in the range
+ * @return the frame, or NULL if gpa is not in the range
+ */
+sel4utils_ept_ram_frame_t *sel4utils_ept_ram_find(sel4utils_ept_ram_t *ram, uintptr_t gpa);
+
+/**
+ * Unmap a range of guest RAM and free its frames and paging structures.
+ *
+ * @param ram range from sel4utils_ept_ram_map
+ */
+void sel4utils_ept_ram_destroy(sel4utils_ept_ram_t *ram);
+
 #endif /* CONFIG_VTX */
 
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* Copy and zero whole pages.
+ *
+ * With LibSel4UtilsPageCopy on, these use kernels for the architecture rather than the C
+ * library: NEON loads and stores and DC ZVA on aarch64, and rep movsb, AVX or rep movsq on
+ * x86_64, chosen the first time they are used from what the cpu supports. Elsewhere, or
+ * with the option off, they are memcpy and memset. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <utils/util.h>
+
+/**
+ * Copy bytes from src to dst, which must not overlap.
+ *
+ * @param dst destination, aligned to PAGE_SIZE_4K
+ * @param src source, aligned to PAGE_SIZE_4K
+ * @param bytes a multiple of PAGE_SIZE_4K
+ */
+void sel4utils_copy_pages(void *dst, const void *src, size_t bytes);
+
+/**
+ * Zero bytes at dst.
+ *
+ * @param dst destination, aligned to PAGE_SIZE_4K
+ * @param bytes a multiple of PAGE_SIZE_4K
+ */
+void sel4utils_zero_pages(void *dst, size_t bytes);
+
+/* memcpy, using sel4utils_copy_pages when the copy is of whole pages */
+static inline void *sel4utils_copy(void *dst, const void *src, size_t bytes)
+{
+    if (IS_ALIGNED((uintptr_t) dst | (uintptr_t) src | bytes, PAGE_BITS_4K)) {
+        sel4utils_copy_pages(dst, src, bytes);
+        return dst;
+    }
+    return memcpy(dst, src, bytes);
+}
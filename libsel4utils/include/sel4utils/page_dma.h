@@ -17,8 +17,10 @@
 /**
  * Creates an implementation of a dma manager that is designed to allocate at page granularity. Due
  * to implementation details it will round up all allocations to the next power of 2, or 4k (whichever
- * is larger). This allocator will put mappings into the vspace with custom cookie values and you
- * must free all dma allocations before tearing down the vspace
+ * is larger). Any power of 2 alignment is supported, an alignment larger than the allocation grows
+ * it to the alignment. Allocations are mapped with the largest frames that fit in them. This allocator
+ * will put mappings into the vspace with custom cookie values and you must free all dma allocations
+ * before tearing down the vspace
  * @param vka Allocation interface for allocating untypeds (for frames) and slots
  * @param vspace Virtual memory manager used for mapping frames
  * @param dma_man Pointer to dma manager struct that will be filled out
@@ -26,3 +28,58 @@
  */
 int sel4utils_new_page_dma_alloc(vka_t *vka, vspace_t *vspace, ps_dma_man_t *dma_man);
 
+
+/**
+ * Creates a dma manager that keeps freed buffers for reuse. Buffers are carved, by power of 2
+ * size class, out of physically contiguous chunks of at least BIT(chunk_bits) that are retyped
+ * and mapped in one go when a size class runs out. Pinning is a lookup of the chunk through
+ * the vspace cookie of the buffer. Memory is only returned to vka by
+ * sel4utils_page_dma_pool_reclaim, and as with sel4utils_new_page_dma_alloc the mappings
+ * carry custom cookies.
+ * @param vka Allocation interface for allocating untypeds (for frames) and slots
+ * @param vspace Virtual memory manager used for mapping frames
+ * @param chunk_bits Size of the chunks to refill size classes with
+ * @param dma_man Pointer to dma manager struct that will be filled out
+ * @return 0 on success
+ */
+int sel4utils_new_page_dma_pool(vka_t *vka, vspace_t *vspace, size_t chunk_bits, ps_dma_man_t *dma_man);
+
+/**
+ * Give the chunks of a dma pool that have no buffers allocated back to vka. Has the
+ * signature of an allocman reclaimer, so that the pool can be registered with
+ * allocman_register_reclaimer and shrink when the allocman behind vka runs short.
+ * @param cookie The cookie of a dma manager made by sel4utils_new_page_dma_pool
+ * @param bytes Stop once at least this many bytes are freed, 0 to free every unused chunk
+ * @return The number of bytes freed
+ */
+size_t sel4utils_page_dma_pool_reclaim(void *cookie, size_t bytes);
+
+/**
+ * Creates a dma manager that carves allocations out of a single physically contiguous untyped
+ * of BIT(size_bits), allocated and retyped into frames up front. Allocations take the lowest
+ * free run of just as many 4K frames as they need, with no rounding to a power of 2, and only
+ * those frames are mapped.
+ * @param vka Allocation interface for allocating the untyped and slots
+ * @param vspace Virtual memory manager used for mapping frames
+ * @param size_bits Size of the carveout
+ * @param dma_man Pointer to dma manager struct that will be filled out
+ * @return 0 on success
+ */
+int sel4utils_new_page_dma_carveout(vka_t *vka, vspace_t *vspace, size_t size_bits, ps_dma_man_t *dma_man);
+
+typedef struct sel4utils_dma_range {
+    void *vaddr;
+    size_t len;
+} sel4utils_dma_range_t;
+
+/**
+ * Perform a cache operation on a list of ranges, such as a batch of descriptors. The ranges are
+ * sorted in place and overlapping or adjacent ranges are coalesced, so that the dma manager is
+ * asked once per contiguous run.
+ * @param dma_man dma manager the ranges were allocated from
+ * @param num_ranges number of ranges
+ * @param ranges ranges to operate on, reordered by this function
+ * @param op cache operation to perform
+ */
+void sel4utils_dma_cache_op_ranges(ps_dma_man_t *dma_man, size_t num_ranges, sel4utils_dma_range_t *ranges,
+                                   dma_cache_op_t op);
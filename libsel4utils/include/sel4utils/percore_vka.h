@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <vka/vka.h>
+#include <sel4/sel4.h>
+
+/* A delegating allocator with a cache per core in front of a single shared allocator,
+ * such as an allocman, that is not thread safe.
+ *
+ * Each core gets its own vka, to be used by the threads running on that core. A core's
+ * vka keeps a magazine of free cslots and, for each type it is told to cache, a magazine
+ * of objects already allocated from the delegate. Allocating and freeing those is then
+ * local to the core. Magazines are refilled from and flushed to the delegate in batches,
+ * under a lock shared by all the cores, as are any allocations that are not cached.
+ *
+ * Each core's vka has a lock of its own too, so threads of the same core can preempt
+ * each other, but it is only contended if a thread uses another core's vka.
+ *
+ * Cached objects are created with the delegate's utspace_alloc at the default size of
+ * their type, and moved into the slot they are allocated to. Objects of the type at any
+ * other size are allocated and freed through the delegate as if it were not cached. Freed objects go back to
+ * the delegate, a batch at a time, as they can not be used again without revoking their
+ * untyped.
+ *
+ * The batch interface falls back to single allocations.
+ */
+
+/**
+ * Initialise a vka for each core.
+ *
+ * @param cores array of num_cores empty allocators to initialise, cores[i] for core i
+ * @param num_cores number of cores
+ * @param delegate initialised allocator to refill from, only used under the shared lock
+ * @param object_batch number of objects of each type to move between a core and the
+ *                     delegate at once (indexed by object type), 0 to not cache the type
+ * @param slot_batch number of cslots to move between a core and the delegate at once
+ * @return 0 on success
+ */
+int percore_vka_init(vka_t *cores, size_t num_cores, vka_t *delegate,
+                     size_t object_batch[seL4_ObjectTypeCount], size_t slot_batch);
+
+/**
+ * Give everything cached by each core back to the delegate, and free the caches. No
+ * thread may be using any of the vkas.
+ *
+ * @param cores allocators initialised with percore_vka_init
+ * @param num_cores number of cores they were initialised with
+ */
+void percore_vka_destroy(vka_t *cores, size_t num_cores);
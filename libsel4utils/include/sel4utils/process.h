@@ -54,8 +54,61 @@ typedef struct {
     bool own_vspace;
     bool own_cspace;
     bool own_ep;
+    /* allocator the objects of the process were carved from if it was configured with an
+     * untyped pool, its data is NULL otherwise */
+    vka_t untyped_pool;
+    /* allocator the objects of the process come from if it was configured with one, see
+     * process_config_object_vka, NULL otherwise */
+    vka_t *object_vka;
+    /* manager the ASID of the vspace came from and the pool it is in, if it was configured
+     * with process_config_asid_manager */
+    sel4utils_asid_manager_t *asid_manager;
+    seL4_CPtr asid_pool;
 } sel4utils_process_t;
 
+/* One process to create in a call to sel4utils_spawn_batch */
+typedef struct sel4utils_spawn_job {
+    /* filled in by the caller */
+    sel4utils_process_t *process;
+    sel4utils_process_config_t config;
+    int argc;
+    char **argv;
+    int resume;
+    /* filled in by sel4utils_spawn_batch: the result of configuring and spawning the
+     * process, and the allocator to later pass to sel4utils_destroy_process */
+    int error;
+    vka_t *vka;
+} sel4utils_spawn_job_t;
+
+struct sel4utils_spawn_batch;
+
+/* A thread that builds processes for sel4utils_spawn_batch */
+typedef struct sel4utils_spawn_worker {
+    /* Allocator and spawner vspace front end for this worker alone. Nothing else may
+     * use them for the duration of the batch */
+    vka_t *vka;
+    vspace_t *vspace;
+    /* used internally */
+    sel4utils_thread_t thread;
+    struct sel4utils_spawn_batch *batch;
+} sel4utils_spawn_worker_t;
+
+/* A frame of a process and the pristine copy of its contents we restore it from */
+typedef struct sel4utils_process_snapshot_frame {
+    uintptr_t vaddr;
+    size_t size_bits;
+    vka_object_t pristine;
+    /* where pristine is mapped in the vspace that took the snapshot */
+    void *copy;
+} sel4utils_process_snapshot_frame_t;
+
+/* The writable state of a process: registers, writable elf segments, stack and ipc buffer */
+typedef struct sel4utils_process_snapshot {
+    size_t num_frames;
+    sel4utils_process_snapshot_frame_t *frames;
+    seL4_UserContext regs;
+} sel4utils_process_snapshot_t;
+
 /* sel4utils processes start with some caps in their cspace.
  * These are the caps
  */
@@ -243,6 +296,98 @@ seL4_CPtr sel4utils_move_cap_to_process(sel4utils_process_t *process, cspacepath
 seL4_CPtr sel4utils_mint_cap_to_process(sel4utils_process_t *process, cspacepath_t src, seL4_CapRights_t rights,
                                         seL4_Word data);
 
+/* One cap to give a process with sel4utils_copy_caps_to_process */
+typedef struct sel4utils_process_cap {
+    /* path in the current cspace to copy the cap from */
+    cspacepath_t src;
+    seL4_CapRights_t rights;
+    /* badge to mint the cap with, 0 to copy it as it is */
+    seL4_Word data;
+} sel4utils_process_cap_t;
+
+/**
+ * Copy or mint a number of caps into consecutive slots of a process' cspace.
+ *
+ * As sel4utils_mint_cap_to_process for each cap, except that either every cap is
+ * given to the process or, if one fails, none are and the slots are left free.
+ *
+ * @param process process to give the caps to
+ * @param caps    caps to give, the first goes in the returned slot and the rest after it
+ * @param num     number of caps
+ *
+ * @return 0 on failure, otherwise the slot in the process' cspace of the first cap.
+ */
+seL4_CPtr sel4utils_copy_caps_to_process(sel4utils_process_t *process, const sel4utils_process_cap_t *caps,
+                                         size_t num);
+
+/**
+ * Configure and spawn a batch of independent processes, each as per
+ * sel4utils_configure_process_custom followed by sel4utils_spawn_process_v, on one worker
+ * thread per core. Workers take the next job as they finish the last, so a single slow
+ * image does not hold up the rest. ASID pool assignment is serialised between workers;
+ * everything else a job does only touches its worker's vka and vspace.
+ *
+ * The caller must be linked against a thread safe malloc, and jobs run on different
+ * workers must not share an elf cache.
+ *
+ * @param simple used to find the number of cores and to configure the workers
+ * @param vka allocator for the worker threads
+ * @param vspace vspace of the caller, in which the worker threads run
+ * @param priority priority to run the workers at
+ * @param num_workers size of the workers array. At most one worker per core is used
+ * @param workers per worker allocators and vspaces
+ * @param num_jobs size of the jobs array
+ * @param jobs processes to create. The error of each job reports how it went
+ *
+ * @return 0 if every job succeeded, -1 if any failed or the workers could not be started
+ */
+int sel4utils_spawn_batch(simple_t *simple, vka_t *vka, vspace_t *vspace, uint8_t priority,
+                          size_t num_workers, sel4utils_spawn_worker_t workers[num_workers],
+                          size_t num_jobs, sel4utils_spawn_job_t jobs[num_jobs]);
+
+/**
+ * Snapshot a configured process so it can later be reset in place with
+ * sel4utils_process_reset rather than destroyed and configured again. Taken after
+ * sel4utils_spawn_process_v with resume false, the snapshot is a template of the process
+ * ready to run with its arguments already on its stack.
+ *
+ * Only memory that is mapped and writable at the time of the snapshot is captured. The
+ * cspace, read only segments and anything mapped later are left as they are by a reset.
+ *
+ * @param process the process to snapshot, which is suspended
+ * @param vka allocator the process was configured with, pristine copies come from here too
+ * @param vspace the vspace of the caller, pristine copies stay mapped here
+ * @param snapshot the snapshot to populate
+ *
+ * @return 0 on success, -1 on error
+ */
+int sel4utils_process_snapshot(sel4utils_process_t *process, vka_t *vka, vspace_t *vspace,
+                               sel4utils_process_snapshot_t *snapshot);
+
+/**
+ * Reset a process to a snapshot taken with sel4utils_process_snapshot by copying the
+ * pristine contents back over its frames and restoring its registers.
+ *
+ * @param process the process to reset
+ * @param vka allocator the process was configured with
+ * @param vspace the vspace the snapshot was taken from
+ * @param snapshot the snapshot to reset to, which can be reused
+ * @param resume true if the process should be started again
+ *
+ * @return 0 on success, -1 on error
+ */
+int sel4utils_process_reset(sel4utils_process_t *process, vka_t *vka, vspace_t *vspace,
+                            sel4utils_process_snapshot_t *snapshot, bool resume);
+
+/**
+ * Free a snapshot taken with sel4utils_process_snapshot.
+ *
+ * @param snapshot the snapshot to free
+ * @param vka allocator the snapshot was taken with
+ * @param vspace the vspace the snapshot was taken from
+ */
+void sel4utils_process_snapshot_free(sel4utils_process_snapshot_t *snapshot, vka_t *vka, vspace_t *vspace);
+
 /**
  * Destroy a process.
  *
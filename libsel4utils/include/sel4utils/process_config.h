@@ -10,6 +10,7 @@
 #include <sel4utils/gen_config.h>
 #include <sel4/types.h>
 #include <sel4utils/api.h>
+#include <sel4utils/asid_pool.h>
 #include <sel4utils/elf.h>
 #include <vka/vka.h>
 
@@ -20,6 +21,12 @@ typedef struct {
     const char *image_name;
     /* Do you want the elf image preloaded? */
     bool do_elf_load;
+    /* optional cache to share read only segments of preloaded images through */
+    sel4utils_elf_cache_t *elf_cache;
+    /* If not 0, the largest frames to preload segments with, such as seL4_PageBits to keep
+     * to 4K frames. Otherwise large pages are used wherever a segment allows. Images
+     * loaded through the elf cache always allow large pages */
+    size_t elf_max_page_bits;
 
     /* otherwise what is the entry point and sysinfo? */
     void *entry_point;
@@ -57,6 +64,21 @@ typedef struct {
     sched_params_t sched_params;
 
     seL4_CPtr asid_pool;
+    /* If not NULL, assign the vspace an ASID from this manager rather than from asid_pool,
+     * and give it back when the process is destroyed */
+    sel4utils_asid_manager_t *asid_manager;
+
+    /* If not 0, carve every object of the process from untypeds of this size taken for it
+     * alone, so that destroying it revokes the untypeds rather than freeing each object.
+     * The elf cache is not used for such a process, as its shared frames would be carved
+     * from the pools of whichever process loaded them first. */
+    size_t untyped_pool_size_bits;
+
+    /* If not NULL, allocate every object of the process from this vka rather than the one it
+     * is configured with, such as one made by allocman_make_coloured_vka to keep the process
+     * to a partition of the cache. Frames mapped into its vspace later come from it too. The
+     * elf cache is not used, as its shared frames may be of any colour. */
+    vka_t *object_vka;
 } sel4utils_process_config_t;
 
 static inline sel4utils_process_config_t process_config_asid_pool(sel4utils_process_config_t config,
@@ -66,12 +88,33 @@ static inline sel4utils_process_config_t process_config_asid_pool(sel4utils_proc
     return config;
 }
 
+static inline sel4utils_process_config_t process_config_asid_manager(sel4utils_process_config_t config,
+                                                                     sel4utils_asid_manager_t *asid_manager)
+{
+    config.asid_manager = asid_manager;
+    return config;
+}
+
 static inline sel4utils_process_config_t process_config_auth(sel4utils_process_config_t config, seL4_CPtr auth)
 {
     config.sched_params.auth = auth;
     return config;
 }
 
+static inline sel4utils_process_config_t process_config_untyped_pool(sel4utils_process_config_t config,
+                                                                     size_t size_bits)
+{
+    config.untyped_pool_size_bits = size_bits;
+    return config;
+}
+
+static inline sel4utils_process_config_t process_config_object_vka(sel4utils_process_config_t config,
+                                                                   vka_t *object_vka)
+{
+    config.object_vka = object_vka;
+    return config;
+}
+
 static inline sel4utils_process_config_t process_config_new(simple_t *simple)
 {
     sel4utils_process_config_t config = {0};
@@ -88,6 +131,20 @@ static inline sel4utils_process_config_t process_config_elf(sel4utils_process_co
     return config;
 }
 
+static inline sel4utils_process_config_t process_config_elf_cache(sel4utils_process_config_t config,
+                                                                  sel4utils_elf_cache_t *elf_cache)
+{
+    config.elf_cache = elf_cache;
+    return config;
+}
+
+static inline sel4utils_process_config_t process_config_elf_max_page_bits(sel4utils_process_config_t config,
+                                                                         size_t max_page_bits)
+{
+    config.elf_max_page_bits = max_page_bits;
+    return config;
+}
+
 static inline sel4utils_process_config_t process_config_noelf(sel4utils_process_config_t config, void *entry_point,
                                                               uintptr_t sysinfo)
 {
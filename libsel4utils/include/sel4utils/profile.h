@@ -11,6 +11,9 @@
 
 #define PROFILE_VAR_TYPE_INT32 1
 #define PROFILE_VAR_TYPE_INT64 2
+#define PROFILE_VAR_TYPE_SHARDED64 3
+
+#define PROFILE_CACHE_LINE 64
 
 typedef struct profile_var {
     int type;
@@ -38,6 +41,27 @@ typedef struct profile_var {
 #define WATCH_VAR64(var, description) \
     _WATCH_VAR64(var, description, __LINE__)
 
+/* A 64 bit counter with a slot on its own cache line for each core, so that threads on
+ * different cores count without sharing a line, and summed when scraped. The slot is
+ * picked by profile_core, which each thread sets to the core it is pinned to with
+ * profile_set_core. Increments are plain adds, so as with PADD an increment can be lost
+ * to a thread on the same core that preempts it mid way. */
+typedef struct profile_shard {
+    uint64_t value;
+} __attribute__((aligned(PROFILE_CACHE_LINE))) profile_shard_t;
+
+#define _WATCH_SHARDED(var, description, unique) \
+    compile_time_assert(profile_shards_##unique, sizeof(var) == sizeof(profile_shard_t) * CONFIG_MAX_NUM_NODES); \
+    __WATCH_VAR(PROFILE_VAR_TYPE_SHARDED64, var, description, unique)
+
+#define WATCH_SHARDED(var, description) \
+    _WATCH_SHARDED(var, description, __LINE__)
+
+extern __thread unsigned int profile_core;
+
+/* Set the core whose shards the calling thread counts in, 0 until called */
+void profile_set_core(unsigned int core);
+
 typedef void (*profile_callback32)(uint32_t value, const char *varname, const char *descrption, void *cookie);
 typedef void (*profile_callback64)(uint64_t value, const char *varname, const char *descrption, void *cookie);
 
@@ -45,8 +69,22 @@ typedef void (*profile_callback64)(uint64_t value, const char *varname, const ch
 void profile_print32(uint32_t value, const char *varname, const char *description, void *cookie);
 void profile_print64(uint64_t value, const char *varname, const char *description, void *cookie);
 
-/* Iterates over all profile variables and calls back the specified function(s)
- * with the current value. */
+/* Values that are computed when scraped rather than kept in a variable, such as
+ * snapshots of an allocator. scrape calls callback64 with each value */
+typedef struct profile_source {
+    void (*scrape)(void *data, profile_callback64 callback64, void *cookie);
+    void *data;
+    struct profile_source *next;
+} profile_source_t;
+
+/* Add a source to be reported by profile_scrape after the profile variables. The
+ * source must stay valid until it is unregistered. Neither of these are thread safe
+ * against each other or profile_scrape */
+void profile_register_source(profile_source_t *source);
+void profile_unregister_source(profile_source_t *source);
+
+/* Iterates over all profile variables and registered sources and calls back the
+ * specified function(s) with the current value. */
 void profile_scrape(profile_callback32 callback32, profile_callback64 callback64, void *cookie);
 
 /* Iterates over all profile variables and resets the value to zero */
@@ -66,11 +104,16 @@ void profile_reset(void);
 #define PADD(name, x) do {name += (x); } while(0)
 #define PSTART_TIME(x) _PSTART_TIME(x)
 #define PEND_TIME(x) _PEND_TIME(x)
+#define PVARSHARDED(name, desc) static profile_shard_t name[CONFIG_MAX_NUM_NODES]; WATCH_SHARDED(name, desc);
+#define PSHARDADD(name, x) do {name[profile_core].value += (x); } while(0)
 #else
 #define PVARUINT32(name, desc)
 #define PVARUINT64(name, desc)
 #define PADD(name, x) do { } while(0)
 #define PSTART_TIME(x) do { } while(0)
 #define PEND_TIME(x) do { } while(0)
+#define PVARSHARDED(name, desc)
+#define PSHARDADD(name, x) do { } while(0)
 #endif
+#define PSHARDINC(name) PSHARDADD(name, 1)
 
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* A ring of descriptors in memory shared between components.
+ *
+ * One consumer takes descriptors that one, or optionally many, producers put. The indices
+ * each side writes live on cache lines of their own. Each side is told about the other
+ * with a notification, which is only signalled when the ring goes from empty to non empty
+ * (to wake the consumer) or from full to not full (to wake a producer), so a steady stream
+ * of descriptors costs no system calls. Descriptors only describe buffers, such as buffers
+ * from a dma manager, so nothing is copied through the ring. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <vspace/vspace.h>
+
+#define SEL4UTILS_RING_CACHE_LINE 64
+
+typedef struct sel4utils_ring_desc {
+    /* address of the buffer as the peer understands it, such as the result of ps_dma_pin */
+    uintptr_t addr;
+    size_t len;
+    /* free for the user, such as to identify the buffer when it comes back */
+    seL4_Word cookie;
+} sel4utils_ring_desc_t;
+
+/* Layout of the shared memory */
+typedef struct sel4utils_ring_shared {
+    /* written by producers: descriptors before head are ready, before reserve are claimed */
+    size_t head __attribute__((aligned(SEL4UTILS_RING_CACHE_LINE)));
+    size_t reserve;
+    /* written by the consumer: descriptors before tail have been taken */
+    size_t tail __attribute__((aligned(SEL4UTILS_RING_CACHE_LINE)));
+    /* set up once */
+    size_t mask __attribute__((aligned(SEL4UTILS_RING_CACHE_LINE)));
+    bool multi_producer;
+    sel4utils_ring_desc_t descs[] __attribute__((aligned(SEL4UTILS_RING_CACHE_LINE)));
+} sel4utils_ring_shared_t;
+
+/* One side's view of a ring */
+typedef struct sel4utils_ring {
+    sel4utils_ring_shared_t *shared;
+    /* notification of the other side, seL4_CapNull to never signal */
+    seL4_CPtr notify;
+    /* number of pages of shared memory */
+    size_t num_pages;
+} sel4utils_ring_t;
+
+/**
+ * Create a ring in newly allocated memory.
+ *
+ * @param vspace vspace to allocate and map the ring's memory in
+ * @param size_bits log2 of the number of descriptors the ring holds
+ * @param multi_producer whether more than one producer may enqueue at once
+ * @param notify notification of the other side
+ * @param ring ring to initialise
+ *
+ * @return 0 on success.
+ */
+int sel4utils_ring_create(vspace_t *vspace, size_t size_bits, bool multi_producer, seL4_CPtr notify,
+                          sel4utils_ring_t *ring);
+
+/**
+ * Share a ring created with sel4utils_ring_create into another vspace, the other side then
+ * uses sel4utils_ring_attach on the returned address.
+ *
+ * @param ring the ring to share
+ * @param from the vspace the ring was created in
+ * @param to the vspace to share into
+ *
+ * @return address of the ring in to, NULL on failure.
+ */
+void *sel4utils_ring_share(sel4utils_ring_t *ring, vspace_t *from, vspace_t *to);
+
+/**
+ * Set up the other side's view of a shared ring.
+ *
+ * @param shared address of the ring's memory
+ * @param notify notification of the side that created the ring
+ * @param ring ring to initialise
+ */
+void sel4utils_ring_attach(void *shared, seL4_CPtr notify, sel4utils_ring_t *ring);
+
+/**
+ * Free the memory of a ring created with sel4utils_ring_create, after every vspace it was
+ * shared into has unmapped it.
+ *
+ * @param vspace the vspace the ring was created in
+ * @param ring the ring to destroy
+ */
+void sel4utils_ring_destroy(vspace_t *vspace, sel4utils_ring_t *ring);
+
+/**
+ * Put up to num descriptors on the ring, signalling the consumer if the ring was empty.
+ *
+ * @return number of descriptors put, less than num if the ring filled up.
+ */
+size_t sel4utils_ring_enqueue(sel4utils_ring_t *ring, const sel4utils_ring_desc_t *descs, size_t num);
+
+/**
+ * Take up to max descriptors from the ring, signalling the producer if the ring was full.
+ * When this returns 0 the consumer can wait on its notification, which is signalled once
+ * anything is put on the ring.
+ *
+ * @return number of descriptors taken.
+ */
+size_t sel4utils_ring_dequeue(sel4utils_ring_t *ring, sel4utils_ring_desc_t *descs, size_t max);
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* A statistical profiler that samples the program counters of a set of threads.
+ *
+ * Each time a sample is taken, the registers of every target thread are read with
+ * seL4_TCB_ReadRegisters and its program counter put on a ring, overwriting the oldest
+ * samples once full. Samples are normally taken from an IRQ handled by the irq server, such
+ * as a periodic timer. The PMU overflow interrupt cannot be programmed from user level, but
+ * where a kernel configures it and makes its IRQ available, it can be registered the same way
+ * to sample every N events instead of every N ticks.
+ *
+ * A target that is blocked is sampled at the system call it is blocked in, so samples show
+ * where time is spent waiting as well as running. sel4utils_sampler_dump prints the samples
+ * one per line, so a host script can map the addresses to symbols with addr2line and count
+ * them into the folded stacks that flame graph tools take. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sel4/sel4.h>
+#include <platsupport/irq.h>
+#include <sel4utils/irq_server.h>
+
+typedef struct sel4utils_sampler_target {
+    seL4_CPtr tcb;
+    /* reported with each sample of the thread */
+    seL4_Word id;
+} sel4utils_sampler_target_t;
+
+typedef struct sel4utils_sample {
+    seL4_Word id;
+    seL4_Word pc;
+} sel4utils_sample_t;
+
+typedef struct sel4utils_sampler {
+    sel4utils_sampler_target_t *targets;
+    size_t num_targets;
+    sel4utils_sample_t *samples;
+    size_t mask;
+    /* samples ever taken, the next is at head & mask */
+    size_t head;
+    /* register reads that failed, such as of a deleted tcb */
+    size_t failed;
+    volatile bool enabled;
+    /* called after each sample taken from the IRQ callback, before the IRQ is acknowledged,
+     * to set up the next one, such as by setting a timeout. Can be NULL */
+    int (*rearm_fn)(void *data);
+    void *rearm_data;
+} sel4utils_sampler_t;
+
+/**
+ * Initialise a sampler, initially disabled.
+ *
+ * @param sampler sampler to initialise
+ * @param samples memory for the ring of BIT(size_bits) samples
+ * @param size_bits log2 of the number of samples to keep
+ * @param targets threads to sample, which must stay valid while the sampler is in use
+ * @param num_targets number of targets
+ *
+ * @return 0 on success.
+ */
+int sel4utils_sampler_init(sel4utils_sampler_t *sampler, sel4utils_sample_t *samples, size_t size_bits,
+                           sel4utils_sampler_target_t *targets, size_t num_targets);
+
+/**
+ * Start or stop sampling. Samples are kept until sel4utils_sampler_reset.
+ */
+void sel4utils_sampler_enable(sel4utils_sampler_t *sampler, bool enabled);
+
+/* Discard all the samples */
+void sel4utils_sampler_reset(sel4utils_sampler_t *sampler);
+
+/**
+ * Take a sample of every target, if the sampler is enabled. For calling from an IRQ handler
+ * other than sel4utils_sampler_irq_callback.
+ */
+void sel4utils_sampler_sample(sel4utils_sampler_t *sampler);
+
+/* An irq_callback_fn_t that samples, rearms and acknowledges the IRQ. data is the sampler */
+void sel4utils_sampler_irq_callback(void *data, irq_acknowledge_fn_t acknowledge_fn, void *ack_data);
+
+/**
+ * Take samples each time an IRQ arrives, handled by the irq server.
+ *
+ * @return an IRQ ID on success, as for irq_server_register_irq
+ */
+irq_id_t sel4utils_sampler_register_irq(sel4utils_sampler_t *sampler, irq_server_t *irq_server, ps_irq_t irq);
+
+/**
+ * @return number of samples held, at most the size of the ring
+ */
+size_t sel4utils_sampler_num_samples(sel4utils_sampler_t *sampler);
+
+/**
+ * Print the held samples, oldest first, after a header line, as one "<id> 0x<pc>" line each.
+ * Stop the sampler first to get a consistent dump.
+ */
+void sel4utils_sampler_dump(sel4utils_sampler_t *sampler);
@@ -19,10 +19,16 @@
  * Initialise with another allocator to perform cspace allocation,
  * untyped allocation.
  *
- * When the slab allocator runs out, it will delegate any
- * further allocations.
+ * Objects are handed out as copies of caps the slab keeps. Freeing an object revokes
+ * the slab's cap, removing every cap that was derived from it, and returns the object to
+ * a per type free list to be handed out again. Other object state, such as threads
+ * queued on an endpoint, is not reset. Objects are never returned to the delegate.
  *
- * This allocator does not implement free, alloc_at, paddr or device related functions.
+ * A type can be set to refill in batches from the delegate, with a single multi object
+ * allocation, once it runs low. Otherwise when the slab runs out of a type it delegates
+ * any further allocations of it.
+ *
+ * This allocator does not implement alloc_at, paddr or device related functions.
  */
 
 /**
@@ -34,3 +40,14 @@
  * @return 0 on success
  */
 int slab_init(vka_t *slab_vka, vka_t *delegate, size_t object_freq[seL4_ObjectTypeCount]);
+
+/**
+ * Refill a type in batches once it runs low.
+ *
+ * @param slab_vka allocator initialised with slab_init
+ * @param type object type to refill
+ * @param low_water refill once fewer than this many objects of type are free
+ * @param batch number of objects to create per refill, 0 to never refill
+ * @return 0 on success
+ */
+int slab_set_refill(vka_t *slab_vka, seL4_Word type, size_t low_water, size_t batch);
@@ -5,6 +5,9 @@
  */
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include <vspace/vspace.h>
 
 /**
@@ -20,3 +23,56 @@
  */
 int sel4utils_run_on_stack(vspace_t *vspace, void * (*func)(void *arg), void *arg, void **retval);
 
+
+/* Free stacks of one size, linked through the word at the top of each stack */
+typedef struct sel4utils_stack_class {
+    size_t num_pages;
+    void *free;
+    struct sel4utils_stack_class *next;
+} sel4utils_stack_class_t;
+
+/* A cache of stacks allocated with vspace_new_sized_stack. Stacks stay mapped, with their
+ * guard pages, while in the pool and are handed out most recently returned first */
+typedef struct sel4utils_stack_pool {
+    vspace_t *vspace;
+    /* zero the pages a stack used before it is handed out again */
+    bool zero;
+    sel4utils_stack_class_t *classes;
+} sel4utils_stack_pool_t;
+
+/**
+ * Initialise an empty stack pool.
+ *
+ * @param pool the pool to initialise
+ * @param vspace vspace to allocate stacks in. If zero is set this must be the vspace of the
+ *               caller, as stacks are zeroed in place.
+ * @param zero true if returned stacks should be zeroed, only the pages that were touched are
+ */
+void sel4utils_stack_pool_init(sel4utils_stack_pool_t *pool, vspace_t *vspace, bool zero);
+
+/**
+ * Get a stack of n_pages from a pool, allocating a new one only if none is free.
+ *
+ * @return the top of the stack, or NULL on failure.
+ */
+void *sel4utils_stack_pool_get(sel4utils_stack_pool_t *pool, size_t n_pages);
+
+/**
+ * Return a stack obtained with sel4utils_stack_pool_get to its pool.
+ *
+ * @param stack_top top of the stack
+ * @param n_pages size the stack was obtained with
+ */
+void sel4utils_stack_pool_put(sel4utils_stack_pool_t *pool, void *stack_top, size_t n_pages);
+
+/**
+ * Free every stack in a pool. Stacks that are handed out are not affected.
+ */
+void sel4utils_stack_pool_destroy(sel4utils_stack_pool_t *pool);
+
+/**
+ * As sel4utils_run_on_stack, but with a stack of n_pages from a pool that is returned to
+ * it once func returns.
+ */
+int sel4utils_run_on_pooled_stack(sel4utils_stack_pool_t *pool, size_t n_pages, void * (*func)(void *arg),
+                                  void *arg, void **retval);
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* A small work stealing task runtime.
+ *
+ * One worker thread runs on each core it is given, each with its own Chase-Lev deque of
+ * tasks. Tasks spawned by a task go on the bottom of its worker's deque, tasks spawned from
+ * outside the runtime go on a shared injection queue, and workers that run out of work steal
+ * from the top of the other deques. Workers with nothing to steal block on their own
+ * notification, which is only signalled when there is a sleeper to wake, so spawning a task
+ * costs no system calls while every worker is busy. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <simple/simple.h>
+#include <vka/vka.h>
+#include <vspace/vspace.h>
+#include <sel4utils/thread.h>
+
+/* Tasks spawned with the same group can be waited for together */
+typedef struct sel4utils_task_group {
+    size_t pending;
+} sel4utils_task_group_t;
+
+typedef void (*sel4utils_task_fn)(void *arg);
+
+/* A unit of work. Owned by the caller and must stay valid until it has run */
+typedef struct sel4utils_task {
+    sel4utils_task_fn fn;
+    void *arg;
+    /* optional group to report completion to */
+    sel4utils_task_group_t *group;
+} sel4utils_task_t;
+
+/* Fixed size ring of tasks, indices are signed so the owner can speculatively take */
+typedef struct sel4utils_task_deque {
+    intptr_t top;
+    intptr_t bottom;
+    intptr_t mask;
+    sel4utils_task_t **tasks;
+} sel4utils_task_deque_t;
+
+struct sel4utils_task_runtime;
+
+typedef struct sel4utils_task_worker {
+    sel4utils_thread_t thread;
+    sel4utils_task_deque_t deque;
+    vka_object_t notification;
+    /* true while blocked, or about to block, on notification */
+    bool sleeping;
+    size_t index;
+    struct sel4utils_task_runtime *runtime;
+} sel4utils_task_worker_t;
+
+typedef struct sel4utils_task_runtime {
+    size_t num_workers;
+    sel4utils_task_worker_t *workers;
+    /* tasks spawned from outside the runtime, protected by inject_lock */
+    sel4utils_task_deque_t inject;
+    int inject_lock;
+    size_t num_sleeping;
+    size_t num_started;
+    size_t num_exited;
+    bool stop;
+} sel4utils_task_runtime_t;
+
+/**
+ * Start a task runtime with a worker per core, up to num_workers.
+ *
+ * @param simple used to find the cores and configure the workers
+ * @param vka allocator for the workers. Tasks must not use it unless it is thread safe
+ * @param vspace vspace to run the workers in
+ * @param priority priority of the workers
+ * @param num_workers maximum number of workers, 0 for one per core
+ * @param size_bits log2 of the number of tasks each deque and the injection queue hold
+ * @param runtime the runtime to initialise
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int sel4utils_task_runtime_create(simple_t *simple, vka_t *vka, vspace_t *vspace, uint8_t priority,
+                                  size_t num_workers, size_t size_bits, sel4utils_task_runtime_t *runtime);
+
+/**
+ * Spawn a task. From a task this pushes onto the current worker's deque, anywhere else onto
+ * the injection queue. If the queue is full the task is run in place instead.
+ *
+ * @param runtime runtime to run the task on
+ * @param task the task to run
+ */
+void sel4utils_task_spawn(sel4utils_task_runtime_t *runtime, sel4utils_task_t *task);
+
+/**
+ * Wait for every task spawned with group to complete. Workers run other tasks while they
+ * wait; other threads yield.
+ *
+ * @param runtime runtime the tasks were spawned on
+ * @param group the group to wait for
+ */
+void sel4utils_task_group_wait(sel4utils_task_runtime_t *runtime, sel4utils_task_group_t *group);
+
+/**
+ * Stop the workers of a runtime and free them. Tasks already running are finished first,
+ * tasks that have not yet started are dropped. Must not be called from a task.
+ *
+ * @param vka the vka the runtime was created with
+ * @param vspace the vspace the runtime was created with
+ * @param runtime the runtime to destroy
+ */
+void sel4utils_task_runtime_destroy(vka_t *vka, vspace_t *vspace, sel4utils_task_runtime_t *runtime);
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* Export of metrics through shared memory, for a collector outside the system to read.
+ *
+ * Subsystems register each of their metrics once, as a counter, a gauge or a histogram,
+ * read either from a variable or through a callback, so that the counters of the profiler,
+ * of sel4bench or of the irq server can be exported without changing them. Each snapshot
+ * reads every metric and writes it to a ring of fixed size records in the shared memory,
+ * overwriting the oldest once full. Snapshots are taken by hand, or on a period by the time
+ * server, either from the time server's own context or by a thread of the lowest priority
+ * that the time server wakes.
+ *
+ * The collector never writes to the memory, so it can be a host reading it through a debug
+ * port or a device. It reads a header and a table describing the metrics, then the ring of
+ * records. A snapshot is a SEL4UTILS_TELEMETRY_SNAPSHOT record with its timestamp, followed
+ * by a record for each counter and gauge and one for each histogram bucket that isn't
+ * empty. Every record carries the low bits of its position in the ring, written last when
+ * the record is written and cleared first when it is overwritten, so a collector that
+ * falls behind or reads a record as it is written sees that it did. All fields are native
+ * endian, and the header gives the sizes of the records and of the table so that they can
+ * grow in later versions. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <vka/vka.h>
+#include <vspace/vspace.h>
+#include <sel4utils/thread.h>
+#include <sel4utils/time_server/server.h>
+
+#define SEL4UTILS_TELEMETRY_MAGIC 0x4d4c4554 /* "TELM" */
+#define SEL4UTILS_TELEMETRY_VERSION 1
+#define SEL4UTILS_TELEMETRY_NAME_LEN 24
+/* bucket 0 counts zeroes, bucket n values of n significant bits, the last everything larger */
+#define SEL4UTILS_TELEMETRY_BUCKETS 32
+/* metric of the record starting each snapshot, its value is the snapshot's timestamp */
+#define SEL4UTILS_TELEMETRY_SNAPSHOT 0xffff
+
+typedef enum sel4utils_telemetry_type {
+    /* a value that only grows, such as events counted */
+    SEL4UTILS_TELEMETRY_COUNTER = 1,
+    /* a value that can go either way, such as bytes free */
+    SEL4UTILS_TELEMETRY_GAUGE,
+    /* counts of values recorded into log2 buckets, such as latencies */
+    SEL4UTILS_TELEMETRY_HISTOGRAM,
+} sel4utils_telemetry_type_t;
+
+/* Layout of the shared memory, at its start */
+typedef struct sel4utils_telemetry_header {
+    uint32_t magic;
+    uint32_t version;
+    /* bytes from the header to the table of metrics and to the ring of records */
+    uint32_t metrics_offset;
+    uint32_t records_offset;
+    uint32_t metric_size;
+    uint32_t record_size;
+    uint32_t max_metrics;
+    /* entries of the table are valid up to num_metrics */
+    uint32_t num_metrics;
+    /* a power of two */
+    uint32_t num_records;
+    uint32_t reserved;
+    /* records ever written, the next is at head % num_records */
+    uint64_t head;
+    /* snapshots ever taken */
+    uint64_t snapshots;
+} sel4utils_telemetry_header_t;
+
+typedef struct sel4utils_telemetry_metric {
+    /* nul terminated unless it is SEL4UTILS_TELEMETRY_NAME_LEN long */
+    char name[SEL4UTILS_TELEMETRY_NAME_LEN];
+    uint16_t id;
+    uint8_t type;
+    uint8_t num_buckets;
+    uint32_t reserved;
+} sel4utils_telemetry_metric_t;
+
+typedef struct sel4utils_telemetry_record {
+    /* low bits of the record's position in the ring plus one, 0 while it is written */
+    uint32_t seq;
+    uint16_t metric;
+    /* the bucket of a histogram record, 0 otherwise */
+    uint8_t bucket;
+    uint8_t reserved;
+    uint64_t value;
+} sel4utils_telemetry_record_t;
+
+typedef struct sel4utils_telemetry_histogram {
+    uint64_t buckets[SEL4UTILS_TELEMETRY_BUCKETS];
+} sel4utils_telemetry_histogram_t;
+
+typedef uint64_t (*sel4utils_telemetry_read_fn)(void *data);
+
+/* Where a metric is read from, private to the exporting side */
+typedef struct sel4utils_telemetry_source {
+    sel4utils_telemetry_type_t type;
+    /* a counter or gauge is read from value if it is not NULL, and from read_fn otherwise */
+    const uint64_t *value;
+    sel4utils_telemetry_read_fn read_fn;
+    void *read_data;
+    const sel4utils_telemetry_histogram_t *histogram;
+} sel4utils_telemetry_source_t;
+
+typedef struct sel4utils_telemetry {
+    sel4utils_telemetry_header_t *header;
+    sel4utils_telemetry_metric_t *metrics;
+    sel4utils_telemetry_record_t *records;
+    sel4utils_telemetry_source_t *sources;
+    /* serialises registration with snapshots */
+    int lock;
+    /* most records a snapshot of the registered metrics takes, at most num_records */
+    size_t snapshot_records;
+    /* pages allocated by sel4utils_telemetry_create, 0 if the memory is the user's */
+    size_t num_pages;
+    /* periodic snapshots, see sel4utils_telemetry_start_periodic */
+    sel4utils_time_server_t *server;
+    sel4utils_timeout_t timeout;
+    /* snapshot thread, see sel4utils_telemetry_start_thread */
+    sel4utils_thread_t thread;
+    seL4_CPtr notification;
+} sel4utils_telemetry_t;
+
+/**
+ * Set up telemetry in memory the user provides, such as memory a host can see.
+ *
+ * @param telemetry telemetry to initialise
+ * @param mem shared memory, aligned to 8 bytes
+ * @param bytes size of mem, which must fit the header, the table and at least one record
+ * @param sources memory for the sources of max_metrics metrics
+ * @param max_metrics most metrics that can be registered, at most SEL4UTILS_TELEMETRY_SNAPSHOT
+ *
+ * @return 0 on success.
+ */
+int sel4utils_telemetry_init(sel4utils_telemetry_t *telemetry, void *mem, size_t bytes,
+                             sel4utils_telemetry_source_t *sources, size_t max_metrics);
+
+/**
+ * Set up telemetry in newly allocated memory.
+ *
+ * @param telemetry telemetry to initialise
+ * @param vspace vspace to allocate and map the memory in
+ * @param num_pages 4K pages of shared memory
+ * @param sources memory for the sources of max_metrics metrics
+ * @param max_metrics most metrics that can be registered
+ *
+ * @return 0 on success.
+ */
+int sel4utils_telemetry_create(sel4utils_telemetry_t *telemetry, vspace_t *vspace, size_t num_pages,
+                               sel4utils_telemetry_source_t *sources, size_t max_metrics);
+
+/**
+ * Share the memory of telemetry created with sel4utils_telemetry_create into the vspace of a
+ * collector.
+ *
+ * @return address of the memory in to, NULL on failure.
+ */
+void *sel4utils_telemetry_share(sel4utils_telemetry_t *telemetry, vspace_t *from, vspace_t *to);
+
+/**
+ * Stop the telemetry and free the memory of telemetry created with
+ * sel4utils_telemetry_create, after every vspace it was shared into has unmapped it. The
+ * snapshot thread, if started, must have been stopped.
+ */
+void sel4utils_telemetry_destroy(sel4utils_telemetry_t *telemetry, vspace_t *vspace);
+
+/**
+ * Register a counter or gauge read from a variable, which must stay valid while the
+ * telemetry is in use. May be called as snapshots are taken. A metric is only registered
+ * if a snapshot of every metric still fits in the ring, counting a record for each counter
+ * and gauge, one for each bucket of each histogram, and the record starting the snapshot.
+ *
+ * @return id of the metric, -1 if the table or the ring is full.
+ */
+int sel4utils_telemetry_add_value(sel4utils_telemetry_t *telemetry, const char *name,
+                                  sel4utils_telemetry_type_t type, const uint64_t *value);
+
+/* As sel4utils_telemetry_add_value, with the metric read by calling read_fn(data) */
+int sel4utils_telemetry_add_fn(sel4utils_telemetry_t *telemetry, const char *name,
+                               sel4utils_telemetry_type_t type, sel4utils_telemetry_read_fn read_fn,
+                               void *data);
+
+/* As sel4utils_telemetry_add_value, for a histogram filled with
+ * sel4utils_telemetry_histogram_record */
+int sel4utils_telemetry_add_histogram(sel4utils_telemetry_t *telemetry, const char *name,
+                                      const sel4utils_telemetry_histogram_t *histogram);
+
+/* Count value in its bucket, from any thread */
+static inline void sel4utils_telemetry_histogram_record(sel4utils_telemetry_histogram_t *histogram,
+                                                        uint64_t value)
+{
+    size_t bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    if (bucket >= SEL4UTILS_TELEMETRY_BUCKETS) {
+        bucket = SEL4UTILS_TELEMETRY_BUCKETS - 1;
+    }
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Read every metric into the ring.
+ *
+ * @param telemetry telemetry to snapshot
+ * @param timestamp recorded with the snapshot, such as ns since boot
+ */
+void sel4utils_telemetry_snapshot(sel4utils_telemetry_t *telemetry, uint64_t timestamp);
+
+/**
+ * Start a thread that takes a snapshot each time notification is signalled, by
+ * sel4utils_telemetry_start_periodic or by the user. The thread runs at priority 0, so
+ * that snapshots only use time nothing else wants, and can be given another priority
+ * through its tcb.
+ *
+ * @param telemetry telemetry to snapshot, must outlive the thread
+ * @param vka allocator for the thread
+ * @param vspace vspace of the telemetry, for the thread to run in
+ * @param cspace the root of the cspace to start the thread in
+ * @param data the cspace_data for that cspace (with correct guard)
+ * @param notification notification the thread waits on
+ *
+ * @return 0 on success.
+ */
+int sel4utils_telemetry_start_thread(sel4utils_telemetry_t *telemetry, vka_t *vka, vspace_t *vspace,
+                                     seL4_CPtr cspace, seL4_Word data, seL4_CPtr notification);
+
+/* Stop and free the snapshot thread, with snapshots then taken in the time server's context */
+void sel4utils_telemetry_stop_thread(sel4utils_telemetry_t *telemetry, vka_t *vka, vspace_t *vspace);
+
+/**
+ * Take a snapshot every period_ns from the time server, timestamped with the time of its
+ * ltimer. If the snapshot thread has been started, it is signalled to take them, otherwise
+ * they are taken from the time server's context.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_telemetry_start_periodic(sel4utils_telemetry_t *telemetry, sel4utils_time_server_t *server,
+                                       uint64_t period_ns);
+
+/* Stop periodic snapshots */
+void sel4utils_telemetry_stop_periodic(sel4utils_telemetry_t *telemetry);
@@ -41,6 +41,8 @@ typedef struct sel4utils_thread {
     bool own_sc;
     bool own_reply;
     vka_object_t reply;
+    /* pool the stack came from and goes back to, if any */
+    struct sel4utils_stack_pool *stack_pool;
 } sel4utils_thread_t;
 
 typedef struct sel4utils_checkpoint {
@@ -52,6 +54,37 @@ typedef struct sel4utils_checkpoint {
     uintptr_t sp;
 } sel4utils_checkpoint_t;
 
+/* A page tracked by an incremental checkpoint */
+typedef struct sel4utils_checkpoint_page {
+    uintptr_t vaddr;
+    /* copy of the frame cap of the thread, mapped at mapping in the checkpointing vspace */
+    seL4_CPtr slot;
+    void *mapping;
+    /* contents at the time of the checkpoint, saved on the first write after it */
+    void *saved;
+    bool dirty;
+} sel4utils_checkpoint_page_t;
+
+/* A range of memory of a thread for an incremental checkpoint to track */
+typedef struct sel4utils_checkpoint_range {
+    void *start;
+    size_t bytes;
+} sel4utils_checkpoint_range_t;
+
+typedef struct sel4utils_incremental_checkpoint {
+    /* registers, with no stack as the stack is tracked page by page */
+    sel4utils_checkpoint_t checkpoint;
+    vspace_t *thread_vspace;
+    vspace_t *vspace;
+    vka_t *vka;
+    size_t num_pages;
+    /* sorted by vaddr */
+    sel4utils_checkpoint_page_t *pages;
+    size_t num_dirty;
+    /* pages written to since the checkpoint, so a restore only visits these */
+    sel4utils_checkpoint_page_t **dirty;
+} sel4utils_incremental_checkpoint_t;
+
 typedef void (*sel4utils_thread_entry_fn)(void *arg0, void *arg1, void *ipc_buf);
 
 /**
@@ -178,6 +211,65 @@ int sel4utils_checkpoint_restore(sel4utils_checkpoint_t *checkpoint, bool free,
  */
 void sel4utils_free_checkpoint(sel4utils_checkpoint_t *checkpoint);
 
+/**
+ * Checkpoint a thread in another vspace a page at a time rather than by copying its stack.
+ * Every 4K page mapped in the given ranges of its vspace, such as its stack, data and heap,
+ * is mapped read only. The first write to a page after the checkpoint faults, and
+ * sel4utils_checkpoint_fault saves the page and makes it writable again, so the cost of a
+ * restore is proportional to the pages the thread has written to.
+ *
+ * Faults must be passed to sel4utils_checkpoint_fault, such as by setting the checkpoint
+ * of a lazy fault handler that is the fault endpoint of the thread. The same restrictions
+ * on the state of the thread as sel4utils_checkpoint_thread apply.
+ *
+ * @param thread        the thread to checkpoint
+ * @param thread_vspace vspace of the thread, which must not be vspace
+ * @param vka           allocator of the caller, for the caps of the mappings into vspace
+ * @param vspace        vspace of the caller, where the pages of the thread are mapped
+ * @param num_ranges    number of ranges
+ * @param ranges        4K aligned ranges of thread_vspace, mapped with 4K pages whose
+ *                      reservations do not have deferred rights
+ * @param suspend       true if the thread should be suspended
+ * @param checkpoint    pointer to uninitialised checkpoint struct
+ *
+ * @return 0 on success.
+ */
+int sel4utils_checkpoint_thread_incremental(sel4utils_thread_t *thread, vspace_t *thread_vspace, vka_t *vka,
+                                            vspace_t *vspace, size_t num_ranges,
+                                            const sel4utils_checkpoint_range_t *ranges, bool suspend,
+                                            sel4utils_incremental_checkpoint_t *checkpoint);
+
+/**
+ * Handle a write fault at vaddr in a page tracked by an incremental checkpoint, by saving
+ * the page and making it writable.
+ *
+ * @param checkpoint the checkpoint covering vaddr
+ * @param vaddr      faulting address
+ *
+ * @return 0 if the fault was handled and the faulter can be resumed, -1 if vaddr is not
+ *         in a page the checkpoint tracks, or the page was already saved.
+ */
+int sel4utils_checkpoint_fault(sel4utils_incremental_checkpoint_t *checkpoint, void *vaddr);
+
+/**
+ * Rollback a thread to an incremental checkpoint, copying back only the pages written to
+ * since and making them read only again, so the checkpoint can be restored repeatedly.
+ *
+ * The thread must be stopped and not in the middle of a fault being handled.
+ *
+ * @param checkpoint the previously saved checkpoint to restore.
+ * @param resume     true if the thread should be resumed immediately.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_checkpoint_restore_incremental(sel4utils_incremental_checkpoint_t *checkpoint, bool resume);
+
+/**
+ * Clean up an incremental checkpoint, leaving the pages of the thread writable as they
+ * are now.
+ */
+void sel4utils_free_incremental_checkpoint(sel4utils_incremental_checkpoint_t *checkpoint);
+
 /**
  * Start a fault handling thread that will print the name of the thread that faulted
  * as well as debugging information. The thread will start at priority 0.
@@ -197,6 +289,217 @@ void sel4utils_free_checkpoint(sel4utils_checkpoint_t *checkpoint);
 int sel4utils_start_fault_handler(seL4_CPtr fault_endpoint, vka_t *vka, vspace_t *vspace,
                                   seL4_CPtr cspace, seL4_Word data, char *name, sel4utils_thread_t *res);
 
+typedef struct sel4utils_lazy_fault_handler {
+    sel4utils_thread_t thread;
+    seL4_CPtr fault_endpoint;
+    /* vspace of the faulting threads, containing the lazy reservations */
+    vspace_t *vspace;
+    /* vspace the handler itself runs in */
+    vspace_t *handler_vspace;
+    char *name;
+    /* incremental checkpoint of a faulter whose writes are also handled, or NULL */
+    sel4utils_incremental_checkpoint_t *checkpoint;
+} sel4utils_lazy_fault_handler_t;
+
+/**
+ * Start a fault handling thread that populates lazy reservations (see
+ * sel4utils_reservation_set_lazy) in faulter_vspace on demand, and copies frames shared
+ * with sel4utils_cow_clone_range when they are written to. If the checkpoint of the
+ * handler is set, writes to the pages it tracks are handled by sel4utils_checkpoint_fault
+ * too. VM faults that any of these resolve are handled and the faulter resumed. Any other fault is printed as with
+ * sel4utils_start_fault_handler, and the faulter is left blocked.
+ *
+ * The handler maps pages into faulter_vspace, so nothing else may use faulter_vspace
+ * while a fault is being handled. The simplest way to guarantee this is for every thread
+ * using it to have the handler as its fault endpoint.
+ *
+ * @param fault_endpoint the fault_endpoint to wait on
+ * @param vka allocator
+ * @param vspace vspace (this library must be mapped into that vspace).
+ * @param cspace the cspace that the fault_endpoint is in
+ * @param data the cspace_data for that cspace (with correct guard)
+ * @param name the name of the thread to print if it faults
+ * @param faulter_vspace vspace containing the lazy reservations
+ * @param handler the handler data structure to populate, must outlive the thread
+ *
+ * @return 0 on success.
+ */
+int sel4utils_start_lazy_fault_handler(seL4_CPtr fault_endpoint, vka_t *vka, vspace_t *vspace,
+                                       seL4_CPtr cspace, seL4_Word data, char *name, vspace_t *faulter_vspace,
+                                       sel4utils_lazy_fault_handler_t *handler);
+
+typedef struct sel4utils_reaper {
+    sel4utils_thread_t thread;
+    seL4_CPtr endpoint;
+    /* work done per call to sel4utils_tear_down_step, the reaper yields between calls */
+    size_t budget;
+} sel4utils_reaper_t;
+
+/**
+ * Start a thread that tears down vspaces handed to it with sel4utils_reaper_tear_down,
+ * so the caller does not have to wait for large vspaces to be destroyed. Tear downs are
+ * done one at a time, in steps of budget, yielding in between.
+ *
+ * The reaper frees frames to the vka given with each vspace and book keeping to that
+ * vspace's bootstrap vspace while other threads may be running, so both must be safe
+ * to use concurrently with the rest of the system.
+ *
+ * @param endpoint the endpoint to wait on
+ * @param vka allocator
+ * @param vspace vspace (this library must be mapped into that vspace).
+ * @param cspace the cspace that the endpoint is in
+ * @param data the cspace_data for that cspace (with correct guard)
+ * @param budget passed to sel4utils_tear_down_step
+ * @param reaper the reaper data structure to populate, must outlive the thread
+ *
+ * @return 0 on success.
+ */
+int sel4utils_start_reaper(seL4_CPtr endpoint, vka_t *vka, vspace_t *vspace, seL4_CPtr cspace,
+                           seL4_Word data, size_t budget, sel4utils_reaper_t *reaper);
+
+/**
+ * Hand a vspace to a reaper started with sel4utils_start_reaper to be torn down. This
+ * blocks until the reaper is ready to take it, not until the tear down is complete.
+ *
+ * @param endpoint the endpoint the reaper is waiting on
+ * @param vspace the vspace to tear down, must not be used or freed until the reaper
+ *               signals notification
+ * @param vka allocator to free the frames of vspace to, or VSPACE_FREE
+ * @param notification signalled once the tear down is complete, or seL4_CapNull
+ */
+void sel4utils_reaper_tear_down(seL4_CPtr endpoint, vspace_t *vspace, vka_t *vka, seL4_CPtr notification);
+
+typedef struct sel4utils_populater {
+    sel4utils_thread_t thread;
+    seL4_CPtr endpoint;
+} sel4utils_populater_t;
+
+/**
+ * Start a thread that populates ranges handed to it with sel4utils_populate_async, so that
+ * mapping memory up front can overlap with other initialisation. Ranges are populated one
+ * at a time with sel4utils_populate.
+ *
+ * While a range is being populated the populater allocates from and maps into its vspace,
+ * so nothing else may use that vspace, or its allocator unless that is safe to use
+ * concurrently, until the completion is signalled.
+ *
+ * @param endpoint the endpoint to wait on
+ * @param vka allocator
+ * @param vspace vspace (this library must be mapped into that vspace).
+ * @param cspace the cspace that the endpoint is in
+ * @param data the cspace_data for that cspace (with correct guard)
+ * @param populater the populater data structure to populate, must outlive the thread
+ *
+ * @return 0 on success.
+ */
+int sel4utils_start_populater(seL4_CPtr endpoint, vka_t *vka, vspace_t *vspace, seL4_CPtr cspace,
+                              seL4_Word data, sel4utils_populater_t *populater);
+
+/**
+ * Hand a range to a populater started with sel4utils_start_populater to be populated as by
+ * sel4utils_populate. This blocks until the populater is ready to take it, not until the
+ * range is populated.
+ *
+ * @param endpoint the endpoint the populater is waiting on
+ * @param vspace vspace the range is reserved in
+ * @param vaddr start of the range
+ * @param bytes size of the range
+ * @param flags SEL4UTILS_POPULATE_* flags
+ * @param error if not NULL, set to what sel4utils_populate returned before notification is
+ *              signalled
+ * @param notification signalled once the range is populated, or population failed
+ */
+void sel4utils_populate_async(seL4_CPtr endpoint, vspace_t *vspace, void *vaddr, size_t bytes, int flags,
+                              int *error, seL4_CPtr notification);
+
+/* Handle one request to a passive server, returning the message to reply with */
+typedef seL4_MessageInfo_t (*sel4utils_passive_server_fn)(void *cookie, seL4_Word badge, seL4_MessageInfo_t info);
+
+typedef struct sel4utils_passive_server {
+    sel4utils_thread_t *thread;
+    seL4_CPtr endpoint;
+    /* signalled by the server once it is waiting for its first request */
+    vka_object_t init;
+    sel4utils_passive_server_fn handler;
+    void *cookie;
+} sel4utils_passive_server_t;
+
+/**
+ * Start a configured thread as a passive server, which runs on the scheduling context donated
+ * by each client that calls endpoint rather than one of its own. The thread starts on its own
+ * scheduling context, waits on endpoint, and has it unbound once it is waiting, so init done
+ * by the caller before this must not need the server to run. Each request is given to handler,
+ * and what it returns is the reply.
+ *
+ * A reply object is allocated for the thread if it does not have one. On the non MCS kernel the
+ * thread keeps running on its own, serving requests in the same way.
+ *
+ * @param vka allocator for the reply object, and for a notification used while starting
+ * @param thread configured with sel4utils_configure_thread_config with a scheduling context,
+ *               must outlive the server
+ * @param endpoint the endpoint clients call
+ * @param handler called for each request, on the scheduling context of the client
+ * @param cookie passed to handler
+ * @param server the server data structure to populate, must outlive the thread
+ *
+ * @return 0 on success.
+ */
+int sel4utils_start_passive_server(vka_t *vka, sel4utils_thread_t *thread, seL4_CPtr endpoint,
+                                   sel4utils_passive_server_fn handler, void *cookie,
+                                   sel4utils_passive_server_t *server);
+
+/* Threads configured up front and kept idle between uses, so that running a short lived
+ * thread is a sel4utils_start_thread rather than a configure and clean up */
+typedef struct sel4utils_thread_pool {
+    size_t num_threads;
+    sel4utils_thread_t *threads;
+    /* stack of the threads not handed out */
+    size_t num_idle;
+    sel4utils_thread_t **idle;
+} sel4utils_thread_pool_t;
+
+/**
+ * Configure num_threads threads as per sel4utils_configure_thread_config, each with its
+ * stack and ipc buffer mapped, and keep them idle in a pool.
+ *
+ * The pool itself is not thread safe, all calls on it must be serialised by the caller.
+ *
+ * @param vka allocator for the threads
+ * @param parent vspace structure of the thread calling this function
+ * @param alloc vspace to allocate the stacks and ipc buffers in
+ * @param config configuration shared by every thread in the pool
+ * @param num_threads number of threads to create
+ * @param pool the pool to initialise
+ *
+ * @return 0 on success, -1 on failure, in which case nothing is left allocated.
+ */
+int sel4utils_thread_pool_create(vka_t *vka, vspace_t *parent, vspace_t *alloc, sel4utils_thread_config_t config,
+                                 size_t num_threads, sel4utils_thread_pool_t *pool);
+
+/**
+ * Take an idle thread from a pool. Start it with sel4utils_start_thread.
+ *
+ * @return an idle thread, or NULL if every thread is in use.
+ */
+sel4utils_thread_t *sel4utils_thread_pool_get(sel4utils_thread_pool_t *pool);
+
+/**
+ * Suspend a thread taken with sel4utils_thread_pool_get and return it to its pool. Must
+ * not be called by the thread itself, as it could be handed out again before it is suspended.
+ *
+ * @return 0 on success, -1 if the thread could not be suspended, in which case it is not returned.
+ */
+int sel4utils_thread_pool_put(sel4utils_thread_pool_t *pool, sel4utils_thread_t *thread);
+
+/**
+ * Clean up every thread in a pool, whether idle or not.
+ *
+ * @param vka the vka the pool was created with
+ * @param alloc the vspace the pool was created with
+ * @param pool the pool to destroy
+ */
+void sel4utils_thread_pool_destroy(vka_t *vka, vspace_t *alloc, sel4utils_thread_pool_t *pool);
+
 /**
  * Pretty print a fault message.
  *
@@ -17,6 +17,8 @@
 #include <simple/simple.h>
 #include <sel4utils/api.h>
 
+struct sel4utils_stack_pool;
+
 /* Threads and processes use this struct as both need scheduling config parameters */
 typedef struct sched_params {
     /* seL4 priority for the thread to be scheduled with. */
@@ -51,6 +53,9 @@ typedef struct sel4utils_thread_config {
     bool custom_stack_size;
     /* custom stack size in 4k pages for this thread */
     seL4_Word stack_size;
+    /* optional pool to take the stack from, only used if its vspace is the one the
+     * thread is allocated in */
+    struct sel4utils_stack_pool *stack_pool;
     /* true if this thread should have no ipc buffer */
     bool no_ipc_buffer;
     /* scheduling parameters */
@@ -154,6 +159,13 @@ static inline sel4utils_thread_config_t thread_config_stack_size(sel4utils_threa
     return config;
 }
 
+static inline sel4utils_thread_config_t thread_config_stack_pool(sel4utils_thread_config_t config,
+                                                                 struct sel4utils_stack_pool *pool)
+{
+    config.stack_pool = pool;
+    return config;
+}
+
 static inline sel4utils_thread_config_t thread_config_no_ipc_buffer(sel4utils_thread_config_t config)
 {
     config.no_ipc_buffer = true;
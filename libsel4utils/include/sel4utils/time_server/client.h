@@ -5,16 +5,66 @@
  */
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
 #include <platsupport/ltimer.h>
+#include <sel4utils/util.h>
 
 /* the timer op is set in mr0 */
 typedef enum rpc_timer_ops {
     /* get the time. Return error code in mr0, and time values in mr1, mr2 (only use mr2 on 32-bit) */
     GET_TIME = 1,
     /* set a timeout. mr1 is the timeout type, mr2 (+mr3 on 32bit) store the timeout value. */
-    SET_TIMEOUT = 2
+    SET_TIMEOUT = 2,
+    /* set or cancel a batch of timeouts. mr1 is the number of timeouts, mr2 is non zero to
+     * signal the client's completion notification once they are done, followed by an id,
+     * type (or SEL4UTILS_RPC_TIMEOUT_CANCEL) and value for each as for SET_TIMEOUT. Return
+     * error code in mr0 and the number of timeouts done in mr1 */
+    SET_TIMEOUTS = 3,
+    /* get the ids of the timeouts that have fired since the last call. Return error code in
+     * mr0 and a bitmap of the ids in mr1 */
+    GET_FIRED = 4
 } rpc_ltimer_ops_t;
 
+/* Number of timeouts each client can have at once, SET_TIMEOUT uses id 0 */
+#define SEL4UTILS_RPC_MAX_TIMEOUTS seL4_WordBits
+
+/* Type of a timeout in SET_TIMEOUTS that cancels it */
+#define SEL4UTILS_RPC_TIMEOUT_CANCEL ((seL4_Word) -1)
+
+#define SEL4UTILS_RPC_SET_TIMEOUTS_HEADER 3
+#define SEL4UTILS_RPC_SET_TIMEOUTS_WORDS (2 + SEL4UTILS_64_WORDS)
+/* Number of timeouts that fit in one SET_TIMEOUTS message */
+#define SEL4UTILS_RPC_SET_TIMEOUTS_MAX \
+    ((seL4_MsgMaxLength - SEL4UTILS_RPC_SET_TIMEOUTS_HEADER) / SEL4UTILS_RPC_SET_TIMEOUTS_WORDS)
+
+typedef struct sel4utils_rpc_timeout {
+    seL4_Word id;
+    /* a timeout_type_t, or SEL4UTILS_RPC_TIMEOUT_CANCEL */
+    seL4_Word type;
+    uint64_t ns;
+} sel4utils_rpc_timeout_t;
+
+/* timeouts are copied straight into and out of SET_TIMEOUTS messages */
+compile_time_assert(rpc_timeout_words, SEL4UTILS_MSG_WORDS(sel4utils_rpc_timeout_t) ==
+                    SEL4UTILS_RPC_SET_TIMEOUTS_WORDS);
+
+/* Page a time server can share read only with its clients so they can get the time without
+ * an rpc, which ns = base_ns + (((counter - base_cycles) * mult) >> shift) for counter read
+ * with sel4utils_read_counter. seq is odd while the server is updating the page, and mult
+ * is 0 if the page is not to be used. The wall clock time is the time plus realtime_offset_ns,
+ * which is 0 until the server is told the wall clock time. */
+typedef struct sel4utils_time_page {
+    uint32_t seq;
+    uint32_t mult;
+    uint32_t shift;
+    uint64_t base_ns;
+    uint64_t base_cycles;
+    uint64_t realtime_offset_ns;
+} sel4utils_time_page_t;
+
 /**
  * Initialise a client ltimer which calls via rpc to a server for
  * timer operations. This exists such that it is easy to swap out ltimer
@@ -36,3 +86,58 @@ typedef enum rpc_timer_ops {
 int sel4utils_rpc_ltimer_init(ltimer_t *ltimer, ps_io_ops_t ops,
                               seL4_CPtr ep, seL4_Word label);
 
+
+/**
+ * Have a client ltimer get the time from a page shared by the time server instead of by
+ * rpc, on platforms where user level can read a counter (SEL4UTILS_HAVE_USER_COUNTER).
+ *
+ * @param ltimer client ltimer initialised with sel4utils_rpc_ltimer_init
+ * @param time_page the page shared by the server, NULL to go back to using rpc
+ */
+void sel4utils_rpc_ltimer_set_time_page(ltimer_t *ltimer, sel4utils_time_page_t *time_page);
+
+/**
+ * Read the time from a page shared by the time server, without rpc.
+ *
+ * @param time_page the page shared by the server
+ * @param[out] time the time in ns
+ * @param[out] realtime_offset_ns what to add to time for the wall clock time, can be NULL
+ *
+ * @return true on success, false if the page is not in use or there is no counter user level
+ *         can read, in which case the time has to be got by rpc
+ */
+bool sel4utils_time_page_get_time(sel4utils_time_page_t *time_page, uint64_t *time, uint64_t *realtime_offset_ns);
+
+/**
+ * Set or cancel a batch of timeouts, each identified by an id below SEL4UTILS_RPC_MAX_TIMEOUTS.
+ * Timeouts are sent SEL4UTILS_RPC_SET_TIMEOUTS_MAX to a message. The client's notification
+ * is signalled when any of them fire, sel4utils_rpc_ltimer_get_fired says which.
+ *
+ * @param ltimer client ltimer initialised with sel4utils_rpc_ltimer_init
+ * @param num number of timeouts
+ * @param timeouts the timeouts to set or cancel
+ *
+ * @return 0 on success
+ */
+int sel4utils_rpc_ltimer_set_timeouts(ltimer_t *ltimer, size_t num, sel4utils_rpc_timeout_t *timeouts);
+
+/**
+ * As sel4utils_rpc_ltimer_set_timeouts, but without waiting for a reply. The server signals
+ * the client's completion notification once it has handled all of them, and errors are
+ * only logged by the server.
+ *
+ * @param ltimer client ltimer initialised with sel4utils_rpc_ltimer_init
+ * @param num number of timeouts
+ * @param timeouts the timeouts to set or cancel
+ */
+void sel4utils_rpc_ltimer_set_timeouts_async(ltimer_t *ltimer, size_t num, sel4utils_rpc_timeout_t *timeouts);
+
+/**
+ * Get, and forget, the ids of the timeouts that have fired.
+ *
+ * @param ltimer client ltimer initialised with sel4utils_rpc_ltimer_init
+ * @param[out] fired bitmap of the ids
+ *
+ * @return 0 on success
+ */
+int sel4utils_rpc_ltimer_get_fired(ltimer_t *ltimer, seL4_Word *fired);
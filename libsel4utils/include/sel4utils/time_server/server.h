@@ -0,0 +1,199 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* Server side of the time server protocol in client.h.
+ *
+ * Timeouts from any number of clients are kept in a hierarchical timing wheel and share a
+ * single ltimer. Each level of the wheel has SEL4UTILS_TIMER_WHEEL_SIZE slots, a slot of
+ * level n covering SEL4UTILS_TIMER_WHEEL_SIZE^n ticks, and a bitmap of which of its slots
+ * are in use. Setting and cancelling a timeout is constant time, and the next event is found
+ * with one bit scan per level. Timeouts are rounded up to a whole tick, and the hardware
+ * timeout is set up to slack ns late so that timeouts close together are handled with one
+ * interrupt. Timeouts beyond the range of the wheel wait in its last slot and are put back
+ * in when it is reached.
+ *
+ * The server does not wait for anything itself: the user receives client requests and
+ * timer interrupts however their component is structured, and hands them to
+ * sel4utils_time_server_handle_rpc and sel4utils_time_server_handle_timeout. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <platsupport/ltimer.h>
+#include <vspace/vspace.h>
+#include <sel4utils/time_server/client.h>
+
+#define SEL4UTILS_TIMER_WHEEL_BITS 6
+#define SEL4UTILS_TIMER_WHEEL_SIZE BIT(SEL4UTILS_TIMER_WHEEL_BITS)
+#define SEL4UTILS_TIMER_WHEEL_LEVELS 5
+
+typedef void (*sel4utils_timeout_fn_t)(void *data);
+
+/* A timeout, owned by the user and valid until it has been cancelled or has fired */
+typedef struct sel4utils_timeout {
+    /* ns the timeout is due at */
+    uint64_t deadline;
+    /* ns between timeouts, 0 if it only fires once */
+    uint64_t period;
+    /* tick the timeout is due at */
+    uint64_t expires;
+    sel4utils_timeout_fn_t fn;
+    void *data;
+    /* slot the timeout is in, pprev is NULL when it is not pending */
+    struct sel4utils_timeout *next;
+    struct sel4utils_timeout **pprev;
+    uint8_t level;
+    uint8_t slot;
+} sel4utils_timeout_t;
+
+typedef struct sel4utils_time_server {
+    ltimer_t *ltimer;
+    uint64_t tick_ns;
+    uint64_t slack_ns;
+    /* tick the wheel has been advanced to */
+    uint64_t now;
+    /* ns the hardware timeout is set for, UINT64_MAX if it is not set */
+    uint64_t programmed;
+    /* true while timeouts are being fired */
+    bool running;
+    uint64_t occupied[SEL4UTILS_TIMER_WHEEL_LEVELS];
+    sel4utils_timeout_t *slots[SEL4UTILS_TIMER_WHEEL_LEVELS][SEL4UTILS_TIMER_WHEEL_SIZE];
+    /* page exported with sel4utils_time_server_export_time, and the timeout that rebases it */
+    sel4utils_time_page_t *time_page;
+    sel4utils_timeout_t time_page_refresh;
+} sel4utils_time_server_t;
+
+struct sel4utils_time_server_client;
+
+typedef struct sel4utils_time_server_client_timeout {
+    sel4utils_timeout_t timeout;
+    struct sel4utils_time_server_client *client;
+} sel4utils_time_server_client_timeout_t;
+
+/* A client of the rpc protocol, which is signalled on its notification when its timeouts fire */
+typedef struct sel4utils_time_server_client {
+    sel4utils_time_server_client_timeout_t timeouts[SEL4UTILS_RPC_MAX_TIMEOUTS];
+    /* ids of the timeouts that fired since GET_FIRED */
+    seL4_Word fired;
+    seL4_CPtr notification;
+    seL4_CPtr completion;
+} sel4utils_time_server_client_t;
+
+/**
+ * Initialise a time server.
+ *
+ * @param server server to initialise
+ * @param ltimer timer to multiplex, which the server sets absolute timeouts on
+ * @param tick_ns resolution of the wheel in ns
+ * @param slack_ns how late in ns a timeout may fire, to handle more timeouts per interrupt
+ *
+ * @return 0 on success
+ */
+int sel4utils_time_server_init(sel4utils_time_server_t *server, ltimer_t *ltimer, uint64_t tick_ns,
+                               uint64_t slack_ns);
+
+/**
+ * Set a timeout, replacing it if it is already pending. fn is called from
+ * sel4utils_time_server_handle_timeout once it is due, or from this function if it is
+ * already due. fn may set and cancel timeouts.
+ *
+ * @param server server to set the timeout on
+ * @param timeout the timeout to set
+ * @param ns time, relative time or period of the timeout depending on type
+ * @param type type of the timeout, as for ltimer_set_timeout
+ * @param fn function to call when the timeout fires
+ * @param data passed to fn
+ *
+ * @return 0 on success
+ */
+int sel4utils_timeout_set(sel4utils_time_server_t *server, sel4utils_timeout_t *timeout, uint64_t ns,
+                          timeout_type_t type, sel4utils_timeout_fn_t fn, void *data);
+
+/**
+ * Cancel a timeout. Does nothing if it is not pending.
+ *
+ * @param server server the timeout was set on
+ * @param timeout the timeout to cancel
+ */
+void sel4utils_timeout_cancel(sel4utils_time_server_t *server, sel4utils_timeout_t *timeout);
+
+/**
+ * Fire every timeout that is due and set the hardware timeout for the next one. Call this
+ * whenever the ltimer's interrupt comes in, after the ltimer has handled it.
+ *
+ * @param server the server to update
+ *
+ * @return 0 on success
+ */
+int sel4utils_time_server_handle_timeout(sel4utils_time_server_t *server);
+
+/**
+ * Export the time in a page that clients can read without rpc, see
+ * sel4utils_rpc_ltimer_set_time_page. Clients convert the counter of
+ * sel4utils/arch/counter.h to time at the given frequency, from a base that is rebased
+ * against the ltimer every minute with a timeout on the server.
+ *
+ * @param server server to export the time of
+ * @param vspace vspace to allocate the page in
+ * @param freq frequency of the counter in Hz, such as from x86_get_tsc_freq_from_simple,
+ *             0 to use sel4utils_counter_freq, or if that isn't known to measure the
+ *             counter against the ltimer for 10ms
+ *
+ * @return 0 on success, -ENOSYS if there is no counter user level can read
+ */
+int sel4utils_time_server_export_time(sel4utils_time_server_t *server, vspace_t *vspace, uint64_t freq);
+
+/**
+ * Publish the wall clock time in the page exported with sel4utils_time_server_export_time,
+ * such as once it has been read from an RTC or the network.
+ *
+ * @param server server the time was exported from
+ * @param realtime_ns the wall clock time now, in ns since the epoch
+ *
+ * @return 0 on success
+ */
+int sel4utils_time_server_set_realtime(sel4utils_time_server_t *server, uint64_t realtime_ns);
+
+/**
+ * Share the page exported with sel4utils_time_server_export_time read only into a client's vspace.
+ *
+ * @param server server the time was exported from
+ * @param from vspace the page was allocated in
+ * @param to vspace of the client
+ *
+ * @return address of the page in to, NULL on failure.
+ */
+sel4utils_time_page_t *sel4utils_time_server_share_time(sel4utils_time_server_t *server, vspace_t *from,
+                                                        vspace_t *to);
+
+/**
+ * Initialise a client of the rpc protocol.
+ *
+ * @param client client to initialise
+ * @param notification notification to signal when the client's timeouts fire
+ * @param completion notification to signal when an asynchronous SET_TIMEOUTS is done, which
+ *                   can be the same notification badged differently. seL4_CapNull for none
+ */
+void sel4utils_time_server_client_init(sel4utils_time_server_client_t *client, seL4_CPtr notification,
+                                       seL4_CPtr completion);
+
+/**
+ * Handle a request made by a client with sel4utils_rpc_ltimer_init, which is in the
+ * message registers.
+ *
+ * @param server server to handle the request with
+ * @param client the client that sent it, as identified by the user (by its badge or label)
+ *
+ * @return the reply to send to the client, whose message registers have been set. Replying
+ *         to an asynchronous SET_TIMEOUTS, which was sent without seL4_Call, does nothing.
+ */
+seL4_MessageInfo_t sel4utils_time_server_handle_rpc(sel4utils_time_server_t *server,
+                                                    sel4utils_time_server_client_t *client);
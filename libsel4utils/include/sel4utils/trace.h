@@ -0,0 +1,117 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* Trace points for hot paths.
+ *
+ * SEL4_TRACE(name, arg) places a descriptor in the _trace_point section, the same way
+ * WATCH_VAR32 does in _profile_var, and when the trace point is enabled puts a
+ * (timestamp, trace point, arg) record on the buffer of the calling thread's core. Every
+ * trace point starts disabled, and costs a load and a predicted branch until enabled at run
+ * time. Like the other profiling tools, trace points compile down to nothing without
+ * LibSel4UtilsProfile.
+ *
+ * Each core has its own ring, so threads on different cores never share a cache line when
+ * tracing. Records are claimed with an atomic increment and marked complete with a sequence
+ * number, so threads on the same core preempting one another do not need a lock, and a
+ * reader skips records that are being written or have been overwritten. The timestamp is
+ * sel4utils_read_counter where there is a user level counter, otherwise 0, in which case
+ * records are only ordered within a core. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <utils/util.h>
+
+#define SEL4UTILS_TRACE_CACHE_LINE 64
+
+typedef struct sel4utils_tracepoint {
+    /* checked on every pass, so first */
+    volatile bool enabled;
+    const char *name;
+    const char *file;
+    int line;
+} sel4utils_tracepoint_t;
+
+typedef struct sel4utils_trace_record {
+    /* index of the record plus one once complete, 0 while being written */
+    volatile seL4_Word seq;
+    uint64_t timestamp;
+    sel4utils_tracepoint_t *tracepoint;
+    seL4_Word arg;
+} sel4utils_trace_record_t;
+
+typedef struct sel4utils_trace_buffer {
+    seL4_Word head __attribute__((aligned(SEL4UTILS_TRACE_CACHE_LINE)));
+    seL4_Word mask;
+    sel4utils_trace_record_t records[] __attribute__((aligned(SEL4UTILS_TRACE_CACHE_LINE)));
+} sel4utils_trace_buffer_t;
+
+/* Bytes of memory for a buffer of BIT(size_bits) records */
+#define SEL4UTILS_TRACE_BUFFER_SIZE(size_bits) \
+    (sizeof(sel4utils_trace_buffer_t) + BIT(size_bits) * sizeof(sel4utils_trace_record_t))
+
+typedef void (*sel4utils_trace_callback)(seL4_Word core, sel4utils_trace_record_t *record, void *cookie);
+
+/* Put a record on the calling thread's core's buffer, called by SEL4_TRACE */
+void sel4utils_trace_record(sel4utils_tracepoint_t *tracepoint, seL4_Word arg);
+
+#ifdef CONFIG_SEL4UTILS_PROFILE
+#define SEL4_TRACE(_name, _arg) do { \
+    static sel4utils_tracepoint_t _sel4utils_tracepoint \
+        __attribute__((used)) __attribute__((section("_trace_point"))) \
+        = {.enabled = false, .name = #_name, .file = __FILE__, .line = __LINE__}; \
+    if (unlikely(_sel4utils_tracepoint.enabled)) { \
+        sel4utils_trace_record(&_sel4utils_tracepoint, (seL4_Word) (_arg)); \
+    } \
+} while (0)
+#else
+#define SEL4_TRACE(_name, _arg) do { } while (0)
+#endif
+
+/**
+ * Give a core a buffer to trace into. Until it has one, trace points hit on the core are
+ * dropped.
+ *
+ * @param core core the buffer is for
+ * @param memory SEL4UTILS_TRACE_BUFFER_SIZE(size_bits) bytes, aligned to SEL4UTILS_TRACE_CACHE_LINE
+ * @param size_bits log2 of the number of records the buffer holds
+ *
+ * @return 0 on success.
+ */
+int sel4utils_trace_init_buffer(seL4_Word core, void *memory, size_t size_bits);
+
+/**
+ * Set the core the calling thread records on, which should be the core it is pinned to.
+ * Threads that never call this record on core 0. The same as profile_set_core.
+ */
+void sel4utils_trace_set_core(seL4_Word core);
+
+/**
+ * Enable or disable every trace point named name.
+ *
+ * @return the number of trace points changed
+ */
+int sel4utils_trace_enable(const char *name, bool enabled);
+
+/* Enable or disable every trace point */
+void sel4utils_trace_enable_all(bool enabled);
+
+/**
+ * Call back with every complete record held for a core, oldest first.
+ */
+void sel4utils_trace_read(seL4_Word core, sel4utils_trace_callback callback, void *cookie);
+
+/* Print the records of every core, one "<core> <timestamp> <name> <arg>" line each */
+void sel4utils_trace_dump(void);
+
+/* Discard the records of every core */
+void sel4utils_trace_reset(void);
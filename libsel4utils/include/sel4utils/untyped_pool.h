@@ -0,0 +1,49 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <vka/vka.h>
+#include <sel4/sel4.h>
+
+/* This is a delegating allocator that carves every object from untypeds it takes from
+ * the delegate, so that everything allocated through it can be deleted by revoking a few
+ * untypeds rather than one object at a time.
+ *
+ * Objects are placed one after the other in each untyped, as the kernel does. Freeing an
+ * object does not make its memory available again until every other object in the same
+ * untyped has been freed too. When an object does not fit in any untyped the pool has, the
+ * pool takes another from the delegate of at least the size it was initialised with.
+ *
+ * Cslots are allocated from the delegate. alloc_at is passed to the delegate, and the
+ * objects it returns are not deleted by sel4utils_untyped_pool_revoke.
+ */
+
+/**
+ * Initialise an untyped pool.
+ *
+ * @param pool_vka empty allocator to initialise
+ * @param delegate initialised allocator to take untypeds and cslots from
+ * @param size_bits size of the untypeds to take from the delegate
+ * @return 0 on success
+ */
+int sel4utils_untyped_pool_init(vka_t *pool_vka, vka_t *delegate, size_t size_bits);
+
+/**
+ * Delete every object allocated from the pool by revoking its untypeds. Afterwards freeing
+ * an object allocated from the pool only returns its cslot, the object itself is already
+ * gone, and the pool cannot allocate anything more.
+ *
+ * @param pool_vka allocator initialised with sel4utils_untyped_pool_init
+ */
+void sel4utils_untyped_pool_revoke(vka_t *pool_vka);
+
+/**
+ * Revoke the pool if it has not been already and return its untypeds to the delegate.
+ * The pool must not be used afterwards.
+ *
+ * @param pool_vka allocator initialised with sel4utils_untyped_pool_init
+ */
+void sel4utils_untyped_pool_destroy(vka_t *pool_vka);
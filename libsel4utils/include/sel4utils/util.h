@@ -8,7 +8,9 @@
 #include <autoconf.h>
 #include <sel4utils/gen_config.h>
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <utils/util.h>
 
@@ -53,3 +55,54 @@ static inline void sel4utils_64_set_mr(seL4_Word offset, uint64_t value)
     assert(sel4utils_64_get_mr(offset) == value);
 }
 
+/* Number of message registers an object of type takes, for working out the length of a
+ * message at compile time */
+#define SEL4UTILS_MSG_WORDS(type) DIV_ROUND_UP(sizeof(type), sizeof(seL4_Word))
+
+/*
+ * Copy bytes into the message registers starting at offset, in one go. The last word is
+ * padded with zeroes. The kernel stubs load the first seL4_FastMessageRegisters from the
+ * IPC buffer into registers themselves, so this works whichever of them the message spans.
+ *
+ * Values are laid out as they are in memory, so a uint64_t is put low word first on
+ * 32-bit, as with sel4utils_64_set_mr.
+ *
+ * @param offset first message register to set.
+ * @param src    data to copy.
+ * @param bytes  size of the data.
+ * @return the message register after the data, for the next value or the message length.
+ */
+static inline seL4_Word sel4utils_set_mrs(seL4_Word offset, const void *src, size_t bytes)
+{
+    seL4_Word words = DIV_ROUND_UP(bytes, sizeof(seL4_Word));
+    assert(offset + words <= seL4_MsgMaxLength);
+    seL4_Word *msg = &seL4_GetIPCBuffer()->msg[offset];
+
+    if (bytes % sizeof(seL4_Word) != 0) {
+        msg[words - 1] = 0;
+    }
+    memcpy(msg, src, bytes);
+    return offset + words;
+}
+
+/*
+ * Copy bytes out of the message registers starting at offset, the reverse of
+ * sel4utils_set_mrs.
+ *
+ * @param offset first message register to read.
+ * @param dest   to copy the data to.
+ * @param bytes  size of the data.
+ * @return the message register after the data.
+ */
+static inline seL4_Word sel4utils_get_mrs(seL4_Word offset, void *dest, size_t bytes)
+{
+    seL4_Word words = DIV_ROUND_UP(bytes, sizeof(seL4_Word));
+    assert(offset + words <= seL4_MsgMaxLength);
+
+    memcpy(dest, &seL4_GetIPCBuffer()->msg[offset], bytes);
+    return offset + words;
+}
+
+/* Set or get the object that ptr points to */
+#define SEL4UTILS_SET_MRS(offset, ptr) sel4utils_set_mrs((offset), (ptr), sizeof(*(ptr)))
+#define SEL4UTILS_GET_MRS(offset, ptr) sel4utils_get_mrs((offset), (ptr), sizeof(*(ptr)))
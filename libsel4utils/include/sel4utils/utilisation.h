@@ -0,0 +1,134 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* Cpu utilisation of a set of threads, and of the cores they run on, over windows of time.
+ *
+ * Needs a kernel built with CONFIG_BENCHMARK_TRACK_UTILISATION, which counts the cycles
+ * each tcb runs for and those the idle thread of each core runs for. A window is started
+ * by resetting the counts of the kernel and of every thread, and ended by finalising the
+ * log and reading the counts back from the IPC buffer. Windows can be ended by hand or on
+ * a period by the time server, with a callback to report each one.
+ *
+ * The length of a window is the kernel's count on the core that ends it. Cores are
+ * assumed to count cycles at the same rate, and a core only has an idle time if one of
+ * the threads is on it. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <sel4utils/thread.h>
+#include <sel4utils/process.h>
+#include <sel4utils/time_server/server.h>
+
+#define SEL4UTILS_UTILISATION_NO_IDLE UINT64_MAX
+
+typedef struct sel4utils_utilisation_thread {
+    seL4_CPtr tcb;
+    /* reported with the thread */
+    seL4_Word id;
+    /* core the thread has affinity with */
+    seL4_Word core;
+    /* cycles the thread ran for in the last window */
+    uint64_t cycles;
+} sel4utils_utilisation_thread_t;
+
+struct sel4utils_utilisation;
+
+/* Called with each window as it ends, from the time server when sampling periodically */
+typedef void (*sel4utils_utilisation_report_fn)(void *data, struct sel4utils_utilisation *utilisation);
+
+typedef struct sel4utils_utilisation {
+    sel4utils_utilisation_thread_t *threads;
+    size_t num_threads;
+    /* cycles the idle thread of each core ran for in the last window, NO_IDLE for cores
+     * with none of the threads on them */
+    uint64_t *core_idle;
+    size_t num_cores;
+    /* cycles in the last window, and windows ended so far */
+    uint64_t window_cycles;
+    size_t windows;
+    /* periodic sampling, see sel4utils_utilisation_start_periodic */
+    sel4utils_time_server_t *server;
+    sel4utils_timeout_t timeout;
+    sel4utils_utilisation_report_fn report_fn;
+    void *report_data;
+} sel4utils_utilisation_t;
+
+/**
+ * Initialise a utilisation tracker.
+ *
+ * @param utilisation tracker to initialise
+ * @param threads threads to track, with tcb, id and core set, which must stay valid while
+ *                the tracker is in use
+ * @param num_threads number of threads
+ * @param core_idle memory for the idle time of num_cores cores
+ * @param num_cores number of cores
+ *
+ * @return 0 on success, -1 if the kernel does not track utilisation.
+ */
+int sel4utils_utilisation_init(sel4utils_utilisation_t *utilisation, sel4utils_utilisation_thread_t *threads,
+                               size_t num_threads, uint64_t *core_idle, size_t num_cores);
+
+/* Fill in the tcb of a thread to track */
+static inline void sel4utils_utilisation_thread_init(sel4utils_utilisation_thread_t *thread,
+                                                     sel4utils_thread_t *from, seL4_Word id, seL4_Word core)
+{
+    thread->tcb = from->tcb.cptr;
+    thread->id = id;
+    thread->core = core;
+    thread->cycles = 0;
+}
+
+/* Fill in the tcb of the initial thread of a process to track */
+static inline void sel4utils_utilisation_process_init(sel4utils_utilisation_thread_t *thread,
+                                                      sel4utils_process_t *from, seL4_Word id, seL4_Word core)
+{
+    sel4utils_utilisation_thread_init(thread, &from->thread, id, core);
+}
+
+/* Start a window, resetting the counts of the kernel and of every thread */
+void sel4utils_utilisation_start(sel4utils_utilisation_t *utilisation);
+
+/**
+ * End the window, reading the cycles of every thread and the idle time of their cores,
+ * and start the next one.
+ */
+void sel4utils_utilisation_sample(sel4utils_utilisation_t *utilisation);
+
+/**
+ * Start a window now and end one every period_ns from the time server, calling report_fn
+ * with each.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_utilisation_start_periodic(sel4utils_utilisation_t *utilisation, sel4utils_time_server_t *server,
+                                         uint64_t period_ns, sel4utils_utilisation_report_fn report_fn,
+                                         void *report_data);
+
+/* Stop periodic sampling */
+void sel4utils_utilisation_stop_periodic(sel4utils_utilisation_t *utilisation);
+
+/* Percentage of the last window that cycles is, rounded down */
+static inline unsigned int sel4utils_utilisation_percent(sel4utils_utilisation_t *utilisation, uint64_t cycles)
+{
+    if (utilisation->window_cycles == 0) {
+        return 0;
+    }
+    return (cycles * 100) / utilisation->window_cycles;
+}
+
+/**
+ * Print the last window, as a line for each thread of its id, core, cycles and percentage,
+ * then a line for each core with a thread on it of its busy and idle percentages. Meant for
+ * a report_fn, so that threads hogging a core stand out.
+ */
+void sel4utils_utilisation_dump(sel4utils_utilisation_t *utilisation);
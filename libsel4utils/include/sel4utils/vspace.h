@@ -30,6 +30,7 @@
 #include <vspace/vspace.h>
 #include <vka/vka.h>
 #include <sel4utils/util.h>
+#include <sel4utils/profile.h>
 #include <sel4utils/arch/vspace.h>
 
 /* These definitions are only here so that you can take the size of them.
@@ -37,6 +38,8 @@
  */
 #define KERNEL_RESERVED_START (ALIGN_DOWN(seL4_UserTop, PAGE_SIZE_4K))
 #define VSPACE_LEVEL_SIZE BIT(VSPACE_LEVEL_BITS)
+/* number of recently used reservations find_reserve checks before the tree */
+#define SEL4UTILS_RES_MRU_SIZE 4
 
 typedef struct vspace_mid_level {
     /* there is a clear optimization that could be done where instead of always pointing to a
@@ -45,11 +48,63 @@ typedef struct vspace_mid_level {
     uintptr_t table[VSPACE_LEVEL_SIZE];
 } vspace_mid_level_t;
 
+#ifdef CONFIG_SEL4UTILS_INTERLEAVED_LEVELS
+/* An entry of a bottom level, kept together so that looking up both the cap and the
+ * cookie of a page touches one cache line */
+typedef struct vspace_bottom_entry {
+    seL4_CPtr cap;
+    uintptr_t cookie;
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+    /* physical address of the frame mapped at this entry, or 0 if it is not known */
+    uintptr_t paddr;
+    /* a power of 2 in size, so that no entry straddles a cache line */
+    uintptr_t unused;
+#endif
+} vspace_bottom_entry_t;
+
+typedef struct vspace_bottom_level {
+    vspace_bottom_entry_t entry[VSPACE_LEVEL_SIZE];
+} vspace_bottom_level_t;
+
+#define VSPACE_BOTTOM_CAP(level, i)    ((level)->entry[i].cap)
+#define VSPACE_BOTTOM_COOKIE(level, i) ((level)->entry[i].cookie)
+#define VSPACE_BOTTOM_PADDR(level, i)  ((level)->entry[i].paddr)
+#else
 typedef struct vspace_bottom_level {
     seL4_CPtr cap[VSPACE_LEVEL_SIZE];
     uintptr_t cookie[VSPACE_LEVEL_SIZE];
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+    /* physical address of the frame mapped at each entry, or 0 if it is not known */
+    uintptr_t paddr[VSPACE_LEVEL_SIZE];
+#endif
 } vspace_bottom_level_t;
 
+#define VSPACE_BOTTOM_CAP(level, i)    ((level)->cap[i])
+#define VSPACE_BOTTOM_COOKIE(level, i) ((level)->cookie[i])
+#define VSPACE_BOTTOM_PADDR(level, i)  ((level)->paddr[i])
+#endif /* CONFIG_SEL4UTILS_INTERLEAVED_LEVELS */
+
+/* levels are made of whole pages, so every entry is in the same place in a cache line */
+compile_time_assert(vspace_mid_level_pages, sizeof(vspace_mid_level_t) % PAGE_SIZE_4K == 0);
+compile_time_assert(vspace_bottom_level_pages, sizeof(vspace_bottom_level_t) % PAGE_SIZE_4K == 0);
+
+/* Number of entries a vspace_compact_level_t can hold before it is promoted */
+#define VSPACE_COMPACT_LEVEL_SIZE 31
+
+/* Sparse form of a bottom level. Only entries that differ from init are stored, sorted by
+ * index. Once it runs out of space it is replaced by a full vspace_bottom_level_t */
+typedef struct vspace_compact_level {
+    /* value of every entry not listed, or the next free level if this one is unused */
+    uintptr_t init;
+    uint16_t num;
+    uint16_t index[VSPACE_COMPACT_LEVEL_SIZE];
+    seL4_CPtr cap[VSPACE_COMPACT_LEVEL_SIZE];
+    uintptr_t cookie[VSPACE_COMPACT_LEVEL_SIZE];
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+    uintptr_t paddr[VSPACE_COMPACT_LEVEL_SIZE];
+#endif
+} vspace_compact_level_t;
+
 typedef int(*sel4utils_map_page_fn)(vspace_t *vspace, seL4_CPtr cap, void *vaddr, seL4_CapRights_t rights,
                                     int cacheable, size_t size_bits);
 
@@ -60,11 +115,37 @@ struct sel4utils_res {
     int cacheable;
     int malloced;
     bool rights_deferred;
-    struct sel4utils_res *next;
+    /* if non zero pages are not mapped until first touched, and then this many at a time.
+     * See sel4utils_reservation_set_lazy */
+    size_t lazy_cluster;
+    /* frames without a cookie are shared copy on write. See sel4utils_cow_clone_range */
+    bool cow;
+    /* links in the reservation tree of the owning vspace */
+    uint32_t priority;
+    struct sel4utils_res *left;
+    struct sel4utils_res *right;
 };
 
 typedef struct sel4utils_res sel4utils_res_t;
 
+/* A maximal free (neither reserved nor mapped) range of virtual address space.
+ * See src/vspace/free_range.c */
+struct sel4utils_free_range {
+    uintptr_t start;
+    uintptr_t end;
+    /* size of the largest range in the subtree rooted here */
+    uintptr_t largest;
+    uint32_t priority;
+    struct sel4utils_free_range *left;
+    struct sel4utils_free_range *right;
+};
+
+enum sel4utils_free_ranges_state {
+    SEL4UTILS_FREE_RANGES_UNBUILT = 0,
+    SEL4UTILS_FREE_RANGES_VALID,
+    SEL4UTILS_FREE_RANGES_DISABLED,
+};
+
 typedef struct sel4utils_alloc_data {
     seL4_CPtr vspace_root;
     vka_t *vka;
@@ -73,8 +154,24 @@ typedef struct sel4utils_alloc_data {
     uintptr_t last_allocated;
     vspace_t *bootstrap;
     sel4utils_map_page_fn map_page;
-    sel4utils_res_t *reservation_head;
+    /* all reservations, ordered by start address */
+    sel4utils_res_t *reservation_root;
+    /* most recently looked up reservations, most recent first */
+    sel4utils_res_t *reservation_mru[SEL4UTILS_RES_MRU_SIZE];
     bool is_empty;
+    /* index of free virtual ranges used by find_range */
+    struct sel4utils_free_range *free_ranges;
+    struct sel4utils_free_range *free_range_nodes;
+    size_t free_range_spare;
+    void *free_range_pages;
+    enum sel4utils_free_ranges_state free_ranges_state;
+    /* pages that compact bottom levels are carved from, and the unused levels in them */
+    void *compact_level_pages;
+    vspace_compact_level_t *compact_level_free;
+    /* set once the objects mapped into the vspace have been deleted all at once, by revoking
+     * what they were retyped from, so that unmapping needn't unmap each page. Caps are
+     * still deleted, as shared ones are not children of what was revoked */
+    bool objects_revoked;
 } sel4utils_alloc_data_t;
 
 static inline sel4utils_res_t *reservation_to_res(reservation_t res)
@@ -82,6 +179,101 @@ static inline sel4utils_res_t *reservation_to_res(reservation_t res)
     return (sel4utils_res_t *) res.res;
 }
 
+/* Lookups in the book keeping, shared by the implementation and by the inline
+ * vspace_get_cap and vspace_get_cookie of CONFIG_SEL4UTILS_STATIC_VSPACE */
+
+/* values of table entries that are neither caps nor pointers to the next level */
+#define SEL4UTILS_VSPACE_EMPTY    0
+#define SEL4UTILS_VSPACE_RESERVED UINTPTR_MAX
+
+/* Compact bottom levels are tagged in the low bit of the table entry pointing to them,
+ * full levels are page aligned so can never have it set */
+#define SEL4UTILS_COMPACT_LEVEL_TAG 1
+
+#define SEL4UTILS_VSPACE_INDEX(addr, l) (((addr) >> ((l) * VSPACE_LEVEL_BITS + PAGE_BITS_4K)) & MASK(VSPACE_LEVEL_BITS))
+
+static inline bool sel4utils_is_compact_level(uintptr_t table)
+{
+    return table != SEL4UTILS_VSPACE_RESERVED && (table & SEL4UTILS_COMPACT_LEVEL_TAG);
+}
+
+static inline vspace_compact_level_t *sel4utils_to_compact_level(uintptr_t table)
+{
+    return (vspace_compact_level_t *)(table & ~(uintptr_t)SEL4UTILS_COMPACT_LEVEL_TAG);
+}
+
+/* position of index in a compact level, or -(insertion point + 1) if it is not there */
+static inline int sel4utils_compact_level_find(vspace_compact_level_t *level, int index)
+{
+    int low = 0;
+    int high = level->num;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (level->index[mid] < index) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < level->num && level->index[low] == index) {
+        return low;
+    }
+    return -(low + 1);
+}
+
+static inline uintptr_t sel4utils_bottom_level_get_cap(uintptr_t table, int index)
+{
+    if (sel4utils_is_compact_level(table)) {
+        vspace_compact_level_t *level = sel4utils_to_compact_level(table);
+        int pos = sel4utils_compact_level_find(level, index);
+        return pos < 0 ? level->init : level->cap[pos];
+    }
+    return VSPACE_BOTTOM_CAP((vspace_bottom_level_t *)table, index);
+}
+
+static inline uintptr_t sel4utils_bottom_level_get_cookie(uintptr_t table, int index)
+{
+    if (sel4utils_is_compact_level(table)) {
+        vspace_compact_level_t *level = sel4utils_to_compact_level(table);
+        int pos = sel4utils_compact_level_find(level, index);
+        return pos < 0 ? 0 : level->cookie[pos];
+    }
+    return VSPACE_BOTTOM_COOKIE((vspace_bottom_level_t *)table, index);
+}
+
+/* the bottom level covering vaddr, or SEL4UTILS_VSPACE_EMPTY if there is none */
+static inline uintptr_t sel4utils_bottom_level_find(vspace_mid_level_t *top, uintptr_t vaddr)
+{
+    vspace_mid_level_t *level = top;
+    for (int i = VSPACE_NUM_LEVELS - 1; i > 1; i--) {
+        uintptr_t next = level->table[SEL4UTILS_VSPACE_INDEX(vaddr, i)];
+        if (next == SEL4UTILS_VSPACE_EMPTY || next == SEL4UTILS_VSPACE_RESERVED) {
+            return SEL4UTILS_VSPACE_EMPTY;
+        }
+        level = (vspace_mid_level_t *)next;
+    }
+    uintptr_t next = level->table[SEL4UTILS_VSPACE_INDEX(vaddr, 1)];
+    return next == SEL4UTILS_VSPACE_RESERVED ? SEL4UTILS_VSPACE_EMPTY : next;
+}
+
+static inline seL4_CPtr sel4utils_lookup_cap(vspace_mid_level_t *top, uintptr_t vaddr)
+{
+    uintptr_t table = sel4utils_bottom_level_find(top, vaddr);
+    if (table == SEL4UTILS_VSPACE_EMPTY) {
+        return 0;
+    }
+    return sel4utils_bottom_level_get_cap(table, SEL4UTILS_VSPACE_INDEX(vaddr, 0));
+}
+
+static inline uintptr_t sel4utils_lookup_cookie(vspace_mid_level_t *top, uintptr_t vaddr)
+{
+    uintptr_t table = sel4utils_bottom_level_find(top, vaddr);
+    if (table == SEL4UTILS_VSPACE_EMPTY) {
+        return 0;
+    }
+    return sel4utils_bottom_level_get_cookie(table, SEL4UTILS_VSPACE_INDEX(vaddr, 0));
+}
+
 /**
  * This is a mostly internal function for constructing a vspace. Allows a vspace to be created
  * with an arbitrary function to invoke for the mapping of pages. This is useful if you want
@@ -321,6 +513,214 @@ int sel4utils_reserve_range_at_no_alloc(vspace_t *vspace, sel4utils_res_t *reser
 int sel4utils_move_resize_reservation(vspace_t *vspace, reservation_t reservation, void *vaddr,
                                       size_t bytes);
 
+/**
+ * Make a reservation lazy. Rather than being mapped up front, frames are allocated and
+ * mapped by sel4utils_lazy_fault when the reservation is first touched. Each fault maps
+ * the naturally aligned cluster of cluster_pages 4K pages around the faulting address,
+ * skipping any that are already mapped.
+ *
+ * The reservation must not have deferred rights. Mapped pages must still be unmapped by
+ * the caller before the reservation is freed.
+ *
+ * @param vspace the virtual memory allocator the reservation belongs to.
+ * @param reservation the reservation to make lazy.
+ * @param cluster_pages number of pages to map per fault, must be a power of 2. 0 turns
+ *                      lazy mapping back off.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_reservation_set_lazy(vspace_t *vspace, reservation_t reservation, size_t cluster_pages);
+
+/**
+ * Handle a fault at vaddr by populating the lazy reservation covering it.
+ *
+ * This modifies the vspace, so must not run concurrently with anything else using it,
+ * sel4utils_start_lazy_fault_handler is the usual way to call it.
+ *
+ * @param vspace vspace the fault occurred in.
+ * @param vaddr faulting address.
+ *
+ * @return 0 if the fault was handled and the faulter can be resumed, -1 if vaddr is not
+ *         in a lazy reservation, is in a page that was already mapped, or a frame could
+ *         not be mapped.
+ */
+int sel4utils_lazy_fault(vspace_t *vspace, void *vaddr);
+
+/* Flags for sel4utils_populate */
+/* use the largest frames that are aligned and fit, rather than 4K ones */
+#define SEL4UTILS_POPULATE_LARGE_PAGES BIT(0)
+/* frames may come from device untypeds */
+#define SEL4UTILS_POPULATE_DEVICE      BIT(1)
+
+/* Most frames sel4utils_populate allocates cslots for at once */
+#define SEL4UTILS_POPULATE_BATCH 32
+
+/**
+ * Allocate and map frames for every page of a range that is reserved but not yet mapped,
+ * so that nothing in it will fault later, as MAP_POPULATE does. The range may be part of a
+ * lazy reservation. Runs of frames of the same size get their cslots from one allocation,
+ * and with SEL4UTILS_POPULATE_LARGE_PAGES frames are as large as alignment, the range and
+ * what is already mapped allow, falling back to smaller ones once the allocator runs out.
+ *
+ * Frames are mapped with the rights and cacheability of the reservation, and must be
+ * unmapped by the caller before the reservation is freed, for instance with
+ * sel4utils_unmap_range.
+ *
+ * @param vspace the virtual memory allocator to use.
+ * @param vaddr start of the range, rounded down to 4K.
+ * @param bytes size of the range, which must be within one reservation without deferred
+ *              rights.
+ * @param flags SEL4UTILS_POPULATE_* flags.
+ *
+ * @return 0 on success. On failure the pages mapped so far stay mapped.
+ */
+int sel4utils_populate(vspace_t *vspace, void *vaddr, size_t bytes, int flags);
+
+/**
+ * Change the rights a 4K page is mapped with, without unmapping it. The frame is mapped
+ * again at vaddr, either read only or with the rights of its reservation.
+ *
+ * @param vspace vspace the page is mapped in.
+ * @param vaddr the page, 4K aligned. Its reservation must not have deferred rights.
+ * @param read_only true to map the page read only, false to restore its rights.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_remap_page(vspace_t *vspace, void *vaddr, bool read_only);
+
+/**
+ * Unmap the frame of a 4K page from the page tables while keeping it in the book keeping,
+ * so that the next access to it faults. sel4utils_remap_page(vspace, vaddr, false) maps it
+ * again, and unmapping it as usual also works while it is hidden.
+ *
+ * @param vspace vspace the page is mapped in.
+ * @param vaddr the page, 4K aligned.
+ *
+ * @return 0 if the page was hidden, -1 if nothing is mapped there, 1 if a frame is mapped
+ *         but can't be hidden and restored: it is part of a larger frame, is shared copy
+ *         on write, or its reservation has deferred rights.
+ */
+int sel4utils_hide_page(vspace_t *vspace, void *vaddr);
+
+/**
+ * Look up the frame mapped at vaddr in the book keeping.
+ *
+ * @param vspace vspace to look in.
+ * @param vaddr any address in the frame.
+ * @param size_bits set to the size of the frame.
+ * @param private_write set to whether writing to the frame only changes memory of this
+ *                      vspace: its reservation has write rights, and it is not a copy on
+ *                      write frame still shared with the vspace it was cloned from.
+ *
+ * @return the cap of the frame, seL4_CapNull if nothing is mapped at vaddr.
+ */
+seL4_CPtr sel4utils_get_frame(vspace_t *vspace, void *vaddr, size_t *size_bits, bool *private_write);
+
+/* Progress of an incremental tear down, zero initialise before the first step */
+typedef struct sel4utils_tear_down_cursor {
+    /* lowest vaddr that may still have something to free */
+    uintptr_t next;
+    bool done;
+} sel4utils_tear_down_cursor_t;
+
+/**
+ * Do a bounded amount of the work of vspace_tear_down, so that destroying a large vspace
+ * does not have to happen all at once. Call repeatedly with the same cursor until it
+ * returns 0. The vspace must not be used for anything else once the first step is taken.
+ *
+ * @param vspace the vspace to tear down.
+ * @param vka allocator to free frames to, or VSPACE_FREE to use the one the vspace was
+ *            created with.
+ * @param cursor where to resume from.
+ * @param budget roughly the number of frames, book keeping levels and reservations to
+ *               free in this step.
+ *
+ * @return 0 once the tear down is complete, 1 if there is more to do, -1 on error.
+ */
+int sel4utils_tear_down_step(vspace_t *vspace, vka_t *vka, sel4utils_tear_down_cursor_t *cursor, size_t budget);
+
+/**
+ * Allocate and map enough frames to back bytes of memory, using the largest frame sizes the
+ * architecture supports that fit. The range is aligned for the largest such frame, and if a
+ * large frame cannot be allocated smaller ones are used in its place. Pages are mapped
+ * cacheable, as with vspace_new_pages.
+ *
+ * @param vspace the virtual memory allocator to use.
+ * @param rights the rights to map the frames with.
+ * @param bytes the size in bytes to back, rounded up to 4K.
+ * @param can_use_dev true if frames may come from device untypeds.
+ *
+ * @return the start of the mapped range, or NULL on failure.
+ */
+void *sel4utils_new_pages_best_fit(vspace_t *vspace, seL4_CapRights_t rights, size_t bytes, bool can_use_dev);
+
+/**
+ * Unmap everything in a range, working out the size of each frame from the book keeping.
+ * Use this to undo sel4utils_new_pages_best_fit, where the caller does not know which
+ * frame sizes were used.
+ *
+ * @param vspace the virtual memory allocator to use.
+ * @param vaddr start of the range.
+ * @param bytes size of the range in bytes.
+ * @param vka as for vspace_unmap_pages, VSPACE_FREE to free frames with the vspace's allocator
+ *            or NULL to leave them allocated.
+ */
+void sel4utils_unmap_range(vspace_t *vspace, void *vaddr, size_t bytes, vka_t *vka);
+
+/**
+ * Share a range of memory from one vspace into another, like vspace_share_mem_at_vaddr,
+ * but with every frame shared at the size it is mapped with in the source. This lets
+ * large pages in the source stay large pages in the destination, provided vaddr has
+ * the same alignment as start relative to those frames.
+ *
+ * @param from vspace to share memory from.
+ * @param to vspace to share memory into.
+ * @param start start of the range in from, 4K aligned.
+ * @param bytes size of the range in bytes, a multiple of 4K.
+ * @param vaddr where to map the range in to.
+ * @param reservation reservation in to covering the range.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_share_range_at_vaddr(vspace_t *from, vspace_t *to, void *start, size_t bytes, void *vaddr,
+                                   reservation_t reservation);
+
+/**
+ * Clone a range of memory from one vspace into the same addresses in another, copy on
+ * write. The frames of from are shared read only, and each is replaced by a private copy
+ * the first time it is written to, see sel4utils_cow_fault.
+ *
+ * Writes to the range in from are not caught, so from is best left as a template that
+ * does not run, such as a process that has been loaded but never started.
+ *
+ * @param from vspace to clone memory from.
+ * @param to vspace to clone memory into.
+ * @param start start of the range, 4K aligned.
+ * @param bytes size of the range in bytes, a multiple of 4K.
+ * @param reservation reservation in to covering the range. Private copies are mapped with
+ *                    its rights, which must not be deferred.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_cow_clone_range(vspace_t *from, vspace_t *to, void *start, size_t bytes, reservation_t reservation);
+
+/**
+ * Handle a write fault at vaddr in memory cloned with sel4utils_cow_clone_range, by
+ * copying the frame at vaddr and mapping the copy in its place with the rights of its
+ * reservation.
+ *
+ * This modifies vspace, so must not run concurrently with anything else using it,
+ * sel4utils_start_lazy_fault_handler is the usual way to call it.
+ *
+ * @param current vspace to map the frames being copied into, must be the caller's.
+ * @param vspace vspace the fault occurred in.
+ * @param vaddr faulting address.
+ *
+ * @return 0 if the fault was handled and the faulter can be resumed, -1 if vaddr is not
+ *         a shared frame in a copy on write reservation, or it could not be copied.
+ */
+int sel4utils_cow_fault(vspace_t *current, vspace_t *vspace, void *vaddr);
+
 /*
  * Copy the code and data segment (the image effectively) from current vspace
  * into clone vspace. The clone vspace should be initialised.
@@ -341,9 +741,64 @@ int sel4utils_bootstrap_clone_into_vspace(vspace_t *current, vspace_t *clone, re
 void sel4utils_get_image_region(uintptr_t *va_start, uintptr_t *va_end);
 
 /**
+ * If CONFIG_SEL4UTILS_PADDR_CACHE is set the physical address of frames allocated by this
+ * vspace is recorded when they are mapped, and is returned without asking the vka.
  *
- * @return the physical address that vaddr is mapped to.
+ * @return the physical address of the frame that vaddr is mapped to.
  *         VKA_NO_PADDR if there is no mapping
  */
 uintptr_t sel4utils_get_paddr(vspace_t *vspace, void *vaddr, seL4_Word type, seL4_Word size_bits);
 
+
+/* Snapshot of a vspace and its book keeping, see sel4utils_vspace_get_stats */
+typedef struct sel4utils_vspace_stats {
+    /* reservations, and the bytes of virtual address space they cover */
+    size_t reservations;
+    uint64_t reserved_bytes;
+    /* bytes of address space with a frame mapped */
+    uint64_t mapped_bytes;
+    /* book keeping tables of each kind, the top level counts as a mid level */
+    size_t mid_levels;
+    size_t bottom_levels;
+    size_t compact_levels;
+    /* bytes of memory used for the tables, the free range index and malloced reservations */
+    size_t bookkeeping_bytes;
+    /* ranges in the free range index and the size of the largest, both 0 if the index
+     * is not being used */
+    size_t free_ranges;
+    uintptr_t largest_free_range;
+} sel4utils_vspace_stats_t;
+
+/**
+ * Take a snapshot of a vspace. Walks every reservation and book keeping table, so is
+ * not something to do on a fast path, and must not run concurrently with anything
+ * else using the vspace.
+ *
+ * @param vspace vspace to take a snapshot of.
+ * @param stats structure to fill out.
+ */
+void sel4utils_vspace_get_stats(vspace_t *vspace, sel4utils_vspace_stats_t *stats);
+
+/**
+ * Report a snapshot from sel4utils_vspace_get_stats one value at a time. Matches the
+ * scrape function of a profile_source_t, so a vspace can be registered with
+ * profile_register_source to be reported by profile_scrape.
+ *
+ * @param vspace the vspace_t to report on.
+ * @param callback64 called with each value, its name and a description.
+ * @param cookie passed to callback64.
+ */
+void sel4utils_vspace_stats_scrape(void *vspace, profile_callback64 callback64, void *cookie);
+
+#ifdef CONFIG_SEL4UTILS_STATIC_VSPACE
+/* the fast paths of vspace_get_cap and vspace_get_cookie, see vspace/vspace.h */
+static inline seL4_CPtr sel4utils_vspace_get_cap(vspace_t *vspace, void *vaddr)
+{
+    return sel4utils_lookup_cap(((sel4utils_alloc_data_t *) vspace->data)->top_level, (uintptr_t) vaddr);
+}
+
+static inline uintptr_t sel4utils_vspace_get_cookie(vspace_t *vspace, void *vaddr)
+{
+    return sel4utils_lookup_cookie(((sel4utils_alloc_data_t *) vspace->data)->top_level, (uintptr_t) vaddr);
+}
+#endif /* CONFIG_SEL4UTILS_STATIC_VSPACE */
@@ -15,13 +15,13 @@
 #include <sel4utils/mapping.h>
 #include <sel4utils/vspace.h>
 
-#define RESERVED UINTPTR_MAX
-#define EMPTY    0
+#define RESERVED SEL4UTILS_VSPACE_RESERVED
+#define EMPTY    SEL4UTILS_VSPACE_EMPTY
 
 #define TOP_LEVEL_BITS_OFFSET (VSPACE_LEVEL_BITS * (VSPACE_NUM_LEVELS - 1) + PAGE_BITS_4K)
 #define LEVEL_MASK MASK_UNSAFE(VSPACE_LEVEL_BITS)
 
-#define INDEX_FOR_LEVEL(addr, l) ( ( (addr) >> ((l) * VSPACE_LEVEL_BITS + PAGE_BITS_4K)) & MASK(VSPACE_LEVEL_BITS))
+#define INDEX_FOR_LEVEL(addr, l) SEL4UTILS_VSPACE_INDEX(addr, l)
 #define TOP_LEVEL_INDEX(x) INDEX_FOR_LEVEL(x, VSPACE_NUM_LEVELS - 1)
 
 #define BYTES_FOR_LEVEL(l) BIT(VSPACE_LEVEL_BITS * (l) + PAGE_BITS_4K)
@@ -30,6 +30,23 @@
 void *create_level(vspace_t *vspace, size_t size);
 void *bootstrap_create_level(vspace_t *vspace, size_t size);
 
+/* Keep the free range index in step with the book keeping tables. Marking a range
+ * used is always safe, the index only ever hands out ranges the tables agree are free */
+void free_range_mark_used(vspace_t *vspace, uintptr_t start, uintptr_t end);
+void free_range_mark_free(vspace_t *vspace, uintptr_t start, uintptr_t end);
+/* Find the lowest addressed free range of size bytes aligned to align_bits, at or above from.
+ * Returns 0 with *result set to the range, or to 0 if there is no such range, and -1 if
+ * the index is not available and the caller should search the tables itself */
+int free_range_find(vspace_t *vspace, uintptr_t from, size_t size, size_t align_bits, uintptr_t *result);
+void free_range_destroy(vspace_t *vspace);
+/* Number of ranges in the index, and the size of the largest, 0 if it is not valid */
+void free_range_stats(vspace_t *vspace, size_t *count, uintptr_t *largest);
+
+static inline sel4utils_alloc_data_t *get_alloc_data(vspace_t *vspace)
+{
+    return (sel4utils_alloc_data_t *) vspace->data;
+}
+
 static inline void *create_mid_level(vspace_t *vspace, uintptr_t init)
 {
     vspace_mid_level_t *level = create_level(vspace, sizeof(vspace_mid_level_t));
@@ -41,29 +58,86 @@ static inline void *create_mid_level(vspace_t *vspace, uintptr_t init)
     return level;
 }
 
+#define COMPACT_LEVEL_TAG SEL4UTILS_COMPACT_LEVEL_TAG
+
+static inline bool is_compact_level(uintptr_t table)
+{
+    return sel4utils_is_compact_level(table);
+}
+
+static inline vspace_compact_level_t *to_compact_level(uintptr_t table)
+{
+    return sel4utils_to_compact_level(table);
+}
+
+/* see compact_level.c */
+vspace_compact_level_t *compact_level_alloc(vspace_t *vspace);
+void compact_level_free(vspace_t *vspace, vspace_compact_level_t *level);
+void compact_level_destroy(vspace_t *vspace);
+int bottom_level_set(vspace_t *vspace, uintptr_t *table, int index, uintptr_t cap, uintptr_t cookie);
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+void bottom_level_set_paddr(uintptr_t table, int index, uintptr_t paddr);
+#endif
+
 static inline void *create_bottom_level(vspace_t *vspace, uintptr_t init)
 {
+    /* The self bootstrapped vspace reserved exactly enough room for full levels when it
+     * was created, so only start with compact levels if there is a bootstrapper to
+     * allocate from */
+    if (get_alloc_data(vspace)->bootstrap != NULL) {
+        vspace_compact_level_t *compact = compact_level_alloc(vspace);
+        if (compact) {
+            compact->init = init;
+            compact->num = 0;
+            return (void *)((uintptr_t)compact | COMPACT_LEVEL_TAG);
+        }
+    }
     vspace_bottom_level_t *level = create_level(vspace, sizeof(vspace_bottom_level_t));
     if (level) {
         for (int i = 0; i < VSPACE_LEVEL_SIZE; i++) {
-            level->cap[i] = init;
-            level->cookie[i] = 0;
+            VSPACE_BOTTOM_CAP(level, i) = init;
+            VSPACE_BOTTOM_COOKIE(level, i) = 0;
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+            VSPACE_BOTTOM_PADDR(level, i) = 0;
+#endif
         }
     }
     return level;
 }
 
-static inline sel4utils_alloc_data_t *get_alloc_data(vspace_t *vspace)
+static inline int compact_level_find(vspace_compact_level_t *level, int index)
 {
-    return (sel4utils_alloc_data_t *) vspace->data;
+    return sel4utils_compact_level_find(level, index);
+}
+
+static inline uintptr_t bottom_level_get_cap(uintptr_t table, int index)
+{
+    return sel4utils_bottom_level_get_cap(table, index);
+}
+
+static inline uintptr_t bottom_level_get_cookie(uintptr_t table, int index)
+{
+    return sel4utils_bottom_level_get_cookie(table, index);
+}
+
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+static inline uintptr_t bottom_level_get_paddr(uintptr_t table, int index)
+{
+    if (is_compact_level(table)) {
+        vspace_compact_level_t *level = to_compact_level(table);
+        int pos = compact_level_find(level, index);
+        return pos < 0 ? 0 : level->paddr[pos];
+    }
+    return VSPACE_BOTTOM_PADDR((vspace_bottom_level_t *)table, index);
 }
+#endif /* CONFIG_SEL4UTILS_PADDR_CACHE */
 
-static int reserve_entries_bottom(vspace_t *vspace, vspace_bottom_level_t *level, uintptr_t start, uintptr_t end,
+static int reserve_entries_bottom(vspace_t *vspace, uintptr_t *table, uintptr_t start, uintptr_t end,
                                   bool preserve_frames)
 {
     while (start < end) {
         int index = INDEX_FOR_LEVEL(start, 0);
-        uintptr_t cap = level->cap[index];
+        uintptr_t cap = bottom_level_get_cap(*table, index);
         if (cap == RESERVED) {
             ZF_LOGE("Attempting to reserve already reserved region");
             return -1;
@@ -71,8 +145,9 @@ static int reserve_entries_bottom(vspace_t *vspace, vspace_bottom_level_t *level
         if (cap != EMPTY && preserve_frames) {
             return -1;
         }
-        level->cap[index] = RESERVED;
-        level->cookie[index] = 0;
+        if (bottom_level_set(vspace, table, index, RESERVED, 0)) {
+            return -1;
+        }
         start += BYTES_FOR_LEVEL(0);
     }
     return 0;
@@ -121,7 +196,7 @@ static int reserve_entries_mid(vspace_t *vspace, vspace_mid_level_t *level, int
         if (next_table != RESERVED) {
             int error;
             if (level_num == 1) {
-                error = reserve_entries_bottom(vspace, (vspace_bottom_level_t *)next_table, start, next_start, preserve_frames);
+                error = reserve_entries_bottom(vspace, &level->table[index], start, next_start, preserve_frames);
             } else {
                 error = reserve_entries_mid(vspace, (vspace_mid_level_t *)next_table, level_num - 1, start, next_start,
                                             preserve_frames);
@@ -135,17 +210,18 @@ static int reserve_entries_mid(vspace_t *vspace, vspace_mid_level_t *level, int
     return 0;
 }
 
-static int clear_entries_bottom(vspace_t *vspace, vspace_bottom_level_t *level, uintptr_t start, uintptr_t end,
+static int clear_entries_bottom(vspace_t *vspace, uintptr_t *table, uintptr_t start, uintptr_t end,
                                 bool only_reserved)
 {
     while (start < end) {
         int index = INDEX_FOR_LEVEL(start, 0);
-        uintptr_t cap = level->cap[index];
+        uintptr_t cap = bottom_level_get_cap(*table, index);
         if (cap != RESERVED && only_reserved) {
             return -1;
         }
-        level->cap[index] = EMPTY;
-        level->cookie[index] = 0;
+        if (bottom_level_set(vspace, table, index, EMPTY, 0)) {
+            return -1;
+        }
         start += BYTES_FOR_LEVEL(0);
     }
     return 0;
@@ -172,7 +248,7 @@ static int clear_entries_mid(vspace_t *vspace, vspace_mid_level_t *level, int le
         if (next_table != EMPTY) {
             int error;
             if (level_num == 1) {
-                error = clear_entries_bottom(vspace, (vspace_bottom_level_t *)next_table, start, next_start, only_reserved);
+                error = clear_entries_bottom(vspace, &level->table[index], start, next_start, only_reserved);
             } else {
                 error = clear_entries_mid(vspace, (vspace_mid_level_t *)next_table, level_num - 1, start, next_start, only_reserved);
             }
@@ -185,18 +261,19 @@ static int clear_entries_mid(vspace_t *vspace, vspace_mid_level_t *level, int le
     return 0;
 }
 
-static int update_entries_bottom(vspace_t *vspace, vspace_bottom_level_t *level, uintptr_t start, uintptr_t end,
+static int update_entries_bottom(vspace_t *vspace, uintptr_t *table, uintptr_t start, uintptr_t end,
                                  seL4_CPtr cap, uintptr_t cookie)
 {
     while (start < end) {
         int index = INDEX_FOR_LEVEL(start, 0);
-        uintptr_t old_cap = level->cap[index];
+        uintptr_t old_cap = bottom_level_get_cap(*table, index);
         if (old_cap != RESERVED && old_cap != EMPTY) {
             ZF_LOGE("Mapping neither reserved nor empty for vaddr %" PRIxPTR " (contains 0x%" PRIxPTR ")", start, old_cap);
             return -1;
         }
-        level->cap[index] = cap;
-        level->cookie[index] = cookie;
+        if (bottom_level_set(vspace, table, index, cap, cookie)) {
+            return -1;
+        }
         start += BYTES_FOR_LEVEL(0);
     }
     return 0;
@@ -231,7 +308,7 @@ static int update_entries_mid(vspace_t *vspace, vspace_mid_level_t *level, int l
         }
         int error;
         if (level_num == 1) {
-            error = update_entries_bottom(vspace, (vspace_bottom_level_t *)next_table, start, next_start, cap, cookie);
+            error = update_entries_bottom(vspace, &level->table[index], start, next_start, cap, cookie);
         } else {
             error = update_entries_mid(vspace, (vspace_mid_level_t *)next_table, level_num - 1, start, next_start, cap, cookie);
         }
@@ -243,12 +320,12 @@ static int update_entries_mid(vspace_t *vspace, vspace_mid_level_t *level, int l
     return 0;
 }
 
-static bool is_reserved_or_empty_bottom(vspace_bottom_level_t *level, uintptr_t start, uintptr_t end, uintptr_t good,
+static bool is_reserved_or_empty_bottom(uintptr_t table, uintptr_t start, uintptr_t end, uintptr_t good,
                                         uintptr_t bad)
 {
     while (start < end) {
         int index = INDEX_FOR_LEVEL(start, 0);
-        uintptr_t cap = level->cap[index];
+        uintptr_t cap = bottom_level_get_cap(table, index);
         if (cap != good) {
             return false;
         }
@@ -277,7 +354,7 @@ static bool is_reserved_or_empty_mid(vspace_mid_level_t *level, int level_num, u
         if (next_table != good) {
             int succ;
             if (level_num == 1) {
-                succ = is_reserved_or_empty_bottom((vspace_bottom_level_t *)next_table, start, next_start, good, bad);
+                succ = is_reserved_or_empty_bottom(next_table, start, next_start, good, bad);
             } else {
                 succ = is_reserved_or_empty_mid((vspace_mid_level_t *)next_table, level_num - 1, start, next_start, good, bad);
             }
@@ -296,13 +373,18 @@ static inline int update_entries(vspace_t *vspace, uintptr_t vaddr, seL4_CPtr ca
     uintptr_t start = vaddr;
     uintptr_t end = vaddr + BIT(size_bits);
     sel4utils_alloc_data_t *data = get_alloc_data(vspace);
-    return update_entries_mid(vspace, data->top_level, VSPACE_NUM_LEVELS - 1, start, end, cap, cookie);
+    int error = update_entries_mid(vspace, data->top_level, VSPACE_NUM_LEVELS - 1, start, end, cap, cookie);
+    /* even on failure part of the range may now be in use */
+    free_range_mark_used(vspace, start, end);
+    return error;
 }
 
 static inline int reserve_entries_range(vspace_t *vspace, uintptr_t start, uintptr_t end, bool preserve_frames)
 {
     sel4utils_alloc_data_t *data = get_alloc_data(vspace);
-    return reserve_entries_mid(vspace, data->top_level, VSPACE_NUM_LEVELS - 1, start, end, preserve_frames);
+    int error = reserve_entries_mid(vspace, data->top_level, VSPACE_NUM_LEVELS - 1, start, end, preserve_frames);
+    free_range_mark_used(vspace, start, end);
+    return error;
 }
 
 static inline int reserve_entries(vspace_t *vspace, uintptr_t vaddr, size_t size_bits)
@@ -319,6 +401,7 @@ static inline int clear_entries_range(vspace_t *vspace, uintptr_t start, uintptr
     if (error) {
         return error;
     }
+    free_range_mark_free(vspace, start, end);
 
     if (start < data->last_allocated) {
         data->last_allocated = start;
@@ -370,40 +453,12 @@ static inline bool is_reserved(vspace_mid_level_t *top_level, uintptr_t vaddr, s
 
 static inline seL4_CPtr get_cap(vspace_mid_level_t *top, uintptr_t vaddr)
 {
-    vspace_mid_level_t *level = top;
-    for (int i = VSPACE_NUM_LEVELS - 1; i > 1; i--) {
-        int index = INDEX_FOR_LEVEL(vaddr, i);
-        uintptr_t next = level->table[index];
-        if (next == EMPTY || next == RESERVED) {
-            return 0;
-        }
-        level = (vspace_mid_level_t *)next;
-    }
-    uintptr_t next = level->table[INDEX_FOR_LEVEL(vaddr, 1)];
-    if (next == EMPTY || next == RESERVED) {
-        return 0;
-    }
-    vspace_bottom_level_t *bottom = (vspace_bottom_level_t *)next;
-    return bottom->cap[INDEX_FOR_LEVEL(vaddr, 0)];
+    return sel4utils_lookup_cap(top, vaddr);
 }
 
 static inline uintptr_t get_cookie(vspace_mid_level_t *top, uintptr_t vaddr)
 {
-    vspace_mid_level_t *level = top;
-    for (int i = VSPACE_NUM_LEVELS - 1; i > 1; i--) {
-        int index = INDEX_FOR_LEVEL(vaddr, i);
-        uintptr_t next = level->table[index];
-        if (next == EMPTY || next == RESERVED) {
-            return 0;
-        }
-        level = (vspace_mid_level_t *)next;
-    }
-    uintptr_t next = level->table[INDEX_FOR_LEVEL(vaddr, 1)];
-    if (next == EMPTY || next == RESERVED) {
-        return 0;
-    }
-    vspace_bottom_level_t *bottom = (vspace_bottom_level_t *)next;
-    return bottom->cookie[INDEX_FOR_LEVEL(vaddr, 0)];
+    return sel4utils_lookup_cookie(top, vaddr);
 }
 
 /* Internal interface functions */
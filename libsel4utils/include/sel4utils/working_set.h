@@ -0,0 +1,167 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+/* Working set estimation of a vspace by sampling which of its pages are accessed.
+ *
+ * The estimate is made over windows of time. At the start of a window a random sample of
+ * the 4K pages in a set of ranges is hidden with sel4utils_hide_page, so that the next
+ * access to each faults. The fault is handed to sel4utils_working_set_fault, usually as a
+ * callback of the fault service, which maps the page again and counts it as touched. At the
+ * end of the window the pages that were touched, against those sampled, give the fraction
+ * of the resident pages that are in the working set, and the pages that were not are passed
+ * to an idle callback, such as a reclaim hook. Windows can be ended by hand or on a period
+ * by the time server, with a callback to report each one.
+ *
+ * The fraction of sample attempts that land on a mapped page estimates how many pages are
+ * resident. Pages of large frames, of shared copy on write frames and of reservations with
+ * deferred rights are resident but can't be sampled, and are assumed to be accessed like
+ * the rest. Pages tracked by an incremental checkpoint must not be in the ranges, as
+ * mapping them again would lose their read only rights.
+ *
+ * Faults on hidden pages are handled by another thread, so that thread's stack and code,
+ * the estimator, its ranges and its pages must not be in the ranges. The estimator checks
+ * the last three itself. The thread starting and ending windows may touch the pages it
+ * hides, as they are hidden without holding the lock that faults take, but windows must
+ * only be started and ended from one thread at a time, which is the time server's when
+ * sampling periodically. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vspace/vspace.h>
+#include <sel4utils/fault_service.h>
+#include <sel4utils/time_server/server.h>
+
+typedef struct sel4utils_working_set_range {
+    uintptr_t start;
+    uintptr_t end;
+} sel4utils_working_set_range_t;
+
+typedef struct sel4utils_working_set_page {
+    uintptr_t vaddr;
+    /* accessed since the window started */
+    bool touched;
+} sel4utils_working_set_page_t;
+
+struct sel4utils_working_set;
+
+/* Called at the end of a window for each sampled page that was not touched in it, after it
+ * has been mapped again */
+typedef void (*sel4utils_working_set_idle_fn)(void *data, vspace_t *vspace, void *vaddr);
+
+/* Called with each window as it ends, from the time server when sampling periodically */
+typedef void (*sel4utils_working_set_report_fn)(void *data, struct sel4utils_working_set *ws);
+
+typedef struct sel4utils_working_set {
+    vspace_t *vspace;
+    const sel4utils_working_set_range_t *ranges;
+    size_t num_ranges;
+    /* 4K pages in all the ranges */
+    size_t total_pages;
+    /* the pages sampled in the current window, sorted by vaddr */
+    sel4utils_working_set_page_t *pages;
+    size_t max_pages;
+    size_t num_pages;
+    /* sample attempts in the current window, and how many of them found a mapped page */
+    size_t attempts;
+    size_t resident_hits;
+    uint64_t random;
+    /* serialises the faults with the start and end of windows */
+    int lock;
+    /* estimates from the last window, and windows ended so far */
+    size_t resident_pages;
+    size_t working_set_pages;
+    size_t idle_pages;
+    size_t windows;
+    sel4utils_working_set_idle_fn idle_fn;
+    void *idle_data;
+    /* periodic sampling, see sel4utils_working_set_start_periodic */
+    sel4utils_time_server_t *server;
+    sel4utils_timeout_t timeout;
+    sel4utils_working_set_report_fn report_fn;
+    void *report_data;
+} sel4utils_working_set_t;
+
+/**
+ * Initialise a working set estimator, with no window started.
+ *
+ * @param ws estimator to initialise
+ * @param vspace vspace the ranges are in
+ * @param ranges ranges to estimate the working set of, 4K aligned, which must stay valid
+ *               while the estimator is in use
+ * @param num_ranges number of ranges
+ * @param pages memory for the sample of each window
+ * @param max_pages most pages to sample in a window
+ * @param seed seed for choosing the samples
+ *
+ * @return 0 on success, -1 if the arguments are invalid or the estimator, the ranges or the
+ *         pages are in the ranges.
+ */
+int sel4utils_working_set_init(sel4utils_working_set_t *ws, vspace_t *vspace,
+                               const sel4utils_working_set_range_t *ranges, size_t num_ranges,
+                               sel4utils_working_set_page_t *pages, size_t max_pages, uint64_t seed);
+
+/* Call idle_fn with the idle pages of each window */
+static inline void sel4utils_working_set_set_idle_fn(sel4utils_working_set_t *ws, sel4utils_working_set_idle_fn idle_fn,
+                                                     void *idle_data)
+{
+    ws->idle_fn = idle_fn;
+    ws->idle_data = idle_data;
+}
+
+/**
+ * Start a window by hiding a new sample of pages. A window in progress is ended first,
+ * updating the estimates and mapping its sampled pages again.
+ */
+void sel4utils_working_set_start(sel4utils_working_set_t *ws);
+
+/* End the window without starting another, mapping the sampled pages again */
+void sel4utils_working_set_stop(sel4utils_working_set_t *ws);
+
+/**
+ * Handle a fault at vaddr if it is in a page hidden by the estimator, by mapping the page
+ * again. May be called from another thread than the one sampling.
+ *
+ * @return 0 if the fault was handled and the faulter can be resumed, -1 if vaddr is not a
+ *         hidden page.
+ */
+int sel4utils_working_set_fault(sel4utils_working_set_t *ws, void *vaddr);
+
+/* A sel4utils_fault_fn that calls sel4utils_working_set_fault, cookie is the estimator */
+sel4utils_fault_result_t sel4utils_working_set_fault_fn(void *cookie, sel4utils_fault_t *fault);
+
+/**
+ * Start a window now and end one every period_ns from the time server, calling report_fn
+ * with each.
+ *
+ * @return 0 on success.
+ */
+int sel4utils_working_set_start_periodic(sel4utils_working_set_t *ws, sel4utils_time_server_t *server,
+                                         uint64_t period_ns, sel4utils_working_set_report_fn report_fn,
+                                         void *report_data);
+
+/* Stop periodic sampling, and end the window in progress */
+void sel4utils_working_set_stop_periodic(sel4utils_working_set_t *ws);
+
+/* Estimated bytes in the working set in the last window */
+static inline size_t sel4utils_working_set_bytes(sel4utils_working_set_t *ws)
+{
+    return ws->working_set_pages * PAGE_SIZE_4K;
+}
+
+/* Estimated bytes resident but not accessed in the last window */
+static inline size_t sel4utils_working_set_idle_bytes(sel4utils_working_set_t *ws)
+{
+    return ws->idle_pages * PAGE_SIZE_4K;
+}
+
+/* Print the estimates of the last window */
+void sel4utils_working_set_dump(sel4utils_working_set_t *ws);
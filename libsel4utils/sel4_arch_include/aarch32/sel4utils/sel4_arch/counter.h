@@ -0,0 +1,29 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+#pragma once
+
+#include <autoconf.h>
+#include <stdint.h>
+
+/* The virtual count of the generic timer, which user level can read if the kernel exports it */
+#ifdef CONFIG_EXPORT_VCNT_USER
+#define SEL4UTILS_HAVE_USER_COUNTER 1
+
+static inline uint64_t sel4utils_read_counter(void)
+{
+    uint32_t low, high;
+    asm volatile("isb; mrrc p15, 1, %0, %1, c14" : "=r"(low), "=r"(high) :: "memory");
+    return ((uint64_t) high << 32) | low;
+}
+
+/* frequency of the counter in Hz, 0 if it is not known */
+static inline uint64_t sel4utils_counter_freq(void)
+{
+    uint32_t freq;
+    asm volatile("mrc p15, 0, %0, c14, c0, 0" : "=r"(freq));
+    return freq;
+}
+#endif /* CONFIG_EXPORT_VCNT_USER */
@@ -5,6 +5,9 @@
  */
 #pragma once
 
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+#include <stdbool.h>
 #include <sel4/sel4.h>
 
 static inline int seL4_ARCH_PageDirectory_Clean_Data(seL4_CPtr root, seL4_Word start, seL4_Word end)
@@ -27,3 +30,26 @@ static inline int seL4_ARCH_PageDirectory_Unify_Instruction(seL4_CPtr root, seL4
     return seL4_ARM_VSpace_Unify_Instruction(root, start, end);
 }
 
+#ifdef CONFIG_SEL4UTILS_USER_CACHE_OPS
+static inline seL4_Word sel4utils_dcache_line_size(void)
+{
+    seL4_Word ctr;
+    asm volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    /* DminLine is log2 of the number of words in the smallest line */
+    return 4 << ((ctr >> 16) & 0xf);
+}
+
+/* Clean, and if invalidate is set also invalidate, the data cache lines covering [start, end) */
+static inline void sel4utils_user_dcache_op(seL4_Word start, seL4_Word end, bool invalidate)
+{
+    seL4_Word line = sel4utils_dcache_line_size();
+    for (seL4_Word addr = start & ~(line - 1); addr < end; addr += line) {
+        if (invalidate) {
+            asm volatile("dc civac, %0" :: "r"(addr) : "memory");
+        } else {
+            asm volatile("dc cvac, %0" :: "r"(addr) : "memory");
+        }
+    }
+    asm volatile("dsb sy" ::: "memory");
+}
+#endif /* CONFIG_SEL4UTILS_USER_CACHE_OPS */
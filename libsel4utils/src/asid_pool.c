@@ -0,0 +1,204 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <vka/capops.h>
+#include <vka/object.h>
+#include <vspace/page.h>
+#include <utils/util.h>
+#include <sel4utils/asid_pool.h>
+#include "lock_internal.h"
+
+#define POOL_ASIDS BIT(seL4_ASIDPoolIndexBits)
+
+static sel4utils_asid_pool_t *add_pool(sel4utils_asid_manager_t *manager)
+{
+    if (manager->num_pools == manager->max_pools) {
+        size_t max_pools = MAX(manager->max_pools * 2, 4);
+        sel4utils_asid_pool_t *pools = realloc(manager->pools, max_pools * sizeof(*pools));
+        if (pools == NULL) {
+            ZF_LOGE("Failed to grow ASID pool table");
+            return NULL;
+        }
+        manager->pools = pools;
+        manager->max_pools = max_pools;
+    }
+    sel4utils_asid_pool_t *pool = &manager->pools[manager->num_pools];
+    memset(pool, 0, sizeof(*pool));
+    return pool;
+}
+
+static int make_pool(sel4utils_asid_manager_t *manager)
+{
+    if (manager->asid_control == seL4_CapNull) {
+        return -1;
+    }
+    sel4utils_asid_pool_t *pool = add_pool(manager);
+    if (pool == NULL) {
+        return -1;
+    }
+
+    int error = vka_alloc_untyped(manager->vka, seL4_ASIDPoolBits, &pool->untyped);
+    if (error) {
+        ZF_LOGE("Failed to allocate untyped for ASID pool");
+        return error;
+    }
+    cspacepath_t path;
+    error = vka_cspace_alloc_path(manager->vka, &path);
+    if (error) {
+        ZF_LOGE("Failed to allocate slot for ASID pool");
+        vka_free_object(manager->vka, &pool->untyped);
+        return error;
+    }
+    error = seL4_ARCH_ASIDControl_MakePool(manager->asid_control, pool->untyped.cptr, path.root, path.capPtr,
+                                           path.capDepth);
+    if (error) {
+        /* most likely there are no ASID pools left in the kernel */
+        ZF_LOGE("Failed to make ASID pool: %d", error);
+        vka_cspace_free_path(manager->vka, path);
+        vka_free_object(manager->vka, &pool->untyped);
+        return error;
+    }
+    pool->cap = path.capPtr;
+    manager->num_pools++;
+    return 0;
+}
+
+static void delete_pool(sel4utils_asid_manager_t *manager, size_t i)
+{
+    sel4utils_asid_pool_t *pool = &manager->pools[i];
+    assert(pool->untyped.cptr != seL4_CapNull && pool->used == 0);
+    cspacepath_t path;
+    vka_cspace_make_path(manager->vka, pool->cap, &path);
+    vka_cnode_delete(&path);
+    vka_cspace_free_path(manager->vka, path);
+    vka_free_object(manager->vka, &pool->untyped);
+    manager->pools[i] = manager->pools[--manager->num_pools];
+}
+
+/* The fullest pool with room, or NULL */
+static sel4utils_asid_pool_t *fullest_pool(sel4utils_asid_manager_t *manager)
+{
+    sel4utils_asid_pool_t *best = NULL;
+    for (size_t i = 0; i < manager->num_pools; i++) {
+        sel4utils_asid_pool_t *pool = &manager->pools[i];
+        if (!pool->full && pool->used < POOL_ASIDS && (best == NULL || pool->used > best->used)) {
+            best = pool;
+        }
+    }
+    return best;
+}
+
+static bool past_threshold(sel4utils_asid_manager_t *manager)
+{
+    for (size_t i = 0; i < manager->num_pools; i++) {
+        if (!manager->pools[i].full && manager->pools[i].used < manager->threshold) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int sel4utils_asid_manager_init(sel4utils_asid_manager_t *manager, vka_t *vka, seL4_CPtr asid_control,
+                                seL4_CPtr pool, size_t threshold)
+{
+    assert(manager != NULL && vka != NULL);
+    memset(manager, 0, sizeof(*manager));
+    manager->vka = vka;
+    manager->asid_control = asid_control;
+    manager->threshold = threshold == 0 ? POOL_ASIDS / 4 * 3 : MIN(threshold, POOL_ASIDS);
+
+    if (pool != seL4_CapNull) {
+        sel4utils_asid_pool_t *given = add_pool(manager);
+        if (given == NULL) {
+            return -1;
+        }
+        given->cap = pool;
+        manager->num_pools++;
+        return 0;
+    }
+    return make_pool(manager);
+}
+
+int sel4utils_asid_manager_assign(sel4utils_asid_manager_t *manager, seL4_CPtr vspace_root, seL4_CPtr *pool)
+{
+    int error = -1;
+    sel4utils_lock(&manager->lock);
+    while (true) {
+        sel4utils_asid_pool_t *chosen = fullest_pool(manager);
+        if (chosen == NULL) {
+            if (make_pool(manager) != 0) {
+                ZF_LOGE("Out of ASIDs");
+                break;
+            }
+            continue;
+        }
+        error = seL4_ARCH_ASIDPool_Assign(chosen->cap, vspace_root);
+        if (error == seL4_DeleteFirst) {
+            /* someone else used the pool up */
+            chosen->full = true;
+            continue;
+        }
+        if (error == seL4_NoError) {
+            chosen->used++;
+            *pool = chosen->cap;
+        }
+        break;
+    }
+    /* get the next pool ready before it is needed, failing that is not an error yet */
+    if (error == seL4_NoError && manager->asid_control != seL4_CapNull && past_threshold(manager)) {
+        make_pool(manager);
+    }
+    sel4utils_unlock(&manager->lock);
+    return error;
+}
+
+void sel4utils_asid_manager_release(sel4utils_asid_manager_t *manager, seL4_CPtr pool)
+{
+    sel4utils_lock(&manager->lock);
+    size_t i;
+    for (i = 0; i < manager->num_pools && manager->pools[i].cap != pool; i++);
+    if (i == manager->num_pools || manager->pools[i].used == 0) {
+        ZF_LOGE("ASID released to unknown or empty pool %lu", (unsigned long) pool);
+        sel4utils_unlock(&manager->lock);
+        return;
+    }
+    manager->pools[i].used--;
+    manager->pools[i].full = false;
+
+    /* keep a single empty pool of our own to grow into */
+    if (manager->pools[i].used == 0 && manager->pools[i].untyped.cptr != seL4_CapNull) {
+        for (size_t j = 0; j < manager->num_pools; j++) {
+            if (j != i && manager->pools[j].used == 0 && manager->pools[j].untyped.cptr != seL4_CapNull) {
+                delete_pool(manager, i);
+                break;
+            }
+        }
+    }
+    sel4utils_unlock(&manager->lock);
+}
+
+void sel4utils_asid_manager_destroy(sel4utils_asid_manager_t *manager)
+{
+    for (size_t i = manager->num_pools; i > 0; i--) {
+        if (manager->pools[i - 1].untyped.cptr != seL4_CapNull) {
+            if (manager->pools[i - 1].used != 0) {
+                ZF_LOGW("Deleting ASID pool with %zu ASIDs in use", manager->pools[i - 1].used);
+                manager->pools[i - 1].used = 0;
+            }
+            delete_pool(manager, i - 1);
+        }
+    }
+    free(manager->pools);
+    memset(manager, 0, sizeof(*manager));
+}
@@ -6,6 +6,7 @@
 #include <autoconf.h>
 #include <sel4utils/gen_config.h>
 
+#include <stdlib.h>
 #include <string.h>
 #include <sel4/sel4.h>
 #include <elf/elf.h>
@@ -13,7 +14,9 @@
 #include <sel4utils/thread.h>
 #include <sel4utils/util.h>
 #include <sel4utils/mapping.h>
+#include <sel4utils/page_copy.h>
 #include <sel4utils/elf.h>
+#include <sel4utils/trace.h>
 
 /*
  * Convert ELF permissions into seL4 permissions.
@@ -29,10 +32,118 @@ static inline seL4_CapRights_t rights_from_elf(unsigned long permissions)
     return seL4_CapRights_new(false, false, canRead, canWrite);
 }
 
+/* Maximum number of frames load_segment maps into the loader vspace at once */
+#define LOAD_WINDOW_FRAMES 64
+
+/* Find the reservation that the frame at page belongs to, which may belong to an adjacent region */
+static int reservation_for_page(int num_regions, sel4utils_elf_region_t regions[num_regions], int region_index,
+                                uintptr_t page, reservation_t *result)
+{
+    sel4utils_elf_region_t *region = &regions[region_index];
+    uintptr_t res_start = (uintptr_t) region->reservation_vstart;
+    if (page < res_start) {
+        if ((region_index - 1) < 0) {
+            ZF_LOGE("Invalid regions: bad elf file.");
+            return seL4_InvalidArgument;
+        }
+        *result = regions[region_index - 1].reservation;
+    } else if (page + PAGE_SIZE_4K > res_start + region->reservation_size) {
+        if ((region_index + 1) >= num_regions) {
+            ZF_LOGE("Invalid regions: bad elf file.");
+            return seL4_InvalidArgument;
+        }
+        *result = regions[region_index + 1].reservation;
+    } else {
+        *result = region->reservation;
+    }
+    return seL4_NoError;
+}
+
+/* Make sure there is a frame in the loadee at page, allocating one if needed. Frames
+ * entirely inside the segment's own reservation are allocated as large pages where
+ * possible, unless max_bits is smaller than a large page. The first and last pages of a segment may be shared with adjacent segments,
+ * so are always 4K, which means any frame that is already mapped is 4K as well */
+static int loadee_frame(vspace_t *loadee_vspace, int num_regions, sel4utils_elf_region_t regions[num_regions],
+                        int region_index, uintptr_t page, uintptr_t first_page, uintptr_t last_page,
+                        size_t max_bits, seL4_CPtr *cap, size_t *size_bits)
+{
+    *size_bits = seL4_PageBits;
+    *cap = vspace_get_cap(loadee_vspace, (void *) page);
+    if (*cap != seL4_CapNull) {
+        return seL4_NoError;
+    }
+
+    sel4utils_elf_region_t *region = &regions[region_index];
+    uintptr_t res_start = (uintptr_t) region->reservation_vstart;
+    uintptr_t res_end = res_start + region->reservation_size;
+    if (SEL4_NUM_PAGE_SIZES > 1 && max_bits >= sel4_page_sizes[1]) {
+        size_t large_bits = sel4_page_sizes[1];
+        if (IS_ALIGNED(page, large_bits) && page > first_page && page >= res_start &&
+            page + BIT(large_bits) <= MIN(last_page, res_end) &&
+            vspace_new_pages_at_vaddr(loadee_vspace, (void *) page, 1, large_bits, region->reservation) == 0) {
+            *size_bits = large_bits;
+            *cap = vspace_get_cap(loadee_vspace, (void *) page);
+            return seL4_NoError;
+        }
+    }
+    reservation_t reservation;
+    int error = reservation_for_page(num_regions, regions, region_index, page, &reservation);
+    if (error == seL4_NoError) {
+        error = vspace_new_pages_at_vaddr(loadee_vspace, (void *) page, 1, seL4_PageBits, reservation);
+    }
+    if (error != seL4_NoError) {
+        ZF_LOGE("ERROR: failed to allocate frame by loadee vka: %d", error);
+        return error;
+    }
+    *cap = vspace_get_cap(loadee_vspace, (void *) page);
+    return seL4_NoError;
+}
+
+/* Read bytes of the uncompressed image at offset into dest. The image can only be read
+ * forwards, except for the prefix, and bytes skipped over are read and thrown away */
+static int elf_stream_read(sel4utils_elf_stream_t *stream, size_t offset, void *dest, size_t bytes)
+{
+    char *d = dest;
+    if (offset < stream->prefix_size) {
+        size_t n = MIN(bytes, stream->prefix_size - offset);
+        memcpy(d, (const char *) stream->prefix + offset, n);
+        d += n;
+        offset += n;
+        bytes -= n;
+    }
+    if (bytes == 0) {
+        return 0;
+    }
+    if (offset < stream->offset) {
+        ZF_LOGE("Segment data at 0x%zx has already been read past, segments must be in file order", offset);
+        return -1;
+    }
+    while (stream->offset < offset) {
+        char discard[256];
+        size_t n = MIN(sizeof(discard), offset - stream->offset);
+        if (stream->read(stream->cookie, discard, n)) {
+            ZF_LOGE("Failed to read image at 0x%zx", stream->offset);
+            return -1;
+        }
+        stream->offset += n;
+    }
+    if (stream->read(stream->cookie, d, bytes)) {
+        ZF_LOGE("Failed to read image at 0x%zx", stream->offset);
+        return -1;
+    }
+    stream->offset += bytes;
+    return 0;
+}
+
+/* Load the segment of a region, copying file_size bytes from either src or, if src is NULL,
+ * from file_offset of stream, with frames of at most max_page_bits. Pages from skip_start
+ * to skip_end are left alone, as they have been loaded some other way */
 static int load_segment(vspace_t *loadee_vspace, vspace_t *loader_vspace,
                         vka_t *loadee_vka, vka_t *loader_vka,
-                        const char *src, size_t file_size, int num_regions,
-                        sel4utils_elf_region_t regions[num_regions], int region_index)
+                        const char *src, sel4utils_elf_stream_t *stream, size_t file_offset,
+                        size_t file_size, bool executable, size_t max_page_bits, int num_regions,
+                        sel4utils_elf_region_t regions[num_regions], int region_index,
+                        uintptr_t skip_start, uintptr_t skip_end)
 {
     int error = seL4_NoError;
     sel4utils_elf_region_t region = regions[region_index];
@@ -43,109 +154,136 @@ static int load_segment(vspace_t *loadee_vspace, vspace_t *loader_vspace,
         return seL4_InvalidArgument;
     }
 
-    /* create a slot to map a page into the loader address space */
-    seL4_CPtr loader_slot;
-    cspacepath_t loader_frame_cap;
-
-    error = vka_cspace_alloc(loader_vka, &loader_slot);
+    /* create slots to map a window of frames into the loader address space */
+    seL4_CPtr loader_slots[LOAD_WINDOW_FRAMES];
+    error = vka_cspace_alloc_n(loader_vka, LOAD_WINDOW_FRAMES, loader_slots);
     if (error) {
-        ZF_LOGE("Failed to allocate cslot by loader vka: %d", error);
+        ZF_LOGE("Failed to allocate cslots by loader vka: %d", error);
         return error;
     }
-    vka_cspace_make_path(loader_vka, loader_slot, &loader_frame_cap);
-
-    /* We work a page at a time */
-    unsigned int pos = 0;
-    while (pos < segment_size && error == seL4_NoError) {
-        void *loader_vaddr = 0;
-        void *loadee_vaddr = (void *)((seL4_Word)ROUND_DOWN(dst, PAGE_SIZE_4K));
-
-        /* Find the reservation that this frame belongs to.
-         * The reservation may belong to an adjacent region */
-        reservation_t reservation;
-        if (loadee_vaddr < region.reservation_vstart) {
-            //  Have to use reservation from adjacent region
-            if ((region_index - 1) < 0) {
-                ZF_LOGE("Invalid regions: bad elf file.");
-                error = seL4_InvalidArgument;
-                continue;
-            }
-            reservation = regions[region_index - 1].reservation;
-        } else if (loadee_vaddr + (MIN(segment_size - pos, PAGE_SIZE_4K)) >
-                   (region.reservation_vstart + region.reservation_size)) {
-            if ((region_index + 1) >= num_regions) {
-                ZF_LOGE("Invalid regions: bad elf file.");
-                error = seL4_InvalidArgument;
-                continue;
-            }
-            reservation = regions[region_index + 1].reservation;
-        } else {
-            reservation = region.reservation;
-        }
-
-        /* We need to check if the frame has already been mapped by another region.
-         * Currently this check is done on every frame because it is assumed to be cheap. */
-        seL4_CPtr cap = vspace_get_cap(loadee_vspace, loadee_vaddr);
-        if (cap == seL4_CapNull) {
-            error = vspace_new_pages_at_vaddr(loadee_vspace, loadee_vaddr, 1, seL4_PageBits, reservation);
-        }
 
-        if (error != seL4_NoError) {
-            ZF_LOGE("ERROR: failed to allocate frame by loadee vka: %d", error);
-            continue;
-        }
+    uintptr_t first_page = ROUND_DOWN(dst, PAGE_SIZE_4K);
+    uintptr_t end = ROUND_UP(dst + segment_size, PAGE_SIZE_4K);
+    uintptr_t last_page = end - PAGE_SIZE_4K;
+    uintptr_t page = first_page;
 
-        /* copy the frame cap to map into the loader address space */
-        cspacepath_t loadee_frame_cap;
+    /* Pages that hold any file data are file backed and are copied into through the loader.
+     * The rest are pure zero fill, and as seL4 gives us zero'd frames they only need to be
+     * allocated in the loadee */
+    uintptr_t file_end = ROUND_UP(dst + file_size, PAGE_SIZE_4K);
 
-        vka_cspace_make_path(loadee_vka, vspace_get_cap(loadee_vspace, loadee_vaddr),
-                             &loadee_frame_cap);
-        error = vka_cnode_copy(&loader_frame_cap, &loadee_frame_cap, seL4_AllRights);
-        if (error != seL4_NoError) {
-            ZF_LOGE("ERROR: failed to copy frame cap into loader cspace: %d", error);
+    /* We work a window of frames of the same size and the same kind at a time */
+    while (page < end && error == seL4_NoError) {
+        if (page >= skip_start && page < skip_end) {
+            page = skip_end;
             continue;
         }
+        cspacepath_t loader_frame_caps[LOAD_WINDOW_FRAMES];
+        seL4_CPtr loadee_caps[LOAD_WINDOW_FRAMES];
+        seL4_CPtr loader_caps[LOAD_WINDOW_FRAMES];
+        size_t window_bits = 0;
+        uintptr_t window_start = page;
+        bool file_backed = file_size > 0 && window_start < file_end;
+        int num_frames = 0;
+
+        while (page < end && num_frames < LOAD_WINDOW_FRAMES) {
+            if (file_backed != (file_size > 0 && page < file_end) || (num_frames > 0 && page == skip_start)) {
+                break;
+            }
+            if (num_frames > 0 && SEL4_NUM_PAGE_SIZES > 1 && window_bits < sel4_page_sizes[1] &&
+                max_page_bits >= sel4_page_sizes[1] && IS_ALIGNED(page, sel4_page_sizes[1])) {
+                /* start a new window in case a large page fits here */
+                break;
+            }
+            size_t size_bits;
+            /* once the window has a size, only add frames of that size */
+            size_t max_bits = num_frames == 0 ? max_page_bits : window_bits;
+            error = loadee_frame(loadee_vspace, num_regions, regions, region_index, page, first_page,
+                                 last_page, max_bits, &loadee_caps[num_frames], &size_bits);
+            if (error != seL4_NoError || loadee_caps[num_frames] == seL4_CapNull ||
+                (num_frames > 0 && size_bits != window_bits)) {
+                break;
+            }
+            window_bits = size_bits;
+            num_frames++;
+            page += BIT(size_bits);
+        }
 
-        /* map the frame into the loader address space */
-        loader_vaddr = vspace_map_pages(loader_vspace, &loader_frame_cap.capPtr, NULL, seL4_AllRights,
-                                        1, seL4_PageBits, 1);
-        if (loader_vaddr == NULL) {
-            ZF_LOGE("failed to map frame into loader vspace.");
-            error = -1;
+        if (!file_backed || error != seL4_NoError) {
             continue;
         }
 
-        /* finally copy the data */
-        int nbytes = PAGE_SIZE_4K - (dst & PAGE_MASK_4K);
-        if (pos < file_size) {
-            memcpy(loader_vaddr + (dst % PAGE_SIZE_4K), (void *)src, MIN(nbytes, file_size - pos));
+        /* copy the frame caps to map into the loader address space */
+        int num_copied = 0;
+        for (; num_copied < num_frames; num_copied++) {
+            cspacepath_t loadee_frame_cap;
+            vka_cspace_make_path(loadee_vka, loadee_caps[num_copied], &loadee_frame_cap);
+            vka_cspace_make_path(loader_vka, loader_slots[num_copied], &loader_frame_caps[num_copied]);
+            error = vka_cnode_copy(&loader_frame_caps[num_copied], &loadee_frame_cap, seL4_AllRights);
+            if (error != seL4_NoError) {
+                ZF_LOGE("ERROR: failed to copy frame cap into loader cspace: %d", error);
+                break;
+            }
+            loader_caps[num_copied] = loader_frame_caps[num_copied].capPtr;
         }
-        /* Note that we don't need to explicitly zero frames as seL4 gives us zero'd frames */
 
+        if (error == seL4_NoError) {
+            /* map the window into the loader address space */
+            void *loader_vaddr = vspace_map_pages(loader_vspace, loader_caps, NULL, seL4_AllRights,
+                                                  num_frames, window_bits, 1);
+            if (loader_vaddr == NULL) {
+                ZF_LOGE("failed to map frames into loader vspace.");
+                error = -1;
+            } else {
+                /* finally copy the data */
+                uintptr_t copy_start = MAX(window_start, dst);
+                uintptr_t copy_end = MIN(page, dst + file_size);
+                if (src != NULL) {
+                    sel4utils_copy(loader_vaddr + (copy_start - window_start), src + (copy_start - dst),
+                                   copy_end - copy_start);
+                } else {
+                    /* decompressed straight into the loadee's frames */
+                    error = elf_stream_read(stream, file_offset + (copy_start - dst),
+                                            loader_vaddr + (copy_start - window_start), copy_end - copy_start);
+                }
+
+                /* Only code needs the caches flushed before it runs */
+                if (executable) {
 #ifdef CONFIG_ARCH_ARM
-        /* Flush the caches */
-        seL4_ARM_Page_Unify_Instruction(loader_frame_cap.capPtr, 0, PAGE_SIZE_4K);
-        seL4_ARM_Page_Unify_Instruction(loadee_frame_cap.capPtr, 0, PAGE_SIZE_4K);
+                    for (int i = 0; i < num_frames; i++) {
+                        seL4_ARM_Page_Unify_Instruction(loader_caps[i], 0, BIT(window_bits));
+                        seL4_ARM_Page_Unify_Instruction(loadee_caps[i], 0, BIT(window_bits));
+                    }
 #elif CONFIG_ARCH_RISCV
-        /* Ensure that the writes to memory that may be executed become visible */
-        asm volatile("fence.i" ::: "memory");
+                    /* Ensure that the writes to memory that may be executed become visible */
+                    asm volatile("fence.i" ::: "memory");
 #endif
+                }
 
-        /* now unmap the page in the loader address space */
-        vspace_unmap_pages(loader_vspace, (void *) loader_vaddr, 1, seL4_PageBits, VSPACE_PRESERVE);
-        vka_cnode_delete(&loader_frame_cap);
+                /* now unmap the window in the loader address space */
+                vspace_unmap_pages(loader_vspace, loader_vaddr, num_frames, window_bits, VSPACE_PRESERVE);
+            }
+        }
 
-        pos += nbytes;
-        dst += nbytes;
-        src += nbytes;
+        for (int i = 0; i < num_copied; i++) {
+            vka_cnode_delete(&loader_frame_caps[i]);
+        }
     }
 
-    /* clear the cslot */
-    vka_cspace_free(loader_vka, loader_frame_cap.capPtr);
+    /* clear the cslots */
+    vka_cspace_free_n(loader_vka, LOAD_WINDOW_FRAMES, loader_slots);
 
     return error;
 }
 
+/* Read only reservations only ever contain frames of read only segments, as
+ * prepare_reservations moves frames shared with writable segments out of them. The pages
+ * moved out are not cached, so the data of the segment on them is still loaded each time */
+static bool region_is_shareable(sel4utils_elf_region_t *region)
+{
+    return region->reservation_size > 0 && !seL4_CapRights_get_capAllowWrite(region->rights);
+}
+
 /**
  * Load an array of regions into a vspace.
  *
@@ -161,26 +299,45 @@ static int load_segment(vspace_t *loadee_vspace, vspace_t *loader_vspace,
  * @param elf_file pointer to elf object
  * @param num_regions total number of segments/regions to load.
  * @param regions region array containing segment info.
+ * @param image if not NULL, the reservations of read only segments are mapped from here by the
+ *              caller, and only the pages of those segments outside them are loaded.
+ * @param stream if not NULL, segment data is read from here rather than from elf_file.
+ * @param max_page_bits largest frames to load segments with.
  *
  * @return 0 on success.
  */
 static int load_segments(vspace_t *loadee_vspace, vspace_t *loader_vspace,
                          vka_t *loadee_vka, vka_t *loader_vka, const elf_t *elf_file,
-                         int num_regions, sel4utils_elf_region_t regions[num_regions])
+                         int num_regions, sel4utils_elf_region_t regions[num_regions],
+                         sel4utils_elf_cached_image_t *image, sel4utils_elf_stream_t *stream,
+                         size_t max_page_bits)
 {
     for (int i = 0; i < num_regions; i++) {
+        uintptr_t skip_start = 0, skip_end = 0;
+        if (image != NULL && region_is_shareable(&regions[i])) {
+            /* mapped from the image cache instead */
+            skip_start = (uintptr_t) regions[i].reservation_vstart;
+            skip_end = skip_start + regions[i].reservation_size;
+        }
         int segment_index = regions[i].segment_index;
-        const char *source_addr = elf_getProgramSegment(elf_file, segment_index);
-        if (source_addr == NULL) {
-            return 1;
+        const char *source_addr = NULL;
+        if (stream == NULL) {
+            source_addr = elf_getProgramSegment(elf_file, segment_index);
+            if (source_addr == NULL) {
+                return 1;
+            }
         }
+        size_t file_offset = elf_getProgramHeaderOffset(elf_file, segment_index);
         size_t file_size = elf_getProgramHeaderFileSize(elf_file, segment_index);
+        bool executable = elf_getProgramHeaderFlags(elf_file, segment_index) & PF_X;
 
         int error = load_segment(loadee_vspace, loader_vspace, loadee_vka, loader_vka,
-                                 source_addr, file_size, num_regions, regions, i);
+                                 source_addr, stream, file_offset, file_size, executable, max_page_bits,
+                                 num_regions, regions, i, skip_start, skip_end);
         if (error) {
             return error;
         }
+        SEL4_TRACE(elf_load_segment, segment_index);
     }
     return 0;
 }
@@ -470,8 +627,214 @@ void *sel4utils_elf_reserve(vspace_t *loadee, const elf_t *elf_file, sel4utils_e
     return entry_point(elf_file);
 }
 
-void *sel4utils_elf_load_record_regions(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
-                                        const elf_t *elf_file, sel4utils_elf_region_t *regions, int mapanywhere)
+static void elf_cache_free_image(sel4utils_elf_cache_t *cache, sel4utils_elf_cached_image_t *image);
+
+/* FNV-1a over the load layout of an image. Together with the address of the file this
+ * tells apart images without having to read every byte of them */
+static uint32_t elf_cache_hash(const elf_t *elf_file)
+{
+    uint32_t hash = 2166136261u;
+    int num_headers = elf_getNumProgramHeaders(elf_file);
+    for (int i = 0; i < num_headers; i++) {
+        uint64_t fields[] = {
+            elf_getProgramHeaderType(elf_file, i),
+            elf_getProgramHeaderFlags(elf_file, i),
+            elf_getProgramHeaderOffset(elf_file, i),
+            elf_getProgramHeaderVaddr(elf_file, i),
+            elf_getProgramHeaderFileSize(elf_file, i),
+            elf_getProgramHeaderMemorySize(elf_file, i),
+        };
+        const unsigned char *bytes = (const unsigned char *) fields;
+        for (size_t j = 0; j < sizeof(fields); j++) {
+            hash = (hash ^ bytes[j]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+static sel4utils_elf_cached_image_t *elf_cache_lookup(sel4utils_elf_cache_t *cache, const elf_t *elf_file)
+{
+    uint32_t hash = elf_cache_hash(elf_file);
+    for (sel4utils_elf_cached_image_t *image = cache->images; image != NULL; image = image->next) {
+        if (image->complete && image->file == elf_file->elfFile && image->size == elf_file->elfSize &&
+            image->hash == hash) {
+            return image;
+        }
+    }
+    return NULL;
+}
+
+/* Size of the frame mapped at vaddr, which the loader allocates whole so every 4K
+ * page of it has the same cookie */
+static size_t loaded_frame_bits(vspace_t *loadee, uintptr_t vaddr, uintptr_t end)
+{
+    uintptr_t cookie = vspace_get_cookie(loadee, (void *) vaddr);
+    for (int i = SEL4_NUM_PAGE_SIZES - 1; i > 0; i--) {
+        size_t bits = sel4_page_sizes[i];
+        if (IS_ALIGNED(vaddr, bits) && vaddr + BIT(bits) <= end &&
+            vspace_get_cookie(loadee, (void *)(vaddr + BIT(bits) - PAGE_SIZE_4K)) == cookie) {
+            return bits;
+        }
+    }
+    return seL4_PageBits;
+}
+
+/* Map copies of the cached frames of image into loadee */
+static int elf_cache_map(sel4utils_elf_cache_t *cache, sel4utils_elf_cached_image_t *image, vspace_t *loadee,
+                         vka_t *loadee_vka, int num_regions, sel4utils_elf_region_t regions[num_regions])
+{
+    for (size_t i = 0; i < image->num_frames; i++) {
+        seL4_CPtr slot;
+        int error = vka_cspace_alloc(loadee_vka, &slot);
+        if (error) {
+            ZF_LOGE("Failed to allocate cslot for shared frame");
+            return error;
+        }
+        cspacepath_t src, dest;
+        vka_cspace_make_path(cache->vka, image->caps[i], &src);
+        vka_cspace_make_path(loadee_vka, slot, &dest);
+        error = vka_cnode_copy(&dest, &src, seL4_CapRights_new(false, false, true, false));
+        if (error == seL4_NoError) {
+            /* no cookie, the frame still belongs to the cache */
+            error = vspace_map_pages_at_vaddr(loadee, &slot, NULL, (void *) image->vaddrs[i], 1, image->size_bits[i],
+                                              regions[image->regions[i]].reservation);
+            if (error) {
+                vka_cnode_delete(&dest);
+            }
+        }
+        if (error) {
+            ZF_LOGE("Failed to map shared frame at %p", (void *) image->vaddrs[i]);
+            vka_cspace_free(loadee_vka, slot);
+            return error;
+        }
+    }
+    return 0;
+}
+
+/* Take ownership of the frames of the read only segments just loaded into loadee, leaving
+ * loadee with copies of them, so that later loads of the same image can share them */
+static int elf_cache_add(sel4utils_elf_cache_t *cache, vspace_t *loadee, vka_t *loadee_vka, const elf_t *elf_file,
+                         int num_regions, sel4utils_elf_region_t regions[num_regions])
+{
+    if (loadee_vka != cache->vka) {
+        /* we could not free the frames we take over */
+        ZF_LOGW("Not caching image loaded with a different vka to the cache");
+        return 0;
+    }
+
+    size_t num_frames = 0;
+    for (int r = 0; r < num_regions; r++) {
+        uintptr_t start = (uintptr_t) regions[r].reservation_vstart;
+        uintptr_t end = start + regions[r].reservation_size;
+        for (uintptr_t v = start; region_is_shareable(&regions[r]) && v < end; num_frames++) {
+            v += BIT(loaded_frame_bits(loadee, v, end));
+        }
+    }
+
+    sel4utils_elf_cached_image_t *image = calloc(1, sizeof(*image));
+    if (image == NULL) {
+        ZF_LOGW("Failed to allocate image cache entry");
+        return 0;
+    }
+    image->caps = calloc(num_frames, sizeof(*image->caps));
+    image->cookies = calloc(num_frames, sizeof(*image->cookies));
+    image->vaddrs = calloc(num_frames, sizeof(*image->vaddrs));
+    image->size_bits = calloc(num_frames, sizeof(*image->size_bits));
+    image->regions = calloc(num_frames, sizeof(*image->regions));
+    if (num_frames > 0 && (image->caps == NULL || image->cookies == NULL || image->vaddrs == NULL ||
+                           image->size_bits == NULL || image->regions == NULL)) {
+        ZF_LOGW("Failed to allocate image cache entry");
+        elf_cache_free_image(cache, image);
+        return 0;
+    }
+    image->file = elf_file->elfFile;
+    image->size = elf_file->elfSize;
+    image->hash = elf_cache_hash(elf_file);
+
+    /* from here on the image is in the cache, even if incomplete, as it owns frames */
+    image->next = cache->images;
+    cache->images = image;
+
+    for (int r = 0; r < num_regions; r++) {
+        uintptr_t start = (uintptr_t) regions[r].reservation_vstart;
+        uintptr_t end = start + regions[r].reservation_size;
+        for (uintptr_t v = start; region_is_shareable(&regions[r]) && v < end;) {
+            size_t size_bits = loaded_frame_bits(loadee, v, end);
+            seL4_CPtr cap = vspace_get_cap(loadee, (void *) v);
+            uintptr_t cookie = vspace_get_cookie(loadee, (void *) v);
+
+            seL4_CPtr slot;
+            if (vka_cspace_alloc(loadee_vka, &slot)) {
+                /* leave the rest with the loadee, the image just won't be used */
+                return 0;
+            }
+            cspacepath_t src, dest;
+            vka_cspace_make_path(loadee_vka, cap, &src);
+            vka_cspace_make_path(loadee_vka, slot, &dest);
+            if (vka_cnode_copy(&dest, &src, seL4_CapRights_new(false, false, true, false))) {
+                vka_cspace_free(loadee_vka, slot);
+                return 0;
+            }
+
+            /* swap the mapping over to the copy, keeping the original frame for ourselves */
+            vspace_unmap_pages(loadee, (void *) v, 1, size_bits, VSPACE_PRESERVE);
+            size_t i = image->num_frames++;
+            image->caps[i] = cap;
+            image->cookies[i] = cookie;
+            image->vaddrs[i] = v;
+            image->size_bits[i] = size_bits;
+            image->regions[i] = r;
+            int error = vspace_map_pages_at_vaddr(loadee, &slot, NULL, (void *) v, 1, size_bits,
+                                                  regions[r].reservation);
+            if (error) {
+                ZF_LOGE("Failed to remap shared frame at %p", (void *) v);
+                vka_cnode_delete(&dest);
+                vka_cspace_free(loadee_vka, slot);
+                return error;
+            }
+            v += BIT(size_bits);
+        }
+    }
+    image->complete = true;
+    return 0;
+}
+
+static void elf_cache_free_image(sel4utils_elf_cache_t *cache, sel4utils_elf_cached_image_t *image)
+{
+    for (size_t i = 0; i < image->num_frames; i++) {
+        cspacepath_t path;
+        vka_cspace_make_path(cache->vka, image->caps[i], &path);
+        vka_cnode_delete(&path);
+        vka_cspace_free(cache->vka, image->caps[i]);
+        vka_utspace_free(cache->vka, kobject_get_type(KOBJECT_FRAME, image->size_bits[i]), image->size_bits[i],
+                         image->cookies[i]);
+    }
+    free(image->caps);
+    free(image->cookies);
+    free(image->vaddrs);
+    free(image->size_bits);
+    free(image->regions);
+    free(image);
+}
+
+void sel4utils_elf_cache_init(sel4utils_elf_cache_t *cache, vka_t *vka)
+{
+    cache->vka = vka;
+    cache->images = NULL;
+}
+
+void sel4utils_elf_cache_destroy(sel4utils_elf_cache_t *cache)
+{
+    while (cache->images != NULL) {
+        sel4utils_elf_cached_image_t *image = cache->images;
+        cache->images = image->next;
+        elf_cache_free_image(cache, image);
+    }
+}
+
+static void *elf_load(sel4utils_elf_cache_t *cache, vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka,
+                      vka_t *loader_vka, const elf_t *elf_file, sel4utils_elf_stream_t *stream,
+                      sel4utils_elf_region_t *regions, int mapanywhere, size_t max_page_bits)
 {
     /* Calculate number of loadable regions.  Use stack array if one wasn't passed in */
     int num_regions = count_loadable_regions(elf_file);
@@ -488,9 +851,22 @@ void *sel4utils_elf_load_record_regions(vspace_t *loadee, vspace_t *loader, vka_
         ZF_LOGE("Failed to reserve regions");
         return NULL;
     }
+    SEL4_TRACE(elf_load_reserved, num_regions);
+
+    /* Images are only ever shared between processes at the same addresses */
+    sel4utils_elf_cached_image_t *image = NULL;
+    if (cache != NULL && !mapanywhere) {
+        image = elf_cache_lookup(cache, elf_file);
+    }
 
     /* Load Map reservations and load in elf data */
-    error = load_segments(loadee, loader, loadee_vka, loader_vka, elf_file, num_regions, regions);
+    error = load_segments(loadee, loader, loadee_vka, loader_vka, elf_file, num_regions, regions, image, stream,
+                          max_page_bits);
+    if (!error && image != NULL) {
+        error = elf_cache_map(cache, image, loadee, loadee_vka, num_regions, regions);
+    } else if (!error && cache != NULL && !mapanywhere) {
+        error = elf_cache_add(cache, loadee, loadee_vka, elf_file, num_regions, regions);
+    }
     if (error) {
         ZF_LOGE("Failed to load segments");
         return NULL;
@@ -534,6 +910,33 @@ uintptr_t sel4utils_elf_get_section(const elf_t *elf_file, const char *section_n
     }
 }
 
+void *sel4utils_elf_load_record_regions(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                                        const elf_t *elf_file, sel4utils_elf_region_t *regions, int mapanywhere)
+{
+    return elf_load(NULL, loadee, loader, loadee_vka, loader_vka, elf_file, NULL, regions, mapanywhere, SIZE_MAX);
+}
+
+void *sel4utils_elf_load_max_page_bits(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                                       const elf_t *elf_file, size_t max_page_bits)
+{
+    return elf_load(NULL, loadee, loader, loadee_vka, loader_vka, elf_file, NULL, NULL, 0, max_page_bits);
+}
+
+void *sel4utils_elf_load_stream(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
+                                const elf_t *elf_file, sel4utils_elf_stream_t *stream,
+                                sel4utils_elf_region_t *regions, int mapanywhere)
+{
+    assert(stream != NULL && stream->read != NULL);
+    stream->offset = stream->prefix_size;
+    return elf_load(NULL, loadee, loader, loadee_vka, loader_vka, elf_file, stream, regions, mapanywhere, SIZE_MAX);
+}
+
+void *sel4utils_elf_load_cached(sel4utils_elf_cache_t *cache, vspace_t *loadee, vspace_t *loader,
+                                vka_t *loadee_vka, vka_t *loader_vka, const elf_t *elf_file)
+{
+    return elf_load(cache, loadee, loader, loadee_vka, loader_vka, elf_file, NULL, NULL, 0, SIZE_MAX);
+}
+
 void *sel4utils_elf_load(vspace_t *loadee, vspace_t *loader, vka_t *loadee_vka, vka_t *loader_vka,
                          const elf_t *elf_file)
 {
@@ -0,0 +1,358 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <vka/capops.h>
+#include <vka/object.h>
+#include <sel4utils/api.h>
+#include <sel4utils/arch/counter.h>
+#include <sel4utils/fault_service.h>
+#include <sel4utils/thread.h>
+#include <sel4utils/vspace.h>
+#include <utils/util.h>
+#include "lock_internal.h"
+
+#define FAULT_SERVICE_MIN_REGIONS 4
+
+static uint64_t fault_cycles(void)
+{
+#ifdef SEL4UTILS_HAVE_USER_COUNTER
+    return sel4utils_read_counter();
+#else
+    return 0;
+#endif
+}
+
+/* Index of the last region starting at or below vaddr, or -1. Service lock held */
+static ssize_t region_before(sel4utils_fault_client_t *client, uintptr_t vaddr)
+{
+    ssize_t low = 0, high = (ssize_t) client->num_regions - 1, found = -1;
+
+    while (low <= high) {
+        ssize_t mid = low + (high - low) / 2;
+        if (client->regions[mid].start <= vaddr) {
+            found = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return found;
+}
+
+/* Returns true if the client should be resumed */
+static bool handle_fault(sel4utils_fault_service_t *service, seL4_Word badge, seL4_MessageInfo_t info)
+{
+    if (badge == 0 || badge > service->max_clients || !service->clients[badge - 1].in_use) {
+        ZF_LOGE("Fault from unknown client %"SEL4_PRIu_word, badge);
+        return false;
+    }
+    sel4utils_fault_client_t *client = &service->clients[badge - 1];
+
+    if (seL4_MessageInfo_get_label(info) != seL4_Fault_VMFault) {
+        sel4utils_print_fault_message(info, client->name);
+        return false;
+    }
+
+    sel4utils_fault_t fault = {
+        .client = client,
+        .fault = seL4_getFault(info),
+    };
+    fault.addr = (void *) seL4_Fault_VMFault_get_Addr(fault.fault);
+
+    sel4utils_fault_fn fn = NULL;
+    void *cookie = NULL;
+    sel4utils_lock(&service->lock);
+    ssize_t i = region_before(client, (uintptr_t) fault.addr);
+    if (i >= 0 && (uintptr_t) fault.addr < client->regions[i].end) {
+        fn = client->regions[i].fn;
+        cookie = client->regions[i].cookie;
+    }
+    sel4utils_unlock(&service->lock);
+
+    if (fn == NULL) {
+        sel4utils_print_fault_message(info, client->name);
+        return false;
+    }
+    if (fn(cookie, &fault) != SEL4UTILS_FAULT_RESUME) {
+        /* the callback may have clobbered the message registers, so report what we read */
+        ZF_LOGE("Unhandled fault from [%s] at address %p", client->name, fault.addr);
+        return false;
+    }
+    if (fault.write_regs &&
+        seL4_TCB_WriteRegisters(client->tcb, false, 0, sizeof(seL4_UserContext) / sizeof(seL4_Word),
+                                &fault.regs)) {
+        ZF_LOGE("Failed to write registers of [%s]", client->name);
+        return false;
+    }
+    return true;
+}
+
+static void fault_handler(sel4utils_fault_handler_t *handler)
+{
+    sel4utils_fault_service_t *service = handler->service;
+    seL4_CPtr endpoint = service->endpoint.cptr;
+    seL4_CPtr reply = handler->thread.reply.cptr;
+    seL4_Word badge;
+
+    seL4_MessageInfo_t info = api_recv(endpoint, &badge, reply);
+    while (1) {
+        uint64_t start = fault_cycles();
+        bool resume = handle_fault(service, badge, info);
+        uint64_t cycles = fault_cycles() - start;
+
+        handler->stats.faults++;
+        handler->stats.unhandled += resume ? 0 : 1;
+        handler->stats.cycles += cycles;
+        handler->stats.max_cycles = MAX(handler->stats.max_cycles, cycles);
+
+        if (resume) {
+            /* an empty reply restarts the client */
+            info = api_reply_recv(endpoint, seL4_MessageInfo_new(0, 0, 0, 0), &badge, reply);
+        } else {
+            /* leave the client blocked */
+            info = api_recv(endpoint, &badge, reply);
+        }
+    }
+}
+
+int sel4utils_fault_service_create(simple_t *simple, vka_t *vka, vspace_t *vspace, uint8_t priority,
+                                   size_t num_handlers, size_t max_clients, sel4utils_fault_service_t *service)
+{
+    memset(service, 0, sizeof(*service));
+    size_t num_cores = simple_get_core_count(simple);
+    num_handlers = num_handlers == 0 ? num_cores : MIN(num_handlers, num_cores);
+
+    service->handlers = calloc(num_handlers, sizeof(*service->handlers));
+    service->clients = calloc(max_clients, sizeof(*service->clients));
+    if (service->handlers == NULL || service->clients == NULL) {
+        ZF_LOGE("Failed to allocate fault service");
+        goto error;
+    }
+    service->max_clients = max_clients;
+
+    if (vka_alloc_endpoint(vka, &service->endpoint)) {
+        ZF_LOGE("Failed to allocate fault service endpoint");
+        goto error;
+    }
+
+    /* only handlers that are configured are counted, so destroy cleans up just those */
+    for (size_t i = 0; i < num_handlers; i++) {
+        sel4utils_fault_handler_t *handler = &service->handlers[i];
+        handler->service = service;
+        sel4utils_thread_config_t config = thread_config_new(simple);
+        config = thread_config_priority(config, priority);
+        config = thread_config_create_reply(config);
+        if (config_set(CONFIG_KERNEL_MCS)) {
+            /* seL4_Time measures time in us, the config parameter uses ms. */
+            seL4_Time timeslice_us = CONFIG_BOOT_THREAD_TIME_SLICE * US_IN_MS;
+            config.sched_params = sched_params_round_robin(config.sched_params, simple, i, timeslice_us);
+        } else {
+            config.sched_params.core = i;
+        }
+        if (sel4utils_configure_thread_config(vka, vspace, vspace, config, &handler->thread)) {
+            ZF_LOGE("Failed to configure fault handler %zu", i);
+            goto error;
+        }
+        service->num_handlers++;
+        if (num_cores > 1 && sel4utils_set_sched_affinity(&handler->thread, config.sched_params)) {
+            ZF_LOGE("Failed to pin fault handler %zu", i);
+            goto error;
+        }
+        NAME_THREAD(handler->thread.tcb.cptr, "fault handler");
+    }
+
+    for (size_t i = 0; i < service->num_handlers; i++) {
+        sel4utils_fault_handler_t *handler = &service->handlers[i];
+        if (sel4utils_start_thread(&handler->thread, (sel4utils_thread_entry_fn) fault_handler, handler, NULL, 1)) {
+            ZF_LOGE("Failed to start fault handler %zu", i);
+            goto error;
+        }
+    }
+    return 0;
+
+error:
+    sel4utils_fault_service_destroy(vka, vspace, service);
+    return -1;
+}
+
+void sel4utils_fault_service_destroy(vka_t *vka, vspace_t *vspace, sel4utils_fault_service_t *service)
+{
+    for (size_t i = 0; i < service->num_handlers; i++) {
+        sel4utils_clean_up_thread(vka, vspace, &service->handlers[i].thread);
+    }
+    for (size_t i = 0; i < service->max_clients; i++) {
+        if (service->clients[i].in_use) {
+            sel4utils_fault_service_remove_client(service, vka, &service->clients[i]);
+        }
+    }
+    if (service->endpoint.cptr != seL4_CapNull) {
+        vka_free_object(vka, &service->endpoint);
+    }
+    free(service->handlers);
+    free(service->clients);
+    memset(service, 0, sizeof(*service));
+}
+
+int sel4utils_fault_service_add_client(sel4utils_fault_service_t *service, vka_t *vka, const char *name,
+                                       seL4_CPtr tcb, vspace_t *vspace, sel4utils_fault_client_t **client)
+{
+    sel4utils_fault_client_t *new = NULL;
+    size_t i;
+
+    sel4utils_lock(&service->lock);
+    for (i = 0; i < service->max_clients; i++) {
+        if (!service->clients[i].in_use) {
+            new = &service->clients[i];
+            *new = (sel4utils_fault_client_t) {
+                .in_use = true,
+                .name = name,
+                .tcb = tcb,
+                .vspace = vspace,
+            };
+            break;
+        }
+    }
+    sel4utils_unlock(&service->lock);
+    if (new == NULL) {
+        ZF_LOGE("Fault service has no room for another client");
+        return -1;
+    }
+
+    seL4_CPtr slot;
+    if (vka_cspace_alloc(vka, &slot)) {
+        ZF_LOGE("Failed to allocate slot for fault endpoint of client");
+        goto error;
+    }
+    vka_cspace_make_path(vka, slot, &new->endpoint);
+    cspacepath_t src;
+    vka_cspace_make_path(vka, service->endpoint.cptr, &src);
+    if (vka_cnode_mint(&new->endpoint, &src, seL4_AllRights, i + 1)) {
+        ZF_LOGE("Failed to mint fault endpoint of client");
+        vka_cspace_free(vka, slot);
+        goto error;
+    }
+    *client = new;
+    return 0;
+
+error:
+    sel4utils_lock(&service->lock);
+    new->in_use = false;
+    sel4utils_unlock(&service->lock);
+    return -1;
+}
+
+void sel4utils_fault_service_remove_client(sel4utils_fault_service_t *service, vka_t *vka,
+                                           sel4utils_fault_client_t *client)
+{
+    /* The badge goes to the next client added to this entry, so faults the client sent
+     * that are still queued on the endpoint must not be received as that client's. */
+    if (vka_cnode_cancelBadgedSends(&client->endpoint)) {
+        ZF_LOGE("Failed to cancel queued faults of client");
+    }
+    vka_cnode_delete(&client->endpoint);
+    vka_cspace_free(vka, client->endpoint.capPtr);
+
+    sel4utils_lock(&service->lock);
+    free(client->regions);
+    *client = (sel4utils_fault_client_t) {
+        .in_use = false,
+    };
+    sel4utils_unlock(&service->lock);
+}
+
+int sel4utils_fault_service_add_region(sel4utils_fault_service_t *service, sel4utils_fault_client_t *client,
+                                       reservation_t reservation, sel4utils_fault_fn fn, void *cookie)
+{
+    sel4utils_res_t *res = reservation_to_res(reservation);
+    if (res == NULL || fn == NULL) {
+        ZF_LOGE("Invalid region for fault service");
+        return -1;
+    }
+
+    int error = 0;
+    sel4utils_lock(&service->lock);
+    if (client->num_regions == client->max_regions) {
+        size_t max = MAX(client->max_regions * 2, FAULT_SERVICE_MIN_REGIONS);
+        sel4utils_fault_region_t *regions = realloc(client->regions, max * sizeof(*regions));
+        if (regions == NULL) {
+            ZF_LOGE("Failed to grow regions of client");
+            error = -1;
+            goto out;
+        }
+        client->regions = regions;
+        client->max_regions = max;
+    }
+
+    size_t i = region_before(client, res->start) + 1;
+    if ((i > 0 && client->regions[i - 1].end > res->start) ||
+        (i < client->num_regions && client->regions[i].start < res->end)) {
+        ZF_LOGE("Region overlaps one the client already has");
+        error = -1;
+        goto out;
+    }
+    memmove(&client->regions[i + 1], &client->regions[i], (client->num_regions - i) * sizeof(*client->regions));
+    client->regions[i] = (sel4utils_fault_region_t) {
+        .start = res->start,
+        .end = res->end,
+        .fn = fn,
+        .cookie = cookie,
+    };
+    client->num_regions++;
+
+out:
+    sel4utils_unlock(&service->lock);
+    return error;
+}
+
+int sel4utils_fault_service_remove_region(sel4utils_fault_service_t *service, sel4utils_fault_client_t *client,
+                                          reservation_t reservation)
+{
+    sel4utils_res_t *res = reservation_to_res(reservation);
+    if (res == NULL) {
+        return -1;
+    }
+
+    int error = -1;
+    sel4utils_lock(&service->lock);
+    ssize_t i = region_before(client, res->start);
+    if (i >= 0 && client->regions[i].start == res->start) {
+        client->num_regions--;
+        memmove(&client->regions[i], &client->regions[i + 1],
+                (client->num_regions - i) * sizeof(*client->regions));
+        error = 0;
+    }
+    sel4utils_unlock(&service->lock);
+    return error;
+}
+
+int sel4utils_fault_read_regs(sel4utils_fault_t *fault)
+{
+    int error = seL4_TCB_ReadRegisters(fault->client->tcb, false, 0, sizeof(seL4_UserContext) / sizeof(seL4_Word),
+                                       &fault->regs);
+    if (error) {
+        ZF_LOGE("Failed to read registers of [%s]", fault->client->name);
+    }
+    return error;
+}
+
+void sel4utils_fault_service_stats(sel4utils_fault_service_t *service, sel4utils_fault_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (size_t i = 0; i < service->num_handlers; i++) {
+        sel4utils_fault_stats_t *handler = &service->handlers[i].stats;
+        stats->faults += handler->faults;
+        stats->unhandled += handler->unhandled;
+        stats->cycles += handler->cycles;
+        stats->max_cycles = MAX(stats->max_cycles, handler->max_cycles);
+    }
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+
+#include <utils/util.h>
+#include <sel4utils/tasks.h>
+#include <sel4utils/init_phases.h>
+
+struct sel4utils_init_run {
+    sel4utils_task_runtime_t *runtime;
+    sel4utils_init_phase_t *phases;
+    size_t num_phases;
+    sel4utils_task_group_t group;
+};
+
+/* Check that the phases can all be run, by running them on paper */
+static bool phases_valid(sel4utils_init_phase_t *phases, size_t num_phases)
+{
+    uint64_t all = num_phases == SEL4UTILS_INIT_PHASES_MAX ? UINT64_MAX : BIT_ULL(num_phases) - 1;
+    uint64_t done = 0;
+    bool progress = true;
+
+    for (size_t i = 0; i < num_phases; i++) {
+        if (phases[i].after & ~all) {
+            ZF_LOGE("Init phase %s depends on a phase that does not exist", phases[i].name);
+            return false;
+        }
+    }
+    while (done != all && progress) {
+        progress = false;
+        for (size_t i = 0; i < num_phases; i++) {
+            if (!(done & BIT_ULL(i)) && (phases[i].after & ~done) == 0) {
+                done |= BIT_ULL(i);
+                progress = true;
+            }
+        }
+    }
+    if (done != all) {
+        ZF_LOGE("Init phases depend on each other in a cycle");
+        return false;
+    }
+    return true;
+}
+
+static void phase_run(sel4utils_init_phase_t *phase)
+{
+    struct sel4utils_init_run *run = phase->run;
+    uint64_t after = phase->after;
+
+    while (after) {
+        sel4utils_init_phase_t *dependency = &run->phases[CTZLL(after)];
+        /* the acquire in phase_finish orders this after the dependency's result */
+        if (dependency->result != 0) {
+            phase->result = -1;
+            return;
+        }
+        after &= after - 1;
+    }
+    phase->result = phase->fn(phase->arg);
+    if (phase->result != 0) {
+        ZF_LOGE("Init phase %s failed: %d", phase->name, phase->result);
+    }
+}
+
+/* Mark a phase as complete, returning the phases that are now ready to run */
+static uint64_t phase_finish(sel4utils_init_phase_t *phase)
+{
+    struct sel4utils_init_run *run = phase->run;
+    uint64_t bit = BIT_ULL(phase - run->phases);
+    uint64_t ready = 0;
+
+    for (size_t i = 0; i < run->num_phases; i++) {
+        if ((run->phases[i].after & bit) && __atomic_sub_fetch(&run->phases[i].waiting, 1, __ATOMIC_ACQ_REL) == 0) {
+            ready |= BIT_ULL(i);
+        }
+    }
+    return ready;
+}
+
+static void phase_task(void *arg)
+{
+    sel4utils_init_phase_t *phase = arg;
+    struct sel4utils_init_run *run = phase->run;
+
+    phase_run(phase);
+    uint64_t ready = phase_finish(phase);
+    while (ready) {
+        sel4utils_task_spawn(run->runtime, &run->phases[CTZLL(ready)].task);
+        ready &= ready - 1;
+    }
+}
+
+int sel4utils_init_phases_run(sel4utils_task_runtime_t *runtime, sel4utils_init_phase_t *phases,
+                              size_t num_phases)
+{
+    struct sel4utils_init_run run = {
+        .runtime = runtime,
+        .phases = phases,
+        .num_phases = num_phases,
+    };
+    uint64_t ready = 0;
+
+    if (num_phases > SEL4UTILS_INIT_PHASES_MAX) {
+        ZF_LOGE("At most %d init phases are supported", SEL4UTILS_INIT_PHASES_MAX);
+        return -1;
+    }
+    if (!phases_valid(phases, num_phases)) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < num_phases; i++) {
+        phases[i].result = 0;
+        phases[i].waiting = __builtin_popcountll(phases[i].after);
+        phases[i].run = &run;
+        phases[i].task = (sel4utils_task_t) {
+            .fn = phase_task,
+            .arg = &phases[i],
+            .group = &run.group,
+        };
+        if (phases[i].waiting == 0) {
+            ready |= BIT_ULL(i);
+        }
+    }
+
+    if (runtime == NULL) {
+        while (ready) {
+            sel4utils_init_phase_t *phase = &phases[CTZLL(ready)];
+            ready &= ready - 1;
+            phase_run(phase);
+            ready |= phase_finish(phase);
+        }
+    } else {
+        while (ready) {
+            sel4utils_task_spawn(runtime, &phases[CTZLL(ready)].task);
+            ready &= ready - 1;
+        }
+        sel4utils_task_group_wait(runtime, &run.group);
+    }
+
+    for (size_t i = 0; i < num_phases; i++) {
+        if (phases[i].result != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -17,126 +17,339 @@
 #include <string.h>
 #include <utils/zf_log.h>
 
+/* The IOMMUs we support only take 4K mappings */
+#define IOSPACE_PAGE_BITS seL4_PageBits
+
+/* A page aligned range of vaddrs that is mapped into every iospace and the number of
+ * unreleased alloc_iospace calls that cover it. Extents are disjoint and kept sorted.
+ * The copies of the frame caps are only recorded in the iospaces, which are mapped
+ * with a cookie of 0 so unmapping an extent with our vka deletes and frees them.
+ * In sticky mode extents whose count drops to 0 stay mapped, on an LRU list, so mapping
+ * the same range again needs no kernel calls */
+typedef struct iommu_extent {
+    uintptr_t start;
+    uintptr_t end;
+    size_t refcount;
+    struct iommu_extent *next;
+    /* only valid while refcount is 0, head of the list is the most recently released */
+    struct iommu_extent *lru_prev;
+    struct iommu_extent *lru_next;
+} iommu_extent_t;
+
 typedef struct dma_man {
     vka_t vka;
     vspace_t vspace;
     int num_iospaces;
     vspace_t *iospaces;
     sel4utils_alloc_data_t *iospace_data;
+    iommu_extent_t *extents;
+    /* 0 unless sticky, in which case up to this many idle pages stay mapped */
+    size_t max_idle_pages;
+    size_t num_idle_pages;
+    iommu_extent_t *lru_head;
+    iommu_extent_t *lru_tail;
 } dma_man_t;
 
+static inline size_t extent_pages(iommu_extent_t *extent)
+{
+    return (extent->end - extent->start) / PAGE_SIZE_4K;
+}
+
+/* Put extent on the LRU list after prev, or at the head if prev is NULL */
+static void lru_insert(dma_man_t *dma, iommu_extent_t *prev, iommu_extent_t *extent)
+{
+    extent->lru_prev = prev;
+    extent->lru_next = prev ? prev->lru_next : dma->lru_head;
+    if (extent->lru_next) {
+        extent->lru_next->lru_prev = extent;
+    } else {
+        dma->lru_tail = extent;
+    }
+    if (prev) {
+        prev->lru_next = extent;
+    } else {
+        dma->lru_head = extent;
+    }
+}
+
+static void lru_remove(dma_man_t *dma, iommu_extent_t *extent)
+{
+    if (extent->lru_prev) {
+        extent->lru_prev->lru_next = extent->lru_next;
+    } else {
+        dma->lru_head = extent->lru_next;
+    }
+    if (extent->lru_next) {
+        extent->lru_next->lru_prev = extent->lru_prev;
+    } else {
+        dma->lru_tail = extent->lru_prev;
+    }
+}
+
+/* Make sure no extent crosses addr. Returns the link that the first extent at or after
+ * addr hangs off */
+static iommu_extent_t **split_at(dma_man_t *dma, uintptr_t addr)
+{
+    iommu_extent_t **link = &dma->extents;
+    while (*link != NULL && (*link)->end <= addr) {
+        link = &(*link)->next;
+    }
+    iommu_extent_t *extent = *link;
+    if (extent != NULL && extent->start < addr) {
+        iommu_extent_t *tail = malloc(sizeof(*tail));
+        if (!tail) {
+            ZF_LOGE("Failed to malloc %zu bytes", sizeof(*tail));
+            return NULL;
+        }
+        *tail = *extent;
+        tail->start = addr;
+        extent->end = addr;
+        extent->next = tail;
+        if (extent->refcount == 0) {
+            /* both halves are as old as each other */
+            lru_insert(dma, extent, tail);
+        }
+        link = &extent->next;
+    }
+    return link;
+}
+
+static void unmap_extent(dma_man_t *dma, uintptr_t start, uintptr_t end)
+{
+    for (int i = 0; i < dma->num_iospaces; i++) {
+        vspace_unmap_pages(dma->iospaces + i, (void *)start, (end - start) / PAGE_SIZE_4K, IOSPACE_PAGE_BITS, &dma->vka);
+    }
+}
+
+/* Join neighbouring extents that have the same count so the list stays short */
+static void merge_extents(dma_man_t *dma)
+{
+    iommu_extent_t *extent = dma->extents;
+    while (extent != NULL && extent->next != NULL) {
+        iommu_extent_t *next = extent->next;
+        if (extent->end == next->start && extent->refcount == next->refcount) {
+            if (next->refcount == 0) {
+                lru_remove(dma, next);
+            }
+            extent->end = next->end;
+            extent->next = next->next;
+            free(next);
+        } else {
+            extent = next;
+        }
+    }
+}
+
+/* Unmap and free the least recently released idle extents until at most limit idle
+ * pages are left mapped */
+static void evict_idle(dma_man_t *dma, size_t limit)
+{
+    while (dma->num_idle_pages > limit) {
+        iommu_extent_t *extent = dma->lru_tail;
+        assert(extent && extent->refcount == 0);
+        lru_remove(dma, extent);
+        dma->num_idle_pages -= extent_pages(extent);
+        unmap_extent(dma, extent->start, extent->end);
+        iommu_extent_t **link = &dma->extents;
+        while (*link != extent) {
+            link = &(*link)->next;
+        }
+        *link = extent->next;
+        free(extent);
+    }
+}
+
 static void unmap_range(dma_man_t *dma, uintptr_t addr, size_t size)
 {
     uintptr_t start = ROUND_DOWN(addr, PAGE_SIZE_4K);
-    uintptr_t end = addr + size;
-    for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE_4K) {
-        for (int i = 0; i < dma->num_iospaces; i++) {
-            uintptr_t *cookie = (uintptr_t *)vspace_get_cookie(dma->iospaces + i, (void *)addr);
-            assert(cookie);
-            (*cookie)--;
-            if (*cookie == 0) {
-                seL4_CPtr page = vspace_get_cap(dma->iospaces + i, (void *)addr);
-                cspacepath_t page_path;
-                assert(page);
-                vspace_unmap_pages(dma->iospaces + i, (void *)addr, 1, seL4_PageBits, NULL);
-                vka_cspace_make_path(&dma->vka, page, &page_path);
-                vka_cnode_delete(&page_path);
-                vka_cspace_free(&dma->vka, page);
-                free(cookie);
-            }
+    uintptr_t end = ROUND_UP(addr + size, PAGE_SIZE_4K);
+    if (split_at(dma, end) == NULL) {
+        ZF_LOGE("Failed to split extent, leaving range mapped");
+        return;
+    }
+    iommu_extent_t **link = split_at(dma, start);
+    if (link == NULL) {
+        ZF_LOGE("Failed to split extent, leaving range mapped");
+        return;
+    }
+    while (*link != NULL && (*link)->start < end) {
+        iommu_extent_t *extent = *link;
+        assert(extent->refcount > 0);
+        extent->refcount--;
+        if (extent->refcount == 0 && dma->max_idle_pages > 0) {
+            lru_insert(dma, NULL, extent);
+            dma->num_idle_pages += extent_pages(extent);
+            link = &extent->next;
+        } else if (extent->refcount == 0) {
+            unmap_extent(dma, extent->start, extent->end);
+            *link = extent->next;
+            free(extent);
+        } else {
+            link = &extent->next;
         }
     }
+    merge_extents(dma);
+    evict_idle(dma, dma->max_idle_pages);
 }
 
-int sel4utils_iommu_dma_alloc_iospace(void *cookie, void *vaddr, size_t size)
+/* Map [start, end), which must not be covered by any extent, into every iospace and
+ * record it as a new extent at link */
+static int map_extent(dma_man_t *dma, iommu_extent_t **link, uintptr_t start, uintptr_t end)
 {
-    dma_man_t *dma = (dma_man_t *)cookie;
+    size_t num_pages = (end - start) / PAGE_SIZE_4K;
+    size_t num_caps = num_pages * dma->num_iospaces;
     int error;
-
-    /* for each page duplicate and map it into all the iospaces */
-    uintptr_t start = ROUND_DOWN((uintptr_t)vaddr, PAGE_SIZE_4K);
-    uintptr_t end = (uintptr_t)vaddr + size;
-    seL4_CPtr last_page = 0;
-    for (uintptr_t addr = start; addr < end; addr += PAGE_SIZE_4K) {
-        cspacepath_t page_path;
-        seL4_CPtr page = vspace_get_cap(&dma->vspace, (void *)addr);
-        if (!page) {
+    seL4_CPtr *pages = malloc(sizeof(*pages) * num_pages);
+    seL4_CPtr *copies = malloc(sizeof(*copies) * num_caps);
+    iommu_extent_t *extent = malloc(sizeof(*extent));
+    if (!pages || !copies || !extent) {
+        ZF_LOGE("Failed to malloc book keeping for %zu pages", num_pages);
+        goto error;
+    }
+    for (size_t i = 0; i < num_pages; i++) {
+        pages[i] = vspace_get_cap(&dma->vspace, (void *)(start + i * PAGE_SIZE_4K));
+        if (!pages[i]) {
             ZF_LOGE("Failed to retrieve frame cap for malloc region. "
                     "Is your malloc backed by the correct vspace? "
                     "If you allocated your own buffer, does the dma manager's vspace "
                     "know about the caps to the frames that back the buffer?");
-            unmap_range(dma, start, addr + 1);
-            return -1;
+            goto error;
         }
-        if (page == last_page) {
+        if (i > 0 && pages[i] == pages[i - 1]) {
             ZF_LOGE("Found the same frame two pages in a row. We only support 4K mappings");
-            unmap_range(dma, start, addr + 1);
-            return -1;
-        }
-        last_page = page;
-        vka_cspace_make_path(&dma->vka, page, &page_path);
-        /* work out the size of this page */
-        for (int i = 0; i < dma->num_iospaces; i++) {
-            /* see if its already mapped */
-            uintptr_t *cookie = (uintptr_t *)vspace_get_cookie(dma->iospaces + i, (void *)addr);
-            if (cookie) {
-                /* increment the counter */
-                (*cookie)++;
+            goto error;
+        }
+    }
+    /* one batch of slots for the copies in every iospace */
+    error = vka_cspace_alloc_n(&dma->vka, num_caps, copies);
+    if (error) {
+        ZF_LOGE("Failed to allocate slots");
+        goto error;
+    }
+    int mapped;
+    for (mapped = 0; mapped < dma->num_iospaces; mapped++) {
+        seL4_CPtr *caps = copies + mapped * num_pages;
+        size_t copied;
+        for (copied = 0; copied < num_pages; copied++) {
+            cspacepath_t page_path, copy_path;
+            vka_cspace_make_path(&dma->vka, pages[copied], &page_path);
+            vka_cspace_make_path(&dma->vka, caps[copied], &copy_path);
+            error = vka_cnode_copy(&copy_path, &page_path, seL4_AllRights);
+            if (error) {
+                ZF_LOGE("Failed to copy frame cap");
+                break;
+            }
+        }
+        if (copied == num_pages) {
+            reservation_t res = vspace_reserve_range_at(dma->iospaces + mapped, (void *)start, end - start,
+                                                        seL4_AllRights, 1);
+            if (!res.res) {
+                ZF_LOGE("Failed to create a reservation");
             } else {
-                cspacepath_t copy_path;
-                /* allocate slot for the cap */
-                error = vka_cspace_alloc_path(&dma->vka, &copy_path);
-                if (error) {
-                    ZF_LOGE("Failed to allocate slot");
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                /* copy the cap */
-                error = vka_cnode_copy(&copy_path, &page_path, seL4_AllRights);
-                if (error) {
-                    ZF_LOGE("Failed to copy frame cap");
-                    vka_cspace_free(&dma->vka, copy_path.capPtr);
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
+                error = vspace_map_pages_at_vaddr(dma->iospaces + mapped, caps, NULL, (void *)start, num_pages,
+                                                  IOSPACE_PAGE_BITS, res);
+                vspace_free_reservation(dma->iospaces + mapped, res);
+                if (!error) {
+                    continue;
                 }
-                /* now map it in */
-                reservation_t res = vspace_reserve_range_at(dma->iospaces + i, (void *)addr, PAGE_SIZE_4K, seL4_AllRights, 1);
-                if (!res.res) {
-                    ZF_LOGE("Failed to create a reservation");
-                    vka_cnode_delete(&copy_path);
-                    vka_cspace_free(&dma->vka, copy_path.capPtr);
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                cookie = malloc(sizeof(*cookie));
-                if (!cookie) {
-                    ZF_LOGE("Failed to malloc %zu bytes", sizeof(*cookie));
-                    vspace_free_reservation(dma->iospaces + i, res);
-                    vka_cnode_delete(&copy_path);
-                    vka_cspace_free(&dma->vka, copy_path.capPtr);
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                *cookie = 1;
-                error = vspace_map_pages_at_vaddr(dma->iospaces + i, &copy_path.capPtr, (uintptr_t *)&cookie, (void *)addr, 1,
-                                                  seL4_PageBits, res);
-                if (error) {
-                    ZF_LOGE("Failed to map frame into iospace");
-                    free(cookie);
-                    vspace_free_reservation(dma->iospaces + i, res);
-                    vka_cnode_delete(&copy_path);
-                    vka_cspace_free(&dma->vka, copy_path.capPtr);
-                    unmap_range(dma, start, addr + 1);
-                    return -1;
-                }
-                vspace_free_reservation(dma->iospaces + i, res);
+                ZF_LOGE("Failed to map frames into iospace");
+                vspace_unmap_pages(dma->iospaces + mapped, (void *)start, num_pages, IOSPACE_PAGE_BITS, NULL);
+            }
+        }
+        /* tidy up this iospace's copies, the iospaces before us are undone below */
+        for (size_t i = 0; i < num_pages; i++) {
+            cspacepath_t copy_path;
+            vka_cspace_make_path(&dma->vka, caps[i], &copy_path);
+            if (i < copied) {
+                vka_cnode_delete(&copy_path);
+            }
+            vka_cspace_free(&dma->vka, caps[i]);
+        }
+        for (size_t i = (mapped + 1) * num_pages; i < num_caps; i++) {
+            vka_cspace_free(&dma->vka, copies[i]);
+        }
+        for (int i = 0; i < mapped; i++) {
+            vspace_unmap_pages(dma->iospaces + i, (void *)start, num_pages, IOSPACE_PAGE_BITS, &dma->vka);
+        }
+        goto error;
+    }
+    free(pages);
+    free(copies);
+    extent->start = start;
+    extent->end = end;
+    extent->refcount = 1;
+    extent->next = *link;
+    *link = extent;
+    return 0;
+error:
+    free(pages);
+    free(copies);
+    free(extent);
+    return -1;
+}
+
+static int alloc_iospace(dma_man_t *dma, void *vaddr, size_t size)
+{
+    uintptr_t start = ROUND_DOWN((uintptr_t)vaddr, PAGE_SIZE_4K);
+    uintptr_t end = ROUND_UP((uintptr_t)vaddr + size, PAGE_SIZE_4K);
+    if (split_at(dma, end) == NULL) {
+        return -1;
+    }
+    iommu_extent_t **link = split_at(dma, start);
+    if (link == NULL) {
+        return -1;
+    }
+    /* take a reference on the extents already there and map the gaps between them */
+    uintptr_t done = start;
+    while (done < end) {
+        iommu_extent_t *extent = *link;
+        uintptr_t gap_end = (extent != NULL && extent->start < end) ? extent->start : end;
+        if (done < gap_end) {
+            if (map_extent(dma, link, done, gap_end)) {
+                unmap_range(dma, start, done - start);
+                return -1;
+            }
+        } else {
+            if (extent->refcount == 0) {
+                /* still mapped from last time */
+                lru_remove(dma, extent);
+                dma->num_idle_pages -= extent_pages(extent);
             }
+            extent->refcount++;
         }
+        done = (*link)->end;
+        link = &(*link)->next;
+    }
+    merge_extents(dma);
+
+    return 0;
+}
+
+int sel4utils_iommu_dma_alloc_iospace(void *cookie, void *vaddr, size_t size)
+{
+    dma_man_t *dma = (dma_man_t *)cookie;
+    int error = alloc_iospace(dma, vaddr, size);
+    if (error && dma->num_idle_pages > 0) {
+        /* idle mappings may be what we are short of, give them back and try again */
+        evict_idle(dma, 0);
+        error = alloc_iospace(dma, vaddr, size);
     }
+    return error;
+}
 
+int sel4utils_iommu_dma_set_sticky(ps_dma_man_t *dma_man, size_t max_idle_pages)
+{
+    dma_man_t *dma = dma_man->cookie;
+    dma->max_idle_pages = max_idle_pages;
+    evict_idle(dma, max_idle_pages);
     return 0;
 }
 
+void sel4utils_iommu_dma_flush(ps_dma_man_t *dma_man)
+{
+    evict_idle(dma_man->cookie, 0);
+}
+
 static void *dma_alloc(void *cookie, size_t size, int align, int cached, ps_mem_flags_t flags)
 {
     int error;
@@ -13,16 +13,31 @@
 #include <stdlib.h>
 #include <string.h>
 #include <platsupport/irq.h>
+#include <sel4platsupport/gen_config.h>
 #include <sel4platsupport/irq.h>
+#include <sel4utils/ring.h>
 
 #include <utils/util.h>
 
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+#include <sel4bench/sel4bench.h>
+#endif
+
 #define IRQ_SERVER_MESSAGE_LENGTH 2
 
+/* An IRQ bound to a node, and the time handling it took in the last balancing window */
+typedef struct irq_server_irq {
+    irq_id_t irq_id;
+    uint64_t cycles;
+    uint64_t load;
+} irq_server_irq_t;
+
 typedef struct irq_server_node {
     seL4_CPtr ntfn;
     size_t max_irqs_bound;
     size_t num_irqs_bound;
+    /* The first num_irqs_bound are in use */
+    irq_server_irq_t *irqs;
 } irq_server_node_t;
 
 typedef struct irq_server_thread irq_server_thread_t;
@@ -33,7 +48,15 @@ struct irq_server_thread {
     irq_server_node_t *node;
     seL4_CPtr delivery_ep;
     seL4_Word label;
+    /* Ring to deliver IRQs through instead, if not NULL */
+    sel4utils_ring_t *ring;
     sel4utils_thread_t thread;
+    /* Core the thread is pinned to, -1 if it is not */
+    int core;
+    /* Polling mode, if poll.poll_fn is set */
+    irq_server_poll_t poll;
+    /* Cycles spent handling the IRQs of the node in the last balancing window */
+    uint64_t load;
     /* Linked list chain of threads */
     irq_server_thread_t *next;
 };
@@ -42,11 +65,20 @@ struct irq_server_thread {
 struct irq_server {
     seL4_CPtr delivery_ep;
     seL4_Word label;
+    /* Ring delivery: the threads' view, which signals the consumer, and the consumer's */
+    bool has_ring;
+    sel4utils_ring_t ring;
+    sel4utils_ring_t ring_consumer;
     vka_object_t reply;
     irq_server_thread_t *server_threads;
+    size_t num_threads;
     size_t num_irqs;
     size_t max_irqs;
 
+    /* Load balancing, if balance.max_threads is set, and when the last window started */
+    irq_server_balance_t balance;
+    uint64_t balance_start;
+
     /* New thread parameters */
     seL4_Word priority;
     seL4_CPtr cspace;
@@ -94,6 +126,9 @@ static irq_id_t irq_server_node_register_irq(irq_server_node_t *node, ps_irq_t i
         return error;
     }
 
+    node->irqs[node->num_irqs_bound] = (irq_server_irq_t) {
+        .irq_id = irq_id
+    };
     node->num_irqs_bound++;
 
     /* Success, return the ID that was assigned to the IRQ */
@@ -107,6 +142,11 @@ static irq_server_node_t *irq_server_node_new(seL4_CPtr ntfn, size_t max_irqs_bo
     irq_server_node_t *new_node = NULL;
     ps_calloc(malloc_ops, 1, sizeof(irq_server_node_t), (void **) &new_node);
     if (new_node) {
+        ps_calloc(malloc_ops, max_irqs_bound, sizeof(irq_server_irq_t), (void **) &new_node->irqs);
+        if (new_node->irqs == NULL) {
+            ps_free(malloc_ops, sizeof(irq_server_node_t), new_node);
+            return NULL;
+        }
         new_node->ntfn = ntfn;
         new_node->max_irqs_bound = max_irqs_bound;
     }
@@ -116,6 +156,36 @@ static irq_server_node_t *irq_server_node_new(seL4_CPtr ntfn, size_t max_irqs_bo
 /* IRQ handler thread. Wait on a notification object for IRQs. When one arrives, send a
  * synchronous message to the registered endpoint. If no synchronous endpoint was
  * registered, call the appropriate handler function directly (must be thread safe) */
+/* Keep calling the poll function, and handling anything else that arrives on our
+ * notification, until it runs out of work or we run out of budget */
+static void irq_server_thread_poll(irq_server_thread_t *my_thread_info, ps_irq_ops_t *irq_ops)
+{
+    irq_server_poll_t *poll = &my_thread_info->poll;
+    size_t empty_polls = 0;
+    for (size_t polls = 0; empty_polls < poll->max_empty_polls && (poll->max_polls == 0 || polls < poll->max_polls);
+         polls++) {
+        seL4_Word badge = 0;
+        seL4_Poll(my_thread_info->node->ntfn, &badge);
+        if (badge) {
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+            sel4platsupport_irq_trace_wake(irq_ops, my_thread_info->thread_id);
+#endif
+            irq_server_node_handle_irq(my_thread_info, irq_ops, badge);
+        }
+        if (poll->poll_fn(poll->data) > 0) {
+            empty_polls = 0;
+        } else {
+            empty_polls++;
+            if (poll->yield) {
+                seL4_Yield();
+            }
+        }
+    }
+    if (poll->complete_fn) {
+        poll->complete_fn(poll->data);
+    }
+}
+
 static void _irq_thread_entry(irq_server_thread_t *my_thread_info, ps_irq_ops_t *irq_ops)
 {
     seL4_CPtr ep;
@@ -132,7 +202,18 @@ static void _irq_thread_entry(irq_server_thread_t *my_thread_info, ps_irq_ops_t
     while (1) {
         seL4_Word badge = 0;
         seL4_Wait(ntfn, &badge);
-        if (ep != seL4_CapNull) {
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+        sel4platsupport_irq_trace_wake(irq_ops, my_thread_info->thread_id);
+#endif
+        if (my_thread_info->ring != NULL) {
+            /* Each event is the badge and who it came to, the consumer hands it back to
+             * irq_server_handle_irq_ring */
+            sel4utils_ring_desc_t event = { .addr = thread_info_ptr, .len = 0, .cookie = badge };
+            while (sel4utils_ring_enqueue(my_thread_info->ring, &event, 1) == 0) {
+                /* Full, let the consumer catch up */
+                seL4_Yield();
+            }
+        } else if (ep != seL4_CapNull) {
             /* Synchronous endpoint registered. Send IPC */
             seL4_MessageInfo_t info = seL4_MessageInfo_new(label, 0, 0, IRQ_SERVER_MESSAGE_LENGTH);
             seL4_SetMR(0, badge);
@@ -141,12 +222,15 @@ static void _irq_thread_entry(irq_server_thread_t *my_thread_info, ps_irq_ops_t
         } else {
             /* No synchronous endpoint. Get the IRQ interface to invoke callbacks */
             irq_server_node_handle_irq(my_thread_info, irq_ops, badge);
+            if (my_thread_info->poll.poll_fn) {
+                irq_server_thread_poll(my_thread_info, irq_ops);
+            }
         }
     }
 }
 
-thread_id_t irq_server_thread_new(irq_server_t *irq_server, seL4_CPtr provided_ntfn,
-                                  seL4_Word usable_mask, thread_id_t id_hint)
+static thread_id_t irq_server_thread_new_common(irq_server_t *irq_server, seL4_CPtr provided_ntfn,
+                                                seL4_Word usable_mask, thread_id_t id_hint, int core)
 {
     int error;
 
@@ -214,12 +298,23 @@ thread_id_t irq_server_thread_new(irq_server_t *irq_server, seL4_CPtr provided_n
     /* Initialise structure */
     new_thread->delivery_ep = irq_server->delivery_ep;
     new_thread->label = irq_server->label;
+    new_thread->ring = irq_server->has_ring ? &irq_server->ring : NULL;
     new_thread->node = new_node;
     new_thread->thread_id = thread_id_to_use;
+    new_thread->core = core;
 
     /* Create the IRQ thread */
     sel4utils_thread_config_t config = thread_config_default(irq_server->simple, irq_server->cspace,
                                                              seL4_NilData, 0, irq_server->priority);
+    if (core >= 0) {
+        if (config_set(CONFIG_KERNEL_MCS)) {
+            /* seL4_Time measures time in us, the config parameter uses ms. */
+            seL4_Time timeslice_us = CONFIG_BOOT_THREAD_TIME_SLICE * US_IN_MS;
+            config.sched_params = sched_params_round_robin(config.sched_params, irq_server->simple, core, timeslice_us);
+        } else {
+            config.sched_params.core = core;
+        }
+    }
     error = sel4utils_configure_thread_config(irq_server->vka, irq_server->vspace,
                                               irq_server->vspace, config, &(new_thread->thread));
     if (error) {
@@ -227,6 +322,14 @@ thread_id_t irq_server_thread_new(irq_server_t *irq_server, seL4_CPtr provided_n
         goto fail;
     }
 
+    if (core >= 0 && CONFIG_MAX_NUM_NODES > 1) {
+        error = sel4utils_set_sched_affinity(&new_thread->thread, config.sched_params);
+        if (error) {
+            ZF_LOGE("Failed to pin IRQ server thread to core %d", core);
+            goto fail;
+        }
+    }
+
     bool thread_created = true;
 
     /* Start the thread */
@@ -240,6 +343,7 @@ thread_id_t irq_server_thread_new(irq_server_t *irq_server, seL4_CPtr provided_n
     /* Append this thread structure to the head of the list */
     new_thread->next = irq_server->server_threads;
     irq_server->server_threads = new_thread;
+    irq_server->num_threads++;
 
     return thread_id_to_use;
 
@@ -256,6 +360,7 @@ fail:
     }
 
     if (new_node) {
+        ps_free(irq_server->malloc_ops, new_node->max_irqs_bound * sizeof(irq_server_irq_t), new_node->irqs);
         ps_free(irq_server->malloc_ops, sizeof(irq_server_node_t), new_node);
     }
 
@@ -270,6 +375,56 @@ fail:
     return error;
 }
 
+int irq_server_new_ring_delivery(irq_server_t *irq_server, size_t size_bits, seL4_CPtr consumer_ntfn)
+{
+    if (irq_server == NULL) {
+        ZF_LOGE("irq_server is NULL");
+        return -EINVAL;
+    }
+
+    if (irq_server->delivery_ep != seL4_CapNull || irq_server->has_ring) {
+        ZF_LOGE("IRQ server already has a way of delivering IRQs");
+        return -EINVAL;
+    }
+
+    if (irq_server->server_threads != NULL) {
+        ZF_LOGE("Ring delivery must be set up before any threads are created");
+        return -EINVAL;
+    }
+
+    /* Threads never wait for room, so the consumer never needs to signal them */
+    int error = sel4utils_ring_create(irq_server->vspace, size_bits, true, consumer_ntfn, &irq_server->ring);
+    if (error) {
+        ZF_LOGE("Failed to create IRQ delivery ring");
+        return -ENOMEM;
+    }
+    sel4utils_ring_attach(irq_server->ring.shared, seL4_CapNull, &irq_server->ring_consumer);
+    irq_server->has_ring = true;
+
+    return 0;
+}
+
+size_t irq_server_handle_irq_ring(irq_server_t *irq_server, size_t max_events)
+{
+    sel4utils_ring_desc_t events[16];
+    size_t handled = 0;
+
+    while (handled < max_events) {
+        size_t n = sel4utils_ring_dequeue(&irq_server->ring_consumer, events, MIN(ARRAY_SIZE(events),
+                                                                                   max_events - handled));
+        if (n == 0) {
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            irq_server_node_handle_irq((irq_server_thread_t *) events[i].addr, &(irq_server->irq_ops),
+                                       events[i].cookie);
+        }
+        handled += n;
+    }
+
+    return handled;
+}
+
 void irq_server_handle_irq_ipc(irq_server_t *irq_server, seL4_MessageInfo_t msginfo)
 {
     seL4_Word badge = 0;
@@ -289,9 +444,56 @@ void irq_server_handle_irq_ipc(irq_server_t *irq_server, seL4_MessageInfo_t msgi
     }
 }
 
-/* Register for a function to be called when an IRQ arrives */
-irq_id_t irq_server_register_irq(irq_server_t *irq_server, ps_irq_t irq,
-                                 irq_callback_fn_t callback, void *callback_data)
+int irq_server_thread_set_polling(irq_server_t *irq_server, thread_id_t thread_id, irq_server_poll_t *poll)
+{
+    if (irq_server == NULL) {
+        ZF_LOGE("irq_server is NULL");
+        return -EINVAL;
+    }
+
+    if (irq_server->delivery_ep != seL4_CapNull || irq_server->has_ring) {
+        ZF_LOGE("Polling needs the IRQ server threads to call the callbacks themselves");
+        return -EINVAL;
+    }
+
+    if (poll && poll->poll_fn && poll->max_empty_polls == 0) {
+        ZF_LOGE("Polling needs a budget of at least one empty poll");
+        return -EINVAL;
+    }
+
+    for (irq_server_thread_t *st = irq_server->server_threads; st != NULL; st = st->next) {
+        if (st->thread_id == thread_id) {
+            if (poll) {
+                st->poll = *poll;
+            } else {
+                memset(&st->poll, 0, sizeof(st->poll));
+            }
+            return 0;
+        }
+    }
+
+    ZF_LOGE("No IRQ server thread with ID %d", thread_id);
+    return -ENOENT;
+}
+
+thread_id_t irq_server_thread_new(irq_server_t *irq_server, seL4_CPtr provided_ntfn,
+                                  seL4_Word usable_mask, thread_id_t id_hint)
+{
+    return irq_server_thread_new_common(irq_server, provided_ntfn, usable_mask, id_hint, -1);
+}
+
+thread_id_t irq_server_thread_new_on_core(irq_server_t *irq_server, seL4_CPtr provided_ntfn,
+                                          seL4_Word usable_mask, thread_id_t id_hint, seL4_Word core)
+{
+    if (core >= CONFIG_MAX_NUM_NODES) {
+        ZF_LOGE("Core %lu does not exist", (unsigned long) core);
+        return -EINVAL;
+    }
+    return irq_server_thread_new_common(irq_server, provided_ntfn, usable_mask, id_hint, core);
+}
+
+static irq_id_t irq_server_register_irq_common(irq_server_t *irq_server, ps_irq_t irq, int core,
+                                               irq_callback_fn_t callback, void *callback_data)
 {
     if (irq_server == NULL) {
         ZF_LOGE("irq_server is NULL");
@@ -303,7 +505,7 @@ irq_id_t irq_server_register_irq(irq_server_t *irq_server, ps_irq_t irq,
 
     /* Try to assign the IRQ to an existing node/thread */
     for (st = irq_server->server_threads; st != NULL; st = st->next) {
-        if (st->node->num_irqs_bound < st->node->max_irqs_bound) {
+        if ((core < 0 || st->core == core) && st->node->num_irqs_bound < st->node->max_irqs_bound) {
             /* thread_id is synonymous with a ntfn_id */
             ret_id = irq_server_node_register_irq(st->node, irq, callback, callback_data,
                                                   (ntfn_id_t) st->thread_id, irq_server);
@@ -318,6 +520,202 @@ irq_id_t irq_server_register_irq(irq_server_t *irq_server, ps_irq_t irq,
     return -ENOENT;
 }
 
+/* Register for a function to be called when an IRQ arrives */
+irq_id_t irq_server_register_irq(irq_server_t *irq_server, ps_irq_t irq,
+                                 irq_callback_fn_t callback, void *callback_data)
+{
+    return irq_server_register_irq_common(irq_server, irq, -1, callback, callback_data);
+}
+
+irq_id_t irq_server_register_irq_on_core(irq_server_t *irq_server, ps_irq_t irq, seL4_Word core,
+                                         irq_callback_fn_t callback, void *callback_data)
+{
+    if (irq_server == NULL) {
+        ZF_LOGE("irq_server is NULL");
+        return -EINVAL;
+    }
+
+#if defined(CONFIG_ARCH_ARM) && CONFIG_MAX_NUM_NODES > 1
+    /* Have the kernel deliver the IRQ to the same core */
+    if (irq.type == PS_TRIGGER) {
+        irq = (ps_irq_t) {
+            .type = PS_PER_CPU,
+            .cpu = { .number = irq.trigger.number, .trigger = irq.trigger.trigger, .cpu_idx = core }
+        };
+    } else if (irq.type == PS_INTERRUPT) {
+        irq = (ps_irq_t) {
+            .type = PS_PER_CPU, .cpu = { .number = irq.irq.number, .trigger = 0, .cpu_idx = core }
+        };
+    }
+#endif
+
+    return irq_server_register_irq_common(irq_server, irq, core, callback, callback_data);
+}
+
+int irq_server_set_balancing(irq_server_t *irq_server, irq_server_balance_t *balance)
+{
+    if (irq_server == NULL) {
+        ZF_LOGE("irq_server is NULL");
+        return -EINVAL;
+    }
+
+    if (balance == NULL) {
+        memset(&irq_server->balance, 0, sizeof(irq_server->balance));
+        return 0;
+    }
+
+#ifndef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    ZF_LOGE("Balancing needs LibSel4PlatSupportIrqTrace to measure how long IRQs take to handle");
+    return -ENOSYS;
+#else
+    if (balance->hot_pct == 0 || balance->hot_pct > 100) {
+        ZF_LOGE("Balancing needs a percentage of the window above which a thread is hot");
+        return -EINVAL;
+    }
+
+    irq_server->balance = *balance;
+    irq_server->balance_start = 0;
+    return 0;
+#endif
+}
+
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+/* Work out how long each IRQ, and the threads they are bound to, took to handle in the
+ * window that has just ended */
+static void irq_server_measure_load(irq_server_t *irq_server)
+{
+    for (irq_server_thread_t *st = irq_server->server_threads; st != NULL; st = st->next) {
+        st->load = 0;
+        for (size_t i = 0; i < st->node->num_irqs_bound; i++) {
+            irq_server_irq_t *irq = &st->node->irqs[i];
+            uint64_t cycles = 0;
+            sel4platsupport_irq_trace_load(&(irq_server->irq_ops), irq->irq_id, NULL, &cycles);
+            irq->load = cycles - irq->cycles;
+            irq->cycles = cycles;
+            st->load += irq->load;
+        }
+    }
+}
+
+/* The least loaded thread, other than hot, that can take an IRQ from it */
+static irq_server_thread_t *irq_server_coolest_thread(irq_server_t *irq_server, irq_server_thread_t *hot)
+{
+    irq_server_thread_t *coolest = NULL;
+    for (irq_server_thread_t *st = irq_server->server_threads; st != NULL; st = st->next) {
+        if (st == hot || st->core != hot->core || st->poll.poll_fn ||
+            st->node->num_irqs_bound >= st->node->max_irqs_bound) {
+            continue;
+        }
+        if (coolest == NULL || st->load < coolest->load) {
+            coolest = st;
+        }
+    }
+    return coolest;
+}
+
+/* Pair the index'th IRQ of from with the notification of to instead */
+static int irq_server_move_irq(irq_server_t *irq_server, irq_server_thread_t *from, size_t index,
+                               irq_server_thread_t *to)
+{
+    irq_server_irq_t irq = from->node->irqs[index];
+
+    int error = sel4platsupport_irq_unset_ntfn(&(irq_server->irq_ops), irq.irq_id);
+    if (error) {
+        return error;
+    }
+
+    /* thread_id is synonymous with a ntfn_id */
+    error = sel4platsupport_irq_set_ntfn(&(irq_server->irq_ops), (ntfn_id_t) to->thread_id, irq.irq_id, NULL);
+    if (error) {
+        ZF_LOGF_IF(sel4platsupport_irq_set_ntfn(&(irq_server->irq_ops), (ntfn_id_t) from->thread_id,
+                                                irq.irq_id, NULL), "Failed to return an IRQ to its thread");
+        return error;
+    }
+
+    from->node->num_irqs_bound--;
+    from->node->irqs[index] = from->node->irqs[from->node->num_irqs_bound];
+    to->node->irqs[to->node->num_irqs_bound] = irq;
+    to->node->num_irqs_bound++;
+    from->load -= irq.load;
+    to->load += irq.load;
+
+    return 0;
+}
+#endif /* CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE */
+
+int irq_server_rebalance(irq_server_t *irq_server)
+{
+    if (irq_server == NULL) {
+        ZF_LOGE("irq_server is NULL");
+        return -EINVAL;
+    }
+
+#ifdef CONFIG_LIB_SEL4_PLAT_SUPPORT_IRQ_TRACE
+    if (irq_server->balance.hot_pct == 0) {
+        ZF_LOGE("Balancing has not been set up with irq_server_set_balancing");
+        return -EINVAL;
+    }
+
+    uint64_t now = sel4bench_get_cycle_count();
+    uint64_t window = now - irq_server->balance_start;
+    bool first = irq_server->balance_start == 0;
+    irq_server->balance_start = now;
+
+    irq_server_measure_load(irq_server);
+    if (first) {
+        /* Nothing to compare against yet */
+        return 0;
+    }
+
+    uint64_t hot = (window / 100) * irq_server->balance.hot_pct;
+    int moved = 0;
+    for (irq_server_thread_t *st = irq_server->server_threads; st != NULL; st = st->next) {
+        /* A thread with one IRQ can't be helped by moving it */
+        if (st->load <= hot || st->node->num_irqs_bound < 2 || st->poll.poll_fn) {
+            continue;
+        }
+
+        irq_server_thread_t *to = irq_server_coolest_thread(irq_server, st);
+        if ((to == NULL || to->load > hot) && irq_server->num_threads < irq_server->balance.max_threads) {
+            /* New threads go at the head of the list, so this doesn't disturb the walk */
+            thread_id_t id = irq_server_thread_new_common(irq_server, seL4_CapNull, 0, -1, st->core);
+            if (id < 0) {
+                ZF_LOGW("Failed to create an IRQ server thread to balance onto");
+            } else {
+                to = irq_server->server_threads;
+            }
+        }
+        if (to == NULL || to->load >= st->load) {
+            continue;
+        }
+
+        /* Move the busiest IRQ that leaves both threads less loaded than st is now */
+        size_t best = st->node->num_irqs_bound;
+        for (size_t i = 0; i < st->node->num_irqs_bound; i++) {
+            uint64_t load = st->node->irqs[i].load;
+            if (load > 0 && load < st->load - to->load &&
+                (best == st->node->num_irqs_bound || load > st->node->irqs[best].load)) {
+                best = i;
+            }
+        }
+        if (best == st->node->num_irqs_bound) {
+            continue;
+        }
+
+        int error = irq_server_move_irq(irq_server, st, best, to);
+        if (error) {
+            ZF_LOGE("Failed to move an IRQ between IRQ server threads");
+            return error;
+        }
+        moved++;
+    }
+
+    return moved;
+#else
+    return -ENOSYS;
+#endif
+}
+
 irq_server_t *irq_server_new(vspace_t *vspace, vka_t *vka, seL4_Word priority,
                              simple_t *simple, seL4_CPtr cspace, seL4_CPtr delivery_ep, seL4_Word label,
                              size_t num_irqs, ps_malloc_ops_t *malloc_ops)
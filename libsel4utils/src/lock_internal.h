@@ -0,0 +1,24 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <sel4/sel4.h>
+
+/* Lock of book keeping shared between the threads of an address space, an int that is 0
+ * when free. Waiters yield instead of spinning, as the holder may be on the same core and
+ * of the same priority. */
+static inline void sel4utils_lock(volatile int *lock)
+{
+    while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) {
+        seL4_Yield();
+    }
+}
+
+static inline void sel4utils_unlock(volatile int *lock)
+{
+    __atomic_clear(lock, __ATOMIC_RELEASE);
+}
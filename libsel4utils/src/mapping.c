@@ -8,12 +8,17 @@
 #include <sel4utils/gen_config.h>
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sel4/sel4.h>
 #include <vka/object.h>
 #include <vka/capops.h>
 #include <sel4utils/mapping.h>
+#include <sel4utils/page_copy.h>
+#include <sel4utils/vspace.h>
 #include <sel4utils/util.h>
 #include <vspace/mapping.h>
+#include <vspace/page.h>
 
 static int map_page(vka_t *vka, vspace_map_page_fn_t map_page_fn, vspace_get_map_obj_fn map_obj_fn,
                     seL4_CPtr root, seL4_CPtr frame, void *vaddr, seL4_CapRights_t rights,
@@ -117,6 +122,188 @@ int sel4utils_map_ept_page(vka_t *vka, seL4_CPtr pd, seL4_CPtr frame, seL4_Word
     return error;
 }
 
+/* Paging structures of an EPT below its PML4, and the bits of guest physical address an
+ * entry of the level above them covers. A frame of size_bits needs every level that
+ * covers more than it */
+static const struct {
+    seL4_Word type;
+    seL4_Word size_bits;
+    vspace_map_fn_t map_fn;
+    size_t covers_bits;
+} ept_levels[] = {
+    { seL4_X86_EPTPDPTObject, seL4_X86_EPTPDPTBits, seL4_X86_EPTPDPT_Map, 39 },
+    { seL4_X86_EPTPDObject, seL4_X86_EPTPDBits, seL4_X86_EPTPD_Map, 30 },
+    { seL4_X86_EPTPTObject, seL4_X86_EPTPTBits, seL4_X86_EPTPT_Map, 21 },
+};
+
+static int ept_ram_grow(void **array, size_t *max, size_t num, size_t item_size)
+{
+    if (num < *max) {
+        return 0;
+    }
+    size_t new_max = MAX(*max * 2, 16);
+    void *new_array = realloc(*array, new_max * item_size);
+    if (new_array == NULL) {
+        return -1;
+    }
+    *array = new_array;
+    *max = new_max;
+    return 0;
+}
+
+/* Create the paging structures a frame of frame_bits at gpa needs. done[i] is the last
+ * region of level i that was handled, as frames are mapped in order */
+static int ept_ram_make_tables(sel4utils_ept_ram_t *ram, uintptr_t gpa, size_t frame_bits, uint64_t done[])
+{
+    for (size_t i = 0; i < ARRAY_SIZE(ept_levels); i++) {
+        uint64_t region = (uint64_t) gpa >> ept_levels[i].covers_bits;
+        if (ept_levels[i].covers_bits <= frame_bits || region == done[i]) {
+            continue;
+        }
+        if (ept_ram_grow((void **) &ram->tables, &ram->max_tables, ram->num_tables, sizeof(*ram->tables))) {
+            return -1;
+        }
+        vka_object_t *table = &ram->tables[ram->num_tables];
+        int error = vka_alloc_object(ram->vka, ept_levels[i].type, ept_levels[i].size_bits, table);
+        if (error) {
+            ZF_LOGE("Failed to allocate EPT paging structure");
+            return error;
+        }
+        error = ept_levels[i].map_fn(table->cptr, ram->ept, (seL4_Word)(region << ept_levels[i].covers_bits),
+                                     seL4_X86_EPT_Default_VMAttributes);
+        if (error == seL4_DeleteFirst) {
+            /* the EPT already has one */
+            vka_free_object(ram->vka, table);
+        } else if (error != seL4_NoError) {
+            ZF_LOGE("Failed to map EPT paging structure: %d", error);
+            vka_free_object(ram->vka, table);
+            return error;
+        } else {
+            ram->num_tables++;
+        }
+        done[i] = region;
+    }
+    return 0;
+}
+
+int sel4utils_ept_ram_map(vka_t *vka, seL4_CPtr ept, uintptr_t gpa, size_t size, size_t max_frame_bits,
+                          int cacheable, sel4utils_ept_ram_t *ram)
+{
+    if (!IS_ALIGNED(gpa, seL4_PageBits) || !IS_ALIGNED(size, seL4_PageBits) || size == 0) {
+        ZF_LOGE("Guest RAM %p of %zu bytes is not 4K aligned", (void *) gpa, size);
+        return -1;
+    }
+    *ram = (sel4utils_ept_ram_t) {
+        .vka = vka,
+        .ept = ept,
+        .gpa = gpa,
+        .size = size,
+    };
+
+    seL4_Word attr = cacheable ? seL4_X86_EPT_Default_VMAttributes : seL4_X86_EPT_Uncached_VMAttributes;
+    uint64_t done[ARRAY_SIZE(ept_levels)];
+    memset(done, 0xff, sizeof(done));
+    /* largest frame size left to try, lowered when a size cannot be allocated or mapped */
+    size_t limit_bits = max_frame_bits;
+    uintptr_t end = gpa + size;
+    uintptr_t next = gpa;
+    while (next < end) {
+        /* the largest frame size the next part of the range is aligned to and fills */
+        size_t frame_bits = 0;
+        for (int i = SEL4_NUM_PAGE_SIZES - 1; i >= 0; i--) {
+            size_t bits = sel4_page_sizes[i];
+            if (bits <= limit_bits && IS_ALIGNED(next, bits) && end - next >= BIT(bits)) {
+                frame_bits = bits;
+                break;
+            }
+        }
+        if (frame_bits == 0) {
+            ZF_LOGE("No frame size fits the guest RAM at %p", (void *) next);
+            goto error;
+        }
+        if (ept_ram_grow((void **) &ram->frames, &ram->max_frames, ram->num_frames, sizeof(*ram->frames))) {
+            ZF_LOGE("Failed to grow the guest RAM frame array");
+            goto error;
+        }
+        sel4utils_ept_ram_frame_t *frame = &ram->frames[ram->num_frames];
+        frame->gpa = next;
+        if (vka_alloc_frame(vka, frame_bits, &frame->frame)) {
+            if (frame_bits == seL4_PageBits) {
+                ZF_LOGE("Failed to allocate a frame of guest RAM");
+                goto error;
+            }
+            limit_bits = frame_bits - 1;
+            continue;
+        }
+        if (ept_ram_make_tables(ram, next, frame_bits, done)) {
+            vka_free_object(vka, &frame->frame);
+            goto error;
+        }
+        int error = seL4_X86_Page_MapEPT(frame->frame.cptr, ept, next, seL4_AllRights, attr);
+        if (error == seL4_InvalidArgument && frame_bits > seL4_LargePageBits) {
+            /* the kernel does not map frames this large into an EPT */
+            vka_free_object(vka, &frame->frame);
+            limit_bits = seL4_LargePageBits;
+            continue;
+        }
+        if (error != seL4_NoError) {
+            ZF_LOGE("Failed to map guest RAM at %p: %d", (void *) next, error);
+            vka_free_object(vka, &frame->frame);
+            goto error;
+        }
+        ram->num_frames++;
+        next += BIT(frame_bits);
+    }
+    return 0;
+
+error:
+    sel4utils_ept_ram_destroy(ram);
+    return -1;
+}
+
+sel4utils_ept_ram_frame_t *sel4utils_ept_ram_find(sel4utils_ept_ram_t *ram, uintptr_t gpa)
+{
+    if (gpa < ram->gpa || gpa - ram->gpa >= ram->size || ram->num_frames == 0) {
+        return NULL;
+    }
+    /* the last frame starting at or below gpa */
+    size_t low = 0;
+    size_t high = ram->num_frames;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (ram->frames[mid].gpa <= gpa) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    sel4utils_ept_ram_frame_t *frame = &ram->frames[low];
+    if (gpa - frame->gpa >= BIT(frame->frame.size_bits)) {
+        /* past the frames mapped so far */
+        return NULL;
+    }
+    return frame;
+}
+
+void sel4utils_ept_ram_destroy(sel4utils_ept_ram_t *ram)
+{
+    for (size_t i = 0; i < ram->num_frames; i++) {
+        vka_free_object(ram->vka, &ram->frames[i].frame);
+    }
+    /* deepest first, so nothing is freed while it is still mapped into another */
+    for (size_t i = ram->num_tables; i > 0; i--) {
+        vka_free_object(ram->vka, &ram->tables[i - 1]);
+    }
+    free(ram->frames);
+    free(ram->tables);
+    ram->frames = NULL;
+    ram->tables = NULL;
+    ram->num_frames = 0;
+    ram->num_tables = 0;
+    ram->max_frames = 0;
+    ram->max_tables = 0;
+}
+
 #endif /* CONFIG_VTX */
 
 /* Some more generic routines for helping with mapping */
@@ -158,3 +345,244 @@ void sel4utils_unmap_dup(vka_t *vka, vspace_t *vspace, void *mapping, size_t siz
     vka_cnode_delete(&copy_path);
     vka_cspace_free(vka, copy);
 }
+
+int sel4utils_map_windows_init(vka_t *vka, vspace_t *vspace, size_t num_windows, size_t size_bits,
+                               sel4utils_map_windows_t *windows)
+{
+    memset(windows, 0, sizeof(*windows));
+    windows->vka = vka;
+    windows->vspace = vspace;
+    windows->size_bits = size_bits;
+    windows->num_windows = num_windows;
+    windows->slots = calloc(num_windows, sizeof(seL4_CPtr));
+    windows->free = calloc(num_windows, sizeof(size_t));
+    if (!windows->slots || !windows->free) {
+        ZF_LOGE("Failed to allocate book keeping for %zu windows", num_windows);
+        goto error;
+    }
+    if (vka_cspace_alloc_n(vka, num_windows, windows->slots)) {
+        ZF_LOGE("Failed to allocate slots for %zu windows", num_windows);
+        memset(windows->slots, 0, num_windows * sizeof(seL4_CPtr));
+        goto error;
+    }
+    windows->reservation = vspace_reserve_range_aligned(vspace, num_windows * BIT(size_bits), size_bits,
+                                                        seL4_AllRights, 1, &windows->base);
+    if (!windows->reservation.res) {
+        ZF_LOGE("Failed to reserve %zu windows", num_windows);
+        goto error;
+    }
+    /* map a frame into every window once, unmapping leaves behind the paging structures
+     * so later mappings never need to allocate any */
+    vka_object_t frame;
+    if (vka_alloc_frame(vka, size_bits, &frame)) {
+        ZF_LOGE("Failed to allocate frame to prepare windows");
+        goto error;
+    }
+    for (size_t i = 0; i < num_windows; i++) {
+        void *vaddr = windows->base + i * BIT(size_bits);
+        if (vspace_map_pages_at_vaddr(vspace, &frame.cptr, NULL, vaddr, 1, size_bits, windows->reservation)) {
+            ZF_LOGE("Failed to prepare window %p", vaddr);
+            vka_free_object(vka, &frame);
+            goto error;
+        }
+        vspace_unmap_pages(vspace, vaddr, 1, size_bits, VSPACE_PRESERVE);
+        windows->free[windows->num_free++] = num_windows - i - 1;
+    }
+    vka_free_object(vka, &frame);
+    return 0;
+error:
+    sel4utils_map_windows_destroy(windows);
+    return -1;
+}
+
+void *sel4utils_map_windows_map(sel4utils_map_windows_t *windows, seL4_CPtr page)
+{
+    if (windows->num_free == 0) {
+        ZF_LOGE("No free windows");
+        return NULL;
+    }
+    size_t window = windows->free[windows->num_free - 1];
+    cspacepath_t page_path, copy_path;
+    vka_cspace_make_path(windows->vka, page, &page_path);
+    vka_cspace_make_path(windows->vka, windows->slots[window], &copy_path);
+    int error = vka_cnode_copy(&copy_path, &page_path, seL4_AllRights);
+    if (error != seL4_NoError) {
+        ZF_LOGE("Failed to copy frame cap");
+        return NULL;
+    }
+    void *vaddr = windows->base + window * BIT(windows->size_bits);
+    error = vspace_map_pages_at_vaddr(windows->vspace, &windows->slots[window], NULL, vaddr, 1, windows->size_bits,
+                                      windows->reservation);
+    if (error) {
+        ZF_LOGE("Failed to map window %p", vaddr);
+        vka_cnode_delete(&copy_path);
+        return NULL;
+    }
+    windows->num_free--;
+    return vaddr;
+}
+
+void sel4utils_map_windows_unmap(sel4utils_map_windows_t *windows, void *mapping)
+{
+    size_t window = (mapping - windows->base) >> windows->size_bits;
+    assert(window < windows->num_windows);
+    cspacepath_t copy_path;
+    vspace_unmap_pages(windows->vspace, mapping, 1, windows->size_bits, VSPACE_PRESERVE);
+    vka_cspace_make_path(windows->vka, windows->slots[window], &copy_path);
+    vka_cnode_delete(&copy_path);
+    windows->free[windows->num_free++] = window;
+}
+
+void sel4utils_map_windows_destroy(sel4utils_map_windows_t *windows)
+{
+    if (windows->reservation.res) {
+        vspace_free_reservation(windows->vspace, windows->reservation);
+    }
+    for (size_t i = 0; windows->slots && i < windows->num_windows && windows->slots[i]; i++) {
+        cspacepath_t path;
+        vka_cspace_make_path(windows->vka, windows->slots[i], &path);
+        vka_cnode_delete(&path);
+        vka_cspace_free(windows->vka, windows->slots[i]);
+    }
+    free(windows->slots);
+    free(windows->free);
+    memset(windows, 0, sizeof(*windows));
+}
+
+/* Copy len bytes between remote in target and local, mapping as many pages of target as
+ * there are free windows at a time */
+static int vspace_copy(sel4utils_map_windows_t *windows, vspace_t *target, uintptr_t remote,
+                       void *local, size_t len, bool write)
+{
+    size_t page_size = BIT(windows->size_bits);
+    size_t max_pages = windows->num_free;
+    void *mappings[max_pages];
+
+    if (max_pages == 0) {
+        ZF_LOGE("No free windows");
+        return -1;
+    }
+
+    while (len > 0) {
+        uintptr_t start = ROUND_DOWN(remote, page_size);
+        size_t offset = remote - start;
+        size_t pages = MIN(DIV_ROUND_UP(offset + len, page_size), max_pages);
+        size_t mapped;
+        int error = 0;
+
+        /* walk the book keeping of target once for the batch, mapping each of its frames */
+        for (mapped = 0; mapped < pages; mapped++) {
+            void *vaddr = (void *)(start + mapped * page_size);
+            size_t size_bits;
+            bool private_write;
+            seL4_CPtr cap = sel4utils_get_frame(target, vaddr, &size_bits, &private_write);
+            if (cap == seL4_CapNull) {
+                ZF_LOGE("Nothing mapped at %p in target", vaddr);
+                error = -1;
+                break;
+            }
+            if (size_bits != windows->size_bits) {
+                ZF_LOGE("Frame at %p in target is of %zu bits, not of the windows' %zu", vaddr, size_bits,
+                        windows->size_bits);
+                error = -1;
+                break;
+            }
+            /* writing to a frame shared with other vspaces would change their memory too */
+            if (write && !private_write) {
+                ZF_LOGE("Frame at %p in target is read only or shared copy on write", vaddr);
+                error = -1;
+                break;
+            }
+            mappings[mapped] = sel4utils_map_windows_map(windows, cap);
+            if (mappings[mapped] == NULL) {
+                error = -1;
+                break;
+            }
+        }
+
+        /* copy each run of consecutive windows in one go */
+        size_t run = 0;
+        for (size_t i = 1; i <= mapped; i++) {
+            if (i < mapped && mappings[i] == mappings[i - 1] + page_size) {
+                continue;
+            }
+            size_t run_offset = run == 0 ? offset : 0;
+            size_t bytes = MIN((i - run) * page_size - run_offset, len);
+            void *window = mappings[run] + run_offset;
+            if (write) {
+                sel4utils_copy(window, local, bytes);
+            } else {
+                sel4utils_copy(local, window, bytes);
+            }
+            local += bytes;
+            remote += bytes;
+            len -= bytes;
+            run = i;
+        }
+
+        /* unmap in reverse, leaving the free windows in the order they were taken */
+        while (mapped > 0) {
+            mapped--;
+            sel4utils_map_windows_unmap(windows, mappings[mapped]);
+        }
+        if (error) {
+            return error;
+        }
+    }
+    return 0;
+}
+
+int sel4utils_vspace_copy_to(sel4utils_map_windows_t *windows, vspace_t *target, void *target_vaddr,
+                             const void *src, size_t len)
+{
+    return vspace_copy(windows, target, (uintptr_t) target_vaddr, (void *) src, len, true);
+}
+
+int sel4utils_vspace_copy_from(sel4utils_map_windows_t *windows, vspace_t *target, void *target_vaddr,
+                               void *dst, size_t len)
+{
+    return vspace_copy(windows, target, (uintptr_t) target_vaddr, dst, len, false);
+}
+
+static ssize_t vspace_copy_iov(sel4utils_map_windows_t *windows, vspace_t *target,
+                               const struct iovec *local, size_t local_count,
+                               const struct iovec *remote, size_t remote_count, bool write)
+{
+    size_t l = 0, r = 0;
+    size_t l_done = 0, r_done = 0;
+    ssize_t copied = 0;
+
+    while (l < local_count && r < remote_count) {
+        size_t bytes = MIN(local[l].iov_len - l_done, remote[r].iov_len - r_done);
+        if (bytes > 0 && vspace_copy(windows, target, (uintptr_t) remote[r].iov_base + r_done,
+                                     local[l].iov_base + l_done, bytes, write)) {
+            return -1;
+        }
+        copied += bytes;
+        l_done += bytes;
+        r_done += bytes;
+        if (l_done == local[l].iov_len) {
+            l++;
+            l_done = 0;
+        }
+        if (r_done == remote[r].iov_len) {
+            r++;
+            r_done = 0;
+        }
+    }
+    return copied;
+}
+
+ssize_t sel4utils_vspace_writev(sel4utils_map_windows_t *windows, vspace_t *target,
+                                const struct iovec *local, size_t local_count,
+                                const struct iovec *remote, size_t remote_count)
+{
+    return vspace_copy_iov(windows, target, local, local_count, remote, remote_count, true);
+}
+
+ssize_t sel4utils_vspace_readv(sel4utils_map_windows_t *windows, vspace_t *target,
+                               const struct iovec *local, size_t local_count,
+                               const struct iovec *remote, size_t remote_count)
+{
+    return vspace_copy_iov(windows, target, local, local_count, remote, remote_count, false);
+}
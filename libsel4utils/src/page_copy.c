@@ -0,0 +1,31 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <assert.h>
+#include <string.h>
+
+#include <utils/util.h>
+#include <sel4utils/page_copy.h>
+
+/* Architectures with kernels of their own define these in src/sel4_arch */
+#if !defined(CONFIG_SEL4UTILS_PAGE_COPY) || !(defined(CONFIG_ARCH_AARCH64) || defined(CONFIG_ARCH_X86_64))
+
+void sel4utils_copy_pages(void *dst, const void *src, size_t bytes)
+{
+    assert(IS_ALIGNED((uintptr_t) dst | (uintptr_t) src | bytes, PAGE_BITS_4K));
+    memcpy(dst, src, bytes);
+}
+
+void sel4utils_zero_pages(void *dst, size_t bytes)
+{
+    assert(IS_ALIGNED((uintptr_t) dst | bytes, PAGE_BITS_4K));
+    memset(dst, 0, bytes);
+}
+
+#endif
@@ -9,6 +9,7 @@
 
 #include <sel4utils/page_dma.h>
 #include <vspace/vspace.h>
+#include <vspace/page.h>
 #include <stdlib.h>
 #include <vka/capops.h>
 #include <vka/kobject_t.h>
@@ -25,22 +26,54 @@ typedef struct dma_alloc {
     void *base;
     vka_object_t ut;
     uintptr_t paddr;
+    /* size of the frames the untyped was retyped into */
+    size_t frame_bits;
 } dma_alloc_t;
 
+/* Delete the frames retyped from ut, up to the first empty slot, and free their slots. The
+ * frames are the only children of ut, so one revoke deletes them all */
+static void free_frames(vka_t *vka, vka_object_t *ut, size_t num_frames, seL4_CPtr *frames)
+{
+    size_t num = 0;
+    while (num < num_frames && frames[num] != seL4_CapNull) {
+        num++;
+    }
+    if (num == 0) {
+        return;
+    }
+    cspacepath_t ut_path;
+    vka_cspace_make_path(vka, ut->cptr, &ut_path);
+    if (vka_cnode_revoke_free_n(vka, &ut_path, num, frames) != seL4_NoError) {
+        ZF_LOGW("Failed to revoke dma untyped, deleting frames one at a time");
+        vka_cnode_delete_free_n(vka, num, frames);
+    }
+}
+
 static void dma_free(void *cookie, void *addr, size_t size)
 {
     dma_man_t *dma = cookie;
     dma_alloc_t *alloc = (dma_alloc_t *)vspace_get_cookie(&dma->vspace, addr);
     assert(alloc);
     assert(alloc->base == addr);
-    int num_pages = BIT(alloc->ut.size_bits) / PAGE_SIZE_4K;
-    for (int i = 0; i < num_pages; i++) {
-        cspacepath_t path;
-        seL4_CPtr frame = vspace_get_cap(&dma->vspace, addr + i * PAGE_SIZE_4K);
-        vspace_unmap_pages(&dma->vspace, addr + i * PAGE_SIZE_4K, 1, PAGE_BITS_4K, NULL);
-        vka_cspace_make_path(&dma->vka, frame, &path);
-        vka_cnode_delete(&path);
-        vka_cspace_free(&dma->vka, frame);
+    size_t num_frames = BIT(alloc->ut.size_bits - alloc->frame_bits);
+    seL4_CPtr *frames = malloc(num_frames * sizeof(*frames));
+    if (frames != NULL) {
+        for (size_t i = 0; i < num_frames; i++) {
+            frames[i] = vspace_get_cap(&dma->vspace, addr + i * BIT(alloc->frame_bits));
+        }
+        vspace_unmap_pages(&dma->vspace, addr, num_frames, alloc->frame_bits, NULL);
+        free_frames(&dma->vka, &alloc->ut, num_frames, frames);
+        free(frames);
+    } else {
+        for (size_t i = 0; i < num_frames; i++) {
+            cspacepath_t path;
+            void *frame_addr = addr + i * BIT(alloc->frame_bits);
+            seL4_CPtr frame = vspace_get_cap(&dma->vspace, frame_addr);
+            vspace_unmap_pages(&dma->vspace, frame_addr, 1, alloc->frame_bits, NULL);
+            vka_cspace_make_path(&dma->vka, frame, &path);
+            vka_cnode_delete(&path);
+            vka_cspace_free(&dma->vka, frame);
+        }
     }
     vka_free_object(&dma->vka, &alloc->ut);
     free(alloc);
@@ -60,24 +93,31 @@ static uintptr_t dma_pin(void *cookie, void *addr, size_t size)
 static void *dma_alloc(void *cookie, size_t size, int align, int cached, ps_mem_flags_t flags)
 {
     dma_man_t *dma = cookie;
-    cspacepath_t *frames = NULL;
+    seL4_CPtr *frames = NULL;
     reservation_t res = {NULL};
     dma_alloc_t *alloc = NULL;
     unsigned int num_frames = 0;
     void *base = NULL;
-    /* We align to the 4K boundary, but do not support more */
-    if (align > PAGE_SIZE_4K) {
+    if (align < 0 || (align & (align - 1))) {
+        ZF_LOGE("Alignment %d is not a power of 2", align);
         return NULL;
     }
     /* Round up to the next page size */
     size = ROUND_UP(size, PAGE_SIZE_4K);
     /* Then round up to the next power of 2 size. This is because untypeds are allocated
-     * in powers of 2 */
+     * in powers of 2. Untypeds are also naturally aligned, so an alignment larger than
+     * the size is met by growing the untyped to it */
     size_t size_bits = LOG_BASE_2(size);
     if (BIT(size_bits) != size) {
         size_bits++;
     }
+    if (align > 0) {
+        size_bits = MAX(size_bits, (size_t) LOG_BASE_2(align));
+    }
     size = BIT(size_bits);
+    /* The untyped is aligned to its size, so the largest frame that fits in it can be
+     * used as long as the virtual range is aligned to it as well */
+    size_t frame_bits = sel4_page_size_bits_for_memory_region(size);
     /* Allocate an untyped */
     vka_object_t ut;
     int error = vka_alloc_untyped(&dma->vka, size_bits, &ut);
@@ -92,27 +132,30 @@ static void *dma_alloc(void *cookie, size_t size, int align, int cached, ps_mem_
         goto handle_error;
     }
     /* Allocate all the frames */
-    num_frames = size / PAGE_SIZE_4K;
-    frames = calloc(num_frames, sizeof(cspacepath_t));
+    num_frames = size / BIT(frame_bits);
+    frames = calloc(num_frames, sizeof(*frames));
     if (!frames) {
         goto handle_error;
     }
     for (unsigned i = 0; i < num_frames; i++) {
-        error = vka_cspace_alloc_path(&dma->vka, &frames[i]);
+        error = vka_cspace_alloc(&dma->vka, &frames[i]);
         if (error) {
             goto handle_error;
         }
-        error = seL4_Untyped_Retype(ut.cptr, kobject_get_type(KOBJECT_FRAME, PAGE_BITS_4K), size_bits, frames[i].root,
-                                    frames[i].dest, frames[i].destDepth, frames[i].offset, 1);
+        cspacepath_t path;
+        vka_cspace_make_path(&dma->vka, frames[i], &path);
+        error = seL4_Untyped_Retype(ut.cptr, kobject_get_type(KOBJECT_FRAME, frame_bits), frame_bits, path.root,
+                                    path.dest, path.destDepth, path.offset, 1);
         if (error != seL4_NoError) {
             goto handle_error;
         }
     }
     /* Grab a reservation */
-    res = vspace_reserve_range(&dma->vspace, size, seL4_AllRights, cached, &base);
+    res = vspace_reserve_range_aligned(&dma->vspace, size, MAX(frame_bits, (size_t) LOG_BASE_2(MAX(align, 1))),
+                                       seL4_AllRights, cached, &base);
     if (!res.res) {
         ZF_LOGE("Failed to reserve");
-        return NULL;
+        goto handle_error;
     }
     alloc = malloc(sizeof(*alloc));
     if (alloc == NULL) {
@@ -121,32 +164,29 @@ static void *dma_alloc(void *cookie, size_t size, int align, int cached, ps_mem_
     alloc->base = base;
     alloc->ut = ut;
     alloc->paddr = paddr;
+    alloc->frame_bits = frame_bits;
     /* Map in all the pages */
     for (unsigned i = 0; i < num_frames; i++) {
-        error = vspace_map_pages_at_vaddr(&dma->vspace, &frames[i].capPtr, (uintptr_t *)&alloc, base + i * PAGE_SIZE_4K, 1,
-                                          PAGE_BITS_4K, res);
+        error = vspace_map_pages_at_vaddr(&dma->vspace, &frames[i], (uintptr_t *)&alloc, base + i * BIT(frame_bits), 1,
+                                          frame_bits, res);
         if (error) {
             goto handle_error;
         }
     }
     /* no longer need the reservation */
     vspace_free_reservation(&dma->vspace, res);
+    free(frames);
     return base;
 handle_error:
     if (alloc) {
         free(alloc);
     }
     if (res.res) {
-        vspace_unmap_pages(&dma->vspace, base, num_frames, PAGE_BITS_4K, NULL);
+        vspace_unmap_pages(&dma->vspace, base, num_frames, frame_bits, NULL);
         vspace_free_reservation(&dma->vspace, res);
     }
     if (frames) {
-        for (int i = 0; i < num_frames; i++) {
-            if (frames[i].capPtr) {
-                vka_cnode_delete(&frames[i]);
-                vka_cspace_free(&dma->vka, frames[i].capPtr);
-            }
-        }
+        free_frames(&dma->vka, &ut, num_frames, frames);
         free(frames);
     }
     vka_free_object(&dma->vka, &ut);
@@ -159,6 +199,9 @@ static void dma_unpin(void *cookie, void *addr, size_t size)
 
 static void dma_cache_op(void *cookie, void *addr, size_t size, dma_cache_op_t op)
 {
+#ifdef CONFIG_SEL4UTILS_USER_CACHE_OPS
+    sel4utils_user_dcache_op((seL4_Word)addr, (seL4_Word)addr + size, op != DMA_CACHE_OP_CLEAN);
+#else
     dma_man_t *dma = cookie;
     seL4_CPtr root = vspace_get_root(&dma->vspace);
     uintptr_t end = (uintptr_t)addr + size;
@@ -181,6 +224,417 @@ static void dma_cache_op(void *cookie, void *addr, size_t size, dma_cache_op_t o
         }
         cur = top;
     }
+#endif
+}
+
+/* Buffers of one size carved out of a physically contiguous chunk, which is mapped
+ * contiguously once when it is created. Every page of a chunk has the chunk as its cookie */
+typedef struct dma_pool_chunk {
+    void *base;
+    uintptr_t paddr;
+    vka_object_t ut;
+    size_t num_frames;
+    seL4_CPtr *frames;
+    /* size of each buffer in the chunk */
+    size_t buf_bits;
+    int cached;
+    struct dma_pool_buf *bufs;
+    /* buffers on the free list, the chunk can be given back once they all are */
+    size_t num_free;
+    struct dma_pool_chunk *next;
+} dma_pool_chunk_t;
+
+typedef struct dma_pool_buf {
+    /* next free buffer of the same size, if we are free */
+    struct dma_pool_buf *next;
+    struct dma_pool_chunk *chunk;
+} dma_pool_buf_t;
+
+typedef struct dma_pool {
+    /* must be first, dma_cache_op only knows about this */
+    dma_man_t man;
+    size_t chunk_bits;
+    /* free buffers by cacheability and size, size_bits - seL4_PageBits indexes the list */
+    dma_pool_buf_t *free[2][CONFIG_WORD_SIZE];
+    dma_pool_chunk_t *chunks;
+} dma_pool_t;
+
+static inline void *pool_buf_vaddr(dma_pool_chunk_t *chunk, dma_pool_buf_t *buf)
+{
+    return chunk->base + ((buf - chunk->bufs) << chunk->buf_bits);
+}
+
+/* Retype ut into num_frames frames, with a single retype when the slots are consecutive */
+static int retype_frames(vka_t *vka, vka_object_t *ut, size_t num_frames, seL4_CPtr *frames)
+{
+    cspacepath_t first, last;
+    vka_cspace_make_path(vka, frames[0], &first);
+    vka_cspace_make_path(vka, frames[num_frames - 1], &last);
+    seL4_Word type = kobject_get_type(KOBJECT_FRAME, PAGE_BITS_4K);
+    if (last.root == first.root && last.offset == first.offset + num_frames - 1) {
+        for (size_t created = 0; created < num_frames;) {
+            size_t count = MIN(num_frames - created, CONFIG_RETYPE_FAN_OUT_LIMIT);
+            int error = seL4_Untyped_Retype(ut->cptr, type, PAGE_BITS_4K, first.root, first.dest, first.destDepth,
+                                            first.offset + created, count);
+            if (error != seL4_NoError) {
+                return error;
+            }
+            created += count;
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < num_frames; i++) {
+        cspacepath_t path;
+        vka_cspace_make_path(vka, frames[i], &path);
+        int error = seL4_Untyped_Retype(ut->cptr, type, PAGE_BITS_4K, path.root, path.dest, path.destDepth,
+                                        path.offset, 1);
+        if (error != seL4_NoError) {
+            return error;
+        }
+    }
+    return 0;
+}
+
+static void free_chunk(dma_pool_t *pool, dma_pool_chunk_t *chunk)
+{
+    vka_t *vka = &pool->man.vka;
+    if (chunk->base != NULL) {
+        vspace_unmap_pages(&pool->man.vspace, chunk->base, chunk->num_frames, PAGE_BITS_4K, NULL);
+    }
+    if (chunk->frames != NULL) {
+        free_frames(vka, &chunk->ut, chunk->num_frames, chunk->frames);
+    }
+    if (chunk->ut.cptr != seL4_CapNull) {
+        vka_free_object(vka, &chunk->ut);
+    }
+    free(chunk->frames);
+    free(chunk->bufs);
+    free(chunk);
+}
+
+/* Create a chunk of at least BIT(buf_bits), split into buffers of buf_bits, and put them
+ * all on their free list */
+static int refill_pool(dma_pool_t *pool, size_t buf_bits, int cached)
+{
+    vka_t *vka = &pool->man.vka;
+    size_t chunk_bits = MAX(pool->chunk_bits, buf_bits);
+    size_t num_bufs = BIT(chunk_bits - buf_bits);
+
+    dma_pool_chunk_t *chunk = calloc(1, sizeof(*chunk));
+    if (chunk == NULL) {
+        return -1;
+    }
+    chunk->num_frames = BIT(chunk_bits - PAGE_BITS_4K);
+    chunk->buf_bits = buf_bits;
+    chunk->cached = cached;
+    chunk->frames = calloc(chunk->num_frames, sizeof(*chunk->frames));
+    chunk->bufs = calloc(num_bufs, sizeof(*chunk->bufs));
+    uintptr_t *cookies = calloc(chunk->num_frames, sizeof(*cookies));
+    if (chunk->frames == NULL || chunk->bufs == NULL || cookies == NULL) {
+        goto error;
+    }
+
+    if (vka_alloc_untyped(vka, chunk_bits, &chunk->ut)) {
+        ZF_LOGE("Failed to allocate untyped of size %zu", chunk_bits);
+        goto error;
+    }
+    chunk->paddr = vka_utspace_paddr(vka, chunk->ut.ut, seL4_UntypedObject, chunk_bits);
+    if (chunk->paddr == VKA_NO_PADDR) {
+        ZF_LOGE("Allocated untyped has no physical address");
+        goto error;
+    }
+    if (vka_cspace_alloc_n(vka, chunk->num_frames, chunk->frames)) {
+        ZF_LOGE("Failed to allocate cslots for dma chunk");
+        /* nothing to clean up in frames */
+        memset(chunk->frames, 0, chunk->num_frames * sizeof(*chunk->frames));
+        goto error;
+    }
+    if (retype_frames(vka, &chunk->ut, chunk->num_frames, chunk->frames)) {
+        ZF_LOGE("Failed to retype dma chunk");
+        goto error;
+    }
+    for (size_t i = 0; i < chunk->num_frames; i++) {
+        cookies[i] = (uintptr_t) chunk;
+    }
+    chunk->base = vspace_map_pages(&pool->man.vspace, chunk->frames, cookies, seL4_AllRights, chunk->num_frames,
+                                   PAGE_BITS_4K, cached);
+    if (chunk->base == NULL) {
+        ZF_LOGE("Failed to map dma chunk");
+        goto error;
+    }
+    free(cookies);
+
+    for (size_t i = num_bufs; i > 0; i--) {
+        dma_pool_buf_t *buf = &chunk->bufs[i - 1];
+        buf->chunk = chunk;
+        buf->next = pool->free[!!cached][buf_bits - PAGE_BITS_4K];
+        pool->free[!!cached][buf_bits - PAGE_BITS_4K] = buf;
+    }
+    chunk->num_free = num_bufs;
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    return 0;
+
+error:
+    free(cookies);
+    free_chunk(pool, chunk);
+    return -1;
+}
+
+static void *dma_pool_alloc(void *cookie, size_t size, int align, int cached, ps_mem_flags_t flags)
+{
+    dma_pool_t *pool = cookie;
+    /* buffers are naturally aligned physically, but only 4K aligned virtually */
+    if (align > PAGE_SIZE_4K) {
+        return NULL;
+    }
+    size_t size_bits = MAX(LOG_BASE_2(ROUND_UP(MAX(size, 1), PAGE_SIZE_4K)), PAGE_BITS_4K);
+    if (BIT(size_bits) < size) {
+        size_bits++;
+    }
+    dma_pool_buf_t **list = &pool->free[!!cached][size_bits - PAGE_BITS_4K];
+    if (*list == NULL && refill_pool(pool, size_bits, cached)) {
+        return NULL;
+    }
+    dma_pool_buf_t *buf = *list;
+    *list = buf->next;
+    buf->chunk->num_free--;
+    return pool_buf_vaddr(buf->chunk, buf);
+}
+
+static void dma_pool_free(void *cookie, void *addr, size_t size)
+{
+    dma_pool_t *pool = cookie;
+    dma_pool_chunk_t *chunk = (dma_pool_chunk_t *) vspace_get_cookie(&pool->man.vspace, addr);
+    assert(chunk != NULL);
+    dma_pool_buf_t *buf = &chunk->bufs[(addr - chunk->base) >> chunk->buf_bits];
+    assert(pool_buf_vaddr(chunk, buf) == addr);
+    buf->next = pool->free[!!chunk->cached][chunk->buf_bits - PAGE_BITS_4K];
+    pool->free[!!chunk->cached][chunk->buf_bits - PAGE_BITS_4K] = buf;
+    chunk->num_free++;
+}
+
+static uintptr_t dma_pool_pin(void *cookie, void *addr, size_t size)
+{
+    dma_pool_t *pool = cookie;
+    dma_pool_chunk_t *chunk = (dma_pool_chunk_t *) vspace_get_cookie(&pool->man.vspace, addr);
+    if (!chunk) {
+        return 0;
+    }
+    return chunk->paddr + (addr - chunk->base);
+}
+
+size_t sel4utils_page_dma_pool_reclaim(void *cookie, size_t bytes)
+{
+    dma_pool_t *pool = cookie;
+    size_t freed = 0;
+    dma_pool_chunk_t **pos = &pool->chunks;
+    while (*pos != NULL && (bytes == 0 || freed < bytes)) {
+        dma_pool_chunk_t *chunk = *pos;
+        size_t chunk_bytes = chunk->num_frames * PAGE_SIZE_4K;
+        if (chunk->num_free != chunk_bytes >> chunk->buf_bits) {
+            pos = &chunk->next;
+            continue;
+        }
+        for (dma_pool_buf_t **buf = &pool->free[!!chunk->cached][chunk->buf_bits - PAGE_BITS_4K]; *buf != NULL;) {
+            if ((*buf)->chunk == chunk) {
+                *buf = (*buf)->next;
+            } else {
+                buf = &(*buf)->next;
+            }
+        }
+        *pos = chunk->next;
+        free_chunk(pool, chunk);
+        freed += chunk_bytes;
+    }
+    return freed;
+}
+
+int sel4utils_new_page_dma_pool(vka_t *vka, vspace_t *vspace, size_t chunk_bits, ps_dma_man_t *dma_man)
+{
+    if (chunk_bits < PAGE_BITS_4K || chunk_bits >= CONFIG_WORD_SIZE) {
+        ZF_LOGE("Invalid dma pool chunk size %zu", chunk_bits);
+        return -1;
+    }
+    dma_pool_t *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return -1;
+    }
+    pool->man.vka = *vka;
+    pool->man.vspace = *vspace;
+    pool->chunk_bits = chunk_bits;
+    dma_man->cookie = pool;
+    dma_man->dma_alloc_fn = dma_pool_alloc;
+    dma_man->dma_free_fn = dma_pool_free;
+    dma_man->dma_pin_fn = dma_pool_pin;
+    dma_man->dma_unpin_fn = dma_unpin;
+    dma_man->dma_cache_op_fn = dma_cache_op;
+    return 0;
+}
+
+/* A single contiguous untyped, retyped into frames up front, that allocations take
+ * page granular runs of. Only the frames of a run are mapped while it is allocated */
+typedef struct dma_carveout {
+    /* must be first, dma_cache_op only knows about this */
+    dma_man_t man;
+    vka_object_t ut;
+    uintptr_t paddr;
+    size_t num_frames;
+    seL4_CPtr *frames;
+    /* bit set for every frame that is allocated */
+    seL4_Word *used;
+} dma_carveout_t;
+
+/* Cookie of the pages of a run */
+typedef struct dma_run {
+    void *base;
+    size_t first;
+    size_t num;
+} dma_run_t;
+
+static inline bool carveout_used(dma_carveout_t *carveout, size_t frame)
+{
+    return carveout->used[frame / seL4_WordBits] & BIT(frame % seL4_WordBits);
+}
+
+static void carveout_mark(dma_carveout_t *carveout, size_t first, size_t num, bool used)
+{
+    for (size_t i = first; i < first + num; i++) {
+        if (used) {
+            carveout->used[i / seL4_WordBits] |= BIT(i % seL4_WordBits);
+        } else {
+            carveout->used[i / seL4_WordBits] &= ~BIT(i % seL4_WordBits);
+        }
+    }
+}
+
+/* Lowest run of num free frames starting at a multiple of align frames */
+static int carveout_find(dma_carveout_t *carveout, size_t num, size_t align, size_t *first)
+{
+    size_t start = 0;
+    while (start + num <= carveout->num_frames) {
+        if (carveout->used[start / seL4_WordBits] == (seL4_Word) - 1 && start % seL4_WordBits == 0) {
+            /* skip whole words that are in use */
+            start += seL4_WordBits;
+            continue;
+        }
+        size_t i;
+        for (i = 0; i < num && !carveout_used(carveout, start + i); i++);
+        if (i == num) {
+            *first = start;
+            return 0;
+        }
+        start = ROUND_UP(start + i + 1, align);
+    }
+    return -1;
+}
+
+static void *dma_carveout_alloc(void *cookie, size_t size, int align, int cached, ps_mem_flags_t flags)
+{
+    dma_carveout_t *carveout = cookie;
+    /* physical alignment comes from where the run starts, virtual alignment is 4K */
+    if (align > PAGE_SIZE_4K) {
+        return NULL;
+    }
+    size_t num = BYTES_TO_4K_PAGES(ROUND_UP(MAX(size, 1), PAGE_SIZE_4K));
+    size_t first;
+    if (carveout_find(carveout, num, 1, &first)) {
+        ZF_LOGE("No run of %zu frames left in dma carveout", num);
+        return NULL;
+    }
+    dma_run_t *run = malloc(sizeof(*run));
+    if (run == NULL) {
+        return NULL;
+    }
+    uintptr_t cookies[num];
+    for (size_t i = 0; i < num; i++) {
+        cookies[i] = (uintptr_t) run;
+    }
+    run->first = first;
+    run->num = num;
+    run->base = vspace_map_pages(&carveout->man.vspace, &carveout->frames[first], cookies, seL4_AllRights, num,
+                                 PAGE_BITS_4K, cached);
+    if (run->base == NULL) {
+        ZF_LOGE("Failed to map dma run");
+        free(run);
+        return NULL;
+    }
+    carveout_mark(carveout, first, num, true);
+    return run->base;
+}
+
+static void dma_carveout_free(void *cookie, void *addr, size_t size)
+{
+    dma_carveout_t *carveout = cookie;
+    dma_run_t *run = (dma_run_t *) vspace_get_cookie(&carveout->man.vspace, addr);
+    assert(run);
+    assert(run->base == addr);
+    vspace_unmap_pages(&carveout->man.vspace, addr, run->num, PAGE_BITS_4K, NULL);
+    carveout_mark(carveout, run->first, run->num, false);
+    free(run);
+}
+
+static uintptr_t dma_carveout_pin(void *cookie, void *addr, size_t size)
+{
+    dma_carveout_t *carveout = cookie;
+    dma_run_t *run = (dma_run_t *) vspace_get_cookie(&carveout->man.vspace, addr);
+    if (!run) {
+        return 0;
+    }
+    return carveout->paddr + run->first * PAGE_SIZE_4K + (addr - run->base);
+}
+
+int sel4utils_new_page_dma_carveout(vka_t *vka, vspace_t *vspace, size_t size_bits, ps_dma_man_t *dma_man)
+{
+    dma_carveout_t *carveout = calloc(1, sizeof(*carveout));
+    if (!carveout) {
+        return -1;
+    }
+    carveout->man.vka = *vka;
+    carveout->man.vspace = *vspace;
+    carveout->num_frames = BIT(size_bits - PAGE_BITS_4K);
+    carveout->frames = calloc(carveout->num_frames, sizeof(*carveout->frames));
+    carveout->used = calloc(DIV_ROUND_UP(carveout->num_frames, seL4_WordBits), sizeof(*carveout->used));
+    if (!carveout->frames || !carveout->used) {
+        goto error;
+    }
+    if (vka_alloc_untyped(vka, size_bits, &carveout->ut)) {
+        ZF_LOGE("Failed to allocate untyped of size %zu", size_bits);
+        goto error;
+    }
+    carveout->paddr = vka_utspace_paddr(vka, carveout->ut.ut, seL4_UntypedObject, size_bits);
+    if (carveout->paddr == VKA_NO_PADDR) {
+        ZF_LOGE("Allocated untyped has no physical address");
+        goto error;
+    }
+    if (vka_cspace_alloc_n(vka, carveout->num_frames, carveout->frames)) {
+        ZF_LOGE("Failed to allocate cslots for dma carveout");
+        memset(carveout->frames, 0, carveout->num_frames * sizeof(*carveout->frames));
+        goto error;
+    }
+    if (retype_frames(vka, &carveout->ut, carveout->num_frames, carveout->frames)) {
+        ZF_LOGE("Failed to retype dma carveout");
+        goto error;
+    }
+    dma_man->cookie = carveout;
+    dma_man->dma_alloc_fn = dma_carveout_alloc;
+    dma_man->dma_free_fn = dma_carveout_free;
+    dma_man->dma_pin_fn = dma_carveout_pin;
+    dma_man->dma_unpin_fn = dma_unpin;
+    dma_man->dma_cache_op_fn = dma_cache_op;
+    return 0;
+
+error:
+    if (carveout->frames != NULL) {
+        free_frames(vka, &carveout->ut, carveout->num_frames, carveout->frames);
+    }
+    if (carveout->ut.cptr != seL4_CapNull) {
+        vka_free_object(vka, &carveout->ut);
+    }
+    free(carveout->frames);
+    free(carveout->used);
+    free(carveout);
+    return -1;
 }
 
 int sel4utils_new_page_dma_alloc(vka_t *vka, vspace_t *vspace, ps_dma_man_t *dma_man)
@@ -199,3 +653,30 @@ int sel4utils_new_page_dma_alloc(vka_t *vka, vspace_t *vspace, ps_dma_man_t *dma
     dma_man->dma_cache_op_fn = dma_cache_op;
     return 0;
 }
+
+static int compare_dma_ranges(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)((const sel4utils_dma_range_t *)a)->vaddr;
+    uintptr_t y = (uintptr_t)((const sel4utils_dma_range_t *)b)->vaddr;
+    return (x > y) - (x < y);
+}
+
+void sel4utils_dma_cache_op_ranges(ps_dma_man_t *dma_man, size_t num_ranges, sel4utils_dma_range_t *ranges,
+                                   dma_cache_op_t op)
+{
+    if (num_ranges == 0) {
+        return;
+    }
+    qsort(ranges, num_ranges, sizeof(*ranges), compare_dma_ranges);
+    uintptr_t start = (uintptr_t)ranges[0].vaddr;
+    uintptr_t end = start + ranges[0].len;
+    for (size_t i = 1; i < num_ranges; i++) {
+        uintptr_t next = (uintptr_t)ranges[i].vaddr;
+        if (next > end) {
+            ps_dma_cache_op(dma_man, (void *)start, end - start, op);
+            start = next;
+        }
+        end = MAX(end, next + ranges[i].len);
+    }
+    ps_dma_cache_op(dma_man, (void *)start, end - start, op);
+}
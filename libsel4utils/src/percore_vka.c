@@ -0,0 +1,373 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <sel4utils/percore_vka.h>
+#include <vka/capops.h>
+#include <vka/object.h>
+#include <utils/util.h>
+#include "lock_internal.h"
+
+/* each core's cache goes on lines of its own, so cores never write to the same line */
+#define PERCORE_CACHE_LINE 64
+
+typedef struct {
+    seL4_CPtr cptr;
+    seL4_Word cookie;
+} cached_object_t;
+
+typedef struct {
+    /* objects move to and from the delegate batch at a time, 0 if the type is not cached */
+    size_t batch;
+    seL4_Word size_bits;
+    /* allocated from the delegate and not handed out yet, up to batch */
+    size_t num_objects;
+    cached_object_t *objects;
+    /* cookies of freed objects not given back to the delegate yet, up to batch */
+    size_t num_freed;
+    seL4_Word *freed;
+} object_cache_t;
+
+typedef struct {
+    vka_t *delegate;
+    volatile int lock;
+} percore_shared_t;
+
+typedef struct {
+    percore_shared_t *shared;
+    /* locks are always taken core first, then shared */
+    volatile int lock;
+    size_t slot_batch;
+    /* free cslots of the delegate's cspace, up to 2 * slot_batch */
+    size_t num_slots;
+    seL4_CPtr *slots;
+    object_cache_t caches[seL4_ObjectTypeCount];
+} __attribute__((aligned(PERCORE_CACHE_LINE))) percore_data_t;
+
+/* only objects of the size the cache holds come from it, others of the type are not cached */
+static bool is_cached(percore_data_t *core, seL4_Word type, seL4_Word size_bits)
+{
+    return type < seL4_ObjectTypeCount && core->caches[type].batch > 0 && core->caches[type].size_bits == size_bits;
+}
+
+/* Core lock held for all of the below */
+static int refill_slots(percore_data_t *core)
+{
+    percore_shared_t *shared = core->shared;
+
+    sel4utils_lock(&shared->lock);
+    int error = vka_cspace_alloc_n(shared->delegate, core->slot_batch, &core->slots[core->num_slots]);
+    sel4utils_unlock(&shared->lock);
+    if (error) {
+        ZF_LOGE("Failed to refill cslots of core");
+        return -1;
+    }
+    core->num_slots += core->slot_batch;
+    return 0;
+}
+
+static void flush_slots(percore_data_t *core, size_t num)
+{
+    percore_shared_t *shared = core->shared;
+
+    sel4utils_lock(&shared->lock);
+    for (size_t i = 0; i < num; i++) {
+        vka_cspace_free(shared->delegate, core->slots[--core->num_slots]);
+    }
+    sel4utils_unlock(&shared->lock);
+}
+
+static void push_slot(percore_data_t *core, seL4_CPtr slot)
+{
+    if (core->num_slots == 2 * core->slot_batch) {
+        flush_slots(core, core->slot_batch);
+    }
+    core->slots[core->num_slots++] = slot;
+}
+
+static int refill_objects(percore_data_t *core, seL4_Word type)
+{
+    percore_shared_t *shared = core->shared;
+    object_cache_t *cache = &core->caches[type];
+
+    sel4utils_lock(&shared->lock);
+    while (cache->num_objects < cache->batch) {
+        cached_object_t *object = &cache->objects[cache->num_objects];
+        if (vka_cspace_alloc(shared->delegate, &object->cptr) != 0) {
+            break;
+        }
+        cspacepath_t path;
+        vka_cspace_make_path(shared->delegate, object->cptr, &path);
+        if (vka_utspace_alloc(shared->delegate, &path, type, cache->size_bits, &object->cookie) != 0) {
+            vka_cspace_free(shared->delegate, object->cptr);
+            break;
+        }
+        cache->num_objects++;
+    }
+    sel4utils_unlock(&shared->lock);
+
+    if (cache->num_objects == 0) {
+        ZF_LOGW("Failed to refill objects of type %lu of core", (long) type);
+        return -1;
+    }
+    return 0;
+}
+
+static void flush_freed(percore_data_t *core, seL4_Word type)
+{
+    percore_shared_t *shared = core->shared;
+    object_cache_t *cache = &core->caches[type];
+
+    sel4utils_lock(&shared->lock);
+    for (size_t i = 0; i < cache->num_freed; i++) {
+        vka_utspace_free(shared->delegate, type, cache->size_bits, cache->freed[i]);
+    }
+    sel4utils_unlock(&shared->lock);
+    cache->num_freed = 0;
+}
+
+static int percore_cspace_alloc(void *data, seL4_CPtr *res)
+{
+    percore_data_t *core = data;
+
+    sel4utils_lock(&core->lock);
+    if (core->num_slots == 0 && refill_slots(core) != 0) {
+        sel4utils_unlock(&core->lock);
+        return -1;
+    }
+    *res = core->slots[--core->num_slots];
+    sel4utils_unlock(&core->lock);
+    return 0;
+}
+
+static void percore_cspace_make_path(void *data, seL4_CPtr slot, cspacepath_t *res)
+{
+    percore_data_t *core = data;
+    /* only reads the layout of the delegate's cspace, which does not change */
+    vka_cspace_make_path(core->shared->delegate, slot, res);
+}
+
+static void percore_cspace_free(void *data, seL4_CPtr slot)
+{
+    percore_data_t *core = data;
+
+    sel4utils_lock(&core->lock);
+    push_slot(core, slot);
+    sel4utils_unlock(&core->lock);
+}
+
+static int percore_utspace_alloc(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                 seL4_Word *res)
+{
+    percore_data_t *core = data;
+    percore_shared_t *shared = core->shared;
+
+    if (!is_cached(core, type, size_bits)) {
+        sel4utils_lock(&shared->lock);
+        int error = vka_utspace_alloc(shared->delegate, dest, type, size_bits, res);
+        sel4utils_unlock(&shared->lock);
+        return error;
+    }
+
+    object_cache_t *cache = &core->caches[type];
+    sel4utils_lock(&core->lock);
+    if (cache->num_objects == 0 && refill_objects(core, type) != 0) {
+        sel4utils_unlock(&core->lock);
+        return -1;
+    }
+    cached_object_t *object = &cache->objects[cache->num_objects - 1];
+    cspacepath_t src;
+    vka_cspace_make_path(shared->delegate, object->cptr, &src);
+    if (vka_cnode_move(dest, &src) != seL4_NoError) {
+        sel4utils_unlock(&core->lock);
+        ZF_LOGE("Failed to move cached object to dest");
+        return -1;
+    }
+    cache->num_objects--;
+    *res = object->cookie;
+    /* the slot the object was kept in is now empty */
+    push_slot(core, object->cptr);
+    sel4utils_unlock(&core->lock);
+    return 0;
+}
+
+static int percore_utspace_alloc_maybe_device(void *data, const cspacepath_t *dest, seL4_Word type,
+                                              seL4_Word size_bits, bool can_use_dev, seL4_Word *res)
+{
+    percore_data_t *core = data;
+    percore_shared_t *shared = core->shared;
+
+    if (!can_use_dev) {
+        return percore_utspace_alloc(data, dest, type, size_bits, res);
+    }
+    sel4utils_lock(&shared->lock);
+    int error = vka_utspace_alloc_maybe_device(shared->delegate, dest, type, size_bits, can_use_dev, res);
+    sel4utils_unlock(&shared->lock);
+    return error;
+}
+
+static int percore_utspace_alloc_at(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                    uintptr_t paddr, seL4_Word *res)
+{
+    percore_data_t *core = data;
+    percore_shared_t *shared = core->shared;
+
+    sel4utils_lock(&shared->lock);
+    int error = vka_utspace_alloc_at(shared->delegate, dest, type, size_bits, paddr, res);
+    sel4utils_unlock(&shared->lock);
+    return error;
+}
+
+static void percore_utspace_free(void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
+{
+    percore_data_t *core = data;
+    percore_shared_t *shared = core->shared;
+
+    if (!is_cached(core, type, size_bits)) {
+        sel4utils_lock(&shared->lock);
+        vka_utspace_free(shared->delegate, type, size_bits, target);
+        sel4utils_unlock(&shared->lock);
+        return;
+    }
+
+    object_cache_t *cache = &core->caches[type];
+    sel4utils_lock(&core->lock);
+    if (cache->num_freed == cache->batch) {
+        flush_freed(core, type);
+    }
+    cache->freed[cache->num_freed++] = target;
+    sel4utils_unlock(&core->lock);
+}
+
+static uintptr_t percore_utspace_paddr(void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits)
+{
+    percore_data_t *core = data;
+    percore_shared_t *shared = core->shared;
+
+    sel4utils_lock(&shared->lock);
+    uintptr_t paddr = vka_utspace_paddr(shared->delegate, target, type, size_bits);
+    sel4utils_unlock(&shared->lock);
+    return paddr;
+}
+
+static void free_core(percore_data_t *core)
+{
+    for (int type = 0; type < seL4_ObjectTypeCount; type++) {
+        free(core->caches[type].objects);
+        free(core->caches[type].freed);
+    }
+    free(core->slots);
+    free(core);
+}
+
+static percore_data_t *new_core(percore_shared_t *shared, size_t object_batch[seL4_ObjectTypeCount],
+                                size_t slot_batch)
+{
+    percore_data_t *core;
+    if (posix_memalign((void **) &core, PERCORE_CACHE_LINE, sizeof(*core)) != 0) {
+        return NULL;
+    }
+    memset(core, 0, sizeof(*core));
+    core->shared = shared;
+    core->slot_batch = slot_batch;
+    core->slots = malloc(2 * slot_batch * sizeof(*core->slots));
+    if (core->slots == NULL) {
+        free_core(core);
+        return NULL;
+    }
+    for (int type = 0; type < seL4_ObjectTypeCount; type++) {
+        object_cache_t *cache = &core->caches[type];
+        if (object_batch[type] == 0) {
+            continue;
+        }
+        cache->batch = object_batch[type];
+        cache->size_bits = vka_get_object_size(type, 0);
+        cache->objects = malloc(cache->batch * sizeof(*cache->objects));
+        cache->freed = malloc(cache->batch * sizeof(*cache->freed));
+        if (cache->objects == NULL || cache->freed == NULL) {
+            free_core(core);
+            return NULL;
+        }
+    }
+    return core;
+}
+
+int percore_vka_init(vka_t *cores, size_t num_cores, vka_t *delegate,
+                     size_t object_batch[seL4_ObjectTypeCount], size_t slot_batch)
+{
+    if (num_cores == 0 || slot_batch == 0) {
+        ZF_LOGE("Need at least one core and a slot batch");
+        return -1;
+    }
+    for (int type = 0; type < seL4_ObjectTypeCount; type++) {
+        if (object_batch[type] > 0 && vka_get_object_size(type, 0) == 0) {
+            ZF_LOGE("Cannot cache objects of type %d, they have no default size", type);
+            return -1;
+        }
+    }
+
+    percore_shared_t *shared = calloc(1, sizeof(*shared));
+    if (shared == NULL) {
+        ZF_LOGE("Failed to allocate shared state");
+        return -1;
+    }
+    shared->delegate = delegate;
+
+    for (size_t i = 0; i < num_cores; i++) {
+        percore_data_t *core = new_core(shared, object_batch, slot_batch);
+        if (core == NULL) {
+            ZF_LOGE("Failed to allocate cache of core %zu", i);
+            if (i > 0) {
+                percore_vka_destroy(cores, i);
+            } else {
+                free(shared);
+            }
+            return -1;
+        }
+        cores[i] = (vka_t) {
+            .data = core,
+            .cspace_alloc = percore_cspace_alloc,
+            .cspace_make_path = percore_cspace_make_path,
+            .utspace_alloc = percore_utspace_alloc,
+            .utspace_alloc_maybe_device = percore_utspace_alloc_maybe_device,
+            .utspace_alloc_at = percore_utspace_alloc_at,
+            .cspace_free = percore_cspace_free,
+            .utspace_free = percore_utspace_free,
+            .utspace_paddr = percore_utspace_paddr,
+        };
+    }
+    return 0;
+}
+
+void percore_vka_destroy(vka_t *cores, size_t num_cores)
+{
+    if (num_cores == 0) {
+        return;
+    }
+    percore_shared_t *shared = ((percore_data_t *) cores[0].data)->shared;
+
+    for (size_t i = 0; i < num_cores; i++) {
+        percore_data_t *core = cores[i].data;
+        for (int type = 0; type < seL4_ObjectTypeCount; type++) {
+            object_cache_t *cache = &core->caches[type];
+            for (size_t j = 0; j < cache->num_objects; j++) {
+                cspacepath_t path;
+                vka_cspace_make_path(shared->delegate, cache->objects[j].cptr, &path);
+                vka_cnode_delete(&path);
+                vka_utspace_free(shared->delegate, type, cache->size_bits, cache->objects[j].cookie);
+                vka_cspace_free(shared->delegate, cache->objects[j].cptr);
+            }
+            flush_freed(core, type);
+        }
+        flush_slots(core, core->num_slots);
+        free_core(core);
+        cores[i] = (vka_t) { 0 };
+    }
+    free(shared);
+}
@@ -23,7 +23,11 @@
 #include <sel4utils/util.h>
 #include <sel4utils/elf.h>
 #include <sel4utils/mapping.h>
+#include <sel4utils/page_copy.h>
 #include <sel4utils/helpers.h>
+#include <sel4utils/trace.h>
+#include <sel4utils/untyped_pool.h>
+#include "lock_internal.h"
 
 /* This library works with our cpio set up in the build system */
 extern char _cpio_archive[];
@@ -50,19 +54,38 @@ void sel4utils_allocated_object(void *cookie, vka_object_t object)
     recurse = false;
 }
 
-static void clear_objects(sel4utils_process_t *process, vka_t *vka)
+#define CLEAR_OBJECTS_BATCH 64
+
+/* Free the objects created by the vspace. If revoked they have already been deleted with
+ * the untyped pool of the process and only their slots are left */
+static void clear_objects(sel4utils_process_t *process, vka_t *vka, bool revoked)
 {
     assert(process != NULL);
     assert(vka != NULL);
 
+    /* once revoked only the slots are left, give them back a batch at a time */
+    seL4_CPtr slots[CLEAR_OBJECTS_BATCH];
+    size_t num_slots = 0;
+
     while (process->allocated_object_list_head != NULL) {
         object_node_t *prev = process->allocated_object_list_head;
 
         process->allocated_object_list_head = prev->next;
 
-        vka_free_object(vka, &prev->object);
+        if (revoked) {
+            slots[num_slots++] = prev->object.cptr;
+            if (num_slots == ARRAY_SIZE(slots)) {
+                vka_cspace_free_n(vka, num_slots, slots);
+                num_slots = 0;
+            }
+        } else {
+            vka_free_object(vka, &prev->object);
+        }
         free(prev);
     }
+    if (num_slots > 0) {
+        vka_cspace_free_n(vka, num_slots, slots);
+    }
 }
 
 static int next_free_slot(sel4utils_process_t *process, cspacepath_t *dest)
@@ -137,6 +160,48 @@ seL4_CPtr sel4utils_copy_path_to_process(sel4utils_process_t *process, cspacepat
     return dest.capPtr;
 }
 
+seL4_CPtr sel4utils_copy_caps_to_process(sel4utils_process_t *process, const sel4utils_process_cap_t *caps,
+                                         size_t num)
+{
+    cspacepath_t dest = { 0 };
+    if (num == 0 || next_free_slot(process, &dest) == -1) {
+        return 0;
+    }
+    if (num > BIT(process->cspace_size) - process->cspace_next_free) {
+        ZF_LOGE("Can't allocate %zu slots, cspace is full.\n", num);
+        return 0;
+    }
+
+    seL4_CPtr base = dest.capPtr;
+    size_t i;
+    for (i = 0; i < num; i++) {
+        cspacepath_t src = caps[i].src;
+        dest.capPtr = base + i;
+        int error;
+        if (caps[i].data != 0) {
+            error = vka_cnode_mint(&dest, &src, caps[i].rights, caps[i].data);
+        } else {
+            error = vka_cnode_copy(&dest, &src, caps[i].rights);
+        }
+        if (error != seL4_NoError) {
+            ZF_LOGE("Failed to copy cap %zu of %zu\n", i, num);
+            break;
+        }
+    }
+
+    if (i < num) {
+        /* take back the ones that were copied, so the process gets all or nothing */
+        while (i-- > 0) {
+            dest.capPtr = base + i;
+            vka_cnode_delete(&dest);
+        }
+        return 0;
+    }
+
+    process->cspace_next_free += num;
+    return base;
+}
+
 /* copy a cap to a process, returning the cptr in the process' cspace */
 seL4_CPtr sel4utils_copy_cap_to_process(sel4utils_process_t *process, vka_t *vka, seL4_CPtr cap)
 {
@@ -167,43 +232,118 @@ seL4_CPtr sel4utils_move_cap_to_process(sel4utils_process_t *process, cspacepath
     allocate_next_slot(process);
     return dest.capPtr;
 }
+/* Maximum number of stack pages sel4utils_stack_write maps at once */
+#define STACK_WRITE_WINDOW_PAGES 16
+
 int sel4utils_stack_write(vspace_t *current_vspace, vspace_t *target_vspace,
                           vka_t *vka, void *buf, size_t len, uintptr_t *initial_stack_pointer)
 {
-    size_t remaining = len;
-    size_t written = 0;
     uintptr_t new_stack_pointer = (*initial_stack_pointer) - len;
-    uintptr_t current_dest = new_stack_pointer;
-    while (remaining > 0) {
-        /* How many can we write on the current page ? */
-        size_t towrite = MIN(PAGE_SIZE_4K - (current_dest % PAGE_SIZE_4K), remaining);
-        assert(towrite != 0);
-        /* Get the cap */
-        seL4_CPtr frame = vspace_get_cap(target_vspace, (void *)PAGE_ALIGN_4K(current_dest));
-        if (!frame) {
-            return -1;
+    uintptr_t end = new_stack_pointer + len;
+    /* Map as many of the covering pages as we can at once, so writing a whole stack
+     * image is a single map, copy and unmap */
+    for (uintptr_t page = PAGE_ALIGN_4K(new_stack_pointer); page < end;) {
+        size_t num_pages = MIN(BYTES_TO_4K_PAGES(ROUND_UP(end, PAGE_SIZE_4K) - page), STACK_WRITE_WINDOW_PAGES);
+        seL4_CPtr caps[num_pages];
+        int error = 0;
+        size_t copied;
+        for (copied = 0; copied < num_pages; copied++) {
+            seL4_CPtr frame = vspace_get_cap(target_vspace, (void *)(page + copied * PAGE_SIZE_4K));
+            cspacepath_t src, dest;
+            if (!frame || vka_cspace_alloc_path(vka, &dest)) {
+                error = -1;
+                break;
+            }
+            vka_cspace_make_path(vka, frame, &src);
+            if (vka_cnode_copy(&dest, &src, seL4_AllRights) != seL4_NoError) {
+                vka_cspace_free_path(vka, dest);
+                error = -1;
+                break;
+            }
+            caps[copied] = dest.capPtr;
+        }
+        void *mapping = NULL;
+        if (!error) {
+            mapping = vspace_map_pages(current_vspace, caps, NULL, seL4_AllRights, num_pages, seL4_PageBits, 1);
+            error = mapping == NULL;
+        }
+        if (!error) {
+            uintptr_t copy_start = MAX(page, new_stack_pointer);
+            uintptr_t copy_end = MIN(page + num_pages * PAGE_SIZE_4K, end);
+            sel4utils_copy(mapping + (copy_start - page), buf + (copy_start - new_stack_pointer),
+                           copy_end - copy_start);
+            vspace_unmap_pages(current_vspace, mapping, num_pages, seL4_PageBits, VSPACE_PRESERVE);
+        }
+        for (size_t i = 0; i < copied; i++) {
+            cspacepath_t path;
+            vka_cspace_make_path(vka, caps[i], &path);
+            vka_cnode_delete(&path);
+            vka_cspace_free(vka, caps[i]);
         }
-        /* map it in */
-        void *mapping = sel4utils_dup_and_map(vka, current_vspace, frame, seL4_PageBits);
-        if (!mapping) {
+        if (error) {
             return -1;
         }
-        /* Copy the portion */
-        memcpy(mapping + (current_dest % PAGE_SIZE_4K), buf + written, towrite);
-        /* Unmap */
-        sel4utils_unmap_dup(vka, current_vspace, mapping, seL4_PageBits);
-        remaining -= towrite;
-        written += towrite;
-        current_dest += towrite;
+        page += num_pages * PAGE_SIZE_4K;
     }
     *initial_stack_pointer = new_stack_pointer;
     return 0;
 }
 
-static int sel4utils_stack_write_constant(vspace_t *current_vspace, vspace_t *target_vspace,
-                                          vka_t *vka, long value, uintptr_t *initial_stack_pointer)
+int sel4utils_stack_write_args(vspace_t *current_vspace, vspace_t *target_vspace, vka_t *vka,
+                               int argc, char *argv[], int envc, char *envp[],
+                               int auxc, Elf_auxv_t auxv[], uintptr_t *initial_stack_pointer)
 {
-    return sel4utils_stack_write(current_vspace, target_vspace, vka, &value, sizeof(value), initial_stack_pointer);
+    /* Lay out the strings first, from the top down, to find out where everything goes */
+    uintptr_t dest_argv[argc];
+    uintptr_t dest_envp[envc];
+    uintptr_t strings = *initial_stack_pointer;
+    for (int i = 0; i < argc + envc; i++) {
+        char *string = i < argc ? argv[i] : envp[i - argc];
+        strings -= strlen(string) + 1;
+        if (i < argc) {
+            dest_argv[i] = strings;
+        } else {
+            dest_envp[i - argc] = strings;
+        }
+        strings = ROUND_DOWN(strings, 4);
+    }
+
+    /* Below the strings: argc, argv, NULL, envp, NULL, auxv and a NULL aux entry, with the
+     * stack pointer left double word aligned for the process' entry */
+    size_t vectors = 5 * sizeof(seL4_Word) + /* constants */
+                     sizeof(auxv[0]) * auxc + /* aux */
+                     sizeof(dest_argv) + /* args */
+                     sizeof(dest_envp); /* env */
+    uintptr_t stack_pointer = ALIGN_DOWN(strings - vectors, STACK_CALL_ALIGNMENT);
+    size_t size = *initial_stack_pointer - stack_pointer;
+
+    char *image = calloc(1, size);
+    if (image == NULL) {
+        ZF_LOGE("Failed to allocate initial stack image of %zu bytes", size);
+        return -1;
+    }
+    for (int i = 0; i < argc + envc; i++) {
+        char *string = i < argc ? argv[i] : envp[i - argc];
+        uintptr_t dest = i < argc ? dest_argv[i] : dest_envp[i - argc];
+        strcpy(image + (dest - stack_pointer), string);
+    }
+    seL4_Word *words = (seL4_Word *) image;
+    *words++ = argc;
+    memcpy(words, dest_argv, sizeof(dest_argv));
+    words += argc + 1;
+    memcpy(words, dest_envp, sizeof(dest_envp));
+    words += envc + 1;
+    memcpy(words, auxv, sizeof(auxv[0]) * auxc);
+    /* the aux NULL terminator is already zero */
+
+    uintptr_t stack_top = *initial_stack_pointer;
+    int error = sel4utils_stack_write(current_vspace, target_vspace, vka, image, size, &stack_top);
+    free(image);
+    if (error) {
+        return -1;
+    }
+    *initial_stack_pointer = stack_pointer;
+    return 0;
 }
 
 static int sel4utils_stack_copy_args(vspace_t *current_vspace, vspace_t *target_vspace,
@@ -272,6 +412,7 @@ int sel4utils_spawn_process_v(sel4utils_process_t *process, vka_t *vka, vspace_t
     int envc = 0;
     char *envp[] = {};
 
+    SEL4_TRACE(process_spawn_start, 0);
     uintptr_t initial_stack_pointer = (uintptr_t) process->thread.stack_top - sizeof(seL4_Word);
 
     /* Copy the elf headers */
@@ -306,73 +447,13 @@ int sel4utils_spawn_process_v(sel4utils_process_t *process, vka_t *vka, vspace_t
 
     seL4_UserContext context = {0};
 
-    uintptr_t dest_argv[argc];
-    uintptr_t dest_envp[envc];
-
-    /* write all the strings into the stack */
-    /* Copy over the user arguments */
-    error = sel4utils_stack_copy_args(vspace, &process->vspace, vka, argc, argv, dest_argv, &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-
-    /* copy the environment */
-    error = sel4utils_stack_copy_args(vspace, &process->vspace, vka, envc, envp, dest_envp, &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-
-    /* we need to make sure the stack is aligned to a double word boundary after we push on everything else
-     * below this point. First, work out how much we are going to push */
-    size_t to_push = 5 * sizeof(seL4_Word) + /* constants */
-                     sizeof(auxv[0]) * auxc + /* aux */
-                     sizeof(dest_argv) + /* args */
-                     sizeof(dest_envp); /* env */
-    uintptr_t hypothetical_stack_pointer = initial_stack_pointer - to_push;
-    uintptr_t rounded_stack_pointer = ALIGN_DOWN(hypothetical_stack_pointer, STACK_CALL_ALIGNMENT);
-    ptrdiff_t stack_rounding = hypothetical_stack_pointer - rounded_stack_pointer;
-    initial_stack_pointer -= stack_rounding;
-
-    /* construct initial stack frame */
-    /* Null terminate aux */
-    error = sel4utils_stack_write_constant(vspace, &process->vspace, vka, 0, &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-    error = sel4utils_stack_write_constant(vspace, &process->vspace, vka, 0, &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-    /* write aux */
-    error = sel4utils_stack_write(vspace, &process->vspace, vka, auxv, sizeof(auxv[0]) * auxc, &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-    /* Null terminate environment */
-    error = sel4utils_stack_write_constant(vspace, &process->vspace, vka, 0, &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-    /* write environment */
-    error = sel4utils_stack_write(vspace, &process->vspace, vka, dest_envp, sizeof(dest_envp), &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-    /* Null terminate arguments */
-    error = sel4utils_stack_write_constant(vspace, &process->vspace, vka, 0, &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-    /* write arguments */
-    error = sel4utils_stack_write(vspace, &process->vspace, vka, dest_argv, sizeof(dest_argv), &initial_stack_pointer);
-    if (error) {
-        return -1;
-    }
-    /* Push argument count */
-    error = sel4utils_stack_write_constant(vspace, &process->vspace, vka, argc, &initial_stack_pointer);
+    /* write the strings, argument and environment vectors and aux in one go */
+    error = sel4utils_stack_write_args(vspace, &process->vspace, vka, argc, argv, envc, envp, auxc, auxv,
+                                       &initial_stack_pointer);
     if (error) {
         return -1;
     }
+    SEL4_TRACE(process_spawn_stack, 0);
 
     ZF_LOGD("Starting process at %p, stack %p\n", process->entry_point, (void *) initial_stack_pointer);
     assert(initial_stack_pointer % (2 * sizeof(seL4_Word)) == 0);
@@ -384,8 +465,10 @@ int sel4utils_spawn_process_v(sel4utils_process_t *process, vka_t *vka, vspace_t
     process->thread.initial_stack_pointer = (void *) initial_stack_pointer;
 
     /* Write the registers */
-    return seL4_TCB_WriteRegisters(process->thread.tcb.cptr, resume, 0, sizeof(context) / sizeof(seL4_Word),
-                                   &context);
+    error = seL4_TCB_WriteRegisters(process->thread.tcb.cptr, resume, 0, sizeof(context) / sizeof(seL4_Word),
+                                    &context);
+    SEL4_TRACE(process_spawn_done, error);
+    return error;
 }
 
 int sel4utils_configure_process(sel4utils_process_t *process, vka_t *vka,
@@ -423,9 +506,15 @@ static seL4_CPtr get_asid_pool(seL4_CPtr asid_pool)
     return asid_pool;
 }
 
+/* Serialises ASID pool assignment between the workers of sel4utils_spawn_batch. It is
+ * the only step of configuring a process that touches state shared between workers */
+static volatile int asid_pool_lock;
+
 static seL4_CPtr assign_asid_pool(seL4_CPtr asid_pool, seL4_CPtr pd)
 {
+    sel4utils_lock(&asid_pool_lock);
     int error = seL4_ARCH_ASIDPool_Assign(get_asid_pool(asid_pool), pd);
+    sel4utils_unlock(&asid_pool_lock);
     if (error) {
         ZF_LOGE("Failed to assign asid pool\n");
     }
@@ -497,9 +586,27 @@ int sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
 {
     int error;
     sel4utils_alloc_data_t *data = NULL;
+    SEL4_TRACE(process_configure_start, 0);
     memset(process, 0, sizeof(sel4utils_process_t));
     seL4_Word cspace_root_data = api_make_guard_skip_word(seL4_WordBits - config.one_level_cspace_size_bits);
 
+    if (config.object_vka != NULL) {
+        vka = config.object_vka;
+        process->object_vka = vka;
+        config.elf_cache = NULL;
+    }
+
+    /* carve everything that follows from untypeds for this process alone */
+    if (config.untyped_pool_size_bits != 0) {
+        error = sel4utils_untyped_pool_init(&process->untyped_pool, vka, config.untyped_pool_size_bits);
+        if (error) {
+            ZF_LOGE("Failed to create untyped pool for new process");
+            return -1;
+        }
+        vka = &process->untyped_pool;
+        config.elf_cache = NULL;
+    }
+
     /* create a page directory */
     process->own_vspace = config.create_vspace;
     if (config.create_vspace) {
@@ -510,8 +617,14 @@ int sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
         }
 
         /* assign an asid pool */
-        if (!config_set(CONFIG_X86_64) &&
-            assign_asid_pool(config.asid_pool, process->pd.cptr) != seL4_NoError) {
+        if (!config_set(CONFIG_X86_64) && config.asid_manager != NULL) {
+            if (sel4utils_asid_manager_assign(config.asid_manager, process->pd.cptr, &config.asid_pool) != 0) {
+                goto error;
+            }
+            process->asid_manager = config.asid_manager;
+            process->asid_pool = config.asid_pool;
+        } else if (!config_set(CONFIG_X86_64) &&
+                   assign_asid_pool(config.asid_pool, process->pd.cptr) != seL4_NoError) {
             goto error;
         }
     } else {
@@ -535,6 +648,7 @@ int sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
     } else {
         process->cspace = config.cnode;
     }
+    SEL4_TRACE(process_configure_cspace, 0);
 
     /* create a vspace */
     if (config.create_vspace) {
@@ -550,6 +664,7 @@ int sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
     } else {
         memcpy(&process->vspace, config.vspace, sizeof(process->vspace));
     }
+    SEL4_TRACE(process_configure_vspace, 0);
 
     /* finally elf load */
     if (config.is_elf) {
@@ -559,7 +674,13 @@ int sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
         elf_t elf;
         elf_newFile(file, size, &elf);
 
-        if (config.do_elf_load) {
+        if (config.do_elf_load && config.elf_cache != NULL) {
+            process->entry_point = sel4utils_elf_load_cached(config.elf_cache, &process->vspace, spawner_vspace,
+                                                             vka, vka, &elf);
+        } else if (config.do_elf_load && config.elf_max_page_bits != 0) {
+            process->entry_point = sel4utils_elf_load_max_page_bits(&process->vspace, spawner_vspace, vka, vka, &elf,
+                                                                    config.elf_max_page_bits);
+        } else if (config.do_elf_load) {
             process->entry_point = sel4utils_elf_load(&process->vspace, spawner_vspace, vka, vka, &elf);
         } else {
             process->num_elf_regions = sel4utils_elf_num_regions(&elf);
@@ -590,6 +711,7 @@ int sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
         process->entry_point = config.entry_point;
         process->sysinfo = config.sysinfo;
     }
+    SEL4_TRACE(process_configure_elf, 0);
 
     /* select the default page size of machine this process is running on */
     process->pagesz = PAGE_SIZE_4K;
@@ -639,6 +761,7 @@ int sel4utils_configure_process_custom(sel4utils_process_t *process, vka_t *vka,
         }
     }
 
+    SEL4_TRACE(process_configure_done, 0);
     return 0;
 
 error:
@@ -653,6 +776,9 @@ error:
 
     if (config.create_vspace && process->pd.cptr != 0) {
         vka_free_object(vka, &process->pd);
+        if (process->asid_manager != NULL) {
+            sel4utils_asid_manager_release(process->asid_manager, process->asid_pool);
+        }
         if (process->vspace.data != 0) {
             ZF_LOGE("Could not clean up vspace\n");
         }
@@ -670,11 +796,138 @@ error:
         free(data);
     }
 
+    if (process->untyped_pool.data != NULL) {
+        sel4utils_untyped_pool_destroy(&process->untyped_pool);
+    }
+
     return -1;
 }
 
+struct sel4utils_spawn_batch {
+    size_t num_jobs;
+    sel4utils_spawn_job_t *jobs;
+    /* index of the next job to hand out */
+    size_t next;
+    /* number of workers that have run out of jobs */
+    size_t finished;
+    /* signalled by each worker as it finishes */
+    seL4_CPtr done;
+};
+
+static void run_spawn_jobs(struct sel4utils_spawn_batch *batch, vka_t *vka, vspace_t *vspace)
+{
+    size_t i;
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->num_jobs) {
+        sel4utils_spawn_job_t *job = &batch->jobs[i];
+        job->vka = vka;
+        job->error = sel4utils_configure_process_custom(job->process, vka, vspace, job->config);
+        if (job->error) {
+            ZF_LOGE("Failed to configure process for job %zu", i);
+            continue;
+        }
+        job->error = sel4utils_spawn_process_v(job->process, vka, vspace, job->argc, job->argv, job->resume);
+        if (job->error) {
+            ZF_LOGE("Failed to spawn process for job %zu", i);
+            sel4utils_destroy_process(job->process, vka);
+        }
+    }
+}
+
+static void spawn_worker(sel4utils_spawn_worker_t *worker)
+{
+    struct sel4utils_spawn_batch *batch = worker->batch;
+    run_spawn_jobs(batch, worker->vka, worker->vspace);
+    __atomic_fetch_add(&batch->finished, 1, __ATOMIC_RELEASE);
+    seL4_Signal(batch->done);
+    /* sel4utils_spawn_batch cleans us up */
+    seL4_TCB_Suspend(worker->thread.tcb.cptr);
+}
+
+int sel4utils_spawn_batch(simple_t *simple, vka_t *vka, vspace_t *vspace, uint8_t priority,
+                          size_t num_workers, sel4utils_spawn_worker_t workers[num_workers],
+                          size_t num_jobs, sel4utils_spawn_job_t jobs[num_jobs])
+{
+    vka_object_t done = {0};
+    int error = vka_alloc_notification(vka, &done);
+    if (error) {
+        ZF_LOGE("Failed to allocate notification for spawn batch");
+        return -1;
+    }
+
+    struct sel4utils_spawn_batch batch = {
+        .num_jobs = num_jobs,
+        .jobs = jobs,
+        .done = done.cptr,
+    };
+    for (size_t i = 0; i < num_jobs; i++) {
+        jobs[i].error = -1;
+        jobs[i].vka = NULL;
+    }
+
+    num_workers = MIN(num_workers, (size_t) simple_get_core_count(simple));
+    size_t started;
+    for (started = 0; started < num_workers; started++) {
+        sel4utils_spawn_worker_t *worker = &workers[started];
+        sel4utils_thread_config_t config = thread_config_new(simple);
+        config = thread_config_priority(config, priority);
+        if (config_set(CONFIG_KERNEL_MCS)) {
+            /* seL4_Time measures time in us, the config parameter uses ms. */
+            seL4_Time timeslice_us = CONFIG_BOOT_THREAD_TIME_SLICE * US_IN_MS;
+            config.sched_params = sched_params_round_robin(config.sched_params, simple, started, timeslice_us);
+        } else {
+            config.sched_params = sched_params_core(config.sched_params, started);
+        }
+        worker->batch = &batch;
+        error = sel4utils_configure_thread_config(vka, vspace, vspace, config, &worker->thread);
+        if (error) {
+            ZF_LOGE("Failed to configure spawn worker %zu", started);
+            break;
+        }
+        error = sel4utils_start_thread(&worker->thread, (sel4utils_thread_entry_fn) spawn_worker, worker, NULL, 1);
+        if (error) {
+            ZF_LOGE("Failed to start spawn worker %zu", started);
+            sel4utils_clean_up_thread(vka, vspace, &worker->thread);
+            break;
+        }
+    }
+
+    if (started == 0) {
+        ZF_LOGW("No spawn workers, running the batch on the calling thread");
+        run_spawn_jobs(&batch, vka, vspace);
+    }
+
+    /* signals to the notification coalesce, so count finished workers separately */
+    while (__atomic_load_n(&batch.finished, __ATOMIC_ACQUIRE) < started) {
+        seL4_Wait(done.cptr, NULL);
+    }
+    for (size_t i = 0; i < started; i++) {
+        sel4utils_clean_up_thread(vka, vspace, &workers[i].thread);
+    }
+    vka_free_object(vka, &done);
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (jobs[i].error) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 void sel4utils_destroy_process(sel4utils_process_t *process, vka_t *vka)
 {
+    /* Every object of the process was carved from its pool, revoking the pool deletes them
+     * all at once and what follows only has book keeping left to free */
+    SEL4_TRACE(process_destroy_start, 0);
+    if (process->object_vka != NULL) {
+        vka = process->object_vka;
+    }
+    bool revoked = process->untyped_pool.data != NULL;
+    if (revoked) {
+        sel4utils_untyped_pool_revoke(&process->untyped_pool);
+        process->data.objects_revoked = true;
+        vka = &process->untyped_pool;
+    }
+
     /* destroy the cnode */
     if (process->own_cspace) {
         cspacepath_t path;
@@ -684,26 +937,31 @@ void sel4utils_destroy_process(sel4utils_process_t *process, vka_t *vka)
         vka_cnode_revoke(&path);
         vka_free_object(vka, &process->cspace);
     }
-
+    SEL4_TRACE(process_destroy_cspace, 0);
 
     /* destroy the thread */
     sel4utils_clean_up_thread(vka, &process->vspace, &process->thread);
+    SEL4_TRACE(process_destroy_thread, 0);
 
     /* tear down the vspace */
     if (process->own_vspace) {
         vspace_tear_down(&process->vspace, VSPACE_FREE);
         /* free any objects created by the vspace */
-        clear_objects(process, vka);
+        clear_objects(process, vka, revoked);
     }
+    SEL4_TRACE(process_destroy_vspace, 0);
 
     /* destroy the endpoint */
     if (process->own_ep && process->fault_endpoint.cptr != 0) {
         vka_free_object(vka, &process->fault_endpoint);
     }
 
-    /* destroy the page directory */
+    /* destroy the page directory, which gives back its ASID */
     if (process->own_vspace) {
         vka_free_object(vka, &process->pd);
+        if (process->asid_manager != NULL) {
+            sel4utils_asid_manager_release(process->asid_manager, process->asid_pool);
+        }
     }
 
     /* Free elf information */
@@ -714,6 +972,198 @@ void sel4utils_destroy_process(sel4utils_process_t *process, vka_t *vka)
     if (process->elf_phdrs) {
         free(process->elf_phdrs);
     }
+
+    if (revoked) {
+        sel4utils_untyped_pool_destroy(&process->untyped_pool);
+    }
+    SEL4_TRACE(process_destroy_done, 0);
+}
+
+/* Size of the frame mapped at vaddr in the process. Frames the process owns repeat
+ * their cookie in every 4K page, anything else is treated as 4K */
+static size_t process_frame_bits(sel4utils_process_t *process, uintptr_t vaddr, uintptr_t end)
+{
+    uintptr_t cookie = vspace_get_cookie(&process->vspace, (void *) vaddr);
+    for (int i = SEL4_NUM_PAGE_SIZES - 1; cookie != 0 && i > 0; i--) {
+        size_t bits = sel4_page_sizes[i];
+        if (IS_ALIGNED(vaddr, bits) && vaddr + BIT(bits) <= end &&
+            vspace_get_cookie(&process->vspace, (void *)(vaddr + BIT(bits) - PAGE_SIZE_4K)) == cookie) {
+            return bits;
+        }
+    }
+    return seL4_PageBits;
+}
+
+/* Map the frame the process has at vaddr into vspace through a copy of its cap */
+static void *map_process_frame(sel4utils_process_t *process, vka_t *vka, vspace_t *vspace, uintptr_t vaddr,
+                               size_t size_bits, seL4_CPtr *slot)
+{
+    cspacepath_t src, dest;
+    if (vka_cspace_alloc_path(vka, &dest)) {
+        ZF_LOGE("Failed to allocate cslot");
+        return NULL;
+    }
+    vka_cspace_make_path(vka, vspace_get_cap(&process->vspace, (void *) vaddr), &src);
+    if (vka_cnode_copy(&dest, &src, seL4_AllRights) != seL4_NoError) {
+        ZF_LOGE("Failed to copy frame cap");
+        vka_cspace_free_path(vka, dest);
+        return NULL;
+    }
+    void *mapping = vspace_map_pages(vspace, &dest.capPtr, NULL, seL4_AllRights, 1, size_bits, 1);
+    if (mapping == NULL) {
+        ZF_LOGE("Failed to map frame");
+        vka_cnode_delete(&dest);
+        vka_cspace_free_path(vka, dest);
+        return NULL;
+    }
+    *slot = dest.capPtr;
+    return mapping;
+}
+
+static void unmap_process_frame(vka_t *vka, vspace_t *vspace, void *mapping, size_t size_bits, seL4_CPtr slot)
+{
+    cspacepath_t path;
+    vspace_unmap_pages(vspace, mapping, 1, size_bits, VSPACE_PRESERVE);
+    vka_cspace_make_path(vka, slot, &path);
+    vka_cnode_delete(&path);
+    vka_cspace_free(vka, slot);
+}
+
+/* Add a pristine copy of every frame the process has in [start, end) to the snapshot */
+static int snapshot_range(sel4utils_process_t *process, vka_t *vka, vspace_t *vspace,
+                          sel4utils_process_snapshot_t *snapshot, uintptr_t start, uintptr_t end)
+{
+    for (uintptr_t v = start; v < end;) {
+        if (vspace_get_cap(&process->vspace, (void *) v) == seL4_CapNull) {
+            /* not (yet) mapped, nothing to restore */
+            v += PAGE_SIZE_4K;
+            continue;
+        }
+        size_t size_bits = process_frame_bits(process, v, end);
+        sel4utils_process_snapshot_frame_t *frame = &snapshot->frames[snapshot->num_frames];
+        frame->vaddr = v;
+        frame->size_bits = size_bits;
+        if (vka_alloc_frame(vka, size_bits, &frame->pristine)) {
+            ZF_LOGE("Failed to allocate pristine frame for %p", (void *) v);
+            return -1;
+        }
+        frame->copy = vspace_map_pages(vspace, &frame->pristine.cptr, NULL, seL4_AllRights, 1, size_bits, 1);
+        if (frame->copy == NULL) {
+            ZF_LOGE("Failed to map pristine frame for %p", (void *) v);
+            vka_free_object(vka, &frame->pristine);
+            return -1;
+        }
+        snapshot->num_frames++;
+
+        seL4_CPtr slot;
+        void *mapping = map_process_frame(process, vka, vspace, v, size_bits, &slot);
+        if (mapping == NULL) {
+            return -1;
+        }
+        sel4utils_copy_pages(frame->copy, mapping, BIT(size_bits));
+        unmap_process_frame(vka, vspace, mapping, size_bits, slot);
+        v += BIT(size_bits);
+    }
+    return 0;
+}
+
+int sel4utils_process_snapshot(sel4utils_process_t *process, vka_t *vka, vspace_t *vspace,
+                               sel4utils_process_snapshot_t *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    /* every page we might copy, an upper bound on the number of frames */
+    uintptr_t stack_bottom = (uintptr_t) process->thread.stack_top - process->thread.stack_size * PAGE_SIZE_4K;
+    size_t max_frames = process->thread.stack_size + (process->thread.ipc_buffer_addr != 0);
+    for (int i = 0; i < process->num_elf_phdrs; i++) {
+        Elf_Phdr *phdr = &process->elf_phdrs[i];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_W)) {
+            max_frames += BYTES_TO_4K_PAGES(ROUND_UP(phdr->p_vaddr + phdr->p_memsz, PAGE_SIZE_4K) -
+                                            ROUND_DOWN(phdr->p_vaddr, PAGE_SIZE_4K));
+        }
+    }
+    snapshot->frames = calloc(max_frames, sizeof(*snapshot->frames));
+    if (max_frames > 0 && snapshot->frames == NULL) {
+        ZF_LOGE("Failed to allocate snapshot");
+        return -1;
+    }
+
+    int error = seL4_TCB_ReadRegisters(process->thread.tcb.cptr, true, 0,
+                                       sizeof(seL4_UserContext) / sizeof(seL4_Word), &snapshot->regs);
+    if (error) {
+        ZF_LOGE("Failed to read registers of process");
+        goto error;
+    }
+
+    uintptr_t last_end = 0;
+    for (int i = 0; i < process->num_elf_phdrs; i++) {
+        Elf_Phdr *phdr = &process->elf_phdrs[i];
+        if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_W)) {
+            continue;
+        }
+        /* writable segments may share their first page with the one before */
+        uintptr_t start = MAX(ROUND_DOWN(phdr->p_vaddr, PAGE_SIZE_4K), last_end);
+        uintptr_t end = ROUND_UP(phdr->p_vaddr + phdr->p_memsz, PAGE_SIZE_4K);
+        if (start < end && snapshot_range(process, vka, vspace, snapshot, start, end)) {
+            goto error;
+        }
+        last_end = MAX(last_end, end);
+    }
+    if (snapshot_range(process, vka, vspace, snapshot, stack_bottom, (uintptr_t) process->thread.stack_top)) {
+        goto error;
+    }
+    if (process->thread.ipc_buffer_addr != 0 &&
+        snapshot_range(process, vka, vspace, snapshot, process->thread.ipc_buffer_addr,
+                       process->thread.ipc_buffer_addr + PAGE_SIZE_4K)) {
+        goto error;
+    }
+    return 0;
+
+error:
+    sel4utils_process_snapshot_free(snapshot, vka, vspace);
+    return -1;
+}
+
+int sel4utils_process_reset(sel4utils_process_t *process, vka_t *vka, vspace_t *vspace,
+                            sel4utils_process_snapshot_t *snapshot, bool resume)
+{
+    int error = seL4_TCB_Suspend(process->thread.tcb.cptr);
+    if (error) {
+        ZF_LOGE("Failed to suspend process");
+        return -1;
+    }
+
+    for (size_t i = 0; i < snapshot->num_frames; i++) {
+        sel4utils_process_snapshot_frame_t *frame = &snapshot->frames[i];
+        seL4_CPtr slot;
+        void *mapping = map_process_frame(process, vka, vspace, frame->vaddr, frame->size_bits, &slot);
+        if (mapping == NULL) {
+            ZF_LOGE("Failed to restore frame at %p", (void *) frame->vaddr);
+            return -1;
+        }
+        sel4utils_copy_pages(mapping, frame->copy, BIT(frame->size_bits));
+        unmap_process_frame(vka, vspace, mapping, frame->size_bits, slot);
+    }
+
+    error = seL4_TCB_WriteRegisters(process->thread.tcb.cptr, resume, 0,
+                                    sizeof(seL4_UserContext) / sizeof(seL4_Word), &snapshot->regs);
+    if (error) {
+        ZF_LOGE("Failed to restore registers of process");
+        return -1;
+    }
+    return 0;
+}
+
+void sel4utils_process_snapshot_free(sel4utils_process_snapshot_t *snapshot, vka_t *vka, vspace_t *vspace)
+{
+    for (size_t i = 0; i < snapshot->num_frames; i++) {
+        sel4utils_process_snapshot_frame_t *frame = &snapshot->frames[i];
+        vspace_unmap_pages(vspace, frame->copy, 1, frame->size_bits, VSPACE_PRESERVE);
+        vka_free_object(vka, &frame->pristine);
+    }
+    free(snapshot->frames);
+    snapshot->frames = NULL;
+    snapshot->num_frames = 0;
 }
 
 seL4_CPtr sel4utils_process_init_cap(void *data, seL4_CPtr cap)
@@ -5,6 +5,7 @@
  */
 
 #include <sel4utils/profile.h>
+#include <assert.h>
 #include <stdio.h>
 #include <inttypes.h>
 
@@ -15,6 +16,36 @@
 extern profile_var_t __start__profile_var[];
 extern profile_var_t __stop__profile_var[];
 
+/* Lock statistics from libsel4sync, when it is linked in */
+void sync_profile_scrape(profile_callback64 callback64, void *cookie) WEAK;
+void sync_profile_reset(void) WEAK;
+
+__thread unsigned int profile_core;
+
+static profile_source_t *profile_sources;
+
+void profile_set_core(unsigned int core)
+{
+    assert(core < CONFIG_MAX_NUM_NODES);
+    profile_core = core;
+}
+
+void profile_register_source(profile_source_t *source)
+{
+    source->next = profile_sources;
+    profile_sources = source;
+}
+
+void profile_unregister_source(profile_source_t *source)
+{
+    for (profile_source_t **i = &profile_sources; *i != NULL; i = &(*i)->next) {
+        if (*i == source) {
+            *i = source->next;
+            return;
+        }
+    }
+}
+
 void profile_print32(uint32_t value, const char *varname, const char *description, void *cookie)
 {
     printf("%s: %"PRIu32" %s\n", varname, value, description);
@@ -34,11 +65,26 @@ void profile_scrape(profile_callback32 callback32, profile_callback64 callback64
         case PROFILE_VAR_TYPE_INT64:
             callback64(*(uint64_t*)i->var, i->varname, i->description, cookie);
             break;
+        case PROFILE_VAR_TYPE_SHARDED64: {
+            profile_shard_t *shards = i->var;
+            uint64_t sum = 0;
+            for (int core = 0; core < CONFIG_MAX_NUM_NODES; core++) {
+                sum += shards[core].value;
+            }
+            callback64(sum, i->varname, i->description, cookie);
+            break;
+        }
         default:
             ZF_LOGE("Unknown profile var. Probable memory corruption or linker failure!");
             break;
         }
     }
+    if (sync_profile_scrape != NULL) {
+        sync_profile_scrape(callback64, cookie);
+    }
+    for (profile_source_t *source = profile_sources; source != NULL; source = source->next) {
+        source->scrape(source->data, callback64, cookie);
+    }
 }
 
 void profile_reset(void)
@@ -51,9 +97,17 @@ void profile_reset(void)
         case PROFILE_VAR_TYPE_INT64:
             *(uint64_t*)i->var = 0;
             break;
+        case PROFILE_VAR_TYPE_SHARDED64:
+            for (int core = 0; core < CONFIG_MAX_NUM_NODES; core++) {
+                ((profile_shard_t *)i->var)[core].value = 0;
+            }
+            break;
         default:
             ZF_LOGE("Unknown profile var. Probable memory corruption or linker failure!");
             break;
         }
     }
+    if (sync_profile_reset != NULL) {
+        sync_profile_reset();
+    }
 }
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <sel4utils/ring.h>
+#include <utils/util.h>
+
+static inline size_t ring_size(sel4utils_ring_shared_t *shared)
+{
+    return shared->mask + 1;
+}
+
+int sel4utils_ring_create(vspace_t *vspace, size_t size_bits, bool multi_producer, seL4_CPtr notify,
+                          sel4utils_ring_t *ring)
+{
+    size_t bytes = sizeof(sel4utils_ring_shared_t) + BIT(size_bits) * sizeof(sel4utils_ring_desc_t);
+    ring->num_pages = BYTES_TO_4K_PAGES(ROUND_UP(bytes, PAGE_SIZE_4K));
+    ring->shared = vspace_new_pages(vspace, seL4_AllRights, ring->num_pages, PAGE_BITS_4K);
+    if (ring->shared == NULL) {
+        ZF_LOGE("Failed to allocate %zu pages for ring", ring->num_pages);
+        return -1;
+    }
+    memset(ring->shared, 0, sizeof(*ring->shared));
+    ring->shared->mask = BIT(size_bits) - 1;
+    ring->shared->multi_producer = multi_producer;
+    ring->notify = notify;
+    return 0;
+}
+
+void *sel4utils_ring_share(sel4utils_ring_t *ring, vspace_t *from, vspace_t *to)
+{
+    return vspace_share_mem(from, to, ring->shared, ring->num_pages, PAGE_BITS_4K, seL4_AllRights, 1);
+}
+
+void sel4utils_ring_attach(void *shared, seL4_CPtr notify, sel4utils_ring_t *ring)
+{
+    ring->shared = shared;
+    ring->notify = notify;
+    ring->num_pages = 0;
+}
+
+void sel4utils_ring_destroy(vspace_t *vspace, sel4utils_ring_t *ring)
+{
+    vspace_unmap_pages(vspace, ring->shared, ring->num_pages, PAGE_BITS_4K, VSPACE_FREE);
+    ring->shared = NULL;
+}
+
+static inline void ring_signal(sel4utils_ring_t *ring)
+{
+    if (ring->notify != seL4_CapNull) {
+        seL4_Signal(ring->notify);
+    }
+}
+
+size_t sel4utils_ring_enqueue(sel4utils_ring_t *ring, const sel4utils_ring_desc_t *descs, size_t num)
+{
+    sel4utils_ring_shared_t *shared = ring->shared;
+    size_t start, n;
+    size_t reserve = __atomic_load_n(&shared->reserve, __ATOMIC_RELAXED);
+    do {
+        size_t tail = __atomic_load_n(&shared->tail, __ATOMIC_ACQUIRE);
+        start = reserve;
+        n = MIN(num, ring_size(shared) - (start - tail));
+        if (n == 0) {
+            return 0;
+        }
+        if (!shared->multi_producer) {
+            __atomic_store_n(&shared->reserve, start + n, __ATOMIC_RELAXED);
+            break;
+        }
+    } while (!__atomic_compare_exchange_n(&shared->reserve, &reserve, start + n, true, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    for (size_t i = 0; i < n; i++) {
+        shared->descs[(start + i) & shared->mask] = descs[i];
+    }
+    /* producers that claimed earlier slots publish first. One of them may have been
+     * preempted by us on this core, so give it the chance to run */
+    while (__atomic_load_n(&shared->head, __ATOMIC_RELAXED) != start) {
+        seL4_Yield();
+    }
+    __atomic_store_n(&shared->head, start + n, __ATOMIC_RELEASE);
+    /* pairs with the fence in dequeue: either the consumer sees our descriptors, or we see
+     * that it had taken everything before them and may be about to wait */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shared->tail, __ATOMIC_RELAXED) == start) {
+        ring_signal(ring);
+    }
+    return n;
+}
+
+size_t sel4utils_ring_dequeue(sel4utils_ring_t *ring, sel4utils_ring_desc_t *descs, size_t max)
+{
+    sel4utils_ring_shared_t *shared = ring->shared;
+    size_t tail = __atomic_load_n(&shared->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&shared->head, __ATOMIC_ACQUIRE);
+    size_t n = MIN(max, head - tail);
+    if (n == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        descs[i] = shared->descs[(tail + i) & shared->mask];
+    }
+    __atomic_store_n(&shared->tail, tail + n, __ATOMIC_RELEASE);
+    /* as in enqueue, but for producers that found the ring full */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shared->reserve, __ATOMIC_RELAXED) - tail == ring_size(shared)) {
+        ring_signal(ring);
+    }
+    return n;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sel4utils/sampler.h>
+#include <sel4utils/util.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <utils/util.h>
+
+int sel4utils_sampler_init(sel4utils_sampler_t *sampler, sel4utils_sample_t *samples, size_t size_bits,
+                           sel4utils_sampler_target_t *targets, size_t num_targets)
+{
+    if (sampler == NULL || samples == NULL || (targets == NULL && num_targets != 0)) {
+        ZF_LOGE("Invalid arguments to sel4utils_sampler_init");
+        return -1;
+    }
+
+    sampler->targets = targets;
+    sampler->num_targets = num_targets;
+    sampler->samples = samples;
+    sampler->mask = MASK(size_bits);
+    sampler->head = 0;
+    sampler->failed = 0;
+    sampler->enabled = false;
+    sampler->rearm_fn = NULL;
+    sampler->rearm_data = NULL;
+    return 0;
+}
+
+void sel4utils_sampler_enable(sel4utils_sampler_t *sampler, bool enabled)
+{
+    __atomic_store_n(&sampler->enabled, enabled, __ATOMIC_RELEASE);
+}
+
+void sel4utils_sampler_reset(sel4utils_sampler_t *sampler)
+{
+    sampler->head = 0;
+    sampler->failed = 0;
+}
+
+void sel4utils_sampler_sample(sel4utils_sampler_t *sampler)
+{
+    if (!__atomic_load_n(&sampler->enabled, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    for (size_t i = 0; i < sampler->num_targets; i++) {
+        seL4_UserContext regs;
+        int error = seL4_TCB_ReadRegisters(sampler->targets[i].tcb, false, 0,
+                                           sizeof(seL4_UserContext) / sizeof(seL4_Word), &regs);
+        if (error) {
+            sampler->failed++;
+            continue;
+        }
+        sel4utils_sample_t *sample = &sampler->samples[sampler->head & sampler->mask];
+        sample->id = sampler->targets[i].id;
+        sample->pc = sel4utils_get_instruction_pointer(regs);
+        sampler->head++;
+    }
+}
+
+void sel4utils_sampler_irq_callback(void *data, irq_acknowledge_fn_t acknowledge_fn, void *ack_data)
+{
+    sel4utils_sampler_t *sampler = data;
+
+    sel4utils_sampler_sample(sampler);
+    if (sampler->rearm_fn != NULL) {
+        int error = sampler->rearm_fn(sampler->rearm_data);
+        ZF_LOGE_IF(error, "Failed to rearm the sampler");
+    }
+    int error = acknowledge_fn(ack_data);
+    ZF_LOGE_IF(error, "Failed to acknowledge the sampler's IRQ");
+}
+
+irq_id_t sel4utils_sampler_register_irq(sel4utils_sampler_t *sampler, irq_server_t *irq_server, ps_irq_t irq)
+{
+    return irq_server_register_irq(irq_server, irq, sel4utils_sampler_irq_callback, sampler);
+}
+
+size_t sel4utils_sampler_num_samples(sel4utils_sampler_t *sampler)
+{
+    return MIN(sampler->head, sampler->mask + 1);
+}
+
+void sel4utils_sampler_dump(sel4utils_sampler_t *sampler)
+{
+    size_t num = sel4utils_sampler_num_samples(sampler);
+
+    printf("# sel4utils_sampler samples=%zu taken=%zu failed=%zu\n", num, sampler->head, sampler->failed);
+    for (size_t i = sampler->head - num; i != sampler->head; i++) {
+        sel4utils_sample_t *sample = &sampler->samples[i & sampler->mask];
+        printf("%"PRIuPTR" 0x%"PRIxPTR"\n", (uintptr_t) sample->id, (uintptr_t) sample->pc);
+    }
+}
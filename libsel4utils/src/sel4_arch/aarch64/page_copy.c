@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#ifdef CONFIG_SEL4UTILS_PAGE_COPY
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <utils/util.h>
+#include <sel4utils/page_copy.h>
+
+void sel4utils_copy_pages(void *dst, const void *src, size_t bytes)
+{
+    assert(IS_ALIGNED((uintptr_t) dst | (uintptr_t) src | bytes, PAGE_BITS_4K));
+    if (bytes == 0) {
+        return;
+    }
+    /* 64 bytes, a cache line on most cores, each time around */
+#ifdef CONFIG_HAVE_FPU
+    asm volatile(
+        "1:\n"
+        "ldp q0, q1, [%1], #32\n"
+        "ldp q2, q3, [%1], #32\n"
+        "stp q0, q1, [%0], #32\n"
+        "stp q2, q3, [%0], #32\n"
+        "subs %2, %2, #64\n"
+        "b.ne 1b\n"
+        : "+r"(dst), "+r"(src), "+r"(bytes)
+        :
+        : "v0", "v1", "v2", "v3", "cc", "memory");
+#else
+    asm volatile(
+        "1:\n"
+        "ldp x3, x4, [%1], #16\n"
+        "ldp x5, x6, [%1], #16\n"
+        "ldp x7, x8, [%1], #16\n"
+        "ldp x9, x10, [%1], #16\n"
+        "stp x3, x4, [%0], #16\n"
+        "stp x5, x6, [%0], #16\n"
+        "stp x7, x8, [%0], #16\n"
+        "stp x9, x10, [%0], #16\n"
+        "subs %2, %2, #64\n"
+        "b.ne 1b\n"
+        : "+r"(dst), "+r"(src), "+r"(bytes)
+        :
+        : "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "cc", "memory");
+#endif
+}
+
+/* Bytes zeroed by DC ZVA, or 0 if it must not be used */
+static size_t zva_block_size(void)
+{
+    static size_t block;
+    static bool known;
+    if (!known) {
+        uint64_t dczid;
+        asm volatile("mrs %0, dczid_el0" : "=r"(dczid));
+        /* DZP set prohibits DC ZVA, BS is log2 of the block size in words */
+        size_t size = 4ul << (dczid & 0xf);
+        block = (dczid & BIT(4)) || size > PAGE_SIZE_4K ? 0 : size;
+        known = true;
+    }
+    return block;
+}
+
+void sel4utils_zero_pages(void *dst, size_t bytes)
+{
+    assert(IS_ALIGNED((uintptr_t) dst | bytes, PAGE_BITS_4K));
+    size_t block = zva_block_size();
+    if (block == 0) {
+        memset(dst, 0, bytes);
+        return;
+    }
+    for (uintptr_t addr = (uintptr_t) dst; addr < (uintptr_t) dst + bytes; addr += block) {
+        asm volatile("dc zva, %0" :: "r"(addr) : "memory");
+    }
+}
+
+#endif /* CONFIG_SEL4UTILS_PAGE_COPY */
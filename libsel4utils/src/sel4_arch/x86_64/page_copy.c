@@ -0,0 +1,125 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#ifdef CONFIG_SEL4UTILS_PAGE_COPY
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <utils/util.h>
+#include <sel4utils/page_copy.h>
+
+typedef enum {
+    PAGE_COPY_UNKNOWN,
+    /* enhanced rep movsb/stosb, the fastest on cpus that have it */
+    PAGE_COPY_ERMS,
+    /* 32 byte loads and stores, if the kernel saves the ymm registers */
+    PAGE_COPY_AVX,
+    PAGE_COPY_MOVSQ,
+} page_copy_kind_t;
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    asm volatile("cpuid"
+                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                 : "a"(leaf), "c"(subleaf));
+}
+
+static page_copy_kind_t page_copy_kind(void)
+{
+    static page_copy_kind_t kind = PAGE_COPY_UNKNOWN;
+    if (kind != PAGE_COPY_UNKNOWN) {
+        return kind;
+    }
+
+    uint32_t max_leaf, eax, ebx, ecx, edx;
+    cpuid(0, 0, &max_leaf, &ebx, &ecx, &edx);
+    kind = PAGE_COPY_MOVSQ;
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx & BIT(9)) {
+            kind = PAGE_COPY_ERMS;
+            return kind;
+        }
+    }
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    /* AVX and OSXSAVE, then ask XCR0 if the kernel enabled the sse and avx state */
+    if ((ecx & BIT(28)) && (ecx & BIT(27))) {
+        uint32_t xcr0_lo, xcr0_hi;
+        asm volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0_lo & 0x6) == 0x6) {
+            kind = PAGE_COPY_AVX;
+        }
+    }
+    return kind;
+}
+
+void sel4utils_copy_pages(void *dst, const void *src, size_t bytes)
+{
+    assert(IS_ALIGNED((uintptr_t) dst | (uintptr_t) src | bytes, PAGE_BITS_4K));
+    if (bytes == 0) {
+        return;
+    }
+    switch (page_copy_kind()) {
+    case PAGE_COPY_ERMS:
+        asm volatile("rep movsb"
+                     : "+D"(dst), "+S"(src), "+c"(bytes)
+                     :: "memory");
+        break;
+    case PAGE_COPY_AVX:
+        /* 128 bytes each time around, then clear the upper halves so later sse code
+         * does not pay for the transition */
+        asm volatile(
+            "1:\n"
+            "vmovdqa 0(%1), %%ymm0\n"
+            "vmovdqa 32(%1), %%ymm1\n"
+            "vmovdqa 64(%1), %%ymm2\n"
+            "vmovdqa 96(%1), %%ymm3\n"
+            "vmovdqa %%ymm0, 0(%0)\n"
+            "vmovdqa %%ymm1, 32(%0)\n"
+            "vmovdqa %%ymm2, 64(%0)\n"
+            "vmovdqa %%ymm3, 96(%0)\n"
+            "add $128, %1\n"
+            "add $128, %0\n"
+            "sub $128, %2\n"
+            "jnz 1b\n"
+            "vzeroupper\n"
+            : "+r"(dst), "+r"(src), "+r"(bytes)
+            :
+            : "xmm0", "xmm1", "xmm2", "xmm3", "cc", "memory");
+        break;
+    default: {
+        size_t words = bytes / sizeof(uint64_t);
+        asm volatile("rep movsq"
+                     : "+D"(dst), "+S"(src), "+c"(words)
+                     :: "memory");
+        break;
+    }
+    }
+}
+
+void sel4utils_zero_pages(void *dst, size_t bytes)
+{
+    assert(IS_ALIGNED((uintptr_t) dst | bytes, PAGE_BITS_4K));
+    if (page_copy_kind() == PAGE_COPY_ERMS) {
+        asm volatile("rep stosb"
+                     : "+D"(dst), "+c"(bytes)
+                     : "a"(0)
+                     : "memory");
+    } else {
+        size_t words = bytes / sizeof(uint64_t);
+        asm volatile("rep stosq"
+                     : "+D"(dst), "+c"(words)
+                     : "a"(0ul)
+                     : "memory");
+    }
+}
+
+#endif /* CONFIG_SEL4UTILS_PAGE_COPY */
@@ -9,13 +9,29 @@
 #include <vka/object.h>
 #include <utils/attribute.h>
 
+/* An object owned by the slab. The slab keeps the original cap and hands out copies,
+ * so the object survives being freed and can be handed out again */
+typedef struct slab_object {
+    seL4_CPtr cptr;
+    struct slab_object *next;
+} slab_object_t;
+
+/* Objects created together, either from the initial untyped or by one refill */
+typedef struct slab_chunk {
+    size_t n;
+    slab_object_t *objects;
+    /* cookie of the delegate allocation backing a refill */
+    seL4_Word cookie;
+    struct slab_chunk *next;
+} slab_chunk_t;
+
 typedef struct {
-    /* number of objects in the slab */
-    seL4_CPtr n;
-    /* next free object in the slab */
-    seL4_CPtr next;
-    /* list of objects in the slab */
-    vka_object_t *objects;
+    /* free objects, most recently freed first */
+    slab_object_t *free;
+    size_t num_free;
+    /* refill by batch objects once fewer than low_water are free, never if batch is 0 */
+    size_t low_water;
+    size_t batch;
 } slab_t;
 
 typedef struct {
@@ -23,6 +39,8 @@ typedef struct {
     vka_t *delegate;
     /* allocation slab of each type */
     slab_t slabs[seL4_ObjectTypeCount];
+    /* every object the slab owns */
+    slab_chunk_t *chunks;
     /* untyped to allocate from */
     vka_object_t untyped;
 } slab_data_t;
@@ -60,6 +78,83 @@ static void delegate_cspace_free(void *data, seL4_CPtr slot)
     vka_cspace_free(sdata->delegate, slot);
 }
 
+static slab_chunk_t *new_chunk(slab_data_t *sdata, size_t n)
+{
+    slab_chunk_t *chunk = calloc(1, sizeof(*chunk));
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->objects = calloc(n, sizeof(*chunk->objects));
+    if (chunk->objects == NULL) {
+        free(chunk);
+        return NULL;
+    }
+    chunk->n = n;
+    chunk->next = sdata->chunks;
+    sdata->chunks = chunk;
+    return chunk;
+}
+
+static void push_free(slab_t *slab, slab_object_t *object)
+{
+    object->next = slab->free;
+    slab->free = object;
+    slab->num_free++;
+}
+
+/* Create a batch of objects with a single allocation from the delegate */
+static int refill(slab_data_t *sdata, seL4_Word type)
+{
+    slab_t *slab = &sdata->slabs[type];
+    size_t n = slab->batch;
+    size_t size_bits = vka_get_object_size(type, 0);
+    seL4_CPtr slots[n];
+    cspacepath_t paths[n];
+
+    if (vka_cspace_alloc_n(sdata->delegate, n, slots) != 0) {
+        ZF_LOGW("Failed to allocate cslots to refill slab of type %lu", (long) type);
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        vka_cspace_make_path(sdata->delegate, slots[i], &paths[i]);
+    }
+    seL4_Word cookie;
+    if (vka_utspace_alloc_n(sdata->delegate, paths, type, size_bits, n, &cookie) != 0) {
+        ZF_LOGW("Failed to refill slab of type %lu", (long) type);
+        goto error;
+    }
+    slab_chunk_t *chunk = new_chunk(sdata, n);
+    if (chunk == NULL) {
+        for (size_t i = 0; i < n; i++) {
+            vka_cnode_delete(&paths[i]);
+        }
+        vka_utspace_free_n(sdata->delegate, type, size_bits, n, cookie);
+        goto error;
+    }
+    chunk->cookie = cookie;
+    for (size_t i = 0; i < n; i++) {
+        chunk->objects[i].cptr = slots[i];
+        push_free(slab, &chunk->objects[i]);
+    }
+    return 0;
+
+error:
+    for (size_t i = 0; i < n; i++) {
+        vka_cspace_free(sdata->delegate, slots[i]);
+    }
+    return -1;
+}
+
+static slab_object_t *find_object(slab_data_t *sdata, seL4_Word cookie)
+{
+    for (slab_chunk_t *chunk = sdata->chunks; chunk != NULL; chunk = chunk->next) {
+        if (cookie >= (seL4_Word) chunk->objects && cookie < (seL4_Word)(chunk->objects + chunk->n)) {
+            return (slab_object_t *) cookie;
+        }
+    }
+    return NULL;
+}
+
 static int slab_utspace_alloc(void *data, const cspacepath_t *dest, seL4_Word type,
         seL4_Word size_bits, seL4_Word *res)
 {
@@ -70,19 +165,30 @@ static int slab_utspace_alloc(void *data, const cspacepath_t *dest, seL4_Word ty
     }
 
     slab_t *slab = &sdata->slabs[type];
-    if (slab->next == slab->n) {
+    if (slab->free == NULL && slab->batch > 0) {
+        refill(sdata, type);
+    }
+    if (slab->free == NULL) {
         ZF_LOGW("Slab of type %lu expired, using delegate allocator", type);
         return vka_utspace_alloc(sdata->delegate, dest, type, size_bits, res);
     }
 
     cspacepath_t src;
-    vka_cspace_make_path(sdata->delegate, slab->objects[slab->next].cptr, &src);
-    if (vka_cnode_move(dest, &src) != seL4_NoError) {
+    vka_cspace_make_path(sdata->delegate, slab->free->cptr, &src);
+    if (vka_cnode_copy(dest, &src, seL4_AllRights) != seL4_NoError) {
         ZF_LOGW("Dest invalid\n");
         return -1;
     }
 
-    slab->next++;
+    slab_object_t *object = slab->free;
+    slab->free = object->next;
+    slab->num_free--;
+    *res = (seL4_Word) object;
+
+    /* top up before we run out, rather than on the allocation that finds us empty */
+    if (slab->num_free < slab->low_water && slab->batch > 0) {
+        refill(sdata, type);
+    }
     return 0;
 }
 
@@ -102,8 +208,24 @@ static int delegate_utspace_alloc_at(void *data, const cspacepath_t *dest, seL4_
 static void
 slab_utspace_free(void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
 {
-    //TODO this should be possible - swap the object in at next, but do we need it?
-    ZF_LOGW("slab_utspace_free not implemented");
+    slab_data_t *sdata = data;
+    slab_object_t *object = type < seL4_ObjectTypeCount ? find_object(sdata, target) : NULL;
+    if (object == NULL) {
+        vka_utspace_free(sdata->delegate, type, size_bits, target);
+        return;
+    }
+
+    /* remove every cap derived from ours, so whoever had the object can no longer reach it */
+    cspacepath_t path;
+    vka_cspace_make_path(sdata->delegate, object->cptr, &path);
+    if (vka_cnode_revoke(&path) != seL4_NoError) {
+        ZF_LOGW("Failed to revoke freed object, dropping it from the slab");
+        return;
+    }
+    if (type == seL4_TCBObject) {
+        seL4_TCB_Suspend(object->cptr);
+    }
+    push_free(&sdata->slabs[type], object);
 }
 
 static size_t calculate_total_size(size_t object_freq[seL4_ObjectTypeCount]) {
@@ -147,32 +269,49 @@ static seL4_Error alloc_object(vka_t *delegate, vka_object_t *untyped, size_t si
                                         path.destDepth, path.offset, 1);
 }
 
-static int alloc_object_slab(vka_t *delegate, vka_object_t *untyped, slab_t *slab, size_t n,
+static int alloc_object_slab(slab_data_t *sdata, vka_object_t *untyped, slab_t *slab, size_t n,
                              size_t size_bits, seL4_Word type)
 {
     ZF_LOGI("Preallocating %zu objects of %zu size bits, %lu type\n", n, size_bits, (long) type);
 
-    slab->n = n;
-    slab->next = 0;
+    if (n == 0) {
+        return 0;
+    }
 
-    if (n > 0) {
-        slab->objects = calloc(n, sizeof(vka_object_t));
-        if (slab->objects == NULL) {
-            ZF_LOGI("Failed to allocate %zu objects of %zu size bits, %lu type", n, size_bits, (long) type);
-            return -1;
-        }
+    slab_chunk_t *chunk = new_chunk(sdata, n);
+    if (chunk == NULL) {
+        ZF_LOGI("Failed to allocate %zu objects of %zu size bits, %lu type", n, size_bits, (long) type);
+        return -1;
     }
 
-    for (int i = 0; i < slab->n; i++) {
-        if (alloc_object(delegate, untyped, size_bits, type, &slab->objects[i]) != seL4_NoError) {
+    for (int i = 0; i < n; i++) {
+        vka_object_t object;
+        if (alloc_object(sdata->delegate, untyped, size_bits, type, &object) != seL4_NoError) {
             return -1;
         }
+        chunk->objects[i].cptr = object.cptr;
+    }
+    /* hand them out in the order they were created */
+    for (int i = n - 1; i >= 0; i--) {
+        push_free(slab, &chunk->objects[i]);
     }
 
     /* success */
     return 0;
 }
 
+int slab_set_refill(vka_t *slab_vka, seL4_Word type, size_t low_water, size_t batch)
+{
+    slab_data_t *sdata = slab_vka->data;
+    if (type >= seL4_ObjectTypeCount || vka_get_object_size(type, 0) == 0) {
+        ZF_LOGE("Cannot refill objects of type %lu", (long) type);
+        return -1;
+    }
+    sdata->slabs[type].low_water = low_water;
+    sdata->slabs[type].batch = batch;
+    return 0;
+}
+
 int slab_init(vka_t *slab_vka, vka_t *delegate, size_t object_freq[seL4_ObjectTypeCount]) {
 
     slab_data_t *data = calloc(1, sizeof(slab_data_t));
@@ -192,6 +331,10 @@ int slab_init(vka_t *slab_vka, vka_t *delegate, size_t object_freq[seL4_ObjectTy
     slab_vka->utspace_alloc = slab_utspace_alloc;
     slab_vka->utspace_alloc_maybe_device = slab_utspace_alloc_maybe_device;
     slab_vka->utspace_free = slab_utspace_free;
+    slab_vka->cspace_alloc_n = NULL;
+    slab_vka->utspace_alloc_n = NULL;
+    slab_vka->utspace_free_n = NULL;
+    slab_vka->cspace_free_n = NULL;
 
     /* allocate untyped */
     size_t total_size = calculate_total_size(object_freq);
@@ -222,7 +365,7 @@ int slab_init(vka_t *slab_vka, vka_t *delegate, size_t object_freq[seL4_ObjectTy
     /* allocate slabs */
     for (int i = 0; i < seL4_ObjectTypeCount && object_descs[i].size_bits != 0; i++) {
         int type = object_descs[i].type;
-        error = alloc_object_slab(delegate, &data->untyped, &data->slabs[type],
+        error = alloc_object_slab(data, &data->untyped, &data->slabs[type],
                                   object_freq[type], object_descs[i].size_bits, type);
         if (error != 0) {
             ZF_LOGE("Failed to create slab\n");
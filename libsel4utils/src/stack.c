@@ -6,6 +6,8 @@
 
 #include <errno.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <vspace/vspace.h>
 #include <sel4utils/stack.h>
 #include <sel4utils/util.h>
@@ -27,3 +29,114 @@ sel4utils_run_on_stack(vspace_t *vspace, void * (*func)(void *arg), void *arg, v
 
     return 0;
 }
+
+void sel4utils_stack_pool_init(sel4utils_stack_pool_t *pool, vspace_t *vspace, bool zero)
+{
+    pool->vspace = vspace;
+    pool->zero = zero;
+    pool->classes = NULL;
+}
+
+static sel4utils_stack_class_t *stack_class(sel4utils_stack_pool_t *pool, size_t n_pages, bool create)
+{
+    for (sel4utils_stack_class_t *class = pool->classes; class != NULL; class = class->next) {
+        if (class->num_pages == n_pages) {
+            return class;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    sel4utils_stack_class_t *class = malloc(sizeof(*class));
+    if (class == NULL) {
+        return NULL;
+    }
+    class->num_pages = n_pages;
+    class->free = NULL;
+    class->next = pool->classes;
+    pool->classes = class;
+    return class;
+}
+
+static inline void **stack_link(void *stack_top)
+{
+    return (void **) stack_top - 1;
+}
+
+void *sel4utils_stack_pool_get(sel4utils_stack_pool_t *pool, size_t n_pages)
+{
+    sel4utils_stack_class_t *class = stack_class(pool, n_pages, false);
+    if (class == NULL || class->free == NULL) {
+        return vspace_new_sized_stack(pool->vspace, n_pages);
+    }
+    void *stack_top = class->free;
+    class->free = *stack_link(stack_top);
+    if (pool->zero) {
+        *stack_link(stack_top) = NULL;
+    }
+    return stack_top;
+}
+
+/* Stacks grow down, so every page above the lowest one that is not all zero may have
+ * been used. Pages below it are still as we zeroed them */
+static void zero_used_pages(void *stack_top, size_t n_pages)
+{
+    uintptr_t bottom = (uintptr_t) stack_top - n_pages * PAGE_SIZE_4K;
+    uintptr_t page;
+    for (page = bottom; page < (uintptr_t) stack_top; page += PAGE_SIZE_4K) {
+        seL4_Word *words = (seL4_Word *) page;
+        size_t i;
+        for (i = 0; i < PAGE_SIZE_4K / sizeof(seL4_Word) && words[i] == 0; i++);
+        if (i < PAGE_SIZE_4K / sizeof(seL4_Word)) {
+            break;
+        }
+    }
+    memset((void *) page, 0, (uintptr_t) stack_top - page);
+}
+
+void sel4utils_stack_pool_put(sel4utils_stack_pool_t *pool, void *stack_top, size_t n_pages)
+{
+    sel4utils_stack_class_t *class = stack_class(pool, n_pages, true);
+    if (class == NULL) {
+        ZF_LOGW("Failed to allocate stack class, freeing stack");
+        vspace_free_sized_stack(pool->vspace, stack_top, n_pages);
+        return;
+    }
+    if (pool->zero) {
+        zero_used_pages(stack_top, n_pages);
+    }
+    *stack_link(stack_top) = class->free;
+    class->free = stack_top;
+}
+
+void sel4utils_stack_pool_destroy(sel4utils_stack_pool_t *pool)
+{
+    while (pool->classes != NULL) {
+        sel4utils_stack_class_t *class = pool->classes;
+        pool->classes = class->next;
+        while (class->free != NULL) {
+            void *stack_top = class->free;
+            class->free = *stack_link(stack_top);
+            vspace_free_sized_stack(pool->vspace, stack_top, class->num_pages);
+        }
+        free(class);
+    }
+}
+
+int sel4utils_run_on_pooled_stack(sel4utils_stack_pool_t *pool, size_t n_pages, void * (*func)(void *arg),
+                                  void *arg, void **retval)
+{
+    void *stack_top = sel4utils_stack_pool_get(pool, n_pages);
+    if (stack_top == NULL) {
+        ZF_LOGE("Failed to allocate new stack\n");
+        return -1;
+    }
+
+    void *ret = utils_run_on_stack(stack_top, func, arg);
+    if (retval != NULL) {
+        *retval = ret;
+    }
+    sel4utils_stack_pool_put(pool, stack_top, n_pages);
+
+    return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <vka/object.h>
+#include <sel4utils/thread.h>
+#include <sel4utils/tasks.h>
+#include <utils/util.h>
+#include "lock_internal.h"
+
+/* Rounds of failed stealing a worker makes before it goes to sleep */
+#define TASK_IDLE_ROUNDS 64
+
+/* worker the current thread is, NULL outside the runtime */
+static __thread sel4utils_task_worker_t *current_worker;
+
+static int deque_init(sel4utils_task_deque_t *deque, size_t size_bits)
+{
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->mask = BIT(size_bits) - 1;
+    deque->tasks = calloc(BIT(size_bits), sizeof(*deque->tasks));
+    return deque->tasks == NULL ? -1 : 0;
+}
+
+/* Chase-Lev deque, as given for weak memory models by Lê et al. Only the owner pushes and
+ * takes at the bottom, anyone steals from the top */
+static bool deque_push(sel4utils_task_deque_t *deque, sel4utils_task_t *task)
+{
+    intptr_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    intptr_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (b - t > deque->mask) {
+        return false;
+    }
+    __atomic_store_n(&deque->tasks[b & deque->mask], task, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static sel4utils_task_t *deque_take(sel4utils_task_deque_t *deque)
+{
+    intptr_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    intptr_t t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        /* empty */
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    sel4utils_task_t *task = __atomic_load_n(&deque->tasks[b & deque->mask], __ATOMIC_RELAXED);
+    if (t == b) {
+        /* last task, race any thieves for it */
+        if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+static sel4utils_task_t *deque_steal(sel4utils_task_deque_t *deque)
+{
+    intptr_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    intptr_t b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+    sel4utils_task_t *task = __atomic_load_n(&deque->tasks[t & deque->mask], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        /* lost to another thief or the owner */
+        return NULL;
+    }
+    return task;
+}
+
+static bool inject_push(sel4utils_task_runtime_t *runtime, sel4utils_task_t *task)
+{
+    sel4utils_lock(&runtime->inject_lock);
+    bool pushed = deque_push(&runtime->inject, task);
+    sel4utils_unlock(&runtime->inject_lock);
+    return pushed;
+}
+
+static sel4utils_task_t *inject_pop(sel4utils_task_runtime_t *runtime)
+{
+    /* first in first out, so outside work is started in the order it was spawned */
+    if (__atomic_load_n(&runtime->inject.bottom, __ATOMIC_RELAXED) ==
+        __atomic_load_n(&runtime->inject.top, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    sel4utils_lock(&runtime->inject_lock);
+    sel4utils_task_t *task = deque_steal(&runtime->inject);
+    sel4utils_unlock(&runtime->inject_lock);
+    return task;
+}
+
+static void run_task(sel4utils_task_t *task)
+{
+    sel4utils_task_group_t *group = task->group;
+    task->fn(task->arg);
+    if (group != NULL) {
+        __atomic_fetch_sub(&group->pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static sel4utils_task_t *find_task(sel4utils_task_worker_t *worker)
+{
+    sel4utils_task_runtime_t *runtime = worker->runtime;
+    sel4utils_task_t *task = deque_take(&worker->deque);
+    if (task == NULL) {
+        task = inject_pop(runtime);
+    }
+    for (size_t i = 1; task == NULL && i < runtime->num_workers; i++) {
+        task = deque_steal(&runtime->workers[(worker->index + i) % runtime->num_workers].deque);
+    }
+    return task;
+}
+
+static void wake_one(sel4utils_task_runtime_t *runtime)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&runtime->num_sleeping, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    for (size_t i = 0; i < runtime->num_workers; i++) {
+        sel4utils_task_worker_t *worker = &runtime->workers[i];
+        bool sleeping = true;
+        /* whoever clears the flag owns the wake up */
+        if (__atomic_compare_exchange_n(&worker->sleeping, &sleeping, false, false, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_RELAXED)) {
+            __atomic_fetch_sub(&runtime->num_sleeping, 1, __ATOMIC_RELAXED);
+            seL4_Signal(worker->notification.cptr);
+            return;
+        }
+    }
+}
+
+static void sleep_worker(sel4utils_task_worker_t *worker)
+{
+    sel4utils_task_runtime_t *runtime = worker->runtime;
+    __atomic_store_n(&worker->sleeping, true, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&runtime->num_sleeping, 1, __ATOMIC_SEQ_CST);
+    /* a spawn before we set the flag would not have woken us, so look once more */
+    sel4utils_task_t *task = find_task(worker);
+    bool sleeping = true;
+    if ((task != NULL || __atomic_load_n(&runtime->stop, __ATOMIC_ACQUIRE)) &&
+        __atomic_compare_exchange_n(&worker->sleeping, &sleeping, false, false, __ATOMIC_SEQ_CST,
+                                    __ATOMIC_RELAXED)) {
+        __atomic_fetch_sub(&runtime->num_sleeping, 1, __ATOMIC_RELAXED);
+    } else {
+        /* either nothing to do or someone is already signalling us */
+        seL4_Wait(worker->notification.cptr, NULL);
+    }
+    if (task != NULL) {
+        run_task(task);
+    }
+}
+
+static void task_worker(sel4utils_task_worker_t *worker)
+{
+    sel4utils_task_runtime_t *runtime = worker->runtime;
+    current_worker = worker;
+    int idle = 0;
+    while (!__atomic_load_n(&runtime->stop, __ATOMIC_ACQUIRE)) {
+        sel4utils_task_t *task = find_task(worker);
+        if (task != NULL) {
+            idle = 0;
+            run_task(task);
+        } else if (++idle < TASK_IDLE_ROUNDS) {
+            seL4_Yield();
+        } else {
+            idle = 0;
+            sleep_worker(worker);
+        }
+    }
+    __atomic_fetch_add(&runtime->num_exited, 1, __ATOMIC_RELEASE);
+    seL4_TCB_Suspend(worker->thread.tcb.cptr);
+}
+
+void sel4utils_task_spawn(sel4utils_task_runtime_t *runtime, sel4utils_task_t *task)
+{
+    if (task->group != NULL) {
+        __atomic_fetch_add(&task->group->pending, 1, __ATOMIC_RELAXED);
+    }
+    sel4utils_task_worker_t *worker = current_worker;
+    bool pushed = worker != NULL && worker->runtime == runtime ? deque_push(&worker->deque, task) :
+                  inject_push(runtime, task);
+    if (!pushed) {
+        run_task(task);
+        return;
+    }
+    wake_one(runtime);
+}
+
+void sel4utils_task_group_wait(sel4utils_task_runtime_t *runtime, sel4utils_task_group_t *group)
+{
+    sel4utils_task_worker_t *worker = current_worker;
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        sel4utils_task_t *task = worker != NULL && worker->runtime == runtime ? find_task(worker) : NULL;
+        if (task != NULL) {
+            run_task(task);
+        } else {
+            seL4_Yield();
+        }
+    }
+}
+
+int sel4utils_task_runtime_create(simple_t *simple, vka_t *vka, vspace_t *vspace, uint8_t priority,
+                                  size_t num_workers, size_t size_bits, sel4utils_task_runtime_t *runtime)
+{
+    memset(runtime, 0, sizeof(*runtime));
+    size_t num_cores = simple_get_core_count(simple);
+    num_workers = num_workers == 0 ? num_cores : MIN(num_workers, num_cores);
+
+    runtime->workers = calloc(num_workers, sizeof(*runtime->workers));
+    if (runtime->workers == NULL || deque_init(&runtime->inject, size_bits)) {
+        ZF_LOGE("Failed to allocate task runtime");
+        goto error;
+    }
+
+    /* only workers that have a deque and notification are counted, so stealing never
+     * looks at a worker that is half set up */
+    for (size_t i = 0; i < num_workers; i++) {
+        sel4utils_task_worker_t *worker = &runtime->workers[i];
+        worker->index = i;
+        worker->runtime = runtime;
+        if (deque_init(&worker->deque, size_bits) || vka_alloc_notification(vka, &worker->notification)) {
+            ZF_LOGE("Failed to allocate task worker %zu", i);
+            free(worker->deque.tasks);
+            goto error;
+        }
+        runtime->num_workers++;
+    }
+
+    for (size_t i = 0; i < runtime->num_workers; i++) {
+        sel4utils_task_worker_t *worker = &runtime->workers[i];
+        sel4utils_thread_config_t config = thread_config_new(simple);
+        config = thread_config_priority(config, priority);
+        if (config_set(CONFIG_KERNEL_MCS)) {
+            /* seL4_Time measures time in us, the config parameter uses ms. */
+            seL4_Time timeslice_us = CONFIG_BOOT_THREAD_TIME_SLICE * US_IN_MS;
+            config.sched_params = sched_params_round_robin(config.sched_params, simple, i, timeslice_us);
+        } else {
+            config.sched_params.core = i;
+        }
+        if (sel4utils_configure_thread_config(vka, vspace, vspace, config, &worker->thread)) {
+            ZF_LOGE("Failed to configure task worker %zu", i);
+            goto error;
+        }
+        if (num_cores > 1 && sel4utils_set_sched_affinity(&worker->thread, config.sched_params)) {
+            ZF_LOGE("Failed to pin task worker %zu", i);
+            goto error;
+        }
+    }
+
+    /* start them only once all are pinned, as they steal from each other straight away */
+    for (size_t i = 0; i < runtime->num_workers; i++) {
+        sel4utils_task_worker_t *worker = &runtime->workers[i];
+        if (sel4utils_start_thread(&worker->thread, (sel4utils_thread_entry_fn) task_worker, worker, NULL, 1)) {
+            ZF_LOGE("Failed to start task worker %zu", i);
+            goto error;
+        }
+        runtime->num_started++;
+    }
+    return 0;
+
+error:
+    sel4utils_task_runtime_destroy(vka, vspace, runtime);
+    return -1;
+}
+
+void sel4utils_task_runtime_destroy(vka_t *vka, vspace_t *vspace, sel4utils_task_runtime_t *runtime)
+{
+    __atomic_store_n(&runtime->stop, true, __ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < runtime->num_workers; i++) {
+        /* sleepers see stop once woken, a spare signal to a worker that is awake is harmless */
+        seL4_Signal(runtime->workers[i].notification.cptr);
+    }
+    /* let running tasks finish, the workers suspend themselves once they see stop */
+    while (__atomic_load_n(&runtime->num_exited, __ATOMIC_ACQUIRE) < runtime->num_started) {
+        seL4_Yield();
+    }
+    for (size_t i = 0; i < runtime->num_workers; i++) {
+        sel4utils_task_worker_t *worker = &runtime->workers[i];
+        sel4utils_clean_up_thread(vka, vspace, &worker->thread);
+        vka_free_object(vka, &worker->notification);
+        free(worker->deque.tasks);
+    }
+    free(runtime->workers);
+    free(runtime->inject.tasks);
+    memset(runtime, 0, sizeof(*runtime));
+}
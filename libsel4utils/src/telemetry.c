@@ -0,0 +1,283 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <sel4utils/telemetry.h>
+#include <utils/util.h>
+#include "lock_internal.h"
+
+#define TELEMETRY_ALIGN 64
+
+int sel4utils_telemetry_init(sel4utils_telemetry_t *telemetry, void *mem, size_t bytes,
+                             sel4utils_telemetry_source_t *sources, size_t max_metrics)
+{
+    if (telemetry == NULL || mem == NULL || !IS_ALIGNED((uintptr_t) mem, 3) ||
+        (sources == NULL && max_metrics != 0) || max_metrics > SEL4UTILS_TELEMETRY_SNAPSHOT) {
+        ZF_LOGE("Invalid arguments to sel4utils_telemetry_init");
+        return -1;
+    }
+
+    size_t metrics_offset = ROUND_UP(sizeof(sel4utils_telemetry_header_t), TELEMETRY_ALIGN);
+    size_t records_offset = ROUND_UP(metrics_offset + max_metrics * sizeof(sel4utils_telemetry_metric_t),
+                                     TELEMETRY_ALIGN);
+    if (bytes < records_offset + sizeof(sel4utils_telemetry_record_t)) {
+        ZF_LOGE("%zu bytes is too small for the telemetry of %zu metrics", bytes, max_metrics);
+        return -1;
+    }
+    size_t num_records = BIT(LOG_BASE_2((bytes - records_offset) / sizeof(sel4utils_telemetry_record_t)));
+
+    *telemetry = (sel4utils_telemetry_t) {
+        .header = mem,
+        .metrics = mem + metrics_offset,
+        .records = mem + records_offset,
+        .sources = sources,
+        .snapshot_records = 1,
+    };
+    /* the collector may be looking at the memory already, so the magic goes in last */
+    memset(mem, 0, records_offset + num_records * sizeof(sel4utils_telemetry_record_t));
+    *telemetry->header = (sel4utils_telemetry_header_t) {
+        .version = SEL4UTILS_TELEMETRY_VERSION,
+        .metrics_offset = metrics_offset,
+        .records_offset = records_offset,
+        .metric_size = sizeof(sel4utils_telemetry_metric_t),
+        .record_size = sizeof(sel4utils_telemetry_record_t),
+        .max_metrics = max_metrics,
+        .num_records = num_records,
+    };
+    __atomic_store_n(&telemetry->header->magic, SEL4UTILS_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int sel4utils_telemetry_create(sel4utils_telemetry_t *telemetry, vspace_t *vspace, size_t num_pages,
+                               sel4utils_telemetry_source_t *sources, size_t max_metrics)
+{
+    void *mem = vspace_new_pages(vspace, seL4_AllRights, num_pages, PAGE_BITS_4K);
+    if (mem == NULL) {
+        ZF_LOGE("Failed to allocate %zu pages for telemetry", num_pages);
+        return -1;
+    }
+    int error = sel4utils_telemetry_init(telemetry, mem, num_pages * PAGE_SIZE_4K, sources, max_metrics);
+    if (error) {
+        vspace_unmap_pages(vspace, mem, num_pages, PAGE_BITS_4K, VSPACE_FREE);
+        return error;
+    }
+    telemetry->num_pages = num_pages;
+    return 0;
+}
+
+void *sel4utils_telemetry_share(sel4utils_telemetry_t *telemetry, vspace_t *from, vspace_t *to)
+{
+    return vspace_share_mem(from, to, telemetry->header, telemetry->num_pages, PAGE_BITS_4K,
+                            seL4_CanRead, 1);
+}
+
+void sel4utils_telemetry_destroy(sel4utils_telemetry_t *telemetry, vspace_t *vspace)
+{
+    sel4utils_telemetry_stop_periodic(telemetry);
+    if (telemetry->num_pages != 0) {
+        vspace_unmap_pages(vspace, telemetry->header, telemetry->num_pages, PAGE_BITS_4K, VSPACE_FREE);
+    }
+    telemetry->header = NULL;
+    telemetry->num_pages = 0;
+}
+
+static int telemetry_add(sel4utils_telemetry_t *telemetry, const char *name, sel4utils_telemetry_source_t source)
+{
+    sel4utils_telemetry_header_t *header = telemetry->header;
+
+    sel4utils_lock(&telemetry->lock);
+    size_t id = header->num_metrics;
+    /* a snapshot that wrapped around the ring would overwrite its own start */
+    size_t records = source.type == SEL4UTILS_TELEMETRY_HISTOGRAM ? SEL4UTILS_TELEMETRY_BUCKETS : 1;
+    if (id == header->max_metrics || telemetry->snapshot_records + records > header->num_records) {
+        sel4utils_unlock(&telemetry->lock);
+        ZF_LOGE("No room for telemetry metric %s", name);
+        return -1;
+    }
+    telemetry->snapshot_records += records;
+    telemetry->sources[id] = source;
+    sel4utils_telemetry_metric_t *metric = &telemetry->metrics[id];
+    strncpy(metric->name, name, sizeof(metric->name));
+    metric->id = id;
+    metric->type = source.type;
+    metric->num_buckets = source.type == SEL4UTILS_TELEMETRY_HISTOGRAM ? SEL4UTILS_TELEMETRY_BUCKETS : 0;
+    __atomic_store_n(&header->num_metrics, id + 1, __ATOMIC_RELEASE);
+    sel4utils_unlock(&telemetry->lock);
+    return id;
+}
+
+int sel4utils_telemetry_add_value(sel4utils_telemetry_t *telemetry, const char *name,
+                                  sel4utils_telemetry_type_t type, const uint64_t *value)
+{
+    if (value == NULL || type == SEL4UTILS_TELEMETRY_HISTOGRAM) {
+        ZF_LOGE("Invalid telemetry value %s", name);
+        return -1;
+    }
+    return telemetry_add(telemetry, name, (sel4utils_telemetry_source_t) {
+        .type = type, .value = value
+    });
+}
+
+int sel4utils_telemetry_add_fn(sel4utils_telemetry_t *telemetry, const char *name,
+                               sel4utils_telemetry_type_t type, sel4utils_telemetry_read_fn read_fn,
+                               void *data)
+{
+    if (read_fn == NULL || type == SEL4UTILS_TELEMETRY_HISTOGRAM) {
+        ZF_LOGE("Invalid telemetry function %s", name);
+        return -1;
+    }
+    return telemetry_add(telemetry, name, (sel4utils_telemetry_source_t) {
+        .type = type, .read_fn = read_fn, .read_data = data
+    });
+}
+
+int sel4utils_telemetry_add_histogram(sel4utils_telemetry_t *telemetry, const char *name,
+                                      const sel4utils_telemetry_histogram_t *histogram)
+{
+    if (histogram == NULL) {
+        ZF_LOGE("Invalid telemetry histogram %s", name);
+        return -1;
+    }
+    return telemetry_add(telemetry, name, (sel4utils_telemetry_source_t) {
+        .type = SEL4UTILS_TELEMETRY_HISTOGRAM, .histogram = histogram
+    });
+}
+
+/* Write the record at position pos of the ring, clearing its seq first so that a collector
+ * reading it meanwhile sees it is not valid */
+static void telemetry_write(sel4utils_telemetry_t *telemetry, uint64_t pos, uint16_t metric, uint8_t bucket,
+                            uint64_t value)
+{
+    sel4utils_telemetry_record_t *record = &telemetry->records[pos & (telemetry->header->num_records - 1)];
+
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->metric = metric;
+    record->bucket = bucket;
+    record->value = value;
+    __atomic_store_n(&record->seq, (uint32_t)(pos + 1), __ATOMIC_RELEASE);
+}
+
+void sel4utils_telemetry_snapshot(sel4utils_telemetry_t *telemetry, uint64_t timestamp)
+{
+    sel4utils_telemetry_header_t *header = telemetry->header;
+
+    sel4utils_lock(&telemetry->lock);
+    uint64_t pos = header->head;
+    telemetry_write(telemetry, pos++, SEL4UTILS_TELEMETRY_SNAPSHOT, 0, timestamp);
+    for (size_t i = 0; i < header->num_metrics; i++) {
+        sel4utils_telemetry_source_t *source = &telemetry->sources[i];
+        if (source->type == SEL4UTILS_TELEMETRY_HISTOGRAM) {
+            for (size_t bucket = 0; bucket < SEL4UTILS_TELEMETRY_BUCKETS; bucket++) {
+                uint64_t count = __atomic_load_n(&source->histogram->buckets[bucket], __ATOMIC_RELAXED);
+                /* empty buckets are left out to keep snapshots small */
+                if (count != 0) {
+                    telemetry_write(telemetry, pos++, i, bucket, count);
+                }
+            }
+        } else if (source->value != NULL) {
+            telemetry_write(telemetry, pos++, i, 0, __atomic_load_n(source->value, __ATOMIC_RELAXED));
+        } else {
+            telemetry_write(telemetry, pos++, i, 0, source->read_fn(source->read_data));
+        }
+    }
+    __atomic_store_n(&header->head, pos, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->snapshots, header->snapshots + 1, __ATOMIC_RELEASE);
+    sel4utils_unlock(&telemetry->lock);
+}
+
+static uint64_t telemetry_now(sel4utils_telemetry_t *telemetry)
+{
+    uint64_t time = 0;
+    if (telemetry->server == NULL || ltimer_get_time(telemetry->server->ltimer, &time)) {
+        /* without a time, number the snapshots instead */
+        time = telemetry->header->snapshots;
+    }
+    return time;
+}
+
+static void telemetry_thread(sel4utils_telemetry_t *telemetry)
+{
+    while (1) {
+        seL4_Wait(telemetry->notification, NULL);
+        sel4utils_telemetry_snapshot(telemetry, telemetry_now(telemetry));
+    }
+}
+
+int sel4utils_telemetry_start_thread(sel4utils_telemetry_t *telemetry, vka_t *vka, vspace_t *vspace,
+                                     seL4_CPtr cspace, seL4_Word data, seL4_CPtr notification)
+{
+    int error = sel4utils_configure_thread(vka, vspace, vspace, 0, cspace, data, &telemetry->thread);
+    if (error) {
+        ZF_LOGE("Failed to configure telemetry thread");
+        return -1;
+    }
+    telemetry->notification = notification;
+    error = sel4utils_start_thread(&telemetry->thread, (sel4utils_thread_entry_fn) telemetry_thread, telemetry,
+                                   NULL, 1);
+    if (error) {
+        ZF_LOGE("Failed to start telemetry thread");
+        telemetry->notification = seL4_CapNull;
+        sel4utils_clean_up_thread(vka, vspace, &telemetry->thread);
+        return -1;
+    }
+    return 0;
+}
+
+void sel4utils_telemetry_stop_thread(sel4utils_telemetry_t *telemetry, vka_t *vka, vspace_t *vspace)
+{
+    if (telemetry->notification == seL4_CapNull) {
+        return;
+    }
+    /* holding the lock, the thread can't be part way through a snapshot */
+    sel4utils_lock(&telemetry->lock);
+    telemetry->notification = seL4_CapNull;
+    sel4utils_clean_up_thread(vka, vspace, &telemetry->thread);
+    sel4utils_unlock(&telemetry->lock);
+}
+
+static void telemetry_timeout(void *data)
+{
+    sel4utils_telemetry_t *telemetry = data;
+
+    if (telemetry->notification != seL4_CapNull) {
+        seL4_Signal(telemetry->notification);
+    } else {
+        sel4utils_telemetry_snapshot(telemetry, telemetry_now(telemetry));
+    }
+}
+
+int sel4utils_telemetry_start_periodic(sel4utils_telemetry_t *telemetry, sel4utils_time_server_t *server,
+                                       uint64_t period_ns)
+{
+    if (server == NULL || period_ns == 0) {
+        ZF_LOGE("Periodic telemetry needs a time server and a period");
+        return -1;
+    }
+    sel4utils_telemetry_stop_periodic(telemetry);
+    telemetry->server = server;
+    int error = sel4utils_timeout_set(server, &telemetry->timeout, period_ns, TIMEOUT_PERIODIC,
+                                      telemetry_timeout, telemetry);
+    if (error) {
+        ZF_LOGE("Failed to set telemetry timeout");
+        telemetry->server = NULL;
+        return error;
+    }
+    return 0;
+}
+
+void sel4utils_telemetry_stop_periodic(sel4utils_telemetry_t *telemetry)
+{
+    if (telemetry->server != NULL) {
+        sel4utils_timeout_cancel(telemetry->server, &telemetry->timeout);
+        telemetry->server = NULL;
+    }
+}
@@ -15,14 +15,18 @@
 #include <sel4/sel4.h>
 #include <vka/vka.h>
 #include <vka/object.h>
+#include <vka/capops.h>
 #include <vspace/vspace.h>
 #include <sel4runtime.h>
 #include <sel4utils/api.h>
 #include <sel4utils/mapping.h>
+#include <sel4utils/page_copy.h>
 #include <sel4utils/thread.h>
+#include <sel4utils/vspace.h>
 #include <sel4utils/util.h>
 #include <sel4utils/arch/util.h>
 #include <sel4utils/helpers.h>
+#include <sel4utils/stack.h>
 #include <utils/stack.h>
 
 
@@ -140,7 +144,12 @@ int sel4utils_configure_thread_config(vka_t *vka, vspace_t *parent, vspace_t *al
     }
 
     if (res->stack_size > 0) {
-        res->stack_top = vspace_new_sized_stack(alloc, res->stack_size);
+        if (config.stack_pool != NULL && config.stack_pool->vspace == alloc) {
+            res->stack_pool = config.stack_pool;
+            res->stack_top = sel4utils_stack_pool_get(res->stack_pool, res->stack_size);
+        } else {
+            res->stack_top = vspace_new_sized_stack(alloc, res->stack_size);
+        }
 
         if (res->stack_top == NULL) {
             ZF_LOGE("Stack allocation failed!");
@@ -207,7 +216,9 @@ void sel4utils_clean_up_thread(vka_t *vka, vspace_t *alloc, sel4utils_thread_t *
         vspace_free_ipc_buffer(alloc, (seL4_Word *) thread->ipc_buffer_addr);
     }
 
-    if (thread->stack_top != 0) {
+    if (thread->stack_top != 0 && thread->stack_pool != NULL) {
+        sel4utils_stack_pool_put(thread->stack_pool, thread->stack_top, thread->stack_size);
+    } else if (thread->stack_top != 0) {
         vspace_free_sized_stack(alloc, thread->stack_top, thread->stack_size);
     }
 
@@ -222,6 +233,64 @@ void sel4utils_clean_up_thread(vka_t *vka, vspace_t *alloc, sel4utils_thread_t *
     memset(thread, 0, sizeof(sel4utils_thread_t));
 }
 
+int sel4utils_thread_pool_create(vka_t *vka, vspace_t *parent, vspace_t *alloc, sel4utils_thread_config_t config,
+                                 size_t num_threads, sel4utils_thread_pool_t *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->threads = calloc(num_threads, sizeof(*pool->threads));
+    pool->idle = calloc(num_threads, sizeof(*pool->idle));
+    if (num_threads > 0 && (pool->threads == NULL || pool->idle == NULL)) {
+        ZF_LOGE("Failed to allocate thread pool");
+        sel4utils_thread_pool_destroy(vka, alloc, pool);
+        return -1;
+    }
+
+    for (; pool->num_threads < num_threads; pool->num_threads++) {
+        sel4utils_thread_t *thread = &pool->threads[pool->num_threads];
+        if (sel4utils_configure_thread_config(vka, parent, alloc, config, thread)) {
+            ZF_LOGE("Failed to configure thread %zu of pool", pool->num_threads);
+            /* a thread that failed to configure may still hold some of its resources */
+            pool->num_threads++;
+            sel4utils_thread_pool_destroy(vka, alloc, pool);
+            return -1;
+        }
+        pool->idle[pool->num_idle++] = thread;
+    }
+    return 0;
+}
+
+sel4utils_thread_t *sel4utils_thread_pool_get(sel4utils_thread_pool_t *pool)
+{
+    if (pool->num_idle == 0) {
+        return NULL;
+    }
+    return pool->idle[--pool->num_idle];
+}
+
+int sel4utils_thread_pool_put(sel4utils_thread_pool_t *pool, sel4utils_thread_t *thread)
+{
+    assert(thread >= pool->threads && thread < pool->threads + pool->num_threads);
+    assert(pool->num_idle < pool->num_threads);
+    /* stopped here, the next sel4utils_start_thread only needs to write its registers */
+    int error = seL4_TCB_Suspend(thread->tcb.cptr);
+    if (error) {
+        ZF_LOGE("Failed to suspend pool thread");
+        return -1;
+    }
+    pool->idle[pool->num_idle++] = thread;
+    return 0;
+}
+
+void sel4utils_thread_pool_destroy(vka_t *vka, vspace_t *alloc, sel4utils_thread_pool_t *pool)
+{
+    for (size_t i = 0; i < pool->num_threads; i++) {
+        sel4utils_clean_up_thread(vka, alloc, &pool->threads[i]);
+    }
+    free(pool->threads);
+    free(pool->idle);
+    memset(pool, 0, sizeof(*pool));
+}
+
 void sel4utils_print_fault_message(seL4_MessageInfo_t tag, const char *thread_name)
 {
     seL4_Fault_t fault = seL4_getFault(tag);
@@ -311,11 +380,228 @@ sel4utils_start_fault_handler(seL4_CPtr fault_endpoint, vka_t *vka, vspace_t *vs
                                   (void *) fault_endpoint, 1);
 }
 
+static void
+lazy_fault_handler(sel4utils_lazy_fault_handler_t *handler)
+{
+    seL4_CPtr reply = handler->thread.reply.cptr;
+    seL4_MessageInfo_t info = api_recv(handler->fault_endpoint, NULL, reply);
+    while (1) {
+        if (seL4_MessageInfo_get_label(info) == seL4_Fault_VMFault) {
+            seL4_Fault_t fault = seL4_getFault(info);
+            void *addr = (void *) seL4_Fault_VMFault_get_Addr(fault);
+            if (sel4utils_lazy_fault(handler->vspace, addr) == 0 ||
+                sel4utils_cow_fault(handler->handler_vspace, handler->vspace, addr) == 0 ||
+                (handler->checkpoint != NULL && sel4utils_checkpoint_fault(handler->checkpoint, addr) == 0)) {
+                /* an empty reply restarts the faulting instruction */
+                info = api_reply_recv(handler->fault_endpoint, seL4_MessageInfo_new(0, 0, 0, 0), NULL, reply);
+                continue;
+            }
+            /* trying to handle the fault may have clobbered the message registers,
+             * so report what we already read out of them */
+            printf("%sUnhandled lazy or copy on write fault from [%s] at address %p%s\n",
+                   COLOR_ERROR, handler->name, addr, COLOR_NORMAL);
+        } else {
+            sel4utils_print_fault_message(info, handler->name);
+        }
+        /* leave the faulter blocked */
+        info = api_recv(handler->fault_endpoint, NULL, reply);
+    }
+}
+
 int
-sel4utils_checkpoint_thread(sel4utils_thread_t *thread, sel4utils_checkpoint_t *checkpoint, bool suspend)
+sel4utils_start_lazy_fault_handler(seL4_CPtr fault_endpoint, vka_t *vka, vspace_t *vspace,
+                                   seL4_CPtr cspace, seL4_Word cap_data, char *name, vspace_t *faulter_vspace,
+                                   sel4utils_lazy_fault_handler_t *handler)
 {
-    assert(checkpoint != NULL);
+    handler->fault_endpoint = fault_endpoint;
+    handler->vspace = faulter_vspace;
+    handler->handler_vspace = vspace;
+    handler->name = name;
+    handler->checkpoint = NULL;
+
+    int error = sel4utils_configure_thread(vka, vspace, vspace, 0, cspace,
+                                           cap_data, &handler->thread);
+    if (error) {
+        ZF_LOGE("Failed to configure lazy fault handling thread\n");
+        return -1;
+    }
+
+    return sel4utils_start_thread(&handler->thread, (sel4utils_thread_entry_fn)lazy_fault_handler, handler,
+                                  NULL, 1);
+}
+
+static void
+reaper(sel4utils_reaper_t *reaper)
+{
+    while (1) {
+        api_recv(reaper->endpoint, NULL, reaper->thread.reply.cptr);
+        vspace_t *vspace = (vspace_t *) seL4_GetMR(0);
+        vka_t *vka = (vka_t *) seL4_GetMR(1);
+        seL4_CPtr notification = (seL4_CPtr) seL4_GetMR(2);
+
+        sel4utils_tear_down_cursor_t cursor = { 0 };
+        int error;
+        while ((error = sel4utils_tear_down_step(vspace, vka, &cursor, reaper->budget)) == 1) {
+            seL4_Yield();
+        }
+        if (error) {
+            ZF_LOGE("Failed to tear down vspace %p", vspace);
+        }
+        if (notification != seL4_CapNull) {
+            seL4_Signal(notification);
+        }
+    }
+}
+
+int
+sel4utils_start_reaper(seL4_CPtr endpoint, vka_t *vka, vspace_t *vspace, seL4_CPtr cspace,
+                       seL4_Word cap_data, size_t budget, sel4utils_reaper_t *res)
+{
+    res->endpoint = endpoint;
+    res->budget = budget;
+
+    int error = sel4utils_configure_thread(vka, vspace, vspace, 0, cspace,
+                                           cap_data, &res->thread);
+    if (error) {
+        ZF_LOGE("Failed to configure reaper thread\n");
+        return -1;
+    }
+
+    return sel4utils_start_thread(&res->thread, (sel4utils_thread_entry_fn)reaper, res, NULL, 1);
+}
+
+void
+sel4utils_reaper_tear_down(seL4_CPtr endpoint, vspace_t *vspace, vka_t *vka, seL4_CPtr notification)
+{
+    seL4_SetMR(0, (seL4_Word) vspace);
+    seL4_SetMR(1, (seL4_Word) vka);
+    seL4_SetMR(2, (seL4_Word) notification);
+    seL4_Send(endpoint, seL4_MessageInfo_new(0, 0, 0, 3));
+}
+
+static void
+populater(sel4utils_populater_t *populater)
+{
+    while (1) {
+        api_recv(populater->endpoint, NULL, populater->thread.reply.cptr);
+        vspace_t *vspace = (vspace_t *) seL4_GetMR(0);
+        void *vaddr = (void *) seL4_GetMR(1);
+        size_t bytes = seL4_GetMR(2);
+        int flags = seL4_GetMR(3);
+        int *result = (int *) seL4_GetMR(4);
+        seL4_CPtr notification = (seL4_CPtr) seL4_GetMR(5);
+
+        int error = sel4utils_populate(vspace, vaddr, bytes, flags);
+        if (error) {
+            ZF_LOGE("Failed to populate %p of %zu bytes", vaddr, bytes);
+        }
+        if (result != NULL) {
+            *result = error;
+        }
+        if (notification != seL4_CapNull) {
+            seL4_Signal(notification);
+        }
+    }
+}
+
+int
+sel4utils_start_populater(seL4_CPtr endpoint, vka_t *vka, vspace_t *vspace, seL4_CPtr cspace,
+                          seL4_Word cap_data, sel4utils_populater_t *res)
+{
+    res->endpoint = endpoint;
+
+    int error = sel4utils_configure_thread(vka, vspace, vspace, 0, cspace,
+                                           cap_data, &res->thread);
+    if (error) {
+        ZF_LOGE("Failed to configure populater thread\n");
+        return -1;
+    }
+
+    return sel4utils_start_thread(&res->thread, (sel4utils_thread_entry_fn)populater, res, NULL, 1);
+}
+
+void
+sel4utils_populate_async(seL4_CPtr endpoint, vspace_t *vspace, void *vaddr, size_t bytes, int flags,
+                         int *error, seL4_CPtr notification)
+{
+    seL4_SetMR(0, (seL4_Word) vspace);
+    seL4_SetMR(1, (seL4_Word) vaddr);
+    seL4_SetMR(2, (seL4_Word) bytes);
+    seL4_SetMR(3, (seL4_Word) flags);
+    seL4_SetMR(4, (seL4_Word) error);
+    seL4_SetMR(5, (seL4_Word) notification);
+    seL4_Send(endpoint, seL4_MessageInfo_new(0, 0, 0, 6));
+}
+
+static void
+passive_server(sel4utils_passive_server_t *server)
+{
+    seL4_CPtr reply = server->thread->reply.cptr;
+    seL4_Word badge = 0;
+    seL4_MessageInfo_t info;
+
+    /* tell the starter we are ready and wait for the first request in one go, so the
+     * scheduling context is not unbound before we are blocked on the endpoint */
+    if (config_set(CONFIG_KERNEL_MCS)) {
+        info = api_nbsend_recv(server->init.cptr, seL4_MessageInfo_new(0, 0, 0, 0), server->endpoint, &badge,
+                               reply);
+    } else {
+        seL4_Signal(server->init.cptr);
+        info = api_recv(server->endpoint, &badge, reply);
+    }
+    while (1) {
+        info = server->handler(server->cookie, badge, info);
+        info = api_reply_recv(server->endpoint, info, &badge, reply);
+    }
+}
+
+int
+sel4utils_start_passive_server(vka_t *vka, sel4utils_thread_t *thread, seL4_CPtr endpoint,
+                               sel4utils_passive_server_fn handler, void *cookie,
+                               sel4utils_passive_server_t *server)
+{
+    *server = (sel4utils_passive_server_t) {
+        .thread = thread,
+        .endpoint = endpoint,
+        .handler = handler,
+        .cookie = cookie,
+    };
+
+    if (config_set(CONFIG_KERNEL_MCS) && thread->sched_context.cptr == seL4_CapNull) {
+        ZF_LOGE("Passive server needs a scheduling context to start on");
+        return -1;
+    }
+
+    if (config_set(CONFIG_KERNEL_MCS) && thread->reply.cptr == seL4_CapNull) {
+        if (vka_alloc_reply(vka, &thread->reply)) {
+            ZF_LOGE("Failed to allocate reply for passive server");
+            return -1;
+        }
+        thread->own_reply = true;
+    }
 
+    if (vka_alloc_notification(vka, &server->init)) {
+        ZF_LOGE("Failed to allocate notification to start passive server");
+        return -1;
+    }
+
+    int error = sel4utils_start_thread(thread, (sel4utils_thread_entry_fn)passive_server, server, NULL, 1);
+    if (error) {
+        ZF_LOGE("Failed to start passive server");
+    } else {
+        seL4_Wait(server->init.cptr, NULL);
+        if (config_set(CONFIG_KERNEL_MCS)) {
+            error = api_sc_unbind_object(thread->sched_context.cptr, thread->tcb.cptr);
+            ZF_LOGE_IF(error, "Failed to unbind scheduling context of passive server");
+        }
+    }
+    vka_free_object(vka, &server->init);
+    return error;
+}
+
+static int
+checkpoint_registers(sel4utils_thread_t *thread, sel4utils_checkpoint_t *checkpoint, bool suspend)
+{
     int error = seL4_TCB_ReadRegisters(thread->tcb.cptr, suspend, 0, sizeof(seL4_UserContext) / sizeof(seL4_Word),
             &checkpoint->regs);
     if (error) {
@@ -338,6 +624,20 @@ sel4utils_checkpoint_thread(sel4utils_thread_t *thread, sel4utils_checkpoint_t *
          checkpoint->sp = checkpoint->regs.rbx;
     }
 #endif /* CONFIG_ARCH_X86_64 */
+    checkpoint->thread = thread;
+
+    return 0;
+}
+
+int
+sel4utils_checkpoint_thread(sel4utils_thread_t *thread, sel4utils_checkpoint_t *checkpoint, bool suspend)
+{
+    assert(checkpoint != NULL);
+
+    int error = checkpoint_registers(thread, checkpoint, suspend);
+    if (error) {
+        return error;
+    }
 
     size_t stack_size = (uintptr_t) thread->stack_top - checkpoint->sp;
     checkpoint->stack = malloc(stack_size);
@@ -346,8 +646,7 @@ sel4utils_checkpoint_thread(sel4utils_thread_t *thread, sel4utils_checkpoint_t *
         return -1;
     }
 
-    memcpy(checkpoint->stack, (void *) checkpoint->sp, stack_size);
-    checkpoint->thread = thread;
+    sel4utils_copy(checkpoint->stack, (void *) checkpoint->sp, stack_size);
 
     return error;
 }
@@ -358,7 +657,7 @@ sel4utils_checkpoint_restore(sel4utils_checkpoint_t *checkpoint, bool free_memor
     assert(checkpoint != NULL);
 
     size_t stack_size = (uintptr_t) checkpoint->thread->stack_top - checkpoint->sp;
-    memcpy((void *) checkpoint->sp, checkpoint->stack, stack_size);
+    sel4utils_copy((void *) checkpoint->sp, checkpoint->stack, stack_size);
 
     int error = seL4_TCB_WriteRegisters(checkpoint->thread->tcb.cptr, resume, 0,
             sizeof(seL4_UserContext) / sizeof (seL4_Word),
@@ -381,6 +680,214 @@ sel4utils_free_checkpoint(sel4utils_checkpoint_t *checkpoint)
     free(checkpoint->stack);
 }
 
+/* Map the frame of the thread at vaddr into the vspace of the caller and make it read only
+ * for the thread */
+static int track_page(sel4utils_incremental_checkpoint_t *checkpoint, uintptr_t vaddr)
+{
+    sel4utils_checkpoint_page_t *page = &checkpoint->pages[checkpoint->num_pages];
+    cspacepath_t src, dest;
+
+    if (vka_cspace_alloc_path(checkpoint->vka, &dest)) {
+        ZF_LOGE("Failed to allocate cslot");
+        return -1;
+    }
+    vka_cspace_make_path(checkpoint->vka, vspace_get_cap(checkpoint->thread_vspace, (void *) vaddr), &src);
+    if (vka_cnode_copy(&dest, &src, seL4_AllRights) != seL4_NoError) {
+        ZF_LOGE("Failed to copy frame cap");
+        vka_cspace_free_path(checkpoint->vka, dest);
+        return -1;
+    }
+    void *mapping = vspace_map_pages(checkpoint->vspace, &dest.capPtr, NULL, seL4_AllRights, 1, seL4_PageBits, 1);
+    if (mapping == NULL) {
+        ZF_LOGE("Failed to map frame");
+        vka_cnode_delete(&dest);
+        vka_cspace_free_path(checkpoint->vka, dest);
+        return -1;
+    }
+    *page = (sel4utils_checkpoint_page_t) {
+        .vaddr = vaddr,
+        .slot = dest.capPtr,
+        .mapping = mapping,
+    };
+    checkpoint->num_pages++;
+
+    if (sel4utils_remap_page(checkpoint->thread_vspace, (void *) vaddr, true)) {
+        ZF_LOGE("Failed to make %p read only", (void *) vaddr);
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_range(const void *a, const void *b)
+{
+    uintptr_t start_a = (uintptr_t)((const sel4utils_checkpoint_range_t *) a)->start;
+    uintptr_t start_b = (uintptr_t)((const sel4utils_checkpoint_range_t *) b)->start;
+    return (start_a > start_b) - (start_a < start_b);
+}
+
+int
+sel4utils_checkpoint_thread_incremental(sel4utils_thread_t *thread, vspace_t *thread_vspace, vka_t *vka,
+                                        vspace_t *vspace, size_t num_ranges,
+                                        const sel4utils_checkpoint_range_t *ranges, bool suspend,
+                                        sel4utils_incremental_checkpoint_t *checkpoint)
+{
+    assert(checkpoint != NULL);
+
+    memset(checkpoint, 0, sizeof(*checkpoint));
+    if (thread_vspace == vspace) {
+        ZF_LOGE("Cannot incrementally checkpoint a thread in the vspace of the caller");
+        return -1;
+    }
+    checkpoint->thread_vspace = thread_vspace;
+    checkpoint->vspace = vspace;
+    checkpoint->vka = vka;
+
+    /* sorted, so that faults can find their page with a binary search */
+    sel4utils_checkpoint_range_t *sorted = malloc(sizeof(*sorted) * num_ranges);
+    if (num_ranges > 0 && sorted == NULL) {
+        ZF_LOGE("Failed to allocate ranges");
+        return -1;
+    }
+    memcpy(sorted, ranges, sizeof(*sorted) * num_ranges);
+    qsort(sorted, num_ranges, sizeof(*sorted), compare_range);
+
+    size_t max_pages = 0;
+    for (size_t i = 0; i < num_ranges; i++) {
+        uintptr_t start = (uintptr_t) sorted[i].start;
+        if (!IS_ALIGNED(start, PAGE_BITS_4K) || !IS_ALIGNED(sorted[i].bytes, PAGE_BITS_4K) ||
+            (i > 0 && start < (uintptr_t) sorted[i - 1].start + sorted[i - 1].bytes)) {
+            ZF_LOGE("Ranges to checkpoint must be 4K aligned and not overlap");
+            free(sorted);
+            return -1;
+        }
+        max_pages += BYTES_TO_4K_PAGES(sorted[i].bytes);
+    }
+    checkpoint->pages = calloc(max_pages, sizeof(*checkpoint->pages));
+    checkpoint->dirty = calloc(max_pages, sizeof(*checkpoint->dirty));
+    if (max_pages > 0 && (checkpoint->pages == NULL || checkpoint->dirty == NULL)) {
+        ZF_LOGE("Failed to allocate checkpoint");
+        free(sorted);
+        goto error;
+    }
+
+    /* the thread must not run while its pages change under it */
+    int error = checkpoint_registers(thread, &checkpoint->checkpoint, true);
+    for (size_t i = 0; !error && i < num_ranges; i++) {
+        uintptr_t start = (uintptr_t) sorted[i].start;
+        for (uintptr_t v = start; !error && v < start + sorted[i].bytes; v += PAGE_SIZE_4K) {
+            if (vspace_get_cap(thread_vspace, (void *) v) != seL4_CapNull) {
+                error = track_page(checkpoint, v);
+            }
+        }
+    }
+    free(sorted);
+    if (error) {
+        goto error;
+    }
+
+    if (!suspend) {
+        error = seL4_TCB_Resume(thread->tcb.cptr);
+        if (error) {
+            ZF_LOGE("Failed to resume thread after checkpointing");
+            goto error;
+        }
+    }
+    return 0;
+
+error:
+    sel4utils_free_incremental_checkpoint(checkpoint);
+    return -1;
+}
+
+int
+sel4utils_checkpoint_fault(sel4utils_incremental_checkpoint_t *checkpoint, void *vaddr)
+{
+    uintptr_t v = ROUND_DOWN((uintptr_t) vaddr, PAGE_SIZE_4K);
+    sel4utils_checkpoint_page_t *page = NULL;
+    size_t low = 0, high = checkpoint->num_pages;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (checkpoint->pages[mid].vaddr < v) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < checkpoint->num_pages && checkpoint->pages[low].vaddr == v) {
+        page = &checkpoint->pages[low];
+    }
+    if (page == NULL || page->dirty) {
+        return -1;
+    }
+
+    /* the buffer is kept across restores, so it is only allocated once */
+    if (page->saved == NULL) {
+        if (posix_memalign(&page->saved, PAGE_SIZE_4K, PAGE_SIZE_4K) != 0) {
+            page->saved = NULL;
+            ZF_LOGE("Failed to allocate copy of %p", (void *) v);
+            return -1;
+        }
+    }
+    sel4utils_copy_pages(page->saved, page->mapping, PAGE_SIZE_4K);
+    if (sel4utils_remap_page(checkpoint->thread_vspace, (void *) v, false)) {
+        ZF_LOGE("Failed to make %p writable", (void *) v);
+        return -1;
+    }
+    page->dirty = true;
+    checkpoint->dirty[checkpoint->num_dirty++] = page;
+    return 0;
+}
+
+int
+sel4utils_checkpoint_restore_incremental(sel4utils_incremental_checkpoint_t *checkpoint, bool resume)
+{
+    assert(checkpoint != NULL);
+
+    while (checkpoint->num_dirty > 0) {
+        sel4utils_checkpoint_page_t *page = checkpoint->dirty[checkpoint->num_dirty - 1];
+        /* read only before the copy, so the page is never writable with the old contents */
+        if (sel4utils_remap_page(checkpoint->thread_vspace, (void *) page->vaddr, true)) {
+            ZF_LOGE("Failed to make %p read only", (void *) page->vaddr);
+            return -1;
+        }
+        sel4utils_copy_pages(page->mapping, page->saved, PAGE_SIZE_4K);
+        page->dirty = false;
+        checkpoint->num_dirty--;
+    }
+
+    int error = seL4_TCB_WriteRegisters(checkpoint->checkpoint.thread->tcb.cptr, resume, 0,
+                                        sizeof(seL4_UserContext) / sizeof(seL4_Word),
+                                        &checkpoint->checkpoint.regs);
+    if (error) {
+        ZF_LOGE("Failed to restore registers of tcb while restoring checkpoint\n");
+    }
+    return error;
+}
+
+void
+sel4utils_free_incremental_checkpoint(sel4utils_incremental_checkpoint_t *checkpoint)
+{
+    for (size_t i = 0; i < checkpoint->num_pages; i++) {
+        sel4utils_checkpoint_page_t *page = &checkpoint->pages[i];
+        cspacepath_t path;
+        if (!page->dirty) {
+            sel4utils_remap_page(checkpoint->thread_vspace, (void *) page->vaddr, false);
+        }
+        vspace_unmap_pages(checkpoint->vspace, page->mapping, 1, seL4_PageBits, VSPACE_PRESERVE);
+        vka_cspace_make_path(checkpoint->vka, page->slot, &path);
+        vka_cnode_delete(&path);
+        vka_cspace_free(checkpoint->vka, page->slot);
+        free(page->saved);
+    }
+    free(checkpoint->pages);
+    free(checkpoint->dirty);
+    checkpoint->pages = NULL;
+    checkpoint->dirty = NULL;
+    checkpoint->num_pages = 0;
+    checkpoint->num_dirty = 0;
+}
+
 int sel4utils_set_sched_affinity(sel4utils_thread_t *thread, sched_params_t params) {
 #if CONFIG_MAX_NUM_NODES > 1
 #ifdef CONFIG_KERNEL_MCS
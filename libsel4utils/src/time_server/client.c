@@ -4,21 +4,53 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <stdbool.h>
+
 #include <sel4/sel4.h>
 #include <platsupport/timer.h>
 #include <platsupport/ltimer.h>
 #include <sel4utils/util.h>
+#include <sel4utils/arch/counter.h>
 #include <sel4utils/time_server/client.h>
 #include <utils/util.h>
 
 typedef struct {
     seL4_CPtr ep;
     seL4_Word label;
+    sel4utils_time_page_t *time_page;
 } client_ltimer_t;
 
+bool sel4utils_time_page_get_time(sel4utils_time_page_t *page, uint64_t *time, uint64_t *realtime_offset_ns)
+{
+#ifdef SEL4UTILS_HAVE_USER_COUNTER
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+        uint32_t mult = page->mult;
+        if (mult == 0) {
+            return false;
+        }
+        *time = page->base_ns + (((sel4utils_read_counter() - page->base_cycles) * mult) >> page->shift);
+        if (realtime_offset_ns != NULL) {
+            *realtime_offset_ns = page->realtime_offset_ns;
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&page->seq, __ATOMIC_RELAXED) != seq);
+    return true;
+#else
+    return false;
+#endif /* SEL4UTILS_HAVE_USER_COUNTER */
+}
+
 static int client_get_time(void *data, uint64_t *time)
 {
     client_ltimer_t *ltimer = data;
+    if (ltimer->time_page != NULL && sel4utils_time_page_get_time(ltimer->time_page, time, NULL)) {
+        return 0;
+    }
     seL4_MessageInfo_t info = seL4_MessageInfo_new(ltimer->label, 0, 0, 1);
     seL4_SetMR(0, GET_TIME);
     seL4_Call(ltimer->ep, info);
@@ -54,3 +86,57 @@ int sel4utils_rpc_ltimer_init(ltimer_t *ltimer, ps_io_ops_t ops, seL4_CPtr ep, s
     /* success! */
     return 0;
 }
+
+void sel4utils_rpc_ltimer_set_time_page(ltimer_t *ltimer, sel4utils_time_page_t *time_page)
+{
+    client_ltimer_t *client_ltimer = ltimer->data;
+    client_ltimer->time_page = time_page;
+}
+
+static seL4_MessageInfo_t set_timeouts_message(client_ltimer_t *ltimer, size_t num,
+                                               sel4utils_rpc_timeout_t *timeouts, bool notify)
+{
+    seL4_SetMR(0, SET_TIMEOUTS);
+    seL4_SetMR(1, num);
+    seL4_SetMR(2, notify);
+    seL4_Word length = sel4utils_set_mrs(SEL4UTILS_RPC_SET_TIMEOUTS_HEADER, timeouts,
+                                         num * sizeof(*timeouts));
+    return seL4_MessageInfo_new(ltimer->label, 0, 0, length);
+}
+
+int sel4utils_rpc_ltimer_set_timeouts(ltimer_t *ltimer, size_t num, sel4utils_rpc_timeout_t *timeouts)
+{
+    client_ltimer_t *client_ltimer = ltimer->data;
+    while (num > 0) {
+        size_t batch = MIN(num, SEL4UTILS_RPC_SET_TIMEOUTS_MAX);
+        seL4_Call(client_ltimer->ep, set_timeouts_message(client_ltimer, batch, timeouts, false));
+        int error = seL4_GetMR(0);
+        if (error) {
+            return error;
+        }
+        num -= batch;
+        timeouts += batch;
+    }
+    return 0;
+}
+
+void sel4utils_rpc_ltimer_set_timeouts_async(ltimer_t *ltimer, size_t num, sel4utils_rpc_timeout_t *timeouts)
+{
+    client_ltimer_t *client_ltimer = ltimer->data;
+    while (num > 0) {
+        size_t batch = MIN(num, SEL4UTILS_RPC_SET_TIMEOUTS_MAX);
+        /* only the last message asks to be told it is done */
+        seL4_Send(client_ltimer->ep, set_timeouts_message(client_ltimer, batch, timeouts, batch == num));
+        num -= batch;
+        timeouts += batch;
+    }
+}
+
+int sel4utils_rpc_ltimer_get_fired(ltimer_t *ltimer, seL4_Word *fired)
+{
+    client_ltimer_t *client_ltimer = ltimer->data;
+    seL4_SetMR(0, GET_FIRED);
+    seL4_Call(client_ltimer->ep, seL4_MessageInfo_new(client_ltimer->label, 0, 0, 1));
+    *fired = seL4_GetMR(1);
+    return seL4_GetMR(0);
+}
@@ -0,0 +1,495 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <platsupport/ltimer.h>
+#include <sel4utils/util.h>
+#include <sel4utils/arch/counter.h>
+#include <sel4utils/time_server/server.h>
+#include <utils/util.h>
+#include <utils/time.h>
+
+#define WHEEL_MASK (SEL4UTILS_TIMER_WHEEL_SIZE - 1)
+
+static inline int level_shift(int level)
+{
+    return level * SEL4UTILS_TIMER_WHEEL_BITS;
+}
+
+/* distance from the slot from to the first slot in use at or after it, wrapping around */
+static inline int next_slot(uint64_t occupied, int from)
+{
+    uint64_t rotated = from ? (occupied >> from) | (occupied << (SEL4UTILS_TIMER_WHEEL_SIZE - from)) : occupied;
+    return __builtin_ctzll(rotated);
+}
+
+static void wheel_insert(sel4utils_time_server_t *server, sel4utils_timeout_t *timeout)
+{
+    uint64_t expires = MAX(timeout->expires, server->now);
+
+    /* the first level the timeout is less than a full turn of the wheel away in. This
+     * is never the current slot of a level above the first, which is what lets slots
+     * be emptied as soon as they are reached */
+    int level;
+    for (level = 0; level < SEL4UTILS_TIMER_WHEEL_LEVELS - 1; level++) {
+        if ((expires >> level_shift(level)) - (server->now >> level_shift(level)) < SEL4UTILS_TIMER_WHEEL_SIZE) {
+            break;
+        }
+    }
+    uint64_t current = server->now >> level_shift(level);
+    uint64_t slot = expires >> level_shift(level);
+    if (slot - current >= SEL4UTILS_TIMER_WHEEL_SIZE) {
+        /* past the end of the wheel, wait in the last slot */
+        slot = current + SEL4UTILS_TIMER_WHEEL_SIZE - 1;
+    }
+    slot &= WHEEL_MASK;
+
+    sel4utils_timeout_t **head = &server->slots[level][slot];
+    timeout->next = *head;
+    if (*head != NULL) {
+        (*head)->pprev = &timeout->next;
+    }
+    *head = timeout;
+    timeout->pprev = head;
+    timeout->level = level;
+    timeout->slot = slot;
+    server->occupied[level] |= (1ull << slot);
+}
+
+static void wheel_remove(sel4utils_time_server_t *server, sel4utils_timeout_t *timeout)
+{
+    *timeout->pprev = timeout->next;
+    if (timeout->next != NULL) {
+        timeout->next->pprev = timeout->pprev;
+    }
+    if (server->slots[timeout->level][timeout->slot] == NULL) {
+        server->occupied[timeout->level] &= ~(1ull << timeout->slot);
+    }
+    timeout->pprev = NULL;
+}
+
+/* tick of the next slot that needs attention: one that is due, or one to be spread out
+ * over the levels below. Returns false if there are no timeouts */
+static bool wheel_next_event(sel4utils_time_server_t *server, uint64_t *tick)
+{
+    bool found = false;
+    for (int level = 0; level < SEL4UTILS_TIMER_WHEEL_LEVELS; level++) {
+        if (server->occupied[level] == 0) {
+            continue;
+        }
+        uint64_t current = server->now >> level_shift(level);
+        uint64_t event = (current + next_slot(server->occupied[level], current & WHEEL_MASK)) << level_shift(level);
+        event = MAX(event, server->now);
+        if (!found || event < *tick) {
+            *tick = event;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void wheel_run_tick(sel4utils_time_server_t *server)
+{
+    /* spread out the slots that the current tick has reached, from the top down so that
+     * their timeouts can make it all the way to the first level */
+    for (int level = SEL4UTILS_TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        int slot = (server->now >> level_shift(level)) & WHEEL_MASK;
+        sel4utils_timeout_t *timeout = server->slots[level][slot];
+        if (timeout == NULL) {
+            continue;
+        }
+        server->slots[level][slot] = NULL;
+        server->occupied[level] &= ~(1ull << slot);
+        while (timeout != NULL) {
+            sel4utils_timeout_t *next = timeout->next;
+            wheel_insert(server, timeout);
+            timeout = next;
+        }
+    }
+
+    /* fire the timeouts that are due. They are taken one at a time as the callbacks
+     * may cancel any other timeout */
+    int slot = server->now & WHEEL_MASK;
+    sel4utils_timeout_t *timeout;
+    while ((timeout = server->slots[0][slot]) != NULL) {
+        wheel_remove(server, timeout);
+        if (timeout->period) {
+            timeout->deadline += timeout->period;
+            timeout->expires = DIV_ROUND_UP(timeout->deadline, server->tick_ns);
+            wheel_insert(server, timeout);
+        }
+        timeout->fn(timeout->data);
+    }
+}
+
+static void wheel_advance(sel4utils_time_server_t *server, uint64_t target)
+{
+    uint64_t tick;
+    server->running = true;
+    while (wheel_next_event(server, &tick) && tick <= target) {
+        server->now = tick;
+        wheel_run_tick(server);
+    }
+    server->running = false;
+    server->now = MAX(server->now, target);
+}
+
+/* fire what is due, then make sure the hardware timeout is set no later than slack ns after
+ * the next event */
+static int update(sel4utils_time_server_t *server)
+{
+    while (true) {
+        uint64_t time;
+        int error = ltimer_get_time(server->ltimer, &time);
+        if (error) {
+            ZF_LOGE("Failed to get time");
+            return error;
+        }
+        wheel_advance(server, time / server->tick_ns);
+
+        uint64_t tick;
+        if (!wheel_next_event(server, &tick)) {
+            return 0;
+        }
+        uint64_t deadline = tick * server->tick_ns + server->slack_ns;
+        if (server->programmed <= deadline) {
+            /* an interrupt is on the way soon enough */
+            return 0;
+        }
+        error = ltimer_set_timeout(server->ltimer, deadline, TIMEOUT_ABSOLUTE);
+        if (error == ETIME || error == -ETIME) {
+            /* the deadline passed while we worked it out */
+            continue;
+        }
+        if (error) {
+            ZF_LOGE("Failed to set timeout");
+            return error;
+        }
+        server->programmed = deadline;
+        return 0;
+    }
+}
+
+int sel4utils_time_server_init(sel4utils_time_server_t *server, ltimer_t *ltimer, uint64_t tick_ns,
+                               uint64_t slack_ns)
+{
+    if (ltimer == NULL || tick_ns == 0) {
+        ZF_LOGE("Invalid arguments");
+        return -EINVAL;
+    }
+
+    memset(server, 0, sizeof(*server));
+    server->ltimer = ltimer;
+    server->tick_ns = tick_ns;
+    server->slack_ns = slack_ns;
+    server->programmed = UINT64_MAX;
+
+    uint64_t time;
+    int error = ltimer_get_time(ltimer, &time);
+    if (error) {
+        ZF_LOGE("Failed to get time");
+        return error;
+    }
+    server->now = time / tick_ns;
+    return 0;
+}
+
+int sel4utils_timeout_set(sel4utils_time_server_t *server, sel4utils_timeout_t *timeout, uint64_t ns,
+                          timeout_type_t type, sel4utils_timeout_fn_t fn, void *data)
+{
+    uint64_t time;
+    int error = ltimer_get_time(server->ltimer, &time);
+    if (error) {
+        ZF_LOGE("Failed to get time");
+        return error;
+    }
+
+    sel4utils_timeout_cancel(server, timeout);
+    switch (type) {
+    case TIMEOUT_ABSOLUTE:
+        timeout->deadline = ns;
+        timeout->period = 0;
+        break;
+    case TIMEOUT_RELATIVE:
+        timeout->deadline = time + ns;
+        timeout->period = 0;
+        break;
+    case TIMEOUT_PERIODIC:
+        if (ns == 0) {
+            return -EINVAL;
+        }
+        timeout->deadline = time + ns;
+        timeout->period = ns;
+        break;
+    default:
+        return -EINVAL;
+    }
+    timeout->expires = DIV_ROUND_UP(timeout->deadline, server->tick_ns);
+    timeout->fn = fn;
+    timeout->data = data;
+    wheel_insert(server, timeout);
+
+    if (server->running) {
+        /* the hardware timeout is set up once the timeouts have been fired */
+        return 0;
+    }
+    return update(server);
+}
+
+void sel4utils_timeout_cancel(sel4utils_time_server_t *server, sel4utils_timeout_t *timeout)
+{
+    /* the hardware timeout is left alone, an early interrupt just finds nothing to do */
+    if (timeout->pprev != NULL) {
+        wheel_remove(server, timeout);
+    }
+}
+
+int sel4utils_time_server_handle_timeout(sel4utils_time_server_t *server)
+{
+    server->programmed = UINT64_MAX;
+    return update(server);
+}
+
+#ifdef SEL4UTILS_HAVE_USER_COUNTER
+
+#define TIME_PAGE_REFRESH_S 60
+/* how long the counter is measured against the ltimer when its frequency isn't known */
+#define TIME_PAGE_CALIBRATE_NS (10 * NS_IN_MS)
+
+/* frequency of the counter in Hz from the cycles it counts as the ltimer advances, 0 on error */
+static uint64_t counter_calibrate(sel4utils_time_server_t *server)
+{
+    uint64_t start, now;
+    int error = ltimer_get_time(server->ltimer, &start);
+    uint64_t start_cycles = sel4utils_read_counter();
+    do {
+        if (!error) {
+            error = ltimer_get_time(server->ltimer, &now);
+        }
+    } while (!error && now - start < TIME_PAGE_CALIBRATE_NS);
+    uint64_t cycles = sel4utils_read_counter() - start_cycles;
+    if (error) {
+        ZF_LOGE("Failed to get time, counter not calibrated");
+        return 0;
+    }
+    /* the cycles of a few ms fit in 64 bits even multiplied by NS_IN_S */
+    return cycles * NS_IN_S / (now - start);
+}
+
+/* point the page at the current time, never moving clients backwards */
+static void time_page_rebase(void *data)
+{
+    sel4utils_time_server_t *server = data;
+    sel4utils_time_page_t *page = server->time_page;
+
+    uint64_t time;
+    uint64_t before = sel4utils_read_counter();
+    int error = ltimer_get_time(server->ltimer, &time);
+    uint64_t after = sel4utils_read_counter();
+    if (error) {
+        ZF_LOGE("Failed to get time, time page not rebased");
+        return;
+    }
+    uint64_t cycles = before + (after - before) / 2;
+    if (page->mult != 0) {
+        time = MAX(time, page->base_ns + (((cycles - page->base_cycles) * page->mult) >> page->shift));
+    }
+
+    uint32_t seq = page->seq;
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    page->base_ns = time;
+    page->base_cycles = cycles;
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int sel4utils_time_server_export_time(sel4utils_time_server_t *server, vspace_t *vspace, uint64_t freq)
+{
+    if (freq == 0) {
+        freq = sel4utils_counter_freq();
+    }
+    if (freq == 0) {
+        freq = counter_calibrate(server);
+    }
+    if (freq == 0) {
+        ZF_LOGE("Frequency of the counter is not known");
+        return -EINVAL;
+    }
+
+    server->time_page = vspace_new_pages(vspace, seL4_AllRights, 1, PAGE_BITS_4K);
+    if (server->time_page == NULL) {
+        ZF_LOGE("Failed to allocate time page");
+        return -ENOMEM;
+    }
+    sel4utils_time_page_t *page = server->time_page;
+    memset(page, 0, sizeof(*page));
+
+    /* the most precise shift that keeps mult in 32 bits and can count twice the
+     * refresh period without overflowing. Any frequency a counter runs at is found
+     * a shift with mult well above 0 */
+    uint64_t max_cycles = freq * TIME_PAGE_REFRESH_S * 2;
+    uint32_t shift;
+    uint64_t mult;
+    for (shift = 32; shift > 0; shift--) {
+        mult = (NS_IN_S << shift) / freq;
+        if (mult <= UINT32_MAX && mult <= UINT64_MAX / max_cycles) {
+            break;
+        }
+    }
+
+    time_page_rebase(server);
+    page->shift = shift;
+    __atomic_store_n(&page->mult, mult, __ATOMIC_RELEASE);
+
+    return sel4utils_timeout_set(server, &server->time_page_refresh, TIME_PAGE_REFRESH_S * NS_IN_S,
+                                 TIMEOUT_PERIODIC, time_page_rebase, server);
+}
+
+int sel4utils_time_server_set_realtime(sel4utils_time_server_t *server, uint64_t realtime_ns)
+{
+    sel4utils_time_page_t *page = server->time_page;
+    if (page == NULL) {
+        ZF_LOGE("Time has not been exported");
+        return -EINVAL;
+    }
+
+    uint64_t time;
+    int error = ltimer_get_time(server->ltimer, &time);
+    if (error) {
+        ZF_LOGE("Failed to get time, wall clock time not set");
+        return error;
+    }
+
+    uint32_t seq = page->seq;
+    __atomic_store_n(&page->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    page->realtime_offset_ns = realtime_ns - time;
+    __atomic_store_n(&page->seq, seq + 2, __ATOMIC_RELEASE);
+    return 0;
+}
+
+#else
+
+int sel4utils_time_server_export_time(sel4utils_time_server_t *server, vspace_t *vspace, uint64_t freq)
+{
+    ZF_LOGE("No counter to export the time with");
+    return -ENOSYS;
+}
+
+int sel4utils_time_server_set_realtime(sel4utils_time_server_t *server, uint64_t realtime_ns)
+{
+    ZF_LOGE("No counter to export the time with");
+    return -ENOSYS;
+}
+
+#endif /* SEL4UTILS_HAVE_USER_COUNTER */
+
+sel4utils_time_page_t *sel4utils_time_server_share_time(sel4utils_time_server_t *server, vspace_t *from,
+                                                        vspace_t *to)
+{
+    if (server->time_page == NULL) {
+        ZF_LOGE("Time has not been exported");
+        return NULL;
+    }
+    return vspace_share_mem(from, to, server->time_page, 1, PAGE_BITS_4K, seL4_CanRead, 1);
+}
+
+static void signal_client(void *data)
+{
+    sel4utils_time_server_client_timeout_t *timeout = data;
+    sel4utils_time_server_client_t *client = timeout->client;
+    client->fired |= BIT(timeout - client->timeouts);
+    seL4_Signal(client->notification);
+}
+
+void sel4utils_time_server_client_init(sel4utils_time_server_client_t *client, seL4_CPtr notification,
+                                       seL4_CPtr completion)
+{
+    memset(client, 0, sizeof(*client));
+    for (int i = 0; i < SEL4UTILS_RPC_MAX_TIMEOUTS; i++) {
+        client->timeouts[i].client = client;
+    }
+    client->notification = notification;
+    client->completion = completion;
+}
+
+static int client_set_timeout(sel4utils_time_server_t *server, sel4utils_time_server_client_t *client,
+                              seL4_Word id, seL4_Word type, uint64_t ns)
+{
+    if (id >= SEL4UTILS_RPC_MAX_TIMEOUTS) {
+        ZF_LOGE("Invalid timeout id %"SEL4_PRIu_word, id);
+        return -EINVAL;
+    }
+    sel4utils_time_server_client_timeout_t *timeout = &client->timeouts[id];
+    if (type == SEL4UTILS_RPC_TIMEOUT_CANCEL) {
+        sel4utils_timeout_cancel(server, &timeout->timeout);
+        return 0;
+    }
+    return sel4utils_timeout_set(server, &timeout->timeout, ns, type, signal_client, timeout);
+}
+
+seL4_MessageInfo_t sel4utils_time_server_handle_rpc(sel4utils_time_server_t *server,
+                                                    sel4utils_time_server_client_t *client)
+{
+    switch (seL4_GetMR(0)) {
+    case GET_TIME: {
+        uint64_t time = 0;
+        int error = ltimer_get_time(server->ltimer, &time);
+        seL4_SetMR(0, error);
+        sel4utils_64_set_mr(1, time);
+        return seL4_MessageInfo_new(0, 0, 0, 1 + SEL4UTILS_64_WORDS);
+    }
+    case SET_TIMEOUT: {
+        timeout_type_t type = seL4_GetMR(1);
+        uint64_t ns = sel4utils_64_get_mr(2);
+        int error = client_set_timeout(server, client, 0, type, ns);
+        seL4_SetMR(0, error);
+        return seL4_MessageInfo_new(0, 0, 0, 1);
+    }
+    case SET_TIMEOUTS: {
+        seL4_Word num = seL4_GetMR(1);
+        bool notify = seL4_GetMR(2);
+        int error = 0;
+        seL4_Word done;
+        if (num > SEL4UTILS_RPC_SET_TIMEOUTS_MAX) {
+            ZF_LOGE("Too many timeouts in one message");
+            num = 0;
+            error = -EINVAL;
+        }
+        seL4_Word mr = SEL4UTILS_RPC_SET_TIMEOUTS_HEADER;
+        for (done = 0; done < num; done++) {
+            sel4utils_rpc_timeout_t timeout;
+            mr = SEL4UTILS_GET_MRS(mr, &timeout);
+            error = client_set_timeout(server, client, timeout.id, timeout.type, timeout.ns);
+            if (error) {
+                ZF_LOGE("Failed to set timeout %"SEL4_PRIu_word, timeout.id);
+                break;
+            }
+        }
+        if (notify && client->completion != seL4_CapNull) {
+            seL4_Signal(client->completion);
+        }
+        seL4_SetMR(0, error);
+        seL4_SetMR(1, done);
+        return seL4_MessageInfo_new(0, 0, 0, 2);
+    }
+    case GET_FIRED:
+        seL4_SetMR(0, 0);
+        seL4_SetMR(1, client->fired);
+        client->fired = 0;
+        return seL4_MessageInfo_new(0, 0, 0, 2);
+    default:
+        ZF_LOGE("Unknown time server request %"SEL4_PRIu_word, seL4_GetMR(0));
+        seL4_SetMR(0, -EINVAL);
+        return seL4_MessageInfo_new(0, 0, 0, 1);
+    }
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sel4utils/trace.h>
+#include <sel4utils/arch/counter.h>
+#include <sel4utils/profile.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ *  __start_SECTION_NAME and __stop_SECTION_NAME are magic symbols inserted by the gcc
+ *  linker, weak so that a program without trace points still links
+ */
+extern sel4utils_tracepoint_t __start__trace_point[] WEAK;
+extern sel4utils_tracepoint_t __stop__trace_point[] WEAK;
+
+static sel4utils_trace_buffer_t *buffers[CONFIG_MAX_NUM_NODES];
+
+static inline uint64_t trace_timestamp(void)
+{
+#ifdef SEL4UTILS_HAVE_USER_COUNTER
+    return sel4utils_read_counter();
+#else
+    return 0;
+#endif
+}
+
+void sel4utils_trace_record(sel4utils_tracepoint_t *tracepoint, seL4_Word arg)
+{
+    sel4utils_trace_buffer_t *buffer = buffers[profile_core];
+    if (buffer == NULL) {
+        return;
+    }
+
+    seL4_Word index = __atomic_fetch_add(&buffer->head, 1, __ATOMIC_RELAXED);
+    sel4utils_trace_record_t *record = &buffer->records[index & buffer->mask];
+
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->timestamp = trace_timestamp();
+    record->tracepoint = tracepoint;
+    record->arg = arg;
+    __atomic_store_n(&record->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+int sel4utils_trace_init_buffer(seL4_Word core, void *memory, size_t size_bits)
+{
+    if (core >= CONFIG_MAX_NUM_NODES || memory == NULL) {
+        ZF_LOGE("Invalid arguments to sel4utils_trace_init_buffer");
+        return -1;
+    }
+
+    sel4utils_trace_buffer_t *buffer = memory;
+    buffer->head = 0;
+    buffer->mask = MASK(size_bits);
+    for (seL4_Word i = 0; i <= buffer->mask; i++) {
+        buffer->records[i].seq = 0;
+    }
+    __atomic_store_n(&buffers[core], buffer, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void sel4utils_trace_set_core(seL4_Word core)
+{
+    profile_set_core(core);
+}
+
+int sel4utils_trace_enable(const char *name, bool enabled)
+{
+    int changed = 0;
+
+    for (sel4utils_tracepoint_t *i = __start__trace_point; i < __stop__trace_point; i++) {
+        if (strcmp(i->name, name) == 0) {
+            i->enabled = enabled;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+void sel4utils_trace_enable_all(bool enabled)
+{
+    for (sel4utils_tracepoint_t *i = __start__trace_point; i < __stop__trace_point; i++) {
+        i->enabled = enabled;
+    }
+}
+
+void sel4utils_trace_read(seL4_Word core, sel4utils_trace_callback callback, void *cookie)
+{
+    sel4utils_trace_buffer_t *buffer = __atomic_load_n(&buffers[core], __ATOMIC_ACQUIRE);
+    if (buffer == NULL) {
+        return;
+    }
+
+    seL4_Word head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+    seL4_Word start = head > buffer->mask + 1 ? head - (buffer->mask + 1) : 0;
+    for (seL4_Word index = start; index != head; index++) {
+        sel4utils_trace_record_t *slot = &buffer->records[index & buffer->mask];
+        sel4utils_trace_record_t copy;
+
+        /* The record can be overwritten under us, so copy it and check it didn't change. */
+        copy.seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        copy.timestamp = slot->timestamp;
+        copy.tracepoint = slot->tracepoint;
+        copy.arg = slot->arg;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (copy.seq != index + 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != copy.seq) {
+            continue;
+        }
+        callback(core, &copy, cookie);
+    }
+}
+
+static void print_record(seL4_Word core, sel4utils_trace_record_t *record, UNUSED void *cookie)
+{
+    printf("%zu %"PRIu64" %s %zu\n", (size_t) core, record->timestamp, record->tracepoint->name,
+           (size_t) record->arg);
+}
+
+void sel4utils_trace_dump(void)
+{
+    for (seL4_Word core = 0; core < CONFIG_MAX_NUM_NODES; core++) {
+        sel4utils_trace_read(core, print_record, NULL);
+    }
+}
+
+void sel4utils_trace_reset(void)
+{
+    for (seL4_Word core = 0; core < CONFIG_MAX_NUM_NODES; core++) {
+        sel4utils_trace_buffer_t *buffer = buffers[core];
+        if (buffer != NULL) {
+            /* Moving head on past every record leaves them all looking stale. */
+            __atomic_fetch_add(&buffer->head, buffer->mask + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
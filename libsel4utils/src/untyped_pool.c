@@ -0,0 +1,293 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdlib.h>
+#include <sel4utils/untyped_pool.h>
+#include <vka/capops.h>
+#include <vka/object.h>
+#include <utils/util.h>
+
+/* An untyped taken from the delegate. Cookies of the objects in it are base plus the
+ * offset of the object in the untyped */
+typedef struct pool_untyped {
+    vka_object_t untyped;
+    seL4_Word base;
+    /* where the next object goes, as the kernel's free index */
+    size_t offset;
+    /* objects allocated and not yet freed */
+    size_t live;
+    struct pool_untyped *next;
+} pool_untyped_t;
+
+/* An allocation passed to the delegate by alloc_at */
+typedef struct pool_delegated {
+    seL4_Word cookie;
+    struct pool_delegated *next;
+} pool_delegated_t;
+
+typedef struct {
+    vka_t *delegate;
+    size_t size_bits;
+    pool_untyped_t *untypeds;
+    pool_delegated_t *delegated;
+    /* base of the next untyped taken, cookies are never 0 */
+    seL4_Word next_base;
+    /* every object has been deleted, frees only return cslots */
+    bool revoked;
+} pool_data_t;
+
+static int delegate_cspace_alloc(void *data, seL4_CPtr *res)
+{
+    pool_data_t *pdata = data;
+    return vka_cspace_alloc(pdata->delegate, res);
+}
+
+static void delegate_cspace_make_path(void *data, seL4_CPtr slot, cspacepath_t *res)
+{
+    pool_data_t *pdata = data;
+    vka_cspace_make_path(pdata->delegate, slot, res);
+}
+
+static void delegate_cspace_free(void *data, seL4_CPtr slot)
+{
+    pool_data_t *pdata = data;
+    vka_cspace_free(pdata->delegate, slot);
+}
+
+static pool_untyped_t *find_untyped(pool_data_t *pdata, seL4_Word cookie)
+{
+    for (pool_untyped_t *ut = pdata->untypeds; ut != NULL; ut = ut->next) {
+        if (cookie >= ut->base && cookie - ut->base < BIT(ut->untyped.size_bits)) {
+            return ut;
+        }
+    }
+    return NULL;
+}
+
+static pool_untyped_t *new_untyped(pool_data_t *pdata, size_t size_bits)
+{
+    pool_untyped_t *ut = calloc(1, sizeof(*ut));
+    if (ut == NULL) {
+        return NULL;
+    }
+    if (vka_alloc_untyped(pdata->delegate, size_bits, &ut->untyped) != 0) {
+        ZF_LOGW("Failed to take an untyped of size bits %zu for the pool", size_bits);
+        free(ut);
+        return NULL;
+    }
+    ut->base = pdata->next_base;
+    pdata->next_base += BIT(size_bits);
+    ut->next = pdata->untypeds;
+    pdata->untypeds = ut;
+    return ut;
+}
+
+static int pool_utspace_alloc(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                              seL4_Word *res)
+{
+    pool_data_t *pdata = data;
+
+    if (pdata->revoked) {
+        ZF_LOGE("Cannot allocate from a revoked pool");
+        return -1;
+    }
+
+    size_t object_bits = vka_get_object_size(type, size_bits);
+    if (object_bits == 0 || object_bits >= seL4_WordBits) {
+        ZF_LOGE("Object of type %lu has no known size", (long) type);
+        return -1;
+    }
+
+    /* first fit, a pool only has a few untypeds */
+    pool_untyped_t *ut;
+    size_t offset = 0;
+    for (ut = pdata->untypeds; ut != NULL; ut = ut->next) {
+        offset = ROUND_UP(ut->offset, BIT(object_bits));
+        if (object_bits <= ut->untyped.size_bits && offset + BIT(object_bits) <= BIT(ut->untyped.size_bits)) {
+            break;
+        }
+    }
+    if (ut == NULL) {
+        ut = new_untyped(pdata, MAX(pdata->size_bits, object_bits));
+        if (ut == NULL) {
+            return -1;
+        }
+        offset = 0;
+    }
+
+    seL4_Error error = seL4_Untyped_Retype(ut->untyped.cptr, type, size_bits, dest->root, dest->dest,
+                                           dest->destDepth, dest->offset, 1);
+    if (error != seL4_NoError) {
+        ZF_LOGE("Failed to retype object of type %lu from the pool", (long) type);
+        return -1;
+    }
+    ut->offset = offset + BIT(object_bits);
+    ut->live++;
+    *res = ut->base + offset;
+    return 0;
+}
+
+static int pool_utspace_alloc_maybe_device(void *data, const cspacepath_t *dest, seL4_Word type,
+                                           seL4_Word size_bits, bool can_use_dev, seL4_Word *res)
+{
+    return pool_utspace_alloc(data, dest, type, size_bits, res);
+}
+
+static int delegate_utspace_alloc_at(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                     uintptr_t paddr, seL4_Word *res)
+{
+    pool_data_t *pdata = data;
+    pool_delegated_t *delegated = malloc(sizeof(*delegated));
+    if (delegated == NULL) {
+        return -1;
+    }
+    int error = vka_utspace_alloc_at(pdata->delegate, dest, type, size_bits, paddr, res);
+    if (error) {
+        free(delegated);
+        return error;
+    }
+    delegated->cookie = *res;
+    delegated->next = pdata->delegated;
+    pdata->delegated = delegated;
+    return 0;
+}
+
+/* Remove a cookie from the list of delegated allocations, returns false if it is not in it */
+static bool remove_delegated(pool_data_t *pdata, seL4_Word cookie)
+{
+    for (pool_delegated_t **prev = &pdata->delegated; *prev != NULL; prev = &(*prev)->next) {
+        if ((*prev)->cookie == cookie) {
+            pool_delegated_t *delegated = *prev;
+            *prev = delegated->next;
+            free(delegated);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pool_utspace_free(void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target)
+{
+    pool_data_t *pdata = data;
+
+    if (remove_delegated(pdata, target)) {
+        vka_utspace_free(pdata->delegate, type, size_bits, target);
+        return;
+    }
+    if (pdata->revoked) {
+        return;
+    }
+
+    pool_untyped_t *ut = find_untyped(pdata, target);
+    if (ut == NULL) {
+        ZF_LOGE("Freeing an object that is not from the pool");
+        return;
+    }
+    assert(ut->live > 0);
+    ut->live--;
+    if (ut->live == 0) {
+        /* Nothing is left in the untyped once any copies of what was in it are gone, then
+         * the kernel starts again from the beginning. */
+        cspacepath_t path;
+        vka_cspace_make_path(pdata->delegate, ut->untyped.cptr, &path);
+        if (vka_cnode_revoke(&path) == seL4_NoError) {
+            ut->offset = 0;
+        }
+    }
+}
+
+static uintptr_t pool_utspace_paddr(void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits)
+{
+    pool_data_t *pdata = data;
+    pool_untyped_t *ut = find_untyped(pdata, target);
+    if (ut == NULL) {
+        return vka_utspace_paddr(pdata->delegate, target, type, size_bits);
+    }
+    uintptr_t paddr = vka_utspace_paddr(pdata->delegate, ut->untyped.ut, seL4_UntypedObject, ut->untyped.size_bits);
+    if (paddr == VKA_NO_PADDR) {
+        return VKA_NO_PADDR;
+    }
+    return paddr + (target - ut->base);
+}
+
+int sel4utils_untyped_pool_init(vka_t *pool_vka, vka_t *delegate, size_t size_bits)
+{
+    if (size_bits < seL4_MinUntypedBits || size_bits > seL4_MaxUntypedBits) {
+        ZF_LOGE("Invalid pool untyped size bits %zu", size_bits);
+        return -1;
+    }
+
+    pool_data_t *data = calloc(1, sizeof(pool_data_t));
+    if (data == NULL) {
+        return -1;
+    }
+    data->delegate = delegate;
+    data->size_bits = size_bits;
+    data->next_base = BIT(seL4_MinUntypedBits);
+
+    *pool_vka = (vka_t) {
+        .data = data,
+        .cspace_alloc = delegate_cspace_alloc,
+        .cspace_make_path = delegate_cspace_make_path,
+        .cspace_free = delegate_cspace_free,
+        .utspace_alloc = pool_utspace_alloc,
+        .utspace_alloc_maybe_device = pool_utspace_alloc_maybe_device,
+        .utspace_alloc_at = delegate_utspace_alloc_at,
+        .utspace_free = pool_utspace_free,
+        .utspace_paddr = pool_utspace_paddr,
+    };
+
+    /* take the first untyped now, most users of a pool allocate from it straight away */
+    if (new_untyped(data, size_bits) == NULL) {
+        free(data);
+        pool_vka->data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void sel4utils_untyped_pool_revoke(vka_t *pool_vka)
+{
+    pool_data_t *pdata = pool_vka->data;
+    if (pdata->revoked) {
+        return;
+    }
+    for (pool_untyped_t *ut = pdata->untypeds; ut != NULL; ut = ut->next) {
+        cspacepath_t path;
+        vka_cspace_make_path(pdata->delegate, ut->untyped.cptr, &path);
+        if (vka_cnode_revoke(&path) != seL4_NoError) {
+            ZF_LOGE("Failed to revoke pool untyped");
+        }
+        ut->offset = 0;
+        ut->live = 0;
+    }
+    pdata->revoked = true;
+}
+
+void sel4utils_untyped_pool_destroy(vka_t *pool_vka)
+{
+    pool_data_t *pdata = pool_vka->data;
+    if (pdata == NULL) {
+        return;
+    }
+    sel4utils_untyped_pool_revoke(pool_vka);
+    while (pdata->untypeds != NULL) {
+        pool_untyped_t *ut = pdata->untypeds;
+        pdata->untypeds = ut->next;
+        vka_free_object(pdata->delegate, &ut->untyped);
+        free(ut);
+    }
+    if (pdata->delegated != NULL) {
+        ZF_LOGW("Destroying a pool with objects from alloc_at still allocated");
+    }
+    while (pdata->delegated != NULL) {
+        pool_delegated_t *delegated = pdata->delegated;
+        pdata->delegated = delegated->next;
+        free(delegated);
+    }
+    free(pdata);
+    pool_vka->data = NULL;
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sel4utils/utilisation.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <utils/util.h>
+
+#ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
+#include <sel4/benchmark_utilisation_types.h>
+
+/* The kernel writes the counts as 64 bit values from the start of the IPC buffer */
+static inline uint64_t *utilisation_buffer(void)
+{
+    return (uint64_t *) &seL4_GetIPCBuffer()->msg[0];
+}
+#endif
+
+int sel4utils_utilisation_init(sel4utils_utilisation_t *utilisation, sel4utils_utilisation_thread_t *threads,
+                               size_t num_threads, uint64_t *core_idle, size_t num_cores)
+{
+#ifndef CONFIG_BENCHMARK_TRACK_UTILISATION
+    ZF_LOGE("Utilisation needs a kernel with CONFIG_BENCHMARK_TRACK_UTILISATION");
+    return -1;
+#else
+    if (utilisation == NULL || (threads == NULL && num_threads != 0) || (core_idle == NULL && num_cores != 0)) {
+        ZF_LOGE("Invalid arguments to sel4utils_utilisation_init");
+        return -1;
+    }
+    for (size_t i = 0; i < num_threads; i++) {
+        if (threads[i].core >= num_cores) {
+            ZF_LOGE("Thread %zu is on core %"PRIuPTR" of %zu", i, (uintptr_t) threads[i].core, num_cores);
+            return -1;
+        }
+    }
+
+    *utilisation = (sel4utils_utilisation_t) {
+        .threads = threads,
+        .num_threads = num_threads,
+        .core_idle = core_idle,
+        .num_cores = num_cores,
+    };
+    for (size_t i = 0; i < num_cores; i++) {
+        core_idle[i] = SEL4UTILS_UTILISATION_NO_IDLE;
+    }
+    return 0;
+#endif
+}
+
+void sel4utils_utilisation_start(sel4utils_utilisation_t *utilisation)
+{
+#ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
+    seL4_BenchmarkResetLog();
+    for (size_t i = 0; i < utilisation->num_threads; i++) {
+        seL4_BenchmarkResetThreadUtilisation(utilisation->threads[i].tcb);
+    }
+#endif
+}
+
+void sel4utils_utilisation_sample(sel4utils_utilisation_t *utilisation)
+{
+#ifdef CONFIG_BENCHMARK_TRACK_UTILISATION
+    uint64_t *buffer = utilisation_buffer();
+
+    seL4_BenchmarkFinalizeLog();
+    for (size_t i = 0; i < utilisation->num_cores; i++) {
+        utilisation->core_idle[i] = SEL4UTILS_UTILISATION_NO_IDLE;
+    }
+    utilisation->window_cycles = 0;
+    for (size_t i = 0; i < utilisation->num_threads; i++) {
+        sel4utils_utilisation_thread_t *thread = &utilisation->threads[i];
+        seL4_BenchmarkGetThreadUtilisation(thread->tcb);
+        thread->cycles = buffer[BENCHMARK_TCB_UTILISATION];
+        utilisation->core_idle[thread->core] = buffer[BENCHMARK_IDLE_TCBCPU_UTILISATION];
+        utilisation->window_cycles = buffer[BENCHMARK_TOTAL_UTILISATION];
+    }
+    utilisation->windows++;
+    sel4utils_utilisation_start(utilisation);
+#endif
+}
+
+static void utilisation_timeout(void *data)
+{
+    sel4utils_utilisation_t *utilisation = data;
+
+    sel4utils_utilisation_sample(utilisation);
+    if (utilisation->report_fn != NULL) {
+        utilisation->report_fn(utilisation->report_data, utilisation);
+    }
+}
+
+int sel4utils_utilisation_start_periodic(sel4utils_utilisation_t *utilisation, sel4utils_time_server_t *server,
+                                         uint64_t period_ns, sel4utils_utilisation_report_fn report_fn,
+                                         void *report_data)
+{
+    if (server == NULL || period_ns == 0) {
+        ZF_LOGE("Periodic utilisation needs a time server and a period");
+        return -1;
+    }
+    sel4utils_utilisation_stop_periodic(utilisation);
+    utilisation->report_fn = report_fn;
+    utilisation->report_data = report_data;
+    sel4utils_utilisation_start(utilisation);
+    int error = sel4utils_timeout_set(server, &utilisation->timeout, period_ns, TIMEOUT_PERIODIC,
+                                      utilisation_timeout, utilisation);
+    if (error) {
+        ZF_LOGE("Failed to set utilisation timeout");
+        return error;
+    }
+    utilisation->server = server;
+    return 0;
+}
+
+void sel4utils_utilisation_stop_periodic(sel4utils_utilisation_t *utilisation)
+{
+    if (utilisation->server != NULL) {
+        sel4utils_timeout_cancel(utilisation->server, &utilisation->timeout);
+        utilisation->server = NULL;
+    }
+}
+
+void sel4utils_utilisation_dump(sel4utils_utilisation_t *utilisation)
+{
+    printf("utilisation window %zu: %"PRIu64" cycles\n", utilisation->windows, utilisation->window_cycles);
+    for (size_t i = 0; i < utilisation->num_threads; i++) {
+        sel4utils_utilisation_thread_t *thread = &utilisation->threads[i];
+        printf("thread %"PRIuPTR" core %"PRIuPTR" %"PRIu64" cycles %u%%\n", (uintptr_t) thread->id,
+               (uintptr_t) thread->core, thread->cycles, sel4utils_utilisation_percent(utilisation, thread->cycles));
+    }
+    for (size_t i = 0; i < utilisation->num_cores; i++) {
+        uint64_t idle = utilisation->core_idle[i];
+        if (idle == SEL4UTILS_UTILISATION_NO_IDLE) {
+            continue;
+        }
+        unsigned int idle_percent = MIN(sel4utils_utilisation_percent(utilisation, idle), 100u);
+        printf("core %zu busy %u%% idle %u%%\n", i, 100 - idle_percent, idle_percent);
+    }
+}
@@ -13,6 +13,7 @@
 #include <vka/capops.h>
 #include <sel4utils/vspace.h>
 #include <sel4utils/vspace_internal.h>
+#include <sel4utils/page_copy.h>
 
 /* For the initial vspace, we must always guarantee we have virtual memory available
  * for each bottom level page table. Future vspaces can then use the initial vspace
@@ -39,8 +40,16 @@ static int common_init(vspace_t *vspace, vka_t *vka, seL4_CPtr vspace_root,
     sel4utils_alloc_data_t *data = get_alloc_data(vspace);
     data->vka = vka;
     data->last_allocated = 0x10000000;
-    data->reservation_head = NULL;
+    data->reservation_root = NULL;
+    memset(data->reservation_mru, 0, sizeof(data->reservation_mru));
     data->is_empty = false;
+    data->free_ranges = NULL;
+    data->free_range_nodes = NULL;
+    data->free_range_spare = 0;
+    data->free_range_pages = NULL;
+    data->free_ranges_state = SEL4UTILS_FREE_RANGES_UNBUILT;
+    data->compact_level_pages = NULL;
+    data->compact_level_free = NULL;
 
     data->vspace_root = vspace_root;
     vspace->allocated_object = allocated_object_fn;
@@ -116,7 +125,7 @@ static void *alloc_and_map(vspace_t *vspace, size_t size)
             }
 
             /* Zero the memory */
-            memset(vaddr, 0, PAGE_SIZE_4K);
+            sel4utils_zero_pages(vaddr, PAGE_SIZE_4K);
 
             for (int i = 0; i < num; i++) {
                 vspace_maybe_call_allocated_object(vspace, objects[i]);
@@ -136,13 +145,13 @@ static int reserve_range_bottom(vspace_t *vspace, vspace_bottom_level_t *level,
 {
     while (start < end) {
         int index = INDEX_FOR_LEVEL(start, 0);
-        uintptr_t cap = level->cap[index];
+        uintptr_t cap = VSPACE_BOTTOM_CAP(level, index);
         switch (cap) {
         case RESERVED:
             /* nothing to be done */
             break;
         case EMPTY:
-            level->cap[index] = RESERVED;
+            VSPACE_BOTTOM_CAP(level, index) = RESERVED;
             break;
         default:
             ZF_LOGE("Cannot reserve allocated region");
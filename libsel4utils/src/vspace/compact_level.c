@@ -0,0 +1,165 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Compact bottom levels.
+ *
+ * Most bottom levels in a small process only ever have a handful of entries that are not
+ * EMPTY (or RESERVED), yet a full vspace_bottom_level_t is two pages on 64-bit. New bottom
+ * levels therefore start out as a vspace_compact_level_t, several of which are carved out
+ * of each page obtained with create_level, and are only promoted to a full level once they
+ * run out of room. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <string.h>
+
+#include <sel4utils/vspace.h>
+#include <sel4utils/vspace_internal.h>
+
+#include <utils/util.h>
+
+vspace_compact_level_t *compact_level_alloc(vspace_t *vspace)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    if (data->compact_level_free == NULL) {
+        void *page = create_level(vspace, PAGE_SIZE_4K);
+        if (page == NULL) {
+            return NULL;
+        }
+        /* first word of each page links the pages together so tear down can find them */
+        *(void **)page = data->compact_level_pages;
+        data->compact_level_pages = page;
+        vspace_compact_level_t *levels = (vspace_compact_level_t *)((void **)page + 1);
+        size_t num = ((uintptr_t)page + PAGE_SIZE_4K - (uintptr_t)levels) / sizeof(vspace_compact_level_t);
+        for (size_t i = 0; i < num; i++) {
+            compact_level_free(vspace, &levels[i]);
+        }
+    }
+    vspace_compact_level_t *level = data->compact_level_free;
+    data->compact_level_free = (vspace_compact_level_t *)level->init;
+    return level;
+}
+
+void compact_level_free(vspace_t *vspace, vspace_compact_level_t *level)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    level->init = (uintptr_t)data->compact_level_free;
+    data->compact_level_free = level;
+}
+
+void compact_level_destroy(vspace_t *vspace)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    while (data->compact_level_pages != NULL) {
+        void *page = data->compact_level_pages;
+        data->compact_level_pages = *(void **)page;
+        vspace_unmap_pages(data->bootstrap, page, 1, PAGE_BITS_4K, VSPACE_FREE);
+    }
+    data->compact_level_free = NULL;
+}
+
+static int promote(vspace_t *vspace, uintptr_t *table)
+{
+    vspace_compact_level_t *compact = to_compact_level(*table);
+    vspace_bottom_level_t *level = create_level(vspace, sizeof(vspace_bottom_level_t));
+    if (level == NULL) {
+        ZF_LOGE("Failed to allocate book keeping to promote compact level");
+        return -1;
+    }
+    for (int i = 0; i < VSPACE_LEVEL_SIZE; i++) {
+        VSPACE_BOTTOM_CAP(level, i) = compact->init;
+        VSPACE_BOTTOM_COOKIE(level, i) = 0;
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+        VSPACE_BOTTOM_PADDR(level, i) = 0;
+#endif
+    }
+    for (int i = 0; i < compact->num; i++) {
+        VSPACE_BOTTOM_CAP(level, compact->index[i]) = compact->cap[i];
+        VSPACE_BOTTOM_COOKIE(level, compact->index[i]) = compact->cookie[i];
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+        VSPACE_BOTTOM_PADDR(level, compact->index[i]) = compact->paddr[i];
+#endif
+    }
+    *table = (uintptr_t)level;
+    compact_level_free(vspace, compact);
+    return 0;
+}
+
+/* Set an entry in the bottom level pointed to by *table, which may be replaced by
+ * a full level if it is compact and has no room left. Any cached paddr for the entry
+ * is forgotten */
+int bottom_level_set(vspace_t *vspace, uintptr_t *table, int index, uintptr_t cap, uintptr_t cookie)
+{
+    if (is_compact_level(*table)) {
+        vspace_compact_level_t *level = to_compact_level(*table);
+        int pos = compact_level_find(level, index);
+        if (pos >= 0) {
+            if (cap == level->init && cookie == 0) {
+                /* back to the default, drop the entry */
+                level->num--;
+                memmove(&level->index[pos], &level->index[pos + 1], (level->num - pos) * sizeof(level->index[0]));
+                memmove(&level->cap[pos], &level->cap[pos + 1], (level->num - pos) * sizeof(level->cap[0]));
+                memmove(&level->cookie[pos], &level->cookie[pos + 1], (level->num - pos) * sizeof(level->cookie[0]));
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+                memmove(&level->paddr[pos], &level->paddr[pos + 1], (level->num - pos) * sizeof(level->paddr[0]));
+#endif
+            } else {
+                level->cap[pos] = cap;
+                level->cookie[pos] = cookie;
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+                level->paddr[pos] = 0;
+#endif
+            }
+            return 0;
+        }
+        if (cap == level->init && cookie == 0) {
+            return 0;
+        }
+        if (level->num < VSPACE_COMPACT_LEVEL_SIZE) {
+            pos = -(pos + 1);
+            memmove(&level->index[pos + 1], &level->index[pos], (level->num - pos) * sizeof(level->index[0]));
+            memmove(&level->cap[pos + 1], &level->cap[pos], (level->num - pos) * sizeof(level->cap[0]));
+            memmove(&level->cookie[pos + 1], &level->cookie[pos], (level->num - pos) * sizeof(level->cookie[0]));
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+            memmove(&level->paddr[pos + 1], &level->paddr[pos], (level->num - pos) * sizeof(level->paddr[0]));
+            level->paddr[pos] = 0;
+#endif
+            level->index[pos] = index;
+            level->cap[pos] = cap;
+            level->cookie[pos] = cookie;
+            level->num++;
+            return 0;
+        }
+        if (promote(vspace, table)) {
+            return -1;
+        }
+    }
+    vspace_bottom_level_t *level = (vspace_bottom_level_t *)*table;
+    VSPACE_BOTTOM_CAP(level, index) = cap;
+    VSPACE_BOTTOM_COOKIE(level, index) = cookie;
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+    VSPACE_BOTTOM_PADDR(level, index) = 0;
+#endif
+    return 0;
+}
+
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+/* Record the paddr of the frame mapped at an entry. Entries that hold their level's
+ * default value have nowhere to put it and are left alone */
+void bottom_level_set_paddr(uintptr_t table, int index, uintptr_t paddr)
+{
+    if (is_compact_level(table)) {
+        vspace_compact_level_t *level = to_compact_level(table);
+        int pos = compact_level_find(level, index);
+        if (pos >= 0) {
+            level->paddr[pos] = paddr;
+        }
+        return;
+    }
+    VSPACE_BOTTOM_PADDR((vspace_bottom_level_t *)table, index) = paddr;
+}
+#endif /* CONFIG_SEL4UTILS_PADDR_CACHE */
@@ -0,0 +1,391 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Index of the free (neither reserved nor mapped) parts of a vspace.
+ *
+ * Free ranges are kept as disjoint, maximal intervals in a treap ordered by start
+ * address. Every node also records the size of the largest interval in its subtree,
+ * which lets find_range skip any subtree that cannot possibly hold a request instead
+ * of probing the book keeping tables one page at a time.
+ *
+ * The page tables in sel4utils_alloc_data_t remain the authoritative record. The index
+ * is built from them the first time it is needed and is then kept up to date by the
+ * reserve/update/clear entry wrappers in vspace_internal.h. Nodes are carved out of
+ * pages obtained with create_level, so maintaining the index never calls malloc. Should
+ * we ever fail to get a node the index is discarded and find_range goes back to probing
+ * the tables directly. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <sel4utils/vspace.h>
+#include <sel4utils/vspace_internal.h>
+
+#include <utils/util.h>
+
+/* Every index update consumes at most this many fresh nodes */
+#define FREE_RANGE_NODES_PER_UPDATE 2
+
+typedef struct sel4utils_free_range node_t;
+
+static inline uintptr_t node_size(node_t *n)
+{
+    return n->end - n->start;
+}
+
+static inline uintptr_t subtree_largest(node_t *n)
+{
+    return n ? n->largest : 0;
+}
+
+static void pull(node_t *n)
+{
+    n->largest = MAX(node_size(n), MAX(subtree_largest(n->left), subtree_largest(n->right)));
+}
+
+/* split t into nodes starting below key (l) and at or above key (r) */
+static void split(node_t *t, uintptr_t key, node_t **l, node_t **r)
+{
+    if (t == NULL) {
+        *l = NULL;
+        *r = NULL;
+    } else if (t->start < key) {
+        split(t->right, key, &t->right, r);
+        pull(t);
+        *l = t;
+    } else {
+        split(t->left, key, l, &t->left);
+        pull(t);
+        *r = t;
+    }
+}
+
+/* every node in l must start before every node in r */
+static node_t *merge(node_t *l, node_t *r)
+{
+    if (l == NULL) {
+        return r;
+    }
+    if (r == NULL) {
+        return l;
+    }
+    if (l->priority > r->priority) {
+        l->right = merge(l->right, r);
+        pull(l);
+        return l;
+    }
+    r->left = merge(l, r->left);
+    pull(r);
+    return r;
+}
+
+static node_t *pop_first(node_t **t)
+{
+    node_t *n = *t;
+    if (n == NULL) {
+        return NULL;
+    }
+    if (n->left == NULL) {
+        *t = n->right;
+        n->right = NULL;
+        pull(n);
+        return n;
+    }
+    node_t *first = pop_first(&n->left);
+    pull(n);
+    return first;
+}
+
+static node_t *pop_last(node_t **t)
+{
+    node_t *n = *t;
+    if (n == NULL) {
+        return NULL;
+    }
+    if (n->right == NULL) {
+        *t = n->left;
+        n->left = NULL;
+        pull(n);
+        return n;
+    }
+    node_t *last = pop_last(&n->right);
+    pull(n);
+    return last;
+}
+
+static void put_node(sel4utils_alloc_data_t *data, node_t *n)
+{
+    n->right = data->free_range_nodes;
+    data->free_range_nodes = n;
+    data->free_range_spare++;
+}
+
+static node_t *get_node(sel4utils_alloc_data_t *data, uintptr_t start, uintptr_t end)
+{
+    node_t *n = data->free_range_nodes;
+    assert(n != NULL);
+    data->free_range_nodes = n->right;
+    data->free_range_spare--;
+    n->start = start;
+    n->end = end;
+    n->left = NULL;
+    n->right = NULL;
+    pull(n);
+    return n;
+}
+
+/* return every node of t to the spare list, reporting the highest end we saw */
+static void release_tree(sel4utils_alloc_data_t *data, node_t *t, uintptr_t *max_end)
+{
+    while (t != NULL) {
+        release_tree(data, t->left, max_end);
+        node_t *right = t->right;
+        *max_end = MAX(*max_end, t->end);
+        put_node(data, t);
+        t = right;
+    }
+}
+
+static void disable(sel4utils_alloc_data_t *data)
+{
+    uintptr_t ignored = 0;
+    release_tree(data, data->free_ranges, &ignored);
+    data->free_ranges = NULL;
+    data->free_ranges_state = SEL4UTILS_FREE_RANGES_DISABLED;
+}
+
+static int ensure_spare(vspace_t *vspace, sel4utils_alloc_data_t *data)
+{
+    if (data->free_range_spare >= FREE_RANGE_NODES_PER_UPDATE) {
+        return 0;
+    }
+    void *page = create_level(vspace, PAGE_SIZE_4K);
+    if (page == NULL) {
+        ZF_LOGW("Failed to allocate free range book keeping, falling back to probing");
+        disable(data);
+        return -1;
+    }
+    /* first word of each page links the pages together so tear down can find them */
+    *(void **)page = data->free_range_pages;
+    data->free_range_pages = page;
+    node_t *nodes = (node_t *)((void **)page + 1);
+    size_t num = ((uintptr_t)page + PAGE_SIZE_4K - (uintptr_t)nodes) / sizeof(node_t);
+    for (size_t i = 0; i < num; i++) {
+        /* treap priorities only need to be well mixed, hashing the node address does that */
+        nodes[i].priority = (uint32_t)((uintptr_t)&nodes[i] / sizeof(node_t)) * 2654435761u;
+        put_node(data, &nodes[i]);
+    }
+    return 0;
+}
+
+static void remove_range(sel4utils_alloc_data_t *data, uintptr_t start, uintptr_t end)
+{
+    node_t *l, *m, *r;
+    split(data->free_ranges, start, &l, &r);
+    split(r, end, &m, &r);
+    uintptr_t tail = end;
+    /* the last range starting before us may run into, or over, the removed region */
+    node_t *last = pop_last(&l);
+    if (last != NULL) {
+        if (last->end > start) {
+            tail = MAX(tail, last->end);
+            last->end = start;
+            pull(last);
+        }
+        l = merge(l, last);
+    }
+    release_tree(data, m, &tail);
+    if (tail > end) {
+        r = merge(get_node(data, end, tail), r);
+    }
+    data->free_ranges = merge(l, r);
+}
+
+static void insert_range(sel4utils_alloc_data_t *data, uintptr_t start, uintptr_t end)
+{
+    node_t *l, *r;
+    remove_range(data, start, end);
+    split(data->free_ranges, start, &l, &r);
+    node_t *last = pop_last(&l);
+    node_t *first = pop_first(&r);
+    /* coalesce with our neighbours so ranges stay maximal */
+    if (last != NULL && last->end == start) {
+        start = last->start;
+        put_node(data, last);
+    } else if (last != NULL) {
+        l = merge(l, last);
+    }
+    if (first != NULL && first->start == end) {
+        end = first->end;
+        put_node(data, first);
+    } else if (first != NULL) {
+        r = merge(first, r);
+    }
+    data->free_ranges = merge(merge(l, get_node(data, start, end)), r);
+}
+
+void free_range_mark_used(vspace_t *vspace, uintptr_t start, uintptr_t end)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    if (data->free_ranges_state != SEL4UTILS_FREE_RANGES_VALID || start >= end) {
+        return;
+    }
+    if (ensure_spare(vspace, data) != 0) {
+        return;
+    }
+    remove_range(data, start, end);
+}
+
+void free_range_mark_free(vspace_t *vspace, uintptr_t start, uintptr_t end)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    if (data->free_ranges_state != SEL4UTILS_FREE_RANGES_VALID || start >= end) {
+        return;
+    }
+    end = MIN(end, (uintptr_t)KERNEL_RESERVED_START);
+    if (start >= end || ensure_spare(vspace, data) != 0) {
+        return;
+    }
+    insert_range(data, start, end);
+}
+
+/* Appends [*run, end) to the index, the index must not contain anything after *run */
+static int close_run(vspace_t *vspace, sel4utils_alloc_data_t *data, uintptr_t *run, uintptr_t end)
+{
+    if (*run == RESERVED) {
+        return 0;
+    }
+    if (ensure_spare(vspace, data) != 0) {
+        return -1;
+    }
+    data->free_ranges = merge(data->free_ranges, get_node(data, *run, end));
+    *run = RESERVED;
+    return 0;
+}
+
+/* entry is the contents of a slot at level_num covering [base, base + BYTES_FOR_LEVEL(level_num)) */
+static int build_entry(vspace_t *vspace, sel4utils_alloc_data_t *data, uintptr_t entry, int level_num,
+                       uintptr_t base, uintptr_t *run)
+{
+    if (entry == EMPTY) {
+        if (*run == RESERVED) {
+            *run = base;
+        }
+        return 0;
+    }
+    if (entry == RESERVED || level_num == 0) {
+        return close_run(vspace, data, run, base);
+    }
+    for (int i = 0; i < VSPACE_LEVEL_SIZE; i++) {
+        uintptr_t child_base = base + i * BYTES_FOR_LEVEL(level_num - 1);
+        uintptr_t child = level_num == 1 ? bottom_level_get_cap(entry, i) :
+                          ((vspace_mid_level_t *)entry)->table[i];
+        if (child_base >= KERNEL_RESERVED_START) {
+            break;
+        }
+        int error = build_entry(vspace, data, child, level_num - 1, child_base, run);
+        if (error) {
+            return error;
+        }
+    }
+    return 0;
+}
+
+static int build(vspace_t *vspace, sel4utils_alloc_data_t *data)
+{
+    uintptr_t run = RESERVED;
+    data->free_ranges_state = SEL4UTILS_FREE_RANGES_VALID;
+    int error = build_entry(vspace, data, (uintptr_t)data->top_level, VSPACE_NUM_LEVELS, 0, &run);
+    if (!error) {
+        error = close_run(vspace, data, &run, KERNEL_RESERVED_START);
+    }
+    if (error) {
+        disable(data);
+    }
+    return error;
+}
+
+/* lowest addressed fit, starting at or after from */
+static node_t *find_fit(node_t *n, uintptr_t from, uintptr_t size, uintptr_t align, uintptr_t *result)
+{
+    while (n != NULL && n->largest >= size) {
+        /* everything to our left ends before we start, so only look there if we end after from */
+        if (n->end > from) {
+            node_t *found = find_fit(n->left, from, size, align, result);
+            if (found) {
+                return found;
+            }
+            uintptr_t candidate = ALIGN_UP(MAX(n->start, from), align);
+            if (candidate >= n->start && candidate < n->end && n->end - candidate >= size) {
+                *result = candidate;
+                return n;
+            }
+        }
+        n = n->right;
+    }
+    return NULL;
+}
+
+int free_range_find(vspace_t *vspace, uintptr_t from, size_t size, size_t align_bits, uintptr_t *result)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    if (data->free_ranges_state == SEL4UTILS_FREE_RANGES_UNBUILT) {
+        build(vspace, data);
+    }
+    if (data->free_ranges_state != SEL4UTILS_FREE_RANGES_VALID) {
+        return -1;
+    }
+    uintptr_t candidate;
+    while (find_fit(data->free_ranges, from, size, SIZE_BITS_TO_BYTES(align_bits), &candidate)) {
+        /* The tables are authoritative, double check the index agrees with them */
+        if (is_available_range(data->top_level, candidate, candidate + size)) {
+            *result = candidate;
+            return 0;
+        }
+        ZF_LOGW("Free range index out of sync at %p, repairing", (void *)candidate);
+        free_range_mark_used(vspace, candidate, candidate + size);
+        if (data->free_ranges_state != SEL4UTILS_FREE_RANGES_VALID) {
+            return -1;
+        }
+    }
+    /* the index is complete, if it has nothing there is nothing */
+    *result = 0;
+    return 0;
+}
+
+void free_range_destroy(vspace_t *vspace)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    while (data->free_range_pages != NULL) {
+        void *page = data->free_range_pages;
+        data->free_range_pages = *(void **)page;
+        vspace_unmap_pages(data->bootstrap, page, 1, PAGE_BITS_4K, VSPACE_FREE);
+    }
+    data->free_ranges = NULL;
+    data->free_range_nodes = NULL;
+    data->free_range_spare = 0;
+    data->free_ranges_state = SEL4UTILS_FREE_RANGES_DISABLED;
+}
+
+static size_t count_nodes(node_t *t)
+{
+    return t ? 1 + count_nodes(t->left) + count_nodes(t->right) : 0;
+}
+
+void free_range_stats(vspace_t *vspace, size_t *count, uintptr_t *largest)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    if (data->free_ranges_state != SEL4UTILS_FREE_RANGES_VALID) {
+        *count = 0;
+        *largest = 0;
+        return;
+    }
+    *count = count_nodes(data->free_ranges);
+    *largest = subtree_largest(data->free_ranges);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/* Resource accounting for sel4utils vspaces: how much address space is reserved and
+ * mapped, and how much memory the book keeping behind it takes up. */
+
+#include <autoconf.h>
+#include <sel4utils/gen_config.h>
+
+#include <string.h>
+
+#include <sel4utils/vspace.h>
+#include <sel4utils/vspace_internal.h>
+
+#include <utils/util.h>
+
+static void reservation_stats(sel4utils_res_t *res, sel4utils_vspace_stats_t *stats)
+{
+    /* the tree is a treap, so its depth is logarithmic in the number of reservations */
+    while (res != NULL) {
+        stats->reservations++;
+        stats->reserved_bytes += res->end - res->start;
+        if (res->malloced) {
+            stats->bookkeeping_bytes += sizeof(sel4utils_res_t);
+        }
+        reservation_stats(res->left, stats);
+        res = res->right;
+    }
+}
+
+static bool is_mapped(uintptr_t cap)
+{
+    return cap != EMPTY && cap != RESERVED;
+}
+
+static void level_stats(uintptr_t table, int level_num, sel4utils_vspace_stats_t *stats)
+{
+    if (level_num == 0) {
+        if (is_compact_level(table)) {
+            vspace_compact_level_t *level = to_compact_level(table);
+            stats->compact_levels++;
+            for (int i = 0; i < level->num; i++) {
+                stats->mapped_bytes += is_mapped(level->cap[i]) ? PAGE_SIZE_4K : 0;
+            }
+        } else {
+            vspace_bottom_level_t *level = (vspace_bottom_level_t *)table;
+            stats->bottom_levels++;
+            stats->bookkeeping_bytes += sizeof(vspace_bottom_level_t);
+            for (int i = 0; i < VSPACE_LEVEL_SIZE; i++) {
+                stats->mapped_bytes += is_mapped(VSPACE_BOTTOM_CAP(level, i)) ? PAGE_SIZE_4K : 0;
+            }
+        }
+        return;
+    }
+    vspace_mid_level_t *level = (vspace_mid_level_t *)table;
+    stats->mid_levels++;
+    stats->bookkeeping_bytes += sizeof(vspace_mid_level_t);
+    for (int i = 0; i < VSPACE_LEVEL_SIZE; i++) {
+        if (level->table[i] != EMPTY && level->table[i] != RESERVED) {
+            level_stats(level->table[i], level_num - 1, stats);
+        }
+    }
+}
+
+/* pages of book keeping linked through their first word */
+static size_t count_pages(void *page)
+{
+    size_t count = 0;
+    for (; page != NULL; page = *(void **)page) {
+        count++;
+    }
+    return count;
+}
+
+void sel4utils_vspace_get_stats(vspace_t *vspace, sel4utils_vspace_stats_t *stats)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    memset(stats, 0, sizeof(*stats));
+    reservation_stats(data->reservation_root, stats);
+    if (data->top_level != NULL) {
+        level_stats((uintptr_t)data->top_level, VSPACE_NUM_LEVELS - 1, stats);
+    }
+    /* compact levels are carved out of whole pages, count the pages */
+    stats->bookkeeping_bytes += count_pages(data->compact_level_pages) * PAGE_SIZE_4K;
+    stats->bookkeeping_bytes += count_pages(data->free_range_pages) * PAGE_SIZE_4K;
+    free_range_stats(vspace, &stats->free_ranges, &stats->largest_free_range);
+}
+
+void sel4utils_vspace_stats_scrape(void *vspace, profile_callback64 callback64, void *cookie)
+{
+    sel4utils_vspace_stats_t stats;
+    sel4utils_vspace_get_stats((vspace_t *)vspace, &stats);
+    callback64(stats.reservations, "vspace_reservations", "reservations", cookie);
+    callback64(stats.reserved_bytes, "vspace_reserved_bytes", "bytes of address space reserved", cookie);
+    callback64(stats.mapped_bytes, "vspace_mapped_bytes", "bytes of address space mapped", cookie);
+    callback64(stats.mid_levels, "vspace_mid_levels", "mid level book keeping tables", cookie);
+    callback64(stats.bottom_levels, "vspace_bottom_levels", "full bottom level book keeping tables", cookie);
+    callback64(stats.compact_levels, "vspace_compact_levels", "compact bottom level book keeping tables", cookie);
+    callback64(stats.bookkeeping_bytes, "vspace_bookkeeping_bytes", "bytes of book keeping", cookie);
+    callback64(stats.free_ranges, "vspace_free_ranges", "ranges in the free range index", cookie);
+    callback64(stats.largest_free_range, "vspace_largest_free_range", "bytes in the largest free range", cookie);
+}
@@ -15,6 +15,7 @@
 
 #include <sel4utils/vspace.h>
 #include <sel4utils/page.h>
+#include <sel4utils/page_copy.h>
 
 #include <sel4utils/vspace_internal.h>
 #include <vka/capops.h>
@@ -37,7 +38,9 @@ void *create_level(vspace_t *vspace, size_t size)
     if (level == NULL) {
         return NULL;
     }
-    memset(level, 0, size);
+    /* entries of every level share the same offsets within a cache line */
+    assert(IS_ALIGNED((uintptr_t)level, seL4_PageBits));
+    sel4utils_zero_pages(level, size);
 
     return level;
 }
@@ -56,66 +59,100 @@ static int check_reservation(vspace_mid_level_t *top_level, sel4utils_res_t *res
            is_reserved_range(top_level, start, end);
 }
 
-static void insert_reservation(sel4utils_alloc_data_t *data, sel4utils_res_t *reservation)
+/* Reservations are kept in a treap ordered by start address, ties (which can only
+ * happen with empty reservations) are broken by address of the reservation itself */
+static inline bool reservation_before(sel4utils_res_t *a, sel4utils_res_t *b)
 {
+    return a->start < b->start || (a->start == b->start && (uintptr_t)a < (uintptr_t)b);
+}
 
-    assert(data != NULL);
-    assert(reservation != NULL);
-
-    reservation->next = NULL;
+/* split t into the reservations ordered before res (l) and after it (r) */
+static void split_reservations(sel4utils_res_t *t, sel4utils_res_t *res, sel4utils_res_t **l, sel4utils_res_t **r)
+{
+    if (t == NULL) {
+        *l = NULL;
+        *r = NULL;
+    } else if (reservation_before(t, res)) {
+        split_reservations(t->right, res, &t->right, r);
+        *l = t;
+    } else {
+        split_reservations(t->left, res, l, &t->left);
+        *r = t;
+    }
+}
 
-    /* insert at head */
-    if (data->reservation_head == NULL || reservation->start > data->reservation_head->start) {
-        reservation->next = data->reservation_head;
-        data->reservation_head = reservation;
-        return;
+static sel4utils_res_t *merge_reservations(sel4utils_res_t *l, sel4utils_res_t *r)
+{
+    if (l == NULL) {
+        return r;
+    }
+    if (r == NULL) {
+        return l;
     }
+    if (l->priority > r->priority) {
+        l->right = merge_reservations(l->right, r);
+        return l;
+    }
+    r->left = merge_reservations(l, r->left);
+    return r;
+}
 
-    /* insert elsewhere */
-    sel4utils_res_t *prev = data->reservation_head;
-    sel4utils_res_t *current = prev->next;
+static void mru_insert(sel4utils_alloc_data_t *data, sel4utils_res_t *reservation)
+{
+    int i;
+    /* find ourselves, or the least recently used entry, and shuffle everything before it down */
+    for (i = 0; i < SEL4UTILS_RES_MRU_SIZE - 1 && data->reservation_mru[i] != reservation; i++);
+    for (; i > 0; i--) {
+        data->reservation_mru[i] = data->reservation_mru[i - 1];
+    }
+    data->reservation_mru[0] = reservation;
+}
 
-    while (current != NULL) {
-        /* insert in the middle */
-        if (reservation->start > current->start) {
-            reservation->next = current;
-            prev->next = reservation;
+static void mru_remove(sel4utils_alloc_data_t *data, sel4utils_res_t *reservation)
+{
+    for (int i = 0; i < SEL4UTILS_RES_MRU_SIZE; i++) {
+        if (data->reservation_mru[i] == reservation) {
+            for (; i < SEL4UTILS_RES_MRU_SIZE - 1; i++) {
+                data->reservation_mru[i] = data->reservation_mru[i + 1];
+            }
+            data->reservation_mru[SEL4UTILS_RES_MRU_SIZE - 1] = NULL;
             return;
         }
-        prev = current;
-        current = current->next;
     }
-
-    /* insert at the end */
-    prev->next = reservation;
 }
 
-static void remove_reservation(sel4utils_alloc_data_t *data, sel4utils_res_t *reservation)
+static void insert_reservation(sel4utils_alloc_data_t *data, sel4utils_res_t *reservation)
 {
-    /* remove head */
-    if (reservation == data->reservation_head) {
-        data->reservation_head = data->reservation_head->next;
-        reservation->next = NULL;
-        return;
-    }
 
-    sel4utils_res_t *prev = data->reservation_head;
-    sel4utils_res_t *current = prev->next;
+    assert(data != NULL);
+    assert(reservation != NULL);
 
-    while (current != NULL) {
-        /* remove middle */
-        if (current == reservation) {
-            prev->next = reservation->next;
-            reservation->next = NULL;
-            return;
-        }
-        prev = current;
-        current = current->next;
+    /* priorities only need to be well mixed, hashing the reservation address does that */
+    reservation->priority = (uint32_t)((uintptr_t)reservation / sizeof(*reservation)) * 2654435761u;
+
+    sel4utils_res_t **link = &data->reservation_root;
+    while (*link != NULL && (*link)->priority >= reservation->priority) {
+        link = reservation_before(reservation, *link) ? &(*link)->left : &(*link)->right;
     }
+    split_reservations(*link, reservation, &reservation->left, &reservation->right);
+    *link = reservation;
+}
+
+static void remove_reservation(sel4utils_alloc_data_t *data, sel4utils_res_t *reservation)
+{
+    mru_remove(data, reservation);
 
-    /* remove tail */
-    prev->next = NULL;
-    reservation->next = NULL;
+    sel4utils_res_t **link = &data->reservation_root;
+    while (*link != NULL && *link != reservation) {
+        link = reservation_before(reservation, *link) ? &(*link)->left : &(*link)->right;
+    }
+    if (*link == NULL) {
+        ZF_LOGE("Reservation %p not found", reservation);
+        return;
+    }
+    *link = merge_reservations(reservation->left, reservation->right);
+    reservation->left = NULL;
+    reservation->right = NULL;
 }
 
 static void perform_reservation(vspace_t *vspace, sel4utils_res_t *reservation, uintptr_t vaddr, size_t bytes,
@@ -129,6 +166,8 @@ static void perform_reservation(vspace_t *vspace, sel4utils_res_t *reservation,
 
     reservation->rights = rights;
     reservation->cacheable = cacheable;
+    reservation->lazy_cluster = 0;
+    reservation->cow = false;
 
     error = reserve_entries_range(vspace, reservation->start, reservation->end, true);
 
@@ -227,44 +266,161 @@ static int map_page(vspace_t *vspace, seL4_CPtr cap, void *vaddr, seL4_CapRights
     return data->map_page(vspace, cap, vaddr, rights, cacheable, size_bits);
 }
 
-static sel4utils_res_t *find_reserve(sel4utils_alloc_data_t *data, uintptr_t vaddr)
+/* Remembers which bottom level the last vaddr was found in, so that a run of
+ * consecutive pages only walks the tree once per bottom level */
+typedef struct bottom_level_cursor {
+    uintptr_t base;
+    uintptr_t *table;
+} bottom_level_cursor_t;
+
+/* Find the mid level entry pointing to the bottom level for vaddr. If create is set any
+ * missing levels are created, otherwise NULL is returned if there is no bottom level */
+static uintptr_t *bottom_level_lookup(vspace_t *vspace, bottom_level_cursor_t *cursor, uintptr_t vaddr, bool create)
+{
+    uintptr_t base = vaddr & ALIGN_FOR_LEVEL(1);
+    if (cursor->table != NULL && cursor->base == base) {
+        return cursor->table;
+    }
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    vspace_mid_level_t *level = data->top_level;
+    for (int i = VSPACE_NUM_LEVELS - 1; i >= 1; i--) {
+        uintptr_t *entry = &level->table[INDEX_FOR_LEVEL(vaddr, i)];
+        if (*entry == EMPTY || *entry == RESERVED) {
+            if (!create) {
+                return NULL;
+            }
+            uintptr_t next = (uintptr_t)(i == 1 ? create_bottom_level(vspace, *entry) : create_mid_level(vspace, *entry));
+            if (next == EMPTY) {
+                ZF_LOGE("Failed to allocate book keeping for %p", (void *) vaddr);
+                return NULL;
+            }
+            *entry = next;
+        }
+        if (i == 1) {
+            cursor->base = base;
+            cursor->table = entry;
+            return entry;
+        }
+        level = (vspace_mid_level_t *)*entry;
+    }
+    return NULL;
+}
+
+/* update_entries, but without the tree walk for each 4K entry. The caller is
+ * responsible for updating the free range index */
+static int update_entries_cursor(vspace_t *vspace, bottom_level_cursor_t *cursor, uintptr_t vaddr, seL4_CPtr cap,
+                                 size_t size_bits, uintptr_t cookie)
 {
+    for (uintptr_t v = vaddr; v < vaddr + BIT(size_bits); v += PAGE_SIZE_4K) {
+        uintptr_t *table = bottom_level_lookup(vspace, cursor, v, true);
+        if (table == NULL) {
+            return -1;
+        }
+        int index = INDEX_FOR_LEVEL(v, 0);
+        uintptr_t old_cap = bottom_level_get_cap(*table, index);
+        if (old_cap != RESERVED && old_cap != EMPTY) {
+            ZF_LOGE("Mapping neither reserved nor empty for vaddr %" PRIxPTR " (contains 0x%" PRIxPTR ")", v, old_cap);
+            return -1;
+        }
+        if (bottom_level_set(vspace, table, index, cap, cookie)) {
+            return -1;
+        }
+    }
+    return 0;
+}
 
-    sel4utils_res_t *current = data->reservation_head;
+/* Remember the paddr of a frame we just allocated and mapped at vaddr, so that
+ * sel4utils_get_paddr does not have to ask the allocator for it later */
+static void cache_paddr(vspace_t *vspace, bottom_level_cursor_t *cursor, uintptr_t vaddr, vka_object_t *object)
+{
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+    vka_t *vka = get_alloc_data(vspace)->vka;
+    uintptr_t paddr = vka_utspace_paddr(vka, object->ut, object->type, object->size_bits);
+    if (paddr == VKA_NO_PADDR) {
+        return;
+    }
+    for (uintptr_t v = vaddr; v < vaddr + BIT(object->size_bits); v += PAGE_SIZE_4K) {
+        uintptr_t *table = bottom_level_lookup(vspace, cursor, v, false);
+        if (table != NULL) {
+            bottom_level_set_paddr(*table, INDEX_FOR_LEVEL(v, 0), paddr);
+        }
+    }
+#endif /* CONFIG_SEL4UTILS_PADDR_CACHE */
+}
 
+static sel4utils_res_t *lookup_reserve(sel4utils_res_t *current, uintptr_t vaddr)
+{
     while (current != NULL) {
-        if (vaddr >= current->start && vaddr < current->end) {
+        if (vaddr < current->start) {
+            current = current->left;
+        } else if (vaddr < current->end) {
             return current;
+        } else {
+            /* only an empty reservation can share its start with the one we want,
+             * and that one may then be on either side */
+            if (current->start == current->end && current->left != NULL) {
+                sel4utils_res_t *res = lookup_reserve(current->left, vaddr);
+                if (res != NULL) {
+                    return res;
+                }
+            }
+            current = current->right;
         }
-
-        current = current->next;
     }
 
     return NULL;
 }
 
-static void *find_range(sel4utils_alloc_data_t *data, size_t num_pages, size_t size_bits)
+static sel4utils_res_t *find_reserve(sel4utils_alloc_data_t *data, uintptr_t vaddr)
 {
+    /* callers tend to work through the same few reservations, so try those first */
+    for (int i = 0; i < SEL4UTILS_RES_MRU_SIZE && data->reservation_mru[i] != NULL; i++) {
+        sel4utils_res_t *current = data->reservation_mru[i];
+        if (vaddr >= current->start && vaddr < current->end) {
+            if (i != 0) {
+                mru_insert(data, current);
+            }
+            return current;
+        }
+    }
+
+    sel4utils_res_t *current = lookup_reserve(data->reservation_root, vaddr);
+    if (current != NULL) {
+        mru_insert(data, current);
+    }
+    return current;
+}
+
+static void *find_range_aligned(vspace_t *vspace, size_t bytes, size_t align_bits)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
     /* look for a contiguous range that is free.
      * We use first-fit with the optimisation that we store
      * a pointer to the last thing we freed/allocated */
-    size_t contiguous = 0;
-    uintptr_t start = ALIGN_UP(data->last_allocated, SIZE_BITS_TO_BYTES(size_bits));
+    uintptr_t found;
+    if (free_range_find(vspace, data->last_allocated, bytes, align_bits, &found) == 0) {
+        if (found == 0) {
+            ZF_LOGE("Out of virtual memory");
+            return NULL;
+        }
+        data->last_allocated = found + bytes;
+        return (void *) found;
+    }
+
+    /* no index, probe the tables page by page instead */
+    uintptr_t start = ALIGN_UP(data->last_allocated, SIZE_BITS_TO_BYTES(align_bits));
     uintptr_t current = start;
 
-    assert(IS_ALIGNED(start, size_bits));
-    while (contiguous < num_pages) {
+    assert(IS_ALIGNED(start, align_bits));
+    while (current - start < bytes) {
 
-        bool available = is_available(data->top_level, current, size_bits);
-        current += SIZE_BITS_TO_BYTES(size_bits);
+        bool available = is_available(data->top_level, current, PAGE_BITS_4K);
+        current += PAGE_SIZE_4K;
 
-        if (available) {
-            /* keep going! */
-            contiguous++;
-        } else {
+        if (!available) {
             /* reset start and try again */
-            start = current;
-            contiguous = 0;
+            start = ALIGN_UP(current, SIZE_BITS_TO_BYTES(align_bits));
+            current = start;
         }
 
         if (current >= KERNEL_RESERVED_START) {
@@ -279,21 +435,30 @@ static void *find_range(sel4utils_alloc_data_t *data, size_t num_pages, size_t s
     return (void *) start;
 }
 
+static void *find_range(vspace_t *vspace, size_t num_pages, size_t size_bits)
+{
+    return find_range_aligned(vspace, num_pages * SIZE_BITS_TO_BYTES(size_bits), size_bits);
+}
+
 static int map_pages_at_vaddr(vspace_t *vspace, seL4_CPtr caps[], uintptr_t cookies[],
                               void *vaddr, size_t num_pages,
                               size_t size_bits, seL4_CapRights_t rights, int cacheable)
 {
     int error = seL4_NoError;
+    bottom_level_cursor_t cursor = { 0 };
+    uintptr_t start = (uintptr_t) vaddr;
 
     for (int i = 0; i < num_pages && error == seL4_NoError; i++) {
         error = map_page(vspace, caps[i], vaddr, rights, cacheable, size_bits);
 
         if (error == seL4_NoError) {
             uintptr_t cookie = cookies == NULL ? 0 : cookies[i];
-            error = update_entries(vspace, (uintptr_t) vaddr, caps[i], size_bits, cookie);
+            error = update_entries_cursor(vspace, &cursor, (uintptr_t) vaddr, caps[i], size_bits, cookie);
             vaddr = (void *)((uintptr_t) vaddr + (BIT(size_bits)));
         }
     }
+    /* even on failure part of the range may now be in use */
+    free_range_mark_used(vspace, start, start + num_pages * BIT(size_bits));
     return error;
 }
 
@@ -304,6 +469,7 @@ static int new_pages_at_vaddr(vspace_t *vspace, void *vaddr, size_t num_pages, s
     int i;
     int error = seL4_NoError;
     void *start_vaddr = vaddr;
+    bottom_level_cursor_t cursor = { 0 };
 
     for (i = 0; i < num_pages; i++) {
         vka_object_t object;
@@ -317,13 +483,17 @@ static int new_pages_at_vaddr(vspace_t *vspace, void *vaddr, size_t num_pages, s
         error = map_page(vspace, object.cptr, vaddr, rights, cacheable, size_bits);
 
         if (error == seL4_NoError) {
-            error = update_entries(vspace, (uintptr_t) vaddr, object.cptr, size_bits, object.ut);
+            error = update_entries_cursor(vspace, &cursor, (uintptr_t) vaddr, object.cptr, size_bits, object.ut);
+            if (error == seL4_NoError) {
+                cache_paddr(vspace, &cursor, (uintptr_t) vaddr, &object);
+            }
             vaddr = (void *)((uintptr_t) vaddr + (BIT(size_bits)));
         } else {
             vka_free_object(data->vka, &object);
             break;
         }
     }
+    free_range_mark_used(vspace, (uintptr_t) start_vaddr, (uintptr_t) vaddr);
 
     if (i < num_pages) {
         /* we failed, clean up successfully allocated pages */
@@ -396,7 +566,7 @@ void *sel4utils_map_pages(vspace_t *vspace, seL4_CPtr caps[], uintptr_t cookies[
 
     assert(num_pages > 0);
 
-    ret_vaddr = find_range(data, num_pages, size_bits);
+    ret_vaddr = find_range(vspace, num_pages, size_bits);
     if (ret_vaddr == NULL) {
         return NULL;
     }
@@ -447,39 +617,67 @@ void sel4utils_unmap_pages(vspace_t *vspace, void *vaddr, size_t num_pages, size
         vka = data->vka;
     }
 
+    bottom_level_cursor_t cursor = { 0 };
+    uintptr_t start = v;
     for (int i = 0; i < num_pages; i++) {
-        seL4_CPtr cap = get_cap(data->top_level, v);
+        uintptr_t *table = bottom_level_lookup(vspace, &cursor, v, false);
+        seL4_CPtr cap = table ? bottom_level_get_cap(*table, INDEX_FOR_LEVEL(v, 0)) : get_cap(data->top_level, v);
+        uintptr_t cookie = table ? bottom_level_get_cookie(*table, INDEX_FOR_LEVEL(v, 0)) : 0;
 
         /* unmap */
-        if (cap != 0) {
-            int error = seL4_ARCH_Page_Unmap(cap);
+        if (cap != 0 && cap != RESERVED) {
+            int error = data->objects_revoked ? seL4_NoError : seL4_ARCH_Page_Unmap(cap);
             if (error != seL4_NoError) {
                 ZF_LOGE("Failed to unmap page at vaddr %p", vaddr);
             }
-        }
 
-        if (vka) {
-            cspacepath_t path;
-            vka_cspace_make_path(vka, cap, &path);
-            vka_cnode_delete(&path);
-            vka_cspace_free(vka, cap);
-            if (sel4utils_get_cookie(vspace, vaddr)) {
-                vka_utspace_free(vka, kobject_get_type(KOBJECT_FRAME, size_bits),
-                                 size_bits, sel4utils_get_cookie(vspace, vaddr));
+            if (vka) {
+                /* even once the objects have been revoked, caps copied in from elsewhere, as
+                 * vspace_share_mem does, are not their children and are still in the slot */
+                cspacepath_t path;
+                vka_cspace_make_path(vka, cap, &path);
+                vka_cnode_delete(&path);
+                vka_cspace_free(vka, cap);
+                if (cookie) {
+                    vka_utspace_free(vka, kobject_get_type(KOBJECT_FRAME, size_bits),
+                                     size_bits, cookie);
+                }
             }
         }
 
-        if (reserve == NULL) {
-            clear_entries(vspace, v, size_bits);
-        } else {
-            reserve_entries(vspace, v, size_bits);
+        /* Nothing to do if there is no bottom level, the whole of it is already
+         * EMPTY or RESERVED, otherwise update each 4K entry the page covers */
+        for (uintptr_t entry = v; table != NULL && entry < v + BIT(size_bits); entry += PAGE_SIZE_4K) {
+            table = bottom_level_lookup(vspace, &cursor, entry, true);
+            if (table == NULL || bottom_level_set(vspace, table, INDEX_FOR_LEVEL(entry, 0),
+                                                  reserve == NULL ? EMPTY : RESERVED, 0)) {
+                ZF_LOGE("Failed to update book keeping for %p", (void *) entry);
+                break;
+            }
         }
-        assert(get_cap(data->top_level, v) != cap);
+        if (table == NULL) {
+            /* fall back to the general path, which copes with mid level entries */
+            if (reserve == NULL) {
+                clear_entries(vspace, v, size_bits);
+            } else {
+                reserve_entries(vspace, v, size_bits);
+            }
+        }
+        assert(get_cap(data->top_level, v) != cap || cap == RESERVED);
         assert(get_cookie(data->top_level, v) == 0);
 
         v += (BIT(size_bits));
         vaddr = (void *) v;
     }
+
+    if (reserve == NULL) {
+        free_range_mark_free(vspace, start, v);
+        if (start < data->last_allocated) {
+            data->last_allocated = start;
+        }
+    } else {
+        free_range_mark_used(vspace, start, v);
+    }
 }
 
 int sel4utils_new_pages_at_vaddr(vspace_t *vspace, void *vaddr, size_t num_pages,
@@ -505,7 +703,7 @@ void *sel4utils_new_pages(vspace_t *vspace, seL4_CapRights_t rights,
 
     assert(num_pages > 0);
 
-    ret_vaddr = find_range(data, num_pages, size_bits);
+    ret_vaddr = find_range(vspace, num_pages, size_bits);
     if (ret_vaddr == NULL) {
         return NULL;
     }
@@ -532,11 +730,104 @@ void *sel4utils_new_pages(vspace_t *vspace, seL4_CapRights_t rights,
     return ret_vaddr;
 }
 
+/* size of the page mapped at vaddr, frames spanning multiple 4K entries have the same
+ * cap recorded in each of them */
+static size_t mapped_page_bits(vspace_mid_level_t *top_level, uintptr_t vaddr, uintptr_t end)
+{
+    seL4_CPtr cap = get_cap(top_level, vaddr);
+    for (int i = SEL4_NUM_PAGE_SIZES - 1; i > 0; i--) {
+        size_t bits = sel4_page_sizes[i];
+        if (IS_ALIGNED(vaddr, bits) && end - vaddr >= BIT(bits) &&
+            get_cap(top_level, vaddr + BIT(bits) - PAGE_SIZE_4K) == cap) {
+            return bits;
+        }
+    }
+    return sel4_page_sizes[0];
+}
+
+void sel4utils_unmap_range(vspace_t *vspace, void *vaddr, size_t bytes, vka_t *vka)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    uintptr_t v = (uintptr_t) vaddr;
+    uintptr_t end = v + bytes;
+
+    while (v < end) {
+        seL4_CPtr cap = get_cap(data->top_level, v);
+        if (cap == EMPTY || cap == RESERVED) {
+            v += PAGE_SIZE_4K;
+            continue;
+        }
+        size_t size_bits = mapped_page_bits(data->top_level, v, end);
+        sel4utils_unmap_pages(vspace, (void *) v, 1, size_bits, vka);
+        v += BIT(size_bits);
+    }
+}
+
+void *sel4utils_new_pages_best_fit(vspace_t *vspace, seL4_CapRights_t rights, size_t bytes, bool can_use_dev)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+
+    assert(bytes > 0);
+    bytes = ROUND_UP(bytes, PAGE_SIZE_4K);
+
+    /* align the whole range for the largest frame that could fit in it, the frames
+     * in the middle can then be as large as possible */
+    size_t align_bits = sel4_page_size_bits_for_memory_region(bytes);
+    void *ret_vaddr = find_range_aligned(vspace, bytes, align_bits);
+    if (ret_vaddr == NULL) {
+        return NULL;
+    }
+
+    uintptr_t v = (uintptr_t) ret_vaddr;
+    uintptr_t end = v + bytes;
+    bottom_level_cursor_t cursor = { 0 };
+    while (v < end) {
+        int i;
+        vka_object_t object;
+        /* greedily take the largest frame that is aligned and fits, falling back to
+         * smaller frames if the allocator has none of that size */
+        for (i = SEL4_NUM_PAGE_SIZES - 1; i >= 0; i--) {
+            size_t size_bits = sel4_page_sizes[i];
+            if (IS_ALIGNED(v, size_bits) && end - v >= BIT(size_bits) &&
+                vka_alloc_frame_maybe_device(data->vka, size_bits, can_use_dev, &object) == 0) {
+                break;
+            }
+        }
+        if (i < 0) {
+            ZF_LOGE("Failed to allocate frame for %p", (void *) v);
+            break;
+        }
+        size_t size_bits = sel4_page_sizes[i];
+        /* as with sel4utils_new_pages these are always cached */
+        int error = map_page(vspace, object.cptr, (void *) v, rights, (int)true, size_bits);
+        if (error == seL4_NoError) {
+            error = update_entries(vspace, v, object.cptr, size_bits, object.ut);
+        } else {
+            vka_free_object(data->vka, &object);
+        }
+        if (error != seL4_NoError) {
+            ZF_LOGE("Failed to map frame at %p", (void *) v);
+            break;
+        }
+        cache_paddr(vspace, &cursor, v, &object);
+        v += BIT(size_bits);
+    }
+
+    if (v < end) {
+        /* we failed, clean up whatever we managed to map */
+        sel4utils_unmap_range(vspace, ret_vaddr, v - (uintptr_t) ret_vaddr, data->vka);
+        clear_entries_range(vspace, (uintptr_t) ret_vaddr, end, false);
+        return NULL;
+    }
+
+    return ret_vaddr;
+}
+
 int sel4utils_reserve_range_no_alloc_aligned(vspace_t *vspace, sel4utils_res_t *reservation,
                                              size_t size, size_t size_bits, seL4_CapRights_t rights, int cacheable, void **result)
 {
     sel4utils_alloc_data_t *data = get_alloc_data(vspace);
-    void *vaddr = find_range(data, BYTES_TO_SIZE_BITS_PAGES(size, size_bits), size_bits);
+    void *vaddr = find_range(vspace, BYTES_TO_SIZE_BITS_PAGES(size, size_bits), size_bits);
 
     if (vaddr == NULL) {
         return -1;
@@ -653,6 +944,267 @@ void sel4utils_free_reservation_by_vaddr(vspace_t *vspace, void *vaddr)
     sel4utils_free_reservation(vspace, reservation);
 }
 
+int sel4utils_reservation_set_lazy(vspace_t *vspace, reservation_t reservation, size_t cluster_pages)
+{
+    sel4utils_res_t *res = reservation_to_res(reservation);
+    if (res == NULL) {
+        ZF_LOGE("Invalid reservation");
+        return -1;
+    }
+    if (cluster_pages != 0 && (cluster_pages & (cluster_pages - 1)) != 0) {
+        ZF_LOGE("Cluster size %zu is not a power of 2", cluster_pages);
+        return -1;
+    }
+    if (cluster_pages != 0 && res->rights_deferred) {
+        ZF_LOGE("Cannot lazily map a reservation with deferred rights");
+        return -1;
+    }
+    res->lazy_cluster = cluster_pages;
+    return 0;
+}
+
+int sel4utils_lazy_fault(vspace_t *vspace, void *vaddr)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    sel4utils_res_t *res = find_reserve(data, (uintptr_t) vaddr);
+    if (res == NULL || res->lazy_cluster == 0) {
+        return -1;
+    }
+
+    uintptr_t cluster_bytes = res->lazy_cluster * PAGE_SIZE_4K;
+    uintptr_t start = MAX(ROUND_DOWN((uintptr_t) vaddr, cluster_bytes), res->start);
+    uintptr_t end = MIN(start + cluster_bytes, res->end);
+    uintptr_t fault_page = ROUND_DOWN((uintptr_t) vaddr, PAGE_SIZE_4K);
+
+    /* A fault on a page that is already mapped, such as a write to a read only or copy on
+     * write page, is not ours and is left to the next handler */
+    if (get_cap(data->top_level, fault_page) != RESERVED) {
+        return -1;
+    }
+    /* the page that faulted must be mapped, the rest of the cluster is only an optimisation */
+    if (new_pages_at_vaddr(vspace, (void *) fault_page, 1, seL4_PageBits, res->rights, res->cacheable, false)) {
+        ZF_LOGE("Failed to populate lazy page at %p", (void *) fault_page);
+        return -1;
+    }
+
+    for (uintptr_t v = start; v < end; v += PAGE_SIZE_4K) {
+        if (get_cap(data->top_level, v) != RESERVED) {
+            /* already populated */
+            continue;
+        }
+        if (new_pages_at_vaddr(vspace, (void *) v, 1, seL4_PageBits, res->rights, res->cacheable, false)) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Map num consecutive frames of size_bits at vaddr, with the cslots for all of them
+ * allocated at once. Each frame is retyped on its own, so that it has its own cookie and
+ * can be unmapped and freed like any other. Returns the number of frames mapped. */
+static size_t populate_run(vspace_t *vspace, sel4utils_res_t *res, uintptr_t vaddr, size_t num,
+                           size_t size_bits, bool can_use_dev)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    seL4_CPtr slots[SEL4UTILS_POPULATE_BATCH];
+    bottom_level_cursor_t cursor = { 0 };
+    size_t i;
+    /* first slot of those left unused */
+    size_t unused = 0;
+
+    assert(num <= SEL4UTILS_POPULATE_BATCH);
+    if (vka_cspace_alloc_n(data->vka, num, slots) != 0) {
+        return 0;
+    }
+
+    for (i = 0; i < num; i++) {
+        uintptr_t v = vaddr + i * BIT(size_bits);
+        vka_object_t object = {
+            .cptr = slots[i],
+            .type = kobject_get_type(KOBJECT_FRAME, size_bits),
+            .size_bits = size_bits,
+        };
+        cspacepath_t path;
+        vka_cspace_make_path(data->vka, slots[i], &path);
+        if (vka_utspace_alloc_maybe_device(data->vka, &path, object.type, size_bits, can_use_dev, &object.ut)) {
+            break;
+        }
+
+        int error = map_page(vspace, object.cptr, (void *) v, res->rights, res->cacheable, size_bits);
+        if (error == seL4_NoError) {
+            error = update_entries_cursor(vspace, &cursor, v, object.cptr, size_bits, object.ut);
+            if (error != seL4_NoError) {
+                seL4_ARCH_Page_Unmap(object.cptr);
+                reserve_entries(vspace, v, size_bits);
+            }
+        }
+        if (error != seL4_NoError) {
+            ZF_LOGE("Failed to map frame at %p", (void *) v);
+            /* the slot goes with the object */
+            vka_free_object(data->vka, &object);
+            unused++;
+            break;
+        }
+        cache_paddr(vspace, &cursor, v, &object);
+    }
+
+    unused += i;
+    if (unused < num) {
+        vka_cspace_free_n(data->vka, num - unused, &slots[unused]);
+    }
+    free_range_mark_used(vspace, vaddr, vaddr + i * BIT(size_bits));
+    return i;
+}
+
+int sel4utils_populate(vspace_t *vspace, void *vaddr, size_t bytes, int flags)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    uintptr_t start = ROUND_DOWN((uintptr_t) vaddr, PAGE_SIZE_4K);
+    uintptr_t end = ROUND_UP((uintptr_t) vaddr + bytes, PAGE_SIZE_4K);
+    sel4utils_res_t *res = find_reserve(data, start);
+    bool can_use_dev = flags & SEL4UTILS_POPULATE_DEVICE;
+
+    if (res == NULL || !check_reservation_bounds(res, start, end)) {
+        ZF_LOGE("Range %p of %zu bytes is not in one reservation", vaddr, bytes);
+        return -1;
+    }
+    if (res->rights_deferred) {
+        ZF_LOGE("Cannot populate a reservation with deferred rights");
+        return -1;
+    }
+
+    /* largest frame size to try, lowered for the rest of the range once the allocator
+     * has run out of frames of a size */
+    int max_size = (flags & SEL4UTILS_POPULATE_LARGE_PAGES) ? SEL4_NUM_PAGE_SIZES - 1 : 0;
+    uintptr_t v = start;
+    while (v < end) {
+        if (get_cap(data->top_level, v) != RESERVED) {
+            /* already populated */
+            v += PAGE_SIZE_4K;
+            continue;
+        }
+
+        /* the largest frame that is aligned, fits, and covers nothing already mapped */
+        int i;
+        for (i = max_size; i > 0; i--) {
+            size_t bits = sel4_page_sizes[i];
+            if (IS_ALIGNED(v, bits) && end - v >= BIT(bits) && is_reserved_range(data->top_level, v, v + BIT(bits))) {
+                break;
+            }
+        }
+        size_t size_bits = sel4_page_sizes[i];
+
+        /* and as many more of them straight after as fit in a batch */
+        size_t num = 1;
+        while (num < SEL4UTILS_POPULATE_BATCH && (end - v) >> size_bits > num &&
+               is_reserved_range(data->top_level, v + num * BIT(size_bits), v + (num + 1) * BIT(size_bits))) {
+            num++;
+        }
+
+        size_t mapped = populate_run(vspace, res, v, num, size_bits, can_use_dev);
+        if (mapped == 0) {
+            if (i == 0) {
+                ZF_LOGE("Failed to populate page at %p", (void *) v);
+                return -1;
+            }
+            max_size = i - 1;
+            continue;
+        }
+        v += mapped * BIT(size_bits);
+    }
+
+    return 0;
+}
+
+/* size of the frame cap mapped at page, in res, and where the frame starts */
+static size_t frame_bits(sel4utils_alloc_data_t *data, sel4utils_res_t *res, uintptr_t page, seL4_CPtr cap,
+                         uintptr_t *base)
+{
+    for (int i = SEL4_NUM_PAGE_SIZES - 1; i > 0; i--) {
+        uintptr_t candidate = ROUND_DOWN(page, BIT(sel4_page_sizes[i]));
+        if (candidate >= res->start && get_cap(data->top_level, candidate) == cap &&
+            mapped_page_bits(data->top_level, candidate, res->end) == sel4_page_sizes[i]) {
+            *base = candidate;
+            return sel4_page_sizes[i];
+        }
+    }
+    *base = ROUND_DOWN(page, PAGE_SIZE_4K);
+    return seL4_PageBits;
+}
+
+/* whether the frame cap mapped at page, in res, is larger than 4K */
+static bool in_large_frame(sel4utils_alloc_data_t *data, sel4utils_res_t *res, uintptr_t page, seL4_CPtr cap)
+{
+    uintptr_t base;
+    return frame_bits(data, res, page, cap, &base) != seL4_PageBits;
+}
+
+seL4_CPtr sel4utils_get_frame(vspace_t *vspace, void *vaddr, size_t *size_bits, bool *private_write)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    uintptr_t page = ROUND_DOWN((uintptr_t) vaddr, PAGE_SIZE_4K);
+    sel4utils_res_t *res = find_reserve(data, page);
+    seL4_CPtr cap = get_cap(data->top_level, page);
+
+    if (res == NULL || cap == EMPTY || cap == RESERVED) {
+        return seL4_CapNull;
+    }
+    uintptr_t base;
+    *size_bits = frame_bits(data, res, page, cap, &base);
+    /* shared copy on write frames are still those of the vspace they were cloned from, and
+     * without write rights the frame may be shared read only, as the elf cache does */
+    *private_write = !res->rights_deferred && seL4_CapRights_get_capAllowWrite(res->rights) &&
+                     !(res->cow && get_cookie(data->top_level, page) == 0);
+    return cap;
+}
+
+int sel4utils_remap_page(vspace_t *vspace, void *vaddr, bool read_only)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    uintptr_t page = (uintptr_t) vaddr;
+    sel4utils_res_t *res = find_reserve(data, page);
+    seL4_CPtr cap = get_cap(data->top_level, page);
+
+    if (!IS_ALIGNED(page, PAGE_BITS_4K) || res == NULL || res->rights_deferred || cap == EMPTY || cap == RESERVED) {
+        ZF_LOGE("No page with known rights mapped at %p", vaddr);
+        return -1;
+    }
+    if (in_large_frame(data, res, page, cap)) {
+        ZF_LOGE("Page at %p is part of a larger frame", vaddr);
+        return -1;
+    }
+
+    /* mapping a frame again where it is already mapped, or where it was hidden, only
+     * changes its rights */
+    seL4_CapRights_t rights = read_only ? seL4_CapRights_new(false, false, true, false) : res->rights;
+    return map_page(vspace, cap, vaddr, rights, res->cacheable, seL4_PageBits);
+}
+
+int sel4utils_hide_page(vspace_t *vspace, void *vaddr)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    uintptr_t page = (uintptr_t) vaddr;
+    sel4utils_res_t *res = find_reserve(data, page);
+    seL4_CPtr cap = get_cap(data->top_level, page);
+
+    if (!IS_ALIGNED(page, PAGE_BITS_4K) || res == NULL || cap == EMPTY || cap == RESERVED) {
+        return -1;
+    }
+    /* remapping would give shared copy on write frames the rights of the reservation */
+    if (res->rights_deferred || (res->cow && get_cookie(data->top_level, page) == 0) ||
+        data->objects_revoked || in_large_frame(data, res, page, cap)) {
+        return 1;
+    }
+
+    int error = seL4_ARCH_Page_Unmap(cap);
+    if (error != seL4_NoError) {
+        ZF_LOGE("Failed to unmap page at %p", vaddr);
+        return 1;
+    }
+    return 0;
+}
+
 int sel4utils_move_resize_reservation(vspace_t *vspace, reservation_t reservation, void *vaddr,
                                       size_t bytes)
 {
@@ -698,17 +1250,17 @@ int sel4utils_move_resize_reservation(vspace_t *vspace, reservation_t reservatio
         }
     }
 
+    /* We may need to re-insert the reservation into the tree to keep it sorted by start address. */
     bool need_reinsert = false;
     if (res->start != new_start) {
         need_reinsert = true;
+        remove_reservation(data, res);
     }
 
     res->start = new_start;
     res->end = new_end;
 
-    /* We may need to re-insert the reservation into the list to keep it sorted by start address. */
     if (need_reinsert) {
-        remove_reservation(data, res);
         insert_reservation(data, res);
     }
 
@@ -727,161 +1279,364 @@ static void free_page(vspace_t *vspace, vka_t *vka, uintptr_t vaddr)
     vspace_mid_level_t *level = data->top_level;
     /* see if we should free the thing here or not */
     uintptr_t cookie = get_cookie(level, vaddr);
-    int num_4k_entries = 1;
     if (cookie != 0) {
         /* walk along and see just how big this page is */
         uintptr_t test_vaddr = vaddr + PAGE_SIZE_4K;
         while (get_cookie(level, test_vaddr) == cookie) {
             test_vaddr += PAGE_SIZE_4K;
-            num_4k_entries++;
         }
-        sel4utils_unmap_pages(vspace, (void *)vaddr, 1, PAGE_BITS_4K * num_4k_entries, vka);
+        sel4utils_unmap_pages(vspace, (void *)vaddr, 1, mapped_page_bits(level, vaddr, test_vaddr), vka);
     }
 }
 
-static void free_pages_at_level(vspace_t *vspace, vka_t *vka, int table_level, uintptr_t vaddr)
+static void free_level(vspace_t *vspace, uintptr_t table, int level_num)
 {
     sel4utils_alloc_data_t *data = get_alloc_data(vspace);
-    vspace_mid_level_t *level = data->top_level;
-    /* walk down to the level that we want */
-    for (int i = VSPACE_NUM_LEVELS - 1; i > table_level && i > 1; i--) {
-        int index = INDEX_FOR_LEVEL(vaddr, i);
-        switch (level->table[index]) {
-        case RESERVED:
-        case EMPTY:
-            return;
-        }
-        level = (vspace_mid_level_t *)level->table[index];
+    if (is_compact_level(table)) {
+        /* the pages these come from are released by compact_level_destroy */
+        compact_level_free(vspace, to_compact_level(table));
+    } else {
+        vspace_unmap_pages(data->bootstrap, (void *)table,
+                           (level_num == 0 ? sizeof(vspace_bottom_level_t) : sizeof(vspace_mid_level_t)) / PAGE_SIZE_4K,
+                           PAGE_BITS_4K, VSPACE_FREE);
     }
-    if (table_level == 0) {
-        int index = INDEX_FOR_LEVEL(vaddr, 1);
-        switch (level->table[index]) {
-        case RESERVED:
-        case EMPTY:
-            return;
+}
+
+/* Free the pages and sub levels of the table in *slot, which is indexed by level_num and
+ * starts at base, from *next onwards. Returns true once nothing is left in the table, or
+ * false with *next set to where to resume if the budget ran out first */
+static bool tear_down_level(vspace_t *vspace, vka_t *vka, uintptr_t *slot, int level_num, uintptr_t base,
+                            uintptr_t *next, size_t *budget)
+{
+    for (int i = INDEX_FOR_LEVEL(MAX(*next, base), level_num); i < VSPACE_LEVEL_SIZE; i++) {
+        uintptr_t vaddr = base + i * BYTES_FOR_LEVEL(level_num);
+        if (*budget == 0) {
+            *next = vaddr;
+            return false;
         }
-        vspace_bottom_level_t *bottom = (vspace_bottom_level_t *)level->table[index];
-        index = INDEX_FOR_LEVEL(vaddr, 0);
-        if (bottom->cap[index] != EMPTY && bottom->cap[index] != RESERVED) {
-            free_page(vspace, vka, vaddr);
+        *next = MAX(*next, vaddr);
+        if (level_num == 0) {
+            /* read the level each time, unmapping can promote a compact level */
+            uintptr_t cap = bottom_level_get_cap(*slot, i);
+            if (cap != EMPTY && cap != RESERVED) {
+                free_page(vspace, vka, vaddr);
+                (*budget)--;
+            }
+            continue;
         }
-    } else {
-        int index = INDEX_FOR_LEVEL(vaddr, table_level);
-        switch (level->table[index]) {
-        case RESERVED:
-        case EMPTY:
-            return;
+        uintptr_t *entry = &((vspace_mid_level_t *)*slot)->table[i];
+        if (*entry == EMPTY || *entry == RESERVED) {
+            continue;
         }
-        /* recurse to the sub level */
-        for (int j = 0; j < VSPACE_LEVEL_SIZE; j++) {
-            free_pages_at_level(vspace, vka,
-                                table_level - 1,
-                                vaddr + j * BYTES_FOR_LEVEL(table_level - 1));
+        if (!tear_down_level(vspace, vka, entry, level_num - 1, vaddr, next, budget)) {
+            return false;
         }
-        vspace_unmap_pages(data->bootstrap, (void *)level->table[index],
-                           (table_level == 1 ? sizeof(vspace_bottom_level_t) : sizeof(vspace_mid_level_t)) / PAGE_SIZE_4K, PAGE_BITS_4K,
-                           VSPACE_FREE);
+        free_level(vspace, *entry, level_num - 1);
+        *entry = EMPTY;
+        /* the pages in the level may have used up the budget already */
+        *budget -= MIN(*budget, 1);
     }
+    return true;
 }
 
-void sel4utils_tear_down(vspace_t *vspace, vka_t *vka)
+int sel4utils_tear_down_step(vspace_t *vspace, vka_t *vka, sel4utils_tear_down_cursor_t *cursor, size_t budget)
 {
-
     sel4utils_alloc_data_t *data = get_alloc_data(vspace);
 
     if (data->bootstrap == NULL) {
         ZF_LOGE("Not implemented: sel4utils cannot currently tear down a self-bootstrapped vspace\n");
-        return;
+        return -1;
+    }
+
+    if (cursor->done) {
+        return 0;
     }
 
     if (vka == VSPACE_FREE) {
         vka = data->vka;
     }
 
+    /* nothing will search this vspace again, so stop maintaining the free range index */
+    free_range_destroy(vspace);
+
     /* free all the reservations */
-    while (data->reservation_head != NULL) {
-        reservation_t res = { .res = data->reservation_head };
+    while (data->reservation_root != NULL) {
+        if (budget == 0) {
+            return 1;
+        }
+        reservation_t res = { .res = data->reservation_root };
         sel4utils_free_reservation(vspace, res);
+        budget--;
     }
 
     /* walk each level and find any pages / large pages */
     if (data->top_level) {
-        for (int i = 0; i < BIT(VSPACE_LEVEL_BITS); i++) {
-            free_pages_at_level(vspace, vka, VSPACE_NUM_LEVELS - 1, BYTES_FOR_LEVEL(VSPACE_NUM_LEVELS - 1) * i);
+        uintptr_t top = (uintptr_t) data->top_level;
+        if (!tear_down_level(vspace, vka, &top, VSPACE_NUM_LEVELS - 1, 0, &cursor->next, &budget)) {
+            return 1;
         }
         vspace_unmap_pages(data->bootstrap, data->top_level, sizeof(vspace_mid_level_t) / PAGE_SIZE_4K, PAGE_BITS_4K,
                            VSPACE_FREE);
+        data->top_level = NULL;
     }
+    compact_level_destroy(vspace);
+    cursor->done = true;
+    return 0;
 }
 
-int sel4utils_share_mem_at_vaddr(vspace_t *from, vspace_t *to, void *start, int num_pages,
-                                 size_t size_bits, void *vaddr, reservation_t reservation)
+void sel4utils_tear_down(vspace_t *vspace, vka_t *vka)
+{
+    sel4utils_tear_down_cursor_t cursor = { 0 };
+    sel4utils_tear_down_step(vspace, vka, &cursor, SIZE_MAX);
+}
+
+/* number of destination slots share_range allocates at once */
+#define SHARE_SLOT_BATCH 64
+
+/* Copy the frame caps backing [start, start + bytes) in from and map them at vaddr in to
+ * with rights. If size_bits is 0 each frame is shared at the size it is mapped with in from,
+ * otherwise the frames are all assumed to be size_bits. The number of bytes successfully
+ * shared is returned in done */
+static int share_range(vspace_t *from, vspace_t *to, uintptr_t start, size_t bytes, size_t size_bits,
+                       uintptr_t vaddr, sel4utils_res_t *res, seL4_CapRights_t rights, size_t *done)
 {
     int error = 0; /* no error */
     sel4utils_alloc_data_t *from_data = get_alloc_data(from);
     sel4utils_alloc_data_t *to_data = get_alloc_data(to);
-    cspacepath_t from_path, to_path;
-    int page;
-    sel4utils_res_t *res = reservation_to_res(reservation);
-
-    if (!sel4_valid_size_bits(size_bits)) {
-        ZF_LOGE("Invalid size bits %zu", size_bits);
-        return -1;
-    }
+    bottom_level_cursor_t from_cursor = { 0 };
+    bottom_level_cursor_t to_cursor = { 0 };
+    seL4_CPtr slots[SHARE_SLOT_BATCH];
+    size_t num_slots = 0;
+    size_t next_slot = 0;
+    size_t offset = 0;
 
-    /* go through, page by page, and duplicate the page cap into the to cspace and
-     * map it into the to vspace */
-    size_t size_bytes = 1 << size_bits;
-    for (page = 0; page < num_pages; page++) {
-        uintptr_t from_vaddr = (uintptr_t) start + page * size_bytes;
-        uintptr_t to_vaddr = (uintptr_t) vaddr + (uintptr_t) page * size_bytes;
+    while (offset < bytes) {
+        uintptr_t from_vaddr = start + offset;
+        uintptr_t to_vaddr = vaddr + offset;
 
         /* get the frame cap to be copied */
-        seL4_CPtr cap = get_cap(from_data->top_level, from_vaddr);
-        if (cap == seL4_CapNull) {
+        uintptr_t *table = bottom_level_lookup(from, &from_cursor, from_vaddr, false);
+        seL4_CPtr cap = table ? bottom_level_get_cap(*table, INDEX_FOR_LEVEL(from_vaddr, 0)) : seL4_CapNull;
+        if (cap == seL4_CapNull || cap == RESERVED) {
             ZF_LOGE("Cap not present in from vspace to copy, vaddr %"PRIuPTR, from_vaddr);
             error = -1;
             break;
         }
 
-        /* create a path to the cap */
-        vka_cspace_make_path(from_data->vka, cap, &from_path);
-
-        /* allocate a path to put the copy in the destination */
-        error = vka_cspace_alloc_path(to_data->vka, &to_path);
-        if (error) {
-            ZF_LOGE("Failed to allocate slot in to cspace, error: %d", error);
+        size_t frame_bits = size_bits ? size_bits : mapped_page_bits(from_data->top_level, from_vaddr, start + bytes);
+        if (!IS_ALIGNED(to_vaddr, frame_bits)) {
+            ZF_LOGE("Target vaddr %"PRIuPTR" not aligned for frame of size bits %zu", to_vaddr, frame_bits);
+            error = -1;
             break;
         }
 
+        /* allocate slots to put the copies in the destination a batch at a time */
+        if (next_slot == num_slots) {
+            num_slots = MAX(MIN(SHARE_SLOT_BATCH, (bytes - offset) >> frame_bits), 1);
+            next_slot = 0;
+            error = vka_cspace_alloc_n(to_data->vka, num_slots, slots);
+            if (error) {
+                ZF_LOGE("Failed to allocate slot in to cspace, error: %d", error);
+                num_slots = 0;
+                break;
+            }
+        }
+
+        cspacepath_t from_path, to_path;
+        vka_cspace_make_path(from_data->vka, cap, &from_path);
+        vka_cspace_make_path(to_data->vka, slots[next_slot], &to_path);
+
         /* copy the frame cap into the to cspace */
-        error = vka_cnode_copy(&to_path, &from_path, res->rights);
+        error = vka_cnode_copy(&to_path, &from_path, rights);
         if (error) {
             ZF_LOGE("Failed to copy cap, error %d\n", error);
             break;
         }
 
         /* now finally map the page */
-        error = map_page(to, to_path.capPtr, (void *) to_vaddr, res->rights, res->cacheable, size_bits);
+        error = map_page(to, to_path.capPtr, (void *) to_vaddr, rights, res->cacheable, frame_bits);
         if (error) {
             ZF_LOGE("Failed to map page into target vspace at vaddr %"PRIuPTR, to_vaddr);
+            vka_cnode_delete(&to_path);
             break;
         }
 
-        update_entries(to, to_vaddr, to_path.capPtr, size_bits, 0);
+        next_slot++;
+        update_entries_cursor(to, &to_cursor, to_vaddr, to_path.capPtr, frame_bits, 0);
+        offset += BIT(frame_bits);
+    }
+
+    /* give back any slots we did not get to use */
+    if (next_slot < num_slots) {
+        vka_cspace_free_n(to_data->vka, num_slots - next_slot, &slots[next_slot]);
     }
+    free_range_mark_used(to, vaddr, vaddr + offset);
 
+    *done = offset;
+    return error;
+}
+
+int sel4utils_share_mem_at_vaddr(vspace_t *from, vspace_t *to, void *start, int num_pages,
+                                 size_t size_bits, void *vaddr, reservation_t reservation)
+{
+    if (!sel4_valid_size_bits(size_bits)) {
+        ZF_LOGE("Invalid size bits %zu", size_bits);
+        return -1;
+    }
+
+    size_t done;
+    sel4utils_res_t *res = reservation_to_res(reservation);
+    int error = share_range(from, to, (uintptr_t) start, (size_t) num_pages * BIT(size_bits), size_bits,
+                            (uintptr_t) vaddr, res, res->rights, &done);
     if (error) {
         /* we didn't finish, undo any pages we did map */
-        vspace_unmap_pages(to, vaddr, page, size_bits, VSPACE_FREE);
+        vspace_unmap_pages(to, vaddr, done >> size_bits, size_bits, VSPACE_FREE);
+    }
+
+    return error;
+}
+
+int sel4utils_share_range_at_vaddr(vspace_t *from, vspace_t *to, void *start, size_t bytes, void *vaddr,
+                                   reservation_t reservation)
+{
+    if (!IS_ALIGNED((uintptr_t) start, PAGE_BITS_4K) || !IS_ALIGNED(bytes, PAGE_BITS_4K)) {
+        ZF_LOGE("Range to share must be 4K aligned");
+        return -1;
+    }
+
+    size_t done;
+    sel4utils_res_t *res = reservation_to_res(reservation);
+    int error = share_range(from, to, (uintptr_t) start, bytes, 0, (uintptr_t) vaddr, res, res->rights, &done);
+    if (error) {
+        sel4utils_unmap_range(to, vaddr, done, VSPACE_FREE);
     }
 
     return error;
 }
 
+int sel4utils_cow_clone_range(vspace_t *from, vspace_t *to, void *start, size_t bytes, reservation_t reservation)
+{
+    sel4utils_res_t *res = reservation_to_res(reservation);
+    uintptr_t v = (uintptr_t) start;
+
+    if (!IS_ALIGNED(v, PAGE_BITS_4K) || !IS_ALIGNED(bytes, PAGE_BITS_4K)) {
+        ZF_LOGE("Range to clone must be 4K aligned");
+        return -1;
+    }
+    if (v < res->start || v + bytes > res->end || res->rights_deferred) {
+        ZF_LOGE("Range to clone must be inside a reservation with known rights");
+        return -1;
+    }
+
+    /* everything is shared read only to start with, writes then fault into sel4utils_cow_fault */
+    size_t done;
+    res->cow = true;
+    int error = share_range(from, to, v, bytes, 0, v, res, seL4_CapRights_new(false, false, true, false), &done);
+    if (error) {
+        sel4utils_unmap_range(to, start, done, VSPACE_FREE);
+    }
+
+    return error;
+}
+
+int sel4utils_cow_fault(vspace_t *current, vspace_t *vspace, void *vaddr)
+{
+    sel4utils_alloc_data_t *data = get_alloc_data(vspace);
+    sel4utils_res_t *res = find_reserve(data, (uintptr_t) vaddr);
+    if (res == NULL || !res->cow) {
+        return -1;
+    }
+
+    /* pages that have already been copied (or were never shared) have a cookie of their own */
+    uintptr_t page = ROUND_DOWN((uintptr_t) vaddr, PAGE_SIZE_4K);
+    seL4_CPtr shared = get_cap(data->top_level, page);
+    if (shared == EMPTY || shared == RESERVED || get_cookie(data->top_level, page) != 0) {
+        return -1;
+    }
+
+    /* find the whole frame that was shared */
+    uintptr_t base;
+    size_t size_bits = frame_bits(data, res, page, shared, &base);
+
+    vka_object_t object;
+    if (vka_alloc_frame(data->vka, size_bits, &object)) {
+        ZF_LOGE("Failed to allocate frame to copy %p", (void *) base);
+        return -1;
+    }
+
+    /* map the shared frame and its replacement into the current vspace and copy the data */
+    vka_t *current_vka = get_alloc_data(current)->vka;
+    seL4_CPtr slots[2];
+    if (vka_cspace_alloc_n(current_vka, ARRAY_SIZE(slots), slots)) {
+        vka_free_object(data->vka, &object);
+        return -1;
+    }
+    cspacepath_t src_copy, dest_copy, src, dest;
+    vka_cspace_make_path(current_vka, slots[0], &src_copy);
+    vka_cspace_make_path(current_vka, slots[1], &dest_copy);
+    vka_cspace_make_path(data->vka, shared, &src);
+    vka_cspace_make_path(data->vka, object.cptr, &dest);
+
+    int error = vka_cnode_copy(&src_copy, &src, seL4_CapRights_new(false, false, true, false));
+    if (!error) {
+        error = vka_cnode_copy(&dest_copy, &dest, seL4_AllRights);
+    }
+    seL4_CPtr caps[] = { src_copy.capPtr, dest_copy.capPtr };
+    void *mapped = error ? NULL : vspace_map_pages(current, caps, NULL, seL4_AllRights, 2, size_bits, 1);
+    if (mapped != NULL) {
+        memcpy((void *)((uintptr_t) mapped + BIT(size_bits)), mapped, BIT(size_bits));
+#ifdef CONFIG_ARCH_ARM
+        seL4_ARM_Page_Unify_Instruction(dest_copy.capPtr, 0, BIT(size_bits));
+#elif CONFIG_ARCH_RISCV
+        /* Ensure that the writes to memory that may be executed become visible */
+        asm volatile("fence.i" ::: "memory");
+#endif
+        vspace_unmap_pages(current, mapped, 2, size_bits, VSPACE_PRESERVE);
+    } else {
+        ZF_LOGE("Failed to map frames to copy %p", (void *) base);
+        error = -1;
+    }
+    vka_cnode_delete(&src_copy);
+    vka_cnode_delete(&dest_copy);
+    vka_cspace_free(current_vka, slots[0]);
+    vka_cspace_free(current_vka, slots[1]);
+    if (error) {
+        vka_free_object(data->vka, &object);
+        return -1;
+    }
+
+    /* swap the shared frame out for our private copy */
+    sel4utils_unmap_pages(vspace, (void *) base, 1, size_bits, data->vka);
+    error = map_page(vspace, object.cptr, (void *) base, res->rights, res->cacheable, size_bits);
+    if (!error) {
+        error = update_entries(vspace, base, object.cptr, size_bits, object.ut);
+    }
+    if (error) {
+        /* the shared frame is already gone, so the faulter cannot be resumed */
+        ZF_LOGE("Failed to map private copy at %p", (void *) base);
+        vka_free_object(data->vka, &object);
+        return -1;
+    }
+    bottom_level_cursor_t cursor = { 0 };
+    cache_paddr(vspace, &cursor, base, &object);
+
+    return 0;
+}
+
 uintptr_t sel4utils_get_paddr(vspace_t *vspace, void *vaddr, seL4_Word type, seL4_Word size_bits)
 {
     vka_t *vka = get_alloc_data(vspace)->vka;
-    return vka_utspace_paddr(vka, vspace_get_cookie(vspace, vaddr), type, size_bits);
-
+    bottom_level_cursor_t cursor = { 0 };
+    uintptr_t *table = bottom_level_lookup(vspace, &cursor, (uintptr_t) vaddr, false);
+    if (table == NULL) {
+        return vka_utspace_paddr(vka, 0, type, size_bits);
+    }
+    int index = INDEX_FOR_LEVEL((uintptr_t) vaddr, 0);
+#ifdef CONFIG_SEL4UTILS_PADDR_CACHE
+    uintptr_t paddr = bottom_level_get_paddr(*table, index);
+    if (paddr != 0) {
+        return paddr;
+    }
+#endif
+    return vka_utspace_paddr(vka, bottom_level_get_cookie(*table, index), type, size_bits);
 }
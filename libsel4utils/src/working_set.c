@@ -0,0 +1,288 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sel4utils/working_set.h>
+#include <sel4utils/vspace.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/util.h>
+#include "lock_internal.h"
+
+/* sample attempts per page that can be sampled, so that sparse ranges still fill a sample */
+#define WORKING_SET_ATTEMPTS 4
+
+/* xorshift64* */
+static uint64_t ws_random(sel4utils_working_set_t *ws)
+{
+    uint64_t x = ws->random;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    ws->random = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+/* vaddr of the nth 4K page of all the ranges */
+static uintptr_t ws_page(sel4utils_working_set_t *ws, size_t n)
+{
+    for (size_t i = 0; i < ws->num_ranges; i++) {
+        size_t pages = (ws->ranges[i].end - ws->ranges[i].start) / PAGE_SIZE_4K;
+        if (n < pages) {
+            return ws->ranges[i].start + n * PAGE_SIZE_4K;
+        }
+        n -= pages;
+    }
+    assert(!"page beyond the ranges");
+    return 0;
+}
+
+static int ws_page_cmp(const void *a, const void *b)
+{
+    uintptr_t va = ((const sel4utils_working_set_page_t *) a)->vaddr;
+    uintptr_t vb = ((const sel4utils_working_set_page_t *) b)->vaddr;
+    return va < vb ? -1 : va > vb;
+}
+
+static sel4utils_working_set_page_t *ws_find(sel4utils_working_set_t *ws, uintptr_t vaddr)
+{
+    sel4utils_working_set_page_t key = {
+        .vaddr = vaddr
+    };
+    return bsearch(&key, ws->pages, ws->num_pages, sizeof(ws->pages[0]), ws_page_cmp);
+}
+
+/* Add a page to the sample, which is kept sorted for ws_find */
+static void ws_insert(sel4utils_working_set_t *ws, uintptr_t vaddr)
+{
+    size_t i = ws->num_pages++;
+    for (; i > 0 && ws->pages[i - 1].vaddr > vaddr; i--) {
+        ws->pages[i] = ws->pages[i - 1];
+    }
+    ws->pages[i] = (sel4utils_working_set_page_t) {
+        .vaddr = vaddr, .touched = false
+    };
+}
+
+static void ws_remove(sel4utils_working_set_t *ws, uintptr_t vaddr)
+{
+    sel4utils_working_set_page_t *page = ws_find(ws, vaddr);
+    assert(page != NULL);
+    size_t i = page - ws->pages;
+    memmove(page, page + 1, (ws->num_pages - i - 1) * sizeof(*page));
+    ws->num_pages--;
+}
+
+static bool ws_in_ranges(const sel4utils_working_set_range_t *ranges, size_t num_ranges, uintptr_t start,
+                         uintptr_t end)
+{
+    for (size_t i = 0; i < num_ranges && start < end; i++) {
+        if (start < ranges[i].end && end > ranges[i].start) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int sel4utils_working_set_init(sel4utils_working_set_t *ws, vspace_t *vspace,
+                               const sel4utils_working_set_range_t *ranges, size_t num_ranges,
+                               sel4utils_working_set_page_t *pages, size_t max_pages, uint64_t seed)
+{
+    if (ws == NULL || vspace == NULL || (ranges == NULL && num_ranges != 0) || (pages == NULL && max_pages != 0)) {
+        ZF_LOGE("Invalid arguments to sel4utils_working_set_init");
+        return -1;
+    }
+
+    size_t total_pages = 0;
+    for (size_t i = 0; i < num_ranges; i++) {
+        if (!IS_ALIGNED(ranges[i].start | ranges[i].end, PAGE_BITS_4K) || ranges[i].end < ranges[i].start) {
+            ZF_LOGE("Range %zu is not 4K aligned", i);
+            return -1;
+        }
+        total_pages += (ranges[i].end - ranges[i].start) / PAGE_SIZE_4K;
+    }
+    /* the estimator faulting on its own book keeping would wait on itself forever */
+    if (ws_in_ranges(ranges, num_ranges, (uintptr_t) ws, (uintptr_t)(ws + 1)) ||
+        ws_in_ranges(ranges, num_ranges, (uintptr_t) ranges, (uintptr_t)(ranges + num_ranges)) ||
+        ws_in_ranges(ranges, num_ranges, (uintptr_t) pages, (uintptr_t)(pages + max_pages))) {
+        ZF_LOGE("The estimator, its ranges and its pages must not be in the ranges");
+        return -1;
+    }
+
+    *ws = (sel4utils_working_set_t) {
+        .vspace = vspace,
+        .ranges = ranges,
+        .num_ranges = num_ranges,
+        .total_pages = total_pages,
+        .pages = pages,
+        .max_pages = max_pages,
+        /* xorshift never leaves 0 */
+        .random = seed != 0 ? seed : 1,
+    };
+    return 0;
+}
+
+/* End the window in progress, if any, and update the estimates */
+static void ws_end_window(sel4utils_working_set_t *ws)
+{
+    sel4utils_lock(&ws->lock);
+    size_t num_pages = ws->num_pages;
+    size_t touched = 0;
+    if (ws->attempts == 0) {
+        sel4utils_unlock(&ws->lock);
+        return;
+    }
+    for (size_t i = 0; i < num_pages; i++) {
+        if (ws->pages[i].touched) {
+            touched++;
+        } else if (sel4utils_remap_page(ws->vspace, (void *) ws->pages[i].vaddr, false)) {
+            ZF_LOGE("Failed to map sampled page %p again", (void *) ws->pages[i].vaddr);
+        }
+    }
+
+    ws->resident_pages = ((uint64_t) ws->total_pages * ws->resident_hits) / ws->attempts;
+    /* with nothing that could be sampled, assume it is all in use */
+    ws->working_set_pages = num_pages == 0 ? ws->resident_pages :
+                            ((uint64_t) ws->resident_pages * touched) / num_pages;
+    ws->idle_pages = ws->resident_pages - ws->working_set_pages;
+    ws->windows++;
+    /* no faults are ours any more */
+    ws->num_pages = 0;
+    ws->attempts = 0;
+    ws->resident_hits = 0;
+    sel4utils_unlock(&ws->lock);
+
+    if (ws->idle_fn != NULL) {
+        for (size_t i = 0; i < num_pages; i++) {
+            if (!ws->pages[i].touched) {
+                ws->idle_fn(ws->idle_data, ws->vspace, (void *) ws->pages[i].vaddr);
+            }
+        }
+    }
+}
+
+/* Pages are hidden without the lock held, as the sampling thread could touch a page it
+ * has just hidden, and the fault would then wait on the lock forever. Each page is in the
+ * sample before it is hidden, so that a fault on it as soon as it is hidden is handled. */
+static void ws_start_window(sel4utils_working_set_t *ws)
+{
+    if (ws->total_pages == 0) {
+        return;
+    }
+
+    while (true) {
+        sel4utils_lock(&ws->lock);
+        if (ws->num_pages == ws->max_pages || ws->attempts == ws->max_pages * WORKING_SET_ATTEMPTS) {
+            sel4utils_unlock(&ws->lock);
+            return;
+        }
+        uintptr_t vaddr = ws_page(ws, ws_random(ws) % ws->total_pages);
+        ws->attempts++;
+        if (ws_find(ws, vaddr) != NULL) {
+            ws->resident_hits++;
+            sel4utils_unlock(&ws->lock);
+            continue;
+        }
+        ws_insert(ws, vaddr);
+        sel4utils_unlock(&ws->lock);
+
+        int result = sel4utils_hide_page(ws->vspace, (void *) vaddr);
+
+        sel4utils_lock(&ws->lock);
+        if (result >= 0) {
+            ws->resident_hits++;
+        }
+        if (result != 0) {
+            ws_remove(ws, vaddr);
+        }
+        sel4utils_unlock(&ws->lock);
+    }
+}
+
+void sel4utils_working_set_start(sel4utils_working_set_t *ws)
+{
+    ws_end_window(ws);
+    ws_start_window(ws);
+}
+
+void sel4utils_working_set_stop(sel4utils_working_set_t *ws)
+{
+    ws_end_window(ws);
+}
+
+int sel4utils_working_set_fault(sel4utils_working_set_t *ws, void *vaddr)
+{
+    uintptr_t page_vaddr = ROUND_DOWN((uintptr_t) vaddr, PAGE_SIZE_4K);
+    int error = -1;
+
+    sel4utils_lock(&ws->lock);
+    sel4utils_working_set_page_t *page = ws_find(ws, page_vaddr);
+    /* Mapping the page again is harmless if another thread faulted on it and had it mapped
+     * already, and the page may only be about to be hidden if it is not touched yet. */
+    if (page != NULL && sel4utils_remap_page(ws->vspace, (void *) page_vaddr, false) == 0) {
+        page->touched = true;
+        error = 0;
+    }
+    sel4utils_unlock(&ws->lock);
+    return error;
+}
+
+sel4utils_fault_result_t sel4utils_working_set_fault_fn(void *cookie, sel4utils_fault_t *fault)
+{
+    if (sel4utils_working_set_fault(cookie, fault->addr) == 0) {
+        return SEL4UTILS_FAULT_RESUME;
+    }
+    return SEL4UTILS_FAULT_UNHANDLED;
+}
+
+static void working_set_timeout(void *data)
+{
+    sel4utils_working_set_t *ws = data;
+
+    sel4utils_working_set_start(ws);
+    if (ws->report_fn != NULL) {
+        ws->report_fn(ws->report_data, ws);
+    }
+}
+
+int sel4utils_working_set_start_periodic(sel4utils_working_set_t *ws, sel4utils_time_server_t *server,
+                                         uint64_t period_ns, sel4utils_working_set_report_fn report_fn,
+                                         void *report_data)
+{
+    if (server == NULL || period_ns == 0) {
+        ZF_LOGE("Periodic working set estimation needs a time server and a period");
+        return -1;
+    }
+    sel4utils_working_set_stop_periodic(ws);
+    ws->report_fn = report_fn;
+    ws->report_data = report_data;
+    sel4utils_working_set_start(ws);
+    int error = sel4utils_timeout_set(server, &ws->timeout, period_ns, TIMEOUT_PERIODIC,
+                                      working_set_timeout, ws);
+    if (error) {
+        ZF_LOGE("Failed to set working set timeout");
+        sel4utils_working_set_stop(ws);
+        return error;
+    }
+    ws->server = server;
+    return 0;
+}
+
+void sel4utils_working_set_stop_periodic(sel4utils_working_set_t *ws)
+{
+    if (ws->server != NULL) {
+        sel4utils_timeout_cancel(ws->server, &ws->timeout);
+        ws->server = NULL;
+    }
+    sel4utils_working_set_stop(ws);
+}
+
+void sel4utils_working_set_dump(sel4utils_working_set_t *ws)
+{
+    printf("working set window %zu: %zu of %zu pages resident, %zu in the working set, %zu idle\n",
+           ws->windows, ws->resident_pages, ws->total_pages, ws->working_set_pages, ws->idle_pages);
+}
@@ -132,3 +132,58 @@ static inline int vka_untyped_retype(vka_object_t *untyped, int type, int size_b
                                num_objects);
 }
 
+
+/**
+ * Delete the caps in num slots allocated from vka and free the slots, together where the
+ * allocator supports it. Each delete is still an invocation of its own, see
+ * vka_cnode_revoke_free_n to delete caps that share a parent with one.
+ *
+ * If a delete fails, the slots before it are freed and the rest are left allocated.
+ */
+static inline int vka_cnode_delete_free_n(vka_t *vka, size_t num, const seL4_CPtr *slots)
+{
+    for (size_t i = 0; i < num; i++) {
+        cspacepath_t path;
+        vka_cspace_make_path(vka, slots[i], &path);
+        int error = vka_cnode_delete(&path);
+        if (error != seL4_NoError) {
+            vka_cspace_free_n(vka, i, slots);
+            return error;
+        }
+    }
+    vka_cspace_free_n(vka, num, slots);
+    return seL4_NoError;
+}
+
+/**
+ * Delete the caps in num consecutive slots of a cnode, starting from first, for slots that
+ * were not allocated from a vka, such as those of another process's cspace.
+ *
+ * If a delete fails, the slots before it are empty and the rest are left as they were.
+ */
+static inline int vka_cnode_delete_range(const cspacepath_t *first, size_t num)
+{
+    cspacepath_t path = *first;
+    for (size_t i = 0; i < num; i++) {
+        int error = vka_cnode_delete(&path);
+        if (error != seL4_NoError) {
+            return error;
+        }
+        path.capPtr++;
+    }
+    return seL4_NoError;
+}
+
+/**
+ * Delete every cap derived from parent, such as the objects retyped from an untyped, with
+ * a single revoke, then free the num slots they were in. parent itself is kept.
+ */
+static inline int vka_cnode_revoke_free_n(vka_t *vka, const cspacepath_t *parent, size_t num, const seL4_CPtr *slots)
+{
+    int error = vka_cnode_revoke(parent);
+    if (error != seL4_NoError) {
+        return error;
+    }
+    vka_cspace_free_n(vka, num, slots);
+    return seL4_NoError;
+}
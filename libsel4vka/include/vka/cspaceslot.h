@@ -0,0 +1,145 @@
+/*
+ * Copyright 2017, Data61, CSIRO (ABN 41 687 119 230)
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sel4/sel4.h>
+#include <vka/cspacepath_t.h>
+
+/* cspace_slot_t
+ * -------------
+ *
+ * A compact reference to one slot, for book keeping that holds many of them.
+ * A cspacepath_t is seven words, of which only capPtr, dest and offset differ
+ * between the slots of a cspace. A cspace_slot_t is the capPtr and the index of
+ * a cspace_slot_node_t in a cspace_slot_table_t that holds the rest, and is
+ * expanded back into a cspacepath_t with cspace_slot_path where it is given to
+ * the kernel.
+ *
+ * A node describes the slots of a cspace by:
+ *
+ * root:       Capability pointer to the root CNode.
+ * capDepth:   Depth of capPtr.
+ * offsetBits: Number of low bits of capPtr that are the offset into the
+ *             destination CNode. The other bits, at depth
+ *             capDepth - offsetBits, are dest. If all of capPtr is the
+ *             offset, the destination is the root itself, with dest and
+ *             destDepth 0.
+ *
+ * For the example in cspacepath_t.h, x is described by root, a capDepth of 32
+ * and an offsetBits of 4.
+ */
+
+/* Number of different cspaces a table can describe */
+#define CSPACE_SLOT_TABLE_NODES 8
+
+typedef struct cspace_slot_node {
+    seL4_CNode root;
+    seL4_Word  capDepth;
+    seL4_Word  offsetBits;
+} cspace_slot_node_t;
+
+typedef struct cspace_slot_table {
+    size_t num_nodes;
+    cspace_slot_node_t nodes[CSPACE_SLOT_TABLE_NODES];
+} cspace_slot_table_t;
+
+typedef struct cspace_slot {
+    seL4_CPtr capPtr;
+    seL4_Word node;
+} cspace_slot_t;
+
+static inline void
+cspace_slot_table_init(cspace_slot_table_t *table)
+{
+    table->num_nodes = 0;
+}
+
+static inline seL4_Word
+cspace_slot_low_bits(seL4_Word word, seL4_Word bits)
+{
+    return bits >= seL4_WordBits ? word : word & ((((seL4_Word) 1) << bits) - 1);
+}
+
+static inline seL4_Word
+cspace_slot_high_bits(seL4_Word word, seL4_Word bits)
+{
+    return bits >= seL4_WordBits ? 0 : word >> bits;
+}
+
+/*
+ * Make a compact reference to the slot of a path, adding a node to the table if
+ * none describes it yet.
+ *
+ * @param table Table to find or add the node in
+ * @param path Path to a single slot
+ * @param[out] slot The reference
+ *
+ * @return 0 on success, -1 if the path can't be described by a node or the
+ *         table is full.
+ */
+static inline int
+cspace_slot_make(cspace_slot_table_t *table, const cspacepath_t *path, cspace_slot_t *slot)
+{
+    seL4_Word offsetBits;
+    if (path->destDepth == 0) {
+        if (path->dest != 0 || path->offset != path->capPtr) {
+            return -1;
+        }
+        offsetBits = path->capDepth;
+    } else {
+        if (path->destDepth > path->capDepth) {
+            return -1;
+        }
+        offsetBits = path->capDepth - path->destDepth;
+        if (path->dest != cspace_slot_high_bits(path->capPtr, offsetBits) ||
+            path->offset != cspace_slot_low_bits(path->capPtr, offsetBits)) {
+            return -1;
+        }
+    }
+
+    size_t i;
+    for (i = 0; i < table->num_nodes; i++) {
+        cspace_slot_node_t *node = &table->nodes[i];
+        if (node->root == path->root && node->capDepth == path->capDepth && node->offsetBits == offsetBits) {
+            break;
+        }
+    }
+    if (i == table->num_nodes) {
+        if (table->num_nodes == CSPACE_SLOT_TABLE_NODES) {
+            return -1;
+        }
+        table->nodes[i] = (cspace_slot_node_t) {
+            .root = path->root, .capDepth = path->capDepth, .offsetBits = offsetBits
+        };
+        table->num_nodes++;
+    }
+
+    *slot = (cspace_slot_t) {
+        .capPtr = path->capPtr, .node = i
+    };
+    return 0;
+}
+
+/* Expand a compact reference made by cspace_slot_make back into a path */
+static inline cspacepath_t
+cspace_slot_path(const cspace_slot_table_t *table, cspace_slot_t slot)
+{
+    const cspace_slot_node_t *node = &table->nodes[slot.node];
+    bool whole = node->offsetBits == node->capDepth;
+    return (cspacepath_t) {
+        .capPtr = slot.capPtr,
+        .capDepth = node->capDepth,
+        .root = node->root,
+        .dest = whole ? 0 : cspace_slot_high_bits(slot.capPtr, node->offsetBits),
+        .destDepth = node->capDepth - node->offsetBits,
+        .offset = whole ? slot.capPtr : cspace_slot_low_bits(slot.capPtr, node->offsetBits),
+        .window = 1
+    };
+}
@@ -242,6 +242,110 @@ static inline int vka_alloc_kobject(vka_t *vka, kobject_t type, seL4_Word size_b
     return vka_alloc_object(vka, kobject_get_type(type, size_bits), size_bits, result);
 }
 
+/*
+ * Allocate num objects of the same type and size with the batch interface of the vka,
+ * which creates them all with a single retype if the allocator supports it, and with
+ * one allocation each otherwise. The objects share one untyped cookie, so they must be
+ * freed together with vka_free_objects and never with vka_free_object. On failure no
+ * objects remain allocated and result is zeroed.
+ */
+static inline int vka_alloc_objects(vka_t *vka, seL4_Word type, seL4_Word size_bits, size_t num,
+                                    vka_object_t *result)
+{
+    if (!(type < seL4_ObjectTypeCount)) {
+        ZF_LOGE("Unknown object type: %ld", (long) type);
+        memset(result, 0, sizeof(*result) * num);
+        return -1;
+    }
+    if (num == 0) {
+        return 0;
+    }
+
+    seL4_CPtr *slots = malloc(sizeof(seL4_CPtr) * num);
+    cspacepath_t *paths = malloc(sizeof(cspacepath_t) * num);
+    if (!slots || !paths) {
+        ZF_LOGE("Failed to allocate %zu paths", num);
+        free(slots);
+        free(paths);
+        memset(result, 0, sizeof(*result) * num);
+        return -1;
+    }
+
+    int error = vka_cspace_alloc_n(vka, num, slots);
+    if (unlikely(error)) {
+        ZF_LOGE("Failed to allocate %zu cslots: error %d", num, error);
+        goto out;
+    }
+    for (size_t i = 0; i < num; i++) {
+        vka_cspace_make_path(vka, slots[i], &paths[i]);
+    }
+
+    seL4_Word ut;
+    error = vka_utspace_alloc_n(vka, paths, type, size_bits, num, &ut);
+    if (unlikely(error)) {
+        ZF_LOGE("Failed to allocate %zu objects of size %lu, error %d", num, BIT(size_bits), error);
+        for (size_t i = 0; i < num; i++) {
+            vka_cspace_free(vka, slots[i]);
+        }
+        goto out;
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        result[i] = (vka_object_t) {
+            .cptr = slots[i],
+            .ut = ut,
+            .type = type,
+            .size_bits = size_bits,
+        };
+    }
+
+out:
+    if (error) {
+        /* don't return garbage to the caller */
+        memset(result, 0, sizeof(*result) * num);
+    }
+    free(paths);
+    free(slots);
+    return error;
+}
+
+/* Free all the objects allocated by one call to vka_alloc_objects */
+static inline void vka_free_objects(vka_t *vka, size_t num, vka_object_t *objects)
+{
+    if (num == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        cspacepath_t path;
+        vka_cspace_make_path(vka, objects[i].cptr, &path);
+        /* ignore any errors */
+        seL4_CNode_Delete(path.root, path.capPtr, path.capDepth);
+        vka_cspace_free(vka, objects[i].cptr);
+    }
+    vka_utspace_free_n(vka, objects[0].type, objects[0].size_bits, num, objects[0].ut);
+}
+
+static inline int vka_alloc_tcbs(vka_t *vka, size_t num, vka_object_t *result)
+{
+    return vka_alloc_objects(vka, seL4_TCBObject, seL4_TCBBits, num, result);
+}
+
+static inline int vka_alloc_endpoints(vka_t *vka, size_t num, vka_object_t *result)
+{
+    return vka_alloc_objects(vka, seL4_EndpointObject, seL4_EndpointBits, num, result);
+}
+
+static inline int vka_alloc_notifications(vka_t *vka, size_t num, vka_object_t *result)
+{
+    return vka_alloc_objects(vka, seL4_NotificationObject, seL4_NotificationBits, num, result);
+}
+
+static inline int vka_alloc_frames(vka_t *vka, uint32_t size_bits, size_t num, vka_object_t *result)
+{
+    return vka_alloc_objects(vka, kobject_get_type(KOBJECT_FRAME, size_bits), size_bits, num, result);
+}
+
 /* leaky versions of the object allocation functions - throws away the kobject_t */
 
 #define LEAKY(name) \
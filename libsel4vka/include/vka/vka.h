@@ -16,6 +16,7 @@
 #endif
 #include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <utils/util.h>
 #include <vka/cspacepath_t.h>
 
@@ -109,6 +110,56 @@ typedef void (*vka_utspace_free_fn)(void *data, seL4_Word type, seL4_Word size_b
  */
 typedef uintptr_t (*vka_utspace_paddr_fn)(void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits);
 
+/**
+ * Allocate several slots in a cspace at once. Slots are returned as consecutive
+ * cptrs (res[i] == res[0] + i) so they can be used as the destination of a single
+ * Untyped_Retype.
+ *
+ * @param data cookie for the underlying allocator
+ * @param num number of slots to allocate
+ * @param res array of num cptrs to store the allocated slots in
+ * @return 0 on success
+ */
+typedef int (*vka_cspace_alloc_n_fn)(void *data, size_t num, seL4_CPtr *res);
+
+/**
+ * Allocate num objects of the same type and size as a single allocation. Each object is
+ * placed in the corresponding slot of dest. All objects share a single cookie and must
+ * be freed together with the utspace free_n function.
+ *
+ * @param data cookie for the underlying allocator
+ * @param dest array of num paths to empty cslots to place caps to the allocated objects
+ * @param type the seL4 object type to allocate (as passed to Untyped_Retype)
+ * @param size_bits the size of the objects to allocate (as passed to Untyped_Retype)
+ * @param num number of objects to allocate
+ * @param res pointer to a location to store the cookie representing this allocation
+ * @return 0 on success
+ */
+typedef int (*vka_utspace_alloc_n_fn)(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                      size_t num, seL4_Word *res);
+
+/**
+ * Free objects allocated by the utspace alloc_n function. Is the responsibility of the
+ * caller to have already deleted all of the objects first
+ *
+ * @param data cookie for the underlying allocator
+ * @param type the seL4 object type that was allocated (as passed to Untyped_Retype)
+ * @param size_bits the size of the objects that were allocated (as passed to Untyped_Retype)
+ * @param num number of objects that were allocated
+ * @param target cookie to the allocation as given by the utspace alloc_n function
+ */
+typedef void (*vka_utspace_free_n_fn)(void *data, seL4_Word type, seL4_Word size_bits, size_t num, seL4_Word target);
+
+/**
+ * Free several cslots at once. Runs of consecutive slots, as returned by the cspace
+ * alloc_n function, are freed together.
+ *
+ * @param data cookie for the underlying allocator
+ * @param num number of slots to free
+ * @param slots array of num empty cslots allocated from this allocator
+ */
+typedef void (*vka_cspace_free_n_fn)(void *data, size_t num, const seL4_CPtr *slots);
+
 #define VKA_NO_PADDR 1
 
 /*
@@ -131,8 +182,42 @@ typedef struct vka {
     vka_cspace_free_fn cspace_free;
     vka_utspace_free_fn utspace_free;
     vka_utspace_paddr_fn utspace_paddr;
+    /* Optional batch interface. If an allocator leaves these NULL the vka_*_n
+     * wrappers below fall back to repeated single allocations */
+    vka_cspace_alloc_n_fn cspace_alloc_n;
+    vka_utspace_alloc_n_fn utspace_alloc_n;
+    vka_utspace_free_n_fn utspace_free_n;
+    vka_cspace_free_n_fn cspace_free_n;
 } vka_t;
 
+#ifdef CONFIG_LIB_VKA_STATIC_ALLOCMAN
+/* The functions of a vka made by allocman_make_vka, see allocman/vka.h. Weak so that
+ * binaries without allocman still link */
+int allocman_vka_cspace_alloc(void *data, seL4_CPtr *res) WEAK;
+void allocman_vka_cspace_make_path(void *data, seL4_CPtr slot, cspacepath_t *res) WEAK;
+void allocman_vka_cspace_free(void *data, seL4_CPtr slot) WEAK;
+int allocman_vka_utspace_alloc(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                               seL4_Word *res) WEAK;
+int allocman_vka_utspace_alloc_maybe_device(void *data, const cspacepath_t *dest, seL4_Word type,
+                                            seL4_Word size_bits, bool can_use_dev, seL4_Word *res) WEAK;
+int allocman_vka_utspace_alloc_at(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                  uintptr_t paddr, seL4_Word *res) WEAK;
+void allocman_vka_utspace_free(void *data, seL4_Word type, seL4_Word size_bits, seL4_Word target) WEAK;
+uintptr_t allocman_vka_utspace_paddr(void *data, seL4_Word target, seL4_Word type, seL4_Word size_bits) WEAK;
+int allocman_vka_cspace_alloc_n(void *data, size_t num, seL4_CPtr *res) WEAK;
+int allocman_vka_utspace_alloc_n(void *data, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                 size_t num, seL4_Word *res) WEAK;
+void allocman_vka_utspace_free_n(void *data, seL4_Word type, seL4_Word size_bits, size_t num, seL4_Word target) WEAK;
+void allocman_vka_cspace_free_n(void *data, size_t num, const seL4_CPtr *slots) WEAK;
+
+/* Call an allocman vka directly, so the call can be predicted and inlined, and any other
+ * vka through its function pointers */
+#define VKA_CALL(vka, fn, ...) \
+    (likely((vka)->fn == allocman_vka_##fn) ? allocman_vka_##fn(__VA_ARGS__) : (vka)->fn(__VA_ARGS__))
+#else
+#define VKA_CALL(vka, fn, ...) ((vka)->fn(__VA_ARGS__))
+#endif /* CONFIG_LIB_VKA_STATIC_ALLOCMAN */
+
 static inline int vka_cspace_alloc(vka_t *vka, seL4_CPtr *res)
 {
     if (!vka) {
@@ -150,7 +235,7 @@ static inline int vka_cspace_alloc(vka_t *vka, seL4_CPtr *res)
         return -1;
     }
 
-    return vka->cspace_alloc(vka->data, res);
+    return VKA_CALL(vka, cspace_alloc, vka->data, res);
 }
 
 static inline void vka_cspace_make_path(vka_t *vka, seL4_CPtr slot, cspacepath_t *res)
@@ -168,7 +253,7 @@ static inline void vka_cspace_make_path(vka_t *vka, seL4_CPtr slot, cspacepath_t
         ZF_LOGF("Unimplmented");
     }
 
-    vka->cspace_make_path(vka->data, slot, res);
+    VKA_CALL(vka, cspace_make_path, vka->data, slot, res);
 }
 
 /*
@@ -200,7 +285,32 @@ static inline void vka_cspace_free(vka_t *vka, seL4_CPtr slot)
         return;
     }
 
-    vka->cspace_free(vka->data, slot);
+    VKA_CALL(vka, cspace_free, vka->data, slot);
+}
+
+/*
+ * Free num empty slots, in one call to the allocator if it supports batch freeing and
+ * one at a time otherwise.
+ */
+static inline void vka_cspace_free_n(vka_t *vka, size_t num, const seL4_CPtr *slots)
+{
+#ifdef CONFIG_DEBUG_BUILD
+    for (size_t i = 0; i < num; i++) {
+        if (debug_cap_is_valid(slots[i])) {
+            ZF_LOGF("slot is not free: call vka_cnode_delete first");
+            /* this terminates the system */
+        }
+    }
+#endif
+
+    if (vka->cspace_free_n) {
+        VKA_CALL(vka, cspace_free_n, vka->data, num, slots);
+        return;
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        vka_cspace_free(vka, slots[i]);
+    }
 }
 
 static inline void vka_cspace_free_path(vka_t *vka, cspacepath_t path)
@@ -226,7 +336,7 @@ static inline int vka_utspace_alloc(vka_t *vka, const cspacepath_t *dest, seL4_W
         return -1;
     }
 
-    return vka->utspace_alloc(vka->data, dest, type, size_bits, res);
+    return VKA_CALL(vka, utspace_alloc, vka->data, dest, type, size_bits, res);
 }
 
 static inline int vka_utspace_alloc_maybe_device(vka_t *vka, const cspacepath_t *dest, seL4_Word type,
@@ -247,7 +357,7 @@ static inline int vka_utspace_alloc_maybe_device(vka_t *vka, const cspacepath_t
         return -1;
     }
 
-    return vka->utspace_alloc_maybe_device(vka->data, dest, type, size_bits, can_use_dev, res);
+    return VKA_CALL(vka, utspace_alloc_maybe_device, vka->data, dest, type, size_bits, can_use_dev, res);
 }
 
 static inline int vka_utspace_alloc_at(vka_t *vka, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
@@ -266,7 +376,7 @@ static inline int vka_utspace_alloc_at(vka_t *vka, const cspacepath_t *dest, seL
         return -1;
     }
 
-    return vka->utspace_alloc_at(vka->data, dest, type, size_bits, paddr, cookie);
+    return VKA_CALL(vka, utspace_alloc_at, vka->data, dest, type, size_bits, paddr, cookie);
 }
 
 static inline void vka_utspace_free(vka_t *vka, seL4_Word type, seL4_Word size_bits, seL4_Word target)
@@ -284,7 +394,7 @@ static inline void vka_utspace_free(vka_t *vka, seL4_Word type, seL4_Word size_b
         return;
     }
 
-    vka->utspace_free(vka->data, type, size_bits, target);
+    VKA_CALL(vka, utspace_free, vka->data, type, size_bits, target);
 }
 
 static inline uintptr_t vka_utspace_paddr(vka_t *vka, seL4_Word target, seL4_Word type, seL4_Word size_bits)
@@ -300,6 +410,113 @@ static inline uintptr_t vka_utspace_paddr(vka_t *vka, seL4_Word target, seL4_Wor
         return VKA_NO_PADDR;
     }
 
-    return vka->utspace_paddr(vka->data, target, type, size_bits);
+    return VKA_CALL(vka, utspace_paddr, vka->data, target, type, size_bits);
+}
+
+/*
+ * Allocate num slots. If the allocator supports batch allocation the slots are
+ * consecutive, otherwise they are allocated one at a time and may be scattered.
+ * On failure no slots remain allocated.
+ */
+static inline int vka_cspace_alloc_n(vka_t *vka, size_t num, seL4_CPtr *res)
+{
+    if (!vka) {
+        ZF_LOGE("vka is NULL");
+        return -1;
+    }
+
+    if (!res) {
+        ZF_LOGE("res is NULL");
+        return -1;
+    }
+
+    if (vka->cspace_alloc_n) {
+        return VKA_CALL(vka, cspace_alloc_n, vka->data, num, res);
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        int error = vka_cspace_alloc(vka, &res[i]);
+        if (error) {
+            while (i > 0) {
+                i--;
+                vka_cspace_free(vka, res[i]);
+            }
+            return error;
+        }
+    }
+
+    return 0;
 }
 
+/*
+ * Allocate num objects into the slots described by dest. If the allocator supports
+ * batch allocation and the slots are consecutive then all objects are created with a
+ * single Untyped_Retype and are physically contiguous. Otherwise the objects are
+ * allocated one at a time. Either way the whole allocation is described by a single
+ * cookie that must be released with vka_utspace_free_n.
+ */
+static inline int vka_utspace_alloc_n(vka_t *vka, const cspacepath_t *dest, seL4_Word type, seL4_Word size_bits,
+                                      size_t num, seL4_Word *res)
+{
+    if (!vka) {
+        ZF_LOGE("vka is NULL");
+        return -1;
+    }
+
+    if (!res || !dest) {
+        ZF_LOGE("res or dest is NULL");
+        return -1;
+    }
+
+    if (vka->utspace_alloc_n) {
+        return VKA_CALL(vka, utspace_alloc_n, vka->data, dest, type, size_bits, num, res);
+    }
+
+    /* Fallback: the cookie is an array of the individual cookies */
+    seL4_Word *cookies = malloc(sizeof(seL4_Word) * num);
+    if (!cookies) {
+        ZF_LOGE("Failed to allocate cookie array");
+        return -1;
+    }
+    for (size_t i = 0; i < num; i++) {
+        int error = vka_utspace_alloc(vka, &dest[i], type, size_bits, &cookies[i]);
+        if (error) {
+            while (i > 0) {
+                i--;
+                seL4_CNode_Delete(dest[i].root, dest[i].capPtr, dest[i].capDepth);
+                vka_utspace_free(vka, type, size_bits, cookies[i]);
+            }
+            free(cookies);
+            return error;
+        }
+    }
+    *res = (seL4_Word)cookies;
+
+    return 0;
+}
+
+static inline void vka_utspace_free_n(vka_t *vka, seL4_Word type, seL4_Word size_bits, size_t num, seL4_Word target)
+{
+    if (!vka) {
+        ZF_LOGE("vka is NULL");
+        return;
+    }
+
+    if (vka->utspace_alloc_n) {
+        if (!vka->utspace_free_n) {
+#ifndef CONFIG_LIB_VKA_ALLOW_MEMORY_LEAKS
+            ZF_LOGF("Not implemented");
+            /* This terminates the system */
+#endif
+            return;
+        }
+        VKA_CALL(vka, utspace_free_n, vka->data, type, size_bits, num, target);
+        return;
+    }
+
+    seL4_Word *cookies = (seL4_Word *)target;
+    for (size_t i = 0; i < num; i++) {
+        vka_utspace_free(vka, type, size_bits, cookies[i]);
+    }
+    free(cookies);
+}
@@ -19,13 +19,33 @@
 #define CONFIG_LIB_SEL4_VKA_DEBUG_LIVE_SLOTS_SZ 0
 #endif
 #ifndef CONFIG_LIB_SEL4_VKA_DEBUG_LIVE_OBJS_SZ
-#define CONFIG_LIB_SEL4_VKA_DEBUG_LIVE_SLOTS_SZ 0
+#define CONFIG_LIB_SEL4_VKA_DEBUG_LIVE_OBJS_SZ 0
 #endif
 
 /* Kconfig-set sizes for buffers to track live slots and objects. */
 static size_t live_slots_sz = CONFIG_LIB_SEL4_VKA_DEBUG_LIVE_SLOTS_SZ;
 static size_t live_objs_sz = CONFIG_LIB_SEL4_VKA_DEBUG_LIVE_OBJS_SZ;
 
+/* A live slot or object. For slots only key is used, and is the slot. For
+ * objects key is the cookie, and the other members are used for confirming
+ * that a caller is freeing an object in the same way they allocated it. */
+struct obj {
+    seL4_Word key;
+    seL4_Word type;
+    seL4_Word size_bits;
+};
+
+/* An open addressed hash set of live slots or objects, keyed by slot or by
+ * cookie, with 0 marking an empty entry. It holds up to limit entries in at
+ * least twice as many, so probe sequences stay short. A limit of 0 means
+ * tracking is disabled. */
+typedef struct {
+    struct obj *entries;
+    size_t mask;
+    size_t count;
+    size_t limit;
+} live_set_t;
+
 typedef struct {
 
     /* The underlying allocator that we call to effect allocations. This is
@@ -34,24 +54,11 @@ typedef struct {
      */
     vka_t *underlying;
 
-    /* Metadata related to currently live CSlots. The live_slots list contains
-     * non-null entries representing currently live CSlots. Note that these may
-     * be interspersed with null (dead) entries.
-     */
-    seL4_CPtr *live_slots;
-    size_t live_slots_sz;
+    /* Currently live CSlots. */
+    live_set_t live_slots;
 
-    /* Metadata related to currently live objects. The live_objs list contains
-     * live entries with non-0 cookie members, potentially interspersed with
-     * dead entries with 0 cookies. The other members are used for confirming
-     * that a caller is freeing an object in the same way they allocated it.
-     */
-    struct obj {
-        seL4_Word type;
-        seL4_Word size_bits;
-        seL4_Word cookie;
-    } *live_objs;
-    size_t live_objs_sz;
+    /* Currently live objects. */
+    live_set_t live_objs;
 
 } state_t;
 
@@ -68,12 +75,77 @@ typedef struct {
         fprintf(stderr, "\n"); \
     } while (0)
 
+static int live_set_init(live_set_t *set, size_t limit)
+{
+    set->entries = NULL;
+    set->mask = 0;
+    set->count = 0;
+    set->limit = limit;
+    if (limit == 0) {
+        return 0;
+    }
+
+    size_t size = 1;
+    while (size < limit * 2) {
+        size *= 2;
+    }
+    set->entries = (struct obj *)calloc(size, sizeof(struct obj));
+    if (set->entries == NULL) {
+        return -1;
+    }
+    set->mask = size - 1;
+    return 0;
+}
+
+static size_t live_set_hash(const live_set_t *set, seL4_Word key)
+{
+    /* Fibonacci hashing, as slots and cookies are often consecutive. */
+#if UINTPTR_MAX > UINT32_MAX
+    return (size_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & set->mask;
+#else
+    return (size_t)(key * UINT32_C(0x9E3779B9)) & set->mask;
+#endif
+}
+
+/* Find the entry for key, or the empty entry where it would go. */
+static struct obj *live_set_find(live_set_t *set, seL4_Word key)
+{
+    size_t i = live_set_hash(set, key);
+    while (set->entries[i].key != 0 && set->entries[i].key != key) {
+        i = (i + 1) & set->mask;
+    }
+    return &set->entries[i];
+}
+
+/* Empty an entry, moving back any later entries in its probe sequence so
+ * that lookups never have to skip over deleted entries. */
+static void live_set_remove(live_set_t *set, struct obj *entry)
+{
+    size_t hole = entry - set->entries;
+    size_t i = hole;
+
+    for (;;) {
+        i = (i + 1) & set->mask;
+        if (set->entries[i].key == 0) {
+            break;
+        }
+        size_t home = live_set_hash(set, set->entries[i].key);
+        /* Move the entry into the hole unless its home is cyclically in (hole, i]. */
+        if (((i - home) & set->mask) >= ((i - hole) & set->mask)) {
+            set->entries[hole] = set->entries[i];
+            hole = i;
+        }
+    }
+    set->entries[hole].key = 0;
+    set->count--;
+}
+
 /* Track a slot that has just become live. */
 static void track_slot(state_t *state, seL4_CPtr slot)
 {
     assert(state != NULL);
 
-    if (state->live_slots_sz == 0) {
+    if (state->live_slots.limit == 0) {
         /* Disable tracking if we have no buffer. */
         return;
     }
@@ -82,26 +154,20 @@ static void track_slot(state_t *state, seL4_CPtr slot)
         fatal("allocator attempted to hand out the null slot");
     }
 
-    /* Search the current list of live slots for this slot in case it's
-     * currently live. Pretty slow to do this on every allocate, but we're
-     * debugging so hey.
-     */
-    unsigned int available = 0;
-    for (unsigned int i = 0; i < state->live_slots_sz; i++) {
-        if (state->live_slots[i] == slot) {
-            fatal("allocator attempted to hand out slot %lu that is currently "
-                  "in use", (long)slot);
-        } else if (available == i && state->live_slots[i] != 0) {
-            available++;
-        }
+    /* Check whether this slot is currently live. */
+    struct obj *entry = live_set_find(&state->live_slots, slot);
+    if (entry->key == slot) {
+        fatal("allocator attempted to hand out slot %lu that is currently "
+              "in use", (long)slot);
     }
 
-    if (available == state->live_slots_sz) {
-        /* The entire live slot list is full. */
+    if (state->live_slots.count == state->live_slots.limit) {
+        /* The entire live slot set is full. */
         warn("ran out of space for tracking slots; disabling tracking");
-        state->live_slots_sz = 0;
+        state->live_slots.limit = 0;
     } else {
-        state->live_slots[available] = slot;
+        entry->key = slot;
+        state->live_slots.count++;
     }
 }
 
@@ -123,12 +189,15 @@ static void untrack_slot(state_t *state, seL4_CPtr slot)
 {
     assert(state != NULL);
 
-    for (unsigned int i = 0; i < state->live_slots_sz; i++) {
-        if (state->live_slots[i] == slot) {
-            /* Found it. */
-            state->live_slots[i] = 0;
-            return;
-        }
+    if (state->live_slots.limit == 0) {
+        return;
+    }
+
+    struct obj *entry = live_set_find(&state->live_slots, slot);
+    if (entry->key == slot) {
+        /* Found it. */
+        live_set_remove(&state->live_slots, entry);
+        return;
     }
     fatal("attempt to free slot %lu that was not live (double free?)", (long)slot);
 }
@@ -170,7 +239,7 @@ static void track_obj(state_t *state, seL4_Word type, seL4_Word size_bits,
 {
     assert(state != NULL);
 
-    if (state->live_objs_sz == 0) {
+    if (state->live_objs.limit == 0) {
         return;
     }
 
@@ -178,23 +247,20 @@ static void track_obj(state_t *state, seL4_Word type, seL4_Word size_bits,
         fatal("allocator attempted to hand out an object with no cookie");
     }
 
-    unsigned int available = 0;
-    for (unsigned int i = 0; i < state->live_objs_sz; i++) {
-        if (state->live_objs[i].cookie == cookie) {
-            fatal("allocator attempted to hand out an object with a cookie %zu "
-                  "that is currently in use", cookie);
-        } else if (available == i && state->live_objs[i].cookie != 0) {
-            available++;
-        }
+    struct obj *entry = live_set_find(&state->live_objs, cookie);
+    if (entry->key == cookie) {
+        fatal("allocator attempted to hand out an object with a cookie %zu "
+              "that is currently in use", cookie);
     }
 
-    if (available == state->live_objs_sz) {
+    if (state->live_objs.count == state->live_objs.limit) {
         warn("ran out of space for tracking objects; disabling tracking");
-        state->live_objs_sz = 0;
+        state->live_objs.limit = 0;
     } else {
-        state->live_objs[available].type = type;
-        state->live_objs[available].size_bits = size_bits;
-        state->live_objs[available].cookie = cookie;
+        entry->key = cookie;
+        entry->type = type;
+        entry->size_bits = size_bits;
+        state->live_objs.count++;
     }
 }
 
@@ -261,19 +327,22 @@ static void untrack_obj(state_t *state, seL4_Word type, seL4_Word size_bits,
 {
     assert(state != NULL);
 
-    for (unsigned int i = 0; i < state->live_objs_sz; i++) {
-        if (state->live_objs[i].cookie == cookie) {
-            if (state->live_objs[i].type != type) {
-                fatal("attempt to free object with type %d that was allocated "
-                      "with type %d", (int)type, (int)state->live_objs[i].type);
-            }
-            if (state->live_objs[i].size_bits != size_bits) {
-                fatal("attempt to free object with size %d that was allocated "
-                      "with size %d", (int)size_bits, (int)state->live_objs[i].size_bits);
-            }
-            state->live_objs[i].cookie = 0;
-            return;
+    if (state->live_objs.limit == 0) {
+        return;
+    }
+
+    struct obj *entry = live_set_find(&state->live_objs, cookie);
+    if (entry->key == cookie) {
+        if (entry->type != type) {
+            fatal("attempt to free object with type %d that was allocated "
+                  "with type %d", (int)type, (int)entry->type);
+        }
+        if (entry->size_bits != size_bits) {
+            fatal("attempt to free object with size %d that was allocated "
+                  "with size %d", (int)size_bits, (int)entry->size_bits);
         }
+        live_set_remove(&state->live_objs, entry);
+        return;
     }
     fatal("attempt to free object %lu that was not live (double free?)",
           (long)cookie);
@@ -302,23 +371,15 @@ int vka_init_debugvka(vka_t *vka, vka_t *tracee)
         goto fail;
     }
     s->underlying = tracee;
-    s->live_slots = NULL;
-    s->live_objs = NULL;
-
-    s->live_slots_sz = live_slots_sz;
-    if (live_slots_sz > 0) {
-        s->live_slots = (seL4_CPtr *)malloc(sizeof(seL4_CPtr) * live_slots_sz);
-        if (s->live_slots == NULL) {
-            goto fail;
-        }
+    s->live_slots.entries = NULL;
+    s->live_objs.entries = NULL;
+
+    if (live_set_init(&s->live_slots, live_slots_sz) != 0) {
+        goto fail;
     }
 
-    s->live_objs_sz = live_objs_sz;
-    if (live_objs_sz > 0) {
-        s->live_objs = (struct obj *)malloc(sizeof(struct obj) * live_objs_sz);
-        if (s->live_objs == NULL) {
-            goto fail;
-        }
+    if (live_set_init(&s->live_objs, live_objs_sz) != 0) {
+        goto fail;
     }
 
     vka->data = (void *)s;
@@ -329,16 +390,21 @@ int vka_init_debugvka(vka_t *vka, vka_t *tracee)
     vka->utspace_alloc_at = utspace_alloc_at;
     vka->cspace_free = cspace_free;
     vka->utspace_free = utspace_free;
+    /* Batch allocations go through the tracked single object functions */
+    vka->cspace_alloc_n = NULL;
+    vka->utspace_alloc_n = NULL;
+    vka->utspace_free_n = NULL;
+    vka->cspace_free_n = NULL;
 
     return 0;
 
 fail:
     if (s != NULL) {
-        if (s->live_slots != NULL) {
-            free(s->live_slots);
+        if (s->live_slots.entries != NULL) {
+            free(s->live_slots.entries);
         }
-        if (s->live_objs != NULL) {
-            free(s->live_objs);
+        if (s->live_objs.entries != NULL) {
+            free(s->live_objs.entries);
         }
         free(s);
     }
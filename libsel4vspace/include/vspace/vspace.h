@@ -494,6 +494,41 @@ struct vspace {
     void *allocated_object_cookie;
 };
 
+#ifdef CONFIG_SEL4UTILS_STATIC_VSPACE
+/* Every vspace is a sel4utils vspace, so the wrappers below call its functions directly
+ * rather than through the function pointers, and look up caps and cookies inline.
+ * These are defined by sel4utils, see sel4utils/vspace.h, included at the end */
+void *sel4utils_new_pages(vspace_t *vspace, seL4_CapRights_t rights, size_t num_pages, size_t size_bits);
+void *sel4utils_map_pages(vspace_t *vspace, seL4_CPtr caps[], uintptr_t cookies[], seL4_CapRights_t rights,
+                          size_t num_pages, size_t size_bits, int cacheable);
+int sel4utils_new_pages_at_vaddr(vspace_t *vspace, void *vaddr, size_t num_pages, size_t size_bits,
+                                 reservation_t reservation, bool can_use_dev);
+int sel4utils_map_pages_at_vaddr(vspace_t *vspace, seL4_CPtr caps[], uintptr_t cookies[], void *vaddr,
+                                 size_t num_pages, size_t size_bits, reservation_t reservation);
+int sel4utils_deferred_rights_map_pages_at_vaddr(vspace_t *vspace, seL4_CPtr caps[], uintptr_t cookies[], void *vaddr,
+                                                 size_t num_pages, size_t size_bits, seL4_CapRights_t rights,
+                                                 reservation_t reservation);
+void sel4utils_unmap_pages(vspace_t *vspace, void *vaddr, size_t num_pages, size_t size_bits, vka_t *vka);
+void sel4utils_tear_down(vspace_t *vspace, vka_t *vka);
+reservation_t sel4utils_reserve_range_aligned(vspace_t *vspace, size_t size, size_t size_bits, seL4_CapRights_t rights,
+                                              int cacheable, void **vaddr);
+reservation_t sel4utils_reserve_range_at(vspace_t *vspace, void *vaddr, size_t size,
+                                         seL4_CapRights_t rights, int cacheable);
+reservation_t sel4utils_reserve_deferred_rights_range_at(vspace_t *vspace, void *vaddr,
+                                                         size_t size, int cacheable);
+void sel4utils_free_reservation(vspace_t *vspace, reservation_t reservation);
+void sel4utils_free_reservation_by_vaddr(vspace_t *vspace, void *vaddr);
+seL4_CPtr sel4utils_get_root(vspace_t *vspace);
+int sel4utils_share_mem_at_vaddr(vspace_t *from, vspace_t *to, void *start, int num_pages,
+                                 size_t size_bits, void *vaddr, reservation_t reservation);
+static inline seL4_CPtr sel4utils_vspace_get_cap(vspace_t *vspace, void *vaddr);
+static inline uintptr_t sel4utils_vspace_get_cookie(vspace_t *vspace, void *vaddr);
+
+#define VSPACE_FN(vspace, fn) sel4utils_##fn
+#else
+#define VSPACE_FN(vspace, fn) ((vspace)->fn)
+#endif /* CONFIG_SEL4UTILS_STATIC_VSPACE */
+
 /* convenient wrappers */
 
 /**
@@ -528,7 +563,7 @@ static inline void *vspace_new_pages(vspace_t *vspace, seL4_CapRights_t rights,
         return NULL;
     }
 
-    return vspace->new_pages(vspace, rights, num_pages, size_bits);
+    return VSPACE_FN(vspace, new_pages)(vspace, rights, num_pages, size_bits);
 }
 
 /**
@@ -567,7 +602,7 @@ static inline void *vspace_map_pages(vspace_t *vspace, seL4_CPtr caps[], uintptr
         return NULL;
     }
 
-    return vspace->map_pages(vspace, caps, cookies, rights,
+    return VSPACE_FN(vspace, map_pages)(vspace, caps, cookies, rights,
                              num_pages, size_bits, cacheable);
 }
 
@@ -581,7 +616,7 @@ static inline int vspace_new_pages_at_vaddr_with_config(vspace_t *vspace, vspace
     if (res.res == NULL) {
         ZF_LOGE("reservation is required");
     }
-    return vspace->new_pages_at_vaddr(vspace, config->vaddr, config->num_pages, config->size_bits, res,
+    return VSPACE_FN(vspace, new_pages_at_vaddr)(vspace, config->vaddr, config->num_pages, config->size_bits, res,
                                       config->can_use_dev);
 }
 
@@ -631,7 +666,7 @@ static inline int vspace_map_pages_at_vaddr(vspace_t *vspace, seL4_CPtr caps[],
         return -1;
     }
 
-    return vspace->map_pages_at_vaddr(vspace, caps, cookies, vaddr, num_pages, size_bits, reservation);
+    return VSPACE_FN(vspace, map_pages_at_vaddr)(vspace, caps, cookies, vaddr, num_pages, size_bits, reservation);
 }
 
 static inline int vspace_deferred_rights_map_pages_at_vaddr(vspace_t *vspace, seL4_CPtr caps[], uintptr_t cookies[],
@@ -657,7 +692,7 @@ static inline int vspace_deferred_rights_map_pages_at_vaddr(vspace_t *vspace, se
         return -1;
     }
 
-    return vspace->deferred_rights_map_pages_at_vaddr(vspace, caps, cookies, vaddr, num_pages,
+    return VSPACE_FN(vspace, deferred_rights_map_pages_at_vaddr)(vspace, caps, cookies, vaddr, num_pages,
                                                       size_bits, rights, reservation);
 }
 
@@ -684,7 +719,7 @@ static inline void vspace_unmap_pages(vspace_t *vspace, void *vaddr, size_t num_
         return;
     }
 
-    vspace->unmap_pages(vspace, vaddr, num_pages, size_bits, vka);
+    VSPACE_FN(vspace, unmap_pages)(vspace, vaddr, num_pages, size_bits, vka);
 }
 
 static inline void vspace_tear_down(vspace_t *vspace, vka_t *vka)
@@ -698,7 +733,7 @@ static inline void vspace_tear_down(vspace_t *vspace, vka_t *vka)
         ZF_LOGE("Not implemented");
         return;
     }
-    vspace->tear_down(vspace, vka);
+    VSPACE_FN(vspace, tear_down)(vspace, vka);
 }
 
 static inline reservation_t vspace_reserve_range_aligned(vspace_t *vspace, size_t bytes, size_t size_bits,
@@ -726,7 +761,7 @@ static inline reservation_t vspace_reserve_range_aligned(vspace_t *vspace, size_
         return error;
     }
 
-    return vspace->reserve_range_aligned(vspace, bytes, size_bits, rights, cacheable, vaddr);
+    return VSPACE_FN(vspace, reserve_range_aligned)(vspace, bytes, size_bits, rights, cacheable, vaddr);
 }
 
 static inline reservation_t vspace_reserve_range_at(vspace_t *vspace, void *vaddr,
@@ -749,7 +784,7 @@ static inline reservation_t vspace_reserve_range_at(vspace_t *vspace, void *vadd
         return error;
     }
 
-    return vspace->reserve_range_at(vspace, vaddr, bytes, rights, cacheable);
+    return VSPACE_FN(vspace, reserve_range_at)(vspace, vaddr, bytes, rights, cacheable);
 }
 
 static inline reservation_t vspace_reserve_deferred_rights_range_at(vspace_t *vspace, void *vaddr,
@@ -771,7 +806,7 @@ static inline reservation_t vspace_reserve_deferred_rights_range_at(vspace_t *vs
         ZF_LOGE("Attempt to reserve 0 length range");
         return error;
     }
-    return vspace->reserve_deferred_rights_range_at(vspace, vaddr, bytes, cacheable);
+    return VSPACE_FN(vspace, reserve_deferred_rights_range_at)(vspace, vaddr, bytes, cacheable);
 }
 
 static inline void vspace_free_reservation(vspace_t *vspace, reservation_t reservation)
@@ -786,7 +821,7 @@ static inline void vspace_free_reservation(vspace_t *vspace, reservation_t reser
         return;
     }
 
-    vspace->free_reservation(vspace, reservation);
+    VSPACE_FN(vspace, free_reservation)(vspace, reservation);
 }
 
 static inline void vspace_free_reservation_by_vaddr(vspace_t *vspace, void *vaddr)
@@ -801,7 +836,7 @@ static inline void vspace_free_reservation_by_vaddr(vspace_t *vspace, void *vadd
         return;
     }
 
-    vspace->free_reservation_by_vaddr(vspace, vaddr);
+    VSPACE_FN(vspace, free_reservation_by_vaddr)(vspace, vaddr);
 }
 
 static inline seL4_CPtr vspace_get_cap(vspace_t *vspace, void *vaddr)
@@ -821,7 +856,11 @@ static inline seL4_CPtr vspace_get_cap(vspace_t *vspace, void *vaddr)
         return seL4_CapNull;
     }
 
+#ifdef CONFIG_SEL4UTILS_STATIC_VSPACE
+    return sel4utils_vspace_get_cap(vspace, vaddr);
+#else
     return vspace->get_cap(vspace, vaddr);
+#endif
 }
 
 static inline uintptr_t vspace_get_cookie(vspace_t *vspace, void *vaddr)
@@ -841,7 +880,11 @@ static inline uintptr_t vspace_get_cookie(vspace_t *vspace, void *vaddr)
         return 0;
     }
 
+#ifdef CONFIG_SEL4UTILS_STATIC_VSPACE
+    return sel4utils_vspace_get_cookie(vspace, vaddr);
+#else
     return vspace->get_cookie(vspace, vaddr);
+#endif
 }
 
 /* Helper functions */
@@ -867,7 +910,7 @@ static inline seL4_CPtr vspace_get_root(vspace_t *vspace)
         ZF_LOGE("Not implemented");
         return seL4_CapNull;
     }
-    return vspace->get_root(vspace);
+    return VSPACE_FN(vspace, get_root)(vspace);
 }
 
 static inline int vspace_share_mem_at_vaddr(vspace_t *from, vspace_t *to, void *start, int num_pages,
@@ -902,6 +945,9 @@ static inline int vspace_share_mem_at_vaddr(vspace_t *from, vspace_t *to, void *
         return -1;
     }
 
-    return from->share_mem_at_vaddr(from, to, start, num_pages, size_bits, vaddr, res);
+    return VSPACE_FN(from, share_mem_at_vaddr)(from, to, start, num_pages, size_bits, vaddr, res);
 }
 
+#ifdef CONFIG_SEL4UTILS_STATIC_VSPACE
+#include <sel4utils/vspace.h>
+#endif